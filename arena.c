@@ -0,0 +1,217 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include "arena.h"
+#include "iio-lock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_MIN_CHUNK_SIZE	4096
+#define ARENA_MAX_CHUNK_SIZE	(256 * 1024)
+
+union arena_align {
+	void *ptr;
+	long long ll;
+	long double ld;
+};
+
+#define ARENA_ALIGN	sizeof(union arena_align)
+
+struct iio_arena_chunk {
+	struct iio_arena_chunk *next;
+	size_t size, used;
+	union arena_align data[];
+};
+
+struct iio_arena_adopted {
+	struct iio_arena_adopted *next;
+	void *ptr;
+};
+
+struct iio_arena {
+	/* The chunk allocations are served from is the first one */
+	struct iio_arena_chunk *chunks;
+	size_t next_size;
+
+	struct iio_arena_adopted *adopted;
+
+	struct iio_mutex *lock;
+	unsigned int refcount;
+};
+
+struct iio_arena * iio_arena_new(void)
+{
+	struct iio_arena *arena = calloc(1, sizeof(*arena));
+
+	if (!arena)
+		return NULL;
+
+	arena->lock = iio_mutex_create();
+	if (!arena->lock) {
+		free(arena);
+		return NULL;
+	}
+
+	arena->next_size = ARENA_MIN_CHUNK_SIZE;
+	arena->refcount = 1;
+	return arena;
+}
+
+struct iio_arena * iio_arena_ref(struct iio_arena *arena)
+{
+	iio_mutex_lock(arena->lock);
+	arena->refcount++;
+	iio_mutex_unlock(arena->lock);
+
+	return arena;
+}
+
+void iio_arena_destroy(struct iio_arena *arena)
+{
+	struct iio_arena_chunk *chunk, *next;
+	struct iio_arena_adopted *adopted;
+	unsigned int refcount;
+
+	iio_mutex_lock(arena->lock);
+	refcount = --arena->refcount;
+	iio_mutex_unlock(arena->lock);
+
+	if (refcount)
+		return;
+
+	/* The list itself lives in the chunks */
+	for (adopted = arena->adopted; adopted; adopted = adopted->next)
+		free(adopted->ptr);
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	iio_mutex_destroy(arena->lock);
+	free(arena);
+}
+
+static void * arena_alloc(struct iio_arena *arena, size_t size, size_t align)
+{
+	struct iio_arena_chunk *chunk = arena->chunks;
+	size_t offset;
+
+	if (chunk) {
+		offset = (chunk->used + align - 1) & ~(align - 1);
+
+		if (offset + size <= chunk->size) {
+			chunk->used = offset + size;
+			return (char *) chunk->data + offset;
+		}
+	}
+
+	/* The chunks get larger as the arena grows; a large allocation gets
+	 * a chunk of its own, while the current one keeps serving the small
+	 * allocations */
+	if (size > arena->next_size / 4) {
+		chunk = calloc(1, sizeof(*chunk) + size);
+		if (!chunk)
+			return NULL;
+
+		chunk->size = size;
+		chunk->used = size;
+
+		if (arena->chunks) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			arena->chunks = chunk;
+		}
+
+		return chunk->data;
+	}
+
+	chunk = calloc(1, sizeof(*chunk) + arena->next_size);
+	if (!chunk)
+		return NULL;
+
+	chunk->size = arena->next_size;
+	chunk->used = size;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+
+	if (arena->next_size < ARENA_MAX_CHUNK_SIZE)
+		arena->next_size *= 2;
+
+	return chunk->data;
+}
+
+void * iio_arena_alloc(struct iio_arena *arena, size_t size)
+{
+	return arena_alloc(arena, size, ARENA_ALIGN);
+}
+
+char * iio_arena_strndup(struct iio_arena *arena, const char *str, size_t len)
+{
+	char *dst;
+
+	len = strnlen(str, len);
+
+	dst = arena_alloc(arena, len + 1, 1);
+	if (dst)
+		memcpy(dst, str, len); /* Flawfinder: ignore */
+
+	return dst;
+}
+
+char * iio_arena_strdup(struct iio_arena *arena, const char *str)
+{
+	return iio_arena_strndup(arena, str, strlen(str));
+}
+
+void * iio_arena_adopt(struct iio_arena *arena, void *ptr)
+{
+	struct iio_arena_adopted *adopted;
+
+	if (!ptr)
+		return NULL;
+
+	adopted = iio_arena_alloc(arena, sizeof(*adopted));
+	if (!adopted) {
+		free(ptr);
+		return NULL;
+	}
+
+	adopted->ptr = ptr;
+	adopted->next = arena->adopted;
+	arena->adopted = adopted;
+	return ptr;
+}
+
+void * iio_arena_grow_array(struct iio_arena *arena, void *array,
+		unsigned int nb, size_t elem_size)
+{
+	void *new_array;
+
+	/* The capacity of the arrays is doubled every time it is reached,
+	 * that is when their number of elements is a power of two */
+	if (nb & (nb - 1))
+		return array;
+
+	new_array = iio_arena_alloc(arena, (nb ? 2 * nb : 1) * elem_size);
+	if (new_array && nb)
+		memcpy(new_array, array, nb * elem_size); /* Flawfinder: ignore */
+
+	return new_array;
+}
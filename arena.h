@@ -0,0 +1,51 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#ifndef __IIO_ARENA_H__
+#define __IIO_ARENA_H__
+
+#include <stddef.h>
+
+/* Holds the description of a context: the devices, channels, and their
+ * names and attributes. The memory is allocated in large chunks, and is only
+ * released all at once when the arena is destroyed. */
+struct iio_arena;
+
+struct iio_arena * iio_arena_new(void);
+
+/* The arena is shared by the clones of a context, each one holding a
+ * reference; it is freed once the last one is destroyed. A shared arena
+ * must not be allocated from anymore. */
+struct iio_arena * iio_arena_ref(struct iio_arena *arena);
+void iio_arena_destroy(struct iio_arena *arena);
+
+/* The memory returned is zeroed */
+void * iio_arena_alloc(struct iio_arena *arena, size_t size);
+char * iio_arena_strdup(struct iio_arena *arena, const char *str);
+char * iio_arena_strndup(struct iio_arena *arena, const char *str, size_t len);
+
+/* Takes ownership of memory allocated with malloc(), freed along with the
+ * arena. Returns ptr; or NULL if out of memory, in which case ptr is freed. */
+void * iio_arena_adopt(struct iio_arena *arena, void *ptr);
+
+/* Returns the array of nb elements, moved if needed to make room for one
+ * more element. The array must only grow through this function; returns NULL
+ * if out of memory, in which case the array is left untouched. */
+void * iio_arena_grow_array(struct iio_arena *arena, void *array,
+		unsigned int nb, size_t elem_size);
+
+#endif /* __IIO_ARENA_H__ */
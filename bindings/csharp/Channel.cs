@@ -17,6 +17,9 @@
  * */
 
 using System;
+#if NETSTANDARD2_1_OR_GREATER || NETCOREAPP2_1_OR_GREATER
+using System.Buffers;
+#endif
 using System.Collections.Generic;
 using System.IO;
 using System.Linq;
@@ -307,14 +310,7 @@ namespace iio
             return iio_channel_is_enabled(this.chn);
         }
 
-        /// <summary>Extract the samples corresponding to this channel from the
-        /// given <see cref="iio.IOBuffer"/> object.</summary>
-        /// <param name="buffer">A valid instance of the <see cref="iio.IOBuffer"/> class.</param>
-        /// <param name="raw">If set to <c>true</c>, the samples are not converted from their
-        /// hardware format to their host format.</param>
-        /// <returns>A <c>byte</c> array containing the extracted samples.</returns>
-        /// <exception cref="System.Exception">The samples could not be read.</exception>
-        public byte[] read(IOBuffer buffer, bool raw = false)
+        private void check_read()
         {
             if (!is_enabled())
             {
@@ -324,25 +320,76 @@ namespace iio
             {
                 throw new Exception("Unable to read from output channel");
             }
+        }
 
-            byte[] array = new byte[(int) (buffer.samples_count * sample_size)];
-            MemoryStream stream = new MemoryStream(array, true);
-            GCHandle handle = GCHandle.Alloc(array, GCHandleType.Pinned);
-            IntPtr addr = handle.AddrOfPinnedObject();
-            uint count;
+        private void check_write()
+        {
+            if (!is_enabled())
+            {
+                throw new Exception("Channel must be enabled before the IOBuffer is instantiated");
+            }
+            if (!this.output)
+            {
+                throw new Exception("Unable to write to an input channel");
+            }
+        }
 
+        private uint read(IOBuffer buffer, IntPtr addr, uint len, bool raw)
+        {
             if (raw)
             {
-                count = iio_channel_read_raw(this.chn, buffer.buf, addr, buffer.samples_count * sample_size);
+                return iio_channel_read_raw(this.chn, buffer.buf, addr, len);
             }
-            else
+            return iio_channel_read(this.chn, buffer.buf, addr, len);
+        }
+
+        private uint write(IOBuffer buffer, IntPtr addr, uint len, bool raw)
+        {
+            if (raw)
+            {
+                return iio_channel_write_raw(this.chn, buffer.buf, addr, len);
+            }
+            return iio_channel_write(this.chn, buffer.buf, addr, len);
+        }
+
+        /// <summary>Extract the samples corresponding to this channel from the
+        /// given <see cref="iio.IOBuffer"/> object.</summary>
+        /// <param name="buffer">A valid instance of the <see cref="iio.IOBuffer"/> class.</param>
+        /// <param name="raw">If set to <c>true</c>, the samples are not converted from their
+        /// hardware format to their host format.</param>
+        /// <returns>A <c>byte</c> array containing the extracted samples.</returns>
+        /// <exception cref="System.Exception">The samples could not be read.</exception>
+        public byte[] read(IOBuffer buffer, bool raw = false)
+        {
+            byte[] array = new byte[(int) (buffer.samples_count * sample_size)];
+            uint count = read(buffer, array, raw);
+
+            if (count < array.Length)
             {
-                count = iio_channel_read(this.chn, buffer.buf, addr, buffer.samples_count * sample_size);
+                Array.Resize(ref array, (int) count);
             }
+            return array;
+        }
+
+        /// <summary>Extract the samples corresponding to this channel from the
+        /// given <see cref="iio.IOBuffer"/> object, into an existing array.</summary>
+        /// <param name="buffer">A valid instance of the <see cref="iio.IOBuffer"/> class.</param>
+        /// <param name="array">A <c>byte</c> array where the samples will be written.</param>
+        /// <param name="raw">If set to <c>true</c>, the samples are not converted from their
+        /// hardware format to their host format.</param>
+        /// <returns>The number of bytes written to the array.</returns>
+        /// <remarks>Reusing the same array for every refill avoids allocating memory on the
+        /// managed heap.</remarks>
+        /// <exception cref="System.Exception">The samples could not be read.</exception>
+        public uint read(IOBuffer buffer, byte[] array, bool raw = false)
+        {
+            check_read();
+
+            GCHandle handle = GCHandle.Alloc(array, GCHandleType.Pinned);
+            uint count = read(buffer, handle.AddrOfPinnedObject(), (uint) array.Length, raw);
             handle.Free();
-            stream.SetLength((long) count);
-            return stream.ToArray();
 
+            return count;
         }
 
         /// <summary>
@@ -356,31 +403,79 @@ namespace iio
         /// <exception cref="System.Exception">The samples could not be written.</exception>
         public uint write(IOBuffer buffer, byte[] array, bool raw = false)
         {
-            if (!is_enabled())
-            {
-                throw new Exception("Channel must be enabled before the IOBuffer is instantiated");
-            }
-            if (!this.output)
+            check_write();
+
+            GCHandle handle = GCHandle.Alloc(array, GCHandleType.Pinned);
+            uint count = write(buffer, handle.AddrOfPinnedObject(), (uint) array.Length, raw);
+            handle.Free();
+
+            return count;
+        }
+
+#if NETSTANDARD2_1_OR_GREATER || NETCOREAPP2_1_OR_GREATER
+        /// <summary>Extract the samples corresponding to this channel from the
+        /// given <see cref="iio.IOBuffer"/> object, into a span.</summary>
+        /// <param name="buffer">A valid instance of the <see cref="iio.IOBuffer"/> class.</param>
+        /// <param name="span">The memory where the samples will be written.</param>
+        /// <param name="raw">If set to <c>true</c>, the samples are not converted from their
+        /// hardware format to their host format.</param>
+        /// <returns>The number of bytes written to the span.</returns>
+        /// <exception cref="System.Exception">The samples could not be read.</exception>
+        public unsafe uint read(IOBuffer buffer, Span<byte> span, bool raw = false)
+        {
+            check_read();
+
+            fixed (byte *ptr = span)
             {
-                throw new Exception("Unable to write to an input channel");
+                return read(buffer, (IntPtr) ptr, (uint) span.Length, raw);
             }
+        }
 
-            GCHandle handle = GCHandle.Alloc(array, GCHandleType.Pinned);
-            IntPtr addr = handle.AddrOfPinnedObject();
-            uint count;
+        /// <summary>Extract the samples corresponding to this channel from the
+        /// given <see cref="iio.IOBuffer"/> object, into an array of the shared
+        /// <c>ArrayPool</c>.</summary>
+        /// <param name="buffer">A valid instance of the <see cref="iio.IOBuffer"/> class.</param>
+        /// <param name="count">The number of bytes written to the array.</param>
+        /// <param name="raw">If set to <c>true</c>, the samples are not converted from their
+        /// hardware format to their host format.</param>
+        /// <returns>An array rented from <c>ArrayPool&lt;byte&gt;.Shared</c>, which may be
+        /// larger than <paramref name="count"/>; it must be returned to the pool once used.</returns>
+        /// <exception cref="System.Exception">The samples could not be read.</exception>
+        public byte[] read_pooled(IOBuffer buffer, out uint count, bool raw = false)
+        {
+            byte[] array = ArrayPool<byte>.Shared.Rent((int) (buffer.samples_count * sample_size));
 
-            if (raw)
+            try
             {
-                count = iio_channel_write_raw(this.chn, buffer.buf, addr, (uint) array.Length);
+                count = read(buffer, array, raw);
             }
-            else
+            catch
             {
-                count = iio_channel_write(this.chn, buffer.buf, addr, (uint) array.Length);
+                ArrayPool<byte>.Shared.Return(array);
+                throw;
             }
-            handle.Free();
+            return array;
+        }
 
-            return count;
+        /// <summary>
+        /// Write the samples of the given span corresponding to this channel into the
+        /// given <see cref="iio.IOBuffer"/> object.</summary>
+        /// <param name="buffer">A valid instance of the <see cref="iio.IOBuffer"/> class.</param>
+        /// <param name="span">The memory containing the samples to write.</param>
+        /// <param name="raw">If set to <c>true</c>, the samples are not converted from their
+        /// host format to their native format.</param>
+        /// <returns>The number of bytes written.</returns>
+        /// <exception cref="System.Exception">The samples could not be written.</exception>
+        public unsafe uint write(IOBuffer buffer, ReadOnlySpan<byte> span, bool raw = false)
+        {
+            check_write();
+
+            fixed (byte *ptr = span)
+            {
+                return write(buffer, (IntPtr) ptr, (uint) span.Length, raw);
+            }
         }
+#endif
 
         /// <summary>Get the index of this channel.</summary>
         public long get_index()
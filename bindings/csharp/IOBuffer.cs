@@ -17,10 +17,12 @@
  * */
 
 using System;
+#if NETSTANDARD2_1_OR_GREATER || NETCOREAPP2_1_OR_GREATER
+using System.Buffers;
+#endif
 using System.Collections.Generic;
 using System.Linq;
 using System.Runtime.InteropServices;
-using System.Runtime.Remoting.Contexts;
 using System.Security.Authentication.ExtendedProtection;
 using System.Text;
 using System.Threading.Tasks;
@@ -75,6 +77,41 @@ namespace iio
 
         internal IntPtr buf;
 
+#if NETSTANDARD2_1_OR_GREATER || NETCOREAPP2_1_OR_GREATER
+        /* Exposes the native memory of the buffer as a Memory<byte>; the
+         * memory is looked up again every time it is accessed, as refilling
+         * or pushing the buffer may move it */
+        private sealed class NativeMemoryManager : MemoryManager<byte>
+        {
+            private readonly IOBuffer buffer;
+
+            public NativeMemoryManager(IOBuffer buffer)
+            {
+                this.buffer = buffer;
+            }
+
+            public override Span<byte> GetSpan()
+            {
+                return buffer.as_span();
+            }
+
+            public override unsafe MemoryHandle Pin(int elementIndex = 0)
+            {
+                return new MemoryHandle((byte *) iio_buffer_start(buffer.buf) + elementIndex);
+            }
+
+            public override void Unpin()
+            {
+            }
+
+            protected override void Dispose(bool disposing)
+            {
+            }
+        }
+
+        private NativeMemoryManager memory_manager;
+#endif
+
         /// <summary>The size of this buffer, in samples.</summary>
         public readonly uint samples_count;
 
@@ -190,6 +227,65 @@ namespace iio
             Marshal.Copy(iio_buffer_start(buf), array, 0, (int)length);
         }
 
+#if NETSTANDARD2_1_OR_GREATER || NETCOREAPP2_1_OR_GREATER
+        /// <summary>Gets the samples contained in the <see cref="iio.IOBuffer"/> object, without
+        /// copying them.</summary>
+        /// <returns>A span over the native memory of the buffer.</returns>
+        /// <remarks>The span is only valid until the next call to <see cref="refill"/> or
+        /// <see cref="push()"/>, which may move the samples, or until the buffer is disposed.</remarks>
+        public unsafe Span<byte> as_span()
+        {
+            IntPtr start = iio_buffer_start(buf);
+            long length = (long) iio_buffer_end(buf) - (long) start;
+
+            return new Span<byte>(start.ToPointer(), (int) length);
+        }
+
+        /// <summary>Gets the samples contained in the <see cref="iio.IOBuffer"/> object, without
+        /// copying them.</summary>
+        /// <returns>A <c>Memory&lt;byte&gt;</c> over the native memory of the buffer.</returns>
+        /// <remarks>Contrary to the span returned by <see cref="as_span"/>, the memory can be
+        /// stored and used in asynchronous methods; it stays valid after the buffer is refilled,
+        /// but not after it is disposed.</remarks>
+        public Memory<byte> as_memory()
+        {
+            if (memory_manager == null)
+            {
+                memory_manager = new NativeMemoryManager(this);
+            }
+            return memory_manager.Memory;
+        }
+
+        /// <summary>Copy the samples of the given span inside the <see cref="iio.IOBuffer"/> object.</summary>
+        /// <param name="span">The memory containing the samples that should be written.</param>
+        /// <remarks>The number of samples written will not exceed the size of the buffer.</remarks>
+        public void fill(ReadOnlySpan<byte> span)
+        {
+            Span<byte> dst = as_span();
+
+            if (span.Length > dst.Length)
+            {
+                span = span.Slice(0, dst.Length);
+            }
+            span.CopyTo(dst);
+        }
+
+        /// <summary>Extract the samples from the <see cref="iio.IOBuffer"/> object.</summary>
+        /// <param name="span">The memory where the samples will be written.</param>
+        /// <returns>The number of bytes written to the span.</returns>
+        public int read(Span<byte> span)
+        {
+            Span<byte> src = as_span();
+
+            if (src.Length > span.Length)
+            {
+                src = src.Slice(0, span.Length);
+            }
+            src.CopyTo(span);
+            return src.Length;
+        }
+#endif
+
         /// <summary>Returns poll file descriptor for the current buffer.</summary>
         public int get_poll_fd()
         {
@@ -30,6 +30,7 @@ from ctypes import (
     c_size_t,
     c_ssize_t,
     c_char,
+    c_ubyte,
     c_void_p,
     c_bool,
     create_string_buffer,
@@ -596,6 +597,10 @@ _channel_convert_inverse = _lib.iio_channel_convert_inverse
 _channel_convert_inverse.restype = None
 _channel_convert_inverse.argtypes = (_ChannelPtr, c_void_p, c_void_p)
 
+_channel_convert_n = _lib.iio_channel_convert_n
+_channel_convert_n.restype = None
+_channel_convert_n.argtypes = (_ChannelPtr, c_void_p, c_void_p, c_ssize_t, c_size_t)
+
 _create_buffer = _lib.iio_device_create_buffer
 _create_buffer.restype = _BufferPtr
 _create_buffer.argtypes = (
@@ -645,6 +650,10 @@ _buffer_step = _lib.iio_buffer_step
 _buffer_step.restype = c_longlong
 _buffer_step.argtypes = (_BufferPtr,)
 
+_buffer_first = _lib.iio_buffer_first
+_buffer_first.restype = c_void_p
+_buffer_first.argtypes = (_BufferPtr, _ChannelPtr)
+
 _buffer_set_blocking_mode = _lib.iio_buffer_set_blocking_mode
 _buffer_set_blocking_mode.restype = c_uint
 _buffer_set_blocking_mode.argtypes = (_BufferPtr, c_bool)
@@ -672,6 +681,17 @@ def iio_strerror(err, buf, length):
     _iio_strerror(err, b_buf, length)
 
 
+def _get_numpy():
+    # NumPy is only required by the methods returning arrays
+    # pylint: disable=import-outside-toplevel
+    try:
+        import numpy
+    except ImportError:
+        raise ImportError("NumPy is required to get the samples as arrays")
+    # pylint: enable=import-outside-toplevel
+    return numpy
+
+
 version = _get_lib_version()
 backends = [_get_backend(b).decode("ascii") for b in range(0, _get_backends_count())]
 
@@ -889,6 +909,88 @@ class Channel(object):
             return _c_write_raw(self._channel, buf._buffer, c_array, len(array))
         return _c_write(self._channel, buf._buffer, c_array, len(array))
 
+    def _samples(self, buf):
+        first = _buffer_first(buf._buffer, self._channel)
+        end = _buffer_end(buf._buffer)
+        step = _buffer_step(buf._buffer)
+        return first, step, max(0, (end - first + step - 1) // step)
+
+    def view(self, buf):
+        """
+        Get the raw samples of this channel in the given iio.Buffer object, without copying them.
+
+        The samples are in the hardware format of the channel: neither shifted
+        nor sign-extended. The array is only valid until the next call to
+        refill() or push() on the buffer, which may move the samples.
+        Requires NumPy.
+
+        :param buf: type=iio.Buffer
+            A valid instance of the iio.Buffer class
+
+        returns: type=numpy.ndarray
+            A strided view over the samples of this channel, with one row of
+            'repeat' values per sample if the channel has repeated samples
+        """
+        numpy = _get_numpy()
+        fmt = self.data_format
+        size = fmt.length // 8
+        first, step, count = self._samples(buf)
+        dtype = numpy.dtype(
+            "%s%s%u" % (">" if fmt.is_be else "<", "i" if fmt.is_signed else "u", size)
+        )
+
+        if fmt.repeat > 1:
+            shape, strides = (count, fmt.repeat), (step, size)
+        else:
+            shape, strides = (count,), (step,)
+
+        return numpy.ndarray(
+            shape,
+            dtype,
+            buffer=buf.view(),
+            offset=first - _buffer_start(buf._buffer) if count else 0,
+            strides=strides,
+        )
+
+    def read_array(self, buf, out=None):
+        """
+        Extract and convert the samples of this channel from the given iio.Buffer object.
+
+        Contrary to read(), the samples are converted in a single call to the
+        library, straight into a NumPy array. Requires NumPy.
+
+        :param buf: type=iio.Buffer
+            A valid instance of the iio.Buffer class
+        :param out: type=numpy.ndarray
+            Optional C-contiguous array to write the samples to, as returned
+            by a previous call; it avoids allocating a new array on every
+            refill
+
+        returns: type=numpy.ndarray
+            An array of host-endian integers containing the samples for this
+            channel, with one row of 'repeat' values per sample if the channel
+            has repeated samples
+        """
+        numpy = _get_numpy()
+        fmt = self.data_format
+        first, step, count = self._samples(buf)
+        dtype = numpy.dtype("%s%u" % ("i" if fmt.is_signed else "u", fmt.length // 8))
+        shape = (count, fmt.repeat) if fmt.repeat > 1 else (count,)
+
+        if out is None:
+            out = numpy.empty(shape, dtype)
+        elif (
+            out.dtype != dtype
+            or out.shape[1:] != shape[1:]
+            or len(out) < count
+            or not out.flags.c_contiguous
+        ):
+            raise ValueError("The output array cannot hold the samples")
+
+        if count:
+            _channel_convert_n(self._channel, out.ctypes.data, first, step, count)
+        return out[:count]
+
     id = property(
         lambda self: self._id,
         None,
@@ -1054,6 +1156,24 @@ class Buffer(object):
         _memmove(c_array, start, len(array))
         return array
 
+    def view(self):
+        """
+        Expose the samples contained inside the Buffer object, without copying them.
+
+        The memory is the one of the buffer: writing to the view changes the
+        samples that the next push() submits. The view is only valid until the
+        next call to refill() or push(), which may move the samples, and
+        keeps the Buffer object alive.
+
+        returns: type=memoryview
+            A view over the samples
+        """
+        start = _buffer_start(self._buffer)
+        end = _buffer_end(self._buffer)
+        array = (c_ubyte * (end - start)).from_address(start)
+        array._iio_buffer = self
+        return memoryview(array).cast("B")
+
     def write(self, array):
         """
         Copy the given array of samples inside the Buffer object.
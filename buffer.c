@@ -18,6 +18,8 @@
 
 #include "iio-config.h"
 #include "iio-private.h"
+#include "iio-trace.h"
+#include "debug.h"
 
 #include <errno.h>
 #include <string.h>
@@ -33,6 +35,137 @@ static bool device_is_high_speed(const struct iio_device *dev)
 		(ops->get_buffer(dev, NULL, 0, NULL, 0) != -ENOSYS);
 }
 
+/*
+ * Computes the offset of every channel's data within one sample, using the
+ * same rules as the kernel: channels are laid out by index, each one aligned
+ * to its own storage size, and channels sharing an index share their data.
+ */
+static void update_channel_offsets(struct iio_buffer *buf)
+{
+	const struct iio_device *dev = buf->dev;
+	size_t len, offset = 0, group_offset = 0;
+	unsigned int i;
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		const struct iio_channel *cur = dev->channels[i];
+		bool same_index = i > 0 &&
+			cur->index == dev->channels[i - 1]->index;
+
+		if (cur->index < 0) {
+			buf->offsets[i] = 0;
+			continue;
+		}
+
+		if (!same_index)
+			group_offset = offset;
+
+		len = cur->format.length / 8;
+		if (group_offset % len)
+			buf->offsets[i] = group_offset + len - (group_offset % len);
+		else
+			buf->offsets[i] = group_offset;
+
+		/* Test if the buffer has samples for this channel */
+		if (same_index || !TEST_BIT(buf->mask, cur->number))
+			continue;
+
+		len *= cur->format.repeat;
+		if (offset % len)
+			offset += len - (offset % len);
+		offset += len;
+	}
+}
+
+static void buffer_block_done(struct iio_buffer *buf, size_t bytes_used)
+{
+	buf->timestamp = iio_get_monotonic_ns();
+	buf->bytes_used = bytes_used;
+	buf->nb_blocks++;
+}
+
+static int buffer_init(struct iio_buffer *buf, const struct iio_device *dev,
+		size_t samples_count, unsigned int sample_size)
+{
+	buf->dev_sample_size = sample_size;
+	buf->length = sample_size * samples_count;
+	buf->data_length = buf->length;
+	buf->dev = dev;
+	buf->nb_pending = 0;
+	buf->timestamp = 0;
+	buf->nb_blocks = 0;
+	buf->bytes_used = 0;
+	buf->dev_is_high_speed = false;
+	buf->cyclic = false;
+	buf->closed = false;
+	buf->buffer = NULL;
+	buf->offsets = NULL;
+	buf->units = NULL;
+	buf->plane_chns = NULL;
+	buf->plane_offsets = NULL;
+	buf->plane_ptrs = NULL;
+	buf->mask = calloc(dev->words, sizeof(*buf->mask));
+	if (!buf->mask)
+		return -ENOMEM;
+
+	/* Set the default channel mask to the one used by the device.
+	 * While input buffers will erase this as soon as the refill function
+	 * is used, it is useful for output buffers, as it permits
+	 * iio_buffer_foreach_sample to be used. */
+	memcpy(buf->mask, dev->mask, dev->words * sizeof(*buf->mask));
+
+	buf->offsets = calloc(dev->nb_channels, sizeof(*buf->offsets));
+	if (!buf->offsets)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* Also frees buffers on which buffer_init() failed */
+static void buffer_free(struct iio_buffer *buf)
+{
+	if (!buf->dev_is_high_speed)
+		iio_buffer_memory_free(&buf->memory, buf->buffer, buf->length);
+	free(buf->plane_ptrs);
+	free(buf->plane_offsets);
+	free(buf->plane_chns);
+	free(buf->units);
+	free(buf->offsets);
+	free(buf->mask);
+	free(buf);
+}
+
+/* Must be called once the device is opened */
+static int buffer_setup(struct iio_buffer *buf)
+{
+	const struct iio_device *dev = buf->dev;
+	ssize_t ret;
+
+	buf->dev_is_high_speed = device_is_high_speed(dev);
+	if (!buf->dev_is_high_speed) {
+		buf->memory = dev->memory;
+		buf->buffer = iio_buffer_memory_alloc(&buf->memory,
+				buf->length);
+		if (!buf->buffer)
+			return -ENOMEM;
+	}
+
+	ret = iio_device_get_sample_size_mask(dev, buf->mask, dev->words);
+	if (ret < 0)
+		return (int) ret;
+
+	buf->sample_size = (unsigned int) ret;
+	update_channel_offsets(buf);
+
+	buf->plane_chns = malloc(dev->nb_channels * sizeof(*buf->plane_chns));
+	buf->plane_offsets = malloc(dev->nb_channels *
+			sizeof(*buf->plane_offsets));
+	buf->plane_ptrs = malloc(dev->nb_channels * sizeof(*buf->plane_ptrs));
+	if (!buf->plane_chns || !buf->plane_offsets || !buf->plane_ptrs)
+		return -ENOMEM;
+
+	return 0;
+}
+
 struct iio_buffer * iio_device_create_buffer(const struct iio_device *dev,
 		size_t samples_count, bool cyclic)
 {
@@ -54,58 +187,34 @@ struct iio_buffer * iio_device_create_buffer(const struct iio_device *dev,
 		goto err_set_errno;
 	}
 
-	buf->dev_sample_size = (unsigned int) sample_size;
-	buf->length = sample_size * samples_count;
-	buf->dev = dev;
-	buf->mask = calloc(dev->words, sizeof(*buf->mask));
-	if (!buf->mask) {
-		ret = -ENOMEM;
-		goto err_free_buf;
-	}
-
-	/* Set the default channel mask to the one used by the device.
-	 * While input buffers will erase this as soon as the refill function
-	 * is used, it is useful for output buffers, as it permits
-	 * iio_buffer_foreach_sample to be used. */
-	memcpy(buf->mask, dev->mask, dev->words * sizeof(*buf->mask));
+	ret = buffer_init(buf, dev, samples_count, (unsigned int) sample_size);
+	if (ret < 0)
+		goto err_free_buffer;
 
 	ret = iio_device_open(dev, samples_count, cyclic);
 	if (ret < 0)
-		goto err_free_mask;
+		goto err_free_buffer;
 
-	buf->dev_is_high_speed = device_is_high_speed(dev);
-	if (buf->dev_is_high_speed) {
-		/* Dequeue the first buffer, so that buf->buffer is correctly
-		 * initialized */
-		buf->buffer = NULL;
-		if (iio_device_is_tx(dev)) {
-			ret = dev->ctx->ops->get_buffer(dev, &buf->buffer,
-					buf->length, buf->mask, dev->words);
-			if (ret < 0)
-				goto err_close_device;
-		}
-	} else {
-		buf->buffer = malloc(buf->length);
-		if (!buf->buffer) {
-			ret = -ENOMEM;
-			goto err_close_device;
-		}
-	}
-
-	ret = iio_device_get_sample_size_mask(dev, buf->mask, dev->words);
+	buf->cyclic = cyclic;
+	ret = buffer_setup(buf);
 	if (ret < 0)
 		goto err_close_device;
 
-	buf->sample_size = (unsigned int) ret;
-	buf->data_length = buf->length;
+	/* Dequeue the first buffer, so that buf->buffer is correctly
+	 * initialized */
+	if (buf->dev_is_high_speed && iio_device_is_tx(dev)) {
+		ret = dev->ctx->ops->get_buffer(dev, &buf->buffer,
+				buf->length, buf->mask, dev->words);
+		if (ret < 0)
+			goto err_close_device;
+	}
+
 	return buf;
 
 err_close_device:
 	iio_device_close(dev);
-err_free_mask:
-	free(buf->mask);
-err_free_buf:
-	free(buf);
+err_free_buffer:
+	buffer_free(buf);
 err_set_errno:
 	errno = -(int)ret;
 	return NULL;
@@ -113,11 +222,117 @@ err_set_errno:
 
 void iio_buffer_destroy(struct iio_buffer *buffer)
 {
-	iio_device_close(buffer->dev);
-	if (!buffer->dev_is_high_speed)
-		free(buffer->buffer);
-	free(buffer->mask);
-	free(buffer);
+	/* Requests still in flight would otherwise be waited for (or their
+	 * replies mistaken for the answer to the close command) */
+	if (buffer->nb_pending)
+		iio_buffer_cancel(buffer);
+
+	if (!buffer->closed)
+		iio_device_close(buffer->dev);
+	buffer_free(buffer);
+}
+
+int iio_buffer_reconfigure(struct iio_buffer *buffer, size_t samples_count)
+{
+	const struct iio_device *dev = buffer->dev;
+	const struct iio_backend_ops *ops = dev->ctx->ops;
+	ssize_t sample_size = iio_device_get_sample_size(dev);
+	size_t length, old_samples_count;
+	void *data = NULL;
+	int ret, err = 0;
+
+	if (!sample_size || !samples_count)
+		return -EINVAL;
+	if (sample_size < 0)
+		return (int) sample_size;
+	if (buffer->closed)
+		return -EBADF;
+	if (buffer->nb_pending)
+		return -EBUSY;
+
+	old_samples_count = buffer->length / buffer->dev_sample_size;
+	length = (size_t) sample_size * samples_count;
+
+	/* Allocated first, so that the buffer is left untouched if that
+	 * fails */
+	if (!buffer->dev_is_high_speed && length != buffer->length) {
+		data = iio_buffer_memory_alloc(&buffer->memory, length);
+		if (!data)
+			return -ENOMEM;
+	}
+
+	ret = -ENOSYS;
+	if (ops->reconfigure)
+		ret = ops->reconfigure(dev, samples_count);
+	if (ret == -ENOSYS) {
+		iio_device_close(dev);
+		ret = iio_device_open(dev, samples_count, buffer->cyclic);
+
+		/* Reopened with its previous size, so that the buffer stays
+		 * usable; the error is still returned */
+		if (ret < 0 && samples_count != old_samples_count) {
+			err = ret;
+
+			if (data)
+				iio_buffer_memory_free(&buffer->memory,
+						data, length);
+			data = NULL;
+
+			samples_count = old_samples_count;
+			length = (size_t) sample_size * samples_count;
+
+			ret = -ENOMEM;
+			if (!buffer->dev_is_high_speed &&
+					length != buffer->length)
+				data = iio_buffer_memory_alloc(&buffer->memory,
+						length);
+			if (data || buffer->dev_is_high_speed ||
+					length == buffer->length)
+				ret = iio_device_open(dev, samples_count,
+						buffer->cyclic);
+		}
+
+		/* The device stays closed: the buffer can only be destroyed */
+		if (ret < 0) {
+			buffer->closed = true;
+			if (buffer->dev_is_high_speed)
+				buffer->buffer = NULL;
+		}
+	}
+	if (ret < 0) {
+		if (data)
+			iio_buffer_memory_free(&buffer->memory, data, length);
+		return err ? err : ret;
+	}
+
+	if (data) {
+		iio_buffer_memory_free(&buffer->memory,
+				buffer->buffer, buffer->length);
+		buffer->buffer = data;
+	}
+
+	buffer->dev_sample_size = (unsigned int) sample_size;
+	buffer->sample_size = (unsigned int) sample_size;
+	buffer->length = length;
+	buffer->data_length = length;
+	memcpy(buffer->mask, dev->mask, dev->words * sizeof(*buffer->mask));
+	update_channel_offsets(buffer);
+
+	/* The blocks previously held are now owned by the backend; output
+	 * buffers need one to be written to, like after their creation */
+	if (buffer->dev_is_high_speed) {
+		buffer->buffer = NULL;
+
+		if (iio_device_is_tx(dev)) {
+			ret = (int) ops->get_buffer(dev, &buffer->buffer,
+					buffer->length, buffer->mask,
+					dev->words);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return err;
 }
 
 int iio_buffer_get_poll_fd(struct iio_buffer *buffer)
@@ -130,39 +345,81 @@ int iio_buffer_set_blocking_mode(struct iio_buffer *buffer, bool blocking)
 	return iio_device_set_blocking_mode(buffer->dev, blocking);
 }
 
+int iio_buffer_set_decimation(struct iio_buffer *buffer,
+		unsigned int factor, bool average)
+{
+	const struct iio_device *dev = buffer->dev;
+
+	if (!factor)
+		return -EINVAL;
+
+	if (dev->ctx->ops->set_decimation)
+		return dev->ctx->ops->set_decimation(dev, factor, average);
+	else
+		return -ENOSYS;
+}
+
 ssize_t iio_buffer_refill(struct iio_buffer *buffer)
 {
 	ssize_t read;
 	const struct iio_device *dev = buffer->dev;
+	uint64_t start, get_start;
 	ssize_t ret;
 
+	if (buffer->closed)
+		return -EBADF;
+	if (buffer->nb_pending)
+		return -EBUSY;
+
+	start = iio_stats_start(dev);
+	IIO_TRACE2(refill_entry, dev->id, buffer->length);
+
 	if (buffer->dev_is_high_speed) {
+		get_start = iio_stats_start(dev);
 		read = dev->ctx->ops->get_buffer(dev, &buffer->buffer,
 				buffer->length, buffer->mask, dev->words);
+		iio_stats_end(dev, IIO_STATS_GET_BUFFER, get_start, read);
 	} else {
 		read = iio_device_read_raw(dev, buffer->buffer, buffer->length,
 				buffer->mask, dev->words);
 	}
 
 	if (read >= 0) {
+		buffer_block_done(buffer, (size_t) read);
 		buffer->data_length = read;
 		ret = iio_device_get_sample_size_mask(dev, buffer->mask, dev->words);
 		if (ret < 0)
 			return ret;
 		buffer->sample_size = (unsigned int)ret;
+		update_channel_offsets(buffer);
 	}
+
+	iio_stats_end(dev, IIO_STATS_REFILL, start, read);
+	IIO_TRACE2(refill_exit, dev->id, read);
 	return read;
 }
 
 ssize_t iio_buffer_push(struct iio_buffer *buffer)
 {
 	const struct iio_device *dev = buffer->dev;
+	uint64_t start, get_start;
 	ssize_t ret;
 
+	if (buffer->closed)
+		return -EBADF;
+	if (buffer->nb_pending)
+		return -EBUSY;
+
+	start = iio_stats_start(dev);
+	IIO_TRACE2(push_entry, dev->id, buffer->data_length);
+
 	if (buffer->dev_is_high_speed) {
 		void *buf;
+
+		get_start = iio_stats_start(dev);
 		ret = dev->ctx->ops->get_buffer(dev, &buf,
 				buffer->data_length, buffer->mask, dev->words);
+		iio_stats_end(dev, IIO_STATS_GET_BUFFER, get_start, ret);
 		if (ret >= 0) {
 			buffer->buffer = buf;
 			ret = (ssize_t) buffer->data_length;
@@ -185,11 +442,353 @@ ssize_t iio_buffer_push(struct iio_buffer *buffer)
 		ret = (ssize_t) buffer->data_length;
 	}
 
+	if (ret >= 0)
+		buffer_block_done(buffer, (size_t) ret);
+
 out_reset_data_length:
+	iio_stats_end(dev, IIO_STATS_PUSH, start, ret);
+	IIO_TRACE2(push_exit, dev->id, ret);
 	buffer->data_length = buffer->length;
 	return ret;
 }
 
+int iio_buffer_submit(struct iio_buffer *buffer)
+{
+	const struct iio_device *dev = buffer->dev;
+	const struct iio_backend_ops *ops = dev->ctx->ops;
+	size_t len;
+	int ret;
+
+	if (!ops->submit_buffer || !ops->complete_buffer)
+		return -ENOSYS;
+
+	/* Output buffers send what has been written, input buffers ask for
+	 * a complete refill */
+	if (iio_device_is_tx(dev))
+		len = buffer->data_length;
+	else
+		len = buffer->length;
+
+	ret = ops->submit_buffer(dev, buffer->buffer, len);
+	if (ret < 0)
+		return ret;
+
+	buffer->nb_pending++;
+	buffer->data_length = buffer->length;
+
+	/* The block now belongs to the kernel; a new one will be obtained
+	 * on completion */
+	if (buffer->dev_is_high_speed)
+		buffer->buffer = NULL;
+	return 0;
+}
+
+static ssize_t buffer_complete(struct iio_buffer *buffer, bool wait)
+{
+	const struct iio_device *dev = buffer->dev;
+	const struct iio_backend_ops *ops = dev->ctx->ops;
+	ssize_t ret, sample_size;
+
+	if (!ops->complete_buffer)
+		return -ENOSYS;
+	if (!buffer->nb_pending)
+		return -ENOENT;
+
+	ret = ops->complete_buffer(dev, &buffer->buffer, buffer->length,
+			buffer->mask, dev->words, wait);
+	if (ret == -EAGAIN)
+		return ret;
+
+	/* Failed or not, the request is not pending anymore */
+	buffer->nb_pending--;
+
+	if (ret >= 0)
+		buffer_block_done(buffer, (size_t) ret);
+
+	if (ret >= 0 && !iio_device_is_tx(dev)) {
+		buffer->data_length = ret;
+		sample_size = iio_device_get_sample_size_mask(dev,
+				buffer->mask, dev->words);
+		if (sample_size < 0)
+			return sample_size;
+		buffer->sample_size = (unsigned int) sample_size;
+		update_channel_offsets(buffer);
+	}
+
+	return ret;
+}
+
+ssize_t iio_buffer_complete(struct iio_buffer *buffer)
+{
+	return buffer_complete(buffer, false);
+}
+
+static void buffer_set_queue(struct iio_buffer_set *set, unsigned int idx)
+{
+	set->queue[(set->queue_head + set->nb_queued) % set->nb_buffers] = idx;
+	set->nb_queued++;
+}
+
+static int buffer_set_submit_free(struct iio_buffer_set *set)
+{
+	unsigned int idx;
+	int ret;
+
+	while (set->nb_free) {
+		idx = set->free_list[set->nb_free - 1];
+
+		ret = iio_buffer_submit(set->buffers[idx]);
+		if (ret < 0)
+			return ret;
+
+		set->nb_free--;
+		buffer_set_queue(set, idx);
+	}
+
+	return 0;
+}
+
+static void buffer_set_free(struct iio_buffer_set *set)
+{
+	unsigned int i;
+
+	if (set->buffers) {
+		for (i = 0; i < set->nb_buffers; i++)
+			if (set->buffers[i])
+				buffer_free(set->buffers[i]);
+	}
+
+	free(set->acquired);
+	free(set->free_list);
+	free(set->queue);
+	free(set->buffers);
+	free(set);
+}
+
+struct iio_buffer_set * iio_device_create_buffer_set(
+		const struct iio_device *dev, size_t samples_count,
+		unsigned int nb_buffers)
+{
+	const struct iio_backend_ops *ops = dev->ctx->ops;
+	ssize_t sample_size = iio_device_get_sample_size(dev);
+	struct iio_buffer_set *set;
+	unsigned int i;
+	int ret = -EINVAL;
+
+	if (!sample_size || !samples_count || !nb_buffers)
+		goto err_set_errno;
+
+	if (sample_size < 0) {
+		ret = (int) sample_size;
+		goto err_set_errno;
+	}
+
+	if (!ops->submit_buffer || !ops->complete_buffer) {
+		ret = -ENOSYS;
+		goto err_set_errno;
+	}
+
+	set = calloc(1, sizeof(*set));
+	if (!set) {
+		ret = -ENOMEM;
+		goto err_set_errno;
+	}
+
+	set->dev = dev;
+	set->nb_buffers = nb_buffers;
+	set->buffers = calloc(nb_buffers, sizeof(*set->buffers));
+	set->queue = calloc(nb_buffers, sizeof(*set->queue));
+	set->free_list = calloc(nb_buffers, sizeof(*set->free_list));
+	set->acquired = calloc(nb_buffers, sizeof(*set->acquired));
+	if (!set->buffers || !set->queue || !set->free_list || !set->acquired) {
+		ret = -ENOMEM;
+		goto err_free_set;
+	}
+
+	for (i = 0; i < nb_buffers; i++) {
+		set->buffers[i] = malloc(sizeof(*set->buffers[i]));
+		if (!set->buffers[i]) {
+			ret = -ENOMEM;
+			goto err_free_set;
+		}
+
+		ret = buffer_init(set->buffers[i], dev, samples_count,
+				(unsigned int) sample_size);
+		if (ret < 0)
+			goto err_free_set;
+	}
+
+	/* One kernel buffer per buffer of the set. Not all the backends
+	 * support changing it, so errors are not fatal. */
+	ret = iio_device_set_kernel_buffers_count(dev, nb_buffers);
+	if (ret < 0)
+		IIO_DEBUG("Unable to set kernel buffers count: %i\n", ret);
+
+	ret = iio_device_open(dev, samples_count, false);
+	if (ret < 0)
+		goto err_free_set;
+
+	/* Buffers are taken from the end of the free list */
+	for (i = 0; i < nb_buffers; i++) {
+		ret = buffer_setup(set->buffers[i]);
+		if (ret < 0)
+			goto err_close_device;
+
+		set->free_list[set->nb_free++] = nb_buffers - i - 1;
+	}
+
+	/* Input buffers are all handed to the backend right away, so that
+	 * the acquisition can start */
+	if (!iio_device_is_tx(dev)) {
+		ret = buffer_set_submit_free(set);
+		if (ret < 0)
+			goto err_close_device;
+	}
+
+	return set;
+
+err_close_device:
+	if (set->nb_queued)
+		iio_buffer_cancel(set->buffers[0]);
+	iio_device_close(dev);
+err_free_set:
+	buffer_set_free(set);
+err_set_errno:
+	errno = -ret;
+	return NULL;
+}
+
+void iio_buffer_set_destroy(struct iio_buffer_set *set)
+{
+	if (set->nb_queued)
+		iio_buffer_cancel(set->buffers[0]);
+
+	iio_device_close(set->dev);
+	buffer_set_free(set);
+}
+
+ssize_t iio_buffer_set_acquire(struct iio_buffer_set *set,
+		struct iio_buffer **buf)
+{
+	const struct iio_device *dev = set->dev;
+	struct iio_buffer *buffer;
+	unsigned int idx;
+	ssize_t ret;
+
+	if (!iio_device_is_tx(dev)) {
+		/* Re-submit the buffers whose request failed */
+		ret = (ssize_t) buffer_set_submit_free(set);
+		if (ret < 0)
+			return ret;
+	} else if (set->nb_free) {
+		idx = set->free_list[set->nb_free - 1];
+		buffer = set->buffers[idx];
+
+		/* High-speed devices: get an empty block to fill */
+		if (buffer->dev_is_high_speed && !buffer->buffer) {
+			ret = dev->ctx->ops->complete_buffer(dev,
+					&buffer->buffer, buffer->length,
+					buffer->mask, dev->words, true);
+			if (ret < 0)
+				return ret;
+		}
+
+		set->nb_free--;
+		goto out_acquire;
+	}
+
+	/* All the buffers are held by the application */
+	if (!set->nb_queued)
+		return -EBUSY;
+
+	idx = set->queue[set->queue_head];
+	buffer = set->buffers[idx];
+
+	ret = buffer_complete(buffer, true);
+	if (ret == -EAGAIN)
+		return ret;
+
+	set->queue_head = (set->queue_head + 1) % set->nb_buffers;
+	set->nb_queued--;
+
+	if (ret < 0) {
+		set->free_list[set->nb_free++] = idx;
+		return ret;
+	}
+
+out_acquire:
+	set->acquired[idx] = true;
+	*buf = buffer;
+	return (ssize_t) buffer->data_length;
+}
+
+int iio_buffer_set_release(struct iio_buffer_set *set, struct iio_buffer *buf)
+{
+	unsigned int idx;
+	int ret;
+
+	for (idx = 0; idx < set->nb_buffers; idx++)
+		if (set->buffers[idx] == buf)
+			break;
+
+	if (idx == set->nb_buffers || !set->acquired[idx])
+		return -EINVAL;
+
+	set->acquired[idx] = false;
+
+	ret = iio_buffer_submit(buf);
+	if (ret < 0) {
+		set->free_list[set->nb_free++] = idx;
+		return ret;
+	}
+
+	buffer_set_queue(set, idx);
+	return 0;
+}
+
+int iio_buffer_get_block_info(const struct iio_buffer *buffer,
+		struct iio_block_info *info)
+{
+	const struct iio_device *dev = buffer->dev;
+	int ret = 0;
+
+	if (!buffer->nb_blocks)
+		return -ENOENT;
+
+	info->timestamp = buffer->timestamp;
+	info->sequence = buffer->nb_blocks - 1;
+	info->bytes_used = buffer->bytes_used;
+	info->nb_xflows = 0;
+
+	if (dev->ctx->ops->get_xflow_count)
+		ret = dev->ctx->ops->get_xflow_count(dev, &info->nb_xflows);
+
+	return ret == -ENOSYS ? 0 : ret;
+}
+
+ssize_t iio_buffer_dequeue_block(struct iio_buffer *buffer, void **addr)
+{
+	const struct iio_device *dev = buffer->dev;
+
+	if (!buffer->dev_is_high_speed || !dev->ctx->ops->dequeue_block)
+		return -ENOSYS;
+	if (!addr)
+		return -EINVAL;
+
+	return dev->ctx->ops->dequeue_block(dev, addr);
+}
+
+int iio_buffer_enqueue_block(struct iio_buffer *buffer,
+		void *addr, size_t bytes_used)
+{
+	const struct iio_device *dev = buffer->dev;
+
+	if (!buffer->dev_is_high_speed || !dev->ctx->ops->enqueue_block)
+		return -ENOSYS;
+
+	return dev->ctx->ops->enqueue_block(dev, addr, bytes_used);
+}
+
 ssize_t iio_buffer_push_partial(struct iio_buffer *buffer, size_t samples_count)
 {
 	size_t new_len = samples_count * buffer->dev_sample_size;
@@ -206,7 +805,6 @@ ssize_t iio_buffer_foreach_sample(struct iio_buffer *buffer,
 			void *, size_t, void *), void *d)
 {
 	uintptr_t ptr = (uintptr_t) buffer->buffer,
-		  start = ptr,
 		  end = ptr + buffer->data_length;
 	const struct iio_device *dev = buffer->dev;
 	ssize_t processed = 0;
@@ -217,82 +815,153 @@ ssize_t iio_buffer_foreach_sample(struct iio_buffer *buffer,
 	if (buffer->data_length < buffer->dev_sample_size)
 		return 0;
 
-	while (end - ptr >= (size_t) buffer->sample_size) {
+	for (; end - ptr >= (size_t) buffer->sample_size;
+			ptr += buffer->sample_size) {
 		unsigned int i;
 
 		for (i = 0; i < dev->nb_channels; i++) {
 			const struct iio_channel *chn = dev->channels[i];
-			unsigned int length = chn->format.length / 8;
+			ssize_t ret;
 
 			if (chn->index < 0)
 				break;
 
-			/* Test if the buffer has samples for this channel */
-			if (!TEST_BIT(buffer->mask, chn->number))
+			/* Test if the buffer has samples for this channel,
+			 * and if the client wants samples from it */
+			if (!TEST_BIT(buffer->mask, chn->number) ||
+					!TEST_BIT(dev->mask, chn->number))
 				continue;
 
-			if ((ptr - start) % length)
-				ptr += length - ((ptr - start) % length);
-
-			/* Test if the client wants samples from this channel */
-			if (TEST_BIT(dev->mask, chn->number)) {
-				ssize_t ret = callback(chn,
-						(void *) ptr, length, d);
-				if (ret < 0)
-					return ret;
-				else
-					processed += ret;
-			}
-
-			if (i == dev->nb_channels - 1 || dev->channels[
-					i + 1]->index != chn->index)
-				ptr += length * chn->format.repeat;
+			ret = callback(chn, (void *) (ptr + buffer->offsets[i]),
+					chn->format.length / 8, d);
+			if (ret < 0)
+				return ret;
+			else
+				processed += ret;
 		}
 	}
 	return processed;
 }
 
-void * iio_buffer_start(const struct iio_buffer *buffer)
-{
-	return buffer->buffer;
-}
-
-void * iio_buffer_first(const struct iio_buffer *buffer,
-		const struct iio_channel *chn)
+ssize_t iio_buffer_foreach_block(struct iio_buffer *buffer,
+		ssize_t (*callback)(const struct iio_channel *,
+			void *, ptrdiff_t, size_t, void *), void *d)
 {
-	size_t len;
+	const struct iio_device *dev = buffer->dev;
+	ssize_t processed = 0;
 	unsigned int i;
-	uintptr_t ptr = (uintptr_t) buffer->buffer,
-		  start = ptr;
+	size_t count;
 
-	if (!iio_channel_is_enabled(chn))
-		return iio_buffer_end(buffer);
+	if (buffer->sample_size == 0)
+		return -EINVAL;
 
-	for (i = 0; i < buffer->dev->nb_channels; i++) {
-		struct iio_channel *cur = buffer->dev->channels[i];
-		len = cur->format.length / 8 * cur->format.repeat;
+	count = buffer->data_length / buffer->sample_size;
+	if (!count)
+		return 0;
 
-		/* NOTE: dev->channels are ordered by index */
-		if (cur->index < 0 || cur->index == chn->index)
+	for (i = 0; i < dev->nb_channels; i++) {
+		const struct iio_channel *chn = dev->channels[i];
+		ssize_t ret;
+
+		if (chn->index < 0)
 			break;
 
-		/* Test if the buffer has samples for this channel */
-		if (!TEST_BIT(buffer->mask, cur->number))
+		if (!TEST_BIT(buffer->mask, chn->number) ||
+				!TEST_BIT(dev->mask, chn->number))
 			continue;
 
-		/* Two channels with the same index use the same samples */
-		if (i > 0 && cur->index == buffer->dev->channels[i - 1]->index)
+		ret = callback(chn, (void *) ((uintptr_t) buffer->buffer +
+					buffer->offsets[i]),
+				(ptrdiff_t) buffer->sample_size, count, d);
+		if (ret < 0)
+			return ret;
+		else
+			processed += ret;
+	}
+	return processed;
+}
+
+/*
+ * Fills in the list of channels that are enabled in both the buffer and the
+ * device, and for which the caller supplied a memory area.
+ */
+static unsigned int get_planes(const struct iio_buffer *buffer,
+		void **planes, const struct iio_channel **chns,
+		size_t *offsets, void **ptrs)
+{
+	const struct iio_device *dev = buffer->dev;
+	unsigned int i, nb = 0;
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		const struct iio_channel *chn = dev->channels[i];
+
+		if (!planes[i] || !iio_channel_is_enabled(chn) ||
+				!TEST_BIT(buffer->mask, chn->number))
 			continue;
 
-		if ((ptr - start) % len)
-			ptr += len - ((ptr - start) % len);
-		ptr += len;
+		chns[nb] = chn;
+		offsets[nb] = buffer->offsets[i];
+		ptrs[nb++] = planes[i];
 	}
 
-	len = chn->format.length / 8;
-	if ((ptr - start) % len)
-		ptr += len - ((ptr - start) % len);
-	return (void *) ptr;
+	return nb;
+}
+
+static ssize_t buffer_convert_planes(struct iio_buffer *buffer,
+		void **planes, size_t samples_count, bool inverse)
+{
+	unsigned int nb;
+	size_t count;
+
+	if (buffer->sample_size == 0)
+		return -EINVAL;
+
+	count = buffer->data_length / buffer->sample_size;
+	if (count > samples_count)
+		count = samples_count;
+
+	nb = get_planes(buffer, planes, buffer->plane_chns,
+			buffer->plane_offsets, buffer->plane_ptrs);
+
+	if (inverse)
+		iio_channels_mux(buffer->plane_chns, buffer->plane_offsets, nb,
+				buffer->buffer,
+				(const void **) buffer->plane_ptrs,
+				buffer->sample_size, count);
+	else
+		iio_channels_demux(buffer->plane_chns, buffer->plane_offsets,
+				nb, buffer->plane_ptrs, buffer->buffer,
+				buffer->sample_size, count);
+
+	return (ssize_t) count;
+}
+
+ssize_t iio_buffer_deinterleave(struct iio_buffer *buffer,
+		void **planes, size_t samples_count)
+{
+	return buffer_convert_planes(buffer, planes, samples_count, false);
+}
+
+ssize_t iio_buffer_interleave(struct iio_buffer *buffer,
+		const void **planes, size_t samples_count)
+{
+	return buffer_convert_planes(buffer, (void **) planes,
+			samples_count, true);
+}
+
+void * iio_buffer_start(const struct iio_buffer *buffer)
+{
+	return buffer->buffer;
+}
+
+void * iio_buffer_first(const struct iio_buffer *buffer,
+		const struct iio_channel *chn)
+{
+	if (!iio_channel_is_enabled(chn))
+		return iio_buffer_end(buffer);
+
+	return (void *) ((uintptr_t) buffer->buffer +
+			buffer->offsets[chn->number]);
 }
 
 ptrdiff_t iio_buffer_step(const struct iio_buffer *buffer)
@@ -18,6 +18,7 @@
 
 #include "debug.h"
 #include "iio-private.h"
+#include "sort.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -384,36 +385,76 @@ const char * iio_channel_get_attr(const struct iio_channel *chn,
 		return chn->attrs[index].name;
 }
 
-const char * iio_channel_find_attr(const struct iio_channel *chn,
+int iio_channel_init_index(struct iio_channel *chn)
+{
+	unsigned int i;
+	int ret;
+
+	ret = iio_index_init(&chn->attrs_index,
+			chn->dev->ctx->arena, chn->nb_attrs);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < chn->nb_attrs; i++)
+		iio_index_add(&chn->attrs_index, chn->attrs[i].name, 0, i);
+
+	iio_index_sort(&chn->attrs_index);
+	return 0;
+}
+
+static int iio_channel_find_attr_index(const struct iio_channel *chn,
 		const char *name)
 {
 	unsigned int i;
-	for (i = 0; i < chn->nb_attrs; i++) {
-		const char *attr = chn->attrs[i].name;
-		if (!strcmp(attr, name))
-			return attr;
-	}
-	return NULL;
+
+	if (chn->attrs_index.entries)
+		return iio_index_find(&chn->attrs_index, 0, name);
+
+	for (i = 0; i < chn->nb_attrs; i++)
+		if (!strcmp(chn->attrs[i].name, name))
+			return (int) i;
+
+	return -1;
+}
+
+const char * iio_channel_find_attr(const struct iio_channel *chn,
+		const char *name)
+{
+	int i = iio_channel_find_attr_index(chn, name);
+
+	return i < 0 ? NULL : chn->attrs[i].name;
 }
 
 ssize_t iio_channel_attr_read(const struct iio_channel *chn,
 		const char *attr, char *dst, size_t len)
 {
-	if (chn->dev->ctx->ops->read_channel_attr)
-		return chn->dev->ctx->ops->read_channel_attr(chn,
-				attr, dst, len);
-	else
+	uint64_t start;
+	ssize_t ret;
+
+	if (!chn->dev->ctx->ops->read_channel_attr)
 		return -ENOSYS;
+
+	start = iio_stats_start(chn->dev);
+	ret = chn->dev->ctx->ops->read_channel_attr(chn, attr, dst, len);
+	iio_stats_end(chn->dev, IIO_STATS_ATTR_READ, start, ret);
+
+	return ret;
 }
 
 ssize_t iio_channel_attr_write_raw(const struct iio_channel *chn,
 		const char *attr, const void *src, size_t len)
 {
-	if (chn->dev->ctx->ops->write_channel_attr)
-		return chn->dev->ctx->ops->write_channel_attr(chn,
-				attr, src, len);
-	else
+	uint64_t start;
+	ssize_t ret;
+
+	if (!chn->dev->ctx->ops->write_channel_attr)
 		return -ENOSYS;
+
+	start = iio_stats_start(chn->dev);
+	ret = chn->dev->ctx->ops->write_channel_attr(chn, attr, src, len);
+	iio_stats_end(chn->dev, IIO_STATS_ATTR_WRITE, start, ret);
+
+	return ret;
 }
 
 ssize_t iio_channel_attr_write(const struct iio_channel *chn,
@@ -461,22 +502,6 @@ void iio_channel_disable(struct iio_channel *chn)
 		CLEAR_BIT(chn->dev->mask, chn->number);
 }
 
-void free_channel(struct iio_channel *chn)
-{
-	size_t i;
-	for (i = 0; i < chn->nb_attrs; i++) {
-		free(chn->attrs[i].name);
-		free(chn->attrs[i].filename);
-	}
-	if (chn->nb_attrs)
-		free(chn->attrs);
-	if (chn->name)
-		free(chn->name);
-	if (chn->id)
-		free(chn->id);
-	free(chn);
-}
-
 static void byte_swap(uint8_t *dst, const uint8_t *src, size_t len)
 {
 	size_t i;
@@ -639,6 +664,563 @@ void iio_channel_convert_inverse(const struct iio_channel *chn,
 	}
 }
 
+#ifdef __GNUC__
+#define iio_bswap16(x) __builtin_bswap16(x)
+#define iio_bswap32(x) __builtin_bswap32(x)
+#define iio_bswap64(x) __builtin_bswap64(x)
+#else
+static inline uint16_t iio_bswap16(uint16_t x)
+{
+	return (uint16_t) ((x << 8) | (x >> 8));
+}
+
+static inline uint32_t iio_bswap32(uint32_t x)
+{
+	return ((x & 0xff) << 24) | ((x & 0xff00) << 8) |
+		((x >> 8) & 0xff00) | ((x >> 24) & 0xff);
+}
+
+static inline uint64_t iio_bswap64(uint64_t x)
+{
+	return ((uint64_t) iio_bswap32((uint32_t) x) << 32) |
+		iio_bswap32((uint32_t) (x >> 32));
+}
+#endif
+
+/* Never called, as 8-bit samples are never swapped */
+#define iio_bswap8(x) (x)
+
+struct convert_params {
+	uint64_t mask, sign;
+	unsigned int shift;
+	bool swap;
+};
+
+/*
+ * Fills the parameters used by the fast conversion loops below. Returns false
+ * if the format must be handled by the generic (per-byte) code, which is the
+ * case for repeated samples, odd sample lengths or out-of-range shifts.
+ */
+static bool get_convert_params(const struct iio_data_format *fmt,
+		struct convert_params *params, bool inverse)
+{
+	unsigned int length = fmt->length;
+
+	if (fmt->repeat > 1 || !fmt->bits || fmt->shift >= length)
+		return false;
+	if (length != 8 && length != 16 && length != 32 && length != 64)
+		return false;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	params->swap = length > 8 && fmt->is_be;
+#else
+	params->swap = length > 8 && !fmt->is_be;
+#endif
+	params->shift = fmt->shift;
+	params->sign = 0;
+
+	if (fmt->bits >= length || (!inverse && fmt->is_fully_defined))
+		params->mask = ~(uint64_t) 0;
+	else
+		params->mask = ((uint64_t) 1 << fmt->bits) - 1;
+
+	/* Sign extension is done with ((val ^ sign) - sign) on the masked
+	 * value, which is a no-op when sign is zero. */
+	if (!inverse && !fmt->is_fully_defined && fmt->is_signed &&
+			fmt->bits < length)
+		params->sign = (uint64_t) 1 << (fmt->bits - 1);
+
+	return true;
+}
+
+/*
+ * The loops are kept free of any data-dependent branch, and the byte-swap
+ * test is hoisted out of them, so that the compiler can vectorize them.
+ */
+#define DEFINE_CONVERT_FUNCS(n)						\
+static void convert_n_u##n(const struct convert_params *params,	\
+		uint8_t *dst, const uint8_t *src,			\
+		ptrdiff_t step, size_t count)				\
+{									\
+	const uint##n##_t mask = (uint##n##_t) params->mask,		\
+	      sign = (uint##n##_t) params->sign;			\
+	const unsigned int shift = params->shift;			\
+	uint##n##_t val;						\
+	size_t i;							\
+									\
+	if (params->swap) {						\
+		for (i = 0; i < count; i++) {				\
+			memcpy(&val, src + i * step, sizeof(val));	\
+			val = (uint##n##_t) ((iio_bswap##n(val) >> shift) & mask); \
+			val = (uint##n##_t) ((val ^ sign) - sign);	\
+			memcpy(dst + i * sizeof(val), &val, sizeof(val)); \
+		}							\
+	} else {							\
+		for (i = 0; i < count; i++) {				\
+			memcpy(&val, src + i * step, sizeof(val));	\
+			val = (uint##n##_t) ((val >> shift) & mask);	\
+			val = (uint##n##_t) ((val ^ sign) - sign);	\
+			memcpy(dst + i * sizeof(val), &val, sizeof(val)); \
+		}							\
+	}								\
+}									\
+									\
+static void convert_inverse_n_u##n(const struct convert_params *params, \
+		uint8_t *dst, const uint8_t *src,			\
+		ptrdiff_t step, size_t count)				\
+{									\
+	const uint##n##_t mask = (uint##n##_t) params->mask;		\
+	const unsigned int shift = params->shift;			\
+	uint##n##_t val;						\
+	size_t i;							\
+									\
+	if (params->swap) {						\
+		for (i = 0; i < count; i++) {				\
+			memcpy(&val, src + i * sizeof(val), sizeof(val)); \
+			val = (uint##n##_t) ((val & mask) << shift);	\
+			val = (uint##n##_t) iio_bswap##n(val);		\
+			memcpy(dst + i * step, &val, sizeof(val));	\
+		}							\
+	} else {							\
+		for (i = 0; i < count; i++) {				\
+			memcpy(&val, src + i * sizeof(val), sizeof(val)); \
+			val = (uint##n##_t) ((val & mask) << shift);	\
+			memcpy(dst + i * step, &val, sizeof(val));	\
+		}							\
+	}								\
+}
+
+DEFINE_CONVERT_FUNCS(8)
+DEFINE_CONVERT_FUNCS(16)
+DEFINE_CONVERT_FUNCS(32)
+DEFINE_CONVERT_FUNCS(64)
+
+void iio_channel_convert_n(const struct iio_channel *chn,
+		void *dst, const void *src, ptrdiff_t step, size_t count)
+{
+	unsigned int length = chn->format.length / 8 * chn->format.repeat;
+	struct convert_params params;
+	size_t i;
+
+	if (!get_convert_params(&chn->format, &params, false)) {
+		for (i = 0; i < count; i++)
+			iio_channel_convert(chn,
+					(uint8_t *) dst + i * length,
+					(const uint8_t *) src + i * step);
+		return;
+	}
+
+	switch (chn->format.length) {
+	case 8:
+		convert_n_u8(&params, dst, src, step, count);
+		break;
+	case 16:
+		convert_n_u16(&params, dst, src, step, count);
+		break;
+	case 32:
+		convert_n_u32(&params, dst, src, step, count);
+		break;
+	default:
+		convert_n_u64(&params, dst, src, step, count);
+		break;
+	}
+}
+
+void iio_channel_convert_inverse_n(const struct iio_channel *chn,
+		void *dst, const void *src, ptrdiff_t step, size_t count)
+{
+	unsigned int length = chn->format.length / 8 * chn->format.repeat;
+	struct convert_params params;
+	size_t i;
+
+	if (!get_convert_params(&chn->format, &params, true)) {
+		for (i = 0; i < count; i++)
+			iio_channel_convert_inverse(chn,
+					(uint8_t *) dst + i * step,
+					(const uint8_t *) src + i * length);
+		return;
+	}
+
+	switch (chn->format.length) {
+	case 8:
+		convert_inverse_n_u8(&params, dst, src, step, count);
+		break;
+	case 16:
+		convert_inverse_n_u16(&params, dst, src, step, count);
+		break;
+	case 32:
+		convert_inverse_n_u32(&params, dst, src, step, count);
+		break;
+	default:
+		convert_inverse_n_u64(&params, dst, src, step, count);
+		break;
+	}
+}
+
+static size_t channel_nb_samples(uintptr_t ptr, uintptr_t end,
+		ptrdiff_t step, size_t len, unsigned int length)
+{
+	size_t count;
+
+	if (ptr >= end || step <= 0 || !length)
+		return 0;
+
+	count = (end - ptr + (size_t) step - 1) / (size_t) step;
+	if (count > len / length)
+		count = len / length;
+	return count;
+}
+
+/*
+ * Conversion to physical units: the raw value is extracted like above, then
+ * converted to floating point and scaled in the same loop, so that the
+ * samples are only read once.
+ */
+#define iio_nobswap(x) (x)
+
+#define CONVERT_UNITS_LOOP(n, type, bswap, itype)			\
+	for (i = 0; i < count; i++) {					\
+		memcpy(&val, src + i * step, sizeof(val));		\
+		val = (uint##n##_t) ((bswap(val) >> shift) & mask);	\
+		val = (uint##n##_t) ((val ^ sign) - sign);		\
+		dst[i] = ((type) (itype) val + offset) * scale;		\
+	}
+
+#define DEFINE_CONVERT_UNITS_FUNC(n, type)				\
+static void convert_units_n_u##n##_##type(				\
+		const struct convert_params *params, bool is_signed,	\
+		type scale, type offset, type *dst,			\
+		const uint8_t *src, ptrdiff_t step, size_t count)	\
+{									\
+	const uint##n##_t mask = (uint##n##_t) params->mask,		\
+	      sign = (uint##n##_t) params->sign;			\
+	const unsigned int shift = params->shift;			\
+	uint##n##_t val;						\
+	size_t i;							\
+									\
+	if (params->swap && is_signed) {				\
+		CONVERT_UNITS_LOOP(n, type, iio_bswap##n, int##n##_t)	\
+	} else if (params->swap) {					\
+		CONVERT_UNITS_LOOP(n, type, iio_bswap##n, uint##n##_t)	\
+	} else if (is_signed) {						\
+		CONVERT_UNITS_LOOP(n, type, iio_nobswap, int##n##_t)	\
+	} else {							\
+		CONVERT_UNITS_LOOP(n, type, iio_nobswap, uint##n##_t)	\
+	}								\
+}
+
+DEFINE_CONVERT_UNITS_FUNC(8, float)
+DEFINE_CONVERT_UNITS_FUNC(16, float)
+DEFINE_CONVERT_UNITS_FUNC(32, float)
+DEFINE_CONVERT_UNITS_FUNC(64, float)
+DEFINE_CONVERT_UNITS_FUNC(8, double)
+DEFINE_CONVERT_UNITS_FUNC(16, double)
+DEFINE_CONVERT_UNITS_FUNC(32, double)
+DEFINE_CONVERT_UNITS_FUNC(64, double)
+
+/* Scale and offset of the channel, read the first time the samples of the
+ * channel are converted to physical units from the buffer */
+static int buffer_get_units(struct iio_buffer *buf,
+		const struct iio_channel *chn, double *scale, double *offset)
+{
+	struct iio_channel_units *units;
+	int ret;
+
+	if (!buf->units) {
+		buf->units = calloc(buf->dev->nb_channels, sizeof(*buf->units));
+		if (!buf->units)
+			return -ENOMEM;
+	}
+
+	units = &buf->units[chn->number];
+	if (!units->valid) {
+		units->scale = chn->format.with_scale ? chn->format.scale : 1.0;
+		units->offset = 0.0;
+
+		if (iio_channel_find_attr(chn, "offset")) {
+			ret = iio_channel_attr_read_double(chn, "offset",
+					&units->offset);
+			if (ret < 0)
+				return ret;
+		}
+
+		units->valid = true;
+	}
+
+	*scale = units->scale;
+	*offset = units->offset;
+	return 0;
+}
+
+static double get_host_value(const void *ptr, unsigned int len,
+		bool is_signed)
+{
+	union {
+		uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+		int8_t s8; int16_t s16; int32_t s32; int64_t s64;
+	} val;
+
+	memcpy(&val, ptr, len);
+
+	switch (len) {
+	case 1:
+		return is_signed ? (double) val.s8 : (double) val.u8;
+	case 2:
+		return is_signed ? (double) val.s16 : (double) val.u16;
+	case 4:
+		return is_signed ? (double) val.s32 : (double) val.u32;
+	default:
+		return is_signed ? (double) val.s64 : (double) val.u64;
+	}
+}
+
+/* Handles the formats that the fast loops don't, e.g. repeated samples */
+static ssize_t convert_units_generic(const struct iio_channel *chn,
+		void *dst, bool is_double, double scale, double offset,
+		const uint8_t *src, ptrdiff_t step, size_t count)
+{
+	const struct iio_data_format *fmt = &chn->format;
+	unsigned int len = fmt->length / 8, j;
+	uint8_t tmp[1024];
+	size_t i, k = 0;
+	double val;
+
+	if (len != 1 && len != 2 && len != 4 && len != 8)
+		return -EINVAL;
+	if (len * fmt->repeat > sizeof(tmp))
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		iio_channel_convert(chn, tmp, src + i * step);
+
+		for (j = 0; j < fmt->repeat; j++, k++) {
+			val = get_host_value(tmp + j * len, len, fmt->is_signed);
+			val = (val + offset) * scale;
+
+			if (is_double)
+				((double *) dst)[k] = val;
+			else
+				((float *) dst)[k] = (float) val;
+		}
+	}
+
+	return (ssize_t) k;
+}
+
+#define DEFINE_READ_UNITS_FUNC(type)					\
+ssize_t iio_channel_read_##type(const struct iio_channel *chn,		\
+		struct iio_buffer *buf, type *dst, size_t nb)		\
+{									\
+	const struct iio_data_format *fmt = &chn->format;		\
+	const uint8_t *src = iio_buffer_first(buf, chn);		\
+	ptrdiff_t step = iio_buffer_step(buf);				\
+	struct convert_params params;					\
+	double scale, offset;						\
+	size_t count;							\
+	int ret;							\
+									\
+	ret = buffer_get_units(buf, chn, &scale, &offset);		\
+	if (ret < 0)							\
+		return ret;						\
+									\
+	count = channel_nb_samples((uintptr_t) src,			\
+			(uintptr_t) iio_buffer_end(buf), step, nb,	\
+			fmt->repeat);					\
+									\
+	if (!get_convert_params(fmt, &params, false))			\
+		return convert_units_generic(chn, dst,			\
+				sizeof(type) == sizeof(double),		\
+				scale, offset, src, step, count);	\
+									\
+	switch (fmt->length) {						\
+	case 8:								\
+		convert_units_n_u8_##type(&params, fmt->is_signed,	\
+				(type) scale, (type) offset,		\
+				dst, src, step, count);			\
+		break;							\
+	case 16:							\
+		convert_units_n_u16_##type(&params, fmt->is_signed,	\
+				(type) scale, (type) offset,		\
+				dst, src, step, count);			\
+		break;							\
+	case 32:							\
+		convert_units_n_u32_##type(&params, fmt->is_signed,	\
+				(type) scale, (type) offset,		\
+				dst, src, step, count);			\
+		break;							\
+	default:							\
+		convert_units_n_u64_##type(&params, fmt->is_signed,	\
+				(type) scale, (type) offset,		\
+				dst, src, step, count);			\
+		break;							\
+	}								\
+									\
+	return (ssize_t) count;						\
+}
+
+DEFINE_READ_UNITS_FUNC(float)
+DEFINE_READ_UNITS_FUNC(double)
+
+/* Number of samples converted for one channel before moving on to the next
+ * one, small enough for the interleaved block to stay in the L1 cache */
+#define DEMUX_BLOCK_SIZE 256
+
+/*
+ * Returns true if the channels are 2, 4 or 8 contiguous 16-bit channels that
+ * share the same format and fill up the whole sample, e.g. I/Q pairs.
+ */
+static bool get_packed_u16_params(const struct iio_channel **chns,
+		const size_t *offsets, unsigned int nb, ptrdiff_t step,
+		struct convert_params *params, bool inverse)
+{
+	struct convert_params tmp;
+	unsigned int i;
+
+	if ((nb != 2 && nb != 4 && nb != 8) || step != (ptrdiff_t) nb * 2)
+		return false;
+
+	for (i = 0; i < nb; i++) {
+		if (chns[i]->format.length != 16 || offsets[i] != i * 2 ||
+				!get_convert_params(&chns[i]->format,
+					&tmp, inverse))
+			return false;
+
+		if (i == 0)
+			*params = tmp;
+		else if (tmp.mask != params->mask || tmp.sign != params->sign ||
+				tmp.shift != params->shift ||
+				tmp.swap != params->swap)
+			return false;
+	}
+
+	return true;
+}
+
+/* Always called with a constant "nb", so that the inner loop gets unrolled */
+static inline void demux_u16(const struct convert_params *params,
+		void **dst, const uint8_t *src, unsigned int nb, size_t count)
+{
+	const uint16_t mask = (uint16_t) params->mask,
+	      sign = (uint16_t) params->sign;
+	const unsigned int shift = params->shift;
+	const bool swap = params->swap;
+	unsigned int j;
+	uint16_t val;
+	size_t i;
+
+	for (i = 0; i < count; i++, src += nb * 2) {
+		for (j = 0; j < nb; j++) {
+			memcpy(&val, src + j * 2, sizeof(val));
+			val = swap ? (uint16_t) iio_bswap16(val) : val;
+			val = (uint16_t) ((val >> shift) & mask);
+			val = (uint16_t) ((val ^ sign) - sign);
+			memcpy((uint8_t *) dst[j] + i * 2, &val, sizeof(val));
+		}
+	}
+}
+
+static inline void mux_u16(const struct convert_params *params,
+		uint8_t *dst, const void **src, unsigned int nb, size_t count)
+{
+	const uint16_t mask = (uint16_t) params->mask;
+	const unsigned int shift = params->shift;
+	const bool swap = params->swap;
+	unsigned int j;
+	uint16_t val;
+	size_t i;
+
+	for (i = 0; i < count; i++, dst += nb * 2) {
+		for (j = 0; j < nb; j++) {
+			memcpy(&val, (const uint8_t *) src[j] + i * 2,
+					sizeof(val));
+			val = (uint16_t) ((val & mask) << shift);
+			val = swap ? (uint16_t) iio_bswap16(val) : val;
+			memcpy(dst + j * 2, &val, sizeof(val));
+		}
+	}
+}
+
+/*
+ * Converts "count" samples of each of the "nb" channels at once, from the
+ * interleaved area "src" (one sample every "step" bytes, the data of channel
+ * chns[i] being located at offsets[i] within each sample) to the dense
+ * arrays dst[i].
+ */
+void iio_channels_demux(const struct iio_channel **chns, const size_t *offsets,
+		unsigned int nb, void **dst, const void *src,
+		ptrdiff_t step, size_t count)
+{
+	struct convert_params params;
+	unsigned int j, length;
+	size_t i, n;
+
+	if (get_packed_u16_params(chns, offsets, nb, step, &params, false)) {
+		switch (nb) {
+		case 2:
+			demux_u16(&params, dst, src, 2, count);
+			return;
+		case 4:
+			demux_u16(&params, dst, src, 4, count);
+			return;
+		default:
+			demux_u16(&params, dst, src, 8, count);
+			return;
+		}
+	}
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < DEMUX_BLOCK_SIZE ? count - i : DEMUX_BLOCK_SIZE;
+
+		for (j = 0; j < nb; j++) {
+			length = chns[j]->format.length / 8 *
+				chns[j]->format.repeat;
+			iio_channel_convert_n(chns[j],
+					(uint8_t *) dst[j] + i * length,
+					(const uint8_t *) src + i * step +
+					offsets[j], step, n);
+		}
+	}
+}
+
+/* Inverse of iio_channels_demux() */
+void iio_channels_mux(const struct iio_channel **chns, const size_t *offsets,
+		unsigned int nb, void *dst, const void **src,
+		ptrdiff_t step, size_t count)
+{
+	struct convert_params params;
+	unsigned int j, length;
+	size_t i, n;
+
+	if (get_packed_u16_params(chns, offsets, nb, step, &params, true)) {
+		switch (nb) {
+		case 2:
+			mux_u16(&params, dst, src, 2, count);
+			return;
+		case 4:
+			mux_u16(&params, dst, src, 4, count);
+			return;
+		default:
+			mux_u16(&params, dst, src, 8, count);
+			return;
+		}
+	}
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < DEMUX_BLOCK_SIZE ? count - i : DEMUX_BLOCK_SIZE;
+
+		for (j = 0; j < nb; j++) {
+			length = chns[j]->format.length / 8 *
+				chns[j]->format.repeat;
+			iio_channel_convert_inverse_n(chns[j],
+					(uint8_t *) dst + i * step + offsets[j],
+					(const uint8_t *) src[j] + i * length,
+					step, n);
+		}
+	}
+}
+
+/* Returns the number of samples of "length" bytes that can be transferred
+ * between the buffer area [ptr, end) and a user area of "len" bytes */
 size_t iio_channel_read_raw(const struct iio_channel *chn,
 		struct iio_buffer *buf, void *dst, size_t len)
 {
@@ -657,17 +1239,14 @@ size_t iio_channel_read_raw(const struct iio_channel *chn,
 size_t iio_channel_read(const struct iio_channel *chn,
 		struct iio_buffer *buf, void *dst, size_t len)
 {
-	uintptr_t src_ptr, dst_ptr = (uintptr_t) dst, end = dst_ptr + len;
+	void *src = iio_buffer_first(buf, chn);
 	unsigned int length = chn->format.length / 8 * chn->format.repeat;
-	uintptr_t buf_end = (uintptr_t) iio_buffer_end(buf);
 	ptrdiff_t buf_step = iio_buffer_step(buf);
+	size_t count = channel_nb_samples((uintptr_t) src,
+			(uintptr_t) iio_buffer_end(buf), buf_step, len, length);
 
-	for (src_ptr = (uintptr_t) iio_buffer_first(buf, chn);
-			src_ptr < buf_end && dst_ptr + length <= end;
-			src_ptr += buf_step, dst_ptr += length)
-		iio_channel_convert(chn,
-				(void *) dst_ptr, (const void *) src_ptr);
-	return dst_ptr - (uintptr_t) dst;
+	iio_channel_convert_n(chn, dst, src, buf_step, count);
+	return count * length;
 }
 
 size_t iio_channel_write_raw(const struct iio_channel *chn,
@@ -688,17 +1267,14 @@ size_t iio_channel_write_raw(const struct iio_channel *chn,
 size_t iio_channel_write(const struct iio_channel *chn,
 		struct iio_buffer *buf, const void *src, size_t len)
 {
-	uintptr_t dst_ptr, src_ptr = (uintptr_t) src, end = src_ptr + len;
+	void *dst = iio_buffer_first(buf, chn);
 	unsigned int length = chn->format.length / 8 * chn->format.repeat;
-	uintptr_t buf_end = (uintptr_t) iio_buffer_end(buf);
 	ptrdiff_t buf_step = iio_buffer_step(buf);
+	size_t count = channel_nb_samples((uintptr_t) dst,
+			(uintptr_t) iio_buffer_end(buf), buf_step, len, length);
 
-	for (dst_ptr = (uintptr_t) iio_buffer_first(buf, chn);
-			dst_ptr < buf_end && src_ptr + length <= end;
-			dst_ptr += buf_step, src_ptr += length)
-		iio_channel_convert_inverse(chn,
-				(void *) dst_ptr, (const void *) src_ptr);
-	return src_ptr - (uintptr_t) src;
+	iio_channel_convert_inverse_n(chn, dst, src, buf_step, count);
+	return count * length;
 }
 
 int iio_channel_attr_read_longlong(const struct iio_channel *chn,
@@ -777,12 +1353,9 @@ int iio_channel_attr_write_bool(const struct iio_channel *chn,
 const char * iio_channel_attr_get_filename(
 		const struct iio_channel *chn, const char *attr)
 {
-	unsigned int i;
-	for (i = 0; i < chn->nb_attrs; i++) {
-		if (!strcmp(chn->attrs[i].name, attr))
-			return chn->attrs[i].filename;
-	}
-	return NULL;
+	int i = iio_channel_find_attr_index(chn, attr);
+
+	return i < 0 ? NULL : chn->attrs[i].filename;
 }
 
 int iio_channel_attr_read_all(struct iio_channel *chn,
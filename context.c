@@ -16,6 +16,7 @@
  *
  * */
 
+#include "arena.h"
 #include "debug.h"
 #include "iio-config.h"
 #include "iio-private.h"
@@ -184,6 +185,9 @@ err_free_ctx_attrs:
 
 const char * iio_context_get_xml(const struct iio_context *ctx)
 {
+	if (ctx->ops->get_xml)
+		return ctx->ops->get_xml(ctx);
+
 	return ctx->xml;
 }
 
@@ -202,26 +206,17 @@ const char * iio_context_get_description(const struct iio_context *ctx)
 
 void iio_context_destroy(struct iio_context *ctx)
 {
-	unsigned int i;
 	if (ctx->ops->shutdown)
 		ctx->ops->shutdown(ctx);
 
-	for (i = 0; i < ctx->nb_attrs; i++) {
-		free(ctx->attrs[i]);
-		free(ctx->values[i]);
-	}
-	if (ctx->nb_attrs) {
-		free(ctx->attrs);
-		free(ctx->values);
-	}
-	for (i = 0; i < ctx->nb_devices; i++)
-		free_device(ctx->devices[i]);
-	if (ctx->nb_devices)
-		free(ctx->devices);
-	if (ctx->xml)
-		free(ctx->xml);
-	if (ctx->description)
-		free(ctx->description);
+	iio_stats_free(ctx);
+
+	/* The description of the context, its devices and channels are
+	 * all released along with the arena */
+	if (ctx->arena)
+		iio_arena_destroy(ctx->arena);
+	if (ctx->shared_arena)
+		iio_arena_destroy(ctx->shared_arena);
 	free(ctx);
 }
 
@@ -243,6 +238,13 @@ struct iio_device * iio_context_find_device(const struct iio_context *ctx,
 		const char *name)
 {
 	unsigned int i;
+	int pos;
+
+	if (ctx->devices_index.entries) {
+		pos = iio_index_find(&ctx->devices_index, 0, name);
+		return pos < 0 ? NULL : ctx->devices[pos];
+	}
+
 	for (i = 0; i < ctx->nb_devices; i++) {
 		struct iio_device *dev = ctx->devices[i];
 		if (!strcmp(dev->id, name) ||
@@ -283,15 +285,51 @@ static void reorder_channels(struct iio_device *dev)
 		dev->channels[i]->number = i;
 }
 
-int iio_context_init(struct iio_context *ctx)
+static int iio_context_init_index(struct iio_context *ctx)
 {
 	unsigned int i;
+	int ret;
 
-	for (i = 0; i < ctx->nb_devices; i++)
-		reorder_channels(ctx->devices[i]);
+	ret = iio_index_init(&ctx->devices_index,
+			ctx->arena, 2 * ctx->nb_devices);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ctx->nb_devices; i++) {
+		struct iio_device *dev = ctx->devices[i];
+
+		iio_index_add(&ctx->devices_index, dev->id, 0, i);
+		iio_index_add(&ctx->devices_index, dev->name, 0, i);
+
+		ret = iio_device_init(dev);
+		if (ret)
+			return ret;
+	}
+
+	iio_index_sort(&ctx->devices_index);
+	return 0;
+}
+
+/* Also called by the backends once they populated a device */
+int iio_device_init(struct iio_device *dev)
+{
+	reorder_channels(dev);
+
+	/* The lookups by name are binary searches in these indexes */
+	return iio_device_init_index(dev);
+}
 
-	if (!ctx->xml) {
-		ctx->xml = iio_context_create_xml(ctx);
+int iio_context_init(struct iio_context *ctx)
+{
+	int ret;
+
+	ret = iio_context_init_index(ctx);
+	if (ret)
+		return ret;
+
+	if (!ctx->xml && !ctx->ops->get_xml) {
+		ctx->xml = iio_arena_adopt(ctx->arena,
+				iio_context_create_xml(ctx));
 		if (!ctx->xml)
 			return -ENOMEM;
 	}
@@ -299,6 +337,112 @@ int iio_context_init(struct iio_context *ctx)
 	return 0;
 }
 
+static struct iio_channel * clone_channel(struct iio_arena *arena,
+		const struct iio_channel *chn, struct iio_device *dev)
+{
+	struct iio_channel *new_chn = iio_arena_alloc(arena, sizeof(*new_chn));
+	if (!new_chn)
+		return NULL;
+
+	*new_chn = *chn;
+	new_chn->dev = dev;
+	new_chn->pdata = NULL;
+	new_chn->userdata = NULL;
+	return new_chn;
+}
+
+static struct iio_device * clone_device(struct iio_context *ctx,
+		const struct iio_device *dev)
+{
+	struct iio_device *new_dev = iio_arena_alloc(ctx->arena,
+			sizeof(*new_dev));
+	unsigned int i;
+
+	if (!new_dev)
+		return NULL;
+
+	/* The names, attributes and indexes are shared; the channels are
+	 * enabled separately in every context */
+	*new_dev = *dev;
+	new_dev->ctx = ctx;
+	new_dev->pdata = NULL;
+	new_dev->userdata = NULL;
+	new_dev->stats = NULL;
+	memset(&new_dev->memory, 0, sizeof(new_dev->memory));
+
+	if (dev->words) {
+		new_dev->mask = iio_arena_alloc(ctx->arena,
+				dev->words * sizeof(*dev->mask));
+		if (!new_dev->mask)
+			return NULL;
+	}
+
+	if (dev->nb_channels) {
+		new_dev->channels = iio_arena_alloc(ctx->arena,
+				dev->nb_channels * sizeof(*dev->channels));
+		if (!new_dev->channels)
+			return NULL;
+	}
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		new_dev->channels[i] = clone_channel(ctx->arena,
+				dev->channels[i], new_dev);
+		if (!new_dev->channels[i])
+			return NULL;
+	}
+
+	return new_dev;
+}
+
+struct iio_context * iio_context_clone_description(
+		const struct iio_context *ctx, struct iio_context_pdata *pdata)
+{
+	struct iio_context *new_ctx = malloc(sizeof(*new_ctx));
+	unsigned int i;
+
+	if (!new_ctx) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	*new_ctx = *ctx;
+	new_ctx->pdata = pdata;
+	new_ctx->devices = NULL;
+	new_ctx->stats = NULL;
+	new_ctx->stats_lock = NULL;
+	new_ctx->stats_enabled = false;
+
+	new_ctx->arena = iio_arena_new();
+	if (!new_ctx->arena)
+		goto err_free_ctx;
+
+	new_ctx->shared_arena = iio_arena_ref(ctx->shared_arena ?
+			ctx->shared_arena : ctx->arena);
+
+	if (ctx->nb_devices) {
+		new_ctx->devices = iio_arena_alloc(new_ctx->arena,
+				ctx->nb_devices * sizeof(*ctx->devices));
+		if (!new_ctx->devices)
+			goto err_destroy_arenas;
+	}
+
+	for (i = 0; i < ctx->nb_devices; i++) {
+		new_ctx->devices[i] = clone_device(new_ctx, ctx->devices[i]);
+		if (!new_ctx->devices[i])
+			goto err_destroy_arenas;
+	}
+
+	return new_ctx;
+
+err_destroy_arenas:
+	iio_arena_destroy(new_ctx->shared_arena);
+	iio_arena_destroy(new_ctx->arena);
+err_free_ctx:
+	free(new_ctx);
+	errno = ENOMEM;
+	return NULL;
+}
+
 int iio_context_get_version(const struct iio_context *ctx,
 		unsigned int *major, unsigned int *minor, char git_tag[8])
 {
@@ -317,6 +461,115 @@ int iio_context_set_timeout(struct iio_context *ctx, unsigned int timeout)
 		return -ENOSYS;
 }
 
+int iio_context_set_attr_cache(struct iio_context *ctx, int ttl_ms)
+{
+	if (ctx->ops->set_attr_cache)
+		return ctx->ops->set_attr_cache(ctx, NULL, ttl_ms);
+	else
+		return -ENOSYS;
+}
+
+int iio_context_set_attr_cache_ttl(struct iio_context *ctx,
+		const char *attr, int ttl_ms)
+{
+	if (!attr || !attr[0])
+		return -EINVAL;
+
+	if (ctx->ops->set_attr_cache)
+		return ctx->ops->set_attr_cache(ctx, attr, ttl_ms);
+	else
+		return -ENOSYS;
+}
+
+void iio_context_invalidate_attr_cache(struct iio_context *ctx)
+{
+	if (ctx->ops->invalidate_attr_cache)
+		ctx->ops->invalidate_attr_cache(ctx);
+}
+
+int iio_context_get_attr_cache_stats(const struct iio_context *ctx,
+		struct iio_attr_cache_stats *stats)
+{
+	if (ctx->ops->get_attr_cache_stats)
+		return ctx->ops->get_attr_cache_stats(ctx, stats);
+	else
+		return -ENOSYS;
+}
+
+int iio_context_read_attrs(const struct iio_context *ctx,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs)
+{
+	unsigned int i;
+	int nb_errors = 0;
+
+	for (i = 0; i < nb_reqs; i++)
+		if (!reqs[i].dev || reqs[i].dev->ctx != ctx || !reqs[i].attr ||
+				(reqs[i].chn && reqs[i].chn->dev != reqs[i].dev) ||
+				reqs[i].type > IIO_ATTR_TYPE_BUFFER)
+			return -EINVAL;
+
+	if (ctx->ops->read_attrs)
+		return ctx->ops->read_attrs(ctx, reqs, nb_reqs);
+
+	for (i = 0; i < nb_reqs; i++) {
+		struct iio_attr_read_req *req = &reqs[i];
+
+		if (req->chn)
+			req->ret = iio_channel_attr_read(req->chn,
+					req->attr, req->dst, req->len);
+		else if (req->type == IIO_ATTR_TYPE_DEBUG)
+			req->ret = iio_device_debug_attr_read(req->dev,
+					req->attr, req->dst, req->len);
+		else if (req->type == IIO_ATTR_TYPE_BUFFER)
+			req->ret = iio_device_buffer_attr_read(req->dev,
+					req->attr, req->dst, req->len);
+		else
+			req->ret = iio_device_attr_read(req->dev,
+					req->attr, req->dst, req->len);
+		if (req->ret < 0)
+			nb_errors++;
+	}
+
+	return nb_errors;
+}
+
+int iio_context_write_attrs(const struct iio_context *ctx,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs)
+{
+	unsigned int i;
+	int nb_errors = 0;
+
+	for (i = 0; i < nb_reqs; i++)
+		if (!reqs[i].dev || reqs[i].dev->ctx != ctx || !reqs[i].attr ||
+				(reqs[i].chn && reqs[i].chn->dev != reqs[i].dev) ||
+				reqs[i].type > IIO_ATTR_TYPE_BUFFER)
+			return -EINVAL;
+
+	if (ctx->ops->write_attrs)
+		return ctx->ops->write_attrs(ctx, reqs, nb_reqs);
+
+	for (i = 0; i < nb_reqs; i++) {
+		struct iio_attr_write_req *req = &reqs[i];
+
+		if (req->chn)
+			req->ret = iio_channel_attr_write_raw(req->chn,
+					req->attr, req->src, req->len);
+		else if (req->type == IIO_ATTR_TYPE_DEBUG)
+			req->ret = iio_device_debug_attr_write_raw(req->dev,
+					req->attr, req->src, req->len);
+		else if (req->type == IIO_ATTR_TYPE_BUFFER)
+			req->ret = iio_device_buffer_attr_write_raw(req->dev,
+					req->attr, req->src, req->len);
+		else
+			req->ret = iio_device_attr_write_raw(req->dev,
+					req->attr, req->src, req->len);
+		if (req->ret < 0)
+			nb_errors++;
+	}
+
+	return nb_errors;
+}
+
 struct iio_context * iio_context_clone(const struct iio_context *ctx)
 {
 	if (ctx->ops->clone) {
@@ -330,8 +583,8 @@ struct iio_context * iio_context_clone(const struct iio_context *ctx)
 struct iio_context * iio_create_context_from_uri(const char *uri)
 {
 #ifdef WITH_LOCAL_BACKEND
-	if (strcmp(uri, "local:") == 0) /* No address part */
-		return iio_create_local_context();
+	if (strncmp(uri, "local:", sizeof("local:") - 1) == 0)
+		return local_create_context_from_uri(uri);
 #endif
 
 #ifdef WITH_XML_BACKEND
@@ -342,6 +595,8 @@ struct iio_context * iio_create_context_from_uri(const char *uri)
 #ifdef WITH_NETWORK_BACKEND
 	if (strncmp(uri, "ip:", sizeof("ip:") - 1) == 0)
 		return iio_create_network_context(uri+3);
+	if (strncmp(uri, "shm:", sizeof("shm:") - 1) == 0)
+		return network_create_shm_context(uri + sizeof("shm:") - 1);
 #endif
 
 #ifdef WITH_USB_BACKEND
@@ -375,7 +630,7 @@ struct iio_context * iio_create_default_context(void)
 struct iio_context * iio_create_local_context(void)
 {
 #ifdef WITH_LOCAL_BACKEND
-	return local_create_context();
+	return local_create_context(false);
 #else
 	errno = ENOSYS;
 	return NULL;
@@ -449,40 +704,39 @@ int iio_context_add_attr(struct iio_context *ctx,
 	char **attrs, **values, *new_key, *new_val;
 	unsigned int i;
 
+	/* A replaced value stays in the arena until the context is
+	 * destroyed */
 	for (i = 0; i < ctx->nb_attrs; i++) {
 		if(!strcmp(ctx->attrs[i], key)) {
-			new_val = iio_strdup(value);
+			new_val = iio_arena_strdup(ctx->arena, value);
 			if (!new_val)
 				return -ENOMEM;
-			free(ctx->values[i]);
 			ctx->values[i] = new_val;
 			return 0;
 		}
 	}
 
-	attrs = realloc(ctx->attrs,
-			(ctx->nb_attrs + 1) * sizeof(*ctx->attrs));
+	attrs = iio_arena_grow_array(ctx->arena, ctx->attrs,
+			ctx->nb_attrs, sizeof(*ctx->attrs));
 	if (!attrs)
 		return -ENOMEM;
 
 	ctx->attrs = attrs;
 
-	values = realloc(ctx->values,
-			(ctx->nb_attrs + 1) * sizeof(*ctx->values));
+	values = iio_arena_grow_array(ctx->arena, ctx->values,
+			ctx->nb_attrs, sizeof(*ctx->values));
 	if (!values)
 		return -ENOMEM;
 
 	ctx->values = values;
 
-	new_key = iio_strdup(key);
+	new_key = iio_arena_strdup(ctx->arena, key);
 	if (!new_key)
 		return -ENOMEM;
 
-	new_val = iio_strdup(value);
-	if (!new_val) {
-		free(new_key);
+	new_val = iio_arena_strdup(ctx->arena, value);
+	if (!new_val)
 		return -ENOMEM;
-	}
 
 	ctx->attrs[ctx->nb_attrs] = new_key;
 	ctx->values[ctx->nb_attrs] = new_val;
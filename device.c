@@ -18,6 +18,7 @@
 
 #include "debug.h"
 #include "iio-private.h"
+#include "sort.h"
 
 #include <inttypes.h>
 #include <errno.h>
@@ -272,24 +273,132 @@ const char * iio_device_get_name(const struct iio_device *dev)
 	return dev->name;
 }
 
+/* The channels and attributes of the devices of lazy contexts are only read
+ * on first use */
+int iio_device_populate(const struct iio_device *dev)
+{
+	char err_str[1024];
+	int ret;
+
+	if (!dev->ctx->ops->populate_device)
+		return 0;
+
+	ret = dev->ctx->ops->populate_device(dev);
+	if (ret < 0) {
+		iio_strerror(-ret, err_str, sizeof(err_str));
+		IIO_ERROR("Unable to read device %s: %s\n", dev->id, err_str);
+	}
+
+	return ret;
+}
+
 unsigned int iio_device_get_channels_count(const struct iio_device *dev)
 {
+	if (iio_device_populate(dev))
+		return 0;
+
 	return dev->nb_channels;
 }
 
 struct iio_channel * iio_device_get_channel(const struct iio_device *dev,
 		unsigned int index)
 {
-	if (index >= dev->nb_channels)
+	if (iio_device_populate(dev) || index >= dev->nb_channels)
 		return NULL;
 	else
 		return dev->channels[index];
 }
 
+static int init_names_index(struct iio_index *idx, struct iio_arena *arena,
+		char **names, unsigned int nb)
+{
+	unsigned int i;
+	int ret;
+
+	ret = iio_index_init(idx, arena, nb);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nb; i++)
+		iio_index_add(idx, names[i], 0, i);
+
+	iio_index_sort(idx);
+	return 0;
+}
+
+int iio_device_init_index(struct iio_device *dev)
+{
+	struct iio_arena *arena = dev->ctx->arena;
+	unsigned int i;
+	int ret;
+
+	ret = init_names_index(&dev->attrs_index, arena,
+			dev->attrs, dev->nb_attrs);
+	if (ret)
+		return ret;
+
+	ret = init_names_index(&dev->buffer_attrs_index, arena,
+			dev->buffer_attrs, dev->nb_buffer_attrs);
+	if (ret)
+		return ret;
+
+	ret = init_names_index(&dev->debug_attrs_index, arena,
+			dev->debug_attrs, dev->nb_debug_attrs);
+	if (ret)
+		return ret;
+
+	ret = iio_index_init(&dev->channels_index,
+			arena, 2 * dev->nb_channels);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		struct iio_channel *chn = dev->channels[i];
+
+		iio_index_add(&dev->channels_index, chn->id, chn->is_output, i);
+		iio_index_add(&dev->channels_index, chn->name, chn->is_output, i);
+
+		ret = iio_channel_init_index(chn);
+		if (ret)
+			return ret;
+	}
+
+	iio_index_sort(&dev->channels_index);
+	return 0;
+}
+
+static const char * find_name(const struct iio_index *idx,
+		char **names, unsigned int nb, const char *name)
+{
+	unsigned int i;
+	int pos;
+
+	if (idx->entries) {
+		pos = iio_index_find(idx, 0, name);
+		return pos < 0 ? NULL : names[pos];
+	}
+
+	for (i = 0; i < nb; i++)
+		if (!strcmp(names[i], name))
+			return names[i];
+
+	return NULL;
+}
+
 struct iio_channel * iio_device_find_channel(const struct iio_device *dev,
 		const char *name, bool output)
 {
 	unsigned int i;
+	int pos;
+
+	if (iio_device_populate(dev))
+		return NULL;
+
+	if (dev->channels_index.entries) {
+		pos = iio_index_find(&dev->channels_index, output, name);
+		return pos < 0 ? NULL : dev->channels[pos];
+	}
+
 	for (i = 0; i < dev->nb_channels; i++) {
 		struct iio_channel *chn = dev->channels[i];
 		if (iio_channel_is_output(chn) != output)
@@ -304,13 +413,16 @@ struct iio_channel * iio_device_find_channel(const struct iio_device *dev,
 
 unsigned int iio_device_get_attrs_count(const struct iio_device *dev)
 {
+	if (iio_device_populate(dev))
+		return 0;
+
 	return dev->nb_attrs;
 }
 
 const char * iio_device_get_attr(const struct iio_device *dev,
 		unsigned int index)
 {
-	if (index >= dev->nb_attrs)
+	if (iio_device_populate(dev) || index >= dev->nb_attrs)
 		return NULL;
 	else
 		return dev->attrs[index];
@@ -319,24 +431,24 @@ const char * iio_device_get_attr(const struct iio_device *dev,
 const char * iio_device_find_attr(const struct iio_device *dev,
 		const char *name)
 {
-	unsigned int i;
-	for (i = 0; i < dev->nb_attrs; i++) {
-		const char *attr = dev->attrs[i];
-		if (!strcmp(attr, name))
-			return attr;
-	}
-	return NULL;
+	if (iio_device_populate(dev))
+		return NULL;
+
+	return find_name(&dev->attrs_index, dev->attrs, dev->nb_attrs, name);
 }
 
 unsigned int iio_device_get_buffer_attrs_count(const struct iio_device *dev)
 {
+	if (iio_device_populate(dev))
+		return 0;
+
 	return dev->nb_buffer_attrs;
 }
 
 const char * iio_device_get_buffer_attr(const struct iio_device *dev,
 		unsigned int index)
 {
-	if (index >= dev->nb_buffer_attrs)
+	if (iio_device_populate(dev) || index >= dev->nb_buffer_attrs)
 		return NULL;
 	else
 		return dev->buffer_attrs[index];
@@ -345,31 +457,30 @@ const char * iio_device_get_buffer_attr(const struct iio_device *dev,
 const char * iio_device_find_buffer_attr(const struct iio_device *dev,
 		const char *name)
 {
-	unsigned int i;
-	for (i = 0; i < dev->nb_buffer_attrs; i++) {
-		const char *attr = dev->buffer_attrs[i];
-		if (!strcmp(attr, name))
-			return attr;
-	}
-	return NULL;
+	if (iio_device_populate(dev))
+		return NULL;
+
+	return find_name(&dev->buffer_attrs_index,
+			dev->buffer_attrs, dev->nb_buffer_attrs, name);
 }
 
 const char * iio_device_find_debug_attr(const struct iio_device *dev,
 		const char *name)
 {
-	unsigned int i;
-	for (i = 0; i < dev->nb_debug_attrs; i++) {
-		const char *attr = dev->debug_attrs[i];
-		if (!strcmp(attr, name))
-			return attr;
-	}
-	return NULL;
+	if (iio_device_populate(dev))
+		return NULL;
+
+	return find_name(&dev->debug_attrs_index,
+			dev->debug_attrs, dev->nb_debug_attrs, name);
 }
 
 bool iio_device_is_tx(const struct iio_device *dev)
 {
 	unsigned int i;
 
+	if (iio_device_populate(dev))
+		return false;
+
 	for (i = 0; i < dev->nb_channels; i++) {
 		struct iio_channel *ch = dev->channels[i];
 		if (iio_channel_is_output(ch) && iio_channel_is_enabled(ch))
@@ -438,24 +549,49 @@ ssize_t iio_device_write_raw(const struct iio_device *dev,
 		return -ENOSYS;
 }
 
+static ssize_t device_attr_read(const struct iio_device *dev,
+		const char *attr, char *dst, size_t len, enum iio_attr_type type)
+{
+	uint64_t start;
+	ssize_t ret;
+
+	if (!dev->ctx->ops->read_device_attr)
+		return -ENOSYS;
+
+	start = iio_stats_start(dev);
+	ret = dev->ctx->ops->read_device_attr(dev, attr, dst, len, type);
+	iio_stats_end(dev, IIO_STATS_ATTR_READ, start, ret);
+
+	return ret;
+}
+
+static ssize_t device_attr_write(const struct iio_device *dev,
+		const char *attr, const void *src, size_t len,
+		enum iio_attr_type type)
+{
+	uint64_t start;
+	ssize_t ret;
+
+	if (!dev->ctx->ops->write_device_attr)
+		return -ENOSYS;
+
+	start = iio_stats_start(dev);
+	ret = dev->ctx->ops->write_device_attr(dev, attr, src, len, type);
+	iio_stats_end(dev, IIO_STATS_ATTR_WRITE, start, ret);
+
+	return ret;
+}
+
 ssize_t iio_device_attr_read(const struct iio_device *dev,
 		const char *attr, char *dst, size_t len)
 {
-	if (dev->ctx->ops->read_device_attr)
-		return dev->ctx->ops->read_device_attr(dev,
-				attr, dst, len, IIO_ATTR_TYPE_DEVICE);
-	else
-		return -ENOSYS;
+	return device_attr_read(dev, attr, dst, len, IIO_ATTR_TYPE_DEVICE);
 }
 
 ssize_t iio_device_attr_write_raw(const struct iio_device *dev,
 		const char *attr, const void *src, size_t len)
 {
-	if (dev->ctx->ops->write_device_attr)
-		return dev->ctx->ops->write_device_attr(dev,
-				attr, src, len, IIO_ATTR_TYPE_DEVICE);
-	else
-		return -ENOSYS;
+	return device_attr_write(dev, attr, src, len, IIO_ATTR_TYPE_DEVICE);
 }
 
 ssize_t iio_device_attr_write(const struct iio_device *dev,
@@ -467,21 +603,13 @@ ssize_t iio_device_attr_write(const struct iio_device *dev,
 ssize_t iio_device_buffer_attr_read(const struct iio_device *dev,
 		const char *attr, char *dst, size_t len)
 {
-	if (dev->ctx->ops->read_device_attr)
-		return dev->ctx->ops->read_device_attr(dev,
-				attr, dst, len, IIO_ATTR_TYPE_BUFFER);
-	else
-		return -ENOSYS;
+	return device_attr_read(dev, attr, dst, len, IIO_ATTR_TYPE_BUFFER);
 }
 
 ssize_t iio_device_buffer_attr_write_raw(const struct iio_device *dev,
 		const char *attr, const void *src, size_t len)
 {
-	if (dev->ctx->ops->write_device_attr)
-		return dev->ctx->ops->write_device_attr(dev,
-				attr, src, len, IIO_ATTR_TYPE_BUFFER);
-	else
-		return -ENOSYS;
+	return device_attr_write(dev, attr, src, len, IIO_ATTR_TYPE_BUFFER);
 }
 
 ssize_t iio_device_buffer_attr_write(const struct iio_device *dev,
@@ -523,6 +651,17 @@ int iio_device_set_kernel_buffers_count(const struct iio_device *dev,
 		return -ENOSYS;
 }
 
+int iio_device_set_cyclic_buffers_count(const struct iio_device *dev,
+		unsigned int nb_buffers)
+{
+	if (nb_buffers == 0)
+		return -EINVAL;
+	else if (dev->ctx->ops->set_cyclic_buffers_count)
+		return dev->ctx->ops->set_cyclic_buffers_count(dev, nb_buffers);
+	else
+		return -ENOSYS;
+}
+
 int iio_device_get_trigger(const struct iio_device *dev,
 		const struct iio_device **trigger)
 {
@@ -545,34 +684,6 @@ int iio_device_set_trigger(const struct iio_device *dev,
 		return -ENOSYS;
 }
 
-void free_device(struct iio_device *dev)
-{
-	unsigned int i;
-	for (i = 0; i < dev->nb_attrs; i++)
-		free(dev->attrs[i]);
-	if (dev->nb_attrs)
-		free(dev->attrs);
-	for (i = 0; i < dev->nb_buffer_attrs; i++)
-		free(dev->buffer_attrs[i]);
-	if (dev->nb_buffer_attrs)
-		free(dev->buffer_attrs);
-	for (i = 0; i < dev->nb_debug_attrs; i++)
-		free(dev->debug_attrs[i]);
-	if (dev->nb_debug_attrs)
-		free(dev->debug_attrs);
-	for (i = 0; i < dev->nb_channels; i++)
-		free_channel(dev->channels[i]);
-	if (dev->nb_channels)
-		free(dev->channels);
-	if (dev->mask)
-		free(dev->mask);
-	if (dev->name)
-		free(dev->name);
-	if (dev->id)
-		free(dev->id);
-	free(dev);
-}
-
 ssize_t iio_device_get_sample_size_mask(const struct iio_device *dev,
 		const uint32_t *mask, size_t words)
 {
@@ -610,6 +721,10 @@ ssize_t iio_device_get_sample_size_mask(const struct iio_device *dev,
 
 ssize_t iio_device_get_sample_size(const struct iio_device *dev)
 {
+	int ret = iio_device_populate(dev);
+	if (ret)
+		return ret;
+
 	return iio_device_get_sample_size_mask(dev, dev->mask, dev->words);
 }
 
@@ -770,21 +885,13 @@ int iio_device_buffer_attr_write_bool(const struct iio_device *dev,
 ssize_t iio_device_debug_attr_read(const struct iio_device *dev,
 		const char *attr, char *dst, size_t len)
 {
-	if (dev->ctx->ops->read_device_attr)
-		return dev->ctx->ops->read_device_attr(dev,
-				attr, dst, len, IIO_ATTR_TYPE_DEBUG);
-	else
-		return -ENOSYS;
+	return device_attr_read(dev, attr, dst, len, IIO_ATTR_TYPE_DEBUG);
 }
 
 ssize_t iio_device_debug_attr_write_raw(const struct iio_device *dev,
 		const char *attr, const void *src, size_t len)
 {
-	if (dev->ctx->ops->write_device_attr)
-		return dev->ctx->ops->write_device_attr(dev,
-				attr, src, len, IIO_ATTR_TYPE_DEBUG);
-	else
-		return -ENOSYS;
+	return device_attr_write(dev, attr, src, len, IIO_ATTR_TYPE_DEBUG);
 }
 
 ssize_t iio_device_debug_attr_write(const struct iio_device *dev,
@@ -795,13 +902,16 @@ ssize_t iio_device_debug_attr_write(const struct iio_device *dev,
 
 unsigned int iio_device_get_debug_attrs_count(const struct iio_device *dev)
 {
+	if (iio_device_populate(dev))
+		return 0;
+
 	return dev->nb_debug_attrs;
 }
 
 const char * iio_device_get_debug_attr(const struct iio_device *dev,
 		unsigned int index)
 {
-	if (index >= dev->nb_debug_attrs)
+	if (iio_device_populate(dev) || index >= dev->nb_debug_attrs)
 		return NULL;
 	else
 		return dev->debug_attrs[index];
@@ -889,6 +999,11 @@ int iio_device_identify_filename(const struct iio_device *dev,
 		const char **attr)
 {
 	unsigned int i;
+	int ret;
+
+	ret = iio_device_populate(dev);
+	if (ret)
+		return ret;
 
 	for (i = 0; i < dev->nb_channels; i++) {
 		struct iio_channel *ch = dev->channels[i];
@@ -923,7 +1038,7 @@ int iio_device_identify_filename(const struct iio_device *dev,
 	return -EINVAL;
 }
 
-int iio_device_reg_write(struct iio_device *dev,
+static int iio_device_reg_write_one(struct iio_device *dev,
 		uint32_t address, uint32_t value)
 {
 	ssize_t ret;
@@ -936,12 +1051,12 @@ int iio_device_reg_write(struct iio_device *dev,
 	return (int) (ret < 0 ? ret : 0);
 }
 
-int iio_device_reg_read(struct iio_device *dev,
+static int iio_device_reg_read_one(struct iio_device *dev,
 		uint32_t address, uint32_t *value)
 {
-	/* NOTE: There is a race condition here. But it is extremely unlikely to
-	 * happen, and as this is a debug function, it shouldn't be used for
-	 * something else than debug. */
+	/* NOTE: There is a race condition here, as the address and the value
+	 * are two accesses to the attribute. It is only used by the backends
+	 * that cannot access the registers atomically. */
 
 	long long val;
 	int ret = iio_device_debug_attr_write_longlong(dev,
@@ -956,6 +1071,70 @@ int iio_device_reg_read(struct iio_device *dev,
 	return ret;
 }
 
+int iio_device_reg_read_bulk(struct iio_device *dev,
+		const uint32_t *addresses, uint32_t *values, unsigned int nb)
+{
+	unsigned int i;
+	int ret;
+
+	if (!nb || nb > IIO_MAX_REGS)
+		return -EINVAL;
+
+	if (dev->ctx->ops->read_regs) {
+		ret = dev->ctx->ops->read_regs(dev, addresses, values, nb);
+
+		/* e.g. with older servers: the registers are then accessed one
+		 * at a time */
+		if (ret != -ENOSYS)
+			return ret;
+	}
+
+	for (i = 0; i < nb; i++) {
+		ret = iio_device_reg_read_one(dev, addresses[i], &values[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int iio_device_reg_write_bulk(struct iio_device *dev,
+		const uint32_t *addresses, const uint32_t *values,
+		unsigned int nb)
+{
+	unsigned int i;
+	int ret;
+
+	if (!nb || nb > IIO_MAX_REGS)
+		return -EINVAL;
+
+	if (dev->ctx->ops->write_regs) {
+		ret = dev->ctx->ops->write_regs(dev, addresses, values, nb);
+		if (ret != -ENOSYS)
+			return ret;
+	}
+
+	for (i = 0; i < nb; i++) {
+		ret = iio_device_reg_write_one(dev, addresses[i], values[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int iio_device_reg_write(struct iio_device *dev,
+		uint32_t address, uint32_t value)
+{
+	return iio_device_reg_write_bulk(dev, &address, &value, 1);
+}
+
+int iio_device_reg_read(struct iio_device *dev,
+		uint32_t address, uint32_t *value)
+{
+	return iio_device_reg_read_bulk(dev, &address, value, 1);
+}
+
 static int read_each_attr(struct iio_device *dev, enum iio_attr_type type,
 		int (*cb)(struct iio_device *dev,
 			const char *attr, const char *val, size_t len, void *d),
@@ -965,6 +1144,10 @@ static int read_each_attr(struct iio_device *dev, enum iio_attr_type type,
 	char *buf, *ptr;
 	unsigned int i, count;
 
+	ret = iio_device_populate(dev);
+	if (ret)
+		return ret;
+
 	/* We need a big buffer here; 1 MiB should be enough */
 	buf = malloc(0x100000);
 	if (!buf)
@@ -1061,6 +1244,10 @@ static int write_each_attr(struct iio_device *dev, enum iio_attr_type type,
 	size_t len = 0x100000;
 	int ret;
 
+	ret = iio_device_populate(dev);
+	if (ret)
+		return ret;
+
 	/* We need a big buffer here; 1 MiB should be enough */
 	buf = malloc(len);
 	if (!buf)
@@ -1192,3 +1379,121 @@ const struct iio_context * iio_device_get_context(const struct iio_device *dev)
 {
 	return dev->ctx;
 }
+
+struct iio_event_stream * iio_device_create_event_stream(
+		const struct iio_device *dev)
+{
+	const struct iio_backend_ops *ops = dev->ctx->ops;
+	struct iio_event_stream *stream;
+	int ret;
+
+	if (!ops->open_events || !ops->read_events || !ops->close_events) {
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	stream = zalloc(sizeof(*stream));
+	if (!stream) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	stream->dev = dev;
+
+	ret = ops->open_events(stream);
+	if (ret < 0) {
+		free(stream);
+		errno = -ret;
+		return NULL;
+	}
+
+	return stream;
+}
+
+void iio_event_stream_destroy(struct iio_event_stream *stream)
+{
+	stream->dev->ctx->ops->close_events(stream);
+	free(stream);
+}
+
+ssize_t iio_event_stream_read(struct iio_event_stream *stream,
+		struct iio_event *events, size_t nb)
+{
+	if (!nb)
+		return -EINVAL;
+
+	return stream->dev->ctx->ops->read_events(stream, events, nb);
+}
+
+/* Layout of the identifiers of the kernel's events, see
+ * include/uapi/linux/iio/events.h */
+enum iio_event_type iio_event_get_type(const struct iio_event *event)
+{
+	return (enum iio_event_type) ((event->id >> 56) & 0xff);
+}
+
+enum iio_event_direction iio_event_get_direction(
+		const struct iio_event *event)
+{
+	return (enum iio_event_direction) ((event->id >> 48) & 0x7f);
+}
+
+/* The events identify the channels by the numbers in their ID, and not by
+ * their index: "voltage1" is 1, and "voltage1-voltage2" is 1 and 2 */
+static void iio_channel_get_numbers(const struct iio_channel *chn,
+		long *num, long *num2)
+{
+	const char *ptr = chn->id + strcspn(chn->id, "0123456789_-");
+	char *end;
+
+	*num = 0;
+	*num2 = -1;
+
+	if (*ptr >= '0' && *ptr <= '9') {
+		*num = strtol(ptr, &end, 10);
+		ptr = end;
+	}
+
+	if (*ptr == '-') {
+		ptr += strcspn(ptr, "0123456789_");
+		if (*ptr >= '0' && *ptr <= '9')
+			*num2 = strtol(ptr, NULL, 10);
+	}
+}
+
+const struct iio_channel * iio_event_get_channel(
+		const struct iio_event *event,
+		const struct iio_device *dev, bool diff)
+{
+	unsigned int i, nb = iio_device_get_channels_count(dev);
+	int type = (int) ((event->id >> 32) & 0xff),
+	    modifier = (int) ((event->id >> 40) & 0xff);
+	bool is_diff = (event->id >> 55) & 0x1;
+	long chn = (long) (int16_t) (event->id & 0xffff),
+	     chn2 = (long) (int16_t) ((event->id >> 16) & 0xffff),
+	     num, num2;
+
+	if (diff && !is_diff)
+		return NULL;
+
+	if (diff) {
+		chn = chn2;
+		chn2 = -1;
+	} else if (!is_diff) {
+		chn2 = -1;
+	}
+
+	for (i = 0; i < nb; i++) {
+		const struct iio_channel *ch = iio_device_get_channel(dev, i);
+
+		if (ch->is_output || (int) ch->type != type ||
+				(int) ch->modifier != modifier)
+			continue;
+
+		iio_channel_get_numbers(ch, &num, &num2);
+		if (num == chn && num2 == chn2)
+			return ch;
+	}
+
+	return NULL;
+}
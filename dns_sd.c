@@ -69,7 +69,7 @@ struct iio_scan_backend_context {
 	struct addrinfo *res;
 };
 
-static int dnssd_fill_context_info(struct iio_context_info *info,
+int dnssd_fill_context_info(struct iio_context_info *info,
 		char *hostname, char *addr_str, int port)
 {
 	struct iio_context *ctx;
@@ -148,55 +148,103 @@ void dnssd_context_scan_free(struct iio_scan_backend_context *ctx)
 	free(ctx);
 }
 
+static bool port_knock(const struct dns_sd_discovery_data *ndata)
+{
+	char port_str[6];
+	struct addrinfo hints, *res, *rp;
+	bool found = false;
+	int fd, ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	iio_snprintf(port_str, sizeof(port_str), "%hu", ndata->port);
+	ret = getaddrinfo(ndata->addr_str, port_str, &hints, &res);
+
+	/* getaddrinfo() returns a list of address structures */
+	if (ret) {
+		IIO_DEBUG("Unable to find host ('%s'): %s\n",
+				ndata->hostname,
+				gai_strerror(ret));
+		return false;
+	}
+
+	for (rp = res; rp != NULL; rp = rp->ai_next) {
+		fd = create_socket(rp, DEFAULT_TIMEOUT_MS);
+		if (fd < 0) {
+			IIO_DEBUG("Unable to open %s%s socket ('%s:%d' %s)\n",
+					rp->ai_family == AF_INET ? "ipv4" : "",
+					rp->ai_family == AF_INET6? "ipv6" : "",
+			ndata->hostname, ndata->port, ndata->addr_str);
+		} else {
+			close(fd);
+			IIO_DEBUG("Something %s%s at '%s:%d' %s)\n",
+					rp->ai_family == AF_INET ? "ipv4" : "",
+					rp->ai_family == AF_INET6? "ipv6" : "",
+					ndata->hostname, ndata->port, ndata->addr_str);
+			found = true;
+		}
+	}
+
+	freeaddrinfo(res);
+	return found;
+}
+
+struct port_knock_data {
+	const struct dns_sd_discovery_data *ndata;
+	struct iio_thrd *thrd;
+	bool found;
+};
+
+static int port_knock_thd(void *d)
+{
+	struct port_knock_data *knock = d;
+
+	knock->found = port_knock(knock->ndata);
+	return 0;
+}
+
 /*
  * remove the ones in the list that you can't connect to
  * This is sort of silly, but we have seen non-iio devices advertised
  * and discovered on the network. Oh well....
+ * The hosts are probed concurrently; the list ends with an empty node.
  */
 void port_knock_discovery_data(struct dns_sd_discovery_data **ddata)
 {
 	struct dns_sd_discovery_data *d, *ndata;
-	int i, ret;
+	struct port_knock_data *knocks;
+	unsigned int i, j, nb = 0;
 
 	d = *ddata;
 	iio_mutex_lock(d->lock);
-	for (i = 0, ndata = d; ndata->next != NULL; ) {
-		char port_str[6];
-		struct addrinfo hints, *res, *rp;
-		int fd;
-		bool found = false;
-
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-
-		iio_snprintf(port_str, sizeof(port_str), "%hu", ndata->port);
-		ret = getaddrinfo(ndata->addr_str, port_str, &hints, &res);
-
-		/* getaddrinfo() returns a list of address structures */
-		if (ret) {
-			IIO_DEBUG("Unable to find host ('%s'): %s\n",
-					ndata->hostname,
-					gai_strerror(ret));
+
+	for (ndata = d; ndata->next != NULL; ndata = ndata->next)
+		nb++;
+
+	knocks = calloc(nb, sizeof(*knocks));
+
+	for (i = 0, ndata = d; knocks && ndata->next != NULL;
+			ndata = ndata->next, i++) {
+		knocks[i].ndata = ndata;
+		knocks[i].thrd = iio_thrd_create(port_knock_thd,
+				&knocks[i], "port_knock");
+		if (!knocks[i].thrd)
+			port_knock_thd(&knocks[i]);
+	}
+
+	for (i = 0, j = 0, ndata = d; ndata->next != NULL; j++) {
+		bool found;
+
+		if (knocks) {
+			if (knocks[j].thrd)
+				iio_thrd_join_and_destroy(knocks[j].thrd);
+			found = knocks[j].found;
 		} else {
-			for (rp = res; rp != NULL; rp = rp->ai_next) {
-				fd = create_socket(rp, DEFAULT_TIMEOUT_MS);
-				if (fd < 0) {
-					IIO_DEBUG("Unable to open %s%s socket ('%s:%d' %s)\n",
-							rp->ai_family == AF_INET ? "ipv4" : "",
-							rp->ai_family == AF_INET6? "ipv6" : "",
-					ndata->hostname, ndata->port, ndata->addr_str);
-				} else {
-					close(fd);
-					IIO_DEBUG("Something %s%s at '%s:%d' %s)\n",
-							rp->ai_family == AF_INET ? "ipv4" : "",
-							rp->ai_family == AF_INET6? "ipv6" : "",
-							ndata->hostname, ndata->port, ndata->addr_str);
-					found = true;
-				}
-			}
+			found = port_knock(ndata);
 		}
-		freeaddrinfo(res);
+
 		ndata = ndata->next;
 		if (found) {
 			i++;
@@ -204,6 +252,8 @@ void port_knock_discovery_data(struct dns_sd_discovery_data **ddata)
 			dnssd_remove_node(&d, i);
 		}
 	}
+
+	free(knocks);
 	iio_mutex_unlock(d->lock);
 	*ddata = d;
 
@@ -241,11 +291,139 @@ void remove_dup_discovery_data(struct dns_sd_discovery_data **ddata)
 	*ddata = d;
 }
 
+/* The contexts of the hosts are created concurrently; the threads probing
+ * the hosts past the deadline outlive the scan */
+struct dnssd_host_scan {
+	struct iio_mutex *lock;
+	struct iio_cond *cond;
+	unsigned int refcount, nb_pending;
+
+	struct dnssd_host *hosts;
+	unsigned int nb_hosts;
+};
+
+struct dnssd_host {
+	struct dnssd_host_scan *scan;
+	char *hostname;
+	char addr_str[DNS_SD_ADDRESS_STR_MAX];
+	uint16_t port;
+
+	struct iio_context_info info;
+	bool done;
+	int ret;
+};
+
+static void dnssd_host_scan_unref(struct dnssd_host_scan *scan)
+{
+	unsigned int i, refcount;
+
+	iio_mutex_lock(scan->lock);
+	refcount = --scan->refcount;
+	iio_mutex_unlock(scan->lock);
+
+	if (refcount)
+		return;
+
+	for (i = 0; i < scan->nb_hosts; i++) {
+		free(scan->hosts[i].hostname);
+		free(scan->hosts[i].info.description);
+		free(scan->hosts[i].info.uri);
+	}
+
+	iio_cond_destroy(scan->cond);
+	iio_mutex_destroy(scan->lock);
+	free(scan->hosts);
+	free(scan);
+}
+
+static int dnssd_host_thd(void *d)
+{
+	struct dnssd_host *host = d;
+	struct dnssd_host_scan *scan = host->scan;
+	struct iio_context_info info = { NULL, NULL };
+	int ret;
+
+	ret = dnssd_fill_context_info(&info, host->hostname,
+			host->addr_str, host->port);
+
+	iio_mutex_lock(scan->lock);
+	host->info = info;
+	host->ret = ret;
+	host->done = true;
+	scan->nb_pending--;
+	iio_cond_broadcast(scan->cond);
+	iio_mutex_unlock(scan->lock);
+
+	dnssd_host_scan_unref(scan);
+	return ret;
+}
+
+static struct dnssd_host_scan *
+dnssd_host_scan_new(const struct dns_sd_discovery_data *ddata)
+{
+	const struct dns_sd_discovery_data *ndata;
+	struct dnssd_host_scan *scan;
+	unsigned int i;
+
+	scan = zalloc(sizeof(*scan));
+	if (!scan)
+		return NULL;
+
+	for (ndata = ddata; ndata->next != NULL; ndata = ndata->next)
+		scan->nb_hosts++;
+
+	if (scan->nb_hosts) {
+		scan->hosts = calloc(scan->nb_hosts, sizeof(*scan->hosts));
+		if (!scan->hosts)
+			goto err_free_scan;
+	}
+
+	scan->lock = iio_mutex_create();
+	if (!scan->lock)
+		goto err_free_hosts;
+
+	scan->cond = iio_cond_create();
+	if (!scan->cond)
+		goto err_destroy_lock;
+
+	scan->refcount = 1;
+
+	for (i = 0, ndata = ddata; i < scan->nb_hosts;
+			i++, ndata = ndata->next) {
+		struct dnssd_host *host = &scan->hosts[i];
+
+		host->scan = scan;
+		host->port = ndata->port;
+		iio_strlcpy(host->addr_str, ndata->addr_str,
+				sizeof(host->addr_str));
+
+		host->hostname = iio_strdup(ndata->hostname);
+		if (!host->hostname) {
+			dnssd_host_scan_unref(scan);
+			return NULL;
+		}
+	}
+
+	return scan;
+
+err_destroy_lock:
+	iio_mutex_destroy(scan->lock);
+err_free_hosts:
+	free(scan->hosts);
+err_free_scan:
+	free(scan);
+	return NULL;
+}
+
 int dnssd_context_scan(struct iio_scan_backend_context *ctx,
-		struct iio_scan_result *scan_result)
+		struct iio_scan_result *scan_result, uint64_t deadline)
 {
 	struct iio_context_info **info;
-	struct dns_sd_discovery_data *ddata, *ndata;
+	struct dns_sd_discovery_data *ddata;
+	struct dnssd_host_scan *scan;
+	struct iio_thrd *thrd;
+	uint64_t now;
+	unsigned int i;
 	int ret = 0;
 
 	ret = dnssd_find_hosts(&ddata);
@@ -259,7 +437,59 @@ int dnssd_context_scan(struct iio_scan_backend_context *ctx,
 	if (ret < 0)
 		goto fail;
 
-	for (ndata = ddata; ndata->next != NULL; ndata = ndata->next) {
+	scan = dnssd_host_scan_new(ddata);
+	if (!scan) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	for (i = 0; i < scan->nb_hosts; i++) {
+		iio_mutex_lock(scan->lock);
+		scan->refcount++;
+		scan->nb_pending++;
+		iio_mutex_unlock(scan->lock);
+
+		thrd = iio_thrd_create(dnssd_host_thd,
+				&scan->hosts[i], "dnssd_host");
+		if (thrd)
+			iio_thrd_detach(thrd);
+		else
+			dnssd_host_thd(&scan->hosts[i]);
+	}
+
+	iio_mutex_lock(scan->lock);
+
+	while (scan->nb_pending) {
+		if (!deadline) {
+			iio_cond_wait(scan->cond, scan->lock);
+			continue;
+		}
+
+		now = iio_get_monotonic_ns();
+		if (now >= deadline)
+			break;
+
+		iio_cond_wait_timeout(scan->cond, scan->lock,
+				(unsigned int) ((deadline - now + 999999) / 1000000));
+	}
+
+	/* The results are listed in the order the hosts were discovered */
+	for (i = 0; i < scan->nb_hosts; i++) {
+		struct dnssd_host *host = &scan->hosts[i];
+
+		if (!host->done) {
+			IIO_DEBUG("Timed out probing %s (%s)\n",
+					host->hostname, host->addr_str);
+			continue;
+		}
+
+		if (host->ret < 0) {
+			IIO_DEBUG("Failed to add %s (%s) err: %d\n",
+					host->hostname, host->addr_str,
+					host->ret);
+			continue;
+		}
+
 		info = iio_scan_result_add(scan_result, 1);
 		if (!info) {
 			IIO_ERROR("Out of memory when adding new scan result\n");
@@ -267,14 +497,14 @@ int dnssd_context_scan(struct iio_scan_backend_context *ctx,
 			break;
 		}
 
-		ret = dnssd_fill_context_info(*info,
-				ndata->hostname, ndata->addr_str,ndata->port);
-		if (ret < 0) {
-			IIO_DEBUG("Failed to add %s (%s) err: %d\n", ndata->hostname, ndata->addr_str, ret);
-			break;
-		}
+		**info = host->info;
+		host->info.description = NULL;
+		host->info.uri = NULL;
 	}
 
+	iio_mutex_unlock(scan->lock);
+	dnssd_host_scan_unref(scan);
+
 fail:
 	dnssd_free_all_discovery_data(ddata);
 	return ret;
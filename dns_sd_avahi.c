@@ -254,3 +254,359 @@ err_free_poll:
 
 	return ret;
 }
+
+/*
+ * Watch of the IIOD services appearing and disappearing. The browser and
+ * the resolvers run in the thread of Avahi, which must not block: the
+ * resolved services are queued, and connected to by a thread of the watch
+ * before being reported to the monitor.
+ */
+
+struct avahi_watch_service {
+	AvahiIfIndex iface;
+	AvahiProtocol proto;
+	char *name;
+
+	/* Set once resolved */
+	char addr_str[DNS_SD_ADDRESS_STR_MAX];
+	char *hostname;
+	uint16_t port;
+
+	/* Set once reported to the monitor */
+	char *uri;
+
+	bool queued, probing, removed;
+	struct avahi_watch_service *next;
+};
+
+struct iio_scan_backend_watch {
+	struct iio_scan_monitor *mon;
+
+	AvahiThreadedPoll *poll;
+	AvahiClient *client;
+	AvahiServiceBrowser *browser;
+
+	struct iio_thrd *thrd;
+	struct iio_mutex *lock;
+	struct iio_cond *cond;
+	bool stop;
+
+	struct avahi_watch_service *services;
+};
+
+static void avahi_watch_service_free(struct avahi_watch_service *service)
+{
+	free(service->name);
+	free(service->hostname);
+	free(service->uri);
+	free(service);
+}
+
+static struct avahi_watch_service ** avahi_watch_find(
+		struct iio_scan_backend_watch *watch, AvahiIfIndex iface,
+		AvahiProtocol proto, const char *name)
+{
+	struct avahi_watch_service **it;
+
+	for (it = &watch->services; *it; it = &(*it)->next) {
+		if ((*it)->iface == iface && (*it)->proto == proto &&
+				!strcmp((*it)->name, name))
+			break;
+	}
+
+	return it;
+}
+
+static void __avahi_watch_resolver_cb(AvahiServiceResolver *resolver,
+		AvahiIfIndex iface, AvahiProtocol proto,
+		AvahiResolverEvent event, const char *name,
+		__notused const char *type, __notused const char *domain,
+		const char *host_name, const AvahiAddress *address,
+		uint16_t port, __notused AvahiStringList *txt,
+		__notused AvahiLookupResultFlags flags, void *d)
+{
+	struct iio_scan_backend_watch *watch = d;
+	struct avahi_watch_service *service;
+
+	if (event != AVAHI_RESOLVER_FOUND) {
+		IIO_DEBUG("Avahi Watch: Failed to resolve service '%s'\n", name);
+		goto out_free_resolver;
+	}
+
+	iio_mutex_lock(watch->lock);
+
+	/* The service may have been removed in the meantime */
+	service = *avahi_watch_find(watch, iface, proto, name);
+	if (service && !service->hostname) {
+		service->hostname = iio_strdup(host_name);
+		if (service->hostname) {
+			avahi_address_snprint(service->addr_str,
+					sizeof(service->addr_str), address);
+			service->port = port;
+			service->queued = true;
+			iio_cond_broadcast(watch->cond);
+		}
+	}
+
+	iio_mutex_unlock(watch->lock);
+
+out_free_resolver:
+	avahi_service_resolver_free(resolver);
+}
+
+static void avahi_watch_add(struct iio_scan_backend_watch *watch,
+		AvahiIfIndex iface, AvahiProtocol proto, const char *name,
+		const char *type, const char *domain)
+{
+	struct avahi_watch_service *service;
+
+	iio_mutex_lock(watch->lock);
+
+	if (*avahi_watch_find(watch, iface, proto, name))
+		goto out_unlock;
+
+	service = zalloc(sizeof(*service));
+	if (!service)
+		goto out_unlock;
+
+	service->iface = iface;
+	service->proto = proto;
+	service->name = iio_strdup(name);
+
+	if (!service->name || !avahi_service_resolver_new(watch->client,
+				iface, proto, name, type, domain,
+				AVAHI_PROTO_UNSPEC, 0,
+				__avahi_watch_resolver_cb, watch)) {
+		IIO_ERROR("Failed to resolve service '%s'\n", name);
+		avahi_watch_service_free(service);
+		goto out_unlock;
+	}
+
+	service->next = watch->services;
+	watch->services = service;
+
+out_unlock:
+	iio_mutex_unlock(watch->lock);
+}
+
+static void avahi_watch_remove(struct iio_scan_backend_watch *watch,
+		AvahiIfIndex iface, AvahiProtocol proto, const char *name)
+{
+	struct avahi_watch_service **it, *service;
+
+	iio_mutex_lock(watch->lock);
+
+	it = avahi_watch_find(watch, iface, proto, name);
+	service = *it;
+	if (!service)
+		goto out_unlock;
+
+	if (service->probing) {
+		/* Freed by the thread of the watch once done */
+		service->removed = true;
+		goto out_unlock;
+	}
+
+	*it = service->next;
+
+	if (service->uri)
+		iio_scan_monitor_remove(watch->mon, watch, service->uri);
+	avahi_watch_service_free(service);
+
+out_unlock:
+	iio_mutex_unlock(watch->lock);
+}
+
+static void __avahi_watch_browser_cb(AvahiServiceBrowser *browser,
+		AvahiIfIndex iface, AvahiProtocol proto,
+		AvahiBrowserEvent event, const char *name,
+		const char *type, const char *domain,
+		__notused AvahiLookupResultFlags flags, void *d)
+{
+	struct iio_scan_backend_watch *watch = d;
+
+	switch (event) {
+	case AVAHI_BROWSER_NEW:
+		IIO_DEBUG("Avahi Watch: NEW: service '%s'\n", name);
+		avahi_watch_add(watch, iface, proto, name, type, domain);
+		break;
+	case AVAHI_BROWSER_REMOVE:
+		IIO_DEBUG("Avahi Watch: REMOVE: service '%s'\n", name);
+		avahi_watch_remove(watch, iface, proto, name);
+		break;
+	case AVAHI_BROWSER_FAILURE:
+		IIO_ERROR("Avahi Watch: browser failure: %s\n",
+				avahi_strerror(avahi_client_errno(
+						avahi_service_browser_get_client(
+							browser))));
+		break;
+	default:
+		break;
+	}
+}
+
+static int avahi_watch_thd(void *d)
+{
+	struct iio_scan_backend_watch *watch = d;
+	struct avahi_watch_service *service, **it;
+	struct iio_context_info info;
+	int ret;
+
+	iio_mutex_lock(watch->lock);
+
+	while (!watch->stop) {
+		for (service = watch->services; service; service = service->next)
+			if (service->queued)
+				break;
+
+		if (!service) {
+			iio_cond_wait(watch->cond, watch->lock);
+			continue;
+		}
+
+		service->queued = false;
+		service->probing = true;
+
+		/* Connecting to the host may take a while */
+		iio_mutex_unlock(watch->lock);
+		info.uri = NULL;
+		info.description = NULL;
+		ret = dnssd_fill_context_info(&info, service->hostname,
+				service->addr_str, service->port);
+		iio_mutex_lock(watch->lock);
+
+		service->probing = false;
+
+		if (service->removed) {
+			for (it = &watch->services; *it != service;
+					it = &(*it)->next);
+			*it = service->next;
+			avahi_watch_service_free(service);
+		} else if (!ret && !iio_scan_monitor_add(watch->mon, watch,
+					info.uri, info.description)) {
+			service->uri = info.uri;
+			info.uri = NULL;
+		}
+
+		if (!ret) {
+			free(info.uri);
+			free(info.description);
+		}
+	}
+
+	iio_mutex_unlock(watch->lock);
+	return 0;
+}
+
+struct iio_scan_backend_watch * dnssd_context_watch_start(
+		struct iio_scan_monitor *mon)
+{
+	struct iio_scan_backend_watch *watch;
+	int ret = 0;
+
+	watch = zalloc(sizeof(*watch));
+	if (!watch) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	watch->mon = mon;
+
+	watch->lock = iio_mutex_create();
+	if (!watch->lock) {
+		ret = -ENOMEM;
+		goto err_free_watch;
+	}
+
+	watch->cond = iio_cond_create();
+	if (!watch->cond) {
+		ret = -ENOMEM;
+		goto err_destroy_lock;
+	}
+
+	watch->poll = avahi_threaded_poll_new();
+	if (!watch->poll) {
+		ret = -ENOMEM;
+		goto err_destroy_cond;
+	}
+
+	watch->client = avahi_client_new(avahi_threaded_poll_get(watch->poll),
+			0, NULL, NULL, &ret);
+	if (!watch->client) {
+		IIO_ERROR("Unable to create Avahi DNS-SD client :%s\n",
+				avahi_strerror(ret));
+		ret = -ENXIO;
+		goto err_free_poll;
+	}
+
+	watch->browser = avahi_service_browser_new(watch->client,
+			AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
+			"_iio._tcp", NULL, 0, __avahi_watch_browser_cb, watch);
+	if (!watch->browser) {
+		IIO_ERROR("Unable to create Avahi DNS-SD browser: %s\n",
+				avahi_strerror(avahi_client_errno(watch->client)));
+		ret = -ENXIO;
+		goto err_free_client;
+	}
+
+	watch->thrd = iio_thrd_create(avahi_watch_thd, watch, "avahi_watch");
+	if (!watch->thrd) {
+		ret = -errno;
+		goto err_free_client;
+	}
+
+	if (avahi_threaded_poll_start(watch->poll) < 0) {
+		ret = -ENXIO;
+		goto err_stop_thrd;
+	}
+
+	return watch;
+
+err_stop_thrd:
+	iio_mutex_lock(watch->lock);
+	watch->stop = true;
+	iio_cond_broadcast(watch->cond);
+	iio_mutex_unlock(watch->lock);
+	iio_thrd_join_and_destroy(watch->thrd);
+err_free_client:
+	/* Also frees the browser */
+	avahi_client_free(watch->client);
+err_free_poll:
+	avahi_threaded_poll_free(watch->poll);
+err_destroy_cond:
+	iio_cond_destroy(watch->cond);
+err_destroy_lock:
+	iio_mutex_destroy(watch->lock);
+err_free_watch:
+	free(watch);
+	errno = -ret;
+	return NULL;
+}
+
+void dnssd_context_watch_stop(struct iio_scan_backend_watch *watch)
+{
+	struct avahi_watch_service *service;
+
+	/* No more callbacks from here */
+	avahi_threaded_poll_stop(watch->poll);
+
+	iio_mutex_lock(watch->lock);
+	watch->stop = true;
+	iio_cond_broadcast(watch->cond);
+	iio_mutex_unlock(watch->lock);
+
+	iio_thrd_join_and_destroy(watch->thrd);
+
+	avahi_client_free(watch->client);
+	avahi_threaded_poll_free(watch->poll);
+
+	while (watch->services) {
+		service = watch->services;
+		watch->services = service->next;
+		avahi_watch_service_free(service);
+	}
+
+	iio_cond_destroy(watch->cond);
+	iio_mutex_destroy(watch->lock);
+	free(watch);
+}
@@ -248,3 +248,15 @@ exit:
 	iio_mutex_destroy(d->lock);
 	return ret;
 }
+
+/* Not implemented: the scan monitors browse for the services periodically */
+struct iio_scan_backend_watch * dnssd_context_watch_start(
+		struct iio_scan_monitor *mon)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void dnssd_context_watch_stop(struct iio_scan_backend_watch *watch)
+{
+}
@@ -263,3 +263,15 @@ int dnssd_find_hosts(struct dns_sd_discovery_data** ddata)
 
 	return 0;
 }
+
+/* Not implemented: the scan monitors browse for the services periodically */
+struct iio_scan_backend_watch * dnssd_context_watch_start(
+		struct iio_scan_monitor *mon)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void dnssd_context_watch_stop(struct iio_scan_backend_watch *watch)
+{
+}
@@ -20,6 +20,8 @@
 #define _IIO_LOCK_H
 
 struct iio_mutex;
+struct iio_cond;
+struct iio_thrd;
 
 struct iio_mutex * iio_mutex_create(void);
 void iio_mutex_destroy(struct iio_mutex *lock);
@@ -27,4 +29,27 @@ void iio_mutex_destroy(struct iio_mutex *lock);
 void iio_mutex_lock(struct iio_mutex *lock);
 void iio_mutex_unlock(struct iio_mutex *lock);
 
+/* Mutex protecting the state shared by the whole process; never destroyed */
+struct iio_mutex * iio_mutex_get_global(void);
+
+struct iio_cond * iio_cond_create(void);
+void iio_cond_destroy(struct iio_cond *cond);
+
+/* The mutex is released while waiting, and locked again on return */
+void iio_cond_wait(struct iio_cond *cond, struct iio_mutex *lock);
+
+/* Returns -ETIMEDOUT if the condition was not signaled in time */
+int iio_cond_wait_timeout(struct iio_cond *cond, struct iio_mutex *lock,
+		unsigned int timeout_ms);
+
+void iio_cond_broadcast(struct iio_cond *cond);
+
+/* Returns NULL with errno set on failure */
+struct iio_thrd * iio_thrd_create(int (*thrd)(void *),
+		void *d, const char *name);
+int iio_thrd_join_and_destroy(struct iio_thrd *thrd);
+
+/* The thread then frees its resources once it returns */
+void iio_thrd_detach(struct iio_thrd *thrd);
+
 #endif /* _IIO_LOCK_H */
@@ -111,10 +111,98 @@ static inline void *zalloc(size_t size)
 	return calloc(1, size);
 }
 
-enum iio_attr_type {
-	IIO_ATTR_TYPE_DEVICE = 0,
-	IIO_ATTR_TYPE_DEBUG,
-	IIO_ATTR_TYPE_BUFFER,
+/*
+ * Header of the frames exchanged by iiod and its clients once the binary
+ * protocol has been negotiated with the BINARY command; all the fields are
+ * in network order. The payload of a response holds the bytes that follow
+ * the integer in the text protocol, except for the mask of channels sent by
+ * READBUF, which is sent as binary words (IIOD_FRAME_MASK).
+ */
+struct iiod_frame_header {
+	uint32_t tag;	/* Identifier of the request, echoed in the responses */
+	int32_t code;	/* Responses: return code or length of the data */
+	uint32_t len;	/* Number of bytes of payload following the header */
+	uint32_t flags;
+};
+
+#define IIOD_FRAME_MASK BIT(0)
+
+/*
+ * Set on the responses of READBUF whose samples were sent as datagrams, once
+ * the client negotiated the UDP data plane with the UDP command. The payload
+ * of the frame then only holds the mask (if any) followed by a struct
+ * iiod_udp_info; the code still is the length of the data.
+ */
+#define IIOD_FRAME_UDP BIT(1)
+
+/* Each datagram carries IIOD_UDP_PAYLOAD bytes of the chunk, except the last
+ * one; the n-th datagram of a chunk holds the bytes starting at
+ * n * IIOD_UDP_PAYLOAD, so that lost datagrams can be located. */
+#define IIOD_UDP_PAYLOAD 1400
+
+/* Largest number of registers accessed by one call of
+ * iio_device_reg_{read,write}_bulk(), and thus by one command of iiod */
+#define IIO_MAX_REGS 65536
+
+/* Set on the responses of READBUF whose samples were compressed, once the
+ * client negotiated it with the COMPRESS command; see iiod-codec.h. The
+ * code still is the length of the uncompressed data. */
+#define IIOD_FRAME_PACKED BIT(2)
+#define IIOD_FRAME_DELTA BIT(3)
+
+/* Set on all the frames sent by both sides once the client negotiated it
+ * with the CRC command, whose acknowledgement is the last frame sent without
+ * it. The payload is then followed by the CRC-32 of the header and payload,
+ * in network order; see iiod_crc32(). */
+#define IIOD_FRAME_CRC BIT(4)
+
+/*
+ * Set on the responses of READBUF whose samples were written to the shared
+ * memory of the client, once a client running on the same host negotiated
+ * it with the SHM command. The payload of the frame then only holds the mask
+ * (if any) followed by a struct iiod_shm_info; the code still is the length
+ * of the data.
+ */
+#define IIOD_FRAME_SHM BIT(5)
+
+/*
+ * Set on the responses of READBUF sent after iiod dropped blocks of samples
+ * the client was too slow to read, with the ring of the device full and
+ * --drop-oldest. The payload then starts, after the mask if any, with the
+ * number of blocks dropped since the previous response, as a 32-bit word in
+ * network order.
+ */
+#define IIOD_FRAME_DROPPED BIT(6)
+
+/*
+ * Header of the shared memory object given to the SHM command, created and
+ * filled by the client; the fields are in host order. The chunk of sequence
+ * number n is written to the slot n % nb_slots, which starts at
+ * IIOD_SHM_DATA_OFFSET + (n % nb_slots) * slot_size. The client sets
+ * 'released' to n + 1 once it copied the chunk n out of its slot; iiod only
+ * writes a slot that was released, and sends the samples in the frame
+ * otherwise. iiod only accepts an object owned by the user of the client.
+ */
+struct iiod_shm_header {
+	uint32_t nb_slots;
+	uint32_t slot_size;
+	uint32_t released;
+};
+
+#define IIOD_SHM_DATA_OFFSET 4096
+
+struct iiod_shm_info {
+	uint32_t seq;	/* Sequence number of the chunk */
+};
+
+struct iiod_udp_header {
+	uint32_t seq;	/* Sequence number of the datagram */
+	uint32_t len;	/* Length of the whole chunk */
+};
+
+struct iiod_udp_info {
+	uint32_t first_seq;	/* Sequence number of the first datagram */
+	uint32_t nb;		/* Number of datagrams sent for the chunk */
 };
 
 struct iio_backend_ops {
@@ -126,6 +214,11 @@ struct iio_backend_ops {
 	int (*open)(const struct iio_device *dev,
 			size_t samples_count, bool cyclic);
 	int (*close)(const struct iio_device *dev);
+
+	/* Optional; changes the channels and samples count of an opened
+	 * device, without closing it */
+	int (*reconfigure)(const struct iio_device *dev, size_t samples_count);
+
 	int (*get_fd)(const struct iio_device *dev);
 	int (*set_blocking_mode)(const struct iio_device *dev, bool blocking);
 
@@ -133,9 +226,23 @@ struct iio_backend_ops {
 
 	int (*set_kernel_buffers_count)(const struct iio_device *dev,
 			unsigned int nb_blocks);
+	int (*set_cyclic_buffers_count)(const struct iio_device *dev,
+			unsigned int nb_blocks);
 	ssize_t (*get_buffer)(const struct iio_device *dev,
 			void **addr_ptr, size_t bytes_used,
 			uint32_t *mask, size_t words);
+	ssize_t (*dequeue_block)(const struct iio_device *dev,
+			void **addr_ptr);
+	int (*enqueue_block)(const struct iio_device *dev,
+			void *addr, size_t bytes_used);
+	int (*submit_buffer)(const struct iio_device *dev,
+			void *addr, size_t len);
+	ssize_t (*complete_buffer)(const struct iio_device *dev,
+			void **addr_ptr, size_t len,
+			uint32_t *mask, size_t words, bool wait);
+	int (*get_xflow_count)(const struct iio_device *dev, uint64_t *count);
+	int (*set_decimation)(const struct iio_device *dev,
+			unsigned int factor, bool average);
 
 	ssize_t (*read_device_attr)(const struct iio_device *dev,
 			const char *attr, char *dst, size_t len, enum iio_attr_type);
@@ -146,6 +253,21 @@ struct iio_backend_ops {
 			const char *attr, char *dst, size_t len);
 	ssize_t (*write_channel_attr)(const struct iio_channel *chn,
 			const char *attr, const char *src, size_t len);
+	int (*read_attrs)(const struct iio_context *ctx,
+			struct iio_attr_read_req *reqs, unsigned int nb_reqs);
+	int (*write_attrs)(const struct iio_context *ctx,
+			struct iio_attr_write_req *reqs, unsigned int nb_reqs);
+	int (*read_regs)(const struct iio_device *dev,
+			const uint32_t *addrs, uint32_t *values, unsigned int nb);
+	int (*write_regs)(const struct iio_device *dev, const uint32_t *addrs,
+			const uint32_t *values, unsigned int nb);
+
+	/* Optional; see iio_device_create_event_stream(). read_events blocks
+	 * up to the timeout of the context. */
+	int (*open_events)(struct iio_event_stream *stream);
+	ssize_t (*read_events)(struct iio_event_stream *stream,
+			struct iio_event *events, size_t nb);
+	void (*close_events)(struct iio_event_stream *stream);
 
 	int (*get_trigger)(const struct iio_device *dev,
 			const struct iio_device **trigger);
@@ -158,6 +280,24 @@ struct iio_backend_ops {
 			unsigned int *minor, char git_tag[8]);
 
 	int (*set_timeout)(struct iio_context *ctx, unsigned int timeout);
+
+	/* Optional; cache of the values of the attributes. set_attr_cache()
+	 * sets the default TTL when attr is NULL, the TTL of the attributes
+	 * of that name otherwise. */
+	int (*set_attr_cache)(const struct iio_context *ctx,
+			const char *attr, int ttl_ms);
+	void (*invalidate_attr_cache)(const struct iio_context *ctx);
+	int (*get_attr_cache_stats)(const struct iio_context *ctx,
+			struct iio_attr_cache_stats *stats);
+
+	/* Optional; reads the channels and attributes of a device that was
+	 * only listed when the context was created. Must be thread-safe, and
+	 * return 0 once the device is populated. */
+	int (*populate_device)(const struct iio_device *dev);
+
+	/* Optional; generates the XML of the context on first request,
+	 * instead of iio_context_init() */
+	const char * (*get_xml)(const struct iio_context *ctx);
 };
 
 /*
@@ -168,19 +308,45 @@ struct iio_backend_ops {
 struct iio_context_pdata;
 struct iio_device_pdata;
 struct iio_channel_pdata;
+struct iio_event_stream_pdata;
 struct iio_scan_backend_context;
+struct iio_scan_backend_watch;
+struct iio_arena;
+struct iio_mutex;
 
 struct iio_channel_attr {
 	char *name;
 	char *filename;
 };
 
+/* Names of the elements of a table, sorted for binary searches; see sort.h.
+ * The group separates the input and output channels, and is 0 otherwise. */
+struct iio_index_entry {
+	const char *key;
+	unsigned int group, pos;
+};
+
+struct iio_index {
+	struct iio_index_entry *entries;
+	unsigned int nb;
+};
+
 struct iio_context {
 	struct iio_context_pdata *pdata;
 	const struct iio_backend_ops *ops;
 	const char *name;
 	char *description;
 
+	/* Holds the description, devices and channels of the context, along
+	 * with their names, attributes, indexes and masks; see arena.h */
+	struct iio_arena *arena;
+
+	/* Set on the contexts created by iio_context_clone_description(): the
+	 * arena of the original context, with the description and the XML
+	 * they share. The arena above then only holds the structures of the
+	 * devices and channels. */
+	struct iio_arena *shared_arena;
+
 	struct iio_device **devices;
 	unsigned int nb_devices;
 
@@ -189,6 +355,14 @@ struct iio_context {
 	char **attrs;
 	char **values;
 	unsigned int nb_attrs;
+
+	/* Built by iio_context_init(), with the IDs and names of the devices */
+	struct iio_index devices_index;
+
+	/* Statistics of the devices, allocated once they are first enabled */
+	struct iio_stats *stats;
+	struct iio_mutex *stats_lock;
+	bool stats_enabled;
 };
 
 struct iio_channel {
@@ -206,10 +380,21 @@ struct iio_channel {
 
 	struct iio_channel_attr *attrs;
 	unsigned int nb_attrs;
+	struct iio_index attrs_index;
 
 	unsigned int number;
 };
 
+/* Settings of the memory of the buffers allocated by libiio, see memory.c */
+struct iio_buffer_memory {
+	enum iio_buffer_memory_type type;
+	bool numa_bind;
+	unsigned int numa_node;
+
+	const struct iio_buffer_allocator *allocator;
+	void *allocator_data;
+};
+
 struct iio_device {
 	const struct iio_context *ctx;
 	struct iio_device_pdata *pdata;
@@ -229,8 +414,26 @@ struct iio_device {
 	struct iio_channel **channels;
 	unsigned int nb_channels;
 
+	/* Built by iio_context_init(); the one of the channels holds both
+	 * their IDs and names */
+	struct iio_index attrs_index, buffer_attrs_index, debug_attrs_index;
+	struct iio_index channels_index;
+
 	uint32_t *mask;
 	size_t words;
+
+	/* Statistics of each operation, see stats.c; NULL until they are
+	 * enabled on the context */
+	struct iio_stats *stats;
+
+	/* Memory of the buffers created next */
+	struct iio_buffer_memory memory;
+};
+
+/* Scale and offset of a channel, cached by the buffer */
+struct iio_channel_units {
+	double scale, offset;
+	bool valid;
 };
 
 struct iio_buffer {
@@ -241,7 +444,58 @@ struct iio_buffer {
 	uint32_t *mask;
 	unsigned int dev_sample_size;
 	unsigned int sample_size;
-	bool is_output, dev_is_high_speed;
+	bool is_output, dev_is_high_speed, cyclic;
+
+	/* Set if iio_buffer_reconfigure() could not reopen the device */
+	bool closed;
+
+	/* How the memory of the buffer was allocated, if not high-speed */
+	struct iio_buffer_memory memory;
+
+	/* One entry per channel of the device, allocated the first time the
+	 * samples are converted to physical units */
+	struct iio_channel_units *units;
+
+	/* Number of requests submitted with iio_buffer_submit() and not
+	 * completed yet */
+	unsigned int nb_pending;
+
+	/* Metadata of the last block transferred, see
+	 * iio_buffer_get_block_info() */
+	uint64_t timestamp, nb_blocks;
+	size_t bytes_used;
+
+	/* Offset of each channel's data within one sample, indexed by
+	 * channel number; rebuilt every time the buffer's mask changes. */
+	size_t *offsets;
+
+	/* Scratch arrays of iio_buffer_interleave/deinterleave, one entry per
+	 * channel of the device */
+	const struct iio_channel **plane_chns;
+	size_t *plane_offsets;
+	void **plane_ptrs;
+};
+
+struct iio_buffer_set {
+	const struct iio_device *dev;
+	struct iio_buffer **buffers;
+	unsigned int nb_buffers;
+
+	/* Ring of the buffers owned by the backend, in submission order */
+	unsigned int *queue;
+	unsigned int queue_head, nb_queued;
+
+	/* Buffers owned by no one: never used, or whose request failed */
+	unsigned int *free_list;
+	unsigned int nb_free;
+
+	/* Buffers currently handed to the application */
+	bool *acquired;
+};
+
+struct iio_event_stream {
+	const struct iio_device *dev;
+	struct iio_event_stream_pdata *pdata;
 };
 
 struct iio_context_info {
@@ -257,8 +511,10 @@ struct iio_scan_result {
 struct iio_context_info ** iio_scan_result_add(
 	struct iio_scan_result *scan_result, size_t num);
 
-void free_channel(struct iio_channel *chn);
-void free_device(struct iio_device *dev);
+int iio_channel_init_index(struct iio_channel *chn);
+int iio_device_init_index(struct iio_device *dev);
+int iio_device_init(struct iio_device *dev);
+int iio_device_populate(const struct iio_device *dev);
 
 char *iio_channel_get_xml(const struct iio_channel *chn, size_t *len);
 char *iio_device_get_xml(const struct iio_device *dev, size_t *len);
@@ -267,6 +523,13 @@ char *encode_xml_ndup(const char * input);
 char *iio_context_create_xml(const struct iio_context *ctx);
 int iio_context_init(struct iio_context *ctx);
 
+/* Creates a context sharing the description of ctx, with new structures for
+ * the devices and channels, whose pdata are NULL. The description must not
+ * be modified anymore by either context. On error, errno is set and pdata
+ * is not freed. */
+struct iio_context * iio_context_clone_description(
+		const struct iio_context *ctx, struct iio_context_pdata *pdata);
+
 bool iio_device_is_tx(const struct iio_device *dev);
 int iio_device_open(const struct iio_device *dev,
 		size_t samples_count, bool cyclic);
@@ -281,8 +544,10 @@ int iio_device_get_poll_fd(const struct iio_device *dev);
 int read_double(const char *str, double *val);
 int write_double(char *buf, size_t len, double val);
 
-struct iio_context * local_create_context(void);
+struct iio_context * local_create_context(bool lazy);
+struct iio_context * local_create_context_from_uri(const char *uri);
 struct iio_context * network_create_context(const char *hostname);
+struct iio_context * network_create_shm_context(const char *opts);
 struct iio_context * xml_create_context_mem(const char *xml, size_t len);
 struct iio_context * xml_create_context(const char *xml_file);
 struct iio_context * usb_create_context(unsigned int bus, uint16_t address,
@@ -301,19 +566,61 @@ int usb_context_scan(struct iio_scan_backend_context *ctx,
 struct iio_scan_backend_context * dnssd_context_scan_init(void);
 void dnssd_context_scan_free(struct iio_scan_backend_context *ctx);
 
+/* The hosts not probed by the deadline (monotonic, in ns; 0 for none) are
+ * left out of the results */
 int dnssd_context_scan(struct iio_scan_backend_context *ctx,
-		struct iio_scan_result *scan_result);
+		struct iio_scan_result *scan_result, uint64_t deadline);
+
+/* Report the contexts found by the backends watching for changes to their
+ * scan monitor; the owner is the watch adding or removing them */
+int iio_scan_monitor_add(struct iio_scan_monitor *mon, const void *owner,
+		const char *uri, const char *description);
+void iio_scan_monitor_remove(struct iio_scan_monitor *mon, const void *owner,
+		const char *uri);
+
+/* Return NULL, with errno set to ENOSYS, if the backend cannot be notified
+ * of the changes; the monitor then scans it periodically */
+struct iio_scan_backend_watch * usb_context_watch_start(
+		struct iio_scan_monitor *mon);
+void usb_context_watch_stop(struct iio_scan_backend_watch *watch);
+
+struct iio_scan_backend_watch * dnssd_context_watch_start(
+		struct iio_scan_monitor *mon);
+void dnssd_context_watch_stop(struct iio_scan_backend_watch *watch);
 
 /* This function is not part of the API, but is used by the IIO daemon */
 __api ssize_t iio_device_get_sample_size_mask(const struct iio_device *dev,
 		const uint32_t *mask, size_t words);
 
 void iio_channel_init_finalize(struct iio_channel *chn);
+
+void iio_channels_demux(const struct iio_channel **chns, const size_t *offsets,
+		unsigned int nb, void **dst, const void *src,
+		ptrdiff_t step, size_t count);
+void iio_channels_mux(const struct iio_channel **chns, const size_t *offsets,
+		unsigned int nb, void *dst, const void **src,
+		ptrdiff_t step, size_t count);
 unsigned int find_channel_modifier(const char *s, size_t *len_p);
 
 char *iio_strdup(const char *str);
 size_t iio_strlcpy(char * __restrict dst, const char * __restrict src, size_t dsize);
 char * iio_getenv (char * envvar);
+uint64_t iio_get_monotonic_ns(void);
+
+#define IIO_STATS_NB_OPS (IIO_STATS_SEND + 1)
+
+/* Returns the time the operation starts at, or 0 if the statistics are not
+ * collected; the operation is then recorded with iio_stats_end(), with the
+ * number of bytes transferred or the error code as 'ret' */
+uint64_t iio_stats_start(const struct iio_device *dev);
+void iio_stats_end(const struct iio_device *dev, enum iio_stats_op op,
+		uint64_t start, ssize_t ret);
+void iio_stats_free(struct iio_context *ctx);
+
+void * iio_buffer_memory_alloc(const struct iio_buffer_memory *mem,
+		size_t len);
+void iio_buffer_memory_free(const struct iio_buffer_memory *mem,
+		void *ptr, size_t len);
 
 int iio_context_add_attr(struct iio_context *ctx,
 		const char *key, const char *value);
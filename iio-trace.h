@@ -0,0 +1,52 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef _IIO_TRACE_H
+#define _IIO_TRACE_H
+
+#include "iio-config.h"
+
+/*
+ * Static tracepoints (USDT) of the "libiio" provider, built with WITH_USDT.
+ * A probe is a single nop until a tracer attaches to it, e.g.:
+ *   bpftrace -e 'usdt:/usr/lib/libiio.so:libiio:refill_exit { @[arg1] = count(); }'
+ *
+ * library:  refill_entry / refill_exit, push_entry / push_exit
+ *           (device ID, length / returned value)
+ *           block_enqueue, block_dequeue (device ID, block ID, bytes)
+ *           send, recv, splice (socket, length, returned value)
+ *           usb_transfer_submit (endpoint, length)
+ *           usb_transfer_complete (endpoint, status, actual length)
+ * iiod:     rw_thd_wake (device ID)
+ *           send_data_entry / send_data_exit (device ID, length / returned value)
+ *
+ * The arguments are only evaluated by the probes; they must not have side
+ * effects.
+ */
+
+#ifdef WITH_USDT
+#include <sys/sdt.h>
+
+#define IIO_TRACE1(name, a)		DTRACE_PROBE1(libiio, name, a)
+#define IIO_TRACE2(name, a, b)		DTRACE_PROBE2(libiio, name, a, b)
+#define IIO_TRACE3(name, a, b, c)	DTRACE_PROBE3(libiio, name, a, b, c)
+#else
+#define IIO_TRACE1(name, a)		do { } while (0)
+#define IIO_TRACE2(name, a, b)		do { } while (0)
+#define IIO_TRACE3(name, a, b, c)	do { } while (0)
+#endif
+
+#endif /* _IIO_TRACE_H */
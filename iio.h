@@ -87,10 +87,13 @@ struct iio_context;
 struct iio_device;
 struct iio_channel;
 struct iio_buffer;
+struct iio_buffer_set;
 
 struct iio_context_info;
 struct iio_scan_context;
 struct iio_scan_block;
+struct iio_scan_monitor;
+struct iio_event_stream;
 
 /**
  * @enum iio_chan_type
@@ -192,6 +195,80 @@ enum iio_modifier {
 	IIO_MOD_H2,
 };
 
+/**
+ * @enum iio_scan_event
+ * @brief Change reported by a scan monitor
+ */
+enum iio_scan_event {
+	IIO_SCAN_CONTEXT_ADDED,
+	IIO_SCAN_CONTEXT_REMOVED,
+};
+
+/**
+ * @enum iio_event_type
+ * @brief Type of an IIO event, as defined by the kernel
+ */
+enum iio_event_type {
+	IIO_EV_TYPE_THRESH,
+	IIO_EV_TYPE_MAG,
+	IIO_EV_TYPE_ROC,
+	IIO_EV_TYPE_THRESH_ADAPTIVE,
+	IIO_EV_TYPE_MAG_ADAPTIVE,
+	IIO_EV_TYPE_CHANGE,
+	IIO_EV_TYPE_MAG_REFERENCED,
+	IIO_EV_TYPE_GESTURE,
+};
+
+/**
+ * @enum iio_event_direction
+ * @brief Direction of an IIO event, as defined by the kernel
+ */
+enum iio_event_direction {
+	IIO_EV_DIR_EITHER,
+	IIO_EV_DIR_RISING,
+	IIO_EV_DIR_FALLING,
+	IIO_EV_DIR_NONE,
+	IIO_EV_DIR_SINGLETAP,
+	IIO_EV_DIR_DOUBLETAP,
+};
+
+/**
+ * @enum iio_stats_op
+ * @brief Operation whose statistics are collected
+ *
+ * The first ones are the operations of the API; the following ones are the
+ * steps of these operations within the backends, which are only recorded by
+ * the backends concerned.
+ */
+enum iio_stats_op {
+	IIO_STATS_REFILL,	/**< iio_buffer_refill() */
+	IIO_STATS_PUSH,		/**< iio_buffer_push() */
+	IIO_STATS_GET_BUFFER,	/**< Exchange of a block with the kernel */
+	IIO_STATS_ATTR_READ,	/**< Read of an attribute */
+	IIO_STATS_ATTR_WRITE,	/**< Write of an attribute */
+	IIO_STATS_WAIT,		/**< Local: wait for the device to be ready */
+	IIO_STATS_ENQUEUE,	/**< Local: enqueue of a block to the kernel */
+	IIO_STATS_DEQUEUE,	/**< Local: dequeue of a block from the kernel */
+	IIO_STATS_RECV,		/**< Network: receive on a buffer's socket */
+	IIO_STATS_SEND,		/**< Network: send on a buffer's socket */
+};
+
+/**
+ * @struct iio_event
+ * @brief An event reported by an IIO device
+ *
+ * The layout is the one of the kernel's struct iio_event_data: the identifier
+ * encodes the type, direction and channel of the event, which are decoded by
+ * iio_event_get_type(), iio_event_get_direction() and iio_event_get_channel().
+ */
+struct iio_event {
+	/** @brief The identifier of the event */
+	uint64_t id;
+
+	/** @brief The time of the event, in nanoseconds */
+	int64_t timestamp;
+};
+
 /* ---------------------------------------------------------------------------*/
 /* ------------------------- Scan functions ----------------------------------*/
 /** @defgroup Scan Functions for scanning available contexts
@@ -223,13 +300,26 @@ __api __check_ret struct iio_scan_context * iio_create_scan_context(
 __api void iio_scan_context_destroy(struct iio_scan_context *ctx);
 
 
+/** @brief Set the time given to the scans
+ * @param ctx A pointer to an iio_scan_context structure
+ * @param timeout_ms The time given to iio_scan_context_get_info_list(), in
+ * milliseconds. Zero, the default, waits for all the backends.
+ *
+ * <b>NOTE:</b> Once the time is up, the contexts found so far are returned;
+ * the backends and hosts still being probed are left out of the list. */
+__api void iio_scan_context_set_timeout(struct iio_scan_context *ctx,
+		unsigned int timeout_ms);
+
+
 /** @brief Enumerate available contexts
  * @param ctx A pointer to an iio_scan_context structure
  * @param info A pointer to a 'const struct iio_context_info **' typed variable.
  * The pointed variable will be initialized on success.
  * @returns On success, the number of contexts found.
  * @returns On failure, a negative error number.
- */
+ *
+ * <b>NOTE:</b> The backends, and the hosts found on the network, are probed
+ * concurrently. */
 __api __check_ret ssize_t iio_scan_context_get_info_list(struct iio_scan_context *ctx,
 		struct iio_context_info ***info);
 
@@ -298,6 +388,38 @@ __api struct iio_context_info *iio_scan_block_get_info(
 		struct iio_scan_block *blk, unsigned int index);
 
 
+/** @brief Create a scan monitor, reporting the contexts appearing and
+ * disappearing
+ * @param backend A NULL-terminated string containing the backend(s) to watch,
+ * as for iio_create_scan_context(). If NULL, all the available backends are
+ * watched.
+ * @param flags Unused for now. Set to 0.
+ * @param cb A pointer to a callback function, called with the information of
+ * each context added or removed
+ * @param d A pointer that will be passed to the callback function
+ * @return On success, a pointer to an iio_scan_monitor structure
+ * @return On failure, NULL is returned and errno is set appropriately
+ *
+ * <b>NOTE:</b> The contexts already present are reported first, as added.
+ * The callback is called from threads of the library, one call at a time; it
+ * must not destroy the monitor. The USB devices are watched with the hotplug
+ * notifications of libusb, and the network with the DNS-SD browser of Avahi;
+ * the other backends are scanned again every few seconds. */
+__api __check_ret struct iio_scan_monitor * iio_create_scan_monitor(
+		const char *backend, unsigned int flags,
+		void (*cb)(const struct iio_context_info *info,
+			enum iio_scan_event event, void *d),
+		void *d);
+
+
+/** @brief Destroy the given scan monitor
+ * @param mon A pointer to an iio_scan_monitor structure
+ *
+ * <b>NOTE:</b> The callback is not called anymore once this function returns.
+ * The iio_scan_monitor pointer shall then be invalid. */
+__api void iio_scan_monitor_destroy(struct iio_scan_monitor *mon);
+
+
 /** @} *//* ------------------------------------------------------------------*/
 /* ------------------------- Top-level functions -----------------------------*/
 /** @defgroup TopLevel Top-level functions
@@ -408,6 +530,14 @@ __api __check_ret struct iio_context * iio_create_network_context(const char *ho
  * support:
  * - Local backend, "local:"\n
  *   Does not have an address part. For example <i>"local:"</i>
+ *   With <i>"local:lazy"</i>, the devices are only listed when the context
+ *   is created; their channels and attributes are read from sysfs when
+ *   the device is first used, which speeds up the creation of contexts
+ *   with many devices. With <i>"local:io_uring=0"</i>, the low-speed
+ *   interface uses poll() and read()/write() even if the library was built
+ *   with io_uring support; <i>"local:io_uring=1"</i> fails with ENOSYS if
+ *   it was not. Options are separated by commas, e.g.
+ *   <i>"local:lazy,io_uring=0"</i>.
  * - XML backend, "xml:"\n Requires a path to the XML file for the address part.
  *   For example <i>"xml:/home/user/file.xml"</i>
  * - Network backend, "ip:"\n Requires a hostname, IPv4, or IPv6 to connect to
@@ -415,10 +545,49 @@ __api __check_ret struct iio_context * iio_create_network_context(const char *ho
  *   when library is compiled with ZeroConf support. For example
  *   <i>"ip:192.168.2.1"</i>, <b>or</b> <i>"ip:localhost"</i>, <b>or</b> <i>"ip:"</i>
  *   <b>or</b> <i>"ip:plutosdr.local"</i>
+ *   The address can be followed by comma-separated socket options:
+ *     - sndbuf, rcvbuf: size in bytes of the socket buffers
+ *     - nodelay (default <b>1</b>): use TCP_NODELAY
+ *     - busy_poll: busy-poll the sockets for the given time in microseconds
+ *     - udp: receive the samples of input buffers as UDP datagrams; lost
+ *       datagrams read as zeros and are counted in iio_block_info::nb_xflows
+ *     - udp_wait (default <b>20</b>): time in milliseconds to wait for the
+ *       missing datagrams of a block
+ *     - shm (Linux): receive the samples of input buffers through shared
+ *       memory, with iiod running on the same host; the value is the
+ *       number of blocks the shared memory holds, <b>1</b> selecting the
+ *       default of 4. Falls back to the socket if iiod cannot map it
+ *     - compress: compress the samples of input buffers; <b>1</b> only
+ *       transports the valuable bits of each sample, <b>2</b> also
+ *       delta-codes them, which suits slowly varying signals
+ *     - pool: keep the connection open for the given time in seconds once
+ *       the context is destroyed; the next context created with the same
+ *       URI reuses it, or reconnects to the address already resolved, and
+ *       shares the description of the first context instead of
+ *       downloading it again. The description is cached until the
+ *       process exits, so it must not change on the server.
+ *
+ *   For example <i>"ip:192.168.2.1,rcvbuf=4194304,busy_poll=50"</i>, or
+ *   <i>"ip:192.168.2.1,pool=60"</i>
+ * - Shared memory, "shm:"\n Shorthand for <i>"ip:localhost,shm=1"</i>, for the
+ *   applications running on the host of iiod. It can be followed by the
+ *   comma-separated options above, e.g. <i>"shm:shm=8"</i>
  * - USB backend, "usb:"\n When more than one usb device is attached, requires
  *   bus, address, and interface parts separated with a dot. For example
  *   <i>"usb:3.32.5"</i>. Where there is only one USB device attached, the shorthand
  *   <i>"usb:"</i> can be used.
+ *   The address can be followed by comma-separated options:
+ *     - transfers (default <b>1</b>): number of bulk transfers kept in
+ *       flight per endpoint when streaming samples; <b>1</b> submits one
+ *       transfer at a time
+ *     - transfer_size (default <b>262144</b>): size in bytes of each of
+ *       these transfers
+ *     - stripes (default <b>1</b>): number of endpoint pairs the samples
+ *       read from each device are spread over, in chunks of transfer_size
+ *       bytes; requires as many free endpoint pairs, and a version of iiod
+ *       supporting it
+ *
+ *   For example <i>"usb:3.32.5,transfers=8"</i>
  * - Serial backend, "serial:"\n Requires:
  *     - a port (/dev/ttyUSB0),
  *     - baud_rate (default <b>115200</b>)
@@ -428,7 +597,12 @@ __api __check_ret struct iio_context * iio_create_network_context(const char *ho
  *        - stop bits (<b>1</b> 2)
  *        - flow control ('<b>\0</b>' none, 'x' Xon Xoff, 'r' RTSCTS, 'd' DTRDSR)
  *
- *  For example <i>"serial:/dev/ttyUSB0,115200"</i> <b>or</b> <i>"serial:/dev/ttyUSB0,115200,8n1"</i>*/
+ *  For example <i>"serial:/dev/ttyUSB0,115200"</i> <b>or</b> <i>"serial:/dev/ttyUSB0,115200,8n1"</i>
+ *
+ * <b>NOTE:</b> If the LIBIIO_CACHE_DIR environment variable names an existing
+ * directory, the network, USB and serial backends keep there a copy of the
+ * XML description of each context they download, and reuse it as long as
+ * the IIO Daemon reports the same digest of its context. */
 __api __check_ret struct iio_context * iio_create_context_from_uri(const char *uri);
 
 
@@ -439,7 +613,13 @@ __api __check_ret struct iio_context * iio_create_context_from_uri(const char *u
  *
  * <b>NOTE:</b> This function is not supported on 'usb:' contexts, since libusb
  * can only claim the interface once. "Function not implemented" is the expected errno.
- * Any context which is cloned, must be destroyed via calling iio_context_destroy() */
+ * Any context which is cloned, must be destroyed via calling iio_context_destroy()
+ *
+ * <b>NOTE:</b> Except for the lazy 'local:' contexts, the clone shares the
+ * description of the original context, including its XML string: only a new
+ * connection to the server is established. The clone has its own devices and
+ * channels, which can be used from another thread than those of the original
+ * context, and it can outlive the original context. */
 __api __check_ret struct iio_context * iio_context_clone(const struct iio_context *ctx);
 
 
@@ -560,6 +740,188 @@ __api __check_ret int iio_context_set_timeout(
 		struct iio_context *ctx, unsigned int timeout_ms);
 
 
+/**
+ * @struct iio_attr_cache_stats
+ * @brief Counters of the cache of the values of the attributes
+ */
+struct iio_attr_cache_stats {
+	/** @brief Number of reads answered from the cache, and number of
+	 * reads of cached attributes that had to be sent to the device */
+	uint64_t hits, misses;
+
+	/** @brief Number of values dropped from the cache because they
+	 * expired or were invalidated */
+	uint64_t evictions;
+};
+
+
+/** @brief Enable or disable the cache of the values of the attributes
+ * @param ctx A pointer to an iio_context structure
+ * @param ttl_ms The time in milliseconds during which a value read is
+ * returned from the cache. A value of 0 keeps the values until they are
+ * invalidated; a negative value disables the cache.
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned; -ENOSYS if the
+ * backend does not support the cache
+ *
+ * <b>NOTE:</b> The cache is disabled by default, and only supported by the
+ * remote backends, where each read is a round trip to the device. Writing an
+ * attribute or a register through the context invalidates all the values
+ * cached, as writing one attribute often changes others, including the ones
+ * of other devices. This
+ * call drops the values cached and the TTLs set with
+ * iio_context_set_attr_cache_ttl(). */
+__api __check_ret int iio_context_set_attr_cache(struct iio_context *ctx,
+		int ttl_ms);
+
+
+/** @brief Set the time during which the values of some attributes are cached
+ * @param ctx A pointer to an iio_context structure
+ * @param attr A NULL-terminated string corresponding to the name of the
+ * attributes, of any device or channel
+ * @param ttl_ms The time in milliseconds during which a value read is
+ * returned from the cache. A value of 0 keeps the values until they are
+ * invalidated; a negative value never caches them.
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> This overrides the TTL given to iio_context_set_attr_cache(),
+ * even if the cache is disabled otherwise. It can be used to cache only a few
+ * attributes known not to change, or to never cache the ones that do, like
+ * "raw". */
+__api __check_ret int iio_context_set_attr_cache_ttl(struct iio_context *ctx,
+		const char *attr, int ttl_ms);
+
+
+/** @brief Drop all the values of attributes cached
+ * @param ctx A pointer to an iio_context structure
+ *
+ * <b>NOTE:</b> To be used when the attributes may have been changed by other
+ * clients of the device. */
+__api void iio_context_invalidate_attr_cache(struct iio_context *ctx);
+
+
+/** @brief Get the counters of the cache of the values of the attributes
+ * @param ctx A pointer to an iio_context structure
+ * @param stats A pointer to an iio_attr_cache_stats structure to fill
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned */
+__api __check_ret int iio_context_get_attr_cache_stats(
+		const struct iio_context *ctx, struct iio_attr_cache_stats *stats);
+
+
+/**
+ * @enum iio_attr_type
+ * @brief Kind of a device attribute of a batch request
+ */
+enum iio_attr_type {
+	IIO_ATTR_TYPE_DEVICE = 0,	/**< Device-specific attribute */
+	IIO_ATTR_TYPE_DEBUG,		/**< Debug attribute */
+	IIO_ATTR_TYPE_BUFFER,		/**< Buffer-specific attribute */
+};
+
+
+/**
+ * @struct iio_attr_read_req
+ * @brief One attribute read of a batch submitted to iio_context_read_attrs
+ */
+struct iio_attr_read_req {
+	/** @brief The device the attribute belongs to */
+	const struct iio_device *dev;
+
+	/** @brief The channel the attribute belongs to, or NULL for a
+	 * device-specific attribute */
+	const struct iio_channel *chn;
+
+	/** @brief A NULL-terminated string corresponding to the name of the
+	 * attribute */
+	const char *attr;
+
+	/** @brief A pointer to the memory area where the NULL-terminated
+	 * string corresponding to the value read will be stored */
+	char *dst;
+
+	/** @brief The available length of the memory area, in bytes */
+	size_t len;
+
+	/** @brief The kind of the device attribute; ignored for channel
+	 * attributes. Zero (IIO_ATTR_TYPE_DEVICE) by default. */
+	enum iio_attr_type type;
+
+	/** @brief Set by iio_context_read_attrs to the number of bytes read,
+	 * or to a negative errno code if the read failed */
+	ssize_t ret;
+};
+
+
+/** @brief Read a list of device, debug, buffer and channel attributes in
+ * one call
+ * @param ctx A pointer to an iio_context structure
+ * @param reqs A pointer to an array of iio_attr_read_req structures
+ * @param nb_reqs The number of entries in the array
+ * @return On success, the number of attributes that could not be read is
+ * returned, and the result of each read is stored in the "ret" field of the
+ * corresponding entry
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> All the devices of the list must belong to the given context.
+ * This function is meant for applications polling many attributes at a
+ * regular interval: backends can process the whole list at once (the
+ * network backend pipelines the reads), and the local backend keeps the
+ * attribute files open between calls. */
+__api __check_ret int iio_context_read_attrs(const struct iio_context *ctx,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs);
+
+
+/**
+ * @struct iio_attr_write_req
+ * @brief One attribute write of a batch submitted to iio_context_write_attrs
+ */
+struct iio_attr_write_req {
+	/** @brief The device the attribute belongs to */
+	const struct iio_device *dev;
+
+	/** @brief The channel the attribute belongs to, or NULL for a
+	 * device-specific attribute */
+	const struct iio_channel *chn;
+
+	/** @brief A NULL-terminated string corresponding to the name of the
+	 * attribute */
+	const char *attr;
+
+	/** @brief A pointer to the data to be written */
+	const void *src;
+
+	/** @brief The number of bytes that should be written */
+	size_t len;
+
+	/** @brief The kind of the device attribute; ignored for channel
+	 * attributes. Zero (IIO_ATTR_TYPE_DEVICE) by default. */
+	enum iio_attr_type type;
+
+	/** @brief Set by iio_context_write_attrs to the number of bytes
+	 * written, or to a negative errno code if the write failed */
+	ssize_t ret;
+};
+
+
+/** @brief Write a list of device, debug, buffer and channel attributes in
+ * one call
+ * @param ctx A pointer to an iio_context structure
+ * @param reqs A pointer to an array of iio_attr_write_req structures
+ * @param nb_reqs The number of entries in the array
+ * @return On success, the number of attributes that could not be written is
+ * returned, and the result of each write is stored in the "ret" field of the
+ * corresponding entry
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The attributes are written in the order of the list. With the
+ * network backend, the writes are pipelined, so that configuring many
+ * attributes costs a few round trips instead of one per attribute. */
+__api __check_ret int iio_context_write_attrs(const struct iio_context *ctx,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs);
+
+
 /** @} *//* ------------------------------------------------------------------*/
 /* ------------------------- Device functions --------------------------------*/
 /** @defgroup Device Device
@@ -1031,10 +1393,97 @@ __api __check_ret __pure bool iio_device_is_trigger(const struct iio_device *dev
  * @param dev A pointer to an iio_device structure
  * @param nb_buffers The number of buffers
  * @return On success, 0 is returned
- * @return On error, a negative errno code is returned */
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> This does not apply to cyclic buffers; see
+ * iio_device_set_cyclic_buffers_count(). */
 __api __check_ret int iio_device_set_kernel_buffers_count(const struct iio_device *dev,
 		unsigned int nb_buffers);
 
+
+/** @brief Configure the number of kernel buffers of the cyclic buffers of a
+ * device
+ *
+ * Cyclic buffers use a single kernel buffer by default, and pushing them a
+ * second time returns -EBUSY. With two or more, the waveform of a cyclic
+ * buffer can be replaced by pushing it again (see iio_buffer_push).
+ * @param dev A pointer to an iio_device structure
+ * @param nb_buffers The number of buffers
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned; -ENOSYS if the
+ * backend cannot replace the waveform
+ *
+ * <b>NOTE:</b> Only enable it if the DMA driver of the device ends a cyclic
+ * transfer when a new one is queued: otherwise, the second push blocks until
+ * the kernel buffer times out. Must be called before the buffer is created. */
+__api __check_ret int iio_device_set_cyclic_buffers_count(const struct iio_device *dev,
+		unsigned int nb_buffers);
+
+
+/**
+ * @enum iio_buffer_memory_type
+ * @brief Memory backing the buffers allocated by libiio
+ */
+enum iio_buffer_memory_type {
+	IIO_BUFFER_MEMORY_DEFAULT,	/**< Allocated with malloc() */
+	IIO_BUFFER_MEMORY_PAGE_ALIGNED,	/**< Aligned on, and rounded up to,
+					  the size of a page */
+	IIO_BUFFER_MEMORY_HUGEPAGES,	/**< Backed by huge pages if some are
+					  reserved, or by transparent huge
+					  pages otherwise (Linux only) */
+};
+
+
+/**
+ * @struct iio_buffer_allocator
+ * @brief Functions allocating the memory of the buffers of a device
+ */
+struct iio_buffer_allocator {
+	/** @brief Allocate the memory of one buffer
+	 * @param length The size of the buffer, in bytes
+	 * @param user_data The pointer passed to
+	 * iio_device_set_buffer_allocator()
+	 * @return A pointer to the memory, or NULL on error */
+	void * (*alloc)(size_t length, void *user_data);
+
+	/** @brief Free the memory of one buffer; optional
+	 * @param ptr The pointer returned by the alloc function
+	 * @param length The size of the buffer, in bytes
+	 * @param user_data The pointer passed to
+	 * iio_device_set_buffer_allocator() */
+	void (*free)(void *ptr, size_t length, void *user_data);
+};
+
+
+/** @brief Select the memory backing the buffers created on a device
+ * @param dev A pointer to an iio_device structure
+ * @param type The type of memory to use
+ * @param numa_node The NUMA node to bind the memory to, or -1 to let the
+ * kernel place it (Linux only)
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned; -ENOSYS if the type
+ * of memory or the NUMA binding is not supported on this platform
+ *
+ * <b>NOTE:</b> The settings apply to the buffers created afterwards, and only
+ * to the memory that libiio allocates itself: the blocks of the high-speed
+ * devices of the local backend are mapped from the kernel. */
+__api __check_ret int iio_device_set_buffer_memory(struct iio_device *dev,
+		enum iio_buffer_memory_type type, int numa_node);
+
+
+/** @brief Provide the functions allocating the buffers of a device
+ * @param dev A pointer to an iio_device structure
+ * @param allocator A pointer to an iio_buffer_allocator structure, which
+ * must stay valid until the buffers created afterwards are destroyed; NULL
+ * to restore the memory selected with iio_device_set_buffer_memory()
+ * @param user_data A pointer passed to the functions of the allocator
+ *
+ * <b>NOTE:</b> Like iio_device_set_buffer_memory(), the allocator is used
+ * for the buffers created afterwards, and only for the memory that libiio
+ * allocates itself. */
+__api void iio_device_set_buffer_allocator(struct iio_device *dev,
+		const struct iio_buffer_allocator *allocator, void *user_data);
+
 /** @} *//* ------------------------------------------------------------------*/
 /* ------------------------- Channel functions -------------------------------*/
 /** @defgroup Channel Channel
@@ -1320,6 +1769,39 @@ __api __check_ret size_t iio_channel_read(const struct iio_channel *chn,
 		struct iio_buffer *buffer, void *dst, size_t len);
 
 
+/** @brief Demultiplex the samples of a given channel, and convert them to
+ * physical units in single-precision floating point
+ * @param chn A pointer to an iio_channel structure
+ * @param buffer A pointer to an iio_buffer structure
+ * @param dst A pointer to the memory area where the values will be stored
+ * @param nb The number of values the memory area can hold
+ * @return On success, the number of values stored
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> Each value is (raw + offset) * scale, where raw is the sample
+ * converted like iio_channel_read() does, scale the one of the data format of
+ * the channel (1.0 if it has none), and offset the "offset" attribute of the
+ * channel (0.0 if it has none). The scale and offset are read the first time
+ * the channel is converted from this buffer, and kept until the buffer is
+ * destroyed. */
+__api __check_ret ssize_t iio_channel_read_float(const struct iio_channel *chn,
+		struct iio_buffer *buffer, float *dst, size_t nb);
+
+
+/** @brief Demultiplex the samples of a given channel, and convert them to
+ * physical units in double-precision floating point
+ * @param chn A pointer to an iio_channel structure
+ * @param buffer A pointer to an iio_buffer structure
+ * @param dst A pointer to the memory area where the values will be stored
+ * @param nb The number of values the memory area can hold
+ * @return On success, the number of values stored
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> See iio_channel_read_float(). */
+__api __check_ret ssize_t iio_channel_read_double(const struct iio_channel *chn,
+		struct iio_buffer *buffer, double *dst, size_t nb);
+
+
 /** @brief Multiplex the samples of a given channel
  * @param chn A pointer to an iio_channel structure
  * @param buffer A pointer to an iio_buffer structure
@@ -1402,6 +1884,91 @@ __api __check_ret struct iio_buffer * iio_device_create_buffer(const struct iio_
  * <b>NOTE:</b> After that function, the iio_buffer pointer shall be invalid. */
 __api void iio_buffer_destroy(struct iio_buffer *buf);
 
+
+/** @brief Change the enabled channels and the size of a buffer
+ * @param buf A pointer to an iio_buffer structure
+ * @param samples_count The number of samples that the buffer should contain
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned
+ *
+ * The channels enabled on the device are used, like with
+ * iio_device_create_buffer. The device is not closed: when the backend
+ * supports it, only the channels are reprogrammed, and the kernel's blocks
+ * are reused if their size fits.
+ *
+ * <b>NOTE:</b> The samples not read yet, or not pushed yet, are lost. This
+ * function cannot be used on the buffers of a buffer set. On error, either:
+ * - the buffer is still usable, with its previous size and the channels
+ *   enabled on the device, if the backend had to reopen the device and the
+ *   new size was rejected;
+ * - or the buffer can only be destroyed, if the device could not be reopened
+ *   at all; iio_buffer_refill() and iio_buffer_push() then return -EBADF.
+ * Use iio_buffer_start() and iio_buffer_end() to know the size the buffer
+ * was left with. */
+__api __check_ret int iio_buffer_reconfigure(struct iio_buffer *buf,
+		size_t samples_count);
+
+/** @brief Create a set of buffers sharing the given device
+ * @param dev A pointer to an iio_device structure
+ * @param samples_count The number of samples that each buffer should contain
+ * @param nb_buffers The number of buffers in the set
+ * @return On success, a pointer to an iio_buffer_set structure
+ * @return On error, NULL is returned, and errno is set to the error code
+ *
+ * The buffers rotate between the application and the backend: while the
+ * application processes one buffer, the others are being filled (input
+ * devices) or sent (output devices). The number of kernel buffers is set to
+ * the number of buffers in the set. -ENOSYS is returned if the backend
+ * does not support asynchronous transfers (see iio_buffer_submit).
+ *
+ * <b>NOTE:</b> Channels that have to be written to / read from must be enabled
+ * before creating the buffer set. */
+__api __check_ret struct iio_buffer_set * iio_device_create_buffer_set(
+		const struct iio_device *dev, size_t samples_count,
+		unsigned int nb_buffers);
+
+
+/** @brief Destroy the given buffer set
+ * @param set A pointer to an iio_buffer_set structure
+ *
+ * <b>NOTE:</b> After that function, the iio_buffer_set pointer and the
+ * pointers to its buffers shall be invalid. */
+__api void iio_buffer_set_destroy(struct iio_buffer_set *set);
+
+
+/** @brief Get the next buffer of a buffer set
+ * @param set A pointer to an iio_buffer_set structure
+ * @param buf A pointer to a pointer, that will be set to the buffer
+ * @return On success, the number of bytes available in the buffer: bytes of
+ * samples read for input devices, free space for output devices
+ * @return On error, a negative errno code is returned; -EBUSY means that all
+ * the buffers are held by the application
+ *
+ * For input devices, the oldest buffer is returned once filled; for output
+ * devices, an unused buffer, or else the oldest one once it has been sent.
+ * The call blocks unless the blocking mode has been disabled with
+ * iio_buffer_set_blocking_mode on one of the buffers, in which case -EAGAIN
+ * is returned and iio_buffer_get_poll_fd can be used to wait.
+ *
+ * <b>NOTE:</b> The buffer can be accessed with the usual functions
+ * (iio_buffer_first, iio_buffer_foreach_sample, ...), but must not be
+ * refilled, pushed or destroyed directly. */
+__api __check_ret ssize_t iio_buffer_set_acquire(struct iio_buffer_set *set,
+		struct iio_buffer **buf);
+
+
+/** @brief Give a buffer back to a buffer set
+ * @param set A pointer to an iio_buffer_set structure
+ * @param buf A pointer to a buffer obtained with iio_buffer_set_acquire
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned
+ *
+ * For input devices, the buffer is queued to be refilled; for output
+ * devices, its samples are sent to the hardware. */
+__api __check_ret int iio_buffer_set_release(struct iio_buffer_set *set,
+		struct iio_buffer *buf);
+
+
 /** @brief Get a pollable file descriptor
  *
  * Can be used to know when iio_buffer_refill() or iio_buffer_push() can be
@@ -1426,6 +1993,24 @@ __api __check_ret int iio_buffer_get_poll_fd(struct iio_buffer *buf);
 __api __check_ret int iio_buffer_set_blocking_mode(struct iio_buffer *buf, bool blocking);
 
 
+/** @brief Only receive one sample out of the given number
+ * @param buf A pointer to an iio_buffer structure of an input device
+ * @param factor The decimation factor; 1 disables the decimation
+ * @param average If true, each sample received is the average of the
+ * <i>factor</i> samples it replaces, for the channels up to 32 bits wide;
+ * otherwise, the other samples are simply dropped
+ * @return On success, 0
+ * @return On error, a negative errno code is returned; -ENOSYS if the
+ * backend does not support it
+ *
+ * <b>NOTE:</b> The decimation is done by the remote end (iiod), for that
+ * client only, which reduces the bandwidth used by monitoring clients while
+ * other clients still receive all the samples. It must be set before
+ * submitting any iio_buffer_refill(). */
+__api __check_ret int iio_buffer_set_decimation(struct iio_buffer *buf,
+		unsigned int factor, bool average);
+
+
 /** @brief Fetch more samples from the hardware
  * @param buf A pointer to an iio_buffer structure
  * @return On success, the number of bytes read is returned
@@ -1440,7 +2025,13 @@ __api __check_ret ssize_t iio_buffer_refill(struct iio_buffer *buf);
  * @return On success, the number of bytes written is returned
  * @return On error, a negative errno code is returned
  *
- * <b>NOTE:</b> Only valid for output buffers */
+ * <b>NOTE:</b> Only valid for output buffers. A cyclic buffer can only be
+ * pushed once, unless it uses several kernel buffers, set with
+ * iio_device_set_cyclic_buffers_count(): the new waveform is then written to
+ * an inactive one, and replaces the one being output at the end of its
+ * current period, without any gap. The function returns once a kernel buffer
+ * is available for the next waveform. With a single kernel buffer, -EBUSY is
+ * returned. */
 __api __check_ret ssize_t iio_buffer_push(struct iio_buffer *buf);
 
 
@@ -1454,6 +2045,106 @@ __api __check_ret ssize_t iio_buffer_push(struct iio_buffer *buf);
 __api __check_ret ssize_t iio_buffer_push_partial(struct iio_buffer *buf,
 		size_t samples_count);
 
+
+/** @brief Queue a refill or push request without waiting for it
+ * @param buf A pointer to an iio_buffer structure
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned
+ *
+ * For input buffers, a request for a full buffer of samples is queued; for
+ * output buffers, the samples written to the buffer are sent. In both cases,
+ * the buffer's memory belongs to the backend until the request is completed
+ * with iio_buffer_complete. Several input requests can be queued; output
+ * requests may be limited to one in flight, in which case -EBUSY is returned.
+ * -ENOSYS is returned if the backend does not support asynchronous
+ * transfers.
+ *
+ * <b>NOTE:</b> While requests are pending, iio_buffer_refill and
+ * iio_buffer_push fail with -EBUSY. */
+__api __check_ret int iio_buffer_submit(struct iio_buffer *buf);
+
+
+/** @brief Complete the oldest request queued with iio_buffer_submit
+ * @param buf A pointer to an iio_buffer structure
+ * @return On success, the number of bytes read (input buffers) or written
+ * (output buffers) is returned, and the buffer can be accessed again
+ * @return On error, a negative errno code is returned; -EAGAIN means that
+ * the request is not complete yet, and -ENOENT that no request is pending
+ *
+ * The file descriptor returned by iio_buffer_get_poll_fd becomes readable
+ * when a request can be completed, so that a single event loop can drive
+ * several buffers. Backends that cannot provide such a descriptor wait for
+ * the request to complete instead of returning -EAGAIN. */
+__api __check_ret ssize_t iio_buffer_complete(struct iio_buffer *buf);
+
+
+/**
+ * @struct iio_block_info
+ * @brief Metadata of the last block of samples transferred by a buffer
+ */
+struct iio_block_info {
+	/** @brief Time at which the block was obtained, in nanoseconds
+	 * (CLOCK_MONOTONIC on POSIX systems) */
+	uint64_t timestamp;
+
+	/** @brief Number of blocks transferred before this one */
+	uint64_t sequence;
+
+	/** @brief Number of bytes of samples in the block */
+	size_t bytes_used;
+
+	/** @brief Number of overflows (input) or underflows (output) detected
+	 * since the buffer was created; always zero on backends that cannot
+	 * detect them */
+	uint64_t nb_xflows;
+};
+
+
+/** @brief Get the metadata of the last block transferred
+ * @param buf A pointer to an iio_buffer structure
+ * @param info A pointer to an iio_block_info structure, that will be filled
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned; -ENOENT means that
+ * no block has been transferred yet
+ *
+ * The metadata is updated by iio_buffer_refill, iio_buffer_push and
+ * iio_buffer_complete. Gaps in the stream can be detected by comparing the
+ * number of overflows to the one of the previous block. */
+__api __check_ret int iio_buffer_get_block_info(const struct iio_buffer *buf,
+		struct iio_block_info *info);
+
+
+/** @brief Take ownership of one of the buffer's kernel blocks
+ * @param buf A pointer to an iio_buffer structure
+ * @param addr A pointer to a pointer, that will be set to the address of the
+ * block's data
+ * @return On success, the number of bytes of data in the block is returned
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> Only available for devices supporting the high-speed (mmap)
+ * interface; -ENOSYS is returned otherwise. Up to the number of kernel
+ * buffers (see iio_device_set_kernel_buffers_count) can be held at the same
+ * time, and each one must be given back with iio_buffer_enqueue_block, in any
+ * order and from any thread. For input buffers, the block contains samples
+ * laid out as described by iio_buffer_first and iio_buffer_step; for output
+ * buffers, the block is to be filled with samples.
+ *
+ * This function must not be mixed with iio_buffer_refill or iio_buffer_push
+ * on the same buffer, and is not available for cyclic buffers. */
+__api __check_ret ssize_t iio_buffer_dequeue_block(struct iio_buffer *buf,
+		void **addr);
+
+
+/** @brief Give a kernel block back to the hardware
+ * @param buf A pointer to an iio_buffer structure
+ * @param addr The address of a block obtained with iio_buffer_dequeue_block
+ * @param bytes_used For output buffers, the number of bytes of samples to
+ * submit; zero means the whole block
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned */
+__api __check_ret int iio_buffer_enqueue_block(struct iio_buffer *buf,
+		void *addr, size_t bytes_used);
+
 /** @brief Cancel all buffer operations
  * @param buf The buffer for which operations should be canceled
  *
@@ -1535,6 +2226,61 @@ __api __check_ret ssize_t iio_buffer_foreach_sample(struct iio_buffer *buf,
 			void *src, size_t bytes, void *d), void *data);
 
 
+/** @brief Call the supplied callback once for each channel found in a buffer
+ * @param buf A pointer to an iio_buffer structure
+ * @param callback A pointer to a function to call for each channel
+ * @param data A user-specified pointer that will be passed to the callback
+ * @return On success, the sum of the values returned by the callback
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The callback receives five arguments:
+ * * A pointer to the iio_channel structure,
+ * * A pointer to the first sample of the channel,
+ * * The distance in bytes between two consecutive samples of the channel,
+ * * The number of samples of the channel present in the buffer,
+ * * The user-specified pointer passed to iio_buffer_foreach_block.
+ *
+ * Contrary to iio_buffer_foreach_sample, the callback is only called once per
+ * enabled channel, which allows it to process all the samples of a channel
+ * in a tight loop. */
+__api __check_ret ssize_t iio_buffer_foreach_block(struct iio_buffer *buf,
+		ssize_t (*callback)(const struct iio_channel *chn,
+			void *src, ptrdiff_t step, size_t count, void *d),
+		void *data);
+
+
+/** @brief Demultiplex and convert the samples of all enabled channels at once
+ * @param buf A pointer to an iio_buffer structure
+ * @param planes An array of pointers, one per channel of the device (indexed
+ * like iio_device_get_channel()), to the memory areas where the converted
+ * samples of each channel will be written. NULL entries are skipped.
+ * @param samples_count The maximum number of samples that each memory area
+ * can hold
+ * @return On success, the number of samples written to each memory area
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The result is identical to calling iio_channel_read() for each
+ * enabled channel, but the buffer is only swept once. */
+__api __check_ret ssize_t iio_buffer_deinterleave(struct iio_buffer *buf,
+		void **planes, size_t samples_count);
+
+
+/** @brief Convert and multiplex the samples of all enabled channels at once
+ * @param buf A pointer to an iio_buffer structure
+ * @param planes An array of pointers, one per channel of the device (indexed
+ * like iio_device_get_channel()), to the memory areas containing the samples
+ * of each channel. NULL entries are skipped.
+ * @param samples_count The number of samples available in each memory area
+ * @return On success, the number of samples written to the buffer for each
+ * channel
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The result is identical to calling iio_channel_write() for each
+ * enabled channel, but the buffer is only swept once. */
+__api __check_ret ssize_t iio_buffer_interleave(struct iio_buffer *buf,
+		const void **planes, size_t samples_count);
+
+
 /** @brief Associate a pointer to an iio_buffer structure
  * @param buf A pointer to an iio_buffer structure
  * @param data The pointer to be associated */
@@ -1547,6 +2293,78 @@ __api void iio_buffer_set_data(struct iio_buffer *buf, void *data);
 __api void * iio_buffer_get_data(const struct iio_buffer *buf);
 
 
+/** @} *//* ------------------------------------------------------------------*/
+/* ------------------------- Event functions ---------------------------------*/
+/** @defgroup Events Events
+ * @{
+ * @struct iio_event_stream
+ * @brief A stream of the events reported by a device
+ */
+
+
+/** @brief Open a stream of the events reported by a device
+ * @param dev A pointer to an iio_device structure
+ * @return On success, a pointer to an iio_event_stream structure
+ * @return On error, NULL is returned, and errno is set to the error code
+ *
+ * <b>NOTE:</b> The events are only reported if they were enabled in the
+ * attributes of the device (e.g. "in_voltage0_thresh_rising_en"). With the
+ * local backend, the events are read from the event file descriptor of the
+ * character device; only one stream can be opened per device at a time. The
+ * USB and serial backends do not support events. */
+__api __check_ret struct iio_event_stream * iio_device_create_event_stream(
+		const struct iio_device *dev);
+
+
+/** @brief Close a stream of events
+ * @param stream A pointer to an iio_event_stream structure */
+__api void iio_event_stream_destroy(struct iio_event_stream *stream);
+
+
+/** @brief Wait for, and read, the events of a stream
+ * @param stream A pointer to an iio_event_stream structure
+ * @param events A pointer to an array of iio_event structures
+ * @param nb The number of elements of the array
+ * @return On success, the number of events read, at least 1
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The call blocks until at least one event is reported, or the
+ * timeout of the context expires, in which case -ETIMEDOUT is returned. With
+ * a timeout of 0, the call blocks until an event is reported. */
+__api __check_ret ssize_t iio_event_stream_read(struct iio_event_stream *stream,
+		struct iio_event *events, size_t nb);
+
+
+/** @brief Get the type of an event
+ * @param event A pointer to an iio_event structure
+ * @return The type of the event */
+__api enum iio_event_type iio_event_get_type(const struct iio_event *event);
+
+
+/** @brief Get the direction of an event
+ * @param event A pointer to an iio_event structure
+ * @return The direction of the event */
+__api enum iio_event_direction iio_event_get_direction(
+		const struct iio_event *event);
+
+
+/** @brief Get the channel an event relates to
+ * @param event A pointer to an iio_event structure
+ * @param dev A pointer to the iio_device structure that reported the event
+ * @param diff If true, get the channel of the second input of a differential
+ * event, instead of the differential channel
+ * @return On success, a pointer to an iio_channel structure
+ * @return If the event does not relate to a channel of the device, NULL is
+ * returned
+ *
+ * <b>NOTE:</b> The kernel identifies the channel of an event by its type,
+ * modifier and the number in its name (e.g. 1 for "voltage1"), which is
+ * unrelated to the index of the channel in the buffers. */
+__api const struct iio_channel * iio_event_get_channel(
+		const struct iio_event *event,
+		const struct iio_device *dev, bool diff);
+
+
 /** @} *//* ------------------------------------------------------------------*/
 /* ------------------------- Low-level functions -----------------------------*/
 /** @defgroup Debug Debug and low-level functions
@@ -1630,6 +2448,34 @@ __api void iio_channel_convert_inverse(const struct iio_channel *chn,
 		void *dst, const void *src);
 
 
+/** @brief Convert a run of samples from hardware format to host format
+ * @param chn A pointer to an iio_channel structure
+ * @param dst A pointer to the destination buffer where the converted samples
+ * should be written, one after the other
+ * @param src A pointer to the first sample to convert
+ * @param step The distance in bytes between two consecutive samples in the
+ * source buffer, e.g. the value returned by iio_buffer_step()
+ * @param count The number of samples to convert
+ *
+ * <b>NOTE:</b> The result is identical to calling iio_channel_convert() on
+ * each sample, but the common formats (8, 16, 32 or 64-bit samples) are
+ * handled by dedicated loops that the compiler can vectorize. */
+__api void iio_channel_convert_n(const struct iio_channel *chn,
+		void *dst, const void *src, ptrdiff_t step, size_t count);
+
+
+/** @brief Convert a run of samples from host format to hardware format
+ * @param chn A pointer to an iio_channel structure
+ * @param dst A pointer to the first sample of the destination buffer
+ * @param src A pointer to the source buffer containing the samples, one after
+ * the other
+ * @param step The distance in bytes between two consecutive samples in the
+ * destination buffer, e.g. the value returned by iio_buffer_step()
+ * @param count The number of samples to convert */
+__api void iio_channel_convert_inverse_n(const struct iio_channel *chn,
+		void *dst, const void *src, ptrdiff_t step, size_t count);
+
+
 /** @brief Enumerate the debug attributes of the given device
  * @param dev A pointer to an iio_device structure
  * @return The number of debug attributes found */
@@ -1856,6 +2702,113 @@ __api __check_ret int iio_device_reg_read(struct iio_device *dev,
 		uint32_t address, uint32_t *value);
 
 
+/** @brief Get the values of several hardware registers in one call
+ * @param dev A pointer to an iio_device structure
+ * @param addresses A pointer to an array of register addresses
+ * @param values A pointer to an array where the values will be written
+ * @param nb The number of registers, at most 65536
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The registers are read in the order of the array, and the
+ * register accesses of other callers of libiio on the same device do not
+ * interleave with them: the local backend locks the direct_reg_access file
+ * during the call, and the network backend sends the whole array to iiod in
+ * one command. With older versions of iiod, the registers are read one at a
+ * time instead. */
+__api __check_ret int iio_device_reg_read_bulk(struct iio_device *dev,
+		const uint32_t *addresses, uint32_t *values, unsigned int nb);
+
+
+/** @brief Set the values of several hardware registers in one call
+ * @param dev A pointer to an iio_device structure
+ * @param addresses A pointer to an array of register addresses
+ * @param values A pointer to an array of the values to set the registers to
+ * @param nb The number of registers, at most 65536
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The registers are written in the order of the array, with
+ * the same guarantees as iio_device_reg_read_bulk(). On error, the
+ * registers before the one that failed have been written already. */
+__api __check_ret int iio_device_reg_write_bulk(struct iio_device *dev,
+		const uint32_t *addresses, const uint32_t *values,
+		unsigned int nb);
+
+
+/** @brief Number of buckets of the latency histograms */
+#define IIO_STATS_NB_BUCKETS 32
+
+
+/**
+ * @struct iio_stats
+ * @brief Statistics of one operation
+ */
+struct iio_stats {
+	/** @brief Number of calls, and number of them that failed */
+	uint64_t count, errors;
+
+	/** @brief Number of bytes transferred by the calls that succeeded */
+	uint64_t bytes;
+
+	/** @brief Total and largest duration of the calls, in nanoseconds */
+	uint64_t total_ns, max_ns;
+
+	/** @brief Latency histogram: histogram[0] counts the calls that took
+	 * less than 2 microseconds, and histogram[i] the ones that took
+	 * between 2^i and 2^(i+1) microseconds; the last bucket also counts
+	 * the longer ones */
+	uint64_t histogram[IIO_STATS_NB_BUCKETS];
+};
+
+
+/** @brief Enable or disable the collection of statistics
+ * @param ctx A pointer to an iio_context structure
+ * @param enable If true, the statistics are collected
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned
+ *
+ * <b>NOTE:</b> The collection is disabled by default. When it is, the
+ * operations are not timed at all. Disabling it keeps the statistics
+ * collected so far. */
+__api __check_ret int iio_context_enable_stats(struct iio_context *ctx,
+		bool enable);
+
+
+/** @brief Clear the statistics collected on a context and its devices
+ * @param ctx A pointer to an iio_context structure */
+__api void iio_context_reset_stats(struct iio_context *ctx);
+
+
+/** @brief Get the statistics of an operation on a device
+ * @param dev A pointer to an iio_device structure
+ * @param op The operation
+ * @param stats A pointer to an iio_stats structure to fill
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned; -ENODATA if the
+ * statistics were never enabled on the context */
+__api __check_ret int iio_device_get_stats(const struct iio_device *dev,
+		enum iio_stats_op op, struct iio_stats *stats);
+
+
+/** @brief Get the statistics of an operation on all the devices of a context
+ * @param ctx A pointer to an iio_context structure
+ * @param op The operation
+ * @param stats A pointer to an iio_stats structure to fill
+ * @return On success, 0 is returned
+ * @return On error, a negative errno code is returned; -ENODATA if the
+ * statistics were never enabled on the context */
+__api __check_ret int iio_context_get_stats(const struct iio_context *ctx,
+		enum iio_stats_op op, struct iio_stats *stats);
+
+
+/** @brief Get the name of an operation whose statistics are collected
+ * @param op The operation
+ * @return A pointer to a static NULL-terminated string, or NULL if the
+ * operation is not valid */
+__api const char * iio_stats_op_get_name(enum iio_stats_op op);
+
+
 /** @} */
 
 #ifdef __cplusplus
@@ -18,6 +18,7 @@
 
 #include "debug.h"
 #include "iiod-client.h"
+#include "iiod-codec.h"
 #include "iio-lock.h"
 #include "iio-private.h"
 
@@ -26,64 +27,104 @@
 #include <string.h>
 #include <stdio.h>
 
+/* State of the decompression of the chunks of one READBUF request */
+struct iiod_client_decoder {
+	struct iiod_codec *codec;
+	char *buf;
+	size_t buf_len;
+};
+
+/* A request waiting for its response on a multiplexed connection */
+struct iiod_client_req {
+	uint32_t tag;
+
+	/* Where to store the payload of the response, and how much of it
+	 * was stored */
+	void *dst;
+	size_t len, nb;
+
+	int32_t code;
+	int err;
+	bool done;
+
+	struct iiod_client_req *next;
+};
+
+/* Number of hash buckets of the cache of the values of the attributes */
+#define IIOD_CLIENT_ATTR_CACHE_BUCKETS 64
+
+struct iiod_client_attr_entry {
+	struct iiod_client_attr_entry *next;
+	const struct iio_device *dev;
+	const struct iio_channel *chn;
+	enum iio_attr_type type;
+	char *attr;
+
+	/* Monotonic time after which the value is stale; 0 if it is kept
+	 * until invalidated */
+	uint64_t expires_ns;
+
+	size_t len;
+	char value[];
+};
+
+struct iiod_client_attr_rule {
+	struct iiod_client_attr_rule *next;
+	int ttl_ms;
+	char attr[];
+};
+
+/*
+ * Values of the attributes read, returned instead of sending the same READ
+ * command again until they expire. The generation is incremented by each
+ * invalidation: a value is only stored if no write happened while it was
+ * being read, as it could then be that of before the write.
+ */
+struct iiod_client_attr_cache {
+	struct iio_mutex *lock;
+	int ttl_ms;
+	struct iiod_client_attr_rule *rules;
+	struct iiod_client_attr_entry *buckets[IIOD_CLIENT_ATTR_CACHE_BUCKETS];
+	uint64_t generation;
+	struct iio_attr_cache_stats stats;
+};
+
 struct iiod_client {
 	struct iio_context_pdata *pdata;
 	const struct iiod_client_ops *ops;
 	struct iio_mutex *lock;
+
+	/* When requests are multiplexed over mux_desc, client->lock only
+	 * serializes the sending of the requests. The waiting threads take
+	 * turns reading the responses, and route each of them to the request
+	 * carrying the same tag. */
+	void *mux_desc;
+	struct iio_mutex *mux_lock;
+	struct iio_cond *mux_cond;
+	struct iiod_client_req *pending;
+	bool mux_reading;
+	int mux_err;
+
+	struct iiod_client_attr_cache attr_cache;
 };
 
-static ssize_t iiod_client_read_integer(struct iiod_client *client,
-		void *desc, int *val)
+static struct iiod_client_link * iiod_client_get_link(
+		struct iiod_client *client, void *desc)
 {
-	unsigned int i;
-	char buf[1024], *ptr = NULL, *end;
-	ssize_t ret;
-	int value;
-
-	do {
-		ret = client->ops->read_line(client->pdata,
-				desc, buf, sizeof(buf));
-		if (ret < 0) {
-			IIO_ERROR("READ LINE: %zd\n", ret);
-			return ret;
-		}
-
-		for (i = 0; i < (unsigned int) ret; i++) {
-			if (buf[i] != '\n') {
-				if (!ptr)
-					ptr = &buf[i];
-			} else if (!!ptr) {
-				break;
-			}
-		}
-	} while (!ptr);
-
-	buf[i] = '\0';
-
-	errno = 0;
-	value = (int) strtol(ptr, &end, 10);
-	if (ptr == end || errno == ERANGE)
-		return -EINVAL;
+	if (!client->ops->get_link)
+		return NULL;
 
-	*val = value;
-	return 0;
+	return client->ops->get_link(client->pdata, desc);
 }
 
-static int iiod_client_exec_command(struct iiod_client *client,
-		void *desc, const char *cmd)
+static bool iiod_client_is_binary(struct iiod_client *client, void *desc)
 {
-	int resp;
-	ssize_t ret;
-
-	ret = client->ops->write(client->pdata, desc, cmd, strlen(cmd));
-	if (ret < 0)
-		return (int) ret;
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
 
-	ret = iiod_client_read_integer(client, desc, &resp);
-	return ret < 0 ? (int) ret : resp;
+	return link && link->binary;
 }
 
-static ssize_t iiod_client_write_all(struct iiod_client *client,
+static ssize_t iiod_client_write_raw(struct iiod_client *client,
 		void *desc, const void *src, size_t len)
 {
 	struct iio_context_pdata *pdata = client->pdata;
@@ -110,15 +151,102 @@ static ssize_t iiod_client_write_all(struct iiod_client *client,
 	return (ssize_t) (ptr - (uintptr_t) src);
 }
 
-static ssize_t iiod_client_read_all(struct iiod_client *client,
+/* Refills the receive buffer of the link, with as much data as the
+ * connection has available */
+static ssize_t iiod_client_fill(struct iiod_client *client, void *desc,
+		struct iiod_client_link *link)
+{
+	ssize_t ret;
+
+	do {
+		ret = client->ops->read(client->pdata, desc,
+				link->rx_buf, sizeof(link->rx_buf));
+	} while (ret == -EINTR);
+
+	if (ret == 0)
+		return -EPIPE;
+	if (ret < 0)
+		return ret;
+
+	link->rx_pos = 0;
+	link->rx_len = (size_t) ret;
+	return ret;
+}
+
+/* Reads what is available, from the receive buffer of the link first */
+static ssize_t iiod_client_recv(struct iiod_client *client,
+		void *desc, void *dst, size_t len)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	size_t avail;
+	ssize_t ret;
+
+	if (!link)
+		return client->ops->read(client->pdata, desc, dst, len);
+
+	avail = link->rx_len - link->rx_pos;
+	if (!avail) {
+		/* Large reads, like the samples, bypass the buffer */
+		if (len >= sizeof(link->rx_buf))
+			return client->ops->read(client->pdata, desc, dst, len);
+
+		ret = iiod_client_fill(client, desc, link);
+		if (ret < 0)
+			return ret;
+
+		avail = link->rx_len;
+	}
+
+	if (len > avail)
+		len = avail;
+
+	memcpy(dst, &link->rx_buf[link->rx_pos], len);
+	link->rx_pos += len;
+
+	return (ssize_t) len;
+}
+
+/* Reads one line of the text protocol, terminating \n included */
+static ssize_t iiod_client_read_line(struct iiod_client *client,
+		void *desc, char *dst, size_t len)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	bool found = false;
+	ssize_t ret;
+	size_t i;
+
+	if (!link)
+		return client->ops->read_line(client->pdata, desc, dst, len);
+
+	for (i = 0; i < len - 1; i++) {
+		if (link->rx_pos == link->rx_len) {
+			ret = iiod_client_fill(client, desc, link);
+			if (ret < 0)
+				return ret;
+		}
+
+		dst[i] = link->rx_buf[link->rx_pos++];
+
+		if (dst[i] != '\n')
+			found = true;
+		else if (found)
+			break;
+	}
+
+	/* No \n found? Just garbage data */
+	if (!found || i == len - 1)
+		return -EIO;
+
+	return (ssize_t) i + 1;
+}
+
+static ssize_t iiod_client_read_raw(struct iiod_client *client,
 		void *desc, void *dst, size_t len)
 {
-	struct iio_context_pdata *pdata = client->pdata;
-	const struct iiod_client_ops *ops = client->ops;
 	uintptr_t ptr = (uintptr_t) dst;
 
 	while (len) {
-		ssize_t ret = ops->read(pdata, desc, (void *) ptr, len);
+		ssize_t ret = iiod_client_recv(client, desc, (void *) ptr, len);
 
 		if (ret < 0) {
 			if (ret == -EINTR)
@@ -137,381 +265,1941 @@ static ssize_t iiod_client_read_all(struct iiod_client *client,
 	return (ssize_t) (ptr - (uintptr_t) dst);
 }
 
-struct iiod_client * iiod_client_new(struct iio_context_pdata *pdata,
-		struct iio_mutex *lock, const struct iiod_client_ops *ops)
+/* Sends data to iiod; with the binary protocol, the data is sent as one
+ * frame, carrying the tag of the current request */
+static ssize_t iiod_client_write_all(struct iiod_client *client,
+		void *desc, const void *src, size_t len)
 {
-	struct iiod_client *client;
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	struct iiod_frame_header hdr;
+	uint32_t crc = 0;
+	char buf[1024];
+	size_t size;
+	ssize_t ret;
 
-	client = malloc(sizeof(*client));
-	if (!client) {
-		errno = ENOMEM;
-		return NULL;
-	}
+	if (!link || !link->binary)
+		return iiod_client_write_raw(client, desc, src, len);
 
-	client->lock = lock;
-	client->pdata = pdata;
-	client->ops = ops;
-	return client;
-}
+	hdr.tag = iio_htobe32(link->tag);
+	hdr.code = 0;
+	hdr.len = iio_htobe32((uint32_t) len);
+	hdr.flags = iio_htobe32(link->crc ? IIOD_FRAME_CRC : 0);
 
-void iiod_client_destroy(struct iiod_client *client)
-{
-	free(client);
-}
+	if (link->crc) {
+		crc = iiod_crc32(0, &hdr, sizeof(hdr));
+		crc = iio_htobe32(iiod_crc32(crc, src, len));
+	}
 
-int iiod_client_get_version(struct iiod_client *client, void *desc,
-		unsigned int *major, unsigned int *minor, char *git_tag)
-{
-	struct iio_context_pdata *pdata = client->pdata;
-	const struct iiod_client_ops *ops = client->ops;
-	char buf[256], *ptr = buf, *end;
-	long maj, min;
-	int ret;
+	/* Small payloads, like commands, are sent along with the header and
+	 * CRC */
+	if (len <= sizeof(buf) - sizeof(hdr) - sizeof(crc)) {
+		memcpy(buf, &hdr, sizeof(hdr));
+		memcpy(buf + sizeof(hdr), src, len);
+		size = sizeof(hdr) + len;
 
-	iio_mutex_lock(client->lock);
+		if (link->crc) {
+			memcpy(buf + size, &crc, sizeof(crc));
+			size += sizeof(crc);
+		}
 
-	ret = (int) ops->write(pdata, desc, "VERSION\r\n", sizeof("VERSION\r\n") - 1);
-	if (ret < 0) {
-		iio_mutex_unlock(client->lock);
-		return ret;
+		ret = iiod_client_write_raw(client, desc, buf, size);
+		return ret < 0 ? ret : (ssize_t) len;
 	}
 
-	ret = (int) ops->read_line(pdata, desc, buf, sizeof(buf));
-	iio_mutex_unlock(client->lock);
-
+	ret = iiod_client_write_raw(client, desc, &hdr, sizeof(hdr));
 	if (ret < 0)
 		return ret;
 
-	errno = 0;
-	maj = strtol(ptr, &end, 10);
-	if (ptr == end || errno == ERANGE)
-		return -EIO;
+	ret = iiod_client_write_raw(client, desc, src, len);
+	if (ret < 0 || !link->crc)
+		return ret;
 
-	ptr = end + 1;
-	errno = 0;
-	min = strtol(ptr, &end, 10);
-	if (ptr == end || errno == ERANGE)
-		return -EIO;
+	ret = iiod_client_write_raw(client, desc, &crc, sizeof(crc));
+	return ret < 0 ? ret : (ssize_t) len;
+}
 
-	ptr = end + 1;
-	if (buf + ret < ptr + 8)
-		return -EIO;
+/* Sends a new command to iiod */
+static ssize_t iiod_client_write_command(struct iiod_client *client,
+		void *desc, const char *cmd)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
 
-	/* Strip the \n */
-	ptr[buf + ret - ptr - 1] = '\0';
+	if (link)
+		link->tag++;
 
-	if (major)
-		*major = (unsigned int) maj;
-	if (minor)
-		*minor = (unsigned int) min;
-	if (git_tag)
-		iio_strlcpy(git_tag, ptr, 8);
-	return 0;
+	return iiod_client_write_all(client, desc, cmd, strlen(cmd));
 }
 
-int iiod_client_get_trigger(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, const struct iio_device **trigger)
+/* Reads the CRC following the payload of the current response frame, if it
+ * has one */
+static int iiod_client_check_crc(struct iiod_client *client, void *desc,
+		struct iiod_client_link *link)
 {
-	const struct iio_context *ctx = iio_device_get_context(dev);
-	unsigned int i, nb_devices = iio_context_get_devices_count(ctx);
-	char buf[1024];
-	unsigned int name_len;
-	int ret;
-
-	iio_snprintf(buf, sizeof(buf), "GETTRIG %s\r\n",
-			iio_device_get_id(dev));
+	uint32_t crc;
+	ssize_t ret;
 
-	iio_mutex_lock(client->lock);
-	ret = iiod_client_exec_command(client, desc, buf);
+	if (!(link->in_flags & IIOD_FRAME_CRC))
+		return 0;
 
-	if (ret == 0)
-		*trigger = NULL;
-	if (ret <= 0)
-		goto out_unlock;
+	ret = iiod_client_read_raw(client, desc, &crc, sizeof(crc));
+	if (ret < 0)
+		return (int) ret;
 
-	if ((unsigned int) ret > sizeof(buf) - 1) {
-		ret = -EIO;
-		goto out_unlock;
+	if (iio_be32toh(crc) != link->in_crc) {
+		IIO_ERROR("CRC mismatch on response frame\n");
+		return -EIO;
 	}
 
-	name_len = ret;
+	return 0;
+}
 
-	ret = (int) iiod_client_read_all(client, desc, buf, name_len + 1);
+/* Reads the header of the next response frame */
+static int iiod_client_read_header(struct iiod_client *client, void *desc,
+		struct iiod_client_link *link, struct iiod_frame_header *hdr)
+{
+	ssize_t ret;
+
+	ret = iiod_client_read_raw(client, desc, hdr, sizeof(*hdr));
 	if (ret < 0)
-		goto out_unlock;
+		return (int) ret;
 
-	ret = -ENXIO;
+	link->in_left = iio_be32toh(hdr->len);
+	link->in_flags = iio_be32toh(hdr->flags);
+	link->in_crc = iiod_crc32(0, hdr, sizeof(*hdr));
 
-	for (i = 0; i < nb_devices; i++) {
-		struct iio_device *cur = iio_context_get_device(ctx, i);
+	/* Once negotiated, frames without a CRC are not trusted */
+	if (link->crc && !(link->in_flags & IIOD_FRAME_CRC))
+		return -EIO;
 
-		if (iio_device_is_trigger(cur)) {
-			const char *name = iio_device_get_name(cur);
+	if (!link->in_left)
+		return iiod_client_check_crc(client, desc, link);
 
-			if (!name)
-				continue;
+	return 0;
+}
 
-			if (!strncmp(name, buf, name_len)) {
-				*trigger = cur;
-				ret = 0;
-				goto out_unlock;
-			}
+/* Reads part of the payload of the current response frame; its CRC is
+ * checked once the last byte was read */
+static ssize_t iiod_client_read_payload(struct iiod_client *client,
+		void *desc, struct iiod_client_link *link, void *dst, size_t len)
+{
+	ssize_t ret;
+	int err;
+
+	if (len > link->in_left)
+		return -EIO;
+	if (!len)
+		return 0;
+
+	ret = iiod_client_read_raw(client, desc, dst, len);
+	if (ret < 0)
+		return ret;
+
+	link->in_left -= (size_t) ret;
+
+	if (link->in_flags & IIOD_FRAME_CRC) {
+		link->in_crc = iiod_crc32(link->in_crc, dst, (size_t) ret);
+
+		if (!link->in_left) {
+			err = iiod_client_check_crc(client, desc, link);
+			if (err < 0)
+				return err;
 		}
 	}
 
-out_unlock:
-	iio_mutex_unlock(client->lock);
 	return ret;
 }
 
-int iiod_client_set_trigger(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, const struct iio_device *trigger)
+/* Drops what is left of the payload of the current response frame */
+static int iiod_client_drop(struct iiod_client *client, void *desc,
+		struct iiod_client_link *link)
 {
-	char buf[1024];
-	int ret;
+	char buf[256];
 
-	if (trigger) {
-		iio_snprintf(buf, sizeof(buf), "SETTRIG %s %s\r\n",
-				iio_device_get_id(dev),
-				iio_device_get_id(trigger));
-	} else {
-		iio_snprintf(buf, sizeof(buf), "SETTRIG %s\r\n",
-				iio_device_get_id(dev));
+	while (link->in_left) {
+		ssize_t ret = iiod_client_read_payload(client, desc, link, buf,
+				link->in_left > sizeof(buf) ?
+				sizeof(buf) : link->in_left);
+		if (ret < 0)
+			return (int) ret;
 	}
 
-	iio_mutex_lock(client->lock);
-	ret = iiod_client_exec_command(client, desc, buf);
-	iio_mutex_unlock(client->lock);
-	return ret;
+	return 0;
 }
 
-int iiod_client_set_kernel_buffers_count(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, unsigned int nb_blocks)
+/* Reads data following a response; with the binary protocol, the data
+ * must be part of the payload of the current response frame */
+static ssize_t iiod_client_read_all(struct iiod_client *client,
+		void *desc, void *dst, size_t len)
 {
-	int ret;
-	char buf[1024];
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
 
-	iio_snprintf(buf, sizeof(buf), "SET %s BUFFERS_COUNT %u\r\n",
-			iio_device_get_id(dev), nb_blocks);
+	if (!link || !link->binary)
+		return iiod_client_read_raw(client, desc, dst, len);
 
-	iio_mutex_lock(client->lock);
-	ret = iiod_client_exec_command(client, desc, buf);
+	return iiod_client_read_payload(client, desc, link, dst, len);
+}
+
+static ssize_t iiod_client_read_frame(struct iiod_client *client,
+		void *desc, struct iiod_client_link *link, int *val)
+{
+	struct iiod_frame_header hdr;
+	int ret;
+
+	/* Drop what the previous response left unread */
+	ret = iiod_client_drop(client, desc, link);
+	if (ret < 0)
+		return ret;
+
+	ret = iiod_client_read_header(client, desc, link, &hdr);
+	if (ret < 0)
+		return ret;
+
+	*val = (int32_t) iio_be32toh((uint32_t) hdr.code);
+	return 0;
+}
+
+static ssize_t iiod_client_read_integer(struct iiod_client *client,
+		void *desc, int *val)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	unsigned int i;
+	char buf[1024], *ptr = NULL, *end;
+	ssize_t ret;
+	int value;
+
+	if (link && link->binary)
+		return iiod_client_read_frame(client, desc, link, val);
+
+	do {
+		ret = iiod_client_read_line(client, desc, buf, sizeof(buf));
+		if (ret < 0) {
+			IIO_ERROR("READ LINE: %zd\n", ret);
+			return ret;
+		}
+
+		for (i = 0; i < (unsigned int) ret; i++) {
+			if (buf[i] != '\n') {
+				if (!ptr)
+					ptr = &buf[i];
+			} else if (!!ptr) {
+				break;
+			}
+		}
+	} while (!ptr);
+
+	buf[i] = '\0';
+
+	errno = 0;
+	value = (int) strtol(ptr, &end, 10);
+	if (ptr == end || errno == ERANGE)
+		return -EINVAL;
+
+	*val = value;
+	return 0;
+}
+
+static int iiod_client_exec_command(struct iiod_client *client,
+		void *desc, const char *cmd)
+{
+	int resp;
+	ssize_t ret;
+
+	ret = iiod_client_write_command(client, desc, cmd);
+	if (ret < 0)
+		return (int) ret;
+
+	ret = iiod_client_read_integer(client, desc, &resp);
+	return ret < 0 ? (int) ret : resp;
+}
+
+static bool iiod_client_is_muxed(struct iiod_client *client, void *desc)
+{
+	return client->mux_desc && desc == client->mux_desc &&
+		iiod_client_is_binary(client, desc);
+}
+
+/* Sends a request on the multiplexed connection; the request is registered
+ * before being sent, so that its response can be routed as soon as it
+ * arrives */
+static int iiod_client_mux_submit(struct iiod_client *client, void *desc,
+		struct iiod_client_req *req, const char *cmd,
+		const void *src, size_t len)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	ssize_t ret;
+
+	req->nb = 0;
+	req->code = 0;
+	req->err = 0;
+	req->done = false;
+
+	iio_mutex_lock(client->lock);
+
+	iio_mutex_lock(client->mux_lock);
+	ret = client->mux_err;
+	if (!ret) {
+		req->tag = ++link->tag;
+		req->next = client->pending;
+		client->pending = req;
+	}
+	iio_mutex_unlock(client->mux_lock);
+
+	if (!ret)
+		ret = iiod_client_write_all(client, desc, cmd, strlen(cmd));
+	if (ret >= 0 && src)
+		ret = iiod_client_write_all(client, desc, src, len);
+
+	iio_mutex_unlock(client->lock);
+
+	if (ret < 0) {
+		struct iiod_client_req **ptr;
+
+		/* A request may have been partially sent; nothing can be sent
+		 * on this connection anymore */
+		iio_mutex_lock(client->mux_lock);
+		for (ptr = &client->pending; *ptr; ptr = &(*ptr)->next) {
+			if (*ptr == req) {
+				*ptr = req->next;
+				break;
+			}
+		}
+		if (!client->mux_err)
+			client->mux_err = (int) ret;
+		iio_cond_broadcast(client->mux_cond);
+		iio_mutex_unlock(client->mux_lock);
+		return (int) ret;
+	}
+
+	return 0;
+}
+
+/* Reads one response frame, and hands it to the request it belongs to.
+ * Called by one thread at a time, without the mux lock held. */
+static int iiod_client_mux_read_one(struct iiod_client *client, void *desc)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	struct iiod_client_req *req, **ptr;
+	struct iiod_frame_header hdr;
+	size_t len, nb = 0;
+	uint32_t tag;
+	ssize_t ret;
+
+	ret = iiod_client_read_header(client, desc, link, &hdr);
+	if (ret < 0)
+		return (int) ret;
+
+	tag = iio_be32toh(hdr.tag);
+	len = link->in_left;
+
+	iio_mutex_lock(client->mux_lock);
+	for (ptr = &client->pending; *ptr; ptr = &(*ptr)->next)
+		if ((*ptr)->tag == tag)
+			break;
+	req = *ptr;
+	if (req)
+		*ptr = req->next;
+	iio_mutex_unlock(client->mux_lock);
+
+	/* The owner of the request keeps waiting until it is marked as done,
+	 * so its buffer can be filled without the lock held */
+	if (req) {
+		nb = len < req->len ? len : req->len;
+		if (nb)
+			ret = iiod_client_read_payload(client, desc, link,
+					req->dst, nb);
+	}
+
+	if (ret >= 0)
+		ret = iiod_client_drop(client, desc, link);
+
+	if (!req) {
+		IIO_DEBUG("Dropped response with unknown tag %u\n", tag);
+		return (int) ret;
+	}
+
+	iio_mutex_lock(client->mux_lock);
+	req->code = (int32_t) iio_be32toh((uint32_t) hdr.code);
+	req->nb = nb;
+	req->err = ret < 0 ? (int) ret : 0;
+	req->done = true;
+	iio_mutex_unlock(client->mux_lock);
+
+	return ret < 0 ? (int) ret : 0;
+}
+
+/* Waits for the response to a submitted request. Whichever waiting thread
+ * finds the connection idle reads the next frame, until its own response
+ * arrived; the other threads sleep meanwhile. */
+static int iiod_client_mux_wait(struct iiod_client *client, void *desc,
+		struct iiod_client_req *req)
+{
+	struct iiod_client_req **ptr;
+	int ret;
+
+	iio_mutex_lock(client->mux_lock);
+
+	while (!req->done) {
+		if (client->mux_reading) {
+			iio_cond_wait(client->mux_cond, client->mux_lock);
+			continue;
+		}
+
+		if (client->mux_err) {
+			for (ptr = &client->pending; *ptr; ptr = &(*ptr)->next) {
+				if (*ptr == req) {
+					*ptr = req->next;
+					break;
+				}
+			}
+
+			req->err = client->mux_err;
+			break;
+		}
+
+		client->mux_reading = true;
+		iio_mutex_unlock(client->mux_lock);
+
+		ret = iiod_client_mux_read_one(client, desc);
+
+		iio_mutex_lock(client->mux_lock);
+		client->mux_reading = false;
+		if (ret < 0 && !client->mux_err)
+			client->mux_err = ret;
+		iio_cond_broadcast(client->mux_cond);
+	}
+
+	iio_mutex_unlock(client->mux_lock);
+
+	return req->err ? req->err : (int) req->code;
+}
+
+/* Sends a request on the multiplexed connection, then returns the code of
+ * its response; up to 'len' bytes of the payload are stored in 'dst' */
+static int iiod_client_mux_exec(struct iiod_client *client, void *desc,
+		const char *cmd, const void *src, size_t src_len,
+		void *dst, size_t len, size_t *nb)
+{
+	struct iiod_client_req req;
+	int ret;
+
+	req.dst = dst;
+	req.len = len;
+
+	ret = iiod_client_mux_submit(client, desc, &req, cmd, src, src_len);
+	if (ret < 0)
+		return ret;
+
+	ret = iiod_client_mux_wait(client, desc, &req);
+	if (nb)
+		*nb = req.nb;
+	return ret;
+}
+
+/* Runs a command that has no payload in its response */
+static int iiod_client_exec(struct iiod_client *client,
+		void *desc, const char *cmd)
+{
+	int ret;
+
+	if (iiod_client_is_muxed(client, desc))
+		return iiod_client_mux_exec(client, desc, cmd,
+				NULL, 0, NULL, 0, NULL);
+
+	iio_mutex_lock(client->lock);
+	ret = iiod_client_exec_command(client, desc, cmd);
+	iio_mutex_unlock(client->lock);
+	return ret;
+}
+
+static unsigned int iiod_client_attr_cache_hash(const struct iio_device *dev,
+		const struct iio_channel *chn, const char *attr,
+		enum iio_attr_type type)
+{
+	uint32_t hash = 2166136261u;
+
+	/* FNV-1a */
+	for (; *attr; attr++)
+		hash = (hash ^ (unsigned char) *attr) * 16777619u;
+
+	hash ^= (uint32_t) ((uintptr_t) dev >> 4) ^
+		(uint32_t) ((uintptr_t) chn >> 4) ^ (uint32_t) type;
+
+	return hash % IIOD_CLIENT_ATTR_CACHE_BUCKETS;
+}
+
+static struct iiod_client_attr_entry ** iiod_client_attr_cache_find(
+		struct iiod_client_attr_cache *cache, const struct iio_device *dev,
+		const struct iio_channel *chn, const char *attr,
+		enum iio_attr_type type)
+{
+	struct iiod_client_attr_entry **entry;
+
+	entry = &cache->buckets[iiod_client_attr_cache_hash(dev, chn, attr, type)];
+
+	for (; *entry; entry = &(*entry)->next)
+		if ((*entry)->dev == dev && (*entry)->chn == chn &&
+				(*entry)->type == type &&
+				!strcmp((*entry)->attr, attr))
+			break;
+
+	return entry;
+}
+
+static void iiod_client_attr_cache_remove(struct iiod_client_attr_cache *cache,
+		struct iiod_client_attr_entry **entry)
+{
+	struct iiod_client_attr_entry *next = (*entry)->next;
+
+	free(*entry);
+	*entry = next;
+	cache->stats.evictions++;
+}
+
+/* Drops the values cached for a device, or for all of them if dev is NULL.
+ * Called with the lock of the cache held. */
+static void iiod_client_attr_cache_flush(struct iiod_client_attr_cache *cache,
+		const struct iio_device *dev)
+{
+	struct iiod_client_attr_entry **entry;
+	unsigned int i;
+
+	for (i = 0; i < IIOD_CLIENT_ATTR_CACHE_BUCKETS; i++) {
+		for (entry = &cache->buckets[i]; *entry; ) {
+			if (!dev || (*entry)->dev == dev)
+				iiod_client_attr_cache_remove(cache, entry);
+			else
+				entry = &(*entry)->next;
+		}
+	}
+
+	cache->generation++;
+}
+
+static void iiod_client_attr_cache_invalidate(struct iiod_client *client,
+		const struct iio_device *dev)
+{
+	struct iiod_client_attr_cache *cache = &client->attr_cache;
+
+	iio_mutex_lock(cache->lock);
+	iiod_client_attr_cache_flush(cache, dev);
+	iio_mutex_unlock(cache->lock);
+}
+
+/* Returns the TTL of an attribute, negative if it is not cached */
+static int iiod_client_attr_cache_get_ttl(const struct iiod_client_attr_cache *cache,
+		const char *attr)
+{
+	const struct iiod_client_attr_rule *rule;
+
+	for (rule = cache->rules; rule; rule = rule->next)
+		if (!strcmp(rule->attr, attr))
+			return rule->ttl_ms;
+
+	return cache->ttl_ms;
+}
+
+/* Returns true if the value was found in the cache, and stored in 'dest'
+ * along with its length in 'ret'; otherwise, 'gen' is set to the generation
+ * to give to iiod_client_attr_cache_put() */
+static bool iiod_client_attr_cache_get(struct iiod_client *client,
+		const struct iio_device *dev, const struct iio_channel *chn,
+		const char *attr, enum iio_attr_type type,
+		char *dest, size_t len, ssize_t *ret, uint64_t *gen)
+{
+	struct iiod_client_attr_cache *cache = &client->attr_cache;
+	struct iiod_client_attr_entry **entry;
+	bool found = false;
+
+	iio_mutex_lock(cache->lock);
+
+	*gen = cache->generation;
+
+	if (iiod_client_attr_cache_get_ttl(cache, attr) < 0)
+		goto out_unlock;
+
+	entry = iiod_client_attr_cache_find(cache, dev, chn, attr, type);
+	if (*entry && (*entry)->expires_ns &&
+			iio_get_monotonic_ns() >= (*entry)->expires_ns)
+		iiod_client_attr_cache_remove(cache, entry);
+
+	/* Values that do not fit are read again, to fail the same way */
+	if (*entry && (*entry)->len < len) {
+		memcpy(dest, (*entry)->value, (*entry)->len + 1);
+		*ret = (ssize_t) (*entry)->len;
+		cache->stats.hits++;
+		found = true;
+	} else {
+		cache->stats.misses++;
+	}
+
+out_unlock:
+	iio_mutex_unlock(cache->lock);
+	return found;
+}
+
+static void iiod_client_attr_cache_put(struct iiod_client *client,
+		const struct iio_device *dev, const struct iio_channel *chn,
+		const char *attr, enum iio_attr_type type,
+		const char *value, size_t len, uint64_t gen)
+{
+	struct iiod_client_attr_cache *cache = &client->attr_cache;
+	struct iiod_client_attr_entry **entry, *new_entry;
+	size_t attr_len = strlen(attr);
+	int ttl_ms;
+
+	iio_mutex_lock(cache->lock);
+
+	ttl_ms = iiod_client_attr_cache_get_ttl(cache, attr);
+	if (ttl_ms < 0 || gen != cache->generation)
+		goto out_unlock;
+
+	entry = iiod_client_attr_cache_find(cache, dev, chn, attr, type);
+	if (*entry)
+		iiod_client_attr_cache_remove(cache, entry);
+
+	new_entry = malloc(sizeof(*new_entry) + len + attr_len + 2);
+	if (!new_entry)
+		goto out_unlock;
+
+	new_entry->dev = dev;
+	new_entry->chn = chn;
+	new_entry->type = type;
+	new_entry->len = len;
+	memcpy(new_entry->value, value, len);
+	new_entry->value[len] = '\0';
+	new_entry->attr = &new_entry->value[len + 1];
+	memcpy(new_entry->attr, attr, attr_len + 1);
+
+	if (ttl_ms)
+		new_entry->expires_ns = iio_get_monotonic_ns() +
+			(uint64_t) ttl_ms * 1000000ull;
+	else
+		new_entry->expires_ns = 0;
+
+	new_entry->next = *entry;
+	*entry = new_entry;
+
+out_unlock:
+	iio_mutex_unlock(cache->lock);
+}
+
+static void iiod_client_attr_cache_free_rules(struct iiod_client_attr_cache *cache)
+{
+	struct iiod_client_attr_rule *rule, *next;
+
+	for (rule = cache->rules; rule; rule = next) {
+		next = rule->next;
+		free(rule);
+	}
+
+	cache->rules = NULL;
+}
+
+int iiod_client_set_attr_cache(struct iiod_client *client,
+		const char *attr, int ttl_ms)
+{
+	struct iiod_client_attr_cache *cache = &client->attr_cache;
+	struct iiod_client_attr_rule *rule;
+	size_t attr_len;
+	int ret = 0;
+
+	iio_mutex_lock(cache->lock);
+
+	/* The expiration of the values cached depends on the old TTLs */
+	iiod_client_attr_cache_flush(cache, NULL);
+
+	if (!attr) {
+		iiod_client_attr_cache_free_rules(cache);
+		cache->ttl_ms = ttl_ms;
+		goto out_unlock;
+	}
+
+	for (rule = cache->rules; rule; rule = rule->next)
+		if (!strcmp(rule->attr, attr))
+			break;
+
+	if (!rule) {
+		attr_len = strlen(attr);
+
+		rule = malloc(sizeof(*rule) + attr_len + 1);
+		if (!rule) {
+			ret = -ENOMEM;
+			goto out_unlock;
+		}
+
+		memcpy(rule->attr, attr, attr_len + 1);
+		rule->next = cache->rules;
+		cache->rules = rule;
+	}
+
+	rule->ttl_ms = ttl_ms;
+
+out_unlock:
+	iio_mutex_unlock(cache->lock);
+	return ret;
+}
+
+void iiod_client_invalidate_attr_cache(struct iiod_client *client)
+{
+	iiod_client_attr_cache_invalidate(client, NULL);
+}
+
+void iiod_client_get_attr_cache_stats(struct iiod_client *client,
+		struct iio_attr_cache_stats *stats)
+{
+	iio_mutex_lock(client->attr_cache.lock);
+	*stats = client->attr_cache.stats;
+	iio_mutex_unlock(client->attr_cache.lock);
+}
+
+struct iiod_client * iiod_client_new(struct iio_context_pdata *pdata,
+		struct iio_mutex *lock, const struct iiod_client_ops *ops)
+{
+	struct iiod_client *client;
+
+	client = zalloc(sizeof(*client));
+	if (!client) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	client->attr_cache.lock = iio_mutex_create();
+	if (!client->attr_cache.lock) {
+		free(client);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	client->attr_cache.ttl_ms = -1;
+
+	client->lock = lock;
+	client->pdata = pdata;
+	client->ops = ops;
+	client->mux_desc = NULL;
+	client->mux_lock = NULL;
+	client->mux_cond = NULL;
+	client->pending = NULL;
+	client->mux_reading = false;
+	client->mux_err = 0;
+	return client;
+}
+
+void iiod_client_destroy(struct iiod_client *client)
+{
+	if (client->mux_cond)
+		iio_cond_destroy(client->mux_cond);
+	if (client->mux_lock)
+		iio_mutex_destroy(client->mux_lock);
+
+	iiod_client_attr_cache_flush(&client->attr_cache, NULL);
+	iiod_client_attr_cache_free_rules(&client->attr_cache);
+	iio_mutex_destroy(client->attr_cache.lock);
+	free(client);
+}
+
+int iiod_client_enable_mux(struct iiod_client *client, void *desc)
+{
+	if (!iiod_client_is_binary(client, desc))
+		return -ENOSYS;
+
+	if (client->mux_desc)
+		return -EBUSY;
+
+	client->mux_lock = iio_mutex_create();
+	if (!client->mux_lock)
+		return -ENOMEM;
+
+	client->mux_cond = iio_cond_create();
+	if (!client->mux_cond) {
+		iio_mutex_destroy(client->mux_lock);
+		client->mux_lock = NULL;
+		return -ENOMEM;
+	}
+
+	client->mux_desc = desc;
+	return 0;
+}
+
+int iiod_client_get_version(struct iiod_client *client, void *desc,
+		unsigned int *major, unsigned int *minor, char *git_tag)
+{
+	char buf[256], *ptr = buf, *end;
+	long maj, min;
+	int ret, version_len;
+
+	if (iiod_client_is_muxed(client, desc)) {
+		size_t nb;
+
+		ret = iiod_client_mux_exec(client, desc, "VERSION\r\n",
+				NULL, 0, buf, sizeof(buf), &nb);
+		if (ret <= 0 || ret >= (int) sizeof(buf) || nb != (size_t) ret)
+			return ret < 0 ? ret : -EIO;
+		goto out_parse;
+	}
+
+	iio_mutex_lock(client->lock);
+
+	ret = (int) iiod_client_write_command(client, desc, "VERSION\r\n");
+	if (ret < 0) {
+		iio_mutex_unlock(client->lock);
+		return ret;
+	}
+
+	if (iiod_client_is_binary(client, desc)) {
+		/* The version string is the payload of the response */
+		ret = iiod_client_read_integer(client, desc, &version_len);
+		if (!ret && (version_len <= 0 || version_len >= (int) sizeof(buf)))
+			ret = -EIO;
+		if (!ret)
+			ret = (int) iiod_client_read_all(client, desc,
+					buf, version_len);
+	} else {
+		ret = (int) iiod_client_read_line(client, desc,
+				buf, sizeof(buf));
+	}
+	iio_mutex_unlock(client->lock);
+
+	if (ret < 0)
+		return ret;
+
+out_parse:
+	errno = 0;
+	maj = strtol(ptr, &end, 10);
+	if (ptr == end || errno == ERANGE)
+		return -EIO;
+
+	ptr = end + 1;
+	errno = 0;
+	min = strtol(ptr, &end, 10);
+	if (ptr == end || errno == ERANGE)
+		return -EIO;
+
+	ptr = end + 1;
+	if (buf + ret < ptr + 8)
+		return -EIO;
+
+	/* Strip the \n */
+	ptr[buf + ret - ptr - 1] = '\0';
+
+	if (major)
+		*major = (unsigned int) maj;
+	if (minor)
+		*minor = (unsigned int) min;
+	if (git_tag)
+		iio_strlcpy(git_tag, ptr, 8);
+	return 0;
+}
+
+int iiod_client_get_trigger(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const struct iio_device **trigger)
+{
+	const struct iio_context *ctx = iio_device_get_context(dev);
+	unsigned int i, nb_devices = iio_context_get_devices_count(ctx);
+	char buf[1024];
+	unsigned int name_len;
+	int ret;
+
+	iio_snprintf(buf, sizeof(buf), "GETTRIG %s\r\n",
+			iio_device_get_id(dev));
+
+	if (iiod_client_is_muxed(client, desc)) {
+		size_t nb;
+
+		ret = iiod_client_mux_exec(client, desc, buf, NULL, 0,
+				buf, sizeof(buf), &nb);
+		if (ret > 0 && nb < (size_t) ret)
+			ret = -EIO;
+		if (ret == 0)
+			*trigger = NULL;
+		if (ret <= 0)
+			return ret;
+
+		name_len = ret;
+		goto out_lookup;
+	}
+
+	iio_mutex_lock(client->lock);
+	ret = iiod_client_exec_command(client, desc, buf);
+
+	if (ret == 0)
+		*trigger = NULL;
+	if (ret <= 0)
+		goto out_unlock;
+
+	if ((unsigned int) ret > sizeof(buf) - 1) {
+		ret = -EIO;
+		goto out_unlock;
+	}
+
+	name_len = ret;
+
+	ret = (int) iiod_client_read_all(client, desc, buf, name_len + 1);
+	iio_mutex_unlock(client->lock);
+	if (ret < 0)
+		return ret;
+
+out_lookup:
+	ret = -ENXIO;
+
+	for (i = 0; i < nb_devices; i++) {
+		struct iio_device *cur = iio_context_get_device(ctx, i);
+
+		if (iio_device_is_trigger(cur)) {
+			const char *name = iio_device_get_name(cur);
+
+			if (!name)
+				continue;
+
+			if (!strncmp(name, buf, name_len)) {
+				*trigger = cur;
+				return 0;
+			}
+		}
+	}
+
+	return ret;
+
+out_unlock:
+	iio_mutex_unlock(client->lock);
+	return ret;
+}
+
+int iiod_client_set_trigger(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const struct iio_device *trigger)
+{
+	char buf[1024];
+
+	if (trigger) {
+		iio_snprintf(buf, sizeof(buf), "SETTRIG %s %s\r\n",
+				iio_device_get_id(dev),
+				iio_device_get_id(trigger));
+	} else {
+		iio_snprintf(buf, sizeof(buf), "SETTRIG %s\r\n",
+				iio_device_get_id(dev));
+	}
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+int iiod_client_set_kernel_buffers_count(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, unsigned int nb_blocks)
+{
+	char buf[1024];
+
+	iio_snprintf(buf, sizeof(buf), "SET %s BUFFERS_COUNT %u\r\n",
+			iio_device_get_id(dev), nb_blocks);
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+int iiod_client_set_cyclic_buffers_count(struct iiod_client *client,
+		void *desc, const struct iio_device *dev, unsigned int nb_blocks)
+{
+	char buf[1024];
+
+	iio_snprintf(buf, sizeof(buf), "SET %s CYCLIC_BUFFERS_COUNT %u\r\n",
+			iio_device_get_id(dev), nb_blocks);
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+int iiod_client_set_decimation(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, unsigned int factor, bool average)
+{
+	char buf[1024];
+
+	iio_snprintf(buf, sizeof(buf), "DECIMATE %s %u%s\r\n",
+			iio_device_get_id(dev), factor,
+			average ? " AVERAGE" : "");
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+int iiod_client_enable_binary(struct iiod_client *client, void *desc)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	int ret;
+
+	if (!link)
+		return -ENOSYS;
+
+	iio_mutex_lock(client->lock);
+	ret = iiod_client_exec_command(client, desc, "BINARY\r\n");
+	if (!ret) {
+		link->binary = true;
+		link->crc = false;
+		link->in_left = 0;
+		link->in_flags = 0;
+		link->nb_dropped = 0;
+	}
+	iio_mutex_unlock(client->lock);
+
+	return ret;
+}
+
+int iiod_client_enable_crc(struct iiod_client *client, void *desc)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	int ret;
+
+	if (!link || !link->binary)
+		return -ENOSYS;
+
+	iio_mutex_lock(client->lock);
+	ret = iiod_client_exec_command(client, desc, "CRC\r\n");
+	if (!ret)
+		link->crc = true;
 	iio_mutex_unlock(client->lock);
+
 	return ret;
 }
 
-int iiod_client_set_timeout(struct iiod_client *client,
-		void *desc, unsigned int timeout)
+int iiod_client_enable_udp(struct iiod_client *client, void *desc,
+		unsigned int port)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	char buf[32];
+
+	if (!link || !link->binary || !client->ops->read_datagrams)
+		return -ENOSYS;
+
+	iio_snprintf(buf, sizeof(buf), "UDP %u\r\n", port);
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+int iiod_client_enable_shm(struct iiod_client *client, void *desc,
+		const char *name)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	char buf[128];
+
+	if (!link || !link->binary || !client->ops->read_shm)
+		return -ENOSYS;
+
+	iio_snprintf(buf, sizeof(buf), "SHM %s\r\n", name);
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+int iiod_client_set_stripes(struct iiod_client *client, void *desc,
+		unsigned int nb, size_t size)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	char buf[64];
+
+	if ((link && link->binary) || !client->ops->read_samples)
+		return -ENOSYS;
+
+	iio_snprintf(buf, sizeof(buf), "STRIPE %u %lu\r\n",
+			nb, (unsigned long) size);
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+int iiod_client_enable_compression(struct iiod_client *client, void *desc,
+		uint32_t mode)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	const char *cmd;
+
+	if (!link || !link->binary)
+		return -ENOSYS;
+
+	if (!mode)
+		cmd = "COMPRESS NONE\r\n";
+	else if (mode == IIOD_FRAME_PACKED)
+		cmd = "COMPRESS PACK\r\n";
+	else if (mode == (IIOD_FRAME_PACKED | IIOD_FRAME_DELTA))
+		cmd = "COMPRESS DELTA\r\n";
+	else
+		return -EINVAL;
+
+	return iiod_client_exec(client, desc, cmd);
+}
+
+int iiod_client_set_timeout(struct iiod_client *client,
+		void *desc, unsigned int timeout)
+{
+	char buf[1024];
+
+	iio_snprintf(buf, sizeof(buf), "TIMEOUT %u\r\n", timeout);
+
+	return iiod_client_exec(client, desc, buf);
+}
+
+static int iiod_client_discard(struct iiod_client *client, void *desc,
+		char *buf, size_t buf_len, size_t to_discard)
+{
+	do {
+		size_t read_len;
+		ssize_t ret;
+
+		if (to_discard > buf_len)
+			read_len = buf_len;
+		else
+			read_len = to_discard;
+
+		ret = iiod_client_read_all(client, desc, buf, read_len);
+		if (ret < 0)
+			return (int) ret;
+
+		to_discard -= (size_t) ret;
+	} while (to_discard);
+
+	return 0;
+}
+
+static int iiod_client_check_attr(const struct iio_device *dev,
+		const struct iio_channel *chn, const char *attr,
+		enum iio_attr_type type)
+{
+	if (!attr)
+		return 0;
+
+	if (chn)
+		return iio_channel_find_attr(chn, attr) ? 0 : -ENOENT;
+
+	switch (type) {
+		case IIO_ATTR_TYPE_DEVICE:
+			return iio_device_find_attr(dev, attr) ? 0 : -ENOENT;
+		case IIO_ATTR_TYPE_DEBUG:
+			return iio_device_find_debug_attr(dev, attr) ? 0 : -ENOENT;
+		case IIO_ATTR_TYPE_BUFFER:
+			return iio_device_find_buffer_attr(dev, attr) ? 0 : -ENOENT;
+		default:
+			return -EINVAL;
+	}
+}
+
+/* Writes the READ or WRITE command line addressing the given attribute,
+ * and returns its length; the length of the data follows a WRITE command */
+static size_t iiod_client_attr_command(char *buf, size_t buf_len,
+		const struct iio_device *dev, const struct iio_channel *chn,
+		const char *attr, enum iio_attr_type type,
+		bool is_write, size_t len)
+{
+	const char *id = iio_device_get_id(dev);
+	const char *cmd = is_write ? "WRITE" : "READ";
+	char len_str[32] = "";
+
+	if (is_write)
+		iio_snprintf(len_str, sizeof(len_str), " %lu",
+				(unsigned long) len);
+
+	if (chn) {
+		iio_snprintf(buf, buf_len, "%s %s %s %s %s%s\r\n", cmd, id,
+				iio_channel_is_output(chn) ? "OUTPUT" : "INPUT",
+				iio_channel_get_id(chn), attr ? attr : "",
+				len_str);
+	} else {
+		switch (type) {
+			case IIO_ATTR_TYPE_DEVICE:
+				iio_snprintf(buf, buf_len, "%s %s %s%s\r\n",
+						cmd, id, attr ? attr : "", len_str);
+				break;
+			case IIO_ATTR_TYPE_DEBUG:
+				iio_snprintf(buf, buf_len, "%s %s DEBUG %s%s\r\n",
+						cmd, id, attr ? attr : "", len_str);
+				break;
+			case IIO_ATTR_TYPE_BUFFER:
+				iio_snprintf(buf, buf_len, "%s %s BUFFER %s%s\r\n",
+						cmd, id, attr ? attr : "", len_str);
+				break;
+		}
+	}
+
+	return strlen(buf);
+}
+
+/* Reads the response to a READ command, and stores the result of the read
+ * in *result. A negative error code is returned if the response could not
+ * be received, as the following responses cannot be parsed anymore. */
+static ssize_t iiod_client_read_attr_reply(struct iiod_client *client,
+		void *desc, char *dest, size_t len, ssize_t *result)
+{
+	ssize_t ret;
+	int resp;
+
+	ret = iiod_client_read_integer(client, desc, &resp);
+	if (ret < 0)
+		return ret;
+
+	if (resp < 0) {
+		*result = (ssize_t) resp;
+		return 0;
+	}
+
+	if ((size_t) resp + 1 > len) {
+		ret = iiod_client_discard(client, desc, dest, len, resp + 1);
+		*result = -EIO;
+		return ret;
+	}
+
+	/* +1: Also read the trailing \n */
+	ret = iiod_client_read_all(client, desc, dest, resp + 1);
+	if (ret < 0)
+		return ret;
+
+	/* Discard the trailing \n */
+	ret--;
+
+	/* Replace it with a \0 just in case */
+	dest[ret] = '\0';
+
+	*result = ret;
+	return 0;
+}
+
+static ssize_t iiod_client_write_attr_request(struct iiod_client *client,
+		void *desc, const char *cmd, const void *src, size_t len)
+{
+	ssize_t ret;
+
+	ret = iiod_client_write_command(client, desc, cmd);
+	if (ret < 0)
+		return ret;
+
+	return iiod_client_write_all(client, desc, src, len);
+}
+
+/* Checks the response to a READ command received on the multiplexed
+ * connection, once the payload has been stored in 'dest' */
+static ssize_t iiod_client_mux_attr_result(struct iiod_client_req *req,
+		int code, char *dest, size_t len)
+{
+	if (code < 0)
+		return code;
+
+	/* The value and the trailing \n must have been stored */
+	if ((size_t) code + 1 > len || req->nb != (size_t) code + 1)
+		return -EIO;
+
+	dest[code] = '\0';
+	return code;
+}
+
+static ssize_t iiod_client_mux_attr_reply(struct iiod_client *client,
+		void *desc, const char *cmd, const void *src, size_t src_len,
+		char *dest, size_t len)
 {
+	struct iiod_client_req req;
 	int ret;
+
+	req.dst = dest;
+	req.len = len;
+
+	ret = iiod_client_mux_submit(client, desc, &req, cmd, src, src_len);
+	if (ret < 0)
+		return ret;
+
+	ret = iiod_client_mux_wait(client, desc, &req);
+	if (req.err)
+		return ret;
+
+	return iiod_client_mux_attr_result(&req, ret, dest, len);
+}
+
+ssize_t iiod_client_read_attr(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const struct iio_channel *chn,
+		const char *attr, char *dest, size_t len, enum iio_attr_type type)
+{
 	char buf[1024];
+	uint64_t gen;
+	ssize_t ret;
 
-	iio_snprintf(buf, sizeof(buf), "TIMEOUT %u\r\n", timeout);
+	ret = iiod_client_check_attr(dev, chn, attr, type);
+	if (ret < 0)
+		return ret;
+
+	if (iiod_client_attr_cache_get(client, dev, chn, attr, type,
+				dest, len, &ret, &gen))
+		return ret;
+
+	iiod_client_attr_command(buf, sizeof(buf), dev, chn,
+			attr, type, false, 0);
+
+	if (iiod_client_is_muxed(client, desc)) {
+		ret = iiod_client_mux_attr_reply(client, desc, buf,
+				NULL, 0, dest, len);
+		goto out_cache;
+	}
 
 	iio_mutex_lock(client->lock);
-	ret = iiod_client_exec_command(client, desc, buf);
+
+	ret = iiod_client_write_command(client, desc, buf);
+	if (ret >= 0) {
+		ssize_t result;
+
+		ret = iiod_client_read_attr_reply(client, desc,
+				dest, len, &result);
+		if (!ret)
+			ret = result;
+	}
+
 	iio_mutex_unlock(client->lock);
+
+out_cache:
+	if (ret >= 0)
+		iiod_client_attr_cache_put(client, dev, chn, attr, type,
+				dest, (size_t) ret, gen);
 	return ret;
 }
 
-static int iiod_client_discard(struct iiod_client *client, void *desc,
-		char *buf, size_t buf_len, size_t to_discard)
+ssize_t iiod_client_write_attr(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const struct iio_channel *chn,
+		const char *attr, const char *src, size_t len, enum iio_attr_type type)
 {
-	do {
-		size_t read_len;
-		ssize_t ret;
+	char buf[1024];
+	ssize_t ret;
+	int resp;
 
-		if (to_discard > buf_len)
-			read_len = buf_len;
-		else
-			read_len = to_discard;
+	ret = iiod_client_check_attr(dev, chn, attr, type);
+	if (ret < 0)
+		return ret;
 
-		ret = iiod_client_read_all(client, desc, buf, read_len);
-		if (ret < 0)
-			return (int) ret;
+	iiod_client_attr_command(buf, sizeof(buf), dev, chn,
+			attr, type, true, len);
 
-		to_discard -= (size_t) ret;
-	} while (to_discard);
+	if (iiod_client_is_muxed(client, desc)) {
+		ret = iiod_client_mux_exec(client, desc, buf, src, len,
+				NULL, 0, NULL);
+		goto out_invalidate;
+	}
 
-	return 0;
+	iio_mutex_lock(client->lock);
+
+	ret = iiod_client_write_attr_request(client, desc, buf, src, len);
+	if (ret < 0)
+		goto out_unlock;
+
+	ret = iiod_client_read_integer(client, desc, &resp);
+	if (ret < 0)
+		goto out_unlock;
+
+	ret = (ssize_t) resp;
+
+out_unlock:
+	iio_mutex_unlock(client->lock);
+out_invalidate:
+	/* Done even if the write failed, as it may have been applied. The
+	 * whole cache is dropped, as a write to one device often changes the
+	 * attributes of another one. */
+	iiod_client_attr_cache_invalidate(client, NULL);
+	return ret;
 }
 
-ssize_t iiod_client_read_attr(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, const struct iio_channel *chn,
-		const char *attr, char *dest, size_t len, enum iio_attr_type type)
+/*
+ * Batches are pipelined: commands are sent while the responses to the
+ * previous ones, which iiod sends in order, are still coming. Up to
+ * IIOD_CLIENT_PIPELINE_DEPTH commands are in flight, totalling at most
+ * IIOD_CLIENT_PIPELINE_BYTES (with the values written), unless a single one
+ * is larger; such a command is only sent once all the responses were read.
+ *
+ * iiod stops reading the commands while its responses are not read, so
+ * when the backend can tell, the responses already available are read
+ * before sending the next command, and a command is only sent once the
+ * connection can be written to. Otherwise, the limits above keep the data
+ * in flight small.
+ */
+#define IIOD_CLIENT_PIPELINE_DEPTH 64
+#define IIOD_CLIENT_PIPELINE_BYTES 2048
+
+/* Whether a response should be read before sending the next command of a
+ * batch: some of it was received already, or the connection cannot be
+ * written to */
+static bool iiod_client_batch_should_read(struct iiod_client *client,
+		void *desc)
 {
-	const char *id = iio_device_get_id(dev);
+	struct iiod_client_link *link;
+	int ret;
+
+	/* On multiplexed connections, the responses are read by the thread
+	 * waiting for them */
+	if (!iiod_client_is_muxed(client, desc)) {
+		link = iiod_client_get_link(client, desc);
+		if (link && link->rx_pos < link->rx_len)
+			return true;
+	}
+
+	if (!client->ops->wait)
+		return false;
+
+	/* Errors are reported by the read that follows */
+	ret = client->ops->wait(client->pdata, desc);
+	return ret < 0 || (ret & IIOD_CLIENT_READABLE);
+}
+
+/* On a multiplexed connection, each window of requests is submitted, then
+ * the responses are waited for; other threads can interleave their own
+ * requests meanwhile */
+static int iiod_client_mux_read_attrs(struct iiod_client *client, void *desc,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs)
+{
+	struct iiod_client_req mreqs[IIOD_CLIENT_PIPELINE_DEPTH];
+	unsigned int i, base, nb;
+	int ret = 0, nb_errors = 0;
+	size_t bytes;
 	char buf[1024];
-	ssize_t ret;
 
-	if (attr) {
-		if (chn) {
-			if (!iio_channel_find_attr(chn, attr))
-				return -ENOENT;
-		} else {
-			switch (type) {
-				case IIO_ATTR_TYPE_DEVICE:
-					if (!iio_device_find_attr(dev, attr))
-						return -ENOENT;
-					break;
-				case IIO_ATTR_TYPE_DEBUG:
-					if (!iio_device_find_debug_attr(dev, attr))
-						return -ENOENT;
-					break;
-				case IIO_ATTR_TYPE_BUFFER:
-					if (!iio_device_find_buffer_attr(dev, attr))
-						return -ENOENT;
-					break;
-				default:
-					return -EINVAL;
+	for (base = 0; base < nb_reqs; base += nb) {
+		nb = nb_reqs - base;
+		if (nb > IIOD_CLIENT_PIPELINE_DEPTH)
+			nb = IIOD_CLIENT_PIPELINE_DEPTH;
+
+		for (i = 0, bytes = 0; i < nb; i++) {
+			struct iio_attr_read_req *req = &reqs[base + i];
+
+			if (req->ret < 0)
+				continue;
+
+			if (ret < 0) {
+				req->ret = ret;
+				continue;
+			}
+
+			bytes += iiod_client_attr_command(buf, sizeof(buf),
+					req->dev, req->chn, req->attr,
+					req->type, false, 0);
+			if (i && (bytes > IIOD_CLIENT_PIPELINE_BYTES ||
+					iiod_client_batch_should_read(client,
+						desc))) {
+				nb = i;
+				break;
 			}
+
+			mreqs[i].dst = req->dst;
+			mreqs[i].len = req->len;
+
+			ret = iiod_client_mux_submit(client, desc, &mreqs[i],
+					buf, NULL, 0);
+			if (ret < 0)
+				req->ret = ret;
+			else
+				req->ret = 1;
+		}
+
+		for (i = 0; i < nb; i++) {
+			struct iio_attr_read_req *req = &reqs[base + i];
+			int code;
+
+			if (req->ret > 0) {
+				code = iiod_client_mux_wait(client, desc,
+						&mreqs[i]);
+				if (mreqs[i].err)
+					req->ret = code;
+				else
+					req->ret = iiod_client_mux_attr_result(
+							&mreqs[i], code,
+							req->dst, req->len);
+			}
+
+			if (req->ret < 0)
+				nb_errors++;
 		}
 	}
 
-	if (chn) {
-		iio_snprintf(buf, sizeof(buf), "READ %s %s %s %s\r\n", id,
-				iio_channel_is_output(chn) ? "OUTPUT" : "INPUT",
-				iio_channel_get_id(chn), attr ? attr : "");
-	} else {
-		switch (type) {
-			case IIO_ATTR_TYPE_DEVICE:
-				iio_snprintf(buf, sizeof(buf), "READ %s %s\r\n",
-						id, attr ? attr : "");
-				break;
-			case IIO_ATTR_TYPE_DEBUG:
-				iio_snprintf(buf, sizeof(buf), "READ %s DEBUG %s\r\n",
-						id, attr ? attr : "");
-				break;
-			case IIO_ATTR_TYPE_BUFFER:
-				iio_snprintf(buf, sizeof(buf), "READ %s BUFFER %s\r\n",
-						id, attr ? attr : "");
+	return ret < 0 ? ret : nb_errors;
+}
+
+static int iiod_client_mux_write_attrs(struct iiod_client *client, void *desc,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs)
+{
+	struct iiod_client_req mreqs[IIOD_CLIENT_PIPELINE_DEPTH];
+	unsigned int i, base, nb;
+	int ret = 0, nb_errors = 0;
+	size_t bytes;
+	char buf[1024];
+
+	for (base = 0; base < nb_reqs; base += nb) {
+		nb = nb_reqs - base;
+		if (nb > IIOD_CLIENT_PIPELINE_DEPTH)
+			nb = IIOD_CLIENT_PIPELINE_DEPTH;
+
+		for (i = 0, bytes = 0; i < nb; i++) {
+			struct iio_attr_write_req *req = &reqs[base + i];
+
+			if (req->ret < 0)
+				continue;
+
+			if (ret < 0) {
+				req->ret = ret;
+				continue;
+			}
+
+			bytes += iiod_client_attr_command(buf, sizeof(buf),
+					req->dev, req->chn, req->attr,
+					req->type, true, req->len) + req->len;
+			if (i && (bytes > IIOD_CLIENT_PIPELINE_BYTES ||
+					iiod_client_batch_should_read(client,
+						desc))) {
+				nb = i;
 				break;
+			}
+
+			mreqs[i].dst = NULL;
+			mreqs[i].len = 0;
+
+			ret = iiod_client_mux_submit(client, desc, &mreqs[i],
+					buf, req->src, req->len);
+			req->ret = ret < 0 ? ret : 1;
+		}
+
+		for (i = 0; i < nb; i++) {
+			struct iio_attr_write_req *req = &reqs[base + i];
+
+			if (req->ret > 0)
+				req->ret = iiod_client_mux_wait(client, desc,
+						&mreqs[i]);
+			if (req->ret < 0)
+				nb_errors++;
+		}
+	}
+
+	return ret < 0 ? ret : nb_errors;
+}
+
+/* Whether one more command of the given size fits in the pipeline, given
+ * the number of commands sent and answered, and the bytes in flight */
+static bool iiod_client_can_send(unsigned int sent, unsigned int received,
+		size_t bytes, size_t size)
+{
+	if (sent == received)
+		return true;
+
+	return sent - received < IIOD_CLIENT_PIPELINE_DEPTH &&
+		bytes + size <= IIOD_CLIENT_PIPELINE_BYTES;
+}
+
+int iiod_client_read_attrs(struct iiod_client *client, void *desc,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs)
+{
+	size_t sizes[IIOD_CLIENT_PIPELINE_DEPTH], size, bytes = 0;
+	unsigned int sent = 0, received = 0;
+	int nb_errors = 0;
+	char buf[1024];
+	ssize_t ret = 0;
+
+	for (sent = 0; sent < nb_reqs; sent++)
+		reqs[sent].ret = iiod_client_check_attr(reqs[sent].dev,
+				reqs[sent].chn, reqs[sent].attr,
+				reqs[sent].type);
+
+	if (iiod_client_is_muxed(client, desc))
+		return iiod_client_mux_read_attrs(client, desc, reqs, nb_reqs);
+
+	iio_mutex_lock(client->lock);
+
+	for (sent = 0; received < nb_reqs; ) {
+		struct iio_attr_read_req *req;
+
+		if (sent < nb_reqs) {
+			req = &reqs[sent];
+			if (req->ret < 0)
+				size = 0;
+			else
+				size = iiod_client_attr_command(buf,
+						sizeof(buf), req->dev,
+						req->chn, req->attr,
+						req->type, false, 0);
+
+			if (iiod_client_can_send(sent, received,
+						bytes, size) &&
+					(sent == received ||
+					 !iiod_client_batch_should_read(client,
+						 desc))) {
+				if (size) {
+					ret = iiod_client_write_command(client,
+							desc, buf);
+					if (ret < 0)
+						break;
+				}
+
+				sizes[sent++ % IIOD_CLIENT_PIPELINE_DEPTH] = size;
+				bytes += size;
+				continue;
+			}
+		}
+
+		req = &reqs[received];
+		bytes -= sizes[received++ % IIOD_CLIENT_PIPELINE_DEPTH];
+		if (req->ret < 0) {
+			nb_errors++;
+			continue;
+		}
+
+		ret = iiod_client_read_attr_reply(client, desc,
+				req->dst, req->len, &req->ret);
+		if (ret < 0) {
+			received--;
+			break;
+		}
+
+		if (req->ret < 0)
+			nb_errors++;
+	}
+
+	iio_mutex_unlock(client->lock);
+
+	if (received < nb_reqs) {
+		for (; received < nb_reqs; received++)
+			if (reqs[received].ret >= 0)
+				reqs[received].ret = ret;
+		return (int) ret;
+	}
+
+	return nb_errors;
+}
+
+static int iiod_client_write_attrs_nocache(struct iiod_client *client,
+		void *desc, struct iio_attr_write_req *reqs,
+		unsigned int nb_reqs)
+{
+	size_t sizes[IIOD_CLIENT_PIPELINE_DEPTH], size, bytes = 0;
+	unsigned int sent = 0, received = 0;
+	int nb_errors = 0, resp;
+	char buf[1024];
+	ssize_t ret = 0;
+
+	for (sent = 0; sent < nb_reqs; sent++)
+		reqs[sent].ret = iiod_client_check_attr(reqs[sent].dev,
+				reqs[sent].chn, reqs[sent].attr,
+				reqs[sent].type);
+
+	if (iiod_client_is_muxed(client, desc))
+		return iiod_client_mux_write_attrs(client, desc, reqs, nb_reqs);
+
+	iio_mutex_lock(client->lock);
+
+	for (sent = 0; received < nb_reqs; ) {
+		struct iio_attr_write_req *req;
+
+		if (sent < nb_reqs) {
+			req = &reqs[sent];
+			if (req->ret < 0)
+				size = 0;
+			else
+				size = iiod_client_attr_command(buf,
+						sizeof(buf), req->dev,
+						req->chn, req->attr,
+						req->type, true,
+						req->len) + req->len;
+
+			if (iiod_client_can_send(sent, received,
+						bytes, size) &&
+					(sent == received ||
+					 !iiod_client_batch_should_read(client,
+						 desc))) {
+				if (size) {
+					ret = iiod_client_write_attr_request(
+							client, desc, buf,
+							req->src, req->len);
+					if (ret < 0)
+						break;
+				}
+
+				sizes[sent++ % IIOD_CLIENT_PIPELINE_DEPTH] = size;
+				bytes += size;
+				continue;
+			}
+		}
+
+		req = &reqs[received];
+		bytes -= sizes[received++ % IIOD_CLIENT_PIPELINE_DEPTH];
+		if (req->ret < 0) {
+			nb_errors++;
+			continue;
+		}
+
+		ret = iiod_client_read_integer(client, desc, &resp);
+		if (ret < 0) {
+			received--;
+			break;
+		}
+
+		req->ret = (ssize_t) resp;
+		if (resp < 0)
+			nb_errors++;
+	}
+
+	iio_mutex_unlock(client->lock);
+
+	if (received < nb_reqs) {
+		for (; received < nb_reqs; received++)
+			if (reqs[received].ret >= 0)
+				reqs[received].ret = ret;
+		return (int) ret;
+	}
+
+	return nb_errors;
+}
+
+int iiod_client_write_attrs(struct iiod_client *client, void *desc,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs)
+{
+	int ret;
+
+	ret = iiod_client_write_attrs_nocache(client, desc, reqs, nb_reqs);
+
+	iiod_client_attr_cache_invalidate(client, NULL);
+
+	return ret;
+}
+
+/*
+ * The addresses, and the values to write, are sent as text in the payload of
+ * the REGREAD and REGWRITE commands. The response has the format of the
+ * response to READ, its payload being the result of the accesses followed by
+ * the values read. A negative code means that the command was rejected
+ * before any access, e.g. by an older server.
+ */
+static ssize_t iiod_client_regs_exec(struct iiod_client *client, void *desc,
+		const char *cmd, const char *src, size_t len,
+		char *dst, size_t dst_len)
+{
+	ssize_t ret, result;
+
+	if (iiod_client_is_muxed(client, desc))
+		return iiod_client_mux_attr_reply(client, desc, cmd,
+				src, len, dst, dst_len);
+
+	iio_mutex_lock(client->lock);
+
+	ret = iiod_client_write_attr_request(client, desc, cmd, src, len);
+	if (ret >= 0) {
+		ret = iiod_client_read_attr_reply(client, desc,
+				dst, dst_len, &result);
+		if (!ret)
+			ret = result;
+	}
+
+	iio_mutex_unlock(client->lock);
+	return ret;
+}
+
+static int iiod_client_access_regs(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const uint32_t *addrs,
+		uint32_t *dst, const uint32_t *src, unsigned int nb)
+{
+	/* "0x%x " is at most 11 characters */
+	size_t len = (size_t) nb * (src ? 22 : 11) + 1;
+	size_t dst_len = (size_t) nb * 11 + 16;
+	char cmd[1024], *buf, *reply, *ptr, *end;
+	unsigned int i;
+	ssize_t ret;
+	long code;
+
+	buf = malloc(len);
+	if (!buf)
+		return -ENOMEM;
+
+	reply = malloc(dst_len);
+	if (!reply) {
+		ret = -ENOMEM;
+		goto out_free_buf;
+	}
+
+	for (ptr = buf, i = 0; i < nb; i++) {
+		if (src)
+			ptr += iio_snprintf(ptr, len - (ptr - buf),
+					"0x%" PRIx32 " 0x%" PRIx32 " ",
+					addrs[i], src[i]);
+		else
+			ptr += iio_snprintf(ptr, len - (ptr - buf),
+					"0x%" PRIx32 " ", addrs[i]);
+	}
+
+	iio_snprintf(cmd, sizeof(cmd), "%s %s %lu\r\n",
+			src ? "REGWRITE" : "REGREAD", iio_device_get_id(dev),
+			(unsigned long) (ptr - buf));
+
+	ret = iiod_client_regs_exec(client, desc, cmd, buf,
+			(size_t) (ptr - buf), reply, dst_len);
+	if (ret < 0) {
+		/* Older servers do not know the command */
+		if (ret == -EINVAL)
+			ret = -ENOSYS;
+		goto out_free_reply;
+	}
+
+	errno = 0;
+	code = strtol(reply, &end, 10);
+	if (end == reply || errno) {
+		ret = -EIO;
+		goto out_free_reply;
+	}
+
+	ret = code;
+	if (ret < 0 || src)
+		goto out_free_reply;
+
+	for (i = 0; i < nb; i++) {
+		ptr = end;
+		dst[i] = (uint32_t) strtoul(ptr, &end, 0);
+		if (end == ptr) {
+			ret = -EIO;
+			break;
 		}
 	}
 
-	iio_mutex_lock(client->lock);
+out_free_reply:
+	free(reply);
+out_free_buf:
+	free(buf);
+	return (int) ret;
+}
 
-	ret = (ssize_t) iiod_client_exec_command(client, desc, buf);
-	if (ret < 0)
-		goto out_unlock;
+int iiod_client_read_regs(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const uint32_t *addrs,
+		uint32_t *values, unsigned int nb)
+{
+	return iiod_client_access_regs(client, desc, dev,
+			addrs, values, NULL, nb);
+}
 
-	if ((size_t) ret + 1 > len) {
-		iiod_client_discard(client, desc, dest, len, ret + 1);
-		ret = -EIO;
-		goto out_unlock;
-	}
+int iiod_client_write_regs(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const uint32_t *addrs,
+		const uint32_t *values, unsigned int nb)
+{
+	int ret;
+
+	ret = iiod_client_access_regs(client, desc, dev,
+			addrs, NULL, values, nb);
+
+	iiod_client_attr_cache_invalidate(client, NULL);
+	return ret;
+}
+
+/* Returns the path of the copy of the XML of the context kept in the cache
+ * directory, or NULL if there is no cache or the server does not support the
+ * DIGEST command. The digest is made of the CRC-32 and length of the XML. */
+static char * iiod_client_cache_path(struct iiod_client *client, void *desc,
+		uint32_t *crc, size_t *xml_len)
+{
+	char digest[32], *dir, *path;
+	unsigned long len;
+	size_t path_len;
+	int ret;
+
+	dir = getenv("LIBIIO_CACHE_DIR"); /* Flawfinder: ignore */
+	if (!dir || !dir[0])
+		return NULL;
+
+	ret = iiod_client_exec_command(client, desc, "DIGEST\r\n");
+	if (ret <= 0 || ret >= (int) sizeof(digest))
+		return NULL;
 
 	/* +1: Also read the trailing \n */
-	ret = iiod_client_read_all(client, desc, dest, ret + 1);
+	if (iiod_client_read_all(client, desc, digest, ret + 1) < 0)
+		return NULL;
 
-	if (ret > 0) {
-		/* Discard the trailing \n */
-		ret--;
+	digest[ret] = '\0';
 
-		/* Replace it with a \0 just in case */
-		dest[ret] = '\0';
-	}
+	/* The digest ends up in the path: only accept the expected format */
+	if (strspn(digest, "0123456789abcdef-") != (size_t) ret ||
+			iio_sscanf(digest, "%08" SCNx32 "-%lx", crc, &len) != 2)
+		return NULL;
 
-out_unlock:
-	iio_mutex_unlock(client->lock);
-	return ret;
+	path_len = strlen(dir) + sizeof("/.xml") + ret;
+	path = malloc(path_len);
+	if (!path)
+		return NULL;
+
+	iio_snprintf(path, path_len, "%s/%s.xml", dir, digest);
+	*xml_len = (size_t) len;
+
+	return path;
 }
 
-ssize_t iiod_client_write_attr(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, const struct iio_channel *chn,
-		const char *attr, const char *src, size_t len, enum iio_attr_type type)
+static struct iio_context * iiod_client_load_cache(const char *path,
+		uint32_t crc, size_t xml_len)
 {
-	struct iio_context_pdata *pdata = client->pdata;
-	const struct iiod_client_ops *ops = client->ops;
-	const char *id = iio_device_get_id(dev);
-	char buf[1024];
-	ssize_t ret;
-	int resp;
+	struct iio_context *ctx = NULL;
+	char *xml;
+	FILE *f;
 
-	if (attr) {
-		if (chn) {
-			if (!iio_channel_find_attr(chn, attr))
-				return -ENOENT;
-		} else {
-			switch (type) {
-				case IIO_ATTR_TYPE_DEVICE:
-					if (!iio_device_find_attr(dev, attr))
-						return -ENOENT;
-					break;
-				case IIO_ATTR_TYPE_DEBUG:
-					if (!iio_device_find_debug_attr(dev, attr))
-						return -ENOENT;
-					break;
-				case IIO_ATTR_TYPE_BUFFER:
-					if (!iio_device_find_buffer_attr(dev, attr))
-						return -ENOENT;
-					break;
-				default:
-					return -EINVAL;
-			}
-		}
-	}
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
 
-	if (chn) {
-		iio_snprintf(buf, sizeof(buf), "WRITE %s %s %s %s %lu\r\n", id,
-				iio_channel_is_output(chn) ? "OUTPUT" : "INPUT",
-				iio_channel_get_id(chn), attr ? attr : "",
-				(unsigned long) len);
-	} else {
-		switch (type) {
-			case IIO_ATTR_TYPE_DEVICE:
-				iio_snprintf(buf, sizeof(buf), "WRITE %s %s %lu\r\n",
-						id, attr ? attr : "", (unsigned long) len);
-				break;
-			case IIO_ATTR_TYPE_DEBUG:
-				iio_snprintf(buf, sizeof(buf), "WRITE %s DEBUG %s %lu\r\n",
-						id, attr ? attr : "", (unsigned long) len);
-				break;
-			case IIO_ATTR_TYPE_BUFFER:
-				iio_snprintf(buf, sizeof(buf), "WRITE %s BUFFER %s %lu\r\n",
-						id, attr ? attr : "", (unsigned long) len);
-				break;
-		}
-	}
+	xml = malloc(xml_len);
+	if (!xml)
+		goto out_close;
 
-	iio_mutex_lock(client->lock);
-	ret = ops->write(pdata, desc, buf, strlen(buf));
-	if (ret < 0)
-		goto out_unlock;
+	/* A truncated or corrupted copy is just ignored */
+	if (fread(xml, 1, xml_len, f) == xml_len && fgetc(f) == EOF &&
+			iiod_crc32(0, xml, xml_len) == crc)
+		ctx = iio_create_xml_context_mem(xml, xml_len);
 
-	ret = iiod_client_write_all(client, desc, src, len);
-	if (ret < 0)
-		goto out_unlock;
+	free(xml);
+out_close:
+	fclose(f);
+	return ctx;
+}
 
-	ret = iiod_client_read_integer(client, desc, &resp);
-	if (ret < 0)
-		goto out_unlock;
+/* Written to a temporary file first, so that the other clients never read
+ * a partial copy */
+static void iiod_client_store_cache(const char *path,
+		const char *xml, size_t xml_len)
+{
+	size_t tmp_len = strlen(path) + sizeof(".tmp");
+	char *tmp;
+	FILE *f;
+	bool ok;
 
-	ret = (ssize_t) resp;
+	tmp = malloc(tmp_len);
+	if (!tmp)
+		return;
 
-out_unlock:
-	iio_mutex_unlock(client->lock);
-	return ret;
+	iio_snprintf(tmp, tmp_len, "%s.tmp", path);
+
+	f = fopen(tmp, "wb");
+	if (!f) {
+		IIO_DEBUG("Unable to create %s\n", tmp);
+		goto out_free_tmp;
+	}
+
+	ok = fwrite(xml, 1, xml_len, f) == xml_len;
+	ok = !fclose(f) && ok;
+
+	if (!ok || rename(tmp, path))
+		remove(tmp);
+
+out_free_tmp:
+	free(tmp);
 }
 
 struct iio_context * iiod_client_create_context(
 		struct iiod_client *client, void *desc)
 {
 	struct iio_context *ctx = NULL;
-	size_t xml_len;
-	char *xml;
+	size_t xml_len, cached_len = 0;
+	uint32_t crc = 0;
+	char *xml, *path;
 	int ret;
 
 	iio_mutex_lock(client->lock);
+
+	/* With a copy of the XML of the same context, the download is
+	 * skipped */
+	path = iiod_client_cache_path(client, desc, &crc, &cached_len);
+	if (path) {
+		ctx = iiod_client_load_cache(path, crc, cached_len);
+		if (ctx) {
+			IIO_DEBUG("Context loaded from %s\n", path);
+			goto out_free_path;
+		}
+	}
+
 	ret = iiod_client_exec_command(client, desc, "PRINT\r\n");
 	if (ret < 0)
-		goto out_unlock;
+		goto out_free_path;
 
 	xml_len = (size_t) ret;
 	xml = malloc(xml_len + 1);
 	if (!xml) {
 		ret = -ENOMEM;
-		goto out_unlock;
+		goto out_free_path;
 	}
 
 	/* +1: Also read the trailing \n */
@@ -522,25 +2210,31 @@ struct iio_context * iiod_client_create_context(
 	ctx = iio_create_xml_context_mem(xml, xml_len);
 	if (!ctx)
 		ret = -errno;
+	else if (path && xml_len == cached_len &&
+			iiod_crc32(0, xml, xml_len) == crc)
+		iiod_client_store_cache(path, xml, xml_len);
 
 out_free_xml:
 	free(xml);
-out_unlock:
+out_free_path:
+	free(path);
 	iio_mutex_unlock(client->lock);
 	if (!ctx)
 		errno = -ret;
 	return ctx;
 }
 
-int iiod_client_open_unlocked(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, size_t samples_count, bool cyclic)
+/* Sends OPEN or REOPEN with the device's mask of channels */
+static int iiod_client_send_open(struct iiod_client *client, void *desc,
+		const char *cmd, const struct iio_device *dev,
+		size_t samples_count, bool cyclic)
 {
 	char buf[1024], *ptr;
 	size_t i;
 	ssize_t len;
 
 	len = sizeof(buf);
-	len -= iio_snprintf(buf, len, "OPEN %s %lu ",
+	len -= iio_snprintf(buf, len, "%s %s %lu ", cmd,
 			iio_device_get_id(dev), (unsigned long) samples_count);
 	ptr = buf + strlen(buf);
 
@@ -552,13 +2246,30 @@ int iiod_client_open_unlocked(struct iiod_client *client, void *desc,
 	len -= iio_strlcpy(ptr, cyclic ? " CYCLIC\r\n" : "\r\n", len);
 
 	if (len < 0) {
-		IIO_ERROR("strlength problem in iiod_client_open_unlocked\n");
+		IIO_ERROR("strlength problem in iiod_client_send_open\n");
 		return -ENOMEM;
 	}
 
 	return iiod_client_exec_command(client, desc, buf);
 }
 
+int iiod_client_open_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, size_t samples_count, bool cyclic)
+{
+	return iiod_client_send_open(client, desc, "OPEN", dev,
+			samples_count, cyclic);
+}
+
+int iiod_client_reopen_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, size_t samples_count)
+{
+	int ret = iiod_client_send_open(client, desc, "REOPEN", dev,
+			samples_count, false);
+
+	/* Older servers do not know the command */
+	return ret == -EINVAL ? -ENOSYS : ret;
+}
+
 int iiod_client_close_unlocked(struct iiod_client *client, void *desc,
 		const struct iio_device *dev)
 {
@@ -568,6 +2279,168 @@ int iiod_client_close_unlocked(struct iiod_client *client, void *desc,
 	return iiod_client_exec_command(client, desc, buf);
 }
 
+int iiod_client_open_events_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev)
+{
+	char buf[1024];
+	int ret;
+
+	iio_snprintf(buf, sizeof(buf), "OPENEVT %s\r\n", iio_device_get_id(dev));
+	ret = iiod_client_exec_command(client, desc, buf);
+
+	/* Older servers do not know the command */
+	return ret == -EINVAL ? -ENOSYS : ret;
+}
+
+/* The response of READEVT has the format of the response to READ; its payload
+ * is the identifier and timestamp of each event, as text */
+ssize_t iiod_client_read_events_unlocked(struct iiod_client *client,
+		void *desc, struct iio_event *events, size_t nb)
+{
+	/* "0x%016llx %lld " is at most 40 characters */
+	size_t i, len = nb * 40 + 1;
+	char buf[64], *reply, *ptr, *end;
+	ssize_t ret, result;
+
+	reply = malloc(len);
+	if (!reply)
+		return -ENOMEM;
+
+	iio_snprintf(buf, sizeof(buf), "READEVT %lu\r\n", (unsigned long) nb);
+
+	ret = iiod_client_write_command(client, desc, buf);
+	if (ret < 0)
+		goto out_free_reply;
+
+	ret = iiod_client_read_attr_reply(client, desc, reply, len, &result);
+	if (ret < 0)
+		goto out_free_reply;
+
+	ret = result;
+	if (ret < 0)
+		goto out_free_reply;
+
+	for (ptr = reply, i = 0; i < nb; i++) {
+		events[i].id = (uint64_t) strtoull(ptr, &end, 0);
+		if (end == ptr)
+			break;
+
+		ptr = end;
+		events[i].timestamp = (int64_t) strtoll(ptr, &end, 10);
+		if (end == ptr)
+			break;
+
+		ptr = end;
+	}
+
+	ret = i ? (ssize_t) i : -EIO;
+
+out_free_reply:
+	free(reply);
+	return ret;
+}
+
+int iiod_client_close_events_unlocked(struct iiod_client *client, void *desc)
+{
+	return iiod_client_exec_command(client, desc, "CLOSEEVT\r\n");
+}
+
+/* Reads a chunk of samples sent as datagrams; the payload of the response
+ * frame only holds the sequence numbers of the datagrams */
+static ssize_t iiod_client_read_datagrams(struct iiod_client *client,
+		void *desc, char *dst, size_t len)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	struct iiod_udp_info info;
+	char buf[64];
+	ssize_t ret;
+
+	if (!client->ops->read_datagrams || link->in_left < sizeof(info))
+		return -EIO;
+
+	/* Skip the mask in case the caller did not want it */
+	while (link->in_left > sizeof(info)) {
+		size_t skip = link->in_left - sizeof(info);
+
+		ret = iiod_client_read_all(client, desc, buf,
+				skip > sizeof(buf) ? sizeof(buf) : skip);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = iiod_client_read_all(client, desc, &info, sizeof(info));
+	if (ret < 0)
+		return ret;
+
+	return client->ops->read_datagrams(client->pdata, desc, dst, len,
+			iio_be32toh(info.first_seq), iio_be32toh(info.nb));
+}
+
+/* Reads a chunk of samples written to the shared memory; the payload of the
+ * response frame only holds its sequence number */
+static ssize_t iiod_client_read_shm(struct iiod_client *client,
+		void *desc, char *dst, size_t len)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	struct iiod_shm_info info;
+	char buf[64];
+	ssize_t ret;
+
+	if (!client->ops->read_shm || link->in_left < sizeof(info))
+		return -EIO;
+
+	/* Skip the mask in case the caller did not want it */
+	while (link->in_left > sizeof(info)) {
+		size_t skip = link->in_left - sizeof(info);
+
+		ret = iiod_client_read_all(client, desc, buf,
+				skip > sizeof(buf) ? sizeof(buf) : skip);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = iiod_client_read_all(client, desc, &info, sizeof(info));
+	if (ret < 0)
+		return ret;
+
+	return client->ops->read_shm(client->pdata, desc, dst, len,
+			iio_be32toh(info.seq));
+}
+
+/* Reads a chunk of compressed samples, which make up the rest of the payload
+ * of the response frame */
+static ssize_t iiod_client_read_compressed(struct iiod_client *client,
+		void *desc, struct iiod_client_decoder *dec,
+		const struct iio_device *dev, const uint32_t *mask,
+		char *dst, size_t len)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	size_t size = link->in_left;
+	ssize_t ret;
+
+	if (!dec->codec) {
+		dec->codec = iiod_codec_new(dev, mask);
+		if (!dec->codec)
+			return -EINVAL;
+	}
+
+	if (size > dec->buf_len) {
+		char *buf = realloc(dec->buf, size);
+		if (!buf)
+			return -ENOMEM;
+
+		dec->buf = buf;
+		dec->buf_len = size;
+	}
+
+	ret = iiod_client_read_all(client, desc, dec->buf, size);
+	if (ret < 0)
+		return ret;
+
+	return iiod_codec_decode(dec->codec, link->in_flags,
+			dst, len, dec->buf, size);
+}
+
 static int iiod_client_read_mask(struct iiod_client *client,
 		void *desc, uint32_t *mask, size_t words)
 {
@@ -575,6 +2448,17 @@ static int iiod_client_read_mask(struct iiod_client *client,
 	ssize_t ret;
 	char *buf, *ptr;
 
+	if (iiod_client_is_binary(client, desc)) {
+		ret = iiod_client_read_all(client, desc,
+				mask, words * sizeof(*mask));
+		if (ret < 0)
+			return (int) ret;
+
+		for (i = 0; i < words; i++)
+			mask[i] = iio_be32toh(mask[i]);
+		return 0;
+	}
+
 	buf = malloc(words * 8 + 1);
 	if (!buf)
 		return -ENOMEM;
@@ -603,64 +2487,132 @@ out_buf_free:
 	return (int) ret;
 }
 
-ssize_t iiod_client_read_unlocked(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, void *dst, size_t len,
-		uint32_t *mask, size_t words)
+int iiod_client_submit_read_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, size_t len)
 {
-	unsigned int nb_channels = iio_device_get_channels_count(dev);
-	uintptr_t ptr = (uintptr_t) dst;
 	char buf[1024];
-	ssize_t ret, read = 0;
+	ssize_t ret;
 
-	if (!len || words != (nb_channels + 31) / 32)
+	if (!len)
 		return -EINVAL;
 
 	iio_snprintf(buf, sizeof(buf), "READBUF %s %lu\r\n",
 			iio_device_get_id(dev), (unsigned long) len);
 
-	ret = iiod_client_write_all(client, desc, buf, strlen(buf));
+	ret = iiod_client_write_command(client, desc, buf);
 	if (ret < 0) {
 		IIO_ERROR("WRITE ALL: %zd\n", ret);
-		return ret;
+		return (int) ret;
 	}
 
+	return 0;
+}
+
+ssize_t iiod_client_complete_read_unlocked(struct iiod_client *client,
+		void *desc, const struct iio_device *dev, void *dst, size_t len,
+		uint32_t *mask, size_t words)
+{
+	struct iiod_client_link *link = iiod_client_get_link(client, desc);
+	unsigned int nb_channels = iio_device_get_channels_count(dev);
+	const uint32_t *layout = mask ? mask : dev->mask;
+	struct iiod_client_decoder dec = { 0 };
+	uintptr_t ptr = (uintptr_t) dst;
+	ssize_t ret, read = 0;
+
+	if (!len || words != (nb_channels + 31) / 32)
+		return -EINVAL;
+
 	do {
 		int to_read;
 
 		ret = iiod_client_read_integer(client, desc, &to_read);
 		if (ret < 0) {
 			IIO_ERROR("READ INTEGER: %zd\n", ret);
-			return ret;
+			goto out_free_decoder;
+		}
+		if (to_read < 0) {
+			ret = (ssize_t) to_read;
+			goto out_free_decoder;
 		}
-		if (to_read < 0)
-			return (ssize_t) to_read;
 		if (!to_read)
 			break;
 
-		if (mask) {
+		if (mask && (!link || !link->binary ||
+					(link->in_flags & IIOD_FRAME_MASK))) {
 			ret = iiod_client_read_mask(client, desc, mask, words);
 			if (ret < 0) {
 				IIO_ERROR("READ ALL: %zd\n", ret);
-				return ret;
+				goto out_free_decoder;
 			}
 
 			mask = NULL; /* We read the mask only once */
 		}
 
-		ret = iiod_client_read_all(client, desc, (char *) ptr, to_read);
+		if (link && link->binary &&
+				(link->in_flags & IIOD_FRAME_DROPPED)) {
+			uint32_t nb_dropped;
+
+			ret = iiod_client_read_all(client, desc,
+					&nb_dropped, sizeof(nb_dropped));
+			if (ret < 0)
+				goto out_free_decoder;
+
+			link->nb_dropped += iio_be32toh(nb_dropped);
+		}
+
+		if (link && link->binary && (link->in_flags & IIOD_FRAME_SHM))
+			ret = iiod_client_read_shm(client, desc,
+					(char *) ptr, to_read);
+		else if (link && link->binary &&
+				(link->in_flags & IIOD_FRAME_UDP))
+			ret = iiod_client_read_datagrams(client, desc,
+					(char *) ptr, to_read);
+		else if (link && link->binary &&
+				(link->in_flags & IIOD_FRAME_PACKED))
+			ret = iiod_client_read_compressed(client, desc, &dec,
+					dev, layout, (char *) ptr, to_read);
+		else if (client->ops->read_samples)
+			ret = client->ops->read_samples(client->pdata, desc,
+					(char *) ptr, to_read);
+		else
+			ret = iiod_client_read_all(client, desc,
+					(char *) ptr, to_read);
 		if (ret < 0)
-			return ret;
+			goto out_free_decoder;
 
 		ptr += ret;
 		read += ret;
 		len -= ret;
 	} while (len);
 
-	return read;
+	ret = read;
+out_free_decoder:
+	iiod_codec_destroy(dec.codec);
+	free(dec.buf);
+	return ret;
 }
 
-ssize_t iiod_client_write_unlocked(struct iiod_client *client, void *desc,
-		const struct iio_device *dev, const void *src, size_t len)
+ssize_t iiod_client_read_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, void *dst, size_t len,
+		uint32_t *mask, size_t words)
+{
+	unsigned int nb_channels = iio_device_get_channels_count(dev);
+	int ret;
+
+	if (!len || words != (nb_channels + 31) / 32)
+		return -EINVAL;
+
+	ret = iiod_client_submit_read_unlocked(client, desc, dev, len);
+	if (ret < 0)
+		return (ssize_t) ret;
+
+	return iiod_client_complete_read_unlocked(client, desc, dev,
+			dst, len, mask, words);
+}
+
+int iiod_client_submit_write_unlocked(struct iiod_client *client,
+		void *desc, const struct iio_device *dev,
+		const void *src, size_t len)
 {
 	ssize_t ret;
 	char buf[1024];
@@ -669,19 +2621,25 @@ ssize_t iiod_client_write_unlocked(struct iiod_client *client, void *desc,
 	iio_snprintf(buf, sizeof(buf), "WRITEBUF %s %lu\r\n",
 			dev->id, (unsigned long) len);
 
-	ret = iiod_client_write_all(client, desc, buf, strlen(buf));
+	ret = iiod_client_write_command(client, desc, buf);
 	if (ret < 0)
-		return ret;
+		return (int) ret;
 
 	ret = iiod_client_read_integer(client, desc, &val);
 	if (ret < 0)
-		return ret;
+		return (int) ret;
 	if (val < 0)
-		return (ssize_t) val;
+		return val;
 
 	ret = iiod_client_write_all(client, desc, src, len);
-	if (ret < 0)
-		return ret;
+	return ret < 0 ? (int) ret : 0;
+}
+
+ssize_t iiod_client_complete_write_unlocked(struct iiod_client *client,
+		void *desc, size_t len)
+{
+	ssize_t ret;
+	int val;
 
 	ret = iiod_client_read_integer(client, desc, &val);
 	if (ret < 0)
@@ -691,3 +2649,15 @@ ssize_t iiod_client_write_unlocked(struct iiod_client *client, void *desc,
 
 	return (ssize_t) len;
 }
+
+ssize_t iiod_client_write_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const void *src, size_t len)
+{
+	int ret;
+
+	ret = iiod_client_submit_write_unlocked(client, desc, dev, src, len);
+	if (ret < 0)
+		return (ssize_t) ret;
+
+	return iiod_client_complete_write_unlocked(client, desc, len);
+}
@@ -25,15 +25,81 @@ struct iio_mutex;
 struct iiod_client;
 struct iio_context_pdata;
 
+/* Size of the receive buffer of the connections */
+#define IIOD_CLIENT_RX_BUF_SIZE 4096
+
+/* State of one connection to iiod, kept by the backend along with the
+ * descriptor of the connection */
+struct iiod_client_link {
+	bool binary;
+
+	/* Tag of the last request sent */
+	uint32_t tag;
+
+	/* Bytes of the payload of the current response not read yet, and
+	 * flags of the response */
+	size_t in_left;
+	uint32_t in_flags;
+
+	/* Set once the CRC of the frames was negotiated; and CRC of what was
+	 * read of the current response */
+	bool crc;
+	uint32_t in_crc;
+
+	/* Number of blocks of samples iiod reported as dropped before it
+	 * could send them; see IIOD_FRAME_DROPPED */
+	uint64_t nb_dropped;
+
+	/* Data received but not consumed yet: the connection is read in
+	 * large chunks, instead of one byte at a time to find the end of the
+	 * lines of the responses. A backend reading the connection by itself
+	 * must only do so once the previous responses were read entirely. */
+	char rx_buf[IIOD_CLIENT_RX_BUF_SIZE];
+	size_t rx_pos, rx_len;
+};
+
 struct iiod_client_ops {
 	ssize_t (*write)(struct iio_context_pdata *pdata,
 			void *desc, const char *src, size_t len);
 	ssize_t (*read)(struct iio_context_pdata *pdata,
 			void *desc, char *dst, size_t len);
+
+	/* Optional with get_link, whose receive buffer the lines are then
+	 * read from */
 	ssize_t (*read_line)(struct iio_context_pdata *pdata,
 			void *desc, char *dst, size_t len);
+
+	/* Optional; required to use the binary protocol */
+	struct iiod_client_link * (*get_link)(struct iio_context_pdata *pdata,
+			void *desc);
+
+	/* Optional; required to use the UDP data plane. Receives the
+	 * datagrams of one chunk of samples into dst, and returns len. */
+	ssize_t (*read_datagrams)(struct iio_context_pdata *pdata, void *desc,
+			char *dst, size_t len, uint32_t first_seq, uint32_t nb);
+
+	/* Optional; required to use the shared memory data plane. Copies the
+	 * chunk of the given sequence number out of the shared memory into
+	 * dst, releases its slot, and returns len. */
+	ssize_t (*read_shm)(struct iio_context_pdata *pdata, void *desc,
+			char *dst, size_t len, uint32_t seq);
+
+	/* Optional; required to stripe the samples over several connections.
+	 * Receives the samples of one response of READBUF into dst, and
+	 * returns len. */
+	ssize_t (*read_samples)(struct iio_context_pdata *pdata, void *desc,
+			char *dst, size_t len);
+
+	/* Optional; waits until the connection can be read from or written
+	 * to, and returns IIOD_CLIENT_READABLE and/or IIOD_CLIENT_WRITABLE.
+	 * Batches of attributes use it to read the responses while their
+	 * commands are being sent. */
+	int (*wait)(struct iio_context_pdata *pdata, void *desc);
 };
 
+#define IIOD_CLIENT_READABLE BIT(0)
+#define IIOD_CLIENT_WRITABLE BIT(1)
+
 struct iiod_client * iiod_client_new(struct iio_context_pdata *pdata,
 		struct iio_mutex *lock, const struct iiod_client_ops *ops);
 void iiod_client_destroy(struct iiod_client *client);
@@ -47,6 +113,21 @@ int iiod_client_set_trigger(struct iiod_client *client, void *desc,
 		const struct iio_device *dev, const struct iio_device *trigger);
 int iiod_client_set_kernel_buffers_count(struct iiod_client *client,
 		void *desc, const struct iio_device *dev, unsigned int nb_blocks);
+int iiod_client_set_cyclic_buffers_count(struct iiod_client *client,
+		void *desc, const struct iio_device *dev, unsigned int nb_blocks);
+int iiod_client_set_decimation(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, unsigned int factor, bool average);
+int iiod_client_enable_binary(struct iiod_client *client, void *desc);
+int iiod_client_enable_crc(struct iiod_client *client, void *desc);
+int iiod_client_enable_mux(struct iiod_client *client, void *desc);
+int iiod_client_enable_udp(struct iiod_client *client, void *desc,
+		unsigned int port);
+int iiod_client_enable_shm(struct iiod_client *client, void *desc,
+		const char *name);
+int iiod_client_enable_compression(struct iiod_client *client, void *desc,
+		uint32_t mode);
+int iiod_client_set_stripes(struct iiod_client *client, void *desc,
+		unsigned int nb, size_t size);
 int iiod_client_set_timeout(struct iiod_client *client,
 		void *desc, unsigned int timeout);
 ssize_t iiod_client_read_attr(struct iiod_client *client, void *desc,
@@ -60,11 +141,43 @@ int iiod_client_open_unlocked(struct iiod_client *client, void *desc,
 		bool cyclic);
 int iiod_client_close_unlocked(struct iiod_client *client, void *desc,
 		const struct iio_device *dev);
+int iiod_client_reopen_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, size_t samples_count);
 ssize_t iiod_client_read_unlocked(struct iiod_client *client, void *desc,
 		const struct iio_device *dev, void *dst, size_t len,
 		uint32_t *mask, size_t words);
 ssize_t iiod_client_write_unlocked(struct iiod_client *client, void *desc,
 		const struct iio_device *dev, const void *src, size_t len);
+int iiod_client_submit_read_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, size_t len);
+ssize_t iiod_client_complete_read_unlocked(struct iiod_client *client,
+		void *desc, const struct iio_device *dev, void *dst, size_t len,
+		uint32_t *mask, size_t words);
+int iiod_client_submit_write_unlocked(struct iiod_client *client,
+		void *desc, const struct iio_device *dev,
+		const void *src, size_t len);
+ssize_t iiod_client_complete_write_unlocked(struct iiod_client *client,
+		void *desc, size_t len);
+int iiod_client_set_attr_cache(struct iiod_client *client,
+		const char *attr, int ttl_ms);
+void iiod_client_invalidate_attr_cache(struct iiod_client *client);
+void iiod_client_get_attr_cache_stats(struct iiod_client *client,
+		struct iio_attr_cache_stats *stats);
+int iiod_client_read_attrs(struct iiod_client *client, void *desc,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs);
+int iiod_client_write_attrs(struct iiod_client *client, void *desc,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs);
+int iiod_client_open_events_unlocked(struct iiod_client *client, void *desc,
+		const struct iio_device *dev);
+ssize_t iiod_client_read_events_unlocked(struct iiod_client *client,
+		void *desc, struct iio_event *events, size_t nb);
+int iiod_client_close_events_unlocked(struct iiod_client *client, void *desc);
+int iiod_client_read_regs(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const uint32_t *addrs,
+		uint32_t *values, unsigned int nb);
+int iiod_client_write_regs(struct iiod_client *client, void *desc,
+		const struct iio_device *dev, const uint32_t *addrs,
+		const uint32_t *values, unsigned int nb);
 struct iio_context * iiod_client_create_context(
 		struct iiod_client *client, void *desc);
 
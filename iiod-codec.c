@@ -0,0 +1,443 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "iiod-codec.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* Number of samples per block of the delta coding; each block of each
+ * channel starts with the width of its differences, on 6 bits */
+#define CODEC_BLOCK 64
+
+/* Values wider than that are never delta-coded */
+#define CODEC_DELTA_MAX_BITS 32
+
+/* One word of a sample; channels with a repeat count have several */
+struct iiod_codec_field {
+	unsigned int offset, length;	/* In bytes */
+	unsigned int bits, shift;
+	bool is_be, is_signed;
+};
+
+struct iiod_codec {
+	size_t sample_size;
+
+	/* Set if the fields do not cover all the bytes of a sample */
+	bool has_padding;
+
+	unsigned int nb_fields;
+	struct iiod_codec_field fields[];
+};
+
+struct bit_writer {
+	uint8_t *ptr, *end;
+	uint64_t acc;
+	unsigned int nb;
+	bool overflow;
+};
+
+struct bit_reader {
+	const uint8_t *ptr, *end;
+	uint64_t acc;
+	unsigned int nb;
+	bool overflow;
+};
+
+static inline uint64_t field_mask(unsigned int bits)
+{
+	return bits >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << bits) - 1;
+}
+
+static void put_bits(struct bit_writer *w, uint64_t val, unsigned int bits)
+{
+	if (bits > 32) {
+		put_bits(w, val & 0xffffffff, 32);
+		val >>= 32;
+		bits -= 32;
+	}
+
+	w->acc |= (val & field_mask(bits)) << w->nb;
+	w->nb += bits;
+
+	for (; w->nb >= 8; w->nb -= 8, w->acc >>= 8) {
+		if (w->ptr == w->end)
+			w->overflow = true;
+		else
+			*w->ptr++ = (uint8_t) w->acc;
+	}
+}
+
+static void flush_bits(struct bit_writer *w)
+{
+	if (w->nb)
+		put_bits(w, 0, 8 - w->nb);
+}
+
+static uint64_t get_bits(struct bit_reader *r, unsigned int bits)
+{
+	uint64_t val;
+
+	if (bits > 32) {
+		val = get_bits(r, 32);
+		return val | get_bits(r, bits - 32) << 32;
+	}
+
+	while (r->nb < bits) {
+		if (r->ptr == r->end) {
+			r->overflow = true;
+			return 0;
+		}
+
+		r->acc |= (uint64_t) *r->ptr++ << r->nb;
+		r->nb += 8;
+	}
+
+	val = r->acc & field_mask(bits);
+	r->acc >>= bits;
+	r->nb -= bits;
+	return val;
+}
+
+static uint64_t load_value(const struct iiod_codec_field *f,
+		const uint8_t *sample)
+{
+	const uint8_t *src = sample + f->offset;
+	uint64_t word = 0;
+	unsigned int i;
+
+	for (i = 0; i < f->length; i++)
+		word |= (uint64_t) src[f->is_be ? f->length - 1 - i : i] << (8 * i);
+
+	return (word >> f->shift) & field_mask(f->bits);
+}
+
+static void store_value(const struct iiod_codec_field *f,
+		uint8_t *sample, uint64_t val)
+{
+	uint8_t *dst = sample + f->offset;
+	uint64_t word = (val & field_mask(f->bits)) << f->shift;
+	unsigned int i;
+
+	for (i = 0; i < f->length; i++, word >>= 8)
+		dst[f->is_be ? f->length - 1 - i : i] = (uint8_t) word;
+}
+
+static int64_t load_signed(const struct iiod_codec_field *f,
+		const uint8_t *sample)
+{
+	uint64_t val = load_value(f, sample);
+
+	if (f->is_signed && f->bits < 64 && (val >> (f->bits - 1)))
+		val |= ~field_mask(f->bits);
+
+	return (int64_t) val;
+}
+
+struct iiod_codec * iiod_codec_new(const struct iio_device *dev,
+		const uint32_t *mask)
+{
+	const struct iio_channel *prev = NULL;
+	struct iiod_codec *codec;
+	unsigned int i, j, nb = 0;
+	size_t size = 0, used = 0;
+
+	for (i = 0; i < dev->nb_channels; i++)
+		nb += dev->channels[i]->format.repeat ?
+			dev->channels[i]->format.repeat : 1;
+
+	codec = zalloc(sizeof(*codec) + nb * sizeof(*codec->fields));
+	if (!codec)
+		return NULL;
+
+	/* Same layout as iio_device_get_sample_size_mask() */
+	for (i = 0; i < dev->nb_channels; i++) {
+		const struct iio_channel *chn = dev->channels[i];
+		const struct iio_data_format *fmt = &chn->format;
+		unsigned int length = fmt->length / 8,
+			     repeat = fmt->repeat ? fmt->repeat : 1;
+
+		if (chn->index < 0)
+			break;
+		if (!TEST_BIT(mask, chn->number))
+			continue;
+
+		if (prev && chn->index == prev->index) {
+			prev = chn;
+			continue;
+		}
+
+		prev = chn;
+
+		if (!length || length > 8)
+			goto err_free_codec;
+
+		if (size % (length * repeat))
+			size += length * repeat - size % (length * repeat);
+
+		for (j = 0; j < repeat; j++) {
+			struct iiod_codec_field *f = &codec->fields[codec->nb_fields++];
+
+			f->offset = (unsigned int) size + j * length;
+			f->length = length;
+			f->is_be = fmt->is_be;
+			f->is_signed = fmt->is_signed;
+
+			/* Transport the whole word if the format is bogus */
+			if (fmt->bits && fmt->bits + fmt->shift <= length * 8) {
+				f->bits = fmt->bits;
+				f->shift = fmt->shift;
+			} else {
+				f->bits = length * 8;
+				f->shift = 0;
+			}
+		}
+
+		size += length * repeat;
+		used += length * repeat;
+	}
+
+	if (!size)
+		goto err_free_codec;
+
+	codec->sample_size = size;
+	codec->has_padding = used != size;
+	return codec;
+
+err_free_codec:
+	free(codec);
+	return NULL;
+}
+
+void iiod_codec_destroy(struct iiod_codec *codec)
+{
+	free(codec);
+}
+
+static inline uint64_t zigzag(int64_t val)
+{
+	return ((uint64_t) val << 1) ^ (uint64_t) (val >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t val)
+{
+	return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+}
+
+static void encode_packed(const struct iiod_codec *codec,
+		struct bit_writer *w, const uint8_t *src, size_t nb_samples)
+{
+	size_t i;
+	unsigned int j;
+
+	for (i = 0; i < nb_samples && !w->overflow; i++) {
+		const uint8_t *sample = src + i * codec->sample_size;
+
+		for (j = 0; j < codec->nb_fields; j++) {
+			const struct iiod_codec_field *f = &codec->fields[j];
+
+			put_bits(w, load_value(f, sample), f->bits);
+		}
+	}
+}
+
+static void encode_delta(const struct iiod_codec *codec,
+		struct bit_writer *w, const uint8_t *src, size_t nb_samples)
+{
+	uint64_t deltas[CODEC_BLOCK];
+	size_t block, i;
+	unsigned int j;
+
+	for (block = 0; block < nb_samples && !w->overflow;
+			block += CODEC_BLOCK) {
+		size_t nb = nb_samples - block;
+		const uint8_t *first = src + block * codec->sample_size;
+
+		if (nb > CODEC_BLOCK)
+			nb = CODEC_BLOCK;
+
+		for (j = 0; j < codec->nb_fields; j++) {
+			const struct iiod_codec_field *f = &codec->fields[j];
+			unsigned int width = 0;
+			uint64_t all = 0;
+			int64_t prev;
+
+			if (f->bits > CODEC_DELTA_MAX_BITS) {
+				for (i = 0; i < nb; i++)
+					put_bits(w, load_value(f, first +
+						i * codec->sample_size), f->bits);
+				continue;
+			}
+
+			prev = block ? load_signed(f,
+					first - codec->sample_size) : 0;
+
+			for (i = 0; i < nb; i++) {
+				int64_t val = load_signed(f,
+						first + i * codec->sample_size);
+
+				deltas[i] = zigzag(val - prev);
+				all |= deltas[i];
+				prev = val;
+			}
+
+			for (; all; all >>= 1)
+				width++;
+
+			put_bits(w, width, 6);
+			for (i = 0; i < nb; i++)
+				put_bits(w, deltas[i], width);
+		}
+	}
+}
+
+ssize_t iiod_codec_encode(const struct iiod_codec *codec, uint32_t mode,
+		void *dst, size_t dst_len, const void *src, size_t len)
+{
+	size_t nb_samples = len / codec->sample_size,
+	       tail = len - nb_samples * codec->sample_size;
+	struct bit_writer w = {
+		.ptr = dst,
+		.end = (uint8_t *) dst + dst_len,
+	};
+
+	if (mode & IIOD_FRAME_DELTA)
+		encode_delta(codec, &w, src, nb_samples);
+	else
+		encode_packed(codec, &w, src, nb_samples);
+
+	flush_bits(&w);
+
+	/* Bytes of an incomplete sample are sent as they are */
+	if (w.overflow || (size_t) (w.end - w.ptr) < tail)
+		return -ENOSPC;
+
+	memcpy(w.ptr, (const uint8_t *) src + len - tail, tail);
+
+	return (ssize_t) (w.ptr + tail - (uint8_t *) dst);
+}
+
+static void decode_packed(const struct iiod_codec *codec,
+		struct bit_reader *r, uint8_t *dst, size_t nb_samples)
+{
+	size_t i;
+	unsigned int j;
+
+	for (i = 0; i < nb_samples && !r->overflow; i++) {
+		uint8_t *sample = dst + i * codec->sample_size;
+
+		for (j = 0; j < codec->nb_fields; j++) {
+			const struct iiod_codec_field *f = &codec->fields[j];
+
+			store_value(f, sample, get_bits(r, f->bits));
+		}
+	}
+}
+
+static int decode_delta(const struct iiod_codec *codec,
+		struct bit_reader *r, uint8_t *dst, size_t nb_samples)
+{
+	size_t block, i;
+	unsigned int j;
+
+	for (block = 0; block < nb_samples && !r->overflow;
+			block += CODEC_BLOCK) {
+		size_t nb = nb_samples - block;
+		uint8_t *first = dst + block * codec->sample_size;
+
+		if (nb > CODEC_BLOCK)
+			nb = CODEC_BLOCK;
+
+		for (j = 0; j < codec->nb_fields; j++) {
+			const struct iiod_codec_field *f = &codec->fields[j];
+			unsigned int width;
+			int64_t val;
+
+			if (f->bits > CODEC_DELTA_MAX_BITS) {
+				for (i = 0; i < nb; i++)
+					store_value(f, first + i * codec->sample_size,
+						    get_bits(r, f->bits));
+				continue;
+			}
+
+			width = (unsigned int) get_bits(r, 6);
+			if (width > CODEC_DELTA_MAX_BITS + 1)
+				return -EINVAL;
+
+			val = block ? load_signed(f,
+					first - codec->sample_size) : 0;
+
+			for (i = 0; i < nb; i++) {
+				val += unzigzag(get_bits(r, width));
+				store_value(f, first + i * codec->sample_size,
+						(uint64_t) val);
+			}
+		}
+	}
+
+	return 0;
+}
+
+ssize_t iiod_codec_decode(const struct iiod_codec *codec, uint32_t mode,
+		void *dst, size_t len, const void *src, size_t src_len)
+{
+	size_t nb_samples = len / codec->sample_size,
+	       tail = len - nb_samples * codec->sample_size;
+	struct bit_reader r = {
+		.ptr = src,
+		.end = (const uint8_t *) src + src_len,
+	};
+	int ret = 0;
+
+	if (codec->has_padding)
+		memset(dst, 0, nb_samples * codec->sample_size);
+
+	if (mode & IIOD_FRAME_DELTA)
+		ret = decode_delta(codec, &r, dst, nb_samples);
+	else
+		decode_packed(codec, &r, dst, nb_samples);
+
+	if (ret < 0 || r.overflow || (size_t) (r.end - r.ptr) != tail)
+		return -EINVAL;
+
+	memcpy((uint8_t *) dst + len - tail, r.ptr, tail);
+
+	return (ssize_t) len;
+}
+
+/* The table handles one nibble at a time, which is fast enough for the links
+ * that need the CRC, without the kilobyte of the byte-wise table */
+static const uint32_t crc32_nibble[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+uint32_t iiod_crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+
+	crc = ~crc;
+
+	for (; len; len--, ptr++) {
+		crc = crc32_nibble[(crc ^ *ptr) & 0xf] ^ (crc >> 4);
+		crc = crc32_nibble[(crc ^ (*ptr >> 4)) & 0xf] ^ (crc >> 4);
+	}
+
+	return ~crc;
+}
@@ -0,0 +1,51 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef _IIOD_CODEC_H
+#define _IIOD_CODEC_H
+
+#include "iio-private.h"
+
+/*
+ * Compression of the samples exchanged by iiod and its clients, shared by
+ * both sides. The codec is built from the layout of one sample: the
+ * IIOD_FRAME_PACKED mode only transports the valuable bits of each channel
+ * (iio_data_format::bits); IIOD_FRAME_DELTA additionally stores each value
+ * as the difference with the previous sample of the same channel, packed to
+ * the width of the largest difference of each block of samples.
+ */
+struct iiod_codec;
+
+struct iiod_codec * iiod_codec_new(const struct iio_device *dev,
+		const uint32_t *mask);
+void iiod_codec_destroy(struct iiod_codec *codec);
+
+/* Returns the size of the encoded data, or -ENOSPC if it would not fit in
+ * dst_len bytes */
+ssize_t iiod_codec_encode(const struct iiod_codec *codec, uint32_t mode,
+		void *dst, size_t dst_len, const void *src, size_t len);
+
+/* Returns len, or -EINVAL if src does not hold len bytes of encoded data */
+ssize_t iiod_codec_decode(const struct iiod_codec *codec, uint32_t mode,
+		void *dst, size_t len, const void *src, size_t src_len);
+
+/* CRC-32 (IEEE 802.3) of the frames exchanged once the client negotiated it
+ * with the CRC command; pass 0 as crc for the first block, and the previous
+ * result to continue over the following ones */
+uint32_t iiod_crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif /* _IIOD_CODEC_H */
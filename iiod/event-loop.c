@@ -0,0 +1,311 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "event-loop.h"
+#include "ops.h"
+#include "thread-pool.h"
+#include "../debug.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
+#include <unistd.h>
+
+/*
+ * All the client sockets are registered in one epoll instance, with
+ * EPOLLONESHOT: a socket is reported to only one of the workers, which reads
+ * what the client sent without blocking, runs the commands received
+ * completely, and then re-arms it. The sessions of the clients thus never
+ * run concurrently, an idle client does not cost a thread, and a client
+ * sending a partial command does not hold a worker.
+ *
+ * The commands that wait for samples or events can take arbitrarily long:
+ * once a client sends one, its session moves to a thread of its own for
+ * the rest of the connection, as streaming clients issue them back to back.
+ *
+ * The stop eventfd of the workers' own pool is registered as well, without
+ * EPOLLONESHOT, so that every worker returns once it is signaled.
+ */
+
+struct client_session {
+	struct event_loop *loop;
+	struct parser_pdata *pdata;
+	int fd;
+
+	SLIST_ENTRY(client_session) next;
+};
+
+struct event_loop {
+	struct thread_pool *pool, *session_pool;
+	int epoll_fd;
+
+	/* Sessions not ended yet, freed by event_loop_destroy() */
+	pthread_mutex_t sessions_lock;
+	SLIST_HEAD(EventLoopSessionHead, client_session) sessions;
+};
+
+static void client_session_free(struct event_loop *loop,
+		struct client_session *session)
+{
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+
+	interpreter_free(session->pdata);
+
+	IIO_INFO("Client exited\n");
+	close(session->fd);
+	free(session);
+}
+
+static int client_session_arm(struct event_loop *loop,
+		struct client_session *session, int op)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+		.data.ptr = session,
+	};
+
+	if (epoll_ctl(loop->epoll_fd, op, session->fd, &ev) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static void client_session_end(struct event_loop *loop,
+		struct client_session *session)
+{
+	pthread_mutex_lock(&loop->sessions_lock);
+	SLIST_REMOVE(&loop->sessions, session, client_session, next);
+	pthread_mutex_unlock(&loop->sessions_lock);
+
+	client_session_free(loop, session);
+}
+
+static void client_session_thd(struct thread_pool *pool, void *d)
+{
+	struct client_session *session = d;
+
+	while (interpreter_step(session->pdata));
+
+	client_session_end(session->loop, session);
+}
+
+/* Runs the commands of the session received completely. Returns 1 if the
+ * session moved to a thread of its own, 0 if it waits for more commands,
+ * or a negative error code if it is over. */
+static int client_session_run(struct event_loop *loop,
+		struct client_session *session)
+{
+	struct parser_pdata *pdata = session->pdata;
+	bool has_run = false;
+	char err_str[1024];
+	ssize_t ret;
+
+	ret = interpreter_fill(pdata);
+	if (!ret)
+		ret = -EPIPE;
+	else if (ret == -EAGAIN)
+		ret = 0;
+
+	while (!pdata->stop && interpreter_has_command(pdata)) {
+		if (interpreter_command_blocks(pdata)) {
+			ret = thread_pool_add_thread(loop->pool,
+					client_session_thd, session,
+					"client_thd");
+			if (!ret)
+				return 1;
+
+			iio_strerror((int) ret, err_str, sizeof(err_str));
+			IIO_ERROR("Unable to create client thread: %s\n",
+					err_str);
+			return -(int) ret;
+		}
+
+		interpreter_step(pdata);
+		has_run = true;
+	}
+
+	if (pdata->stop)
+		return -EPIPE;
+
+	/* The data read ahead is full, without a complete command: the
+	 * client sent garbage */
+	if (ret == -ENOBUFS && has_run)
+		ret = 0;
+	else if (ret == -ENOBUFS)
+		IIO_ERROR("Command line too long\n");
+
+	return (int) ret;
+}
+
+static void event_loop_worker(struct thread_pool *pool, void *d)
+{
+	struct event_loop *loop = d;
+	struct client_session *session;
+	struct epoll_event ev;
+	char err_str[1024];
+	int ret;
+
+	while (true) {
+		ret = epoll_wait(loop->epoll_fd, &ev, 1, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			iio_strerror(errno, err_str, sizeof(err_str));
+			IIO_ERROR("Unable to wait for clients: %s\n", err_str);
+			break;
+		}
+
+		session = ev.data.ptr;
+		if (!session) /* STOP event */
+			break;
+
+		ret = client_session_run(loop, session);
+		if (ret > 0)
+			continue;
+
+		if (!ret) {
+			ret = client_session_arm(loop, session, EPOLL_CTL_MOD);
+			if (!ret)
+				continue;
+
+			iio_strerror(-ret, err_str, sizeof(err_str));
+			IIO_ERROR("Unable to re-arm client socket: %s\n",
+					err_str);
+		}
+
+		client_session_end(loop, session);
+	}
+}
+
+struct event_loop * event_loop_new(unsigned int nb_workers,
+		struct thread_pool *session_pool)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL, };
+	struct event_loop *loop;
+	unsigned int i;
+	int ret;
+
+	loop = malloc(sizeof(*loop));
+	if (!loop) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	loop->session_pool = session_pool;
+	pthread_mutex_init(&loop->sessions_lock, NULL);
+	SLIST_INIT(&loop->sessions);
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		ret = -errno;
+		goto err_free_loop;
+	}
+
+	loop->pool = thread_pool_new();
+	if (!loop->pool) {
+		ret = -errno;
+		goto err_close_epoll;
+	}
+
+	ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD,
+			thread_pool_get_poll_fd(loop->pool), &ev);
+	if (ret < 0) {
+		ret = -errno;
+		goto err_destroy_pool;
+	}
+
+	for (i = 0; i < nb_workers; i++) {
+		ret = thread_pool_add_thread(loop->pool, event_loop_worker,
+				loop, "event_loop_thd");
+		if (ret) {
+			ret = -ret;
+			goto err_stop_pool;
+		}
+	}
+
+	return loop;
+
+err_stop_pool:
+	thread_pool_stop_and_wait(loop->pool);
+err_destroy_pool:
+	thread_pool_destroy(loop->pool);
+err_close_epoll:
+	close(loop->epoll_fd);
+err_free_loop:
+	pthread_mutex_destroy(&loop->sessions_lock);
+	free(loop);
+	errno = -ret;
+	return NULL;
+}
+
+int event_loop_add_client(struct event_loop *loop,
+		struct iio_context *ctx, int fd, bool debug)
+{
+	struct client_session *session;
+	int ret;
+
+	session = malloc(sizeof(*session));
+	if (!session)
+		return -ENOMEM;
+
+	session->loop = loop;
+	session->fd = fd;
+	session->pdata = interpreter_new(ctx, fd, fd, debug,
+			true, false, loop->session_pool);
+	if (!session->pdata) {
+		free(session);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_lock(&loop->sessions_lock);
+	SLIST_INSERT_HEAD(&loop->sessions, session, next);
+	pthread_mutex_unlock(&loop->sessions_lock);
+
+	/* From here on, the session may be served or ended by a worker */
+	ret = client_session_arm(loop, session, EPOLL_CTL_ADD);
+	if (ret) {
+		pthread_mutex_lock(&loop->sessions_lock);
+		SLIST_REMOVE(&loop->sessions, session, client_session, next);
+		pthread_mutex_unlock(&loop->sessions_lock);
+
+		interpreter_free(session->pdata);
+		free(session);
+	}
+
+	return ret;
+}
+
+void event_loop_destroy(struct event_loop *loop)
+{
+	struct client_session *session;
+
+	thread_pool_stop_and_wait(loop->pool);
+
+	while (!SLIST_EMPTY(&loop->sessions)) {
+		session = SLIST_FIRST(&loop->sessions);
+		SLIST_REMOVE_HEAD(&loop->sessions, next);
+
+		client_session_free(loop, session);
+	}
+
+	thread_pool_destroy(loop->pool);
+	close(loop->epoll_fd);
+	pthread_mutex_destroy(&loop->sessions_lock);
+	free(loop);
+}
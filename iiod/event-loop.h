@@ -0,0 +1,41 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <stdbool.h>
+
+struct event_loop;
+struct iio_context;
+struct thread_pool;
+
+/* Serves the network clients with a fixed number of worker threads, instead
+ * of one thread per client; only the clients streaming samples or events
+ * get a thread of their own. The sessions use session_pool to abort their
+ * blocking I/O when iiod is stopped. */
+struct event_loop * event_loop_new(unsigned int nb_workers,
+		struct thread_pool *session_pool);
+
+/* The client socket fd must be non-blocking; on success, it is closed by the
+ * event loop once the session is over */
+int event_loop_add_client(struct event_loop *loop,
+		struct iio_context *ctx, int fd, bool debug);
+
+/* Stops the workers, and ends the sessions of the remaining clients */
+void event_loop_destroy(struct event_loop *loop);
+
+#endif /* __EVENT_LOOP_H__ */
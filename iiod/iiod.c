@@ -19,11 +19,13 @@
 #include "../debug.h"
 #include "../iio.h"
 #include "../iio-config.h"
+#include "event-loop.h"
 #include "ops.h"
 #include "thread-pool.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <netinet/in.h>
@@ -59,6 +61,31 @@ struct client_data {
 };
 
 bool server_demux;
+bool server_zerocopy;
+bool server_splice;
+unsigned int server_ring_size = 4;
+bool server_drop_oldest;
+
+/* Options of the client sockets; 0 keeps the system defaults */
+static int sock_sndbuf, sock_rcvbuf, sock_busy_poll;
+
+/* Number of threads serving the network clients; 0 for one per client */
+static unsigned int nb_workers;
+
+/* Scheduling of the R/W threads, given with the --rw-* options: for all
+ * the devices if dev is NULL, otherwise for the device of that ID or name */
+struct rw_thd_config {
+	const char *dev;
+	size_t dev_len;
+
+	bool set_cpus;
+	cpu_set_t cpus;
+	int priority; /* -1 if not set */
+	size_t stack_size; /* 0 if not set */
+};
+
+static struct rw_thd_config *rw_thd_configs;
+static unsigned int nb_rw_thd_configs;
 
 struct thread_pool *main_thread_pool;
 
@@ -95,6 +122,18 @@ static const struct option options[] = {
 	  {"aio", no_argument, 0, 'a'},
 	  {"ffs", required_argument, 0, 'F'},
 	  {"nb-pipes", required_argument, 0, 'n'},
+	  {"sndbuf", required_argument, 0, 's'},
+	  {"rcvbuf", required_argument, 0, 'r'},
+	  {"busy-poll", required_argument, 0, 'b'},
+	  {"zerocopy", no_argument, 0, 'z'},
+	  {"splice", no_argument, 0, 'p'},
+	  {"workers", required_argument, 0, 'w'},
+	  {"ring-blocks", required_argument, 0, 'k'},
+	  {"drop-oldest", no_argument, 0, 'o'},
+	  {"stats", no_argument, 0, 'S'},
+	  {"rw-cpus", required_argument, 0, 'c'},
+	  {"rw-priority", required_argument, 0, 'P'},
+	  {"rw-stack", required_argument, 0, 'T'},
 	  {0, 0, 0, 0},
 };
 
@@ -107,6 +146,18 @@ static const char *options_descriptions[] = {
 	"Use asynchronous I/O.",
 	"Use the given FunctionFS mountpoint to serve over USB",
 	"Specify the number of USB pipes (ep couples) to use",
+	"Size in bytes of the send buffer of the client sockets.",
+	"Size in bytes of the receive buffer of the client sockets.",
+	"Busy-poll the client sockets for the given time in microseconds.",
+	"Send the samples to the network clients with MSG_ZEROCOPY.",
+	"Splice the samples to the network clients without copying them.",
+	"Serve the network clients with the given number of threads.",
+	"Number of blocks read from a device kept for its readers.",
+	"Drop the oldest block for the slow readers instead of waiting for them.",
+	"Collect the statistics of the operations, sent by the STATS command.",
+	"[DEVICE=]CPUS: Pin the R/W threads to the given list of CPUs (e.g. 1,2-3).",
+	"[DEVICE=]PRIO: Run the R/W threads with SCHED_FIFO at the given priority.",
+	"[DEVICE=]SIZE: Size in bytes of the stack of the R/W threads, faulted in at start.",
 };
 
 #ifdef HAVE_AVAHI
@@ -432,6 +483,124 @@ static void usage(void)
 					options_descriptions[i]);
 }
 
+/* Returns the configuration of the R/W threads of the device given at the
+ * start of the argument, or of all the devices; the argument is updated to
+ * point to the value */
+static struct rw_thd_config * get_rw_thd_config(const char **arg)
+{
+	struct rw_thd_config *config;
+	const char *dev = NULL, *sep = strchr(*arg, '=');
+	size_t dev_len = 0;
+	unsigned int i;
+
+	if (sep) {
+		dev = *arg;
+		dev_len = sep - dev;
+		*arg = sep + 1;
+	}
+
+	for (i = 0; i < nb_rw_thd_configs; i++) {
+		config = &rw_thd_configs[i];
+
+		if (!dev && !config->dev)
+			return config;
+		if (dev && config->dev && dev_len == config->dev_len &&
+				!strncmp(dev, config->dev, dev_len))
+			return config;
+	}
+
+	config = realloc(rw_thd_configs,
+			(nb_rw_thd_configs + 1) * sizeof(*config));
+	if (!config)
+		return NULL;
+
+	rw_thd_configs = config;
+	config = &rw_thd_configs[nb_rw_thd_configs++];
+
+	memset(config, 0, sizeof(*config));
+	config->dev = dev;
+	config->dev_len = dev_len;
+	config->priority = -1;
+
+	return config;
+}
+
+/* Parses a list of CPUs of the form "0,2-3" */
+static int parse_cpu_list(const char *str, cpu_set_t *cpus)
+{
+	long first, last;
+	char *end;
+
+	CPU_ZERO(cpus);
+
+	do {
+		errno = 0;
+		first = strtol(str, &end, 10);
+		if (str == end || errno == ERANGE || first < 0)
+			return -EINVAL;
+
+		last = first;
+
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (str == end || errno == ERANGE || last < first)
+				return -EINVAL;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return -EINVAL;
+
+		for (; first <= last; first++)
+			CPU_SET((int) first, cpus);
+
+		str = end + 1;
+	} while (*end == ',');
+
+	return *end ? -EINVAL : 0;
+}
+
+static bool rw_thd_config_matches(const struct rw_thd_config *config,
+		const char *str)
+{
+	return str && strlen(str) == config->dev_len &&
+		!strncmp(str, config->dev, config->dev_len);
+}
+
+void get_rw_thd_sched(const struct iio_device *dev, struct thread_sched *sched)
+{
+	const struct rw_thd_config *config;
+	unsigned int i, pass;
+
+	memset(sched, 0, sizeof(*sched));
+
+	/* The settings of all the devices first, then the ones of this
+	 * device on top of them */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < nb_rw_thd_configs; i++) {
+			config = &rw_thd_configs[i];
+
+			if (!pass != !config->dev)
+				continue;
+
+			if (pass && !rw_thd_config_matches(config,
+						iio_device_get_id(dev)) &&
+					!rw_thd_config_matches(config,
+						iio_device_get_name(dev)))
+				continue;
+
+			if (config->set_cpus) {
+				sched->set_cpus = true;
+				sched->cpus = config->cpus;
+			}
+			if (config->priority >= 0)
+				sched->priority = config->priority;
+			if (config->stack_size)
+				sched->stack_size = config->stack_size;
+		}
+	}
+}
+
 static void client_thd(struct thread_pool *pool, void *d)
 {
 	struct client_data *cdata = d;
@@ -494,6 +663,7 @@ static int main_server(struct iio_context *ctx, bool debug)
 	    keepalive_time = 10,
 	    keepalive_intvl = 10,
 	    keepalive_probes = 6;
+	struct event_loop *loop = NULL;
 	struct pollfd pfd[2];
 	char err_str[1024];
 	bool ipv6;
@@ -542,6 +712,15 @@ static int main_server(struct iio_context *ctx, bool debug)
 		goto err_close_socket;
 	}
 
+	if (nb_workers) {
+		loop = event_loop_new(nb_workers, main_thread_pool);
+		if (!loop) {
+			iio_strerror(errno, err_str, sizeof(err_str));
+			IIO_ERROR("Unable to create event loop: %s\n", err_str);
+			goto err_close_socket;
+		}
+	}
+
 #ifdef HAVE_AVAHI
 	start_avahi();
 #endif
@@ -613,6 +792,32 @@ static int main_server(struct iio_context *ctx, bool debug)
 			iio_strerror(errno, err_str, sizeof(err_str));
 			IIO_WARNING("setsockopt TCP_NODELAY : %s (%d)", err_str, -errno);
 		}
+		if (sock_sndbuf) {
+			ret = setsockopt(new, SOL_SOCKET, SO_SNDBUF,
+					&sock_sndbuf, sizeof(sock_sndbuf));
+			if (ret < 0) {
+				iio_strerror(errno, err_str, sizeof(err_str));
+				IIO_WARNING("setsockopt SO_SNDBUF : %s (%d)", err_str, -errno);
+			}
+		}
+		if (sock_rcvbuf) {
+			ret = setsockopt(new, SOL_SOCKET, SO_RCVBUF,
+					&sock_rcvbuf, sizeof(sock_rcvbuf));
+			if (ret < 0) {
+				iio_strerror(errno, err_str, sizeof(err_str));
+				IIO_WARNING("setsockopt SO_RCVBUF : %s (%d)", err_str, -errno);
+			}
+		}
+#ifdef SO_BUSY_POLL
+		if (sock_busy_poll) {
+			ret = setsockopt(new, SOL_SOCKET, SO_BUSY_POLL,
+					&sock_busy_poll, sizeof(sock_busy_poll));
+			if (ret < 0) {
+				iio_strerror(errno, err_str, sizeof(err_str));
+				IIO_WARNING("setsockopt SO_BUSY_POLL : %s (%d)", err_str, -errno);
+			}
+		}
+#endif
 
 		cdata->fd = new;
 		cdata->ctx = ctx;
@@ -621,6 +826,18 @@ static int main_server(struct iio_context *ctx, bool debug)
 		IIO_INFO("New client connected from %s\n",
 				inet_ntoa(caddr.sin_addr));
 
+		if (loop) {
+			ret = event_loop_add_client(loop, ctx, new, debug);
+			if (ret) {
+				iio_strerror(-ret, err_str, sizeof(err_str));
+				IIO_ERROR("Failed to add new client: %s\n",
+					err_str);
+				close(new);
+			}
+			free(cdata);
+			continue;
+		}
+
 		ret = thread_pool_add_thread(main_thread_pool, client_thd, cdata, "net_client_thd");
 		if (ret) {
 			iio_strerror(ret, err_str, sizeof(err_str));
@@ -635,6 +852,8 @@ static int main_server(struct iio_context *ctx, bool debug)
 #ifdef HAVE_AVAHI
 	stop_avahi();
 #endif
+	if (loop)
+		event_loop_destroy(loop);
 	close(fd);
 	return EXIT_SUCCESS;
 
@@ -645,18 +864,21 @@ err_close_socket:
 
 int main(int argc, char **argv)
 {
-	bool debug = false, interactive = false, use_aio = false;
+	bool debug = false, interactive = false, use_aio = false, stats = false;
 #ifdef WITH_IIOD_USBD
 	long nb_pipes = 3;
 	char *end;
 #endif
+	struct rw_thd_config *rw_config;
 	struct iio_context *ctx;
 	int c, option_index = 0;
-	char *ffs_mountpoint = NULL;
+	char *ffs_mountpoint = NULL, *end_ptr;
+	const char *arg;
 	char err_str[1024];
+	long value;
 	int ret;
 
-	while ((c = getopt_long(argc, argv, "+hVdDiaF:n:",
+	while ((c = getopt_long(argc, argv, "+hVdDiaF:n:s:r:b:zpw:k:oSc:P:T:",
 					options, &option_index)) != -1) {
 		switch (c) {
 		case 'd':
@@ -697,6 +919,97 @@ int main(int argc, char **argv)
 			IIO_ERROR("IIOD was not compiled with USB support.\n");
 			return EXIT_FAILURE;
 #endif
+		case 's':
+		case 'r':
+		case 'b':
+			errno = 0;
+			value = strtol(optarg, &end_ptr, 0);
+			if (optarg == end_ptr || *end_ptr || value < 0 ||
+					value > INT_MAX || errno == ERANGE) {
+				IIO_ERROR("-%c: Invalid parameter\n", c);
+				return EXIT_FAILURE;
+			}
+
+			if (c == 's')
+				sock_sndbuf = (int) value;
+			else if (c == 'r')
+				sock_rcvbuf = (int) value;
+			else
+				sock_busy_poll = (int) value;
+			break;
+		case 'z':
+#ifdef SO_ZEROCOPY
+			server_zerocopy = true;
+			break;
+#else
+			IIO_ERROR("MSG_ZEROCOPY is not supported.\n");
+			return EXIT_FAILURE;
+#endif
+		case 'p':
+			server_splice = true;
+			break;
+		case 'w':
+			errno = 0;
+			value = strtol(optarg, &end_ptr, 0);
+			if (optarg == end_ptr || *end_ptr || value < 0 ||
+					value > 1024 || errno == ERANGE) {
+				IIO_ERROR("--workers: Invalid parameter\n");
+				return EXIT_FAILURE;
+			}
+			nb_workers = (unsigned int) value;
+			break;
+		case 'k':
+			errno = 0;
+			value = strtol(optarg, &end_ptr, 0);
+			if (optarg == end_ptr || *end_ptr || value < 1 ||
+					value > 1024 || errno == ERANGE) {
+				IIO_ERROR("--ring-blocks: Invalid parameter\n");
+				return EXIT_FAILURE;
+			}
+			server_ring_size = (unsigned int) value;
+			break;
+		case 'o':
+			server_drop_oldest = true;
+			break;
+		case 'S':
+			stats = true;
+			break;
+		case 'c':
+		case 'P':
+		case 'T':
+			arg = optarg;
+			rw_config = get_rw_thd_config(&arg);
+			if (!rw_config) {
+				IIO_ERROR("Unable to allocate memory\n");
+				return EXIT_FAILURE;
+			}
+
+			if (c == 'c') {
+				if (parse_cpu_list(arg, &rw_config->cpus)) {
+					IIO_ERROR("--rw-cpus: Invalid parameter\n");
+					return EXIT_FAILURE;
+				}
+
+				rw_config->set_cpus = true;
+				break;
+			}
+
+			errno = 0;
+			value = strtol(arg, &end_ptr, 0);
+			if (arg == end_ptr || *end_ptr || errno == ERANGE ||
+					(c == 'P' && (value < 0 ||
+					 value > sched_get_priority_max(SCHED_FIFO))) ||
+					(c == 'T' && (value < PTHREAD_STACK_MIN ||
+					 value > INT_MAX))) {
+				IIO_ERROR("-%c: Invalid parameter\n", c);
+				return EXIT_FAILURE;
+			}
+
+			if (c == 'P')
+				rw_config->priority = (int) value;
+			else
+				rw_config->stack_size = (size_t) value;
+			break;
 		case 'h':
 			usage();
 			return EXIT_SUCCESS;
@@ -716,6 +1029,16 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	if (stats) {
+		ret = iio_context_enable_stats(ctx, true);
+		if (ret < 0) {
+			iio_strerror(-ret, err_str, sizeof(err_str));
+			IIO_ERROR("Unable to enable statistics: %s\n", err_str);
+			ret = EXIT_FAILURE;
+			goto out_destroy_context;
+		}
+	}
+
 	main_thread_pool = thread_pool_new();
 	if (!main_thread_pool) {
 		iio_strerror(errno, err_str, sizeof(err_str));
@@ -763,6 +1086,7 @@ out_destroy_thread_pool:
 
 out_destroy_context:
 	iio_context_destroy(ctx);
+	free(rw_thd_configs);
 
 	return ret;
 }
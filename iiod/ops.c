@@ -21,22 +21,67 @@
 #include "thread-pool.h"
 #include "../debug.h"
 #include "../iio-private.h"
+#include "../iiod-codec.h"
+#include "../iio-trace.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
 #include <poll.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
 #include <signal.h>
 
 int yyparse(yyscan_t scanner);
 
 struct DevEntry;
 
+/* One sample word of the client's layout, for the averaging decimation */
+struct decim_chn {
+	const struct iio_channel *chn;
+	unsigned int offset;
+	bool average;
+	int64_t acc;
+};
+
+/* Only one sample out of 'factor' is sent to the client, optionally the
+ * average of the samples of its group */
+struct decimator {
+	unsigned int factor, phase;
+	bool average;
+
+	struct decim_chn *chns;
+	unsigned int nb_chns;
+
+	void *buf;
+	size_t buf_size;
+};
+
+/* Number of blocks a reader can have in flight with MSG_ZEROCOPY or splice */
+#define MAX_PINNED_BLOCKS 8
+
+/* Block sent without copying it; the socket may still reference its pages
+ * until the fence is reached: the ID of a zero-copy send, or the offset of
+ * the end of the data spliced in the stream */
+struct block_pin {
+	struct dev_block *blk;
+	uint64_t fence;
+	bool spliced;
+};
+
 /* Corresponds to a thread reading from a device */
 struct ThdEntry {
 	SLIST_ENTRY(ThdEntry) parser_list_entry;
@@ -52,6 +97,27 @@ struct ThdEntry {
 
 	uint32_t *mask;
 	bool active, is_writer, new_client, wait_for_open;
+
+	/* Samples in the client's layout, when it differs from the device's */
+	void *demux_buf;
+	size_t demux_buf_size;
+
+	/* Compression of the samples sent, when negotiated by the client */
+	struct iiod_codec *codec;
+	void *codec_buf;
+	size_t codec_buf_size;
+	struct decimator decim;
+
+	/* Sequence number of the next block of the ring to send, and number
+	 * of blocks dropped before this reader could send them, not reported
+	 * to the client yet */
+	uint64_t ring_seq;
+	unsigned int nb_dropped;
+
+	/* Blocks sent with MSG_ZEROCOPY or spliced, referenced until the
+	 * kernel releases their pages; see thd_entry_pin_block() */
+	struct block_pin pins[MAX_PINNED_BLOCKS];
+	unsigned int nb_pins;
 };
 
 static void thd_entry_event_signal(struct ThdEntry *thd)
@@ -119,11 +185,42 @@ struct DevEntry {
 
 	uint32_t *mask;
 	size_t nb_words;
+
+	/* Ring of the last blocks read from the device; the block of sequence
+	 * number n is ring[n % ring_size], for ring_tail <= n < ring_head.
+	 * Up to ring_size released blocks are kept in the spare_blocks list
+	 * for the next refills. lent_block is the one used to hand the
+	 * device's buffer itself to a lone reader; see dev_entry_push_block(). */
+	struct dev_block **ring, *spare_blocks, *lent_block;
+	unsigned int ring_size, nb_spare_blocks;
+	uint64_t ring_head, ring_tail;
 };
 
-struct sample_cb_info {
-	struct parser_pdata *pdata;
-	unsigned int nb_bytes, cpt;
+/* Samples of one refill of the device's buffer, sent by each reader from its
+ * own thread; protected by the thdlist_lock of the device */
+struct dev_block {
+	unsigned int refs, sample_size;
+	size_t len, size;
+	void *data;
+
+	/* Set if the data was mapped for the splice path */
+	bool mapped;
+
+	/* Set if the data is the device's buffer instead of a copy */
+	bool lent;
+
+	/* Next block of the spare_blocks list of the device */
+	struct dev_block *next;
+
+	/* Channels enabled when the samples were read */
+	uint32_t mask[];
+};
+
+struct block_cb_info {
+	uint8_t *buf;
+	size_t count;
+	unsigned int sample_size, cpt, prev_offset;
+	const struct iio_channel *prev;
 	uint32_t *mask;
 };
 
@@ -132,34 +229,32 @@ struct sample_cb_info {
 static pthread_mutex_t devlist_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #if WITH_AIO
-static ssize_t async_io(struct parser_pdata *pdata, void *buf, size_t len,
-	bool do_read)
+/* Submits the nb requests at once, and waits for all of them to complete;
+ * their results are stored in res. Returns 1 if the session was stopped
+ * meanwhile, in which case the requests were cancelled. */
+static int async_io_wait(struct parser_pdata *pdata,
+		struct iocb **ios, long *res, unsigned int nb)
 {
-	ssize_t ret;
+	struct io_event e[IIOD_MAX_STRIPES];
+	bool done[IIOD_MAX_STRIPES] = { false };
 	struct pollfd pfd[2];
-	unsigned int num_pfds;
-	struct iocb iocb;
-	struct iocb *ios[1];
-	struct io_event e[1];
-
-	ios[0] = &iocb;
-
-	if (do_read)
-		io_prep_pread(&iocb, pdata->fd_in, buf, len, 0);
-	else
-		io_prep_pwrite(&iocb, pdata->fd_out, buf, len, 0);
+	unsigned int i, j, num_pfds, left = nb;
+	int ret = 0;
 
-	io_set_eventfd(&iocb, pdata->aio_eventfd);
+	for (i = 0; i < nb; i++)
+		io_set_eventfd(ios[i], pdata->aio_eventfd);
 
 	pthread_mutex_lock(&pdata->aio_mutex);
 
-	ret = io_submit(pdata->aio_ctx, 1, ios);
-	if (ret != 1) {
+	ret = io_submit(pdata->aio_ctx, nb, ios);
+	if (ret != (int) nb) {
 		pthread_mutex_unlock(&pdata->aio_mutex);
-		IIO_ERROR("Failed to submit IO operation: %zd\n", ret);
+		IIO_ERROR("Failed to submit IO operation: %d\n", ret);
 		return -EIO;
 	}
 
+	ret = 0;
+
 	pfd[0].fd = pdata->aio_eventfd;
 	pfd[0].events = POLLIN;
 	pfd[0].revents = 0;
@@ -168,48 +263,94 @@ static ssize_t async_io(struct parser_pdata *pdata, void *buf, size_t len,
 	pfd[1].revents = 0;
 	num_pfds = 2;
 
-	do {
+	while (left) {
 		poll_nointr(pfd, num_pfds);
 
 		if (pfd[0].revents & POLLIN) {
 			uint64_t event;
-			ret = read(pdata->aio_eventfd, &event, sizeof(event));
-			if (ret != sizeof(event)) {
+			int nb_events;
+
+			if (read(pdata->aio_eventfd, &event,
+						sizeof(event)) != sizeof(event)) {
 				IIO_ERROR("Failed to read from eventfd: %d\n", -errno);
 				ret = -EIO;
 				break;
 			}
 
-			ret = io_getevents(pdata->aio_ctx, 0, 1, e, NULL);
-			if (ret != 1) {
-				IIO_ERROR("Failed to read IO events: %zd\n", ret);
+			nb_events = io_getevents(pdata->aio_ctx, 0,
+					(long) left, e, NULL);
+			if (nb_events < 0) {
+				IIO_ERROR("Failed to read IO events: %d\n",
+						nb_events);
 				ret = -EIO;
 				break;
-			} else {
-				ret = (long)e[0].res;
 			}
-		} else if ((num_pfds > 1 && pfd[1].revents & POLLIN)) {
+
+			for (j = 0; j < (unsigned int) nb_events; j++) {
+				for (i = 0; i < nb; i++) {
+					if (e[j].obj == ios[i] && !done[i]) {
+						res[i] = (long) e[j].res;
+						done[i] = true;
+						left--;
+						break;
+					}
+				}
+			}
+		} else if (num_pfds > 1 && pfd[1].revents & POLLIN) {
 			/* Got a STOP event to abort this whole session */
-			ret = io_cancel(pdata->aio_ctx, &iocb, e);
-			if (ret != -EINPROGRESS && ret != -EINVAL) {
-				IIO_ERROR("Failed to cancel IO transfer: %zd\n", ret);
-				ret = -EIO;
-				break;
+			for (i = 0; i < nb; i++) {
+				int err;
+
+				if (done[i])
+					continue;
+
+				err = io_cancel(pdata->aio_ctx, ios[i], e);
+				if (err != -EINPROGRESS && err != -EINVAL) {
+					IIO_ERROR("Failed to cancel IO transfer: %d\n",
+							err);
+					ret = -EIO;
+				}
 			}
-			/* It should not be long now until we get the cancellation event */
+			if (ret)
+				break;
+
+			/* It should not be long now until we get the
+			 * cancellation events */
 			num_pfds = 1;
 		}
-	} while (!(pfd[0].revents & POLLIN));
+	}
 
 	pthread_mutex_unlock(&pdata->aio_mutex);
 
 	/* Got STOP event, treat it as EOF */
-	if (num_pfds == 1)
-		return 0;
+	if (!ret && num_pfds == 1)
+		return 1;
 
 	return ret;
 }
 
+static ssize_t async_io(struct parser_pdata *pdata, void *buf, size_t len,
+	bool do_read)
+{
+	struct iocb iocb;
+	struct iocb *ios[1] = { &iocb };
+	long res;
+	int ret;
+
+	if (do_read)
+		io_prep_pread(&iocb, pdata->fd_in, buf, len, 0);
+	else
+		io_prep_pwrite(&iocb, pdata->fd_out, buf, len, 0);
+
+	ret = async_io_wait(pdata, ios, &res, 1);
+	if (ret < 0)
+		return ret;
+	if (ret)
+		return 0;
+
+	return (ssize_t) res;
+}
+
 #define MAX_AIO_REQ_SIZE (1024 * 1024)
 
 static ssize_t readfd_aio(struct parser_pdata *pdata, void *dest, size_t len)
@@ -219,18 +360,215 @@ static ssize_t readfd_aio(struct parser_pdata *pdata, void *dest, size_t len)
 	return async_io(pdata, dest, len, true);
 }
 
-static ssize_t writefd_aio(struct parser_pdata *pdata, const void *dest,
+/* Size of the chunks the writes are split into; a new chunk is submitted as
+ * soon as one completes, with up to IIOD_MAX_AIO_REQS of them in flight */
+#define AIO_CHUNK_SIZE (128 * 1024)
+
+/* Cancels the requests still in flight; their completion events are still
+ * to be reaped */
+static int async_io_cancel(struct parser_pdata *pdata,
+		struct iocb *iocbs, const bool *busy)
+{
+	struct io_event e;
+	unsigned int i;
+	int err, ret = 0;
+
+	for (i = 0; i < IIOD_MAX_AIO_REQS; i++) {
+		if (!busy[i])
+			continue;
+
+		err = io_cancel(pdata->aio_ctx, &iocbs[i], &e);
+		if (err != -EINPROGRESS && err != -EINVAL && err != -EAGAIN) {
+			IIO_ERROR("Failed to cancel IO transfer: %d\n", err);
+			ret = -EIO;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Writes the elements of the iovec array in chunks of up to AIO_CHUNK_SIZE
+ * bytes, keeping up to IIOD_MAX_AIO_REQS of them in flight: the window is
+ * refilled each time completions are reaped, and the completions are reaped
+ * in batches, so that the endpoint is never idle between two chunks.
+ * Returns the number of bytes written, 0 if the session was stopped
+ * meanwhile, or a negative error code.
+ */
+static ssize_t writevfd_aio(struct parser_pdata *pdata,
+		const struct iovec *iov, int nb)
+{
+	struct iocb iocbs[IIOD_MAX_AIO_REQS], *ios[IIOD_MAX_AIO_REQS];
+	struct io_event e[IIOD_MAX_AIO_REQS];
+	bool busy[IIOD_MAX_AIO_REQS] = { false };
+	unsigned int i, j, nb_ios, in_flight = 0, num_pfds = 2;
+	size_t offset = 0, written = 0;
+	struct pollfd pfd[2];
+	bool stopped = false;
+	int ret, err = 0;
+
+	pfd[0].fd = pdata->aio_eventfd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = thread_pool_get_poll_fd(pdata->pool);
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+
+	pthread_mutex_lock(&pdata->aio_mutex);
+
+	do {
+		/* Fill the free slots with the next chunks */
+		for (i = 0, nb_ios = 0; !err && !stopped && nb &&
+				i < IIOD_MAX_AIO_REQS; i++) {
+			size_t size;
+
+			if (busy[i])
+				continue;
+
+			for (; nb && !iov->iov_len; iov++, nb--);
+			if (!nb)
+				break;
+
+			size = iov->iov_len - offset;
+
+			if (size > AIO_CHUNK_SIZE)
+				size = AIO_CHUNK_SIZE;
+
+			io_prep_pwrite(&iocbs[i], pdata->fd_out,
+					(char *) iov->iov_base + offset, size, 0);
+			io_set_eventfd(&iocbs[i], pdata->aio_eventfd);
+			ios[nb_ios++] = &iocbs[i];
+			busy[i] = true;
+
+			offset += size;
+			if (offset == iov->iov_len) {
+				iov++;
+				nb--;
+				offset = 0;
+			}
+		}
+
+		if (nb_ios) {
+			ret = io_submit(pdata->aio_ctx, (long) nb_ios, ios);
+			if (ret < 0)
+				ret = 0;
+			if (ret != (int) nb_ios) {
+				IIO_ERROR("Failed to submit IO operation: %d\n",
+						ret);
+				err = -EIO;
+
+				/* Release the slots of the requests that
+				 * were not submitted */
+				for (j = (unsigned int) ret; j < nb_ios; j++)
+					busy[ios[j] - iocbs] = false;
+
+				in_flight += (unsigned int) ret;
+				if (async_io_cancel(pdata, iocbs, busy))
+					break;
+				num_pfds = 1;
+			} else {
+				in_flight += nb_ios;
+			}
+		}
+
+		if (!in_flight)
+			break;
+
+		poll_nointr(pfd, num_pfds);
+
+		if (pfd[0].revents & POLLIN) {
+			uint64_t event;
+			int nb_events;
+
+			if (read(pdata->aio_eventfd, &event,
+						sizeof(event)) != sizeof(event)) {
+				IIO_ERROR("Failed to read from eventfd: %d\n", -errno);
+				err = -EIO;
+				break;
+			}
+
+			nb_events = io_getevents(pdata->aio_ctx, 0,
+					(long) in_flight, e, NULL);
+			if (nb_events < 0) {
+				IIO_ERROR("Failed to read IO events: %d\n",
+						nb_events);
+				err = -EIO;
+				break;
+			}
+
+			for (j = 0; j < (unsigned int) nb_events; j++) {
+				struct iocb *io = (struct iocb *) e[j].obj;
+				long res = (long) e[j].res;
+
+				busy[io - iocbs] = false;
+				in_flight--;
+
+				/* The chunks following a short write were
+				 * already submitted: the stream is broken */
+				if (!err && res >= 0 &&
+						(unsigned long) res != io->u.c.nbytes)
+					res = -EPIPE;
+
+				if (res < 0 && !err && !stopped) {
+					err = (int) res;
+					if (async_io_cancel(pdata, iocbs, busy))
+						in_flight = 0;
+					num_pfds = 1;
+				} else if (res > 0) {
+					written += (size_t) res;
+				}
+			}
+		} else if (num_pfds > 1 && pfd[1].revents & POLLIN) {
+			/* Got a STOP event to abort this whole session */
+			stopped = true;
+			if (async_io_cancel(pdata, iocbs, busy)) {
+				err = -EIO;
+				break;
+			}
+
+			/* It should not be long now until we get the
+			 * cancellation events */
+			num_pfds = 1;
+		}
+	} while (in_flight || (nb && !err && !stopped));
+
+	pthread_mutex_unlock(&pdata->aio_mutex);
+
+	if (err)
+		return err;
+
+	/* Got STOP event, treat it as EOF */
+	if (stopped)
+		return 0;
+
+	return (ssize_t) written;
+}
+
+static ssize_t writefd_aio(struct parser_pdata *pdata, const void *src,
 		size_t len)
 {
-	if (len > MAX_AIO_REQ_SIZE)
-		len = MAX_AIO_REQ_SIZE;
-	return async_io(pdata, (void *)dest, len, false);
+	struct iovec iov = {
+		.iov_base = (void *) src,
+		.iov_len = len,
+	};
+
+	return writevfd_aio(pdata, &iov, 1);
 }
 #endif /* WITH_AIO */
 
 static ssize_t readfd_io(struct parser_pdata *pdata, void *dest, size_t len)
 {
 	ssize_t ret;
+
+	/* Data already read by interpreter_fill() */
+	if (pdata->rx_pos < pdata->rx_len) {
+		if (len > pdata->rx_len - pdata->rx_pos)
+			len = pdata->rx_len - pdata->rx_pos;
+
+		memcpy(dest, pdata->rx_buf + pdata->rx_pos, len);
+		pdata->rx_pos += len;
+		return (ssize_t) len;
+	}
 	struct pollfd pfd[2];
 
 	pfd[0].fd = pdata->fd_in;
@@ -268,7 +606,88 @@ static ssize_t readfd_io(struct parser_pdata *pdata, void *dest, size_t len)
 	return ret;
 }
 
-static ssize_t writefd_io(struct parser_pdata *pdata, const void *src, size_t len)
+#ifdef SO_ZEROCOPY
+#include <linux/errqueue.h>
+
+/* Below this size, copying the data costs less than the page pinning and
+ * completion handling of MSG_ZEROCOPY */
+#define ZEROCOPY_MIN_LEN (16 * 1024)
+
+/* Reads the completions of the zero-copy sends available, without blocking;
+ * returns the number of them read, or a negative error code */
+static int reap_zerocopy(struct parser_pdata *pdata)
+{
+	int nb = 0;
+
+	while (true) {
+		char control[128];
+		struct msghdr msg = {
+			.msg_control = control,
+			.msg_controllen = sizeof(control),
+		};
+		struct cmsghdr *cm;
+
+		if (recvmsg(pdata->fd_out, &msg,
+					MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN ? nb : -errno;
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *serr =
+				(struct sock_extended_err *) CMSG_DATA(cm);
+
+			/* ee_data is the ID of the last send completed */
+			if (serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY &&
+					!serr->ee_errno) {
+				pdata->zc_done = serr->ee_data + 1;
+				nb++;
+			}
+		}
+	}
+}
+
+/* Returns true once the kernel released the pages of the zero-copy sends
+ * up to the one that set zc_sent to the given ID */
+static bool zerocopy_done(const struct parser_pdata *pdata, uint32_t id)
+{
+	return (int32_t) (pdata->zc_done - id) >= 0;
+}
+
+/* Waits until the kernel released the pages of the zero-copy sends up to
+ * the given ID, so that their data can be overwritten */
+static int wait_zerocopy(struct parser_pdata *pdata, uint32_t id)
+{
+	struct pollfd pfd[2];
+	int ret;
+
+	pfd[0].fd = pdata->fd_out;
+	pfd[0].events = 0; /* POLLERR is always reported */
+	pfd[1].fd = thread_pool_get_poll_fd(pdata->pool);
+	pfd[1].events = POLLIN;
+
+	while (!zerocopy_done(pdata, id)) {
+		ret = reap_zerocopy(pdata);
+		if (ret < 0)
+			return ret;
+		if (ret)
+			continue;
+
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		poll_nointr(pfd, 2);
+
+		if (pfd[1].revents & POLLIN || pfd[0].revents & POLLHUP)
+			return -EPIPE;
+	}
+
+	return 0;
+}
+#endif /* SO_ZEROCOPY */
+
+static ssize_t writevfd_io(struct parser_pdata *pdata,
+		const struct iovec *iov, int nb)
 {
 	ssize_t ret;
 	struct pollfd pfd[2];
@@ -286,16 +705,29 @@ static ssize_t writefd_io(struct parser_pdata *pdata, const void *src, size_t le
 		/* Got STOP event, or client closed the socket: treat it as EOF */
 		if (pfd[1].revents & POLLIN || pfd[0].revents & POLLHUP)
 			return 0;
-		if (pfd[0].revents & POLLERR)
+		if (pfd[0].revents & POLLERR) {
+#ifdef SO_ZEROCOPY
+			/* The completions of the zero-copy sends are reported
+			 * as errors */
+			if (pdata->zerocopy && reap_zerocopy(pdata) > 0)
+				continue;
+#endif
 			return -EIO;
+		}
 		if (!(pfd[0].revents & POLLOUT))
 			continue;
 
 		do {
-			if (pdata->fd_out_is_socket)
-				ret = send(pdata->fd_out, src, len, MSG_NOSIGNAL);
-			else
-				ret = write(pdata->fd_out, src, len);
+			if (pdata->fd_out_is_socket) {
+				struct msghdr msg = {
+					.msg_iov = (struct iovec *) iov,
+					.msg_iovlen = nb,
+				};
+
+				ret = sendmsg(pdata->fd_out, &msg, MSG_NOSIGNAL);
+			} else {
+				ret = writev(pdata->fd_out, iov, nb);
+			}
 		} while (ret == -1 && errno == EINTR);
 
 		if (ret != -1 || errno != EAGAIN)
@@ -305,9 +737,21 @@ static ssize_t writefd_io(struct parser_pdata *pdata, const void *src, size_t le
 	if (ret == -1)
 		return -errno;
 
+	pdata->tx_bytes += (uint64_t) ret;
+
 	return ret;
 }
 
+static ssize_t writefd_io(struct parser_pdata *pdata, const void *src, size_t len)
+{
+	struct iovec iov = {
+		.iov_base = (void *) src,
+		.iov_len = len,
+	};
+
+	return writevfd_io(pdata, &iov, 1);
+}
+
 ssize_t write_all(struct parser_pdata *pdata, const void *src, size_t len)
 {
 	uintptr_t ptr = (uintptr_t) src;
@@ -325,952 +769,3277 @@ ssize_t write_all(struct parser_pdata *pdata, const void *src, size_t len)
 	return ptr - (uintptr_t) src;
 }
 
-static ssize_t read_all(struct parser_pdata *pdata,
-		void *dst, size_t len)
+/*
+ * Writes the samples in chunks of stripe_size bytes, to each of the pipes
+ * in turn. With AIO, one chunk is written to each pipe at the same time, so
+ * that they all contribute to the bandwidth; otherwise, the chunks are
+ * written one after the other.
+ */
+static ssize_t write_striped(struct parser_pdata *pdata,
+		const void *src, size_t len)
 {
-	uintptr_t ptr = (uintptr_t) dst;
+	const uint8_t *ptr = src;
+	size_t done = 0, size;
+	unsigned int i;
+	ssize_t ret;
+	int fd;
 
-	while (len) {
-		ssize_t ret = pdata->readfd(pdata, (void *) ptr, len);
-		if (ret < 0)
-			return ret;
-		if (!ret)
-			return -EPIPE;
-		ptr += ret;
-		len -= ret;
-	}
+	while (done < len) {
+#if WITH_AIO
+		if (pdata->use_aio) {
+			struct iocb iocbs[IIOD_MAX_STRIPES];
+			struct iocb *ios[IIOD_MAX_STRIPES];
+			size_t sizes[IIOD_MAX_STRIPES];
+			long res[IIOD_MAX_STRIPES];
+			int err;
+
+			for (i = 0; i < pdata->nb_stripes && done < len; i++) {
+				size = len - done;
+				if (size > pdata->stripe_size)
+					size = pdata->stripe_size;
+
+				fd = i ? pdata->stripe_fds[i - 1] : pdata->fd_out;
+				io_prep_pwrite(&iocbs[i], fd,
+						(void *) (ptr + done), size, 0);
+				ios[i] = &iocbs[i];
+				sizes[i] = size;
+				done += size;
+			}
 
-	return ptr - (uintptr_t) dst;
-}
+			err = async_io_wait(pdata, ios, res, i);
+			if (err < 0)
+				return err;
+			if (err)
+				return -EPIPE;
+
+			while (i--) {
+				if (res[i] < 0)
+					return res[i];
+				if ((size_t) res[i] != sizes[i])
+					return -EPIPE;
+			}
 
-static void print_value(struct parser_pdata *pdata, long value)
-{
-	if (pdata->verbose && value < 0) {
-		char buf[1024];
-		iio_strerror(-value, buf, sizeof(buf));
-		output(pdata, "ERROR: ");
-		output(pdata, buf);
-		output(pdata, "\n");
-	} else {
-		char buf[128];
-		iio_snprintf(buf, sizeof(buf), "%li\n", value);
-		output(pdata, buf);
+			continue;
+		}
+#endif
+		for (i = 0; i < pdata->nb_stripes && done < len; i++) {
+			size = len - done;
+			if (size > pdata->stripe_size)
+				size = pdata->stripe_size;
+
+			if (!i) {
+				ret = write_all(pdata, ptr + done, size);
+				if (ret < 0)
+					return ret;
+				done += size;
+				continue;
+			}
+
+			fd = pdata->stripe_fds[i - 1];
+
+			while (size) {
+				ret = write(fd, ptr + done, size);
+				if (ret < 0 && errno == EINTR)
+					continue;
+				if (ret < 0)
+					return -errno;
+				if (!ret)
+					return -EPIPE;
+
+				done += (size_t) ret;
+				size -= (size_t) ret;
+			}
+		}
 	}
+
+	return (ssize_t) len;
 }
 
-static ssize_t send_sample(const struct iio_channel *chn,
-		void *src, size_t length, void *d)
+static ssize_t writev_all(struct parser_pdata *pdata,
+		struct iovec *iov, unsigned int nb)
 {
-	struct sample_cb_info *info = d;
-	if (chn->index < 0 || !TEST_BIT(info->mask, chn->number))
-		return 0;
-	if (info->nb_bytes < length)
-		return 0;
-
-	if (info->cpt % length) {
-		unsigned int i, goal = length - info->cpt % length;
-		char zero = 0;
-		ssize_t ret;
+	size_t total = 0;
+	ssize_t ret;
 
-		for (i = 0; i < goal; i++) {
-			ret = info->pdata->writefd(info->pdata, &zero, 1);
+	if (!pdata->writevfd) {
+		for (; nb; iov++, nb--) {
+			ret = write_all(pdata, iov->iov_base, iov->iov_len);
 			if (ret < 0)
 				return ret;
+			total += (size_t) ret;
 		}
-		info->cpt += goal;
+
+		return (ssize_t) total;
 	}
 
-	info->cpt += length;
-	info->nb_bytes -= length;
-	return write_all(info->pdata, src, length);
-}
+	while (nb) {
+		size_t written;
 
-static ssize_t receive_sample(const struct iio_channel *chn,
-		void *dst, size_t length, void *d)
-{
-	struct sample_cb_info *info = d;
-	if (chn->index < 0 || !TEST_BIT(info->mask, chn->number))
-		return 0;
-	if (info->cpt == info->nb_bytes)
-		return 0;
+		ret = pdata->writevfd(pdata, iov, (int) nb);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return -EPIPE;
 
-	/* Skip the padding if needed */
-	if (info->cpt % length) {
-		unsigned int i, goal = length - info->cpt % length;
-		char foo;
-		ssize_t ret;
+		total += (size_t) ret;
 
-		for (i = 0; i < goal; i++) {
-			ret = info->pdata->readfd(info->pdata, &foo, 1);
-			if (ret < 0)
-				return ret;
+		/* Skip the elements fully written, and adjust the first
+		 * element partially written */
+		for (written = (size_t) ret; nb && written >= iov->iov_len;
+				iov++, nb--)
+			written -= iov->iov_len;
+
+		if (nb) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
 		}
-		info->cpt += goal;
 	}
 
-	info->cpt += length;
-	return read_all(info->pdata, dst, length);
+	return (ssize_t) total;
 }
 
-static ssize_t send_data(struct DevEntry *dev, struct ThdEntry *thd, size_t len)
-{
-	struct parser_pdata *pdata = thd->pdata;
-	bool demux = server_demux && dev->sample_size != thd->sample_size;
-
-	if (demux)
-		len = (len / dev->sample_size) * thd->sample_size;
-	if (len > thd->nb)
-		len = thd->nb;
-
-	print_value(pdata, len);
-
-	if (thd->new_client) {
-		unsigned int i;
-		char buf[129], *ptr = buf;
-		uint32_t *mask = demux ? thd->mask : dev->mask;
-		ssize_t ret, len;
-
-		len = sizeof(buf);
-		/* Send the current mask */
-		for (i = dev->nb_words; i > 0 && ptr < buf + sizeof(buf);
-				i--, ptr += 8) {
-			iio_snprintf(ptr, len, "%08x", mask[i - 1]);
-			len -= 8;
-		}
-
-		*ptr = '\n';
-		len--;
+/* Upper bound of the size of the splice pipe; this is the default maximum
+ * for unprivileged processes (/proc/sys/fs/pipe-max-size) */
+#define SPLICE_PIPE_SIZE (1024 * 1024)
 
-		if (len < 0) {
-			IIO_ERROR("send_data: string length error\n");
-			return -ENOSPC;
-		}
+/* Below this size, copying the data costs less than mapping its pages */
+#define SPLICE_MIN_LEN (16 * 1024)
 
-		ret = write_all(pdata, buf, ptr + 1 - buf);
-		if (ret < 0)
-			return ret;
+static int setup_splice_pipe(struct parser_pdata *pdata)
+{
+	if (pdata->splice_fds[0] >= 0)
+		return 0;
 
-		thd->new_client = false;
-	}
+	if (pipe2(pdata->splice_fds, O_CLOEXEC) < 0)
+		return -errno;
 
-	if (!demux) {
-		/* Short path */
-		return write_all(pdata, dev->buf->buffer, len);
-	} else {
-		struct sample_cb_info info = {
-			.pdata = pdata,
-			.cpt = 0,
-			.nb_bytes = len,
-			.mask = thd->mask,
-		};
+#ifdef F_SETPIPE_SZ
+	/* The default pipe size (64 KiB) is used if the limit of the system
+	 * is lower */
+	fcntl(pdata->splice_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+#endif
 
-		return iio_buffer_foreach_sample(dev->buf, send_sample, &info);
-	}
+	return 0;
 }
 
-static ssize_t receive_data(struct DevEntry *dev, struct ThdEntry *thd)
+static void close_splice_pipe(struct parser_pdata *pdata)
 {
-	struct parser_pdata *pdata = thd->pdata;
-
-	/* Inform that no error occurred, and that we'll start reading data */
-	if (thd->new_client) {
-		print_value(thd->pdata, 0);
-		thd->new_client = false;
+	if (pdata->splice_fds[0] >= 0) {
+		close(pdata->splice_fds[0]);
+		close(pdata->splice_fds[1]);
 	}
 
-	if (dev->sample_size == thd->sample_size) {
-		/* Short path: Receive directly in the buffer */
+	pdata->splice_fds[0] = -1;
+	pdata->splice_fds[1] = -1;
+}
 
-		size_t len = dev->buf->length;
-		if (thd->nb < len)
-			len = thd->nb;
+/* Polling period while waiting for the client to acknowledge spliced data,
+ * which the socket does not notify */
+#define SPLICE_POLL_NS (100 * 1000)
 
-		return read_all(pdata, dev->buf->buffer, len);
-	} else {
-		/* Long path: Mux the samples to the buffer */
+/* Returns true once the client acknowledged the data written to the socket
+ * up to the given offset of the stream: the socket then dropped its
+ * references to the pages spliced before it */
+static bool splice_done(const struct parser_pdata *pdata, uint64_t end)
+{
+	int outq;
 
-		struct sample_cb_info info = {
-			.pdata = pdata,
-			.cpt = 0,
-			.nb_bytes = thd->nb,
-			.mask = thd->mask,
-		};
+	/* Number of bytes written and not acknowledged yet; the socket is
+	 * not usable anymore if it cannot be read */
+	if (ioctl(pdata->fd_out, SIOCOUTQ, &outq) < 0)
+		return true;
 
-		return iio_buffer_foreach_sample(dev->buf,
-				receive_sample, &info);
-	}
+	return (int64_t) (pdata->tx_bytes - (uint64_t) outq - end) >= 0;
 }
 
-static void dev_entry_put(struct DevEntry *entry)
+/* Waits until the pages spliced up to the given offset of the stream were
+ * released by the socket, so that their data can be overwritten */
+static int wait_splice(struct parser_pdata *pdata, uint64_t end)
 {
-	bool free_entry = false;
+	const struct timespec ts = { .tv_nsec = SPLICE_POLL_NS };
+	struct pollfd pfd[2];
 
-	pthread_mutex_lock(&entry->thdlist_lock);
-	entry->ref_count--;
-	if (entry->ref_count == 0)
-		free_entry = true;
-	pthread_mutex_unlock(&entry->thdlist_lock);
+	pfd[0].fd = pdata->fd_out;
+	pfd[0].events = 0; /* POLLERR and POLLHUP are always reported */
+	pfd[1].fd = thread_pool_get_poll_fd(pdata->pool);
+	pfd[1].events = POLLIN;
 
-	if (free_entry) {
-		pthread_mutex_destroy(&entry->thdlist_lock);
-		pthread_cond_destroy(&entry->rw_ready_cond);
+	while (!splice_done(pdata, end)) {
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
 
-		free(entry->mask);
-		free(entry);
+		if (ppoll(pfd, 2, &ts, NULL) < 0 && errno != EINTR)
+			return -errno;
+
+		if (pfd[1].revents & POLLIN || pfd[0].revents & POLLHUP)
+			return -EPIPE;
+		if (pfd[0].revents & POLLERR) {
+#ifdef SO_ZEROCOPY
+			if (pdata->zerocopy && reap_zerocopy(pdata) > 0)
+				continue;
+#endif
+			return -EIO;
+		}
 	}
-}
 
-static void signal_thread(struct ThdEntry *thd, ssize_t ret)
-{
-	thd->err = ret;
-	thd->nb = 0;
-	thd->active = false;
-	thd_entry_event_signal(thd);
+	return 0;
 }
 
-static void rw_thd(struct thread_pool *pool, void *d)
+/*
+ * Sends the data to the socket without copying it: its pages are mapped into
+ * a pipe with vmsplice(), then moved to the socket with splice(). The socket
+ * keeps references to the pages until the client acknowledged the data, so
+ * the memory must not be written again before splice_done() returns true for
+ * the value of pdata->splice_end on return. Memory that cannot be spliced,
+ * like the one of a device, is copied instead.
+ */
+static ssize_t splice_all(struct parser_pdata *pdata,
+		const void *src, size_t len)
 {
-	struct DevEntry *entry = d;
-	struct ThdEntry *thd, *next_thd;
-	struct iio_device *dev = entry->dev;
-	unsigned int nb_words = entry->nb_words;
-	ssize_t ret = 0;
-
-	IIO_DEBUG("R/W thread started for device %s\n",
-			dev->name ? dev->name : dev->id);
+	struct iovec iov = {
+		.iov_base = (void *) src,
+		.iov_len = len,
+	};
+	size_t write_len = 0;
+	struct pollfd pfd[2];
+	ssize_t ret;
 
-	while (true) {
-		bool has_readers = false, has_writers = false,
-		     mask_updated = false;
-		unsigned int sample_size;
+	ret = setup_splice_pipe(pdata);
+	if (ret < 0)
+		return ret;
 
-		/* NOTE: this while loop must exit with thdlist_lock locked. */
-		pthread_mutex_lock(&entry->thdlist_lock);
+	pfd[0].fd = pdata->fd_out;
+	pfd[0].events = POLLOUT;
+	pfd[0].revents = 0;
+	pfd[1].fd = thread_pool_get_poll_fd(pdata->pool);
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
 
-		if (SLIST_EMPTY(&entry->thdlist_head))
-			break;
+	while (iov.iov_len || write_len) {
+		if (iov.iov_len) {
+			ret = vmsplice(pdata->splice_fds[1], &iov, 1,
+					SPLICE_F_NONBLOCK);
+			if (ret < 0 && errno == EFAULT && iov.iov_len == len)
+				return write_all(pdata, src, len);
+			if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+				ret = -errno;
+				goto err_close_pipe;
+			} else if (ret > 0) {
+				iov.iov_base = (char *) iov.iov_base + ret;
+				iov.iov_len -= (size_t) ret;
+				write_len += (size_t) ret;
+			}
+		}
 
-		if (entry->update_mask) {
-			unsigned int i;
-			unsigned int samples_count = 0;
+		if (!write_len)
+			continue;
 
-			memset(entry->mask, 0, nb_words * sizeof(*entry->mask));
-			SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
-				for (i = 0; i < nb_words; i++)
-					entry->mask[i] |= thd->mask[i];
+		ret = splice(pdata->splice_fds[0], NULL, pdata->fd_out, NULL,
+				write_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK |
+				(iov.iov_len ? SPLICE_F_MORE : 0));
+		if (!ret) {
+			ret = -EPIPE;
+			goto err_close_pipe;
+		} else if (ret > 0) {
+			write_len -= (size_t) ret;
+			pdata->tx_bytes += (uint64_t) ret;
+			continue;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (errno != EAGAIN) {
+			ret = -errno;
+			goto err_close_pipe;
+		}
 
-				if (thd->samples_count > samples_count)
-					samples_count = thd->samples_count;
-			}
+		/* The socket is full */
+		poll_nointr(pfd, 2);
 
-			if (entry->buf)
-				iio_buffer_destroy(entry->buf);
+		/* Got STOP event, or client closed the socket */
+		if (pfd[1].revents & POLLIN || pfd[0].revents & POLLHUP) {
+			ret = -EPIPE;
+			goto err_close_pipe;
+		}
+		if (pfd[0].revents & POLLERR) {
+#ifdef SO_ZEROCOPY
+			/* The completions of the zero-copy sends are reported
+			 * as errors */
+			if (pdata->zerocopy && reap_zerocopy(pdata) > 0)
+				continue;
+#endif
+			ret = -EIO;
+			goto err_close_pipe;
+		}
+	}
 
-			for (i = 0; i < dev->nb_channels; i++) {
-				struct iio_channel *chn = dev->channels[i];
-				long index = chn->index;
+	pdata->splice_end = pdata->tx_bytes;
 
-				if (index < 0)
-					continue;
+	return (ssize_t) len;
 
-				if (TEST_BIT(entry->mask, chn->number))
-					iio_channel_enable(chn);
-				else
-					iio_channel_disable(chn);
-			}
+err_close_pipe:
+	/* Whatever is left in the pipe is garbage now */
+	close_splice_pipe(pdata);
+	return ret;
+}
 
-			entry->buf = iio_device_create_buffer(dev,
-					samples_count, entry->cyclic);
-			if (!entry->buf) {
-				ret = -errno;
-				IIO_ERROR("Unable to create buffer\n");
-				break;
-			}
-			entry->cancelled = false;
+#ifdef SO_ZEROCOPY
+/*
+ * Sends the data with MSG_ZEROCOPY, without waiting for the kernel to
+ * release its pages: the memory must not be written again before
+ * zerocopy_done() returns true for the value of pdata->zc_sent on return.
+ */
+static ssize_t zerocopy_all(struct parser_pdata *pdata,
+		const void *src, size_t len)
+{
+	const char *ptr = src;
+	size_t done = 0;
+	struct pollfd pfd[2];
+	ssize_t ret;
 
-			/* Signal the threads that we opened the device */
-			SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
-				if (thd->wait_for_open) {
-					thd->wait_for_open = false;
-					signal_thread(thd, 0);
-				}
-			}
+	pfd[0].fd = pdata->fd_out;
+	pfd[0].events = POLLOUT;
+	pfd[1].fd = thread_pool_get_poll_fd(pdata->pool);
+	pfd[1].events = POLLIN;
 
-			IIO_DEBUG("IIO device %s reopened with new mask:\n",
-					dev->id);
-			for (i = 0; i < nb_words; i++)
-				IIO_DEBUG("Mask[%i] = 0x%08x\n", i, entry->mask[i]);
-			entry->update_mask = false;
+	while (done < len) {
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		poll_nointr(pfd, 2);
 
-			entry->sample_size = iio_device_get_sample_size(dev);
-			mask_updated = true;
+		/* Got STOP event, or client closed the socket */
+		if (pfd[1].revents & POLLIN || pfd[0].revents & POLLHUP)
+			return -EPIPE;
+		if (pfd[0].revents & POLLERR) {
+			/* The completions of the zero-copy sends are reported
+			 * as errors */
+			if (reap_zerocopy(pdata) > 0)
+				continue;
+			return -EIO;
 		}
+		if (!(pfd[0].revents & POLLOUT))
+			continue;
 
-		sample_size = entry->sample_size;
-
-		SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
-			thd->active = !thd->err && thd->nb >= sample_size;
-			if (mask_updated && thd->active)
-				signal_thread(thd, thd->nb);
+		do {
+			ret = send(pdata->fd_out, ptr + done, len - done,
+					MSG_NOSIGNAL | MSG_ZEROCOPY);
+		} while (ret == -1 && errno == EINTR);
 
-			if (thd->is_writer)
-				has_writers |= thd->active;
-			else
-				has_readers |= thd->active;
+		if (ret > 0) {
+			pdata->zc_sent++;
+			pdata->tx_bytes += (uint64_t) ret;
+			done += (size_t) ret;
+		} else if (!ret) {
+			return -EPIPE;
+		} else if (errno == ENOBUFS || errno == EFAULT) {
+			/* The limit of pinned pages was reached, or the pages
+			 * cannot be pinned, like the ones of a device */
+			ret = write_all(pdata, ptr + done, len - done);
+			if (ret < 0)
+				return ret;
+			break;
+		} else if (errno != EAGAIN) {
+			return -errno;
 		}
+	}
 
-		if (!has_readers && !has_writers) {
-			pthread_cond_wait(&entry->rw_ready_cond,
-					&entry->thdlist_lock);
-		}
+	return (ssize_t) len;
+}
+#endif /* SO_ZEROCOPY */
+
+/* Sends one response frame of the binary protocol. If send_last is set,
+ * the last element of the payload is sent with it instead of being copied
+ * to the socket; see splice_all() and zerocopy_all(). */
+static ssize_t do_send_frame(struct parser_pdata *pdata, long code,
+		uint32_t flags, const struct iovec *iov, unsigned int nb,
+		ssize_t (*send_last)(struct parser_pdata *, const void *, size_t))
+{
+	struct iiod_frame_header hdr;
+	struct iovec vec[5];
+	size_t len = 0;
+	unsigned int i;
+	ssize_t ret;
+	uint32_t crc;
 
-		pthread_mutex_unlock(&entry->thdlist_lock);
+	if (nb >= ARRAY_SIZE(vec) - 1)
+		return -EINVAL;
 
-		if (!has_readers && !has_writers)
-			continue;
+	for (i = 0; i < nb; i++) {
+		vec[i + 1] = iov[i];
+		len += iov[i].iov_len;
+	}
 
-		if (has_readers) {
-			ssize_t nb_bytes;
+	if (pdata->crc)
+		flags |= IIOD_FRAME_CRC;
 
-			ret = iio_buffer_refill(entry->buf);
+	hdr.tag = iio_htobe32(pdata->tag);
+	hdr.code = (int32_t) iio_htobe32((uint32_t) code);
+	hdr.len = iio_htobe32((uint32_t) len);
+	hdr.flags = iio_htobe32(flags);
 
-			pthread_mutex_lock(&entry->thdlist_lock);
+	vec[0].iov_base = &hdr;
+	vec[0].iov_len = sizeof(hdr);
 
-			/*
-			 * When the last client disconnects the buffer is
-			 * cancelled and iio_buffer_refill() returns an error. A
-			 * new client might have connected before we got here
-			 * though, in that case the rw thread has to stay active
-			 * and a new buffer is created. If the list is still empty the loop
-			 * will exit normally.
-			 */
-			if (entry->cancelled) {
-				pthread_mutex_unlock(&entry->thdlist_lock);
-				continue;
-			}
+	if (pdata->crc) {
+		crc = iiod_crc32(0, &hdr, sizeof(hdr));
+		for (i = 0; i < nb; i++)
+			crc = iiod_crc32(crc, iov[i].iov_base, iov[i].iov_len);
 
-			if (ret < 0) {
-				IIO_ERROR("Reading from device failed: %i\n",
-						(int) ret);
-				break;
-			}
+		crc = iio_htobe32(crc);
+		vec[nb + 1].iov_base = &crc;
+		vec[nb + 1].iov_len = sizeof(crc);
+	}
 
-			nb_bytes = ret;
+	if (!send_last || !nb)
+		return writev_all(pdata, vec, nb + 1 + pdata->crc);
 
-			/* We don't use SLIST_FOREACH here. As soon as a thread is
-			 * signaled, its "thd" structure might be freed;
-			 * SLIST_FOREACH would then cause a segmentation fault, as it
-			 * reads "thd" to get the address of the next element. */
-			for (thd = SLIST_FIRST(&entry->thdlist_head);
-					thd; thd = next_thd) {
-				next_thd = SLIST_NEXT(thd, dev_list_entry);
-
-				if (!thd->active || thd->is_writer)
-					continue;
+	ret = writev_all(pdata, vec, nb);
+	if (ret < 0)
+		return ret;
 
-				ret = send_data(entry, thd, nb_bytes);
-				if (ret > 0)
-					thd->nb -= ret;
+	ret = send_last(pdata, vec[nb].iov_base, vec[nb].iov_len);
+	if (ret < 0)
+		return ret;
 
-				if (ret < 0 || thd->nb < sample_size)
-					signal_thread(thd, (ret < 0) ?
-							ret : (ssize_t) thd->nb);
-			}
+	len += sizeof(hdr);
 
-			pthread_mutex_unlock(&entry->thdlist_lock);
-		}
+	if (pdata->crc) {
+		ret = write_all(pdata, &crc, sizeof(crc));
+		if (ret < 0)
+			return ret;
 
-		if (has_writers) {
-			ssize_t nb_bytes = 0;
+		len += sizeof(crc);
+	}
 
-			pthread_mutex_lock(&entry->thdlist_lock);
+	return (ssize_t) len;
+}
 
-			/* Reset the size of the buffer to its maximum size */
-			entry->buf->data_length = entry->buf->length;
+static ssize_t send_frame(struct parser_pdata *pdata, long code,
+		uint32_t flags, const struct iovec *iov, unsigned int nb)
+{
+	return do_send_frame(pdata, code, flags, iov, nb, NULL);
+}
 
-			/* Same comment as above */
-			for (thd = SLIST_FIRST(&entry->thdlist_head);
-					thd; thd = next_thd) {
-				next_thd = SLIST_NEXT(thd, dev_list_entry);
+static ssize_t readfd_all(struct parser_pdata *pdata, void *dst, size_t len)
+{
+	uintptr_t ptr = (uintptr_t) dst;
 
-				if (!thd->active || !thd->is_writer)
-					continue;
+	while (len) {
+		ssize_t ret = pdata->readfd(pdata, (void *) ptr, len);
+		if (ret <= 0)
+			return ret;
+		ptr += ret;
+		len -= ret;
+	}
 
-				ret = receive_data(entry, thd);
-				if (ret > 0) {
-					thd->nb -= ret;
-					if (ret > nb_bytes)
-						nb_bytes = ret;
-				}
+	return ptr - (uintptr_t) dst;
+}
 
-				if (ret < 0)
-					signal_thread(thd, ret);
-			}
+/* Reads the CRC following the payload of the current request frame, if it
+ * has one */
+static int check_frame_crc(struct parser_pdata *pdata)
+{
+	uint32_t crc;
+	ssize_t ret;
 
-			ret = iio_buffer_push_partial(entry->buf,
-				nb_bytes / sample_size);
-			if (entry->cancelled) {
-				pthread_mutex_unlock(&entry->thdlist_lock);
-				continue;
-			}
-			if (ret < 0) {
-				IIO_ERROR("Writing to device failed: %i\n",
-						(int) ret);
-				break;
-			}
+	if (!pdata->frame_has_crc)
+		return 0;
 
-			/* Signal threads which completed their RW command */
-			for (thd = SLIST_FIRST(&entry->thdlist_head);
-					thd; thd = next_thd) {
-				next_thd = SLIST_NEXT(thd, dev_list_entry);
-				if (thd->active && thd->is_writer &&
-						thd->nb < sample_size)
-					signal_thread(thd, thd->nb);
-			}
+	ret = readfd_all(pdata, &crc, sizeof(crc));
+	if (ret < 0)
+		return (int) ret;
+	if (ret != sizeof(crc))
+		return -EPIPE;
 
-			pthread_mutex_unlock(&entry->thdlist_lock);
-		}
+	if (iio_be32toh(crc) != pdata->frame_crc) {
+		IIO_ERROR("CRC mismatch on request frame %u\n", pdata->tag);
+		return -EIO;
 	}
 
-	/* Signal all remaining threads */
-	for (thd = SLIST_FIRST(&entry->thdlist_head); thd; thd = next_thd) {
-		next_thd = SLIST_NEXT(thd, dev_list_entry);
-		SLIST_REMOVE(&entry->thdlist_head, thd, ThdEntry, dev_list_entry);
-		thd->wait_for_open = false;
-		signal_thread(thd, ret);
-	}
-	if (entry->buf) {
-		iio_buffer_destroy(entry->buf);
-		entry->buf = NULL;
-	}
-	entry->closed = true;
-	pthread_mutex_unlock(&entry->thdlist_lock);
+	return 0;
+}
 
-	pthread_mutex_lock(&devlist_lock);
-	/* It is possible that a new thread has already started, make sure to
-	 * not overwrite it. */
-	if (iio_device_get_data(dev) == entry)
-		iio_device_set_data(dev, NULL);
-	pthread_mutex_unlock(&devlist_lock);
+/* Reads the payload of the request frames of the binary protocol, as if
+ * it were one stream; the headers are consumed when needed */
+static ssize_t read_frame_data(struct parser_pdata *pdata,
+		void *dst, size_t len)
+{
+	ssize_t ret;
 
-	IIO_DEBUG("Stopping R/W thread for device %s\n",
-			dev->name ? dev->name : dev->id);
+	while (!pdata->frame_left) {
+		struct iiod_frame_header hdr;
 
-	dev_entry_put(entry);
-}
+		ret = readfd_all(pdata, &hdr, sizeof(hdr));
+		if (ret <= 0)
+			return ret;
 
-static struct ThdEntry *parser_lookup_thd_entry(struct parser_pdata *pdata,
-	struct iio_device *dev)
-{
-	struct ThdEntry *t;
+		pdata->tag = iio_be32toh(hdr.tag);
+		pdata->frame_left = iio_be32toh(hdr.len);
+		pdata->frame_has_crc = !!(iio_be32toh(hdr.flags) &
+				IIOD_FRAME_CRC);
 
-	SLIST_FOREACH(t, &pdata->thdlist_head, parser_list_entry) {
-		if (t->dev == dev)
-			return t;
+		/* Once negotiated, frames without a CRC are not trusted */
+		if (pdata->crc && !pdata->frame_has_crc)
+			return -EIO;
+
+		pdata->frame_crc = iiod_crc32(0, &hdr, sizeof(hdr));
+
+		if (!pdata->frame_left) {
+			ret = check_frame_crc(pdata);
+			if (ret < 0)
+				return ret;
+		}
 	}
 
-	return NULL;
-}
+	if (len > pdata->frame_left)
+		len = pdata->frame_left;
 
-static ssize_t rw_buffer(struct parser_pdata *pdata,
-		struct iio_device *dev, unsigned int nb, bool is_write)
-{
-	struct DevEntry *entry;
-	struct ThdEntry *thd;
-	ssize_t ret;
+	ret = pdata->readfd(pdata, dst, len);
+	if (ret <= 0)
+		return ret;
 
-	if (!dev)
-		return -ENODEV;
+	pdata->frame_left -= (size_t) ret;
 
-	thd = parser_lookup_thd_entry(pdata, dev);
-	if (!thd)
-		return -EBADF;
+	if (pdata->frame_has_crc) {
+		pdata->frame_crc = iiod_crc32(pdata->frame_crc, dst, ret);
 
-	entry = thd->entry;
+		if (!pdata->frame_left) {
+			len = (size_t) ret;
 
-	if (nb < entry->sample_size)
-		return 0;
+			ret = check_frame_crc(pdata);
+			if (ret < 0)
+				return ret;
 
-	pthread_mutex_lock(&entry->thdlist_lock);
-	if (entry->closed) {
-		pthread_mutex_unlock(&entry->thdlist_lock);
-		return -EBADF;
+			ret = (ssize_t) len;
+		}
 	}
 
-	if (thd->nb) {
-		pthread_mutex_unlock(&entry->thdlist_lock);
-		return -EBUSY;
-	}
+	return ret;
+}
 
-	thd->new_client = true;
-	thd->nb = nb;
-	thd->err = 0;
-	thd->is_writer = is_write;
-	thd->active = true;
+static ssize_t read_input(struct parser_pdata *pdata, void *dst, size_t len)
+{
+	if (pdata->binary)
+		return read_frame_data(pdata, dst, len);
+	else
+		return pdata->readfd(pdata, dst, len);
+}
 
-	pthread_cond_signal(&entry->rw_ready_cond);
+static ssize_t read_buffered(struct parser_pdata *pdata,
+		void *dst, size_t len)
+{
+	size_t avail = pdata->in_buf_len - pdata->in_buf_pos;
 
-	IIO_DEBUG("Waiting for completion...\n");
-	while (thd->active) {
-		ret = thd_entry_event_wait(thd, &entry->thdlist_lock, pdata->fd_in);
-		if (ret)
-			break;
-	}
-	if (ret == 0)
-		ret = thd->err;
-	pthread_mutex_unlock(&entry->thdlist_lock);
+	if (!avail)
+		return read_input(pdata, dst, len);
 
-	if (ret > 0 && ret < (ssize_t) nb)
-		print_value(thd->pdata, 0);
+	if (len > avail)
+		len = avail;
 
-	IIO_DEBUG("Exiting rw_buffer with code %li\n", (long) ret);
-	if (ret < 0)
-		return ret;
-	else
-		return nb - ret;
+	memcpy(dst, pdata->in_buf + pdata->in_buf_pos, len);
+	pdata->in_buf_pos += len;
+	return (ssize_t) len;
 }
 
-static uint32_t *get_mask(const char *mask, size_t *len)
+static ssize_t read_all(struct parser_pdata *pdata,
+		void *dst, size_t len)
 {
-	size_t nb = (*len + 7) / 8;
-	uint32_t *ptr, *words = calloc(nb, sizeof(*words));
-	if (!words)
-		return NULL;
+	uintptr_t ptr = (uintptr_t) dst;
 
-	ptr = words + nb;
-	while (*mask) {
-		char buf[9];
-		iio_snprintf(buf, sizeof(buf), "%.*s", 8, mask);
-		sscanf(buf, "%08x", --ptr);
-		mask += 8;
-		IIO_DEBUG("Mask[%lu]: 0x%08x\n",
-				(unsigned long) (words - ptr) / 4, *ptr);
+	while (len) {
+		ssize_t ret = read_buffered(pdata, (void *) ptr, len);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return -EPIPE;
+		ptr += ret;
+		len -= ret;
 	}
 
-	*len = nb;
-	return words;
+	return ptr - (uintptr_t) dst;
 }
 
-static void free_thd_entry(struct ThdEntry *t)
+static void print_value(struct parser_pdata *pdata, long value)
 {
-	close(t->eventfd);
-	free(t->mask);
-	free(t);
+	if (pdata->binary) {
+		if (send_frame(pdata, value, 0, NULL, 0) <= 0)
+			pdata->stop = true;
+	} else if (pdata->verbose && value < 0) {
+		char buf[1024];
+		iio_strerror(-value, buf, sizeof(buf));
+		output(pdata, "ERROR: ");
+		output(pdata, buf);
+		output(pdata, "\n");
+	} else {
+		char buf[128];
+		iio_snprintf(buf, sizeof(buf), "%li\n", value);
+		output(pdata, buf);
+	}
 }
 
-static void remove_thd_entry(struct ThdEntry *t)
+ssize_t send_response(struct parser_pdata *pdata, long code,
+		const struct iovec *iov, unsigned int nb)
 {
-	struct DevEntry *entry = t->entry;
+	ssize_t ret, total = 0;
+	unsigned int i;
 
-	pthread_mutex_lock(&entry->thdlist_lock);
-	if (!entry->closed) {
-		entry->update_mask = true;
-		SLIST_REMOVE(&entry->thdlist_head, t, ThdEntry, dev_list_entry);
-		if (SLIST_EMPTY(&entry->thdlist_head) && entry->buf) {
-			entry->cancelled = true;
-			iio_buffer_cancel(entry->buf); /* Wakeup the rw thread */
-		}
+	if (pdata->binary)
+		return send_frame(pdata, code, 0, iov, nb);
 
-		pthread_cond_signal(&entry->rw_ready_cond);
+	print_value(pdata, code);
+
+	for (i = 0; i < nb; i++) {
+		ret = write_all(pdata, iov[i].iov_base, iov[i].iov_len);
+		if (ret < 0)
+			return ret;
+		total += ret;
 	}
-	pthread_mutex_unlock(&entry->thdlist_lock);
-	dev_entry_put(entry);
 
-	free_thd_entry(t);
+	return total;
 }
 
-static int open_dev_helper(struct parser_pdata *pdata, struct iio_device *dev,
-		size_t samples_count, const char *mask, bool cyclic)
+/*
+ * Returns the offset of the given channel within one sample of the client's
+ * layout, using the same rules as iio_device_get_sample_size_mask(); or -1
+ * if the client did not enable this channel.
+ */
+static int get_client_offset(struct block_cb_info *info,
+		const struct iio_channel *chn)
 {
-	int ret = -ENOMEM;
-	struct DevEntry *entry;
-	struct ThdEntry *thd;
-	size_t len = strlen(mask);
-	uint32_t *words;
-	unsigned int nb_channels;
-	unsigned int cyclic_retry = 500;
+	unsigned int length = chn->format.length / 8 * chn->format.repeat;
 
-	if (!dev)
-		return -ENODEV;
+	if (chn->index < 0 || !TEST_BIT(info->mask, chn->number))
+		return -1;
 
-	nb_channels = dev->nb_channels;
-	if (len != ((nb_channels + 31) / 32) * 8)
-		return -EINVAL;
+	if (!info->prev || info->prev->index != chn->index) {
+		if (info->cpt % length)
+			info->cpt += length - info->cpt % length;
+		info->prev_offset = info->cpt;
+		info->cpt += length;
+	}
 
-	words = get_mask(mask, &len);
-	if (!words)
-		return -ENOMEM;
+	info->prev = chn;
+	return (int) info->prev_offset;
+}
 
-	thd = zalloc(sizeof(*thd));
-	if (!thd)
+static ssize_t demux_block(const struct iio_channel *chn,
+		void *src, ptrdiff_t step, size_t count, void *d)
+{
+	struct block_cb_info *info = d;
+	unsigned int length = chn->format.length / 8 * chn->format.repeat;
+	int offset = get_client_offset(info, chn);
+	const uint8_t *ptr = src;
+	uint8_t *dst;
+	size_t i;
+
+	if (offset < 0)
+		return 0;
+	if (count > info->count)
+		count = info->count;
+
+	dst = info->buf + offset;
+	for (i = 0; i < count; i++)
+		memcpy(dst + i * info->sample_size, ptr + i * step, length);
+	return (ssize_t) (count * length);
+}
+
+static ssize_t mux_block(const struct iio_channel *chn,
+		void *dst, ptrdiff_t step, size_t count, void *d)
+{
+	struct block_cb_info *info = d;
+	unsigned int length = chn->format.length / 8 * chn->format.repeat;
+	int offset = get_client_offset(info, chn);
+	const uint8_t *src;
+	uint8_t *ptr = dst;
+	size_t i;
+
+	if (offset < 0)
+		return 0;
+	if (count > info->count)
+		count = info->count;
+
+	src = info->buf + offset;
+	for (i = 0; i < count; i++)
+		memcpy(ptr + i * step, src + i * info->sample_size, length);
+	return (ssize_t) (count * length);
+}
+
+/* Same as iio_buffer_foreach_block(demux_block), for the layout the samples
+ * of the block were read with */
+static ssize_t demux_dev_block(const struct iio_device *dev,
+		const struct dev_block *blk, struct block_cb_info *info)
+{
+	struct block_cb_info src = { .mask = (uint32_t *) blk->mask, };
+	size_t count = blk->len / blk->sample_size;
+	ssize_t ret, processed = 0;
+	unsigned int i;
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		const struct iio_channel *chn = dev->channels[i];
+		int offset;
+
+		if (chn->index < 0)
+			break;
+
+		offset = get_client_offset(&src, chn);
+		if (offset < 0)
+			continue;
+
+		ret = demux_block(chn, (uint8_t *) blk->data + offset,
+				(ptrdiff_t) blk->sample_size, count, info);
+		if (ret < 0)
+			return ret;
+
+		processed += ret;
+	}
+
+	return processed;
+}
+
+static void * thd_entry_get_demux_buf(struct ThdEntry *thd, size_t len)
+{
+	if (len > thd->demux_buf_size) {
+		/* Zero-filled, as the padding bytes are never written */
+		free(thd->demux_buf);
+		thd->demux_buf = calloc(1, len);
+		thd->demux_buf_size = thd->demux_buf ? len : 0;
+	}
+
+	return thd->demux_buf;
+}
+
+/* Lists the words of the client's layout; the accumulated values are kept
+ * as long as the layout does not change */
+static int decimator_update_layout(struct decimator *decim,
+		const struct iio_device *dev, uint32_t *mask,
+		unsigned int sample_size)
+{
+	struct block_cb_info info = {
+		.sample_size = sample_size,
+		.mask = mask,
+	};
+	struct decim_chn *chns;
+	unsigned int i, nb = 0;
+
+	chns = calloc(dev->nb_channels, sizeof(*chns));
+	if (!chns)
+		return -ENOMEM;
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		const struct iio_channel *chn = dev->channels[i];
+		const struct iio_data_format *fmt = &chn->format;
+		bool shared = info.prev && info.prev->index == chn->index;
+		int offset = get_client_offset(&info, chn);
+
+		/* Channels sharing a word are handled once */
+		if (offset < 0 || shared)
+			continue;
+
+		chns[nb].chn = chn;
+		chns[nb].offset = (unsigned int) offset;
+
+		/* Wider words, like timestamps, are not averaged */
+		chns[nb++].average = fmt->repeat <= 1 &&
+			(fmt->length == 8 || fmt->length == 16 ||
+			 fmt->length == 32);
+	}
+
+	if (nb == decim->nb_chns && decim->chns) {
+		for (i = 0; i < nb; i++)
+			if (chns[i].chn != decim->chns[i].chn ||
+					chns[i].offset != decim->chns[i].offset)
+				break;
+		if (i == nb) {
+			free(chns);
+			return 0;
+		}
+	}
+
+	free(decim->chns);
+	decim->chns = chns;
+	decim->nb_chns = nb;
+	decim->phase = 0;
+	return 0;
+}
+
+static int64_t decim_chn_load(const struct decim_chn *c, const uint8_t *sample)
+{
+	const struct iio_data_format *fmt = &c->chn->format;
+	union {
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+	} val;
+
+	iio_channel_convert(c->chn, &val, sample + c->offset);
+
+	switch (fmt->length) {
+	case 8:
+		return fmt->is_signed ? (int64_t) (int8_t) val.u8 :
+			(int64_t) val.u8;
+	case 16:
+		return fmt->is_signed ? (int64_t) (int16_t) val.u16 :
+			(int64_t) val.u16;
+	default:
+		return fmt->is_signed ? (int64_t) (int32_t) val.u32 :
+			(int64_t) val.u32;
+	}
+}
+
+static void decim_chn_store(const struct decim_chn *c, uint8_t *sample,
+		int64_t value)
+{
+	union {
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+	} val;
+
+	switch (c->chn->format.length) {
+	case 8:
+		val.u8 = (uint8_t) value;
+		break;
+	case 16:
+		val.u16 = (uint16_t) value;
+		break;
+	default:
+		val.u32 = (uint32_t) value;
+		break;
+	}
+
+	iio_channel_convert_inverse(c->chn, sample + c->offset, &val);
+}
+
+/* Returns the number of bytes of decimated samples in decim->buf */
+static ssize_t decimate_data(struct decimator *decim, const void *data,
+		size_t len, unsigned int sample_size)
+{
+	size_t i, nb = 0, nb_samples = len / sample_size,
+	       size = (nb_samples / decim->factor + 1) * sample_size;
+	const uint8_t *src = data;
+	uint8_t *dst;
+	unsigned int j;
+
+	if (size > decim->buf_size) {
+		free(decim->buf);
+		decim->buf = malloc(size);
+		decim->buf_size = decim->buf ? size : 0;
+		if (!decim->buf)
+			return -ENOMEM;
+	}
+
+	dst = decim->buf;
+
+	for (i = 0; i < nb_samples; i++, src += sample_size) {
+		if (decim->average) {
+			for (j = 0; j < decim->nb_chns; j++)
+				if (decim->chns[j].average)
+					decim->chns[j].acc += decim_chn_load(
+							&decim->chns[j], src);
+		}
+
+		if (++decim->phase < decim->factor)
+			continue;
+
+		decim->phase = 0;
+
+		/* The words that are not averaged come from the last sample
+		 * of the group */
+		memcpy(dst, src, sample_size);
+
+		if (decim->average) {
+			for (j = 0; j < decim->nb_chns; j++) {
+				struct decim_chn *c = &decim->chns[j];
+
+				if (c->average) {
+					decim_chn_store(c, dst, c->acc /
+							(int64_t) decim->factor);
+					c->acc = 0;
+				}
+			}
+		}
+
+		dst += sample_size;
+		nb++;
+	}
+
+	return (ssize_t) (nb * sample_size);
+}
+
+/* Returns the size of the compressed data in thd->codec_buf, or a negative
+ * error code if the samples should be sent uncompressed */
+static ssize_t compress_data(struct ThdEntry *thd, uint32_t mode,
+		const void *data, size_t len)
+{
+	if (!thd->codec)
+		return -EINVAL;
+
+	if (len > thd->codec_buf_size) {
+		free(thd->codec_buf);
+		thd->codec_buf = malloc(len);
+		thd->codec_buf_size = thd->codec_buf ? len : 0;
+		if (!thd->codec_buf)
+			return -ENOMEM;
+	}
+
+	/* Only worth it if the result is smaller */
+	return iiod_codec_encode(thd->codec, mode,
+			thd->codec_buf, len - 1, data, len);
+}
+
+/* Send the chunk as a series of datagrams over the UDP socket negotiated
+ * with the client; datagrams the socket could not send are simply lost, the
+ * client accounts for them when reassembling the chunk. */
+static void send_datagrams(struct parser_pdata *pdata,
+		const void *data, size_t len, struct iiod_udp_info *info)
+{
+	struct iiod_udp_header hdrs[32];
+	struct iovec iov[ARRAY_SIZE(hdrs)][2];
+	struct mmsghdr msgs[ARRAY_SIZE(hdrs)];
+	uintptr_t ptr = (uintptr_t) data;
+	uint32_t seq = pdata->udp_seq;
+	size_t left = len;
+
+	info->first_seq = iio_htobe32(seq);
+	info->nb = iio_htobe32((uint32_t) ((len + IIOD_UDP_PAYLOAD - 1)
+				/ IIOD_UDP_PAYLOAD));
+
+	memset(msgs, 0, sizeof(msgs));
+
+	while (left) {
+		unsigned int i, nb = 0, sent = 0;
+
+		for (; left && nb < ARRAY_SIZE(hdrs); nb++) {
+			size_t size = left > IIOD_UDP_PAYLOAD ?
+				IIOD_UDP_PAYLOAD : left;
+
+			hdrs[nb].seq = iio_htobe32(seq++);
+			hdrs[nb].len = iio_htobe32((uint32_t) len);
+
+			iov[nb][0].iov_base = &hdrs[nb];
+			iov[nb][0].iov_len = sizeof(hdrs[nb]);
+			iov[nb][1].iov_base = (void *) ptr;
+			iov[nb][1].iov_len = size;
+
+			msgs[nb].msg_hdr.msg_iov = iov[nb];
+			msgs[nb].msg_hdr.msg_iovlen = 2;
+
+			ptr += size;
+			left -= size;
+		}
+
+		while (sent < nb) {
+			int ret = sendmmsg(pdata->udp_fd,
+					&msgs[sent], nb - sent, 0);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+
+				/* Typically ECONNREFUSED, when an ICMP error
+				 * was received for a previous datagram */
+				break;
+			}
+
+			sent += (unsigned int) ret;
+		}
+
+		for (i = 0; i < nb; i++)
+			msgs[i].msg_len = 0;
+	}
+
+	pdata->udp_seq = seq;
+}
+
+/* Writes the chunk to the next slot of the shared memory negotiated with the
+ * client. Returns false if it does not fit, or if the client did not release
+ * the slot yet; the chunk is then sent in the frame. The object is accessed
+ * through its file rather than mapped: the client can truncate it at any
+ * time, and an access to the mapping past its end would raise SIGBUS. */
+static bool write_shm(struct parser_pdata *pdata,
+		const void *data, size_t len, struct iiod_shm_info *info)
+{
+	uint32_t seq = pdata->shm_seq, released;
+	off_t offset;
+
+	if (len > pdata->shm_slot_size)
+		return false;
+
+	if (pread(pdata->shm_fd, &released, sizeof(released),
+			offsetof(struct iiod_shm_header, released)) !=
+			sizeof(released))
+		return false;
+
+	if (seq - released >= pdata->shm_nb_slots)
+		return false;
+
+	offset = IIOD_SHM_DATA_OFFSET +
+		(off_t) (seq % pdata->shm_nb_slots) * pdata->shm_slot_size;
+	if (pwrite(pdata->shm_fd, data, len, offset) != (ssize_t) len)
+		return false;
+
+	info->seq = iio_htobe32(seq);
+	pdata->shm_seq = seq + 1;
+
+	return true;
+}
+
+static ssize_t do_send_data(struct DevEntry *dev, struct ThdEntry *thd,
+		const struct dev_block *blk)
+{
+	struct parser_pdata *pdata = thd->pdata;
+	bool demux = server_demux && blk->sample_size != thd->sample_size;
+	uint32_t *mask = demux ? thd->mask : (uint32_t *) blk->mask;
+	void *data = blk->data;
+	size_t data_len, len = blk->len;
+	ssize_t (*send_pages)(struct parser_pdata *, const void *, size_t);
+	ssize_t ret;
+
+	if (demux)
+		len = (len / blk->sample_size) * thd->sample_size;
+
+	/* With decimation, the limit applies to the samples sent */
+	if (len > thd->nb && thd->decim.factor <= 1)
+		len = thd->nb;
+
+	data_len = len;
+
+	if (demux) {
+		struct block_cb_info info = {
+			.sample_size = thd->sample_size,
+			.mask = thd->mask,
+		};
+
+		/* Long path: Demux the samples into the client's layout, and
+		 * send them all at once */
+		data_len = 0;
+
+		if (thd->sample_size && len >= thd->sample_size) {
+			info.count = len / thd->sample_size;
+			info.buf = thd_entry_get_demux_buf(thd,
+					info.count * thd->sample_size);
+			if (!info.buf)
+				return -ENOMEM;
+
+			ret = demux_dev_block(thd->dev, blk, &info);
+			if (ret < 0)
+				return ret;
+
+			data = info.buf;
+			data_len = info.count * thd->sample_size;
+		}
+	}
+
+	if (thd->decim.factor > 1) {
+		unsigned int sample_size = demux ?
+			thd->sample_size : blk->sample_size;
+
+		if (thd->new_client || !thd->decim.chns) {
+			ret = decimator_update_layout(&thd->decim, thd->dev,
+					mask, sample_size);
+			if (ret < 0)
+				return ret;
+		}
+
+		ret = decimate_data(&thd->decim, data, data_len, sample_size);
+		if (ret < 0)
+			return ret;
+
+		data = thd->decim.buf;
+		data_len = (size_t) ret;
+		if (data_len > thd->nb)
+			data_len = thd->nb;
+
+		/* Nothing to send until a group of samples is complete */
+		if (!data_len)
+			return 0;
+
+		len = data_len;
+	}
+
+	/* Short path: the samples of the block are sent as they are, and the
+	 * socket can take its pages directly. The reader keeps the block until
+	 * the kernel released them; see read_ring(). */
+	send_pages = NULL;
+	if (data == blk->data && pdata->fd_out_is_socket &&
+			!pdata->use_aio && pdata->nb_stripes == 1) {
+		if ((blk->mapped || (blk->lent && server_splice)) &&
+				data_len >= SPLICE_MIN_LEN)
+			send_pages = splice_all;
+#ifdef SO_ZEROCOPY
+		else if (pdata->zerocopy && data_len >= ZEROCOPY_MIN_LEN)
+			send_pages = zerocopy_all;
+#endif
+	}
+
+	if (pdata->binary) {
+		struct iiod_shm_info shm_info;
+		struct iiod_udp_info udp_info;
+		uint32_t words[16], nb_dropped;
+		struct iovec iov[3];
+		unsigned int i, nb = 0;
+		uint32_t flags = 0;
+
+		if (thd->new_client) {
+			if (dev->nb_words > ARRAY_SIZE(words)) {
+				IIO_ERROR("send_data: mask too large\n");
+				return -ENOSPC;
+			}
+
+			for (i = 0; i < dev->nb_words; i++)
+				words[i] = iio_htobe32(mask[i]);
+
+			iov[nb].iov_base = words;
+			iov[nb++].iov_len = dev->nb_words * sizeof(*words);
+			flags |= IIOD_FRAME_MASK;
+			thd->new_client = false;
+
+			/* The layout of the samples may have changed */
+			if (pdata->compression) {
+				iiod_codec_destroy(thd->codec);
+				thd->codec = iiod_codec_new(thd->dev, mask);
+			}
+		}
+
+		if (thd->nb_dropped) {
+			nb_dropped = iio_htobe32(thd->nb_dropped);
+			iov[nb].iov_base = &nb_dropped;
+			iov[nb++].iov_len = sizeof(nb_dropped);
+			flags |= IIOD_FRAME_DROPPED;
+			thd->nb_dropped = 0;
+		}
+
+		if (pdata->shm_fd >= 0 && data_len &&
+				write_shm(pdata, data, data_len, &shm_info)) {
+			iov[nb].iov_base = &shm_info;
+			iov[nb++].iov_len = sizeof(shm_info);
+			flags |= IIOD_FRAME_SHM;
+			send_pages = NULL;
+		} else if (pdata->udp_fd >= 0 && data_len) {
+			send_datagrams(pdata, data, data_len, &udp_info);
+			send_pages = NULL;
+
+			iov[nb].iov_base = &udp_info;
+			iov[nb++].iov_len = sizeof(udp_info);
+			flags |= IIOD_FRAME_UDP;
+		} else {
+			ret = -EINVAL;
+			if (pdata->compression && data_len > 1)
+				ret = compress_data(thd, pdata->compression,
+						data, data_len);
+
+			if (ret > 0) {
+				iov[nb].iov_base = thd->codec_buf;
+				iov[nb++].iov_len = (size_t) ret;
+				flags |= pdata->compression;
+				send_pages = NULL;
+			} else {
+				iov[nb].iov_base = data;
+				iov[nb++].iov_len = data_len;
+			}
+		}
+
+		ret = do_send_frame(pdata, (long) len, flags, iov, nb,
+				send_pages);
+		if (ret < 0)
+			return ret;
+
+		return (ssize_t) data_len;
+	}
+
+	print_value(pdata, len);
+
+	if (thd->new_client) {
+		unsigned int i;
+		char buf[129], *ptr = buf;
+		ssize_t len;
+
+		len = sizeof(buf);
+		/* Send the current mask */
+		for (i = dev->nb_words; i > 0 && ptr < buf + sizeof(buf);
+				i--, ptr += 8) {
+			iio_snprintf(ptr, len, "%08x", mask[i - 1]);
+			len -= 8;
+		}
+
+		*ptr = '\n';
+		len--;
+
+		if (len < 0) {
+			IIO_ERROR("send_data: string length error\n");
+			return -ENOSPC;
+		}
+
+		ret = write_all(pdata, buf, ptr + 1 - buf);
+		if (ret < 0)
+			return ret;
+
+		thd->new_client = false;
+	}
+
+	if (!data_len)
+		return 0;
+
+	if (pdata->nb_stripes > 1)
+		return write_striped(pdata, data, data_len);
+
+	if (send_pages)
+		return send_pages(pdata, data, data_len);
+
+	return write_all(pdata, data, data_len);
+}
+
+static ssize_t send_data(struct DevEntry *dev, struct ThdEntry *thd,
+		const struct dev_block *blk)
+{
+	ssize_t ret;
+
+	IIO_TRACE2(send_data_entry, dev->dev->id, blk->len);
+	ret = do_send_data(dev, thd, blk);
+	IIO_TRACE2(send_data_exit, dev->dev->id, ret);
+
+	return ret;
+}
+
+static ssize_t receive_data(struct DevEntry *dev, struct ThdEntry *thd)
+{
+	struct parser_pdata *pdata = thd->pdata;
+
+	/* Inform that no error occurred, and that we'll start reading data */
+	if (thd->new_client) {
+		print_value(thd->pdata, 0);
+		thd->new_client = false;
+	}
+
+	if (dev->sample_size == thd->sample_size) {
+		/* Short path: Receive directly in the buffer */
+
+		size_t len = dev->buf->length;
+		if (thd->nb < len)
+			len = thd->nb;
+
+		return read_all(pdata, dev->buf->buffer, len);
+	} else {
+		/* Long path: Receive all the samples at once, then mux them
+		 * to the buffer */
+
+		struct block_cb_info info = {
+			.sample_size = thd->sample_size,
+			.mask = thd->mask,
+		};
+		size_t max = dev->buf->data_length / dev->buf->sample_size;
+		ssize_t ret;
+
+		if (!thd->sample_size)
+			return 0;
+
+		info.count = thd->nb / thd->sample_size;
+		if (info.count > max)
+			info.count = max;
+		if (!info.count)
+			return 0;
+
+		info.buf = thd_entry_get_demux_buf(thd,
+				info.count * thd->sample_size);
+		if (!info.buf)
+			return -ENOMEM;
+
+		ret = read_all(pdata, info.buf, info.count * thd->sample_size);
+		if (ret < 0)
+			return ret;
+
+		ret = iio_buffer_foreach_block(dev->buf, mux_block, &info);
+		if (ret < 0)
+			return ret;
+
+		return (ssize_t) (info.count * thd->sample_size);
+	}
+}
+
+static struct dev_block * dev_block_new(const struct DevEntry *entry,
+		size_t len)
+{
+	struct dev_block *blk;
+
+	if (!server_splice) {
+		blk = malloc(sizeof(*blk) + entry->nb_words *
+				sizeof(*blk->mask) + len);
+		if (!blk)
+			return NULL;
+
+		blk->data = &blk->mask[entry->nb_words];
+		blk->mapped = false;
+	} else {
+		blk = malloc(sizeof(*blk) + entry->nb_words *
+				sizeof(*blk->mask));
+		if (!blk)
+			return NULL;
+
+		/* Mapped on its own, so that its pages can be handed over to
+		 * the sockets; see dev_block_put() */
+		blk->data = mmap(NULL, len ? len : 1, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (blk->data == MAP_FAILED) {
+			free(blk);
+			return NULL;
+		}
+
+		blk->mapped = true;
+	}
+
+	blk->size = len;
+
+	return blk;
+}
+
+static void dev_block_free(struct dev_block *blk)
+{
+	if (blk && blk->mapped)
+		munmap(blk->data, blk->size ? blk->size : 1);
+	free(blk);
+}
+
+static void dev_entry_free_spare_blocks(struct DevEntry *entry)
+{
+	struct dev_block *blk;
+
+	while (entry->spare_blocks) {
+		blk = entry->spare_blocks;
+		entry->spare_blocks = blk->next;
+		dev_block_free(blk);
+	}
+
+	entry->nb_spare_blocks = 0;
+}
+
+static void dev_entry_put(struct DevEntry *entry)
+{
+	bool free_entry = false;
+
+	pthread_mutex_lock(&entry->thdlist_lock);
+	entry->ref_count--;
+	if (entry->ref_count == 0)
+		free_entry = true;
+	pthread_mutex_unlock(&entry->thdlist_lock);
+
+	if (free_entry) {
+		pthread_mutex_destroy(&entry->thdlist_lock);
+		pthread_cond_destroy(&entry->rw_ready_cond);
+
+		dev_entry_free_spare_blocks(entry);
+		free(entry->lent_block);
+		free(entry->ring);
+		free(entry->mask);
+		free(entry);
+	}
+}
+
+static void signal_thread(struct ThdEntry *thd, ssize_t ret)
+{
+	thd->err = ret;
+	thd->nb = 0;
+	thd->active = false;
+	thd_entry_event_signal(thd);
+}
+
+static void dev_block_put(struct DevEntry *entry, struct dev_block *blk)
+{
+	/* The R/W thread may be waiting for the device's buffer */
+	if (blk->lent) {
+		if (--blk->refs <= 1)
+			pthread_cond_signal(&entry->rw_ready_cond);
+		return;
+	}
+
+	if (--blk->refs)
+		return;
+
+	/* The readers keep their reference to the blocks spliced until the
+	 * sockets released their pages, so the block can be reused as it is,
+	 * without mapping it again */
+	if (!entry->closed && entry->nb_spare_blocks < entry->ring_size) {
+		blk->next = entry->spare_blocks;
+		entry->spare_blocks = blk;
+		entry->nb_spare_blocks++;
+	} else {
+		dev_block_free(blk);
+	}
+}
+
+/* Returns true once the socket released the pages of the pinned block */
+static bool block_pin_done(struct parser_pdata *pdata,
+		const struct block_pin *pin)
+{
+	if (pin->spliced)
+		return splice_done(pdata, pin->fence);
+#ifdef SO_ZEROCOPY
+	return zerocopy_done(pdata, (uint32_t) pin->fence);
+#else
+	return true;
+#endif
+}
+
+/* Waits until the socket released the pages of the pinned block */
+static int block_pin_wait(struct parser_pdata *pdata,
+		const struct block_pin *pin)
+{
+	if (pin->spliced)
+		return wait_splice(pdata, pin->fence);
+#ifdef SO_ZEROCOPY
+	return wait_zerocopy(pdata, (uint32_t) pin->fence);
+#else
+	return 0;
+#endif
+}
+
+/* Drops the references of the reader to the blocks sent without copying them
+ * that the kernel is done with, or to all of them if all is set. Called with
+ * the thdlist_lock of the device locked. */
+static void thd_entry_release_blocks(struct DevEntry *entry,
+		struct ThdEntry *thd, bool all)
+{
+	unsigned int i, nb = thd->nb_pins;
+
+	if (!all) {
+#ifdef SO_ZEROCOPY
+		if (thd->pdata->zerocopy)
+			reap_zerocopy(thd->pdata);
+#endif
+
+		for (nb = 0; nb < thd->nb_pins; nb++)
+			if (!block_pin_done(thd->pdata, &thd->pins[nb]))
+				break;
+	}
+
+	for (i = 0; i < nb; i++)
+		dev_block_put(entry, thd->pins[i].blk);
+
+	thd->nb_pins -= nb;
+	memmove(thd->pins, &thd->pins[nb], thd->nb_pins * sizeof(*thd->pins));
+}
+
+/* Keeps the reference of the reader to a block sent without copying it until
+ * the kernel released its pages, so that it is not refilled meanwhile. Only
+ * blocks when the reader has too many of them in flight. Called with the
+ * thdlist_lock of the device locked. */
+static void thd_entry_pin_block(struct DevEntry *entry, struct ThdEntry *thd,
+		const struct block_pin *pin)
+{
+	thd_entry_release_blocks(entry, thd, false);
+
+	if (thd->nb_pins == MAX_PINNED_BLOCKS) {
+		int ret;
+
+		pthread_mutex_unlock(&entry->thdlist_lock);
+		ret = block_pin_wait(thd->pdata, &thd->pins[0]);
+		pthread_mutex_lock(&entry->thdlist_lock);
+
+		/* On error, the client is gone and won't see the data */
+		thd_entry_release_blocks(entry, thd, ret < 0);
+	}
+
+	thd->pins[thd->nb_pins++] = *pin;
+}
+
+/* Drops all the blocks of the ring, and moves the readers to its head */
+static void dev_entry_flush_ring(struct DevEntry *entry)
+{
+	struct ThdEntry *thd;
+
+	for (; entry->ring_tail < entry->ring_head; entry->ring_tail++)
+		dev_block_put(entry, entry->ring[entry->ring_tail %
+				entry->ring_size]);
+
+	SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry)
+		thd->ring_seq = entry->ring_head;
+}
+
+/* Returns true if the next block read can be added to the ring, either
+ * because it is not full, or because the oldest block can be dropped */
+static bool dev_entry_ring_ready(const struct DevEntry *entry)
+{
+	const struct ThdEntry *thd;
+
+	if (entry->ring_head - entry->ring_tail < entry->ring_size ||
+			server_drop_oldest)
+		return true;
+
+	SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
+		if (thd->active && !thd->is_writer &&
+				thd->ring_seq <= entry->ring_tail)
+			return false;
+	}
+
+	return true;
+}
+
+/* Returns a block holding a copy of the given samples, with the ring's
+ * reference */
+static struct dev_block * dev_entry_copy_block(struct DevEntry *entry,
+		const void *data, size_t len)
+{
+	struct dev_block *blk = entry->spare_blocks;
+
+	if (blk) {
+		entry->spare_blocks = blk->next;
+		entry->nb_spare_blocks--;
+	}
+
+	if (!blk || blk->size < len) {
+		dev_block_free(blk);
+
+		blk = dev_block_new(entry, len);
+		if (!blk)
+			return NULL;
+	}
+
+	blk->refs = 1;
+	blk->len = len;
+	blk->sample_size = entry->sample_size;
+	blk->lent = false;
+	memcpy(blk->mask, entry->mask, entry->nb_words * sizeof(*blk->mask));
+	memcpy(blk->data, data, len);
+
+	return blk;
+}
+
+/*
+ * Called before the device's buffer is refilled, written or reprogrammed:
+ * the samples lent to the readers must not be referenced anymore. They are
+ * copied for the readers that did not send them yet, or dropped from the
+ * ring if flush is set. Returns false if the caller has to wait, because a
+ * reader is sending them, or is about to.
+ */
+static bool dev_entry_return_block(struct DevEntry *entry, bool flush)
+{
+	struct dev_block *blk = entry->lent_block;
+	uint64_t seq = entry->ring_head - 1;
+	struct ThdEntry *thd;
+	bool needed = false;
+
+	if (!blk || !blk->refs)
+		return true;
+	if (blk->refs > 1)
+		return false;
+
+	/* Only the ring references it, and it is its newest block */
+	SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
+		if (flush || thd->is_writer || thd->ring_seq > seq)
+			continue;
+		if (thd->active)
+			return false;
+
+		needed = true;
+	}
+
+	if (needed) {
+		struct dev_block *copy = dev_entry_copy_block(entry,
+				blk->data, blk->len);
+
+		if (copy) {
+			entry->ring[seq % entry->ring_size] = copy;
+			blk->refs = 0;
+			return true;
+		}
+	}
+
+	/* None of the readers needs the blocks of the ring anymore, or there
+	 * is no memory to keep them */
+	dev_entry_flush_ring(entry);
+
+	return true;
+}
+
+/* Adds the samples of the device's buffer to the ring, and wakes up the
+ * readers waiting for them. A lone reader sends them right from the device's
+ * buffer, which is not used again until it is done; the samples are only
+ * copied when several clients share the device, or when the oldest blocks
+ * are dropped instead of waiting for the readers. */
+static int dev_entry_push_block(struct DevEntry *entry, size_t len)
+{
+	struct ThdEntry *thd = SLIST_FIRST(&entry->thdlist_head);
+	struct dev_block *blk = NULL;
+
+	if (!server_drop_oldest && !SLIST_NEXT(thd, dev_list_entry)) {
+		if (!entry->lent_block) {
+			entry->lent_block = malloc(sizeof(*blk) +
+					entry->nb_words * sizeof(*blk->mask));
+			if (entry->lent_block) {
+				entry->lent_block->size = 0;
+				entry->lent_block->mapped = false;
+				entry->lent_block->lent = true;
+			}
+		}
+
+		blk = entry->lent_block;
+	}
+
+	if (blk) {
+		blk->refs = 1;
+		blk->len = len;
+		blk->sample_size = entry->sample_size;
+		blk->data = entry->buf->buffer;
+		memcpy(blk->mask, entry->mask,
+				entry->nb_words * sizeof(*blk->mask));
+	} else {
+		blk = dev_entry_copy_block(entry, entry->buf->buffer, len);
+		if (!blk)
+			return -ENOMEM;
+	}
+
+	if (entry->ring_head - entry->ring_tail == entry->ring_size) {
+		dev_block_put(entry, entry->ring[entry->ring_tail %
+				entry->ring_size]);
+		entry->ring_tail++;
+	}
+
+	entry->ring[entry->ring_head++ % entry->ring_size] = blk;
+
+	SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
+		if (thd->active && !thd->is_writer)
+			thd_entry_event_signal(thd);
+	}
+
+	return 0;
+}
+
+/* Returns the next block to send to the reader, with a reference taken, or
+ * NULL if it was not read from the device yet */
+static struct dev_block * dev_entry_get_block(struct DevEntry *entry,
+		struct ThdEntry *thd)
+{
+	struct dev_block *blk;
+
+	if (thd->ring_seq < entry->ring_tail) {
+		thd->nb_dropped += (unsigned int) (entry->ring_tail -
+				thd->ring_seq);
+		IIO_DEBUG("Reader too slow, %u blocks dropped\n",
+				thd->nb_dropped);
+		thd->ring_seq = entry->ring_tail;
+	}
+
+	if (thd->ring_seq == entry->ring_head)
+		return NULL;
+
+	blk = entry->ring[thd->ring_seq++ % entry->ring_size];
+	blk->refs++;
+
+	return blk;
+}
+
+static void rw_thd(struct thread_pool *pool, void *d)
+{
+	struct DevEntry *entry = d;
+	struct ThdEntry *thd, *next_thd;
+	struct iio_device *dev = entry->dev;
+	unsigned int nb_words = entry->nb_words;
+	ssize_t ret = 0;
+
+	IIO_DEBUG("R/W thread started for device %s\n",
+			dev->name ? dev->name : dev->id);
+
+	while (true) {
+		bool has_readers = false, has_writers = false,
+		     mask_updated = false;
+		unsigned int sample_size;
+
+		/* NOTE: this while loop must exit with thdlist_lock locked. */
+		pthread_mutex_lock(&entry->thdlist_lock);
+
+		if (SLIST_EMPTY(&entry->thdlist_head))
+			break;
+
+		/* Not while a reader sends the samples lent to it */
+		if (entry->update_mask && !dev_entry_return_block(entry, true)) {
+			pthread_cond_wait(&entry->rw_ready_cond,
+					&entry->thdlist_lock);
+			pthread_mutex_unlock(&entry->thdlist_lock);
+			continue;
+		}
+
+		if (entry->update_mask) {
+			unsigned int i;
+			unsigned int samples_count = 0;
+
+			memset(entry->mask, 0, nb_words * sizeof(*entry->mask));
+			SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
+				for (i = 0; i < nb_words; i++)
+					entry->mask[i] |= thd->mask[i];
+
+				if (thd->samples_count > samples_count)
+					samples_count = thd->samples_count;
+			}
+
+			for (i = 0; i < dev->nb_channels; i++) {
+				struct iio_channel *chn = dev->channels[i];
+				long index = chn->index;
+
+				if (index < 0)
+					continue;
+
+				if (TEST_BIT(entry->mask, chn->number))
+					iio_channel_enable(chn);
+				else
+					iio_channel_disable(chn);
+			}
+
+			/* Reprogram the device without closing it when
+			 * possible, so that its blocks are reused; a cancelled
+			 * buffer cannot be used anymore */
+			if (entry->buf && (entry->cancelled ||
+					iio_buffer_reconfigure(entry->buf,
+						samples_count) < 0)) {
+				iio_buffer_destroy(entry->buf);
+				entry->buf = NULL;
+			}
+
+			if (!entry->buf)
+				entry->buf = iio_device_create_buffer(dev,
+						samples_count, entry->cyclic);
+			if (!entry->buf) {
+				ret = -errno;
+				IIO_ERROR("Unable to create buffer\n");
+				break;
+			}
+			entry->cancelled = false;
+
+			/* Signal the threads that we opened the device */
+			SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
+				if (thd->wait_for_open) {
+					thd->wait_for_open = false;
+					signal_thread(thd, 0);
+				}
+			}
+
+			IIO_DEBUG("IIO device %s reopened with new mask:\n",
+					dev->id);
+			for (i = 0; i < nb_words; i++)
+				IIO_DEBUG("Mask[%i] = 0x%08x\n", i, entry->mask[i]);
+			entry->update_mask = false;
+
+			entry->sample_size = iio_device_get_sample_size(dev);
+			mask_updated = true;
+
+			/* The blocks read with the previous mask are obsolete */
+			dev_entry_flush_ring(entry);
+		}
+
+		sample_size = entry->sample_size;
+
+		SLIST_FOREACH(thd, &entry->thdlist_head, dev_list_entry) {
+			thd->active = !thd->err && thd->nb >= sample_size;
+			if (mask_updated && thd->active)
+				signal_thread(thd, thd->nb);
+
+			if (thd->is_writer)
+				has_writers |= thd->active;
+			else
+				has_readers |= thd->active;
+		}
+
+		/* Wait for the slowest reader to free some room */
+		if (has_readers && !dev_entry_ring_ready(entry))
+			has_readers = false;
+
+		/* Wait for the reader of the samples lent to it */
+		if ((has_readers || has_writers) &&
+				!dev_entry_return_block(entry, false)) {
+			has_readers = false;
+			has_writers = false;
+		}
+
+		if (!has_readers && !has_writers) {
+			pthread_cond_wait(&entry->rw_ready_cond,
+					&entry->thdlist_lock);
+			IIO_TRACE1(rw_thd_wake, dev->id);
+		}
+
+		pthread_mutex_unlock(&entry->thdlist_lock);
+
+		if (!has_readers && !has_writers)
+			continue;
+
+		if (has_readers) {
+			ret = iio_buffer_refill(entry->buf);
+
+			pthread_mutex_lock(&entry->thdlist_lock);
+
+			/*
+			 * When the last client disconnects the buffer is
+			 * cancelled and iio_buffer_refill() returns an error. A
+			 * new client might have connected before we got here
+			 * though, in that case the rw thread has to stay active
+			 * and a new buffer is created. If the list is still empty the loop
+			 * will exit normally.
+			 */
+			if (entry->cancelled) {
+				pthread_mutex_unlock(&entry->thdlist_lock);
+				continue;
+			}
+
+			if (ret < 0) {
+				IIO_ERROR("Reading from device failed: %i\n",
+						(int) ret);
+				break;
+			}
+
+			/* The readers send the block from their own thread */
+			ret = dev_entry_push_block(entry, (size_t) ret);
+			if (ret < 0) {
+				IIO_ERROR("Unable to allocate block\n");
+				break;
+			}
+
+			pthread_mutex_unlock(&entry->thdlist_lock);
+		}
+
+		if (has_writers) {
+			ssize_t nb_bytes = 0;
+
+			pthread_mutex_lock(&entry->thdlist_lock);
+
+			/* Reset the size of the buffer to its maximum size */
+			entry->buf->data_length = entry->buf->length;
+
+			/* Same comment as above */
+			for (thd = SLIST_FIRST(&entry->thdlist_head);
+					thd; thd = next_thd) {
+				next_thd = SLIST_NEXT(thd, dev_list_entry);
+
+				if (!thd->active || !thd->is_writer)
+					continue;
+
+				ret = receive_data(entry, thd);
+				if (ret > 0) {
+					thd->nb -= ret;
+					if (ret > nb_bytes)
+						nb_bytes = ret;
+				}
+
+				if (ret < 0)
+					signal_thread(thd, ret);
+			}
+
+			ret = iio_buffer_push_partial(entry->buf,
+				nb_bytes / sample_size);
+			if (entry->cancelled) {
+				pthread_mutex_unlock(&entry->thdlist_lock);
+				continue;
+			}
+
+			/* A cyclic buffer with a single kernel block cannot
+			 * take a new waveform; only the writer fails */
+			if (ret == -EBUSY && entry->cyclic) {
+				SLIST_FOREACH(thd, &entry->thdlist_head,
+						dev_list_entry) {
+					if (thd->active && thd->is_writer)
+						signal_thread(thd, ret);
+				}
+
+				pthread_mutex_unlock(&entry->thdlist_lock);
+				continue;
+			}
+
+			if (ret < 0) {
+				IIO_ERROR("Writing to device failed: %i\n",
+						(int) ret);
+				break;
+			}
+
+			/* Signal threads which completed their RW command */
+			for (thd = SLIST_FIRST(&entry->thdlist_head);
+					thd; thd = next_thd) {
+				next_thd = SLIST_NEXT(thd, dev_list_entry);
+				if (thd->active && thd->is_writer &&
+						thd->nb < sample_size)
+					signal_thread(thd, thd->nb);
+			}
+
+			pthread_mutex_unlock(&entry->thdlist_lock);
+		}
+	}
+
+	/* Signal all remaining threads */
+	for (thd = SLIST_FIRST(&entry->thdlist_head); thd; thd = next_thd) {
+		next_thd = SLIST_NEXT(thd, dev_list_entry);
+		SLIST_REMOVE(&entry->thdlist_head, thd, ThdEntry, dev_list_entry);
+		thd->wait_for_open = false;
+		signal_thread(thd, ret);
+	}
+	entry->closed = true;
+	dev_entry_flush_ring(entry);
+	dev_entry_free_spare_blocks(entry);
+
+	/* Wait for the readers still sending the samples lent to them */
+	while (entry->lent_block && entry->lent_block->refs)
+		pthread_cond_wait(&entry->rw_ready_cond, &entry->thdlist_lock);
+
+	if (entry->buf) {
+		iio_buffer_destroy(entry->buf);
+		entry->buf = NULL;
+	}
+	pthread_mutex_unlock(&entry->thdlist_lock);
+
+	pthread_mutex_lock(&devlist_lock);
+	/* It is possible that a new thread has already started, make sure to
+	 * not overwrite it. */
+	if (iio_device_get_data(dev) == entry)
+		iio_device_set_data(dev, NULL);
+	pthread_mutex_unlock(&devlist_lock);
+
+	IIO_DEBUG("Stopping R/W thread for device %s\n",
+			dev->name ? dev->name : dev->id);
+
+	dev_entry_put(entry);
+}
+
+static struct ThdEntry *parser_lookup_thd_entry(struct parser_pdata *pdata,
+	struct iio_device *dev)
+{
+	struct ThdEntry *t;
+
+	SLIST_FOREACH(t, &pdata->thdlist_head, parser_list_entry) {
+		if (t->dev == dev)
+			return t;
+	}
+
+	return NULL;
+}
+
+/* Sends the blocks of the ring to the reader until its request is complete.
+ * Called with the thdlist_lock of the device locked. */
+static int read_ring(struct DevEntry *entry, struct ThdEntry *thd)
+{
+	struct block_pin pin;
+	struct dev_block *blk;
+	uint64_t splice_end;
+	uint32_t zc_sent;
+	ssize_t ret;
+
+	while (thd->active) {
+		blk = dev_entry_get_block(entry, thd);
+		if (!blk) {
+			ret = thd_entry_event_wait(thd, &entry->thdlist_lock,
+					thd->pdata->fd_in);
+			if (ret)
+				return (int) ret;
+			continue;
+		}
+
+		zc_sent = thd->pdata->zc_sent;
+		splice_end = thd->pdata->splice_end;
+
+		pthread_mutex_unlock(&entry->thdlist_lock);
+		ret = send_data(entry, thd, blk);
+
+		pin.blk = blk;
+		if (thd->pdata->splice_end != splice_end) {
+			pin.fence = thd->pdata->splice_end;
+			pin.spliced = true;
+		} else if (thd->pdata->zc_sent != zc_sent) {
+			pin.fence = thd->pdata->zc_sent;
+			pin.spliced = false;
+		} else {
+			pin.blk = NULL;
+		}
+
+		/* The device's buffer is refilled as soon as it is released */
+		if (blk->lent && pin.blk) {
+			block_pin_wait(thd->pdata, &pin);
+			pin.blk = NULL;
+		}
+
+		pthread_mutex_lock(&entry->thdlist_lock);
+
+		if (pin.blk)
+			thd_entry_pin_block(entry, thd, &pin);
+		else
+			dev_block_put(entry, blk);
+
+		/* There may be room in the ring for the next refill */
+		pthread_cond_signal(&entry->rw_ready_cond);
+
+		if (ret < 0) {
+			thd->err = ret;
+		} else if (!thd->active) {
+			/* Interrupted by the R/W thread while sending */
+			if (thd->err > ret)
+				thd->err -= ret;
+			else if (thd->err >= 0)
+				thd->err = 0;
+			break;
+		} else {
+			thd->nb -= ret;
+			if (thd->nb >= entry->sample_size)
+				continue;
+
+			thd->err = thd->nb;
+		}
+
+		thd->nb = 0;
+		thd->active = false;
+	}
+
+	return 0;
+}
+
+static ssize_t rw_buffer(struct parser_pdata *pdata,
+		struct iio_device *dev, unsigned int nb, bool is_write)
+{
+	struct DevEntry *entry;
+	struct ThdEntry *thd;
+	ssize_t ret;
+
+	if (!dev)
+		return -ENODEV;
+
+	thd = parser_lookup_thd_entry(pdata, dev);
+	if (!thd)
+		return -EBADF;
+
+	entry = thd->entry;
+
+	if (nb < entry->sample_size)
+		return 0;
+
+	pthread_mutex_lock(&entry->thdlist_lock);
+	if (entry->closed) {
+		pthread_mutex_unlock(&entry->thdlist_lock);
+		return -EBADF;
+	}
+
+	if (thd->nb) {
+		pthread_mutex_unlock(&entry->thdlist_lock);
+		return -EBUSY;
+	}
+
+	thd->new_client = true;
+	thd->nb = nb;
+	thd->err = 0;
+	thd->is_writer = is_write;
+	thd->active = true;
+
+	pthread_cond_signal(&entry->rw_ready_cond);
+
+	IIO_DEBUG("Waiting for completion...\n");
+	if (is_write) {
+		while (thd->active) {
+			ret = thd_entry_event_wait(thd, &entry->thdlist_lock,
+					pdata->fd_in);
+			if (ret)
+				break;
+		}
+	} else {
+		ret = read_ring(entry, thd);
+		if (ret) {
+			/* Don't hold back the R/W thread waiting for us */
+			thd->nb = 0;
+			thd->active = false;
+		}
+	}
+	if (ret == 0)
+		ret = thd->err;
+	pthread_mutex_unlock(&entry->thdlist_lock);
+
+	if (ret > 0 && ret < (ssize_t) nb)
+		print_value(thd->pdata, 0);
+
+	IIO_DEBUG("Exiting rw_buffer with code %li\n", (long) ret);
+	if (ret < 0)
+		return ret;
+	else
+		return nb - ret;
+}
+
+static uint32_t *get_mask(const char *mask, size_t *len)
+{
+	size_t nb = (*len + 7) / 8;
+	uint32_t *ptr, *words = calloc(nb, sizeof(*words));
+	if (!words)
+		return NULL;
+
+	ptr = words + nb;
+	while (*mask) {
+		char buf[9];
+		iio_snprintf(buf, sizeof(buf), "%.*s", 8, mask);
+		sscanf(buf, "%08x", --ptr);
+		mask += 8;
+		IIO_DEBUG("Mask[%lu]: 0x%08x\n",
+				(unsigned long) (words - ptr) / 4, *ptr);
+	}
+
+	*len = nb;
+	return words;
+}
+
+static void free_thd_entry(struct ThdEntry *t)
+{
+	close(t->eventfd);
+	free(t->demux_buf);
+	iiod_codec_destroy(t->codec);
+	free(t->codec_buf);
+	free(t->decim.chns);
+	free(t->decim.buf);
+	free(t->mask);
+	free(t);
+}
+
+static void remove_thd_entry(struct ThdEntry *t)
+{
+	struct DevEntry *entry = t->entry;
+
+	unsigned int i;
+
+	/* The blocks still in flight cannot be refilled before they are sent */
+	for (i = 0; i < t->nb_pins; i++)
+		if (block_pin_wait(t->pdata, &t->pins[i]) < 0)
+			break;
+
+	pthread_mutex_lock(&entry->thdlist_lock);
+	thd_entry_release_blocks(entry, t, true);
+	if (!entry->closed) {
+		entry->update_mask = true;
+		SLIST_REMOVE(&entry->thdlist_head, t, ThdEntry, dev_list_entry);
+		if (SLIST_EMPTY(&entry->thdlist_head) && entry->buf) {
+			entry->cancelled = true;
+			iio_buffer_cancel(entry->buf); /* Wakeup the rw thread */
+		}
+
+		pthread_cond_signal(&entry->rw_ready_cond);
+	}
+	pthread_mutex_unlock(&entry->thdlist_lock);
+	dev_entry_put(entry);
+
+	free_thd_entry(t);
+}
+
+static int open_dev_helper(struct parser_pdata *pdata, struct iio_device *dev,
+		size_t samples_count, const char *mask, bool cyclic)
+{
+	int ret = -ENOMEM;
+	struct thread_sched sched;
+	struct DevEntry *entry;
+	struct ThdEntry *thd;
+	size_t len = strlen(mask);
+	uint32_t *words;
+	unsigned int nb_channels;
+	unsigned int cyclic_retry = 500;
+
+	if (!dev)
+		return -ENODEV;
+
+	nb_channels = dev->nb_channels;
+	if (len != ((nb_channels + 31) / 32) * 8)
+		return -EINVAL;
+
+	words = get_mask(mask, &len);
+	if (!words)
+		return -ENOMEM;
+
+	thd = zalloc(sizeof(*thd));
+	if (!thd)
 		goto err_free_words;
 
-	thd->wait_for_open = true;
+	thd->wait_for_open = true;
+	thd->mask = words;
+	thd->nb = 0;
+	thd->samples_count = samples_count;
+	thd->sample_size = iio_device_get_sample_size_mask(dev, words, len);
+	thd->pdata = pdata;
+	thd->dev = dev;
+	thd->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+retry:
+	/* Atomically look up the thread and make sure that it is still active
+	 * or allocate new one. */
+	pthread_mutex_lock(&devlist_lock);
+	entry = iio_device_get_data(dev);
+	if (entry) {
+		if (cyclic || entry->cyclic) {
+			/* Only one client allowed in cyclic mode */
+			pthread_mutex_unlock(&devlist_lock);
+
+			/* There is an inherent race condition if a client
+			 * creates a new cyclic buffer shortly after destroying
+			 * a previous. E.g. like
+			 *
+			 *     iio_buffer_destroy(buf);
+			 *     buf = iio_device_create_buffer(dev, n, true);
+			 *
+			 * In this case the two buffers each use their own
+			 * communication channel which are unordered to each
+			 * other. E.g. the socket open might arrive before the
+			 * socket close on the host side, even though they were
+			 * sent in the opposite order on the client side. This
+			 * race condition can cause an error being reported back
+			 * to the client, even though the code on the client
+			 * side was well formed and would work fine e.g. using
+			 * the local backend.
+			 *
+			 * To avoid this issue go to sleep for up to 50ms in
+			 * intervals of 100us. This should be enough time for
+			 * the issue to resolve itself. If there actually is
+			 * contention on the buffer an error will eventually be
+			 * returned in which case the additional delay cause by
+			 * the retires should not matter too much.
+			 *
+			 * This is not pretty but it works.
+			 */
+			if (cyclic_retry) {
+				struct timespec wait;
+				wait.tv_sec = 0;
+				wait.tv_nsec = (100 * 1000);
+				cyclic_retry--;
+				nanosleep(&wait, &wait);
+				goto retry;
+			}
+
+			ret = -EBUSY;
+			goto err_free_thd;
+		}
+
+		pthread_mutex_lock(&entry->thdlist_lock);
+		if (!entry->closed) {
+			pthread_mutex_unlock(&devlist_lock);
+
+			entry->ref_count++;
+
+			SLIST_INSERT_HEAD(&entry->thdlist_head, thd, dev_list_entry);
+			thd->entry = entry;
+			thd->ring_seq = entry->ring_head;
+			entry->update_mask = true;
+			IIO_DEBUG("Added thread to client list\n");
+
+			pthread_cond_signal(&entry->rw_ready_cond);
+
+			/* Wait until the device is opened by the rw thread */
+			while (thd->wait_for_open) {
+				ret = thd_entry_event_wait(thd, &entry->thdlist_lock, pdata->fd_in);
+				if (ret)
+					break;
+			}
+			pthread_mutex_unlock(&entry->thdlist_lock);
+
+			if (ret == 0)
+				ret = (int) thd->err;
+			if (ret < 0)
+				remove_thd_entry(thd);
+			else
+				SLIST_INSERT_HEAD(&pdata->thdlist_head, thd, parser_list_entry);
+			return ret;
+		} else {
+			pthread_mutex_unlock(&entry->thdlist_lock);
+		}
+	}
+
+	entry = zalloc(sizeof(*entry));
+	if (!entry) {
+		pthread_mutex_unlock(&devlist_lock);
+		goto err_free_thd;
+	}
+
+	entry->ref_count = 2; /* One for thread, one for the client */
+
+	entry->mask = malloc(len * sizeof(*words));
+	if (!entry->mask) {
+		pthread_mutex_unlock(&devlist_lock);
+		goto err_free_entry;
+	}
+
+	entry->ring_size = server_ring_size ? server_ring_size : 1;
+	entry->ring = calloc(entry->ring_size, sizeof(*entry->ring));
+	if (!entry->ring) {
+		pthread_mutex_unlock(&devlist_lock);
+		goto err_free_entry_mask;
+	}
+
+	entry->cyclic = cyclic;
+	entry->nb_words = len;
+	entry->update_mask = true;
+	entry->dev = dev;
+	entry->buf = NULL;
+	SLIST_INIT(&entry->thdlist_head);
+	SLIST_INSERT_HEAD(&entry->thdlist_head, thd, dev_list_entry);
+	thd->entry = entry;
+	IIO_DEBUG("Added thread to client list\n");
+
+	pthread_mutex_init(&entry->thdlist_lock, NULL);
+	pthread_cond_init(&entry->rw_ready_cond, NULL);
+
+	get_rw_thd_sched(dev, &sched);
+
+	ret = thread_pool_add_thread_sched(main_thread_pool, rw_thd, entry,
+			"rw_thd", &sched);
+	if (ret == EPERM && sched.priority) {
+		IIO_WARNING("Not allowed to use SCHED_FIFO for the R/W thread\n");
+
+		sched.priority = 0;
+		ret = thread_pool_add_thread_sched(main_thread_pool, rw_thd,
+				entry, "rw_thd", &sched);
+	}
+	if (ret) {
+		pthread_mutex_unlock(&devlist_lock);
+		goto err_free_entry_ring;
+	}
+
+	IIO_DEBUG("Adding new device thread to device list\n");
+	iio_device_set_data(dev, entry);
+	pthread_mutex_unlock(&devlist_lock);
+
+	pthread_mutex_lock(&entry->thdlist_lock);
+	/* Wait until the device is opened by the rw thread */
+	while (thd->wait_for_open) {
+		ret = thd_entry_event_wait(thd, &entry->thdlist_lock, pdata->fd_in);
+		if (ret)
+			break;
+	}
+	pthread_mutex_unlock(&entry->thdlist_lock);
+
+	if (ret == 0)
+		ret = (int) thd->err;
+	if (ret < 0)
+		remove_thd_entry(thd);
+	else
+		SLIST_INSERT_HEAD(&pdata->thdlist_head, thd, parser_list_entry);
+	return ret;
+
+err_free_entry_ring:
+	free(entry->ring);
+err_free_entry_mask:
+	free(entry->mask);
+err_free_entry:
+	free(entry);
+err_free_thd:
+	close(thd->eventfd);
+	free(thd);
+err_free_words:
+	free(words);
+	return ret;
+}
+
+static int close_dev_helper(struct parser_pdata *pdata, struct iio_device *dev)
+{
+	struct ThdEntry *t;
+
+	if (!dev)
+		return -ENODEV;
+
+	t = parser_lookup_thd_entry(pdata, dev);
+	if (!t)
+		return -ENXIO;
+
+	SLIST_REMOVE(&pdata->thdlist_head, t, ThdEntry, parser_list_entry);
+	remove_thd_entry(t);
+
+	return 0;
+}
+
+/* Changes the channels and the number of samples of a device already opened
+ * by this client. The R/W thread reprograms the device in place. */
+static int reopen_dev_helper(struct parser_pdata *pdata,
+		struct iio_device *dev, size_t samples_count, const char *mask)
+{
+	struct DevEntry *entry;
+	struct ThdEntry *thd;
+	size_t len = strlen(mask);
+	uint32_t *words;
+	int ret = 0;
+
+	if (!dev)
+		return -ENODEV;
+
+	thd = parser_lookup_thd_entry(pdata, dev);
+	if (!thd)
+		return -ENXIO;
+
+	if (len != ((dev->nb_channels + 31) / 32) * 8)
+		return -EINVAL;
+
+	words = get_mask(mask, &len);
+	if (!words)
+		return -ENOMEM;
+
+	entry = thd->entry;
+	pthread_mutex_lock(&entry->thdlist_lock);
+	if (entry->closed) {
+		pthread_mutex_unlock(&entry->thdlist_lock);
+		free(words);
+		return -EBADF;
+	}
+
+	free(thd->mask);
 	thd->mask = words;
-	thd->nb = 0;
 	thd->samples_count = samples_count;
 	thd->sample_size = iio_device_get_sample_size_mask(dev, words, len);
-	thd->pdata = pdata;
-	thd->dev = dev;
-	thd->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thd->err = 0;
+	thd->wait_for_open = true;
+	entry->update_mask = true;
+	pthread_cond_signal(&entry->rw_ready_cond);
 
-retry:
-	/* Atomically look up the thread and make sure that it is still active
-	 * or allocate new one. */
-	pthread_mutex_lock(&devlist_lock);
-	entry = iio_device_get_data(dev);
-	if (entry) {
-		if (cyclic || entry->cyclic) {
-			/* Only one client allowed in cyclic mode */
-			pthread_mutex_unlock(&devlist_lock);
+	while (thd->wait_for_open) {
+		ret = thd_entry_event_wait(thd, &entry->thdlist_lock,
+				pdata->fd_in);
+		if (ret)
+			break;
+	}
+	pthread_mutex_unlock(&entry->thdlist_lock);
 
-			/* There is an inherent race condition if a client
-			 * creates a new cyclic buffer shortly after destroying
-			 * a previous. E.g. like
-			 *
-			 *     iio_buffer_destroy(buf);
-			 *     buf = iio_device_create_buffer(dev, n, true);
-			 *
-			 * In this case the two buffers each use their own
-			 * communication channel which are unordered to each
-			 * other. E.g. the socket open might arrive before the
-			 * socket close on the host side, even though they were
-			 * sent in the opposite order on the client side. This
-			 * race condition can cause an error being reported back
-			 * to the client, even though the code on the client
-			 * side was well formed and would work fine e.g. using
-			 * the local backend.
-			 *
-			 * To avoid this issue go to sleep for up to 50ms in
-			 * intervals of 100us. This should be enough time for
-			 * the issue to resolve itself. If there actually is
-			 * contention on the buffer an error will eventually be
-			 * returned in which case the additional delay cause by
-			 * the retires should not matter too much.
-			 *
-			 * This is not pretty but it works.
-			 */
-			if (cyclic_retry) {
-				struct timespec wait;
-				wait.tv_sec = 0;
-				wait.tv_nsec = (100 * 1000);
-				cyclic_retry--;
-				nanosleep(&wait, &wait);
-				goto retry;
-			}
+	if (ret == 0)
+		ret = (int) thd->err;
+	return ret;
+}
+
+int open_dev(struct parser_pdata *pdata, struct iio_device *dev,
+		size_t samples_count, const char *mask, bool cyclic)
+{
+	int ret = open_dev_helper(pdata, dev, samples_count, mask, cyclic);
+	print_value(pdata, ret);
+	return ret;
+}
+
+int close_dev(struct parser_pdata *pdata, struct iio_device *dev)
+{
+	int ret = close_dev_helper(pdata, dev);
+	print_value(pdata, ret);
+	return ret;
+}
+
+int reopen_dev(struct parser_pdata *pdata, struct iio_device *dev,
+		size_t samples_count, const char *mask)
+{
+	int ret = reopen_dev_helper(pdata, dev, samples_count, mask);
+	print_value(pdata, ret);
+	return ret;
+}
+
+ssize_t rw_dev(struct parser_pdata *pdata, struct iio_device *dev,
+		unsigned int nb, bool is_write)
+{
+	ssize_t ret = rw_buffer(pdata, dev, nb, is_write);
+	if (ret <= 0 || is_write)
+		print_value(pdata, ret);
+	return ret;
+}
+
+ssize_t read_dev_attr(struct parser_pdata *pdata, struct iio_device *dev,
+		const char *attr, enum iio_attr_type type)
+{
+	/* We use a very large buffer here, as if attr is NULL all the
+	 * attributes will be read, which may represents a few kilobytes worth
+	 * of data. */
+	char buf[0x10000];
+	struct iovec iov;
+	ssize_t ret = -EINVAL;
+
+	if (!dev) {
+		print_value(pdata, -ENODEV);
+		return -ENODEV;
+	}
+
+	switch (type) {
+		case IIO_ATTR_TYPE_DEVICE:
+			ret = iio_device_attr_read(dev, attr, buf, sizeof(buf) - 1);
+			break;
+		case IIO_ATTR_TYPE_DEBUG:
+			ret = iio_device_debug_attr_read(dev,
+				attr, buf, sizeof(buf) - 1);
+			break;
+		case IIO_ATTR_TYPE_BUFFER:
+			ret = iio_device_buffer_attr_read(dev,
+							attr, buf, sizeof(buf) - 1);
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+	}
+	if (ret < 0) {
+		print_value(pdata, ret);
+		return ret;
+	}
+
+	buf[ret] = '\n';
+	iov.iov_base = buf;
+	iov.iov_len = ret + 1;
+	return send_response(pdata, ret, &iov, 1);
+}
+
+ssize_t write_dev_attr(struct parser_pdata *pdata, struct iio_device *dev,
+		const char *attr, size_t len, enum iio_attr_type type)
+{
+	ssize_t ret = -ENOMEM;
+	char *buf;
+
+	if (!dev) {
+		ret = -ENODEV;
+		goto err_print_value;
+	}
+
+	buf = malloc(len);
+	if (!buf)
+		goto err_print_value;
+
+	ret = read_all(pdata, buf, len);
+	if (ret < 0)
+		goto err_free_buffer;
+
+	switch (type) {
+		case IIO_ATTR_TYPE_DEVICE:
+			ret = iio_device_attr_write_raw(dev, attr, buf, len);
+			break;
+		case IIO_ATTR_TYPE_DEBUG:
+			ret = iio_device_debug_attr_write_raw(dev, attr, buf, len);
+			break;
+		case IIO_ATTR_TYPE_BUFFER:
+			ret = iio_device_buffer_attr_write_raw(dev, attr, buf, len);
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+	}
+
+err_free_buffer:
+	free(buf);
+err_print_value:
+	print_value(pdata, ret);
+	return ret;
+}
+
+/* Parses the numbers sent by the client, up to 'max'; returns how many
+ * there are. They are only stored if 'words' is non-NULL. */
+static ssize_t parse_regs(const char *buf, uint32_t *words, size_t max)
+{
+	const char *ptr = buf;
+	unsigned long val;
+	char *end;
+	size_t nb;
+
+	for (nb = 0; ; nb++) {
+		while (*ptr == ' ')
+			ptr++;
+		if (!*ptr)
+			break;
+
+		if (nb == max)
+			return -E2BIG;
+
+		errno = 0;
+		val = strtoul(ptr, &end, 0);
+		if (end == ptr || errno || val > UINT32_MAX)
+			return -EINVAL;
+
+		if (words)
+			words[nb] = (uint32_t) val;
+		ptr = end;
+	}
+
+	return (ssize_t) nb;
+}
+
+ssize_t rw_regs(struct parser_pdata *pdata, struct iio_device *dev,
+		size_t len, bool is_write)
+{
+	/* With REGWRITE, the addresses alternate with the values */
+	size_t i, nb, reply_len, max = is_write ? 2 * IIO_MAX_REGS : IIO_MAX_REGS;
+	uint32_t *words = NULL, *addrs = NULL, *values = NULL;
+	char *buf, *reply = NULL, *ptr;
+	struct iovec iov;
+	ssize_t ret;
+
+	/* "0x%x " is at most 11 characters */
+	if (!dev || len > max * 11) {
+		ret = dev ? -E2BIG : -ENODEV;
+		goto err_print_value;
+	}
+
+	buf = malloc(len + 1);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto err_print_value;
+	}
+
+	ret = read_all(pdata, buf, len);
+	if (ret < 0)
+		goto err_free_buf;
+
+	buf[len] = '\0';
+
+	ret = parse_regs(buf, NULL, max);
+	if (ret <= 0 || (is_write && ret & 1)) {
+		ret = ret < 0 ? ret : -EINVAL;
+		goto err_free_buf;
+	}
+
+	nb = is_write ? (size_t) ret / 2 : (size_t) ret;
+
+	words = malloc((size_t) ret * sizeof(*words));
+	addrs = malloc(nb * sizeof(*addrs));
+	values = malloc(nb * sizeof(*values));
+	reply_len = nb * 11 + 16;
+	reply = malloc(reply_len);
+	if (!words || !addrs || !values || !reply) {
+		ret = -ENOMEM;
+		goto err_free_buf;
+	}
+
+	parse_regs(buf, words, max);
+
+	for (i = 0; i < nb; i++) {
+		if (is_write) {
+			addrs[i] = words[2 * i];
+			values[i] = words[2 * i + 1];
+		} else {
+			addrs[i] = words[i];
+		}
+	}
+
+	if (is_write)
+		ret = iio_device_reg_write_bulk(dev, addrs, values, nb);
+	else
+		ret = iio_device_reg_read_bulk(dev, addrs, values, nb);
+
+	/* The result of the accesses is part of the payload, so that the
+	 * client can tell it from a rejected command */
+	ptr = reply + iio_snprintf(reply, reply_len, "%zd", ret);
+	for (i = 0; !is_write && !ret && i < nb; i++)
+		ptr += iio_snprintf(ptr, reply_len - (ptr - reply),
+				" 0x%" PRIx32, values[i]);
+	*ptr = '\n';
+
+	iov.iov_base = reply;
+	iov.iov_len = (size_t) (ptr - reply) + 1;
+	ret = send_response(pdata, (long) (ptr - reply), &iov, 1);
+
+	free(reply);
+	free(values);
+	free(addrs);
+	free(words);
+	free(buf);
+	return ret;
+
+err_free_buf:
+	free(reply);
+	free(values);
+	free(addrs);
+	free(words);
+	free(buf);
+err_print_value:
+	print_value(pdata, ret);
+	return ret;
+}
+
+/* One line per device and operation recorded: the ID of the device, the name
+ * of the operation, its counters, and its histogram */
+ssize_t print_stats(struct parser_pdata *pdata)
+{
+	/* "%" PRIu64 " " is at most 21 characters */
+	size_t line_len = NAME_MAX + 32 + (5 + IIO_STATS_NB_BUCKETS) * 21;
+	unsigned int i, j, k, nb = iio_context_get_devices_count(pdata->ctx);
+	char *buf, *ptr;
+	struct iovec iov;
+	ssize_t ret;
+
+	buf = malloc((size_t) nb * IIO_STATS_NB_OPS * line_len + 1);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto err_print_value;
+	}
+
+	for (ptr = buf, i = 0; i < nb; i++) {
+		const struct iio_device *dev = iio_context_get_device(pdata->ctx, i);
+
+		for (j = 0; j < IIO_STATS_NB_OPS; j++) {
+			struct iio_stats stats;
+
+			ret = iio_device_get_stats(dev, (enum iio_stats_op) j,
+					&stats);
+			if (ret < 0)
+				goto err_free_buf;
+			if (!stats.count)
+				continue;
+
+			ptr += iio_snprintf(ptr, line_len, "%s %s %" PRIu64
+					" %" PRIu64 " %" PRIu64 " %" PRIu64
+					" %" PRIu64, iio_device_get_id(dev),
+					iio_stats_op_get_name((enum iio_stats_op) j),
+					stats.count, stats.errors, stats.bytes,
+					stats.total_ns, stats.max_ns);
+
+			for (k = 0; k < IIO_STATS_NB_BUCKETS; k++)
+				ptr += iio_snprintf(ptr, 22, " %" PRIu64,
+						stats.histogram[k]);
+			*ptr++ = '\n';
+		}
+	}
+
+	/* The payload ends with the \n of the last line */
+	if (ptr == buf)
+		*ptr++ = '\n';
+
+	iov.iov_base = buf;
+	iov.iov_len = (size_t) (ptr - buf);
+	ret = send_response(pdata, (long) (ptr - buf) - 1, &iov, 1);
+
+	free(buf);
+	return ret;
+
+err_free_buf:
+	free(buf);
+err_print_value:
+	print_value(pdata, ret);
+	return ret;
+}
+
+int open_events(struct parser_pdata *pdata, struct iio_device *dev)
+{
+	int ret = 0;
+
+	if (!dev)
+		ret = -ENODEV;
+	else if (pdata->events)
+		ret = -EBUSY;
 
-			ret = -EBUSY;
-			goto err_free_thd;
-		}
+	if (!ret) {
+		pdata->events = iio_device_create_event_stream(dev);
+		if (!pdata->events)
+			ret = -errno;
+	}
 
-		pthread_mutex_lock(&entry->thdlist_lock);
-		if (!entry->closed) {
-			pthread_mutex_unlock(&devlist_lock);
+	print_value(pdata, ret);
+	return ret;
+}
 
-			entry->ref_count++;
+ssize_t read_events(struct parser_pdata *pdata, unsigned int nb)
+{
+	struct iio_event events[IIOD_MAX_EVENTS];
+	/* "0x%016llx %lld " is at most 40 characters */
+	char buf[IIOD_MAX_EVENTS * 40 + 1], *ptr = buf;
+	struct iovec iov;
+	ssize_t i, ret;
+
+	if (!pdata->events) {
+		ret = -EBADF;
+		goto err_print_value;
+	}
 
-			SLIST_INSERT_HEAD(&entry->thdlist_head, thd, dev_list_entry);
-			thd->entry = entry;
-			entry->update_mask = true;
-			IIO_DEBUG("Added thread to client list\n");
+	/* Fewer events than asked for can be sent back */
+	if (nb > IIOD_MAX_EVENTS)
+		nb = IIOD_MAX_EVENTS;
 
-			pthread_cond_signal(&entry->rw_ready_cond);
+	ret = iio_event_stream_read(pdata->events, events, nb);
+	if (ret < 0)
+		goto err_print_value;
 
-			/* Wait until the device is opened by the rw thread */
-			while (thd->wait_for_open) {
-				ret = thd_entry_event_wait(thd, &entry->thdlist_lock, pdata->fd_in);
-				if (ret)
-					break;
-			}
-			pthread_mutex_unlock(&entry->thdlist_lock);
+	for (i = 0; i < ret; i++)
+		ptr += iio_snprintf(ptr, sizeof(buf) - (ptr - buf),
+				"%s0x%" PRIx64 " %" PRId64, i ? " " : "",
+				events[i].id, events[i].timestamp);
+	*ptr = '\n';
 
-			if (ret == 0)
-				ret = (int) thd->err;
-			if (ret < 0)
-				remove_thd_entry(thd);
-			else
-				SLIST_INSERT_HEAD(&pdata->thdlist_head, thd, parser_list_entry);
-			return ret;
-		} else {
-			pthread_mutex_unlock(&entry->thdlist_lock);
-		}
-	}
+	iov.iov_base = buf;
+	iov.iov_len = (size_t) (ptr - buf) + 1;
+	return send_response(pdata, (long) (ptr - buf), &iov, 1);
 
-	entry = zalloc(sizeof(*entry));
-	if (!entry) {
-		pthread_mutex_unlock(&devlist_lock);
-		goto err_free_thd;
-	}
+err_print_value:
+	print_value(pdata, ret);
+	return ret;
+}
 
-	entry->ref_count = 2; /* One for thread, one for the client */
+int close_events(struct parser_pdata *pdata)
+{
+	int ret = -EBADF;
 
-	entry->mask = malloc(len * sizeof(*words));
-	if (!entry->mask) {
-		pthread_mutex_unlock(&devlist_lock);
-		goto err_free_entry;
+	if (pdata->events) {
+		iio_event_stream_destroy(pdata->events);
+		pdata->events = NULL;
+		ret = 0;
 	}
 
-	entry->cyclic = cyclic;
-	entry->nb_words = len;
-	entry->update_mask = true;
-	entry->dev = dev;
-	entry->buf = NULL;
-	SLIST_INIT(&entry->thdlist_head);
-	SLIST_INSERT_HEAD(&entry->thdlist_head, thd, dev_list_entry);
-	thd->entry = entry;
-	IIO_DEBUG("Added thread to client list\n");
+	print_value(pdata, ret);
+	return ret;
+}
 
-	pthread_mutex_init(&entry->thdlist_lock, NULL);
-	pthread_cond_init(&entry->rw_ready_cond, NULL);
+ssize_t read_chn_attr(struct parser_pdata *pdata,
+		struct iio_channel *chn, const char *attr)
+{
+	char buf[1024];
+	struct iovec iov;
+	ssize_t ret = -ENODEV;
 
-	ret = thread_pool_add_thread(main_thread_pool, rw_thd, entry, "rw_thd");
-	if (ret) {
-		pthread_mutex_unlock(&devlist_lock);
-		goto err_free_entry_mask;
+	if (chn)
+		ret = iio_channel_attr_read(chn, attr, buf, sizeof(buf) - 1);
+	else if (pdata->dev)
+		ret = -ENXIO;
+	if (ret < 0) {
+		print_value(pdata, ret);
+		return ret;
 	}
 
-	IIO_DEBUG("Adding new device thread to device list\n");
-	iio_device_set_data(dev, entry);
-	pthread_mutex_unlock(&devlist_lock);
+	buf[ret] = '\n';
+	iov.iov_base = buf;
+	iov.iov_len = ret + 1;
+	return send_response(pdata, ret, &iov, 1);
+}
 
-	pthread_mutex_lock(&entry->thdlist_lock);
-	/* Wait until the device is opened by the rw thread */
-	while (thd->wait_for_open) {
-		ret = thd_entry_event_wait(thd, &entry->thdlist_lock, pdata->fd_in);
-		if (ret)
-			break;
-	}
-	pthread_mutex_unlock(&entry->thdlist_lock);
+ssize_t write_chn_attr(struct parser_pdata *pdata,
+		struct iio_channel *chn, const char *attr, size_t len)
+{
+	ssize_t ret = -ENOMEM;
+	char *buf = malloc(len);
+	if (!buf)
+		goto err_print_value;
 
-	if (ret == 0)
-		ret = (int) thd->err;
+	ret = read_all(pdata, buf, len);
 	if (ret < 0)
-		remove_thd_entry(thd);
+		goto err_free_buffer;
+
+	if (chn)
+		ret = iio_channel_attr_write_raw(chn, attr, buf, len);
+	else if (pdata->dev)
+		ret = -ENXIO;
 	else
-		SLIST_INSERT_HEAD(&pdata->thdlist_head, thd, parser_list_entry);
+		ret = -ENODEV;
+err_free_buffer:
+	free(buf);
+err_print_value:
+	print_value(pdata, ret);
 	return ret;
+}
 
-err_free_entry_mask:
-	free(entry->mask);
-err_free_entry:
-	free(entry);
-err_free_thd:
-	close(thd->eventfd);
-	free(thd);
-err_free_words:
-	free(words);
+ssize_t set_trigger(struct parser_pdata *pdata,
+		struct iio_device *dev, const char *trigger)
+{
+	struct iio_device *trig = NULL;
+	ssize_t ret = -ENOENT;
+
+	if (!dev) {
+		ret = -ENODEV;
+		goto err_print_value;
+	}
+
+	if (trigger) {
+		trig = iio_context_find_device(pdata->ctx, trigger);
+		if (!trig)
+			goto err_print_value;
+	}
+
+	ret = iio_device_set_trigger(dev, trig);
+err_print_value:
+	print_value(pdata, ret);
 	return ret;
 }
 
-static int close_dev_helper(struct parser_pdata *pdata, struct iio_device *dev)
+ssize_t get_trigger(struct parser_pdata *pdata, struct iio_device *dev)
 {
-	struct ThdEntry *t;
+	const struct iio_device *trigger;
+	ssize_t ret;
 
-	if (!dev)
+	if (!dev) {
+		print_value(pdata, -ENODEV);
 		return -ENODEV;
+	}
 
-	t = parser_lookup_thd_entry(pdata, dev);
-	if (!t)
-		return -ENXIO;
+	ret = iio_device_get_trigger(dev, &trigger);
+	if (!ret && trigger) {
+		char buf[256];
+		struct iovec iov;
 
-	SLIST_REMOVE(&pdata->thdlist_head, t, ThdEntry, parser_list_entry);
-	remove_thd_entry(t);
+		ret = strlen(trigger->name);
 
-	return 0;
+		iio_snprintf(buf, sizeof(buf), "%s\n", trigger->name);
+		iov.iov_base = buf;
+		iov.iov_len = ret + 1;
+		ret = send_response(pdata, ret, &iov, 1);
+	} else {
+		print_value(pdata, ret);
+	}
+	return ret;
 }
 
-int open_dev(struct parser_pdata *pdata, struct iio_device *dev,
-		size_t samples_count, const char *mask, bool cyclic)
+int set_udp(struct parser_pdata *pdata, unsigned int port)
 {
-	int ret = open_dev_helper(pdata, dev, samples_count, mask, cyclic);
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	int fd, ret;
+
+	/* The datagrams are located in the chunks through the responses of
+	 * READBUF, which requires the binary protocol */
+	if (!pdata->binary || !pdata->fd_out_is_socket || !port || port > 65535) {
+		ret = -EINVAL;
+		goto err_print_value;
+	}
+
+	if (getpeername(pdata->fd_out, (struct sockaddr *) &addr, &addr_len) < 0) {
+		ret = -errno;
+		goto err_print_value;
+	}
+
+	if (addr.ss_family == AF_INET) {
+		((struct sockaddr_in *) &addr)->sin_port = htons((uint16_t) port);
+	} else if (addr.ss_family == AF_INET6) {
+		((struct sockaddr_in6 *) &addr)->sin6_port = htons((uint16_t) port);
+	} else {
+		ret = -EAFNOSUPPORT;
+		goto err_print_value;
+	}
+
+	fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ret = -errno;
+		goto err_print_value;
+	}
+
+	if (connect(fd, (struct sockaddr *) &addr, addr_len) < 0) {
+		ret = -errno;
+		close(fd);
+		goto err_print_value;
+	}
+
+	if (pdata->udp_fd >= 0)
+		close(pdata->udp_fd);
+	pdata->udp_fd = fd;
+	ret = 0;
+
+err_print_value:
 	print_value(pdata, ret);
 	return ret;
 }
 
-int close_dev(struct parser_pdata *pdata, struct iio_device *dev)
+/* The shared memory is only accepted from the clients on the same host, and
+ * must be one they created for iiod */
+static bool shm_allowed(const struct parser_pdata *pdata, const char *name)
 {
-	int ret = close_dev_helper(pdata, dev);
-	print_value(pdata, ret);
-	return ret;
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+
+	if (strncmp(name, "/iiod-", sizeof("/iiod-") - 1) ||
+			strchr(name + 1, '/'))
+		return false;
+
+	if (getpeername(pdata->fd_out, (struct sockaddr *) &addr, &addr_len) < 0)
+		return false;
+
+	if (addr.ss_family == AF_INET) {
+		const struct sockaddr_in *in = (const struct sockaddr_in *) &addr;
+
+		return (ntohl(in->sin_addr.s_addr) >> 24) == IN_LOOPBACKNET;
+	}
+
+	if (addr.ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) &addr;
+		const uint8_t *a = in6->sin6_addr.s6_addr;
+
+		return IN6_IS_ADDR_LOOPBACK(&in6->sin6_addr) ||
+			(IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr) &&
+			 a[12] == IN_LOOPBACKNET);
+	}
+
+	return addr.ss_family == AF_UNIX;
 }
 
-ssize_t rw_dev(struct parser_pdata *pdata, struct iio_device *dev,
-		unsigned int nb, bool is_write)
+/* Formats the address of a TCP socket as the tables of /proc/net list it,
+ * and returns the path of the one listing the socket. IPv4-mapped addresses
+ * are formatted as IPv4 ones, as the socket at the other end is an IPv4 one.
+ */
+static const char * proc_net_tcp_addr(const struct sockaddr_storage *addr,
+		char *buf, size_t len, unsigned int *port)
 {
-	ssize_t ret = rw_buffer(pdata, dev, nb, is_write);
-	if (ret <= 0 || is_write)
-		print_value(pdata, ret);
-	return ret;
+	const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+	const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+	uint32_t words[4];
+
+	if (addr->ss_family == AF_INET) {
+		iio_snprintf(buf, len, "%08X", in->sin_addr.s_addr);
+		*port = ntohs(in->sin_port);
+		return "/proc/net/tcp";
+	}
+
+	if (addr->ss_family != AF_INET6)
+		return NULL;
+
+	memcpy(words, &in6->sin6_addr, sizeof(words));
+	*port = ntohs(in6->sin6_port);
+
+	if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+		iio_snprintf(buf, len, "%08X", words[3]);
+		return "/proc/net/tcp";
+	}
+
+	iio_snprintf(buf, len, "%08X%08X%08X%08X",
+			words[0], words[1], words[2], words[3]);
+	return "/proc/net/tcp6";
 }
 
-ssize_t read_dev_attr(struct parser_pdata *pdata, struct iio_device *dev,
-		const char *attr, enum iio_attr_type type)
+/* Gets the user ID of the client, which runs on the same host: from the
+ * credentials of a UNIX socket, or from the owner of the other end of the TCP
+ * connection as listed in /proc/net */
+static int get_peer_uid(const struct parser_pdata *pdata, uid_t *uid)
 {
-	/* We use a very large buffer here, as if attr is NULL all the
-	 * attributes will be read, which may represents a few kilobytes worth
-	 * of data. */
-	char buf[0x10000];
-	ssize_t ret = -EINVAL;
+	struct sockaddr_storage peer, local;
+	char peer_addr[33], local_addr[33], addr1[33], addr2[33], line[256];
+	unsigned int peer_port, local_port, port1, port2, id;
+	socklen_t len = sizeof(peer);
+	const char *path;
+	int ret = -ESRCH;
+	FILE *f;
+
+	if (getpeername(pdata->fd_out, (struct sockaddr *) &peer, &len) < 0)
+		return -errno;
 
-	if (!dev) {
-		print_value(pdata, -ENODEV);
-		return -ENODEV;
+	if (peer.ss_family == AF_UNIX) {
+		struct ucred cred;
+
+		len = sizeof(cred);
+		if (getsockopt(pdata->fd_out, SOL_SOCKET, SO_PEERCRED,
+					&cred, &len) < 0)
+			return -errno;
+
+		*uid = cred.uid;
+		return 0;
 	}
 
-	switch (type) {
-		case IIO_ATTR_TYPE_DEVICE:
-			ret = iio_device_attr_read(dev, attr, buf, sizeof(buf) - 1);
-			break;
-		case IIO_ATTR_TYPE_DEBUG:
-			ret = iio_device_debug_attr_read(dev,
-				attr, buf, sizeof(buf) - 1);
-			break;
-		case IIO_ATTR_TYPE_BUFFER:
-			ret = iio_device_buffer_attr_read(dev,
-							attr, buf, sizeof(buf) - 1);
-			break;
-		default:
-			ret = -EINVAL;
+	len = sizeof(local);
+	if (getsockname(pdata->fd_out, (struct sockaddr *) &local, &len) < 0)
+		return -errno;
+
+	path = proc_net_tcp_addr(&peer, peer_addr, sizeof(peer_addr),
+			&peer_port);
+	if (!path || !proc_net_tcp_addr(&local, local_addr,
+				sizeof(local_addr), &local_port))
+		return -EAFNOSUPPORT;
+
+	f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, " %*u: %32[0-9A-F]:%x %32[0-9A-F]:%x "
+					"%*x %*x:%*x %*x:%*x %*x %u",
+					addr1, &port1, addr2, &port2, &id) != 5)
+			continue;
+
+		/* The socket of the client: its local end is our remote one */
+		if (port1 == peer_port && port2 == local_port &&
+				!strcmp(addr1, peer_addr) &&
+				!strcmp(addr2, local_addr)) {
+			*uid = (uid_t) id;
+			ret = 0;
 			break;
+		}
 	}
-	print_value(pdata, ret);
-	if (ret < 0)
-		return ret;
 
-	buf[ret] = '\n';
-	return write_all(pdata, buf, ret + 1);
+	fclose(f);
+
+	return ret;
 }
 
-ssize_t write_dev_attr(struct parser_pdata *pdata, struct iio_device *dev,
-		const char *attr, size_t len, enum iio_attr_type type)
+static void close_shm(struct parser_pdata *pdata)
 {
-	ssize_t ret = -ENOMEM;
-	char *buf;
+	if (pdata->shm_fd >= 0) {
+		close(pdata->shm_fd);
+		pdata->shm_fd = -1;
+	}
+}
 
-	if (!dev) {
-		ret = -ENODEV;
+int set_shm(struct parser_pdata *pdata, const char *name)
+{
+	struct iiod_shm_header hdr;
+	struct stat st;
+	uid_t uid;
+	int fd, ret;
+
+	/* The chunks are located in the shared memory through the responses
+	 * of READBUF, which requires the binary protocol */
+	if (!pdata->binary || !pdata->fd_out_is_socket) {
+		ret = -EINVAL;
 		goto err_print_value;
 	}
 
-	buf = malloc(len);
-	if (!buf)
+	if (!shm_allowed(pdata, name)) {
+		ret = -EPERM;
 		goto err_print_value;
+	}
 
-	ret = read_all(pdata, buf, len);
-	if (ret < 0)
-		goto err_free_buffer;
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		ret = -errno;
+		goto err_print_value;
+	}
 
-	switch (type) {
-		case IIO_ATTR_TYPE_DEVICE:
-			ret = iio_device_attr_write_raw(dev, attr, buf, len);
-			break;
-		case IIO_ATTR_TYPE_DEBUG:
-			ret = iio_device_debug_attr_write_raw(dev, attr, buf, len);
-			break;
-		case IIO_ATTR_TYPE_BUFFER:
-			ret = iio_device_buffer_attr_write_raw(dev, attr, buf, len);
-			break;
-		default:
-			ret = -EINVAL;
-			break;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+		goto err_close_fd;
 	}
 
-err_free_buffer:
-	free(buf);
+	/* Only the object of the client itself, not the one of another user
+	 * whose name it guessed */
+	ret = get_peer_uid(pdata, &uid);
+	if (ret < 0 || st.st_uid != uid) {
+		ret = -EPERM;
+		goto err_close_fd;
+	}
+
+	if (st.st_size <= IIOD_SHM_DATA_OFFSET ||
+			pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		ret = -EINVAL;
+		goto err_close_fd;
+	}
+
+	/* The client could resize the object afterwards; see write_shm() */
+	if (!hdr.nb_slots || !hdr.slot_size ||
+			(uint64_t) hdr.nb_slots * hdr.slot_size >
+			(uint64_t) st.st_size - IIOD_SHM_DATA_OFFSET) {
+		ret = -EINVAL;
+		goto err_close_fd;
+	}
+
+	close_shm(pdata);
+	pdata->shm_fd = fd;
+	pdata->shm_nb_slots = hdr.nb_slots;
+	pdata->shm_slot_size = hdr.slot_size;
+	pdata->shm_seq = 0;
+	print_value(pdata, 0);
+	return 0;
+
+err_close_fd:
+	close(fd);
 err_print_value:
 	print_value(pdata, ret);
 	return ret;
 }
 
-ssize_t read_chn_attr(struct parser_pdata *pdata,
-		struct iio_channel *chn, const char *attr)
+static void close_stripes(struct parser_pdata *pdata)
 {
-	char buf[1024];
-	ssize_t ret = -ENODEV;
+	unsigned int i;
 
-	if (chn)
-		ret = iio_channel_attr_read(chn, attr, buf, sizeof(buf) - 1);
-	else if (pdata->dev)
-		ret = -ENXIO;
-	print_value(pdata, ret);
-	if (ret < 0)
-		return ret;
+	for (i = 1; i < pdata->nb_stripes; i++)
+		close(pdata->stripe_fds[i - 1]);
 
-	buf[ret] = '\n';
-	return write_all(pdata, buf, ret + 1);
+	pdata->nb_stripes = 1;
 }
 
-ssize_t write_chn_attr(struct parser_pdata *pdata,
-		struct iio_channel *chn, const char *attr, size_t len)
+int set_stripes(struct parser_pdata *pdata, unsigned int nb, size_t size)
 {
-	ssize_t ret = -ENOMEM;
-	char *buf = malloc(len);
-	if (!buf)
-		goto err_print_value;
+	int fds[IIOD_MAX_STRIPES - 1];
+	int ret = 0;
+
+	/* The client tells the chunks apart from their size and order,
+	 * which the frames of the binary protocol would break */
+	if (pdata->binary || !nb || nb > IIOD_MAX_STRIPES ||
+			!size || size > IIOD_MAX_STRIPE_SIZE) {
+		ret = -EINVAL;
+		goto out_print_value;
+	}
 
-	ret = read_all(pdata, buf, len);
-	if (ret < 0)
-		goto err_free_buffer;
+	if (nb > 1 && !pdata->open_stripes) {
+		ret = -ENOSYS;
+		goto out_print_value;
+	}
 
-	if (chn)
-		ret = iio_channel_attr_write_raw(chn, attr, buf, len);
-	else if (pdata->dev)
-		ret = -ENXIO;
-	else
-		ret = -ENODEV;
-err_free_buffer:
-	free(buf);
-err_print_value:
+	close_stripes(pdata);
+
+	if (nb > 1) {
+		ret = pdata->open_stripes(pdata, fds, nb - 1);
+		if (ret < 0)
+			goto out_print_value;
+
+		memcpy(pdata->stripe_fds, fds, (nb - 1) * sizeof(*fds));
+	}
+
+	pdata->nb_stripes = nb;
+	pdata->stripe_size = size;
+
+out_print_value:
 	print_value(pdata, ret);
 	return ret;
 }
 
-ssize_t set_trigger(struct parser_pdata *pdata,
-		struct iio_device *dev, const char *trigger)
+int set_decimation(struct parser_pdata *pdata, struct iio_device *dev,
+		unsigned int factor, const char *mode)
 {
-	struct iio_device *trig = NULL;
-	ssize_t ret = -ENOENT;
+	struct ThdEntry *thd;
+	bool average = false;
+	int ret = -EBADF;
 
 	if (!dev) {
 		ret = -ENODEV;
 		goto err_print_value;
 	}
 
-	if (trigger) {
-		trig = iio_context_find_device(pdata->ctx, trigger);
-		if (!trig)
+	if (!factor) {
+		ret = -EINVAL;
+		goto err_print_value;
+	}
+
+	if (mode) {
+		if (strcmp(mode, "AVERAGE") && strcmp(mode, "average")) {
+			ret = -EINVAL;
 			goto err_print_value;
+		}
+
+		average = true;
+	}
+
+	/* The device must have been opened by this client */
+	SLIST_FOREACH(thd, &pdata->thdlist_head, parser_list_entry) {
+		struct DevEntry *entry = thd->entry;
+		unsigned int i;
+
+		if (thd->dev != dev)
+			continue;
+
+		pthread_mutex_lock(&entry->thdlist_lock);
+		thd->decim.factor = factor;
+		thd->decim.average = average;
+		thd->decim.phase = 0;
+		for (i = 0; i < thd->decim.nb_chns; i++)
+			thd->decim.chns[i].acc = 0;
+		pthread_mutex_unlock(&entry->thdlist_lock);
+
+		ret = 0;
+		break;
 	}
 
-	ret = iio_device_set_trigger(dev, trig);
 err_print_value:
 	print_value(pdata, ret);
 	return ret;
 }
 
-ssize_t get_trigger(struct parser_pdata *pdata, struct iio_device *dev)
+int set_compression(struct parser_pdata *pdata, const char *mode)
 {
-	const struct iio_device *trigger;
-	ssize_t ret;
+	int ret = 0;
+
+	/* The compressed length of the samples is only known from the size
+	 * of the response frames */
+	if (!pdata->binary)
+		ret = -EINVAL;
+	else if (!strcmp(mode, "NONE"))
+		pdata->compression = 0;
+	else if (!strcmp(mode, "PACK"))
+		pdata->compression = IIOD_FRAME_PACKED;
+	else if (!strcmp(mode, "DELTA"))
+		pdata->compression = IIOD_FRAME_PACKED | IIOD_FRAME_DELTA;
+	else
+		ret = -EINVAL;
 
-	if (!dev) {
-		print_value(pdata, -ENODEV);
-		return -ENODEV;
-	}
+	print_value(pdata, ret);
+	return ret;
+}
 
-	ret = iio_device_get_trigger(dev, &trigger);
-	if (!ret && trigger) {
-		char buf[256];
+/* The digest identifies the XML of the context, so that the clients can
+ * reuse a copy of it downloaded previously: it is made of the CRC-32 and of
+ * the length of the XML string */
+ssize_t get_digest(struct parser_pdata *pdata)
+{
+	const char *xml = iio_context_get_xml(pdata->ctx);
+	size_t len = strlen(xml);
+	char buf[32];
+	struct iovec iov;
 
-		ret = strlen(trigger->name);
-		print_value(pdata, ret);
+	iio_snprintf(buf, sizeof(buf), "%08" PRIx32 "-%lx\n",
+			iiod_crc32(0, xml, len), (unsigned long) len);
 
-		iio_snprintf(buf, sizeof(buf), "%s\n", trigger->name);
-		ret = write_all(pdata, buf, ret + 1);
-	} else {
-		print_value(pdata, ret);
-	}
-	return ret;
+	iov.iov_base = buf;
+	iov.iov_len = strlen(buf);
+
+	/* Like PRINT, the length does not include the trailing \n */
+	return send_response(pdata, (long) iov.iov_len - 1, &iov, 1);
 }
 
 int set_timeout(struct parser_pdata *pdata, unsigned int timeout)
@@ -1280,6 +4049,30 @@ int set_timeout(struct parser_pdata *pdata, unsigned int timeout)
 	return ret;
 }
 
+int set_binary(struct parser_pdata *pdata)
+{
+	/* The acknowledgement is the last response sent in text form */
+	print_value(pdata, 0);
+
+	pdata->binary = true;
+	pdata->frame_left = 0;
+	return 0;
+}
+
+int set_crc(struct parser_pdata *pdata)
+{
+	if (!pdata->binary) {
+		print_value(pdata, -EINVAL);
+		return -EINVAL;
+	}
+
+	/* The acknowledgement is the last frame sent without a CRC */
+	print_value(pdata, 0);
+
+	pdata->crc = true;
+	return 0;
+}
+
 int set_buffers_count(struct parser_pdata *pdata,
 		struct iio_device *dev, long value)
 {
@@ -1298,11 +4091,29 @@ err_print_value:
 	return ret;
 }
 
+int set_cyclic_buffers_count(struct parser_pdata *pdata,
+		struct iio_device *dev, long value)
+{
+	int ret = -EINVAL;
+
+	if (!dev) {
+		ret = -ENODEV;
+		goto err_print_value;
+	}
+
+	if (value >= 1)
+		ret = iio_device_set_cyclic_buffers_count(
+				dev, (unsigned int) value);
+err_print_value:
+	print_value(pdata, ret);
+	return ret;
+}
+
 ssize_t read_line(struct parser_pdata *pdata, char *buf, size_t len)
 {
 	ssize_t ret;
 
-	if (pdata->fd_in_is_socket) {
+	if (pdata->fd_in_is_socket && !pdata->binary && !pdata->rx_buf) {
 		struct pollfd pfd[2];
 		bool found;
 		size_t bytes_read = 0;
@@ -1355,31 +4166,86 @@ ssize_t read_line(struct parser_pdata *pdata, char *buf, size_t len)
 		else
 			ret = bytes_read;
 	} else {
-		ret = pdata->readfd(pdata, buf, len);
+		size_t avail;
+		char *end;
+
+		/* Several commands may arrive in one read when the client
+		 * pipelines them: return the first line only, and keep the
+		 * rest for the next calls */
+		if (pdata->in_buf_pos == pdata->in_buf_len) {
+			ret = read_input(pdata, pdata->in_buf,
+					sizeof(pdata->in_buf));
+			if (ret <= 0)
+				return ret;
+
+			pdata->in_buf_pos = 0;
+			pdata->in_buf_len = (size_t) ret;
+		}
+
+		avail = pdata->in_buf_len - pdata->in_buf_pos;
+		end = memchr(pdata->in_buf + pdata->in_buf_pos, '\n', avail);
+		if (end)
+			avail = end - (pdata->in_buf + pdata->in_buf_pos) + 1;
+
+		ret = read_buffered(pdata, buf, avail < len ? avail : len);
 	}
 
 	return ret;
 }
 
-void interpreter(struct iio_context *ctx, int fd_in, int fd_out, bool verbose,
-	bool is_socket, bool use_aio, struct thread_pool *pool)
+struct parser_pdata * interpreter_new(struct iio_context *ctx,
+		int fd_in, int fd_out, bool verbose, bool is_socket,
+		bool use_aio, struct thread_pool *pool)
 {
-	yyscan_t scanner;
-	struct parser_pdata pdata;
-	unsigned int i;
+	struct parser_pdata *pdata;
 	int ret;
 
-	pdata.ctx = ctx;
-	pdata.stop = false;
-	pdata.fd_in = fd_in;
-	pdata.fd_out = fd_out;
-	pdata.verbose = verbose;
-	pdata.pool = pool;
+	pdata = zalloc(sizeof(*pdata));
+	if (!pdata)
+		return NULL;
 
-	pdata.fd_in_is_socket = is_socket;
-	pdata.fd_out_is_socket = is_socket;
+	pdata->ctx = ctx;
+	pdata->stop = false;
+	pdata->fd_in = fd_in;
+	pdata->fd_out = fd_out;
+	pdata->verbose = verbose;
+	pdata->pool = pool;
+
+	pdata->fd_in_is_socket = is_socket;
+	pdata->fd_out_is_socket = is_socket;
+	pdata->in_buf_pos = 0;
+	pdata->in_buf_len = 0;
+	pdata->binary = false;
+	pdata->tag = 0;
+	pdata->frame_left = 0;
+	pdata->crc = false;
+	pdata->frame_has_crc = false;
+	pdata->zerocopy = false;
+	pdata->zc_sent = 0;
+	pdata->zc_done = 0;
+	pdata->udp_fd = -1;
+	pdata->udp_seq = 0;
+	pdata->splice_fds[0] = -1;
+	pdata->splice_fds[1] = -1;
+	pdata->tx_bytes = 0;
+	pdata->splice_end = 0;
+	pdata->shm_fd = -1;
+	pdata->compression = 0;
+	pdata->nb_stripes = 1;
+
+#ifdef SO_ZEROCOPY
+	if (is_socket && server_zerocopy) {
+		int yes = 1;
+
+		if (setsockopt(fd_out, SOL_SOCKET, SO_ZEROCOPY,
+					&yes, sizeof(yes)) < 0)
+			IIO_WARNING("Unable to enable MSG_ZEROCOPY\n");
+		else
+			pdata->zerocopy = true;
+	}
+#endif
 
-	SLIST_INIT(&pdata.thdlist_head);
+	SLIST_INIT(&pdata->thdlist_head);
 
 	if (use_aio) {
 		/* Note: if WITH_AIO is not defined, use_aio is always false.
@@ -1387,48 +4253,237 @@ void interpreter(struct iio_context *ctx, int fd_in, int fd_out, bool verbose,
 #if WITH_AIO
 		char err_str[1024];
 
-		pdata.aio_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-		if (pdata.aio_eventfd < 0) {
+		pdata->aio_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (pdata->aio_eventfd < 0) {
 			iio_strerror(errno, err_str, sizeof(err_str));
 			IIO_ERROR("Failed to create AIO eventfd: %s\n", err_str);
-			return;
+			free(pdata);
+			return NULL;
 		}
 
-		pdata.aio_ctx = 0;
-		ret = io_setup(1, &pdata.aio_ctx);
+		pdata->aio_ctx = 0;
+		ret = io_setup(IIOD_MAX_AIO_REQS, &pdata->aio_ctx);
 		if (ret < 0) {
 			iio_strerror(-ret, err_str, sizeof(err_str));
 			IIO_ERROR("Failed to create AIO context: %s\n", err_str);
-			close(pdata.aio_eventfd);
-			return;
+			close(pdata->aio_eventfd);
+			free(pdata);
+			return NULL;
 		}
-		pthread_mutex_init(&pdata.aio_mutex, NULL);
-		pdata.readfd = readfd_aio;
-		pdata.writefd = writefd_aio;
+		pthread_mutex_init(&pdata->aio_mutex, NULL);
+		pdata->readfd = readfd_aio;
+		pdata->writefd = writefd_aio;
+		pdata->writevfd = writevfd_aio;
 #endif
 	} else {
-		pdata.readfd = readfd_io;
-		pdata.writefd = writefd_io;
+		pdata->readfd = readfd_io;
+		pdata->writefd = writefd_io;
+		pdata->writevfd = writevfd_io;
+	}
+
+	pdata->use_aio = use_aio;
+
+	ret = yylex_init_extra(pdata, &pdata->scanner);
+	if (ret) {
+		IIO_ERROR("Failed to create lexer\n");
+		goto err_destroy_aio;
+	}
+
+	if (verbose)
+		output(pdata, "iio-daemon > ");
+
+	return pdata;
+
+err_destroy_aio:
+#if WITH_AIO
+	if (use_aio) {
+		io_destroy(pdata->aio_ctx);
+		close(pdata->aio_eventfd);
+	}
+#endif
+	free(pdata);
+	return NULL;
+}
+
+bool interpreter_step(struct parser_pdata *pdata)
+{
+	if (yyparse(pdata->scanner) < 0)
+		pdata->stop = true;
+
+	/* The prompt is printed right away, not when the next command
+	 * arrives, so that the session can wait for it in an event loop */
+	if (pdata->verbose && !pdata->stop)
+		output(pdata, "iio-daemon > ");
+
+	return !pdata->stop;
+}
+
+ssize_t interpreter_fill(struct parser_pdata *pdata)
+{
+	ssize_t ret;
+
+	if (!pdata->rx_buf) {
+		pdata->rx_buf = malloc(IIOD_RX_BUF_SIZE);
+		if (!pdata->rx_buf)
+			return -ENOMEM;
+	}
+
+	/* Move the data not consumed yet to the front */
+	if (pdata->rx_pos) {
+		memmove(pdata->rx_buf, pdata->rx_buf + pdata->rx_pos,
+				pdata->rx_len - pdata->rx_pos);
+		pdata->rx_len -= pdata->rx_pos;
+		pdata->rx_pos = 0;
 	}
 
-	yylex_init_extra(&pdata, &scanner);
+	if (pdata->rx_len == IIOD_RX_BUF_SIZE)
+		return -ENOBUFS;
 
 	do {
-		if (verbose)
-			output(&pdata, "iio-daemon > ");
-		ret = yyparse(scanner);
-	} while (!pdata.stop && ret >= 0);
+		ret = recv(pdata->fd_in, pdata->rx_buf + pdata->rx_len,
+				IIOD_RX_BUF_SIZE - pdata->rx_len,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	pdata->rx_len += (size_t) ret;
+
+	return ret;
+}
+
+/* Copies what fits of one part of the next command, up to its end of line;
+ * returns true if the end of line was found */
+static bool peek_command_part(char *buf, size_t len, size_t *copied,
+		const char *part, size_t part_len)
+{
+	const char *end = memchr(part, '\n', part_len);
+	size_t nb = end ? (size_t) (end - part) + 1 : part_len;
+
+	if (nb > len - *copied)
+		nb = len - *copied;
+
+	memcpy(buf + *copied, part, nb);
+	*copied += nb;
+
+	return !!end;
+}
+
+/* Copies the start of the next command to buf, and returns true if it was
+ * read completely. With the binary protocol, its frame must be complete as
+ * well, as its CRC is checked as soon as its payload is read. */
+static bool peek_command(const struct parser_pdata *pdata,
+		char *buf, size_t len)
+{
+	const char *rx = pdata->rx_buf + pdata->rx_pos;
+	size_t avail = pdata->rx_len - pdata->rx_pos;
+	size_t left = pdata->frame_left, copied = 0, frame_len;
+	bool has_crc = pdata->frame_has_crc;
+
+	if (peek_command_part(buf, len, &copied,
+				pdata->in_buf + pdata->in_buf_pos,
+				pdata->in_buf_len - pdata->in_buf_pos))
+		return true;
+
+	if (!pdata->binary)
+		return peek_command_part(buf, len, &copied, rx, avail);
+
+	while (true) {
+		if (!left) {
+			struct iiod_frame_header hdr;
+
+			if (avail < sizeof(hdr))
+				return false;
+
+			memcpy(&hdr, rx, sizeof(hdr));
+			left = iio_be32toh(hdr.len);
+			has_crc = !!(iio_be32toh(hdr.flags) & IIOD_FRAME_CRC);
+			rx += sizeof(hdr);
+			avail -= sizeof(hdr);
+		}
+
+		frame_len = left + (has_crc ? sizeof(uint32_t) : 0);
+		if (avail < frame_len)
+			return false;
+
+		if (peek_command_part(buf, len, &copied, rx, left))
+			return true;
 
-	yylex_destroy(scanner);
+		rx += frame_len;
+		avail -= frame_len;
+		left = 0;
+	}
+}
+
+bool interpreter_has_command(const struct parser_pdata *pdata)
+{
+	char buf[1];
+
+	return peek_command(pdata, buf, 0);
+}
+
+bool interpreter_command_blocks(const struct parser_pdata *pdata)
+{
+	/* The commands waiting for samples or events, or reading a payload */
+	static const char * const cmds[] = {
+		"READBUF ", "WRITEBUF ", "READEVT ", "WRITE ",
+	};
+	char buf[16] = { 0 };
+	unsigned int i;
+
+	peek_command(pdata, buf, sizeof(buf) - 1);
+
+	for (i = 0; i < ARRAY_SIZE(cmds); i++) {
+		if (!strncasecmp(buf, cmds[i], strlen(cmds[i])))
+			return true;
+	}
+
+	return false;
+}
+
+void interpreter_free(struct parser_pdata *pdata)
+{
+	unsigned int i;
+
+	yylex_destroy(pdata->scanner);
 
 	/* Close all opened devices */
-	for (i = 0; i < ctx->nb_devices; i++)
-		close_dev_helper(&pdata, ctx->devices[i]);
+	for (i = 0; i < pdata->ctx->nb_devices; i++)
+		close_dev_helper(pdata, pdata->ctx->devices[i]);
+
+	if (pdata->events)
+		iio_event_stream_destroy(pdata->events);
+
+	if (pdata->udp_fd >= 0)
+		close(pdata->udp_fd);
+
+	close_stripes(pdata);
+	close_splice_pipe(pdata);
+	close_shm(pdata);
+	free(pdata->rx_buf);
 
 #if WITH_AIO
-	if (use_aio) {
-		io_destroy(pdata.aio_ctx);
-		close(pdata.aio_eventfd);
+	if (pdata->use_aio) {
+		io_destroy(pdata->aio_ctx);
+		close(pdata->aio_eventfd);
 	}
 #endif
+
+	free(pdata);
+}
+
+void interpreter(struct iio_context *ctx, int fd_in, int fd_out, bool verbose,
+	bool is_socket, bool use_aio, struct thread_pool *pool)
+{
+	struct parser_pdata *pdata;
+
+	pdata = interpreter_new(ctx, fd_in, fd_out, verbose,
+			is_socket, use_aio, pool);
+	if (!pdata)
+		return;
+
+	while (interpreter_step(pdata));
+
+	interpreter_free(pdata);
 }
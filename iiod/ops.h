@@ -29,6 +29,7 @@
 #include <string.h>
 #include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #if WITH_AIO
@@ -46,6 +47,22 @@
 	 (((x) & 0x0000ff00) <<  8) | (((x) & 0x000000ff) << 24))
 #endif
 
+/* Largest number of pipes the samples of a session can be striped over,
+ * and largest size of the chunks sent to each one in turn */
+#define IIOD_MAX_STRIPES 8
+#define IIOD_MAX_STRIPE_SIZE (1024 * 1024)
+
+/* Largest number of AIO requests in flight for one session; at least
+ * IIOD_MAX_STRIPES, as one request is written to each pipe at once */
+#define IIOD_MAX_AIO_REQS 16
+
+/* Largest number of events sent back by one READEVT command */
+#define IIOD_MAX_EVENTS 64
+
+/* Size of the data read ahead of the commands of a session served by an
+ * event loop; a command line must fit in it */
+#define IIOD_RX_BUF_SIZE 4096
+
 struct thread_pool;
 extern struct thread_pool *main_thread_pool;
 
@@ -54,6 +71,10 @@ struct parser_pdata {
 	bool stop, verbose;
 	int fd_in, fd_out;
 
+	/* Lexer of the commands of the session */
+	void *scanner;
+	bool use_aio;
+
 	SLIST_HEAD(ParserDataThdHead, ThdEntry) thdlist_head;
 
 	/* Used as temporaries placements by the lexer */
@@ -68,15 +89,119 @@ struct parser_pdata {
 #endif
 	struct thread_pool *pool;
 
+	/* Data received on a non-socket input past the end of the last
+	 * command line, kept for the following commands */
+	char in_buf[1024];
+	size_t in_buf_pos, in_buf_len;
+
+	/* Data read from the socket by interpreter_fill() and not consumed
+	 * yet, or NULL if the session does not read ahead */
+	char *rx_buf;
+	size_t rx_pos, rx_len;
+
+	/* Set once the client negotiated the binary protocol. The tag is the
+	 * one of the last request frame received, and frame_left the number
+	 * of bytes of its payload not read yet. */
+	bool binary;
+	uint32_t tag;
+	size_t frame_left;
+
+	/* Set once the client negotiated the CRC of the frames with CRC.
+	 * frame_crc is the CRC of what was read of the current request frame,
+	 * which is followed by its CRC if frame_has_crc is set. */
+	bool crc, frame_has_crc;
+	uint32_t frame_crc;
+
 	ssize_t (*writefd)(struct parser_pdata *pdata, const void *buf, size_t len);
 	ssize_t (*readfd)(struct parser_pdata *pdata, void *buf, size_t len);
+
+	/* Large writes to the socket are sent with MSG_ZEROCOPY; number of
+	 * such sends, and number of them the kernel reported as completed */
+	bool zerocopy;
+	uint32_t zc_sent, zc_done;
+
+	/* Datagram socket connected to the client once it negotiated the UDP
+	 * data plane, or -1; and sequence number of the next datagram */
+	int udp_fd;
+	uint32_t udp_seq;
+
+	/* Shared memory object of the client the samples sent by READBUF are
+	 * written to, negotiated with SHM, or -1; geometry of its slots as it
+	 * was negotiated, and sequence number of the next chunk */
+	int shm_fd;
+	size_t shm_slot_size;
+	uint32_t shm_nb_slots, shm_seq;
+
+	/* Pipe the samples are spliced through to the socket, with the
+	 * --splice option; created on first use, or -1. tx_bytes counts the
+	 * bytes written to the socket, and splice_end is its value at the end
+	 * of the last data spliced; see splice_done(). */
+	int splice_fds[2];
+	uint64_t tx_bytes, splice_end;
+
+	/* IIOD_FRAME_PACKED / IIOD_FRAME_DELTA flags of the compression of
+	 * the samples sent by READBUF, negotiated with COMPRESS */
+	uint32_t compression;
+
+	/* Stream of the events of the device given to OPENEVT, or NULL */
+	struct iio_event_stream *events;
+
+	/* Optional; when NULL, each element is written with writefd */
+	ssize_t (*writevfd)(struct parser_pdata *pdata,
+			const struct iovec *iov, int nb);
+
+	/* Pipes the samples sent by READBUF are striped over, negotiated
+	 * with STRIPE: chunks of stripe_size bytes are written to fd_out,
+	 * then to each of the stripe_fds, in turn */
+	unsigned int nb_stripes;
+	size_t stripe_size;
+	int stripe_fds[IIOD_MAX_STRIPES - 1];
+
+	/* Optional; opens the outputs of the nb pipes following the one of
+	 * the session. Set by the USB daemon, along with its data. */
+	int (*open_stripes)(struct parser_pdata *pdata,
+			int *fds, unsigned int nb);
+	void *stripes_data;
 };
 
 extern bool server_demux; /* Defined in iiod.c */
+extern bool server_zerocopy; /* Defined in iiod.c */
+extern bool server_splice; /* Defined in iiod.c */
+
+struct thread_sched;
+
+/* Scheduling of the R/W thread of the device; defined in iiod.c */
+void get_rw_thd_sched(const struct iio_device *dev, struct thread_sched *sched);
+
+/* Number of blocks read from a device kept for its readers, and whether the
+ * oldest one is dropped for the slow readers once they are all kept,
+ * instead of waiting for them */
+extern unsigned int server_ring_size; /* Defined in iiod.c */
+extern bool server_drop_oldest; /* Defined in iiod.c */
 
 void interpreter(struct iio_context *ctx, int fd_in, int fd_out, bool verbose,
 	bool is_socket, bool use_aio, struct thread_pool *pool);
 
+/* Same as interpreter(), one command at a time: interpreter_step() parses
+ * and runs the next command, and returns false once the session is over.
+ *
+ * For the sessions served by an event loop: interpreter_fill() reads what
+ * the client sent without blocking; it returns 0 once the client closed the
+ * connection, -EAGAIN if there was nothing to read, and -ENOBUFS if the
+ * data read ahead is too large for a command. interpreter_has_command()
+ * tells whether the next command was read completely, so that
+ * interpreter_step() runs it without waiting for the client, and
+ * interpreter_command_blocks() whether it may still wait for long, for
+ * samples or events. */
+struct parser_pdata * interpreter_new(struct iio_context *ctx,
+		int fd_in, int fd_out, bool verbose, bool is_socket,
+		bool use_aio, struct thread_pool *pool);
+bool interpreter_step(struct parser_pdata *pdata);
+ssize_t interpreter_fill(struct parser_pdata *pdata);
+bool interpreter_has_command(const struct parser_pdata *pdata);
+bool interpreter_command_blocks(const struct parser_pdata *pdata);
+void interpreter_free(struct parser_pdata *pdata);
+
 int start_usb_daemon(struct iio_context *ctx, const char *ffs,
 		bool debug, bool use_aio, unsigned int nb_pipes,
 		struct thread_pool *pool);
@@ -84,12 +209,22 @@ int start_usb_daemon(struct iio_context *ctx, const char *ffs,
 int open_dev(struct parser_pdata *pdata, struct iio_device *dev,
 		size_t samples_count, const char *mask, bool cyclic);
 int close_dev(struct parser_pdata *pdata, struct iio_device *dev);
+int reopen_dev(struct parser_pdata *pdata, struct iio_device *dev,
+		size_t samples_count, const char *mask);
 
 ssize_t rw_dev(struct parser_pdata *pdata, struct iio_device *dev,
 		unsigned int nb, bool is_write);
 
 ssize_t read_dev_attr(struct parser_pdata *pdata, struct iio_device *dev,
 		const char *attr, enum iio_attr_type type);
+ssize_t rw_regs(struct parser_pdata *pdata, struct iio_device *dev,
+		size_t len, bool is_write);
+
+ssize_t print_stats(struct parser_pdata *pdata);
+
+int open_events(struct parser_pdata *pdata, struct iio_device *dev);
+ssize_t read_events(struct parser_pdata *pdata, unsigned int nb);
+int close_events(struct parser_pdata *pdata);
 ssize_t write_dev_attr(struct parser_pdata *pdata, struct iio_device *dev,
 		const char *attr, size_t len, enum iio_attr_type type);
 
@@ -102,16 +237,42 @@ ssize_t get_trigger(struct parser_pdata *pdata, struct iio_device *dev);
 ssize_t set_trigger(struct parser_pdata *pdata,
 		struct iio_device *dev, const char *trig);
 
+ssize_t get_digest(struct parser_pdata *pdata);
 int set_timeout(struct parser_pdata *pdata, unsigned int timeout);
+int set_binary(struct parser_pdata *pdata);
+int set_crc(struct parser_pdata *pdata);
+int set_udp(struct parser_pdata *pdata, unsigned int port);
+int set_shm(struct parser_pdata *pdata, const char *name);
+int set_compression(struct parser_pdata *pdata, const char *mode);
+int set_stripes(struct parser_pdata *pdata, unsigned int nb, size_t size);
+int set_decimation(struct parser_pdata *pdata, struct iio_device *dev,
+		unsigned int factor, const char *mode);
 int set_buffers_count(struct parser_pdata *pdata,
 		struct iio_device *dev, long value);
+int set_cyclic_buffers_count(struct parser_pdata *pdata,
+		struct iio_device *dev, long value);
 
 ssize_t read_line(struct parser_pdata *pdata, char *buf, size_t len);
 ssize_t write_all(struct parser_pdata *pdata, const void *src, size_t len);
+ssize_t send_response(struct parser_pdata *pdata, long code,
+		const struct iovec *iov, unsigned int nb);
 
 static __inline__ void output(struct parser_pdata *pdata, const char *text)
 {
-	if (write_all(pdata, text, strlen(text)) <= 0)
+	ssize_t ret;
+
+	if (pdata->binary) {
+		struct iovec iov = {
+			.iov_base = (void *) text,
+			.iov_len = strlen(text),
+		};
+
+		ret = send_response(pdata, (long) iov.iov_len, &iov, 1);
+	} else {
+		ret = write_all(pdata, text, strlen(text));
+	}
+
+	if (ret <= 0)
 		pdata->stop = true;
 }
 
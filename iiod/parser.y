@@ -74,6 +74,7 @@ ssize_t yy_input(yyscan_t scanner, char *buf, size_t max_size);
 %token EXIT
 %token HELP
 %token OPEN
+%token REOPEN
 %token CLOSE
 %token PRINT
 %token READ
@@ -83,12 +84,27 @@ ssize_t yy_input(yyscan_t scanner, char *buf, size_t max_size);
 %token SETTRIG
 %token GETTRIG
 %token TIMEOUT
+%token DIGEST
+%token BINARY
+%token CRC
+%token UDP
+%token SHM
+%token STRIPE
+%token COMPRESS
+%token DECIMATE
+%token REGREAD
+%token REGWRITE
+%token STATS
+%token OPENEVT
+%token READEVT
+%token CLOSEEVT
 %token DEBUG_ATTR
 %token BUFFER_ATTR
 %token IN_OUT
 %token CYCLIC
 %token SET
 %token BUFFERS_COUNT
+%token CYCLIC_BUFFERS_COUNT
 
 %token <word> WORD
 %token <dev> DEVICE
@@ -118,12 +134,30 @@ Line:
 		"\t\tClose the current session\n"
 		"\tPRINT\n"
 		"\t\tDisplays a XML string corresponding to the current IIO context\n"
+		"\tDIGEST\n"
+		"\t\tGet a digest identifying the XML string of the IIO context\n"
 		"\tVERSION\n"
 		"\t\tGet the version of libiio in use\n"
 		"\tTIMEOUT <timeout_ms>\n"
 		"\t\tSet the timeout (in ms) for I/O operations\n"
+		"\tBINARY\n"
+		"\t\tSwitch the session to the binary framed protocol\n"
+		"\tCRC\n"
+		"\t\tProtect the frames of the binary protocol with a CRC-32\n"
+		"\tUDP <port>\n"
+		"\t\tSend the samples read by READBUF as datagrams to the given port\n"
+		"\tSHM <name>\n"
+		"\t\tWrite the samples read by READBUF to the given shared memory\n"
+		"\tCOMPRESS NONE|PACK|DELTA\n"
+		"\t\tCompress the samples read by READBUF\n"
+		"\tSTRIPE <nb_pipes> <chunk_size>\n"
+		"\t\tSpread the samples read by READBUF over the following pipes\n"
+		"\tDECIMATE <device> <factor> [AVERAGE]\n"
+		"\t\tOnly send one sample out of <factor>, or the average of each group\n"
 		"\tOPEN <device> <samples_count> <mask> [CYCLIC]\n"
 		"\t\tOpen the specified device with the given mask of channels\n"
+		"\tREOPEN <device> <samples_count> <mask>\n"
+		"\t\tChange the channels and samples count of an opened device\n"
 		"\tCLOSE <device>\n"
 		"\t\tClose the specified device\n"
 		"\tREAD <device> DEBUG|BUFFER|[INPUT|OUTPUT <channel>] [<attribute>]\n"
@@ -139,7 +173,21 @@ Line:
 		"\tSETTRIG <device> [<trigger>]\n"
 		"\t\tSet the trigger to use for the specified device\n"
 		"\tSET <device> BUFFERS_COUNT <count>\n"
-		"\t\tSet the number of kernel buffers for the specified device\n");
+		"\t\tSet the number of kernel buffers for the specified device\n"
+		"\tSET <device> CYCLIC_BUFFERS_COUNT <count>\n"
+		"\t\tSet the number of kernel buffers of its cyclic buffers\n"
+		"\tREGREAD <device> <bytes_count>\n"
+		"\t\tRead the registers at the addresses that follow\n"
+		"\tREGWRITE <device> <bytes_count>\n"
+		"\t\tWrite the address and value pairs that follow to the registers\n"
+		"\tSTATS\n"
+		"\t\tPrint the statistics of the operations of the devices\n"
+		"\tOPENEVT <device>\n"
+		"\t\tOpen the stream of the events of the specified device\n"
+		"\tREADEVT <nb_events>\n"
+		"\t\tWait for, and read, at most the given number of events\n"
+		"\tCLOSEEVT\n"
+		"\t\tClose the stream of events\n");
 		YYACCEPT;
 	}
 	| VERSION END {
@@ -153,13 +201,25 @@ Line:
 	| PRINT END {
 		struct parser_pdata *pdata = yyget_extra(scanner);
 		const char *xml = iio_context_get_xml(pdata->ctx);
-		if (!pdata->verbose) {
-			char buf[128];
-			sprintf(buf, "%lu\n", (unsigned long) strlen(xml));
-			output(pdata, buf);
+		if (!pdata->verbose || pdata->binary) {
+			struct iovec iov[2] = {
+				{ .iov_base = (void *) xml, .iov_len = strlen(xml) },
+				{ .iov_base = "\n", .iov_len = 1 },
+			};
+
+			if (send_response(pdata, (long) iov[0].iov_len,
+						iov, 2) <= 0)
+				pdata->stop = true;
+		} else {
+			output(pdata, xml);
+			output(pdata, "\n");
 		}
-		output(pdata, xml);
-		output(pdata, "\n");
+		YYACCEPT;
+	}
+	| DIGEST END {
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		if (get_digest(pdata) <= 0)
+			pdata->stop = true;
 		YYACCEPT;
 	}
 	| TIMEOUT SPACE WORD END {
@@ -173,6 +233,62 @@ Line:
 		else
 			YYACCEPT;
 	}
+	| BINARY END {
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		if (set_binary(pdata) < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| CRC END {
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		if (set_crc(pdata) < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| COMPRESS SPACE WORD END {
+		char *word = $3;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		int ret = set_compression(pdata, word);
+		free(word);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| STRIPE SPACE WORD SPACE WORD END {
+		char *nb = $3, *size = $5;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		int ret = set_stripes(pdata, (unsigned int) atoi(nb),
+				(size_t) atol(size));
+		free(nb);
+		free(size);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| UDP SPACE WORD END {
+		char *word = $3;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		int ret = set_udp(pdata, (unsigned int) atoi(word));
+		free(word);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| SHM SPACE WORD END {
+		char *word = $3;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		int ret = set_shm(pdata, word);
+		free(word);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
 	| OPEN SPACE DEVICE SPACE WORD SPACE WORD SPACE CYCLIC END {
 		char *nb = $5, *mask = $7;
 		struct parser_pdata *pdata = yyget_extra(scanner);
@@ -197,6 +313,41 @@ Line:
 		else
 			YYACCEPT;
 	}
+	| REOPEN SPACE DEVICE SPACE WORD SPACE WORD END {
+		char *nb = $5, *mask = $7;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		unsigned long samples_count = atol(nb);
+		int ret = reopen_dev(pdata, $3, samples_count, mask);
+		free(nb);
+		free(mask);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| DECIMATE SPACE DEVICE SPACE WORD END {
+		char *factor = $5;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		int ret = set_decimation(pdata, $3,
+				(unsigned int) atoi(factor), NULL);
+		free(factor);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| DECIMATE SPACE DEVICE SPACE WORD SPACE WORD END {
+		char *factor = $5, *mode = $7;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		int ret = set_decimation(pdata, $3,
+				(unsigned int) atoi(factor), mode);
+		free(factor);
+		free(mode);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
 	| CLOSE SPACE DEVICE END {
 		struct parser_pdata *pdata = yyget_extra(scanner);
 		int ret = close_dev(pdata, $3);
@@ -299,6 +450,60 @@ Line:
 		else
 			YYACCEPT;
 	}
+	| REGREAD SPACE DEVICE SPACE WORD END {
+		char *len = $5;
+		unsigned long nb = atol(len);
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		ssize_t ret = rw_regs(pdata, $3, nb, false);
+		free(len);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| REGWRITE SPACE DEVICE SPACE WORD END {
+		char *len = $5;
+		unsigned long nb = atol(len);
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		ssize_t ret = rw_regs(pdata, $3, nb, true);
+		free(len);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| STATS END {
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		if (print_stats(pdata) < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| OPENEVT SPACE DEVICE END {
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		if (open_events(pdata, $3) < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| READEVT SPACE WORD END {
+		char *word = $3;
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		unsigned int nb = (unsigned int) atoi(word);
+		ssize_t ret = read_events(pdata, nb);
+		free(word);
+		if (ret < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
+	| CLOSEEVT END {
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		if (close_events(pdata) < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
 	| WRITE SPACE DEVICE SPACE WORD END {
 		char *len = $5;
 		unsigned long nb = atol(len);
@@ -422,6 +627,13 @@ Line:
 		else
 			YYACCEPT;
 	}
+	| SET SPACE DEVICE SPACE CYCLIC_BUFFERS_COUNT SPACE VALUE END {
+		struct parser_pdata *pdata = yyget_extra(scanner);
+		if (set_cyclic_buffers_count(pdata, $3, $7) < 0)
+			YYABORT;
+		else
+			YYACCEPT;
+	}
 	| error END {
 		yyclearin;
 		yyerrok;
@@ -434,7 +646,10 @@ Line:
 void yyerror(yyscan_t scanner, const char *msg)
 {
 	struct parser_pdata *pdata = yyget_extra(scanner);
-	if (pdata->verbose) {
+	if (pdata->binary) {
+		if (send_response(pdata, -EINVAL, NULL, 0) <= 0)
+			pdata->stop = true;
+	} else if (pdata->verbose) {
 		output(pdata, "ERROR: ");
 		output(pdata, msg);
 		output(pdata, "\n");
@@ -17,11 +17,13 @@
 
 #include "thread-pool.h"
 
+#include <alloca.h>
 #include <errno.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
 
@@ -46,8 +48,13 @@ struct thread_body_data {
 	struct thread_pool *pool;
 	void (*f)(struct thread_pool *, void *);
 	void *d;
+	size_t prefault_size;
 };
 
+/* Part of the stack left out of the prefault, for the frames already in use
+ * and the guard of glibc's thread-local storage */
+#define STACK_PREFAULT_MARGIN (64 * 1024)
+
 static void thread_pool_thread_started(struct thread_pool *pool)
 {
 	pthread_mutex_lock(&pool->thread_count_lock);
@@ -63,10 +70,24 @@ static void thread_pool_thread_stopped(struct thread_pool *pool)
 	pthread_mutex_unlock(&pool->thread_count_lock);
 }
 
+/* Touches the pages of the stack, so that the thread does not take page
+ * faults later on while running */
+static void __attribute__((noinline)) thread_prefault_stack(size_t size)
+{
+	volatile unsigned char *stack = alloca(size);
+	size_t i;
+
+	for (i = 0; i < size; i += 4096)
+		stack[i] = 0;
+}
+
 static void * thread_body(void *d)
 {
 	struct thread_body_data *pdata = d;
 
+	if (pdata->prefault_size)
+		thread_prefault_stack(pdata->prefault_size);
+
 	(*pdata->f)(pdata->pool, pdata->d);
 
 	thread_pool_thread_stopped(pdata->pool);
@@ -78,6 +99,35 @@ static void * thread_body(void *d)
 int thread_pool_add_thread(struct thread_pool *pool,
 		void (*f)(struct thread_pool *, void *),
 		void *d, const char *name)
+{
+	return thread_pool_add_thread_sched(pool, f, d, name, NULL);
+}
+
+static void thread_attr_set_sched(pthread_attr_t *attr,
+		const struct thread_sched *sched)
+{
+	struct sched_param param;
+
+	if (sched->set_cpus)
+		pthread_attr_setaffinity_np(attr, sizeof(sched->cpus),
+				&sched->cpus);
+
+	if (sched->priority > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = sched->priority;
+
+		pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+		pthread_attr_setschedparam(attr, &param);
+	}
+
+	if (sched->stack_size)
+		pthread_attr_setstacksize(attr, sched->stack_size);
+}
+
+int thread_pool_add_thread_sched(struct thread_pool *pool,
+		void (*f)(struct thread_pool *, void *),
+		void *d, const char *name, const struct thread_sched *sched)
 {
 	struct thread_body_data *pdata;
 	sigset_t sigmask, oldsigmask;
@@ -92,12 +142,18 @@ int thread_pool_add_thread(struct thread_pool *pool,
 	pdata->f = f;
 	pdata->d = d;
 	pdata->pool = pool;
+	pdata->prefault_size = 0;
+
+	if (sched && sched->stack_size > 2 * STACK_PREFAULT_MARGIN)
+		pdata->prefault_size = sched->stack_size - STACK_PREFAULT_MARGIN;
 
 	sigfillset(&sigmask);
 	pthread_sigmask(SIG_BLOCK, &sigmask, &oldsigmask);
 
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (sched)
+		thread_attr_set_sched(&attr, sched);
 
 	/* In order to avoid race conditions thread_pool_thread_started() must
 	 * be called before the thread is created and
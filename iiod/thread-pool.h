@@ -18,8 +18,26 @@
 #ifndef __THREAD_POOL_H__
 #define __THREAD_POOL_H__
 
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
 struct thread_pool;
 
+/* Scheduling of a thread of the pool */
+struct thread_sched {
+	/* CPUs the thread is pinned to, if set_cpus is set */
+	bool set_cpus;
+	cpu_set_t cpus;
+
+	/* SCHED_FIFO priority of the thread; 0 keeps the default policy */
+	int priority;
+
+	/* Size of the stack of the thread, entirely faulted in before the
+	 * thread starts its work; 0 keeps the default stack */
+	size_t stack_size;
+};
+
 struct thread_pool * thread_pool_new(void);
 
 int thread_pool_get_poll_fd(const struct thread_pool *pool);
@@ -31,5 +49,9 @@ void thread_pool_destroy(struct thread_pool *pool);
 int thread_pool_add_thread(struct thread_pool *pool,
 		void (*func)(struct thread_pool *, void *),
 		void *data, const char *name);
+int thread_pool_add_thread_sched(struct thread_pool *pool,
+		void (*func)(struct thread_pool *, void *),
+		void *data, const char *name,
+		const struct thread_sched *sched);
 
 #endif /* __THREAD_POOL_H__ */
@@ -58,6 +58,7 @@ struct usbd_pdata {
 
 struct usbd_client_pdata {
 	struct usbd_pdata *pdata;
+	unsigned int pipe_id;
 	int ep_in, ep_out;
 };
 
@@ -73,13 +74,61 @@ static const struct usb_ffs_strings ffs_strings = {
 	.string = NAME,
 };
 
+/*
+ * The pipes a session stripes its samples over are taken from the ones that
+ * follow its own pipe, which the host must not have opened: their client
+ * thread, if any, is stopped, and only their IN endpoint is used.
+ */
+static int usbd_open_stripes(struct parser_pdata *parser, int *fds,
+		unsigned int nb)
+{
+	struct usbd_client_pdata *cpdata = parser->stripes_data;
+	struct usbd_pdata *pdata = cpdata->pdata;
+	unsigned int i, pipe_id;
+	char buf[256];
+	int ret;
+
+	if (cpdata->pipe_id + nb >= pdata->nb_pipes)
+		return -EINVAL;
+
+	for (i = 0; i < nb; i++) {
+		pipe_id = cpdata->pipe_id + 1 + i;
+
+		thread_pool_stop_and_wait(pdata->pool[pipe_id]);
+
+		iio_snprintf(buf, sizeof(buf), "%s/ep%u",
+				pdata->ffs, pipe_id * 2 + 1);
+		fds[i] = open(buf, O_WRONLY);
+		if (fds[i] < 0) {
+			ret = -errno;
+			goto err_close_fds;
+		}
+	}
+
+	return 0;
+
+err_close_fds:
+	while (i--)
+		close(fds[i]);
+	return ret;
+}
+
 static void usbd_client_thread(struct thread_pool *pool, void *d)
 {
 	struct usbd_client_pdata *pdata = d;
+	struct parser_pdata *parser;
 
-	interpreter(pdata->pdata->ctx, pdata->ep_in, pdata->ep_out,
-			pdata->pdata->debug, false,
+	parser = interpreter_new(pdata->pdata->ctx, pdata->ep_in,
+			pdata->ep_out, pdata->pdata->debug, false,
 			pdata->pdata->use_aio, pool);
+	if (parser) {
+		parser->open_stripes = usbd_open_stripes;
+		parser->stripes_data = pdata;
+
+		while (interpreter_step(parser));
+
+		interpreter_free(parser);
+	}
 
 	close(pdata->ep_in);
 	close(pdata->ep_out);
@@ -121,6 +170,7 @@ static int usb_open_pipe(struct usbd_pdata *pdata, unsigned int pipe_id)
 	}
 
 	cpdata->pdata = pdata;
+	cpdata->pipe_id = pipe_id;
 
 	err = thread_pool_add_thread(pdata->pool[pipe_id],
 			usbd_client_thread, cpdata, "usbd_client_thd");
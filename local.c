@@ -16,8 +16,11 @@
  *
  * */
 
+#include "arena.h"
 #include "debug.h"
+#include "iio-lock.h"
 #include "iio-private.h"
+#include "iio-trace.h"
 #include "sort.h"
 #ifdef WITH_LOCAL_CONFIG
 #include "libini/ini.h"
@@ -26,6 +29,7 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <poll.h>
 #include <stdbool.h>
@@ -33,8 +37,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/eventfd.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -44,10 +50,18 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef WITH_LOCAL_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 #define DEFAULT_TIMEOUT_MS 1000
 
 #define NB_BLOCKS 4
 
+/* Limit of the attribute file cache when the process has no file limit */
+#define MAX_ATTR_FDS 1024
+
 #define BLOCK_ALLOC_IOCTL   _IOWR('i', 0xa0, struct block_alloc_req)
 #define BLOCK_FREE_IOCTL      _IO('i', 0xa1)
 #define BLOCK_QUERY_IOCTL   _IOWR('i', 0xa2, struct block)
@@ -56,6 +70,8 @@
 
 #define BLOCK_FLAG_CYCLIC BIT(1)
 
+#define IIO_GET_EVENT_FD_IOCTL _IOR('i', 0x90, int)
+
 /* Forward declarations */
 static ssize_t local_read_dev_attr(const struct iio_device *dev,
 		const char *attr, char *dst, size_t len, enum iio_attr_type type);
@@ -85,27 +101,78 @@ struct block {
 
 struct iio_context_pdata {
 	unsigned int rw_timeout_ms;
+
+	/* Number of attribute files kept open, and upper limit */
+	unsigned int nb_attr_fds, max_attr_fds;
+
+	/* Set for the contexts created with the "local:lazy" URI, whose
+	 * devices are populated on first use. The lock serializes that, and
+	 * the generation of the XML on first request. */
+	bool lazy;
+	struct iio_mutex *lock;
+
+#ifdef WITH_LOCAL_IO_URING
+	/* Set unless the context was created with "io_uring=0" */
+	bool use_uring;
+#endif
 };
 
+struct local_uring;
+
 struct iio_device_pdata {
 	int fd;
 	bool blocking;
 	unsigned int samples_count;
 	unsigned int max_nb_blocks;
+
+	/* Blocks of cyclic buffers: one, unless set explicitly with
+	 * iio_device_set_cyclic_buffers_count(). With two or more, the
+	 * waveform can be replaced while it is being output. */
+	unsigned int cyclic_nb_blocks;
 	unsigned int allocated_nb_blocks;
 
 	struct block *blocks;
 	void **addrs;
 	int last_dequeued;
+
+	/* Set for the blocks owned by the kernel */
+	bool *queued;
 	bool is_high_speed, cyclic, cyclic_buffer_enqueued;
 
+	/* Blocks owned by the kernel, and completed blocks already dequeued
+	 * but not yet handed to the application (ring of IDs). Blocks can be
+	 * given back and taken from different threads: this state, along with
+	 * the ownership of the blocks and the counter below, is protected by
+	 * the lock. */
+	struct iio_mutex *lock;
+	unsigned int nb_enqueued;
+	unsigned int *ready, ready_head, nb_ready;
+
+	/* Number of times the kernel ran out of blocks */
+	uint64_t nb_xflows;
+	bool started;
+
+#ifdef WITH_LOCAL_IO_URING
+	struct local_uring *uring;
+#endif
+
 	int cancel_fd;
+
+	/* File descriptors of the attributes, indexed like dev->attrs,
+	 * dev->debug_attrs and dev->buffer_attrs; allocated on first read */
+	int *attr_fds, *debug_attr_fds, *buffer_attr_fds;
+
+	/* Set once the channels and attributes were read */
+	bool populated;
 };
 
 struct iio_channel_pdata {
 	char *enable_fn;
 	struct iio_channel_attr *protected_attrs;
 	unsigned int nb_protected_attrs;
+
+	/* File descriptors of the attributes, indexed like chn->attrs */
+	int *attr_fds;
 };
 
 static const char * const device_attrs_blacklist[] = {
@@ -129,9 +196,23 @@ static int ioctl_nointr(int fd, unsigned long request, void *data)
 	return ret;
 }
 
+static void local_close_attr_fds(int *fds, unsigned int nb)
+{
+	unsigned int i;
+
+	if (!fds)
+		return;
+
+	for (i = 0; i < nb; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	free(fds);
+}
+
 static void local_free_channel_pdata(struct iio_channel *chn)
 {
 	if (chn->pdata) {
+		local_close_attr_fds(chn->pdata->attr_fds, chn->nb_attrs);
 		free(chn->pdata->enable_fn);
 		free(chn->pdata);
 	}
@@ -145,8 +226,17 @@ static void local_free_pdata(struct iio_device *device)
 		local_free_channel_pdata(device->channels[i]);
 
 	if (device->pdata) {
+		if (device->pdata->lock)
+			iio_mutex_destroy(device->pdata->lock);
 		free(device->pdata->blocks);
 		free(device->pdata->addrs);
+		free(device->pdata->ready);
+		local_close_attr_fds(device->pdata->attr_fds,
+				device->nb_attrs);
+		local_close_attr_fds(device->pdata->debug_attr_fds,
+				device->nb_debug_attrs);
+		local_close_attr_fds(device->pdata->buffer_attr_fds,
+				device->nb_buffer_attrs);
 		free(device->pdata);
 	}
 }
@@ -159,10 +249,14 @@ static void local_shutdown(struct iio_context *ctx)
 	for (i = 0; i < ctx->nb_devices; i++) {
 		struct iio_device *dev = ctx->devices[i];
 
-		iio_device_close(dev);
+		/* The pdata of a clone may not be created yet */
+		if (dev->pdata)
+			iio_device_close(dev);
 		local_free_pdata(dev);
 	}
 
+	if (ctx->pdata->lock)
+		iio_mutex_destroy(ctx->pdata->lock);
 	free(ctx->pdata);
 }
 
@@ -220,10 +314,10 @@ static int set_channel_name(struct iio_channel *chn)
 	if (prefix_len) {
 		char *name;
 
-		name = malloc(prefix_len);
+		name = iio_arena_strndup(chn->dev->ctx->arena,
+				attr0, prefix_len - 1);
 		if (!name)
 			return -ENOMEM;
-		iio_strlcpy(name, attr0, prefix_len);
 		IIO_DEBUG("Setting name of channel %s to %s\n", chn->id, name);
 		chn->name = name;
 
@@ -289,22 +383,28 @@ static int device_check_ready(const struct iio_device *dev, short events,
 		}
 	};
 	unsigned int rw_timeout_ms = dev->ctx->pdata->rw_timeout_ms;
+	uint64_t stats_start;
 	int timeout_rel;
-	int ret;
+	int ret, err;
 
 	if (!dev->pdata->blocking)
 		return 0;
 
+	stats_start = iio_stats_start(dev);
+
 	do {
 		timeout_rel = get_rel_timeout_ms(start, rw_timeout_ms);
 		ret = poll(pollfd, 2, timeout_rel);
 	} while (ret == -1 && errno == EINTR);
 
+	err = ret < 0 ? -errno : 0;
+	iio_stats_end(dev, IIO_STATS_WAIT, stats_start, ret ? err : -ETIMEDOUT);
+
 	if ((pollfd[1].revents & POLLIN))
 		return -EBADF;
 
 	if (ret < 0)
-		return -errno;
+		return err;
 	if (!ret)
 		return -ETIMEDOUT;
 	if (pollfd[0].revents & POLLNVAL)
@@ -314,6 +414,286 @@ static int device_check_ready(const struct iio_device *dev, short events,
 	return 0;
 }
 
+#ifdef WITH_LOCAL_IO_URING
+
+/*
+ * io_uring support for the low-speed interface: waiting for the device and
+ * reading (or writing) are submitted as a linked poll + read/write pair, so
+ * that each chunk costs a single io_uring_enter() call instead of poll()
+ * followed by read(). The cancellation eventfd is polled by a request armed
+ * once for the lifetime of the ring. The raw system calls are used, so that
+ * liburing is not required.
+ */
+
+enum {
+	URING_CANCEL = 1,
+	URING_POLL,
+	URING_RW,
+	URING_ABORT,
+};
+
+struct local_uring {
+	int fd;
+	bool cancelled;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	struct io_uring_cqe *cqes;
+};
+
+static int local_uring_enter(struct local_uring *ring, unsigned int to_submit,
+		unsigned int min_complete, int timeout_ms)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	void *argp = NULL;
+	size_t argsz = 0;
+	int ret;
+
+	if (min_complete)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	if (min_complete && timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t) (uintptr_t) &ts;
+
+		flags |= IORING_ENTER_EXT_ARG;
+		argp = &arg;
+		argsz = sizeof(arg);
+	}
+
+	ret = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit,
+			min_complete, flags, argp, argsz);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static struct io_uring_sqe * local_uring_get_sqe(struct local_uring *ring)
+{
+	unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned int tail = *ring->sq_tail;
+	unsigned int idx;
+
+	if (tail - head >= *ring->sq_entries)
+		return NULL;
+
+	idx = tail & *ring->sq_mask;
+	ring->sq_array[idx] = idx;
+	memset(&ring->sqes[idx], 0, sizeof(ring->sqes[idx]));
+
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return &ring->sqes[idx];
+}
+
+static bool local_uring_get_cqe(struct local_uring *ring,
+		struct io_uring_cqe *cqe)
+{
+	unsigned int head = *ring->cq_head;
+	unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return false;
+
+	*cqe = ring->cqes[head & *ring->cq_mask];
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void local_uring_destroy(struct local_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	free(ring);
+}
+
+static struct local_uring * local_uring_create(int cancel_fd)
+{
+	struct io_uring_params params;
+	struct io_uring_sqe *sqe;
+	struct local_uring *ring;
+	int ret;
+
+	ring = zalloc(sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int) syscall(__NR_io_uring_setup, 4, &params);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	/* The timeout of io_uring_enter() requires Linux 5.11 */
+	if (!(params.features & IORING_FEAT_EXT_ARG))
+		goto err_destroy;
+
+	ring->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto err_destroy;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto err_destroy;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto err_destroy;
+	}
+
+	ring->sq_head = (void *) ((uintptr_t) ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (void *) ((uintptr_t) ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = (void *) ((uintptr_t) ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_entries = (void *) ((uintptr_t) ring->sq_ring + params.sq_off.ring_entries);
+	ring->sq_array = (void *) ((uintptr_t) ring->sq_ring + params.sq_off.array);
+	ring->cq_head = (void *) ((uintptr_t) ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (void *) ((uintptr_t) ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = (void *) ((uintptr_t) ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (void *) ((uintptr_t) ring->cq_ring + params.cq_off.cqes);
+
+	/* Armed once; completes when local_cancel() signals the eventfd */
+	sqe = local_uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = cancel_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_CANCEL;
+
+	ret = local_uring_enter(ring, 1, 0, -1);
+	if (ret < 0)
+		goto err_destroy;
+
+	return ring;
+
+err_destroy:
+	local_uring_destroy(ring);
+	return NULL;
+}
+
+/* Cancels the pending poll + read/write pair, and waits for it to end */
+static void local_uring_abort(struct local_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe cqe;
+	int ret;
+
+	sqe = local_uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = URING_POLL;
+	sqe->user_data = URING_ABORT;
+
+	ret = local_uring_enter(ring, 1, 0, -1);
+	if (ret < 0)
+		return;
+
+	for (;;) {
+		while (local_uring_get_cqe(ring, &cqe)) {
+			if (cqe.user_data == URING_CANCEL)
+				ring->cancelled = true;
+			else if (cqe.user_data == URING_RW)
+				return;
+		}
+
+		ret = local_uring_enter(ring, 0, 1, -1);
+		if (ret < 0 && ret != -EINTR)
+			return;
+	}
+}
+
+static ssize_t local_uring_rw(const struct iio_device *dev,
+		void *ptr, size_t len, bool is_write, struct timespec *start)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct local_uring *ring = pdata->uring;
+	unsigned int rw_timeout_ms = dev->ctx->pdata->rw_timeout_ms;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe cqe;
+	unsigned int to_submit = 2;
+	int ret;
+
+	if (ring->cancelled)
+		return -EBADF;
+
+	sqe = local_uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = pdata->fd;
+	sqe->poll32_events = is_write ? POLLOUT : POLLIN;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = URING_POLL;
+
+	sqe = local_uring_get_sqe(ring);
+	sqe->opcode = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = pdata->fd;
+	sqe->addr = (uint64_t) (uintptr_t) ptr;
+	sqe->len = (uint32_t) len;
+	sqe->off = (uint64_t) -1; /* Use the file position */
+	sqe->user_data = URING_RW;
+
+	for (;;) {
+		ret = local_uring_enter(ring, to_submit, 1,
+				get_rel_timeout_ms(start, rw_timeout_ms));
+		if (ret >= 0)
+			to_submit = 0;
+		else if (ret == -ETIME)
+			break;
+		else if (ret != -EINTR && ret != -EBUSY)
+			return ret;
+
+		while (local_uring_get_cqe(ring, &cqe)) {
+			if (cqe.user_data == URING_CANCEL)
+				ring->cancelled = true;
+			else if (cqe.user_data == URING_RW)
+				return cqe.res;
+		}
+
+		if (ring->cancelled)
+			break;
+	}
+
+	local_uring_abort(ring);
+
+	return ring->cancelled ? -EBADF : -ETIMEDOUT;
+}
+
+#endif /* WITH_LOCAL_IO_URING */
+
 static ssize_t local_read(const struct iio_device *dev,
 		void *dst, size_t len, uint32_t *mask, size_t words)
 {
@@ -336,6 +716,24 @@ static ssize_t local_read(const struct iio_device *dev,
 	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	while (len > 0) {
+#ifdef WITH_LOCAL_IO_URING
+		if (pdata->uring && pdata->blocking) {
+			ret = local_uring_rw(dev, (void *) ptr, len,
+					false, &start);
+			if (ret == -EAGAIN)
+				continue;
+			if (ret < 0)
+				break;
+			if (ret == 0) {
+				ret = -EIO;
+				break;
+			}
+
+			ptr += ret;
+			len -= ret;
+			continue;
+		}
+#endif
 		ret = device_check_ready(dev, POLLIN, &start);
 		if (ret < 0)
 			break;
@@ -383,6 +781,24 @@ static ssize_t local_write(const struct iio_device *dev,
 	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	while (len > 0) {
+#ifdef WITH_LOCAL_IO_URING
+		if (pdata->uring && pdata->blocking) {
+			ret = local_uring_rw(dev, (void *) ptr, len,
+					true, &start);
+			if (ret == -EAGAIN)
+				continue;
+			if (ret < 0)
+				break;
+			if (ret == 0) {
+				ret = -EIO;
+				break;
+			}
+
+			ptr += ret;
+			len -= ret;
+			continue;
+		}
+#endif
 		ret = device_check_ready(dev, POLLOUT, &start);
 		if (ret < 0)
 			break;
@@ -432,88 +848,386 @@ static int local_set_kernel_buffers_count(const struct iio_device *dev,
 	return 0;
 }
 
+static int local_set_cyclic_buffers_count(const struct iio_device *dev,
+		unsigned int nb_blocks)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+
+	if (pdata->fd != -1)
+		return -EBUSY;
+
+	pdata->cyclic_nb_blocks = nb_blocks;
+
+	return 0;
+}
+
+/* Dequeues a completed block without waiting; called with the lock of the
+ * device held */
+static ssize_t local_try_dequeue(const struct iio_device *dev,
+		struct block *block)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	uint64_t stats_start;
+	int ret;
+
+	memset(block, 0, sizeof(*block));
+	stats_start = iio_stats_start(dev);
+	ret = ioctl_nointr(pdata->fd, BLOCK_DEQUEUE_IOCTL, block);
+	iio_stats_end(dev, IIO_STATS_DEQUEUE, stats_start,
+			ret ? -errno : (ssize_t) block->bytes_used);
+	IIO_TRACE3(block_dequeue, dev->id, block->id,
+			ret ? -errno : (ssize_t) block->bytes_used);
+	if (ret)
+		return (ssize_t) -errno;
+
+	if (block->id >= pdata->allocated_nb_blocks)
+		return -EIO;
+
+	pdata->queued[block->id] = false;
+	pdata->nb_enqueued--;
+	return 0;
+}
+
+/* Waits for a block to be available and dequeues it */
+static ssize_t local_do_dequeue(const struct iio_device *dev,
+		struct block *block, bool blocking)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct timespec start;
+	char err_str[1024];
+	ssize_t ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		if (blocking) {
+			ret = (ssize_t) device_check_ready(dev,
+					POLLIN | POLLOUT, &start);
+			if (ret < 0)
+				return ret;
+		}
+
+		iio_mutex_lock(pdata->lock);
+		ret = local_try_dequeue(dev, block);
+		iio_mutex_unlock(pdata->lock);
+	} while (blocking && ret == -EAGAIN);
+
+	if (ret && ret != -EIO && ret != -EAGAIN) {
+		iio_strerror(-(int) ret, err_str, sizeof(err_str));
+		IIO_ERROR("Unable to dequeue block: %s\n", err_str);
+	}
+
+	return ret;
+}
+
+/*
+ * The kernel returns the blocks in the order they were enqueued. Once one
+ * is available, the other completed blocks are dequeued as well and kept
+ * for the next calls: if the kernel is left without any block, the hardware
+ * ran out of buffers, and samples were lost (input) or not provided in time
+ * (output). This costs one extra ioctl per block in the common case.
+ */
+static ssize_t local_dequeue(const struct iio_device *dev,
+		struct block *block, bool wait)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct block next;
+	ssize_t ret;
+
+	iio_mutex_lock(pdata->lock);
+	if (pdata->nb_ready) {
+		*block = pdata->blocks[pdata->ready[pdata->ready_head]];
+		pdata->ready_head = (pdata->ready_head + 1) %
+			pdata->allocated_nb_blocks;
+		pdata->nb_ready--;
+		iio_mutex_unlock(pdata->lock);
+		return 0;
+	}
+	iio_mutex_unlock(pdata->lock);
+
+	ret = local_do_dequeue(dev, block, wait && pdata->blocking);
+	if (ret || pdata->cyclic)
+		return ret;
+
+	iio_mutex_lock(pdata->lock);
+	while (pdata->nb_enqueued && !local_try_dequeue(dev, &next)) {
+		pdata->blocks[next.id] = next;
+		pdata->ready[(pdata->ready_head + pdata->nb_ready) %
+			pdata->allocated_nb_blocks] = next.id;
+		pdata->nb_ready++;
+	}
+
+	/* Blocks completed before the application gave any back (e.g. the
+	 * output blocks available right after opening) don't count */
+	if (!pdata->nb_enqueued && pdata->started)
+		pdata->nb_xflows++;
+	iio_mutex_unlock(pdata->lock);
+
+	return 0;
+}
+
+static int local_enqueue(const struct iio_device *dev, struct block *block)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	uint64_t stats_start;
+	char err_str[1024];
+	int ret;
+
+	/* Updated along with the ioctl, so that a thread dequeueing the block
+	 * right away does not see it as not enqueued */
+	iio_mutex_lock(pdata->lock);
+	stats_start = iio_stats_start(dev);
+	ret = ioctl_nointr(pdata->fd, BLOCK_ENQUEUE_IOCTL, block);
+	if (ret)
+		ret = -errno;
+	iio_stats_end(dev, IIO_STATS_ENQUEUE, stats_start,
+			ret ? ret : (ssize_t) block->bytes_used);
+	IIO_TRACE3(block_enqueue, dev->id, block->id,
+			ret ? ret : (ssize_t) block->bytes_used);
+	if (!ret) {
+		pdata->queued[block->id] = true;
+		pdata->nb_enqueued++;
+		pdata->started = true;
+	}
+	iio_mutex_unlock(pdata->lock);
+
+	if (ret) {
+		iio_strerror(-ret, err_str, sizeof(err_str));
+		IIO_ERROR("Unable to enqueue block: %s\n", err_str);
+	}
+
+	return ret;
+}
+
 static ssize_t local_get_buffer(const struct iio_device *dev,
 		void **addr_ptr, size_t bytes_used,
 		uint32_t *mask, size_t words)
 {
 	struct block block;
 	struct iio_device_pdata *pdata = dev->pdata;
-	struct timespec start;
-	char err_str[1024];
-	int f = pdata->fd;
 	ssize_t ret;
 
 	if (!pdata->is_high_speed)
 		return -ENOSYS;
-	if (f == -1)
+	if (pdata->fd == -1)
 		return -EBADF;
 	if (!addr_ptr)
 		return -EINVAL;
 
 	if (pdata->last_dequeued >= 0) {
 		struct block *last_block = &pdata->blocks[pdata->last_dequeued];
+		bool swap = pdata->allocated_nb_blocks > 1;
 
 		if (pdata->cyclic) {
-			if (pdata->cyclic_buffer_enqueued)
+			if (pdata->cyclic_buffer_enqueued && !swap)
 				return -EBUSY;
-			pdata->blocks[0].flags |= BLOCK_FLAG_CYCLIC;
+			last_block->flags |= BLOCK_FLAG_CYCLIC;
 			pdata->cyclic_buffer_enqueued = true;
 		}
 
 		last_block->bytes_used = bytes_used;
-		ret = (ssize_t) ioctl_nointr(f,
-				BLOCK_ENQUEUE_IOCTL, last_block);
-		if (ret) {
-			ret = (ssize_t) -errno;
-			iio_strerror(errno, err_str, sizeof(err_str));
-			IIO_ERROR("Unable to enqueue block: %s\n", err_str);
+		ret = (ssize_t) local_enqueue(dev, last_block);
+		if (ret)
 			return ret;
-		}
 
-		if (pdata->cyclic) {
+		if (pdata->cyclic && !swap) {
 			*addr_ptr = pdata->addrs[pdata->last_dequeued];
 			return (ssize_t) last_block->bytes_used;
 		}
 
+		/* With several blocks, the kernel ends the cyclic transfer of
+		 * the previous waveform once it is complete, and switches to
+		 * the new one. Its block is then returned, and can be filled
+		 * with the next waveform. */
 		pdata->last_dequeued = -1;
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = local_dequeue(dev, &block, true);
+	if (ret)
+		return ret;
 
-	do {
-		ret = (ssize_t) device_check_ready(dev, POLLIN | POLLOUT, &start);
-		if (ret < 0)
-			return ret;
+	/* Requested buffer size is too big! */
+	if (pdata->last_dequeued < 0 && bytes_used > block.size)
+		return -EFBIG;
 
-		memset(&block, 0, sizeof(block));
-		ret = (ssize_t) ioctl_nointr(f, BLOCK_DEQUEUE_IOCTL, &block);
-	} while (pdata->blocking && ret == -1 && errno == EAGAIN);
+	pdata->last_dequeued = block.id;
+	*addr_ptr = pdata->addrs[block.id];
+	return (ssize_t) block.bytes_used;
+}
 
-	if (ret) {
-		ret = (ssize_t) -errno;
-		if ((!pdata->blocking && ret != -EAGAIN) ||
-				(pdata->blocking && ret != -ETIMEDOUT)) {
-			iio_strerror(errno, err_str, sizeof(err_str));
-			IIO_ERROR("Unable to dequeue block: %s\n", err_str);
-		}
+/*
+ * The two functions below give the application direct access to the ring of
+ * DMA blocks. Several blocks can be held at the same time and they can be
+ * given back in any order, from any thread: the ownership of the blocks and
+ * the ring of completed blocks are protected by the lock of the device.
+ */
+static ssize_t local_dequeue_block(const struct iio_device *dev,
+		void **addr_ptr)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct block block;
+	ssize_t ret;
+
+	if (!pdata->is_high_speed)
+		return -ENOSYS;
+	if (pdata->fd == -1)
+		return -EBADF;
+	if (pdata->cyclic)
+		return -EPERM;
+
+	/* Hand over the block that might have been dequeued by
+	 * local_get_buffer() (e.g. the first block of an output buffer) */
+	iio_mutex_lock(pdata->lock);
+	if (pdata->last_dequeued >= 0) {
+		int id = pdata->last_dequeued;
+
+		pdata->last_dequeued = -1;
+		iio_mutex_unlock(pdata->lock);
+		*addr_ptr = pdata->addrs[id];
+		return (ssize_t) pdata->blocks[id].size;
+	}
+	iio_mutex_unlock(pdata->lock);
+
+	ret = local_dequeue(dev, &block, true);
+	if (ret)
 		return ret;
+
+	*addr_ptr = pdata->addrs[block.id];
+	return (ssize_t) block.bytes_used;
+}
+
+static int local_enqueue_block(const struct iio_device *dev,
+		void *addr, size_t bytes_used)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct block block;
+	unsigned int i;
+
+	if (!pdata->is_high_speed)
+		return -ENOSYS;
+	if (pdata->fd == -1)
+		return -EBADF;
+
+	for (i = 0; i < pdata->allocated_nb_blocks; i++)
+		if (pdata->addrs[i] == addr)
+			break;
+	if (i == pdata->allocated_nb_blocks)
+		return -EINVAL;
+
+	block = pdata->blocks[i];
+	if (bytes_used > block.size)
+		return -EFBIG;
+
+	block.bytes_used = bytes_used ? bytes_used : block.size;
+	return local_enqueue(dev, &block);
+}
+
+/*
+ * Asynchronous transfers map directly onto the kernel's block queue:
+ * submitting gives a block back to the kernel, and completing dequeues the
+ * next one. Blocks are identified by their address, so that several of
+ * them can be held at once by the buffers of a buffer set. The file
+ * descriptor returned by local_get_fd() signals when a block is available.
+ */
+static int local_submit_buffer(const struct iio_device *dev,
+		void *addr, size_t len)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct block *block;
+	unsigned int i;
+	int ret;
+
+	if (!pdata->is_high_speed)
+		return -ENOSYS;
+	if (pdata->fd == -1)
+		return -EBADF;
+	if (pdata->cyclic)
+		return -EPERM;
+
+	if (!addr) {
+		/* Input buffers can queue a request before holding any
+		 * block; output buffers would have nothing to send */
+		return iio_device_is_tx(dev) ? -EBUSY : 0;
 	}
 
-	/* Requested buffer size is too big! */
-	if (pdata->last_dequeued < 0 && bytes_used > block.size)
+	for (i = 0; i < pdata->allocated_nb_blocks; i++)
+		if (pdata->addrs[i] == addr)
+			break;
+	if (i == pdata->allocated_nb_blocks)
+		return -EINVAL;
+
+	block = &pdata->blocks[i];
+	if (len > block->size)
 		return -EFBIG;
 
-	pdata->last_dequeued = block.id;
+	block->bytes_used = len;
+	ret = local_enqueue(dev, block);
+	if (ret)
+		return ret;
+
+	if (pdata->last_dequeued == (int) i)
+		pdata->last_dequeued = -1;
+	return 0;
+}
+
+static ssize_t local_complete_buffer(const struct iio_device *dev,
+		void **addr_ptr, size_t len, uint32_t *mask, size_t words,
+		bool wait)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct block block;
+	ssize_t ret;
+
+	if (!pdata->is_high_speed)
+		return -ENOSYS;
+	if (pdata->fd == -1)
+		return -EBADF;
+
+	/* An input buffer completing a second request without submitting
+	 * in between implicitly releases the block it holds */
+	if (*addr_ptr && !iio_device_is_tx(dev)) {
+		ret = (ssize_t) local_submit_buffer(dev, *addr_ptr, len);
+		if (ret)
+			return ret;
+
+		*addr_ptr = NULL;
+	}
+
+	ret = local_dequeue(dev, &block, wait);
+	if (ret)
+		return ret;
+
 	*addr_ptr = pdata->addrs[block.id];
 	return (ssize_t) block.bytes_used;
 }
 
+static int local_get_xflow_count(const struct iio_device *dev,
+		uint64_t *count)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+
+	if (!pdata->is_high_speed || pdata->cyclic)
+		return -ENOSYS;
+	if (pdata->fd == -1)
+		return -EBADF;
+
+	iio_mutex_lock(pdata->lock);
+	*count = pdata->nb_xflows;
+	iio_mutex_unlock(pdata->lock);
+	return 0;
+}
+
 static ssize_t local_read_all_dev_attrs(const struct iio_device *dev,
 		char *dst, size_t len, enum iio_attr_type type)
 {
 	unsigned int i, nb;
 	char **attrs;
 	char *ptr = dst;
+	int ret;
+
+	ret = iio_device_populate(dev);
+	if (ret)
+		return ret;
 
 	switch (type) {
 		case IIO_ATTR_TYPE_DEVICE:
@@ -605,6 +1319,11 @@ static ssize_t local_write_all_dev_attrs(const struct iio_device *dev,
 	unsigned int i, nb;
 	char **attrs;
 	const char *ptr = src;
+	int ret;
+
+	ret = iio_device_populate(dev);
+	if (ret)
+		return ret;
 
 	switch (type) {
 		case IIO_ATTR_TYPE_DEVICE:
@@ -624,97 +1343,374 @@ static ssize_t local_write_all_dev_attrs(const struct iio_device *dev,
 			break;
 	}
 
-	/* First step: Verify that the buffer is in the correct format */
-	if (local_buffer_analyze(nb, src, len))
-		return -EINVAL;
+	/* First step: Verify that the buffer is in the correct format */
+	if (local_buffer_analyze(nb, src, len))
+		return -EINVAL;
+
+	/* Second step: write the attributes */
+	for (i = 0; i < nb; i++) {
+		int32_t val = (int32_t) iio_be32toh(*(uint32_t *) ptr);
+		ptr += 4;
+
+		if (val > 0) {
+			local_write_dev_attr(dev, attrs[i], ptr, val, type);
+
+			/* Align the length to 4 bytes */
+			if (val & 3)
+				val = ((val >> 2) + 1) << 2;
+			ptr += val;
+		}
+	}
+
+	return ptr - src;
+}
+
+static ssize_t local_write_all_chn_attrs(const struct iio_channel *chn,
+		const char *src, size_t len)
+{
+	unsigned int i, nb = chn->nb_attrs;
+	const char *ptr = src;
+
+	/* First step: Verify that the buffer is in the correct format */
+	if (local_buffer_analyze(nb, src, len))
+		return -EINVAL;
+
+	/* Second step: write the attributes */
+	for (i = 0; i < nb; i++) {
+		int32_t val = (int32_t) iio_be32toh(*(uint32_t *) ptr);
+		ptr += 4;
+
+		if (val > 0) {
+			local_write_chn_attr(chn, chn->attrs[i].name, ptr, val);
+
+			/* Align the length to 4 bytes */
+			if (val & 3)
+				val = ((val >> 2) + 1) << 2;
+			ptr += val;
+		}
+	}
+
+	return ptr - src;
+}
+
+/* The kernel latches the address written to direct_reg_access, and reads
+ * back the register at that address. The file is locked for the whole list,
+ * so that the accesses of other processes do not interleave with it. */
+static int local_access_regs(const struct iio_device *dev,
+		const uint32_t *addrs, uint32_t *dst, const uint32_t *src,
+		unsigned int nb)
+{
+	char buf[1024];
+	unsigned int i;
+	ssize_t ret;
+	int fd;
+
+	iio_snprintf(buf, sizeof(buf),
+			"/sys/kernel/debug/iio/%s/direct_reg_access", dev->id);
+
+	fd = open(buf, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (flock(fd, LOCK_EX) < 0) {
+		ret = -errno;
+		goto out_close;
+	}
+
+	for (i = 0; i < nb; i++) {
+		if (src)
+			iio_snprintf(buf, sizeof(buf), "0x%" PRIx32 " 0x%" PRIx32,
+					addrs[i], src[i]);
+		else
+			iio_snprintf(buf, sizeof(buf), "0x%" PRIx32, addrs[i]);
+
+		ret = pwrite(fd, buf, strlen(buf), 0);
+		if (ret < 0) {
+			ret = -errno;
+			goto out_close;
+		}
+
+		if (src)
+			continue;
+
+		ret = pread(fd, buf, sizeof(buf) - 1, 0);
+		if (ret < 0) {
+			ret = -errno;
+			goto out_close;
+		}
+
+		buf[ret] = '\0';
+		dst[i] = (uint32_t) strtoul(buf, NULL, 0);
+	}
+
+	ret = 0;
+
+out_close:
+	/* Also releases the lock */
+	close(fd);
+	return (int) ret;
+}
+
+static int local_read_regs(const struct iio_device *dev,
+		const uint32_t *addrs, uint32_t *values, unsigned int nb)
+{
+	return local_access_regs(dev, addrs, values, NULL, nb);
+}
+
+static int local_write_regs(const struct iio_device *dev,
+		const uint32_t *addrs, const uint32_t *values, unsigned int nb)
+{
+	return local_access_regs(dev, addrs, NULL, values, nb);
+}
+
+struct iio_event_stream_pdata {
+	int fd;
+};
+
+static int local_open_events(struct iio_event_stream *stream)
+{
+	const struct iio_device *dev = stream->dev;
+	int ret, fd = dev->pdata->fd, evfd = -1;
+	char buf[1024];
+
+	/* The character device can only be opened once; the file descriptor
+	 * of the events outlives the one it was obtained from, so the device
+	 * is only opened for the time of the ioctl if no buffer is open */
+	if (fd < 0) {
+		iio_snprintf(buf, sizeof(buf), "/dev/%s", dev->id);
+		fd = open(buf, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+	}
+
+	ret = ioctl_nointr(fd, IIO_GET_EVENT_FD_IOCTL, &evfd);
+	if (ret < 0)
+		ret = -errno;
+
+	if (fd != dev->pdata->fd)
+		close(fd);
+
+	if (ret < 0) {
+		/* Drivers without events do not implement the ioctl */
+		return ret == -ENODEV ? -ENOSYS : ret;
+	}
+
+	stream->pdata = zalloc(sizeof(*stream->pdata));
+	if (!stream->pdata) {
+		close(evfd);
+		return -ENOMEM;
+	}
+
+	if (fcntl(evfd, F_SETFL, O_NONBLOCK) < 0)
+		IIO_WARNING("Unable to make the events non-blocking\n");
+
+	stream->pdata->fd = evfd;
+	return 0;
+}
+
+static ssize_t local_read_events(struct iio_event_stream *stream,
+		struct iio_event *events, size_t nb)
+{
+	unsigned int rw_timeout_ms = stream->dev->ctx->pdata->rw_timeout_ms;
+	struct pollfd pollfd = {
+		.fd = stream->pdata->fd,
+		.events = POLLIN,
+	};
+	struct timespec start;
+	ssize_t ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* struct iio_event has the layout of the kernel's iio_event_data,
+	 * so the events are read in place */
+	do {
+		ret = poll(&pollfd, 1, get_rel_timeout_ms(&start, rw_timeout_ms));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (!ret)
+			return -ETIMEDOUT;
+		if (pollfd.revents & POLLNVAL)
+			return -EBADF;
+
+		ret = read(stream->pdata->fd, events, nb * sizeof(*events));
+		if (ret < 0 && errno != EAGAIN && errno != EINTR)
+			return -errno;
+	} while (ret < 0);
+
+	return ret / (ssize_t) sizeof(*events);
+}
+
+static void local_close_events(struct iio_event_stream *stream)
+{
+	close(stream->pdata->fd);
+	free(stream->pdata);
+}
+
+static int local_attr_path(const struct iio_device *dev, const char *attr,
+		enum iio_attr_type type, char *buf, size_t len)
+{
+	switch (type) {
+		case IIO_ATTR_TYPE_DEVICE:
+			iio_snprintf(buf, len, "/sys/bus/iio/devices/%s/%s",
+					dev->id, attr);
+			return 0;
+		case IIO_ATTR_TYPE_DEBUG:
+			iio_snprintf(buf, len, "/sys/kernel/debug/iio/%s/%s",
+					dev->id, attr);
+			return 0;
+		case IIO_ATTR_TYPE_BUFFER:
+			iio_snprintf(buf, len, "/sys/bus/iio/devices/%s/buffer/%s",
+					dev->id, attr);
+			return 0;
+		default:
+			return -EINVAL;
+	}
+}
+
+/* Returns the cached file descriptor of the attribute at the given index,
+ * opening the file first if needed. Returns -1 if the attribute cannot be
+ * cached, in which case the caller should open the file itself.
+ * The cache may be filled concurrently by several threads: the array and
+ * its slots are published with atomic operations, and the thread that loses
+ * the race simply closes its own file descriptor. */
+static int local_get_attr_fd(const struct iio_device *dev, int **cache,
+		unsigned int nb, unsigned int index, const char *path)
+{
+	struct iio_context_pdata *ctx_pdata = dev->ctx->pdata;
+	int *fds = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+	int fd, expected = -1;
+	unsigned int i;
 
-	/* Second step: write the attributes */
-	for (i = 0; i < nb; i++) {
-		int32_t val = (int32_t) iio_be32toh(*(uint32_t *) ptr);
-		ptr += 4;
+	if (!fds) {
+		int *new_fds = malloc(nb * sizeof(*new_fds));
+		if (!new_fds)
+			return -1;
 
-		if (val > 0) {
-			local_write_dev_attr(dev, attrs[i], ptr, val, type);
+		for (i = 0; i < nb; i++)
+			new_fds[i] = -1;
 
-			/* Align the length to 4 bytes */
-			if (val & 3)
-				val = ((val >> 2) + 1) << 2;
-			ptr += val;
+		if (__atomic_compare_exchange_n(cache, &fds, new_fds, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			fds = new_fds;
+		} else {
+			free(new_fds);
 		}
 	}
 
-	return ptr - src;
+	fd = __atomic_load_n(&fds[index], __ATOMIC_ACQUIRE);
+	if (fd >= 0)
+		return fd;
+
+	if (__atomic_add_fetch(&ctx_pdata->nb_attr_fds, 1, __ATOMIC_RELAXED)
+			> ctx_pdata->max_attr_fds)
+		goto err_release_slot;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		goto err_release_slot;
+
+	if (!__atomic_compare_exchange_n(&fds[index], &expected, fd, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd);
+		__atomic_sub_fetch(&ctx_pdata->nb_attr_fds, 1, __ATOMIC_RELAXED);
+		fd = expected;
+	}
+
+	return fd;
+
+err_release_slot:
+	__atomic_sub_fetch(&ctx_pdata->nb_attr_fds, 1, __ATOMIC_RELAXED);
+	return -1;
 }
 
-static ssize_t local_write_all_chn_attrs(const struct iio_channel *chn,
-		const char *src, size_t len)
+static ssize_t local_read_attr_fd(int fd, char *dst, size_t len)
 {
-	unsigned int i, nb = chn->nb_attrs;
-	const char *ptr = src;
+	ssize_t ret;
 
-	/* First step: Verify that the buffer is in the correct format */
-	if (local_buffer_analyze(nb, src, len))
-		return -EINVAL;
+	/* Reading a sysfs file from offset 0 makes the kernel generate its
+	 * content again, and the whole content is returned by one read */
+	do {
+		ret = pread(fd, dst, len, 0);
+	} while (ret < 0 && errno == EINTR);
 
-	/* Second step: write the attributes */
-	for (i = 0; i < nb; i++) {
-		int32_t val = (int32_t) iio_be32toh(*(uint32_t *) ptr);
-		ptr += 4;
+	if (ret < 0)
+		return -errno;
 
-		if (val > 0) {
-			local_write_chn_attr(chn, chn->attrs[i].name, ptr, val);
+	if (ret > 0)
+		dst[ret - 1] = '\0';
+	else
+		dst[0] = '\0';
+	return ret ? ret : -EIO;
+}
 
-			/* Align the length to 4 bytes */
-			if (val & 3)
-				val = ((val >> 2) + 1) << 2;
-			ptr += val;
-		}
-	}
+static ssize_t local_read_attr_file(const char *path, char *dst, size_t len)
+{
+	FILE *f;
+	ssize_t ret;
 
-	return ptr - src;
+	f = fopen(path, "re");
+	if (!f)
+		return -errno;
+
+	ret = fread(dst, 1, len, f);
+	if (ret > 0)
+		dst[ret - 1] = '\0';
+	else
+		dst[0] = '\0';
+	fflush(f);
+	if (ferror(f))
+		ret = -errno;
+	fclose(f);
+	return ret ? ret : -EIO;
 }
 
 static ssize_t local_read_dev_attr(const struct iio_device *dev,
 		const char *attr, char *dst, size_t len, enum iio_attr_type type)
 {
-	FILE *f;
+	struct iio_device_pdata *pdata = dev->pdata;
 	char buf[1024];
-	ssize_t ret;
+	char **names;
+	unsigned int i, nb;
+	int **cache, fd, ret;
 
 	if (!attr)
 		return local_read_all_dev_attrs(dev, dst, len, type);
 
+	ret = local_attr_path(dev, attr, type, buf, sizeof(buf));
+	if (ret < 0)
+		return ret;
+
 	switch (type) {
-		case IIO_ATTR_TYPE_DEVICE:
-			iio_snprintf(buf, sizeof(buf), "/sys/bus/iio/devices/%s/%s",
-					dev->id, attr);
-			break;
 		case IIO_ATTR_TYPE_DEBUG:
-			iio_snprintf(buf, sizeof(buf), "/sys/kernel/debug/iio/%s/%s",
-					dev->id, attr);
+			names = dev->debug_attrs;
+			nb = dev->nb_debug_attrs;
+			cache = &pdata->debug_attr_fds;
 			break;
 		case IIO_ATTR_TYPE_BUFFER:
-			iio_snprintf(buf, sizeof(buf), "/sys/bus/iio/devices/%s/buffer/%s",
-					dev->id, attr);
+			names = dev->buffer_attrs;
+			nb = dev->nb_buffer_attrs;
+			cache = &pdata->buffer_attr_fds;
 			break;
 		default:
-			return -EINVAL;
+			names = dev->attrs;
+			nb = dev->nb_attrs;
+			cache = &pdata->attr_fds;
+			break;
 	}
 
-	f = fopen(buf, "re");
-	if (!f)
-		return -errno;
+	for (i = 0; i < nb; i++) {
+		if (!strcmp(attr, names[i])) {
+			fd = local_get_attr_fd(dev, cache, nb, i, buf);
+			if (fd >= 0)
+				return local_read_attr_fd(fd, dst, len);
+			break;
+		}
+	}
 
-	ret = fread(dst, 1, len, f);
-	if (ret > 0)
-		dst[ret - 1] = '\0';
-	else
-		dst[0] = '\0';
-	fflush(f);
-	if (ferror(f))
-		ret = -errno;
-	fclose(f);
-	return ret ? ret : -EIO;
+	return local_read_attr_file(buf, dst, len);
 }
 
 static ssize_t local_write_dev_attr(const struct iio_device *dev,
@@ -769,11 +1765,31 @@ static const char * get_filename(const struct iio_channel *chn,
 static ssize_t local_read_chn_attr(const struct iio_channel *chn,
 		const char *attr, char *dst, size_t len)
 {
+	const struct iio_device *dev = chn->dev;
+	char buf[1024];
+	unsigned int i;
+	int fd;
+
 	if (!attr)
 		return local_read_all_chn_attrs(chn, dst, len);
 
-	attr = get_filename(chn, attr);
-	return local_read_dev_attr(chn->dev, attr, dst, len, false);
+	for (i = 0; i < chn->nb_attrs; i++)
+		if (!strcmp(attr, chn->attrs[i].name))
+			break;
+
+	if (i == chn->nb_attrs)
+		return local_read_dev_attr(dev, attr, dst, len,
+				IIO_ATTR_TYPE_DEVICE);
+
+	iio_snprintf(buf, sizeof(buf), "/sys/bus/iio/devices/%s/%s",
+			dev->id, chn->attrs[i].filename);
+
+	fd = local_get_attr_fd(dev, &chn->pdata->attr_fds,
+			chn->nb_attrs, i, buf);
+	if (fd >= 0)
+		return local_read_attr_fd(fd, dst, len);
+
+	return local_read_attr_file(buf, dst, len);
 }
 
 static ssize_t local_write_chn_attr(const struct iio_channel *chn,
@@ -822,7 +1838,7 @@ static int enable_high_speed(const struct iio_device *dev)
 		return -ENOSYS;
 
 	if (pdata->cyclic) {
-		nb_blocks = 1;
+		nb_blocks = pdata->cyclic_nb_blocks;
 		IIO_DEBUG("Enabling cyclic mode\n");
 	} else {
 		nb_blocks = pdata->max_nb_blocks;
@@ -840,6 +1856,13 @@ static int enable_high_speed(const struct iio_device *dev)
 		return -ENOMEM;
 	}
 
+	pdata->ready = calloc(nb_blocks, sizeof(*pdata->ready));
+	pdata->queued = calloc(nb_blocks, sizeof(*pdata->queued));
+	if (!pdata->ready || !pdata->queued) {
+		ret = -ENOMEM;
+		goto err_freemem;
+	}
+
 	req.id = 0;
 	req.type = 0;
 	req.size = pdata->samples_count *
@@ -875,6 +1898,8 @@ static int enable_high_speed(const struct iio_device *dev)
 			goto err_munmap;
 		}
 
+		pdata->queued[i] = true;
+
 		pdata->addrs[i] = mmap(0, pdata->blocks[i].size,
 				PROT_READ | PROT_WRITE,
 				MAP_SHARED, fd, pdata->blocks[i].offset);
@@ -885,6 +1910,11 @@ static int enable_high_speed(const struct iio_device *dev)
 	}
 
 	pdata->last_dequeued = -1;
+	pdata->nb_enqueued = pdata->allocated_nb_blocks;
+	pdata->ready_head = 0;
+	pdata->nb_ready = 0;
+	pdata->nb_xflows = 0;
+	pdata->started = false;
 	return 0;
 
 err_munmap:
@@ -894,6 +1924,41 @@ err_block_free:
 	ioctl_nointr(fd, BLOCK_FREE_IOCTL, 0);
 	pdata->allocated_nb_blocks = 0;
 err_freemem:
+	free(pdata->queued);
+	pdata->queued = NULL;
+	free(pdata->ready);
+	pdata->ready = NULL;
+	free(pdata->addrs);
+	pdata->addrs = NULL;
+	free(pdata->blocks);
+	pdata->blocks = NULL;
+	return ret;
+}
+
+/* Unmaps and frees the blocks allocated by enable_high_speed() */
+static int disable_high_speed(const struct iio_device *dev)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	char err_str[32];
+	unsigned int i;
+	int ret = 0;
+
+	if (pdata->addrs) {
+		for (i = 0; i < pdata->allocated_nb_blocks; i++)
+			munmap(pdata->addrs[i], pdata->blocks[i].size);
+	}
+	if (pdata->fd > -1)
+		ret = ioctl_nointr(pdata->fd, BLOCK_FREE_IOCTL, 0);
+	if (ret) {
+		ret = -errno;
+		iio_strerror(errno, err_str, sizeof(err_str));
+		IIO_ERROR("Error during ioctl(): %s\n", err_str);
+	}
+	pdata->allocated_nb_blocks = 0;
+	free(pdata->queued);
+	pdata->queued = NULL;
+	free(pdata->ready);
+	pdata->ready = NULL;
 	free(pdata->addrs);
 	pdata->addrs = NULL;
 	free(pdata->blocks);
@@ -901,12 +1966,87 @@ err_freemem:
 	return ret;
 }
 
+/*
+ * Gives all the blocks back to the kernel with the new size, instead of
+ * allocating new ones. The kernel always fills input blocks completely, so
+ * those must have the exact size; output blocks only need to be large
+ * enough. Must be called with the buffer disabled.
+ */
+static int local_reuse_blocks(const struct iio_device *dev, size_t size)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	bool is_tx = iio_device_is_tx(dev);
+	struct block block;
+	unsigned int i;
+	int ret;
+
+	if (!pdata->allocated_nb_blocks)
+		return -EFBIG;
+
+	for (i = 0; i < pdata->allocated_nb_blocks; i++) {
+		if (pdata->blocks[i].size < size ||
+				(!is_tx && pdata->blocks[i].size != size))
+			return -EFBIG;
+	}
+
+	/* Get back the blocks completed before the buffer was disabled; the
+	 * ones the application still holds are taken back as well */
+	while (pdata->nb_enqueued && !local_do_dequeue(dev, &block, false))
+		continue;
+
+	pdata->last_dequeued = -1;
+	pdata->ready_head = 0;
+	pdata->nb_ready = 0;
+
+	for (i = 0; i < pdata->allocated_nb_blocks; i++) {
+		if (pdata->queued[i])
+			continue;
+
+		pdata->blocks[i].bytes_used = (uint32_t) size;
+		pdata->blocks[i].flags = 0;
+		ret = local_enqueue(dev, &pdata->blocks[i]);
+		if (ret)
+			return ret;
+	}
+
+	pdata->nb_xflows = 0;
+	pdata->started = false;
+	return 0;
+}
+
+/* Enables the channels of the device's mask, and disables the others */
+static int local_write_channels(const struct iio_device *dev)
+{
+	unsigned int i;
+	int ret;
+
+	/* Disable channels */
+	for (i = 0; i < dev->nb_channels; i++) {
+		struct iio_channel *chn = dev->channels[i];
+		if (chn->index >= 0 && !iio_channel_is_enabled(chn)) {
+			ret = channel_write_state(chn, false);
+			if (ret < 0)
+				return ret;
+		}
+	}
+	/* Enable channels */
+	for (i = 0; i < dev->nb_channels; i++) {
+		struct iio_channel *chn = dev->channels[i];
+		if (chn->index >= 0 && iio_channel_is_enabled(chn)) {
+			ret = channel_write_state(chn, true);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
 static int local_close(const struct iio_device *dev);
 
 static int local_open(const struct iio_device *dev,
 		size_t samples_count, bool cyclic)
 {
-	unsigned int i;
 	int ret;
 	char buf[1024];
 	struct iio_device_pdata *pdata = dev->pdata;
@@ -935,24 +2075,9 @@ static int local_open(const struct iio_device *dev,
 		return -errno;
 	}
 
-	/* Disable channels */
-	for (i = 0; i < dev->nb_channels; i++) {
-		struct iio_channel *chn = dev->channels[i];
-		if (chn->index >= 0 && !iio_channel_is_enabled(chn)) {
-			ret = channel_write_state(chn, false);
-			if (ret < 0)
-				goto err_close;
-		}
-	}
-	/* Enable channels */
-	for (i = 0; i < dev->nb_channels; i++) {
-		struct iio_channel *chn = dev->channels[i];
-		if (chn->index >= 0 && iio_channel_is_enabled(chn)) {
-			ret = channel_write_state(chn, true);
-			if (ret < 0)
-				goto err_close;
-		}
-	}
+	ret = local_write_channels(dev);
+	if (ret < 0)
+		goto err_close;
 
 	pdata->cyclic = cyclic;
 	pdata->cyclic_buffer_enqueued = false;
@@ -982,6 +2107,15 @@ static int local_open(const struct iio_device *dev,
 				buf, strlen(buf) + 1, false);
 		if (ret < 0)
 			goto err_close;
+
+#ifdef WITH_LOCAL_IO_URING
+		/* Fall back to poll() + read() if io_uring is unavailable */
+		if (dev->ctx->pdata->use_uring) {
+			pdata->uring = local_uring_create(pdata->cancel_fd);
+			if (!pdata->uring)
+				IIO_DEBUG("io_uring not available\n");
+		}
+#endif
 	}
 
 	ret = local_buffer_enabled_set(dev, true);
@@ -1006,25 +2140,16 @@ static int local_close(const struct iio_device *dev)
 
 	ret = 0;
 	ret1 = 0;
-	if (pdata->is_high_speed) {
-		unsigned int i;
-		if (pdata->addrs) {
-			for (i = 0; i < pdata->allocated_nb_blocks; i++)
-				munmap(pdata->addrs[i], pdata->blocks[i].size);
-		}
-		if (pdata->fd > -1)
-			ret = ioctl_nointr(pdata->fd, BLOCK_FREE_IOCTL, 0);
-		if (ret) {
-			ret = -errno;
-			iio_strerror(errno, err_str, sizeof(err_str));
-			IIO_ERROR("Error during ioctl(): %s\n", err_str);
-		}
-		pdata->allocated_nb_blocks = 0;
-		free(pdata->addrs);
-		pdata->addrs = NULL;
-		free(pdata->blocks);
-		pdata->blocks = NULL;
+
+#ifdef WITH_LOCAL_IO_URING
+	if (pdata->uring) {
+		local_uring_destroy(pdata->uring);
+		pdata->uring = NULL;
 	}
+#endif
+
+	if (pdata->is_high_speed)
+		ret = disable_high_speed(dev);
 
 	ret1 = close(pdata->fd);
 	if (ret1) {
@@ -1081,6 +2206,55 @@ static int local_close(const struct iio_device *dev)
 	return ret;
 }
 
+/*
+ * Only the channels and the size of the blocks change: the device stays
+ * opened, and its blocks are reused when their size fits. The buffer is
+ * disabled while the channels are reprogrammed, as the kernel requires.
+ */
+static int local_reconfigure(const struct iio_device *dev,
+		size_t samples_count)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	char buf[32];
+	size_t size;
+	int ret;
+
+	if (pdata->fd == -1)
+		return -EBADF;
+
+	ret = (int) local_buffer_enabled_set(dev, false);
+	if (ret < 0)
+		return ret;
+
+	ret = local_write_channels(dev);
+	if (ret < 0)
+		return ret;
+
+	pdata->samples_count = samples_count;
+	pdata->cyclic_buffer_enqueued = false;
+
+	if (pdata->is_high_speed) {
+		size = samples_count * iio_device_get_sample_size_mask(dev,
+				dev->mask, dev->words);
+
+		ret = local_reuse_blocks(dev, size);
+		if (ret == -EFBIG) {
+			IIO_DEBUG("Blocks too small, reallocating them\n");
+			disable_high_speed(dev);
+			ret = enable_high_speed(dev);
+		}
+	} else {
+		iio_snprintf(buf, sizeof(buf), "%lu", (unsigned long)
+				samples_count * pdata->max_nb_blocks);
+		ret = (int) local_write_dev_attr(dev, "buffer/length",
+				buf, strlen(buf) + 1, false);
+	}
+	if (ret < 0)
+		return ret;
+
+	return (int) local_buffer_enabled_set(dev, true);
+}
+
 static int local_get_fd(const struct iio_device *dev)
 {
 	if (dev->pdata->fd == -1)
@@ -1164,9 +2338,9 @@ static bool is_channel(const char *attr, bool strict)
 	return false;
 }
 
-static char * get_channel_id(const char *attr)
+static char * get_channel_id(struct iio_device *dev, const char *attr)
 {
-	char *res, *ptr;
+	char *ptr;
 	size_t len;
 
 	attr = strchr(attr, '_') + 1;
@@ -1174,13 +2348,7 @@ static char * get_channel_id(const char *attr)
 	if (find_channel_modifier(ptr + 1, &len) != IIO_NO_MOD)
 		ptr += len + 1;
 
-	res = malloc(ptr - attr + 1);
-	if (!res)
-		return NULL;
-
-	memcpy(res, attr, ptr - attr);
-	res[ptr - attr] = 0;
-	return res;
+	return iio_arena_strndup(dev->ctx->arena, attr, ptr - attr);
 }
 
 static char * get_short_attr_name(struct iio_channel *chn, const char *attr)
@@ -1198,7 +2366,7 @@ static char * get_short_attr_name(struct iio_channel *chn, const char *attr)
 			ptr += len + 1;
 	}
 
-	return iio_strdup(ptr);
+	return iio_arena_strdup(chn->dev->ctx->arena, ptr);
 }
 
 static int read_device_name(struct iio_device *dev)
@@ -1210,7 +2378,7 @@ static int read_device_name(struct iio_device *dev)
 	else if (ret == 0)
 		return -EIO;
 
-	dev->name = iio_strdup(buf);
+	dev->name = iio_arena_strdup(dev->ctx->arena, buf);
 	if (!dev->name)
 		return -ENOMEM;
 	else
@@ -1226,18 +2394,18 @@ static int add_attr_to_device(struct iio_device *dev, const char *attr)
 		if (!strcmp(device_attrs_blacklist[i], attr))
 			return 0;
 
+	/* The name of the devices of lazy contexts was read already */
 	if (!strcmp(attr, "name"))
-		return read_device_name(dev);
+		return dev->name ? 0 : read_device_name(dev);
 
-	name = iio_strdup(attr);
+	name = iio_arena_strdup(dev->ctx->arena, attr);
 	if (!name)
 		return -ENOMEM;
 
-	attrs = realloc(dev->attrs, (1 + dev->nb_attrs) * sizeof(char *));
-	if (!attrs) {
-		free(name);
+	attrs = iio_arena_grow_array(dev->ctx->arena, dev->attrs,
+			dev->nb_attrs, sizeof(char *));
+	if (!attrs)
 		return -ENOMEM;
-	}
 
 	attrs[dev->nb_attrs++] = name;
 	dev->attrs = attrs;
@@ -1351,15 +2519,10 @@ static int add_protected_attr(struct iio_channel *chn, char *name, char *fn)
 	return 0;
 }
 
+/* The names of the attributes are in the arena of the context */
 static void free_protected_attrs(struct iio_channel *chn)
 {
 	struct iio_channel_pdata *pdata = chn->pdata;
-	unsigned int i;
-
-	for (i = 0; i < pdata->nb_protected_attrs; i++) {
-		free(pdata->protected_attrs[i].name);
-		free(pdata->protected_attrs[i].filename);
-	}
 
 	free(pdata->protected_attrs);
 	pdata->nb_protected_attrs = 0;
@@ -1369,47 +2532,37 @@ static void free_protected_attrs(struct iio_channel *chn)
 static int add_attr_to_channel(struct iio_channel *chn,
 		const char *attr, const char *path, bool is_scan_element)
 {
+	struct iio_arena *arena = chn->dev->ctx->arena;
 	struct iio_channel_attr *attrs;
 	char *fn, *name = get_short_attr_name(chn, attr);
 	if (!name)
 		return -ENOMEM;
 
-	fn = iio_strdup(path);
+	fn = iio_arena_strdup(arena, path);
 	if (!fn)
-		goto err_free_name;
-
-	if (is_scan_element) {
-		int ret = add_protected_attr(chn, name, fn);
-
-		if (ret < 0)
-			goto err_free_fn;
+		return -ENOMEM;
 
-		return 0;
-	}
+	if (is_scan_element)
+		return add_protected_attr(chn, name, fn);
 
-	attrs = realloc(chn->attrs, (1 + chn->nb_attrs) *
+	attrs = iio_arena_grow_array(arena, chn->attrs, chn->nb_attrs,
 			sizeof(struct iio_channel_attr));
 	if (!attrs)
-		goto err_free_fn;
+		return -ENOMEM;
 
 	attrs[chn->nb_attrs].filename = fn;
 	attrs[chn->nb_attrs++].name = name;
 	chn->attrs = attrs;
 	IIO_DEBUG("Added attr \'%s\' to channel \'%s\'\n", name, chn->id);
 	return 0;
-
-err_free_fn:
-	free(fn);
-err_free_name:
-	free(name);
-	return -ENOMEM;
 }
 
 static int add_channel_to_device(struct iio_device *dev,
 		struct iio_channel *chn)
 {
-	struct iio_channel **channels = realloc(dev->channels,
-			(dev->nb_channels + 1) * sizeof(struct iio_channel *));
+	struct iio_channel **channels = iio_arena_grow_array(dev->ctx->arena,
+			dev->channels, dev->nb_channels,
+			sizeof(struct iio_channel *));
 	if (!channels)
 		return -ENOMEM;
 
@@ -1424,8 +2577,9 @@ static int add_channel_to_device(struct iio_device *dev,
 static int add_device_to_context(struct iio_context *ctx,
 		struct iio_device *dev)
 {
-	struct iio_device **devices = realloc(ctx->devices,
-			(ctx->nb_devices + 1) * sizeof(struct iio_device *));
+	struct iio_device **devices = iio_arena_grow_array(ctx->arena,
+			ctx->devices, ctx->nb_devices,
+			sizeof(struct iio_device *));
 	if (!devices)
 		return -ENOMEM;
 
@@ -1439,13 +2593,14 @@ static struct iio_channel *create_channel(struct iio_device *dev,
 		char *id, const char *attr, const char *path,
 		bool is_scan_element)
 {
-	struct iio_channel *chn = zalloc(sizeof(*chn));
+	struct iio_channel *chn = iio_arena_alloc(dev->ctx->arena,
+			sizeof(*chn));
 	if (!chn)
 		return NULL;
 
 	chn->pdata = zalloc(sizeof(*chn->pdata));
 	if (!chn->pdata)
-		goto err_free_chn;
+		return NULL;
 
 	if (!strncmp(attr, "out_", 4))
 		chn->is_output = true;
@@ -1463,8 +2618,6 @@ static struct iio_channel *create_channel(struct iio_device *dev,
 err_free_chn_pdata:
 	free(chn->pdata->enable_fn);
 	free(chn->pdata);
-err_free_chn:
-	free(chn);
 	return NULL;
 }
 
@@ -1476,7 +2629,7 @@ static int add_channel(struct iio_device *dev, const char *name,
 	unsigned int i;
 	int ret;
 
-	channel_id = get_channel_id(name);
+	channel_id = get_channel_id(dev, name);
 	if (!channel_id)
 		return -ENOMEM;
 
@@ -1484,7 +2637,6 @@ static int add_channel(struct iio_device *dev, const char *name,
 		chn = dev->channels[i];
 		if (!strcmp(chn->id, channel_id)
 				&& chn->is_output == (name[0] == 'o')) {
-			free(channel_id);
 			ret = add_attr_to_channel(chn, name, path,
 					dir_is_scan_elements);
 			chn->is_scan_element = dir_is_scan_elements && !ret;
@@ -1493,10 +2645,8 @@ static int add_channel(struct iio_device *dev, const char *name,
 	}
 
 	chn = create_channel(dev, channel_id, name, path, dir_is_scan_elements);
-	if (!chn) {
-		free(channel_id);
+	if (!chn)
 		return -ENXIO;
-	}
 
 	iio_channel_init_finalize(chn);
 
@@ -1504,7 +2654,6 @@ static int add_channel(struct iio_device *dev, const char *name,
 	if (ret) {
 		free(chn->pdata->enable_fn);
 		free(chn->pdata);
-		free_channel(chn);
 	}
 	return ret;
 }
@@ -1610,10 +2759,8 @@ static int detect_and_move_global_attrs(struct iio_device *dev)
 				return ret;
 		}
 
-		if (match) {
-			free(dev->attrs[i]);
+		if (match)
 			dev->attrs[i] = NULL;
-		}
 	}
 
 	/* Find channels without an index */
@@ -1629,7 +2776,6 @@ static int detect_and_move_global_attrs(struct iio_device *dev)
 			if (ret)
 				return ret;
 
-			free(dev->attrs[i]);
 			dev->attrs[i] = NULL;
 		}
 	}
@@ -1640,10 +2786,8 @@ static int detect_and_move_global_attrs(struct iio_device *dev)
 	}
 
 	dev->nb_attrs = ptr - dev->attrs;
-	if (!dev->nb_attrs) {
-		free(dev->attrs);
+	if (!dev->nb_attrs)
 		dev->attrs = NULL;
-	}
 
 	return 0;
 }
@@ -1659,15 +2803,14 @@ static int add_buffer_attr(void *d, const char *path)
 		if (!strcmp(buffer_attrs_reserved[i], name))
 			return 0;
 
-	attr = iio_strdup(name);
+	attr = iio_arena_strdup(dev->ctx->arena, name);
 	if (!attr)
 		return -ENOMEM;
 
-	attrs = realloc(dev->buffer_attrs, (1 + dev->nb_buffer_attrs) * sizeof(char *));
-	if (!attrs) {
-		free(attr);
+	attrs = iio_arena_grow_array(dev->ctx->arena, dev->buffer_attrs,
+			dev->nb_buffer_attrs, sizeof(char *));
+	if (!attrs)
 		return -ENOMEM;
-	}
 
 	attrs[dev->nb_buffer_attrs++] = attr;
 	dev->buffer_attrs = attrs;
@@ -1789,41 +2932,20 @@ static int add_buffer_attributes(struct iio_device *dev, const char *devpath)
 	return 0;
 }
 
-static int create_device(void *d, const char *path)
+/* Reads the channels and attributes of the device from sysfs */
+static int read_device(struct iio_device *dev, const char *path)
 {
 	uint32_t *mask = NULL;
 	unsigned int i;
 	int ret;
-	struct iio_context *ctx = d;
-	struct iio_device *dev = zalloc(sizeof(*dev));
-	if (!dev)
-		return -ENOMEM;
-
-	dev->pdata = zalloc(sizeof(*dev->pdata));
-	if (!dev->pdata) {
-		free(dev);
-		return -ENOMEM;
-	}
-
-	dev->pdata->fd = -1;
-	dev->pdata->blocking = true;
-	dev->pdata->max_nb_blocks = NB_BLOCKS;
-
-	dev->ctx = ctx;
-	dev->id = iio_strdup(strrchr(path, '/') + 1);
-	if (!dev->id) {
-		local_free_pdata(dev);
-		free(dev);
-		return -ENOMEM;
-	}
 
 	ret = foreach_in_dir(dev, path, false, add_attr_or_channel);
 	if (ret < 0)
-		goto err_free_device;
+		return ret;
 
 	ret = add_buffer_attributes(dev, path);
 	if (ret < 0)
-		goto err_free_device;
+		return ret;
 
 	ret = add_scan_elements(dev, path);
 	if (ret < 0)
@@ -1841,7 +2963,7 @@ static int create_device(void *d, const char *path)
 
 	ret = detect_and_move_global_attrs(dev);
 	if (ret < 0)
-		goto err_free_device;
+		return ret;
 
 	/* sorting is done after global attrs are added */
 	for (i = 0; i < dev->nb_channels; i++) {
@@ -1854,25 +2976,79 @@ static int create_device(void *d, const char *path)
 
 	dev->words = (dev->nb_channels + 31) / 32;
 	if (dev->words) {
-		mask = calloc(dev->words, sizeof(*mask));
-		if (!mask) {
-			ret = -ENOMEM;
-			goto err_free_device;
-		}
+		mask = iio_arena_alloc(dev->ctx->arena,
+				dev->words * sizeof(*mask));
+		if (!mask)
+			return -ENOMEM;
 	}
 
 	dev->mask = mask;
+	return 0;
+
+err_free_scan_elements:
+	for (i = 0; i < dev->nb_channels; i++)
+		free_protected_attrs(dev->channels[i]);
+	return ret;
+}
+
+static int create_device_pdata(struct iio_device *dev)
+{
+	dev->pdata = zalloc(sizeof(*dev->pdata));
+	if (!dev->pdata)
+		return -ENOMEM;
+
+	dev->pdata->lock = iio_mutex_create();
+	if (!dev->pdata->lock) {
+		free(dev->pdata);
+		dev->pdata = NULL;
+		return -ENOMEM;
+	}
+
+	dev->pdata->fd = -1;
+	dev->pdata->blocking = true;
+	dev->pdata->max_nb_blocks = NB_BLOCKS;
+	dev->pdata->cyclic_nb_blocks = 1;
+	return 0;
+}
+
+static int create_device(void *d, const char *path)
+{
+	int ret;
+	struct iio_context *ctx = d;
+	struct iio_device *dev = iio_arena_alloc(ctx->arena, sizeof(*dev));
+	if (!dev)
+		return -ENOMEM;
+
+	ret = create_device_pdata(dev);
+	if (ret < 0)
+		return ret;
+
+	dev->ctx = ctx;
+	dev->id = iio_arena_strdup(ctx->arena, strrchr(path, '/') + 1);
+	if (!dev->id) {
+		local_free_pdata(dev);
+		return -ENOMEM;
+	}
+
+	/* The devices of lazy contexts are only listed, with their name */
+	if (ctx->pdata->lazy) {
+		ret = read_device_name(dev);
+		if (ret == -ENOENT)
+			ret = 0;
+	} else {
+		ret = read_device(dev, path);
+	}
+	if (ret < 0)
+		goto err_free_device;
 
 	ret = add_device_to_context(ctx, dev);
 	if (!ret)
 		return 0;
 
-err_free_scan_elements:
-	for (i = 0; i < dev->nb_channels; i++)
-		free_protected_attrs(dev->channels[i]);
 err_free_device:
+	/* The device itself stays in the arena until the context is
+	 * destroyed */
 	local_free_pdata(dev);
-	free_device(dev);
 	return ret;
 }
 
@@ -1880,16 +3056,14 @@ static int add_debug_attr(void *d, const char *path)
 {
 	struct iio_device *dev = d;
 	const char *attr = strrchr(path, '/') + 1;
-	char **attrs, *name = iio_strdup(attr);
+	char **attrs, *name = iio_arena_strdup(dev->ctx->arena, attr);
 	if (!name)
 		return -ENOMEM;
 
-	attrs = realloc(dev->debug_attrs,
-			(1 + dev->nb_debug_attrs) * sizeof(char *));
-	if (!attrs) {
-		free(name);
+	attrs = iio_arena_grow_array(dev->ctx->arena, dev->debug_attrs,
+			dev->nb_debug_attrs, sizeof(char *));
+	if (!attrs)
 		return -ENOMEM;
-	}
 
 	attrs[dev->nb_debug_attrs++] = name;
 	dev->debug_attrs = attrs;
@@ -1929,33 +3103,6 @@ static void local_cancel(const struct iio_device *dev)
 	}
 }
 
-static struct iio_context * local_clone(
-		const struct iio_context *ctx __attribute__((unused)))
-{
-	return local_create_context();
-}
-
-static const struct iio_backend_ops local_ops = {
-	.clone = local_clone,
-	.open = local_open,
-	.close = local_close,
-	.get_fd = local_get_fd,
-	.set_blocking_mode = local_set_blocking_mode,
-	.read = local_read,
-	.write = local_write,
-	.set_kernel_buffers_count = local_set_kernel_buffers_count,
-	.get_buffer = local_get_buffer,
-	.read_device_attr = local_read_dev_attr,
-	.write_device_attr = local_write_dev_attr,
-	.read_channel_attr = local_read_chn_attr,
-	.write_channel_attr = local_write_chn_attr,
-	.get_trigger = local_get_trigger,
-	.set_trigger = local_set_trigger,
-	.shutdown = local_shutdown,
-	.set_timeout = local_set_timeout,
-	.cancel = local_cancel,
-};
-
 static void init_data_scale(struct iio_channel *chn)
 {
 	char *end, buf[1024];
@@ -1988,6 +3135,237 @@ static void init_scan_elements(struct iio_context *ctx)
 	}
 }
 
+static void reset_device(struct iio_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		local_free_channel_pdata(dev->channels[i]);
+		dev->channels[i]->pdata = NULL;
+	}
+
+	/* The memory stays in the arena of the context */
+	dev->channels = NULL;
+	dev->nb_channels = 0;
+	dev->attrs = NULL;
+	dev->nb_attrs = 0;
+	dev->buffer_attrs = NULL;
+	dev->nb_buffer_attrs = 0;
+	dev->debug_attrs = NULL;
+	dev->nb_debug_attrs = 0;
+	dev->mask = NULL;
+	dev->words = 0;
+}
+
+static int populate_device(struct iio_device *dev)
+{
+	unsigned int i;
+	char buf[1024];
+	struct stat st;
+	int ret;
+
+	iio_snprintf(buf, sizeof(buf), "/sys/bus/iio/devices/%s", dev->id);
+
+	ret = read_device(dev, buf);
+	if (ret < 0)
+		goto err_reset_device;
+
+	/* Like for the other contexts, the debug attributes are optional */
+	iio_snprintf(buf, sizeof(buf), "/sys/kernel/debug/iio/%s", dev->id);
+	if (!stat(buf, &st) && S_ISDIR(st.st_mode))
+		foreach_in_dir(dev, buf, false, add_debug_attr);
+
+	for (i = 0; i < dev->nb_channels; i++)
+		init_data_scale(dev->channels[i]);
+
+	ret = iio_device_init(dev);
+	if (ret < 0)
+		goto err_reset_device;
+
+	IIO_DEBUG("Populated device \'%s\'\n", dev->id);
+	return 0;
+
+err_reset_device:
+	/* The next access will try again */
+	reset_device(dev);
+	return ret;
+}
+
+static int local_populate_device(const struct iio_device *dev)
+{
+	struct iio_context_pdata *ctx_pdata = dev->ctx->pdata;
+	struct iio_device_pdata *pdata = dev->pdata;
+	int ret = 0;
+
+	if (!ctx_pdata->lazy ||
+			__atomic_load_n(&pdata->populated, __ATOMIC_ACQUIRE))
+		return 0;
+
+	iio_mutex_lock(ctx_pdata->lock);
+
+	if (!pdata->populated) {
+		ret = populate_device((struct iio_device *) dev);
+		if (!ret)
+			__atomic_store_n(&pdata->populated, true,
+					__ATOMIC_RELEASE);
+	}
+
+	iio_mutex_unlock(ctx_pdata->lock);
+	return ret;
+}
+
+static const char * local_get_xml(const struct iio_context *ctx)
+{
+	struct iio_context *context = (struct iio_context *) ctx;
+	char *xml;
+	unsigned int i;
+
+	if (__atomic_load_n(&context->xml, __ATOMIC_ACQUIRE))
+		return ctx->xml;
+
+	/* The description of every device goes into the XML */
+	for (i = 0; i < ctx->nb_devices; i++)
+		if (iio_device_populate(ctx->devices[i]))
+			return NULL;
+
+	iio_mutex_lock(ctx->pdata->lock);
+
+	if (!ctx->xml) {
+		xml = iio_arena_adopt(ctx->arena, iio_context_create_xml(ctx));
+		if (xml)
+			__atomic_store_n(&context->xml, xml, __ATOMIC_RELEASE);
+	}
+
+	iio_mutex_unlock(ctx->pdata->lock);
+	return ctx->xml;
+}
+
+static int clone_device_pdata(struct iio_device *dev,
+		const struct iio_device *orig)
+{
+	unsigned int i;
+	int ret;
+
+	ret = create_device_pdata(dev);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < dev->nb_channels; i++) {
+		struct iio_channel *chn = dev->channels[i];
+		const char *enable_fn = orig->channels[i]->pdata->enable_fn;
+
+		chn->pdata = zalloc(sizeof(*chn->pdata));
+		if (!chn->pdata)
+			return -ENOMEM;
+
+		if (enable_fn) {
+			chn->pdata->enable_fn = iio_strdup(enable_fn);
+			if (!chn->pdata->enable_fn)
+				return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/* The clones of eager contexts share their description instead of reading
+ * sysfs again. Lazy contexts are cheap to create, and their devices are
+ * populated by each context separately. */
+static struct iio_context * local_clone(const struct iio_context *ctx)
+{
+	struct iio_context_pdata *pdata;
+	struct iio_context *new_ctx;
+	unsigned int i;
+	int ret;
+
+	if (ctx->pdata->lazy) {
+		new_ctx = local_create_context(true);
+#ifdef WITH_LOCAL_IO_URING
+		if (new_ctx)
+			new_ctx->pdata->use_uring = ctx->pdata->use_uring;
+#endif
+		return new_ctx;
+	}
+
+	/* The XML is part of the description shared */
+	if (!local_get_xml(ctx)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pdata = zalloc(sizeof(*pdata));
+	if (!pdata) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pdata->rw_timeout_ms = DEFAULT_TIMEOUT_MS;
+	pdata->max_attr_fds = ctx->pdata->max_attr_fds;
+#ifdef WITH_LOCAL_IO_URING
+	pdata->use_uring = ctx->pdata->use_uring;
+#endif
+
+	pdata->lock = iio_mutex_create();
+	if (!pdata->lock) {
+		free(pdata);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	new_ctx = iio_context_clone_description(ctx, pdata);
+	if (!new_ctx) {
+		iio_mutex_destroy(pdata->lock);
+		free(pdata);
+		return NULL;
+	}
+
+	for (i = 0; i < new_ctx->nb_devices; i++) {
+		ret = clone_device_pdata(new_ctx->devices[i], ctx->devices[i]);
+		if (ret < 0) {
+			iio_context_destroy(new_ctx);
+			errno = -ret;
+			return NULL;
+		}
+	}
+
+	return new_ctx;
+}
+
+static const struct iio_backend_ops local_ops = {
+	.clone = local_clone,
+	.open = local_open,
+	.close = local_close,
+	.reconfigure = local_reconfigure,
+	.get_fd = local_get_fd,
+	.set_blocking_mode = local_set_blocking_mode,
+	.read = local_read,
+	.write = local_write,
+	.set_kernel_buffers_count = local_set_kernel_buffers_count,
+	.set_cyclic_buffers_count = local_set_cyclic_buffers_count,
+	.get_buffer = local_get_buffer,
+	.dequeue_block = local_dequeue_block,
+	.enqueue_block = local_enqueue_block,
+	.submit_buffer = local_submit_buffer,
+	.complete_buffer = local_complete_buffer,
+	.get_xflow_count = local_get_xflow_count,
+	.read_device_attr = local_read_dev_attr,
+	.write_device_attr = local_write_dev_attr,
+	.read_channel_attr = local_read_chn_attr,
+	.write_channel_attr = local_write_chn_attr,
+	.read_regs = local_read_regs,
+	.write_regs = local_write_regs,
+	.open_events = local_open_events,
+	.read_events = local_read_events,
+	.close_events = local_close_events,
+	.get_trigger = local_get_trigger,
+	.set_trigger = local_set_trigger,
+	.shutdown = local_shutdown,
+	.set_timeout = local_set_timeout,
+	.cancel = local_cancel,
+	.populate_device = local_populate_device,
+	.get_xml = local_get_xml,
+};
+
 #ifdef WITH_LOCAL_CONFIG
 static int populate_context_attrs(struct iio_context *ctx, const char *file)
 {
@@ -2044,11 +3422,12 @@ out_close_ini:
 }
 #endif
 
-struct iio_context * local_create_context(void)
+struct iio_context * local_create_context(bool lazy)
 {
 	int ret = -ENOMEM;
 	unsigned int len;
 	struct utsname uts;
+	struct rlimit rlim;
 	struct iio_context *ctx = zalloc(sizeof(*ctx));
 	if (!ctx)
 		goto err_set_errno;
@@ -2056,19 +3435,42 @@ struct iio_context * local_create_context(void)
 	ctx->ops = &local_ops;
 	ctx->name = "local";
 
+	ctx->arena = iio_arena_new();
+	if (!ctx->arena) {
+		free(ctx);
+		goto err_set_errno;
+	}
+
 	ctx->pdata = zalloc(sizeof(*ctx->pdata));
 	if (!ctx->pdata) {
+		iio_arena_destroy(ctx->arena);
 		free(ctx);
 		goto err_set_errno;
 	}
 
 	local_set_timeout(ctx, DEFAULT_TIMEOUT_MS);
 
+	ctx->pdata->lazy = lazy;
+#ifdef WITH_LOCAL_IO_URING
+	ctx->pdata->use_uring = true;
+#endif
+	ctx->pdata->lock = iio_mutex_create();
+	if (!ctx->pdata->lock)
+		goto err_context_destroy;
+
+	/* Keep at most half of the file descriptors available to the process
+	 * for the attribute cache */
+	if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur != RLIM_INFINITY)
+		ctx->pdata->max_attr_fds = (unsigned int) (rlim.rlim_cur / 2);
+	else
+		ctx->pdata->max_attr_fds = MAX_ATTR_FDS;
+
 	uname(&uts);
 	len = strlen(uts.sysname) + strlen(uts.nodename) + strlen(uts.release)
 		+ strlen(uts.version) + strlen(uts.machine);
-	ctx->description = malloc(len + 5); /* 4 spaces + EOF */
+	ctx->description = iio_arena_alloc(ctx->arena, len + 5); /* 4 spaces + EOF */
 	if (!ctx->description) {
+		iio_arena_destroy(ctx->arena);
 		free(ctx->pdata);
 		free(ctx);
 		goto err_set_errno;
@@ -2084,9 +3486,11 @@ struct iio_context * local_create_context(void)
 	qsort(ctx->devices, ctx->nb_devices, sizeof(struct iio_device *),
 		iio_device_compare);
 
-	foreach_in_dir(ctx, "/sys/kernel/debug/iio", true, add_debug);
+	if (!lazy) {
+		foreach_in_dir(ctx, "/sys/kernel/debug/iio", true, add_debug);
 
-	init_scan_elements(ctx);
+		init_scan_elements(ctx);
+	}
 
 #ifdef WITH_LOCAL_CONFIG
 	ret = populate_context_attrs(ctx, "/etc/libiio.ini");
@@ -2115,6 +3519,49 @@ err_set_errno:
 	return NULL;
 }
 
+/* The address part of "local:" URIs is a list of options separated by
+ * commas: "lazy", and "io_uring=0" or "io_uring=1" */
+struct iio_context * local_create_context_from_uri(const char *uri)
+{
+	const char *opt = uri + sizeof("local:") - 1;
+	struct iio_context *ctx;
+	int use_uring = -1;
+	bool lazy = false;
+
+	while (*opt) {
+		size_t len = strcspn(opt, ",");
+
+		if (len == sizeof("lazy") - 1 && !strncmp(opt, "lazy", len)) {
+			lazy = true;
+		} else if (len == sizeof("io_uring=0") - 1 &&
+				!strncmp(opt, "io_uring=", len - 1) &&
+				(opt[len - 1] == '0' || opt[len - 1] == '1')) {
+			use_uring = opt[len - 1] == '1';
+		} else {
+			errno = EINVAL;
+			return NULL;
+		}
+
+		opt += len;
+		if (*opt == ',')
+			opt++;
+	}
+
+#ifdef WITH_LOCAL_IO_URING
+	ctx = local_create_context(lazy);
+	if (ctx && use_uring >= 0)
+		ctx->pdata->use_uring = use_uring;
+#else
+	if (use_uring == 1) {
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	ctx = local_create_context(lazy);
+#endif
+	return ctx;
+}
+
 #define BUF_SIZE 128
 
 static char * cat_file(const char *path)
@@ -24,7 +24,10 @@
 #include <pthread.h>
 #endif
 
+#include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 
 struct iio_mutex {
 #ifdef NO_THREADS
@@ -38,13 +41,37 @@ struct iio_mutex {
 #endif
 };
 
-struct iio_mutex * iio_mutex_create(void)
-{
-	struct iio_mutex *lock = malloc(sizeof(*lock));
+struct iio_cond {
+#ifdef NO_THREADS
+	int foo; /* avoid complaints about empty structure */
+#else
+#ifdef _WIN32
+	CONDITION_VARIABLE cond;
+#else
+	pthread_cond_t cond;
+#endif
+#endif
+};
 
-	if (!lock)
-		return NULL;
+struct iio_thrd {
+#ifndef NO_THREADS
+#ifdef _WIN32
+	HANDLE thid;
+#else
+	pthread_t thid;
+#endif
+#endif
+	int (*func)(void *);
+	void *d;
+	int ret;
+
+	/* A detached thread frees this structure once it returns */
+	struct iio_mutex lock;
+	bool done, detached;
+};
 
+static void iio_mutex_init(struct iio_mutex *lock)
+{
 #ifndef NO_THREADS
 #ifdef _WIN32
 	InitializeCriticalSection(&lock->lock);
@@ -52,10 +79,9 @@ struct iio_mutex * iio_mutex_create(void)
 	pthread_mutex_init(&lock->lock, NULL);
 #endif
 #endif
-	return lock;
 }
 
-void iio_mutex_destroy(struct iio_mutex *lock)
+static void iio_mutex_deinit(struct iio_mutex *lock)
 {
 #ifndef NO_THREADS
 #ifdef _WIN32
@@ -64,6 +90,21 @@ void iio_mutex_destroy(struct iio_mutex *lock)
 	pthread_mutex_destroy(&lock->lock);
 #endif
 #endif
+}
+
+struct iio_mutex * iio_mutex_create(void)
+{
+	struct iio_mutex *lock = malloc(sizeof(*lock));
+
+	if (lock)
+		iio_mutex_init(lock);
+
+	return lock;
+}
+
+void iio_mutex_destroy(struct iio_mutex *lock)
+{
+	iio_mutex_deinit(lock);
 	free(lock);
 }
 
@@ -88,3 +129,228 @@ void iio_mutex_unlock(struct iio_mutex *lock)
 #endif
 #endif
 }
+
+#if defined(_WIN32) && !defined(NO_THREADS)
+static INIT_ONCE global_lock_once = INIT_ONCE_STATIC_INIT;
+static struct iio_mutex global_lock;
+
+static BOOL CALLBACK global_lock_init(PINIT_ONCE once, PVOID d, PVOID *ctx)
+{
+	iio_mutex_init(&global_lock);
+	return TRUE;
+}
+#elif !defined(NO_THREADS)
+static struct iio_mutex global_lock = { PTHREAD_MUTEX_INITIALIZER };
+#else
+static struct iio_mutex global_lock;
+#endif
+
+struct iio_mutex * iio_mutex_get_global(void)
+{
+#if defined(_WIN32) && !defined(NO_THREADS)
+	InitOnceExecuteOnce(&global_lock_once, global_lock_init, NULL, NULL);
+#endif
+	return &global_lock;
+}
+
+struct iio_cond * iio_cond_create(void)
+{
+	struct iio_cond *cond = malloc(sizeof(*cond));
+
+	if (!cond)
+		return NULL;
+
+#ifndef NO_THREADS
+#ifdef _WIN32
+	InitializeConditionVariable(&cond->cond);
+#else
+	pthread_cond_init(&cond->cond, NULL);
+#endif
+#endif
+	return cond;
+}
+
+void iio_cond_destroy(struct iio_cond *cond)
+{
+#if !defined(NO_THREADS) && !defined(_WIN32)
+	pthread_cond_destroy(&cond->cond);
+#endif
+	free(cond);
+}
+
+void iio_cond_wait(struct iio_cond *cond, struct iio_mutex *lock)
+{
+#ifndef NO_THREADS
+#ifdef _WIN32
+	SleepConditionVariableCS(&cond->cond, &lock->lock, INFINITE);
+#else
+	pthread_cond_wait(&cond->cond, &lock->lock);
+#endif
+#endif
+}
+
+int iio_cond_wait_timeout(struct iio_cond *cond, struct iio_mutex *lock,
+		unsigned int timeout_ms)
+{
+#ifdef NO_THREADS
+	return -ETIMEDOUT;
+#else
+#ifdef _WIN32
+	if (!SleepConditionVariableCS(&cond->cond, &lock->lock, timeout_ms))
+		return GetLastError() == ERROR_TIMEOUT ? -ETIMEDOUT : -EIO;
+	return 0;
+#else
+	struct timespec ts;
+	int ret;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	ret = pthread_cond_timedwait(&cond->cond, &lock->lock, &ts);
+	return -ret;
+#endif
+#endif
+}
+
+void iio_cond_broadcast(struct iio_cond *cond)
+{
+#ifndef NO_THREADS
+#ifdef _WIN32
+	WakeAllConditionVariable(&cond->cond);
+#else
+	pthread_cond_broadcast(&cond->cond);
+#endif
+#endif
+}
+
+#ifndef NO_THREADS
+#ifdef _WIN32
+static DWORD WINAPI iio_thrd_wrapper(LPVOID d)
+#else
+static void * iio_thrd_wrapper(void *d)
+#endif
+{
+	struct iio_thrd *thrd = d;
+	bool detached;
+	int ret;
+
+	ret = thrd->func(thrd->d);
+
+	iio_mutex_lock(&thrd->lock);
+	thrd->ret = ret;
+	thrd->done = true;
+	detached = thrd->detached;
+	iio_mutex_unlock(&thrd->lock);
+
+	if (detached) {
+		iio_mutex_deinit(&thrd->lock);
+		free(thrd);
+	}
+
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
+}
+#endif
+
+struct iio_thrd * iio_thrd_create(int (*thrd)(void *),
+		void *d, const char *name)
+{
+#ifdef NO_THREADS
+	errno = ENOSYS;
+	return NULL;
+#else
+	struct iio_thrd *iio_thrd;
+#ifndef _WIN32
+	int ret;
+#endif
+
+	iio_thrd = malloc(sizeof(*iio_thrd));
+	if (!iio_thrd) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	iio_thrd->func = thrd;
+	iio_thrd->d = d;
+	iio_thrd->ret = 0;
+	iio_thrd->done = false;
+	iio_thrd->detached = false;
+	iio_mutex_init(&iio_thrd->lock);
+
+#ifdef _WIN32
+	iio_thrd->thid = CreateThread(NULL, 0, iio_thrd_wrapper,
+			iio_thrd, 0, NULL);
+	if (!iio_thrd->thid) {
+		iio_mutex_deinit(&iio_thrd->lock);
+		free(iio_thrd);
+		errno = ENOMEM;
+		return NULL;
+	}
+#else
+	ret = pthread_create(&iio_thrd->thid, NULL,
+			iio_thrd_wrapper, iio_thrd);
+	if (ret) {
+		iio_mutex_deinit(&iio_thrd->lock);
+		free(iio_thrd);
+		errno = ret;
+		return NULL;
+	}
+
+#ifdef HAS_PTHREAD_SETNAME_NP
+	pthread_setname_np(iio_thrd->thid, name);
+#endif
+#endif
+
+	return iio_thrd;
+#endif
+}
+
+int iio_thrd_join_and_destroy(struct iio_thrd *thrd)
+{
+	int ret = 0;
+
+#ifndef NO_THREADS
+#ifdef _WIN32
+	WaitForSingleObject(thrd->thid, INFINITE);
+	CloseHandle(thrd->thid);
+#else
+	pthread_join(thrd->thid, NULL);
+#endif
+	ret = thrd->ret;
+#endif
+
+	iio_mutex_deinit(&thrd->lock);
+	free(thrd);
+	return ret;
+}
+
+void iio_thrd_detach(struct iio_thrd *thrd)
+{
+	bool done;
+
+#ifndef NO_THREADS
+#ifdef _WIN32
+	CloseHandle(thrd->thid);
+#else
+	pthread_detach(thrd->thid);
+#endif
+#endif
+
+	iio_mutex_lock(&thrd->lock);
+	done = thrd->done;
+	thrd->detached = true;
+	iio_mutex_unlock(&thrd->lock);
+
+	if (done) {
+		iio_mutex_deinit(&thrd->lock);
+		free(thrd);
+	}
+}
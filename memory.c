@@ -0,0 +1,237 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include "iio-private.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Memory of the buffers that libiio allocates itself, i.e. those that are
+ * not mapped from the kernel or provided by the backend. Page-aligned and
+ * huge page memory is mapped anonymously, which also lets it be bound to a
+ * NUMA node with mbind() before it is first touched. The settings are copied
+ * into the buffer when it is created, so that it is freed the way it was
+ * allocated even if the settings of the device changed meanwhile.
+ */
+
+/* Size of the huge pages of x86 and ARM64; when the default size of the
+ * system is different, MAP_HUGETLB fails and transparent huge pages are used
+ * instead */
+#define IIO_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+#define IIO_NUMA_MAX_NODES 1024
+
+#ifndef _WIN32
+static size_t get_page_size(void)
+{
+	long size = sysconf(_SC_PAGESIZE);
+
+	return size > 0 ? (size_t) size : 4096;
+}
+#endif
+
+static bool buffer_memory_is_supported(enum iio_buffer_memory_type type,
+		bool numa_bind)
+{
+	switch (type) {
+	case IIO_BUFFER_MEMORY_DEFAULT:
+	case IIO_BUFFER_MEMORY_PAGE_ALIGNED:
+		break;
+	case IIO_BUFFER_MEMORY_HUGEPAGES:
+#ifndef __linux__
+		return false;
+#endif
+		break;
+	default:
+		return false;
+	}
+
+#ifdef __linux__
+	return true;
+#else
+	return !numa_bind;
+#endif
+}
+
+int iio_device_set_buffer_memory(struct iio_device *dev,
+		enum iio_buffer_memory_type type, int numa_node)
+{
+	if ((unsigned int) type > IIO_BUFFER_MEMORY_HUGEPAGES ||
+			numa_node >= IIO_NUMA_MAX_NODES)
+		return -EINVAL;
+
+	if (!buffer_memory_is_supported(type, numa_node >= 0))
+		return -ENOSYS;
+
+	dev->memory.type = type;
+	dev->memory.numa_bind = numa_node >= 0;
+	dev->memory.numa_node = numa_node >= 0 ? numa_node : 0;
+
+	return 0;
+}
+
+void iio_device_set_buffer_allocator(struct iio_device *dev,
+		const struct iio_buffer_allocator *allocator, void *user_data)
+{
+	dev->memory.allocator = allocator;
+	dev->memory.allocator_data = user_data;
+}
+
+#ifdef __linux__
+static size_t round_up(size_t len, size_t size)
+{
+	return (len + size - 1) / size * size;
+}
+
+/* Returns the size of the mapping holding a buffer of the given length */
+static size_t buffer_memory_map_size(const struct iio_buffer_memory *mem,
+		size_t len)
+{
+	if (mem->type == IIO_BUFFER_MEMORY_HUGEPAGES)
+		return round_up(len, IIO_HUGEPAGE_SIZE);
+
+	return round_up(len, get_page_size());
+}
+
+static int buffer_memory_bind(void *ptr, size_t len, unsigned int node)
+{
+	unsigned long mask[IIO_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	const unsigned int bits = 8 * sizeof(unsigned long);
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / bits] = 1ul << (node % bits);
+
+	/* The kernel reads one bit less than the number of nodes given */
+	if (syscall(SYS_mbind, ptr, len, MPOL_BIND, mask,
+				IIO_NUMA_MAX_NODES + 1, 0) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static void * buffer_memory_map(const struct iio_buffer_memory *mem,
+		size_t len)
+{
+	size_t size = buffer_memory_map_size(mem, len);
+	void *ptr = MAP_FAILED;
+	int ret;
+
+#ifdef MAP_HUGETLB
+	if (mem->type == IIO_BUFFER_MEMORY_HUGEPAGES) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+				-1, 0);
+		if (ptr == MAP_FAILED)
+			IIO_DEBUG("No huge pages reserved, using transparent huge pages\n");
+	}
+#endif
+
+	if (ptr == MAP_FAILED) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+
+#ifdef MADV_HUGEPAGE
+		if (mem->type == IIO_BUFFER_MEMORY_HUGEPAGES &&
+				madvise(ptr, size, MADV_HUGEPAGE) < 0)
+			IIO_DEBUG("Unable to use transparent huge pages: %i\n",
+					-errno);
+#endif
+	}
+
+	if (mem->numa_bind) {
+		ret = buffer_memory_bind(ptr, size, mem->numa_node);
+		if (ret < 0) {
+			munmap(ptr, size);
+			errno = -ret;
+			return NULL;
+		}
+	}
+
+	return ptr;
+}
+#endif /* __linux__ */
+
+void * iio_buffer_memory_alloc(const struct iio_buffer_memory *mem,
+		size_t len)
+{
+	if (mem->allocator)
+		return mem->allocator->alloc(len, mem->allocator_data);
+
+	if (mem->type == IIO_BUFFER_MEMORY_DEFAULT && !mem->numa_bind)
+		return malloc(len);
+
+#if defined(__linux__)
+	return buffer_memory_map(mem, len);
+#elif defined(_WIN32)
+	return _aligned_malloc(len, 4096);
+#else
+	{
+		void *ptr;
+
+		if (posix_memalign(&ptr, get_page_size(), len))
+			return NULL;
+
+		return ptr;
+	}
+#endif
+}
+
+void iio_buffer_memory_free(const struct iio_buffer_memory *mem,
+		void *ptr, size_t len)
+{
+	if (!ptr)
+		return;
+
+	if (mem->allocator) {
+		if (mem->allocator->free)
+			mem->allocator->free(ptr, len, mem->allocator_data);
+		return;
+	}
+
+	if (mem->type == IIO_BUFFER_MEMORY_DEFAULT && !mem->numa_bind) {
+		free(ptr);
+		return;
+	}
+
+#if defined(__linux__)
+	munmap(ptr, buffer_memory_map_size(mem, len));
+#elif defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
@@ -16,11 +16,13 @@
  *
  * */
 
+#include "arena.h"
 #include "iio-config.h"
 #include "iio-private.h"
 #include "network.h"
 #include "iio-lock.h"
 #include "iiod-client.h"
+#include "iio-trace.h"
 #include "debug.h"
 
 #define _STRINGIFY(x) #x
@@ -28,6 +30,41 @@
 
 #define IIOD_PORT_STR STRINGIFY(IIOD_PORT)
 
+/* The UDP data plane requires the binary protocol, which the zero-copy
+ * get_buffer path does not speak */
+#if !defined(_WIN32) && !defined(WITH_NETWORK_GET_BUFFER)
+#define WITH_NETWORK_UDP 1
+
+/* Default time to wait for missing datagrams, and receive buffer size */
+#define NETWORK_UDP_WAIT_MS 20
+#define NETWORK_UDP_RCVBUF (4 * 1024 * 1024)
+
+struct network_udp {
+	int fd;
+	unsigned int wait_ms;
+
+	/* Number of datagrams lost since the device was opened */
+	uint64_t nb_lost;
+
+	/* Bitmap of the datagrams of the current chunk received so far */
+	uint32_t *seen;
+	size_t nb_words;
+
+	/* Last datagram received; when stash_len is non-zero, it belongs to
+	 * a later chunk and is kept until that chunk is read */
+	size_t stash_len;
+	char buf[sizeof(struct iiod_udp_header) + IIOD_UDP_PAYLOAD];
+};
+#endif
+
+/* The shared memory data plane also requires the binary protocol */
+#if defined(__linux__) && !defined(WITH_NETWORK_GET_BUFFER)
+#define WITH_NETWORK_SHM 1
+
+/* Default number of blocks held by the shared memory */
+#define NETWORK_SHM_SLOTS 4
+#endif
+
 struct iio_network_io_context {
 	int fd;
 
@@ -42,14 +79,58 @@ struct iio_network_io_context {
 	int cancel_fd[2]; /* pipe */
 #endif
 	unsigned int timeout_ms;
+
+	/* Device of the buffer using the connection, or NULL */
+	const struct iio_device *dev;
+
+	struct iiod_client_link link;
+
+#ifdef WITH_NETWORK_UDP
+	/* Samples of the input buffers received as datagrams, or NULL */
+	struct network_udp *udp;
+#endif
+#ifdef WITH_NETWORK_SHM
+	/* Shared memory iiod writes the samples of the input buffers to, or
+	 * NULL; see struct iiod_shm_header */
+	struct iiod_shm_header *shm;
+	size_t shm_len;
+#endif
+};
+
+/* Options of the sockets of a context, given in its URI */
+struct network_socket_opts {
+	int sndbuf, rcvbuf;	/* 0: system defaults */
+	int busy_poll;		/* In microseconds; 0: disabled */
+	bool nodelay;
+
+	/* Receive the samples of input buffers over UDP, waiting at most
+	 * udp_wait ms for missing datagrams */
+	bool udp;
+	unsigned int udp_wait;
+	/* Compression of the samples of input buffers: 0 for none, 1 for
+	 * bit packing, 2 for delta coding */
+	unsigned int compress;
+	/* Receive the samples of input buffers through a shared memory of
+	 * that many blocks (1 for the default); 0: disabled */
+	unsigned int shm;
+	/* Time in seconds the connection is kept in the pool once the
+	 * context is destroyed; 0: closed right away */
+	unsigned int pool;
 };
 
+struct network_pool_entry;
+
 struct iio_context_pdata {
 	struct iio_network_io_context io_ctx;
+	struct network_socket_opts sock_opts;
 	struct addrinfo *addrinfo;
 	struct iio_mutex *lock;
 	struct iiod_client *iiod_client;
-	bool msg_trunc_supported;
+
+	/* Set when the connection goes back to the pool once the context is
+	 * destroyed, and time until which it may be reused from there */
+	struct network_pool_entry *pool;
+	uint64_t pool_expiry_ns;
 };
 
 struct iio_device_pdata {
@@ -58,9 +139,16 @@ struct iio_device_pdata {
 	int memfd;
 	void *mmap_addr;
 	size_t mmap_len;
+
+	/* Pipe used to splice the data between the socket and the memfd */
+	int pipefd[2];
 #endif
 	bool wait_for_err_code, is_cyclic, is_tx;
 	struct iio_mutex *lock;
+
+	/* Requests sent by network_submit_buffer() not answered yet */
+	unsigned int nb_pending;
+	size_t pending_tx_len;
 };
 
 #ifdef _WIN32
@@ -133,6 +221,41 @@ static int wait_cancellable(struct iio_network_io_context *io_ctx, bool read)
 	return 0;
 }
 
+/* Waits until the socket can be read from or written to */
+static int network_wait_io(struct iio_network_io_context *io_ctx)
+{
+	WSAPOLLFD pfd = {
+		.fd = (SOCKET) io_ctx->fd,
+		.events = POLLRDNORM | POLLWRNORM,
+	};
+	int ret;
+
+	ret = WSAPoll(&pfd, 1, io_ctx->timeout_ms > 0 ?
+			(int) io_ctx->timeout_ms : -1);
+	if (ret < 0)
+		return -WSAGetLastError();
+	if (!ret)
+		return -EPIPE;
+
+	ret = 0;
+	if (pfd.revents & (POLLRDNORM | POLLERR | POLLHUP))
+		ret |= IIOD_CLIENT_READABLE;
+	if (pfd.revents & POLLWRNORM)
+		ret |= IIOD_CLIENT_WRITABLE;
+	return ret;
+}
+
+static bool network_data_ready(struct iio_network_io_context *io_ctx)
+{
+	WSAPOLLFD pfd = {
+		.fd = (SOCKET) io_ctx->fd,
+		.events = POLLRDNORM,
+	};
+
+	/* Errors are reported by the read that follows */
+	return WSAPoll(&pfd, 1, 0) != 0;
+}
+
 static int network_get_error(void)
 {
 	return -WSAGetLastError();
@@ -298,6 +421,63 @@ static int wait_cancellable(struct iio_network_io_context *io_ctx, bool read)
 	return 0;
 }
 
+/* Waits until the socket can be read from or written to, or the operation
+ * is cancelled */
+static int network_wait_io(struct iio_network_io_context *io_ctx)
+{
+	struct pollfd pfd[2];
+	nfds_t nb = 1;
+	int ret;
+
+	memset(pfd, 0, sizeof(pfd));
+
+	pfd[0].fd = io_ctx->fd;
+	pfd[0].events = POLLIN | POLLOUT;
+
+	if (io_ctx->cancellable) {
+		pfd[1].fd = io_ctx->cancel_fd[0];
+		pfd[1].events = POLLIN;
+		nb = 2;
+	}
+
+	do {
+		ret = poll(pfd, nb, io_ctx->timeout_ms > 0 ?
+				(int) io_ctx->timeout_ms : -1);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1)
+		return -errno;
+	if (!ret)
+		return -EPIPE;
+	if (pfd[1].revents & POLLIN)
+		return -EBADF;
+
+	ret = 0;
+	if (pfd[0].revents & (POLLIN | POLLERR | POLLHUP))
+		ret |= IIOD_CLIENT_READABLE;
+	if (pfd[0].revents & POLLOUT)
+		ret |= IIOD_CLIENT_WRITABLE;
+	return ret;
+}
+
+#ifndef WITH_NETWORK_GET_BUFFER
+static bool network_data_ready(struct iio_network_io_context *io_ctx)
+{
+	struct pollfd pfd = {
+		.fd = io_ctx->fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, 0);
+	} while (ret == -1 && errno == EINTR);
+
+	/* Errors are reported by the read that follows */
+	return ret != 0;
+}
+#endif
+
 static int network_get_error(void)
 {
 	return -errno;
@@ -322,7 +502,7 @@ static bool network_connect_in_progress(int err)
 
 #endif
 
-static ssize_t network_recv(struct iio_network_io_context *io_ctx,
+static ssize_t network_do_recv(struct iio_network_io_context *io_ctx,
 		void *data, size_t len, int flags)
 {
 	ssize_t ret;
@@ -352,7 +532,7 @@ static ssize_t network_recv(struct iio_network_io_context *io_ctx,
 	return ret;
 }
 
-static ssize_t network_send(struct iio_network_io_context *io_ctx,
+static ssize_t network_do_send(struct iio_network_io_context *io_ctx,
 		const void *data, size_t len, int flags)
 {
 	ssize_t ret;
@@ -383,6 +563,31 @@ static ssize_t network_send(struct iio_network_io_context *io_ctx,
 	return ret;
 }
 
+/* Only the connections of the buffers are accounted to their device */
+static ssize_t network_recv(struct iio_network_io_context *io_ctx,
+		void *data, size_t len, int flags)
+{
+	uint64_t start = io_ctx->dev ? iio_stats_start(io_ctx->dev) : 0;
+	ssize_t ret = network_do_recv(io_ctx, data, len, flags);
+
+	if (start)
+		iio_stats_end(io_ctx->dev, IIO_STATS_RECV, start, ret);
+	IIO_TRACE3(recv, io_ctx->fd, len, ret);
+	return ret;
+}
+
+static ssize_t network_send(struct iio_network_io_context *io_ctx,
+		const void *data, size_t len, int flags)
+{
+	uint64_t start = io_ctx->dev ? iio_stats_start(io_ctx->dev) : 0;
+	ssize_t ret = network_do_send(io_ctx, data, len, flags);
+
+	if (start)
+		iio_stats_end(io_ctx->dev, IIO_STATS_SEND, start, ret);
+	IIO_TRACE3(send, io_ctx->fd, len, ret);
+	return ret;
+}
+
 static ssize_t write_all(struct iio_network_io_context *io_ctx,
 		const void *src, size_t len)
 {
@@ -588,6 +793,181 @@ int create_socket(const struct addrinfo *addrinfo, unsigned int timeout)
 	return fd;
 }
 
+/* Failures are not fatal: the socket still works with the defaults */
+static void network_set_socket_opts(struct iio_network_io_context *io_ctx,
+		const struct network_socket_opts *opts)
+{
+	int fd = io_ctx->fd, val;
+
+	if (opts->sndbuf && setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+				(const char *) &opts->sndbuf,
+				sizeof(opts->sndbuf)) < 0)
+		IIO_WARNING("Unable to set the send buffer size\n");
+
+	if (opts->rcvbuf && setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+				(const char *) &opts->rcvbuf,
+				sizeof(opts->rcvbuf)) < 0)
+		IIO_WARNING("Unable to set the receive buffer size\n");
+
+	/* create_socket() enables TCP_NODELAY */
+	if (!opts->nodelay) {
+		val = 0;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+				(const char *) &val, sizeof(val));
+	}
+
+	/* Detects the servers gone while the connection sits in the pool */
+	if (opts->pool) {
+		val = 1;
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE,
+				(const char *) &val, sizeof(val));
+	}
+
+#ifdef SO_BUSY_POLL
+	if (opts->busy_poll && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+				&opts->busy_poll, sizeof(opts->busy_poll)) < 0)
+		IIO_WARNING("Unable to enable busy polling\n");
+#endif
+}
+
+#ifdef WITH_NETWORK_UDP
+static void network_close_udp(struct iio_network_io_context *io_ctx)
+{
+	if (io_ctx->udp) {
+		close(io_ctx->udp->fd);
+		free(io_ctx->udp->seen);
+		free(io_ctx->udp);
+		io_ctx->udp = NULL;
+	}
+}
+
+/* Failures are not fatal: the samples are then sent over the socket */
+static void network_setup_udp(struct iio_context_pdata *pdata,
+		struct iio_network_io_context *io_ctx)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	struct network_udp *udp;
+	int ret, rcvbuf;
+	uint16_t port;
+
+	udp = zalloc(sizeof(*udp));
+	if (!udp)
+		return;
+
+	/* Receive the datagrams on the interface used by the socket */
+	if (getsockname(io_ctx->fd, (struct sockaddr *) &addr, &addr_len) < 0)
+		goto err_free_udp;
+
+	if (addr.ss_family == AF_INET)
+		((struct sockaddr_in *) &addr)->sin_port = 0;
+	else if (addr.ss_family == AF_INET6)
+		((struct sockaddr_in6 *) &addr)->sin6_port = 0;
+	else
+		goto err_free_udp;
+
+	udp->fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (udp->fd < 0)
+		goto err_free_udp;
+
+	rcvbuf = pdata->sock_opts.rcvbuf ? pdata->sock_opts.rcvbuf :
+		NETWORK_UDP_RCVBUF;
+	setsockopt(udp->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (bind(udp->fd, (struct sockaddr *) &addr, addr_len) < 0)
+		goto err_close_fd;
+
+	addr_len = sizeof(addr);
+	if (getsockname(udp->fd, (struct sockaddr *) &addr, &addr_len) < 0)
+		goto err_close_fd;
+
+	if (addr.ss_family == AF_INET)
+		port = ntohs(((struct sockaddr_in *) &addr)->sin_port);
+	else
+		port = ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+
+	ret = iiod_client_enable_udp(pdata->iiod_client, io_ctx, port);
+	if (ret < 0) {
+		IIO_WARNING("Unable to stream the samples over UDP: %d\n", ret);
+		goto err_close_fd;
+	}
+
+	udp->wait_ms = pdata->sock_opts.udp_wait;
+	io_ctx->udp = udp;
+	return;
+
+err_close_fd:
+	close(udp->fd);
+err_free_udp:
+	free(udp);
+}
+#endif
+
+#ifdef WITH_NETWORK_SHM
+static void network_close_shm(struct iio_network_io_context *io_ctx)
+{
+	if (io_ctx->shm) {
+		munmap(io_ctx->shm, io_ctx->shm_len);
+		io_ctx->shm = NULL;
+	}
+}
+
+/* Failures are not fatal: the samples are then sent over the socket */
+static void network_setup_shm(struct iio_context_pdata *pdata,
+		struct iio_network_io_context *io_ctx, size_t block_size)
+{
+	static unsigned int counter;
+	struct iiod_shm_header *hdr;
+	unsigned int nb_slots = pdata->sock_opts.shm > 1 ?
+		pdata->sock_opts.shm : NETWORK_SHM_SLOTS;
+	char name[64];
+	size_t len;
+	int fd, ret;
+
+	if (!block_size || block_size > UINT32_MAX ||
+			(SIZE_MAX - IIOD_SHM_DATA_OFFSET) / block_size < nb_slots)
+		return;
+
+	len = IIOD_SHM_DATA_OFFSET + (size_t) nb_slots * block_size;
+
+	iio_snprintf(name, sizeof(name), "/iiod-%ld-%u", (long) getpid(),
+			__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		IIO_WARNING("Unable to create shared memory: %d\n", -errno);
+		return;
+	}
+
+	if (ftruncate(fd, (off_t) len) < 0)
+		goto out_unlink;
+
+	hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		goto out_unlink;
+
+	hdr->nb_slots = nb_slots;
+	hdr->slot_size = (uint32_t) block_size;
+	hdr->released = 0;
+
+	ret = iiod_client_enable_shm(pdata->iiod_client, io_ctx, name);
+	if (ret < 0) {
+		IIO_WARNING("Unable to share memory with iiod: %d\n", ret);
+		munmap(hdr, len);
+		goto out_unlink;
+	}
+
+	io_ctx->shm = hdr;
+	io_ctx->shm_len = len;
+
+out_unlink:
+	/* Once opened by iiod, the object only lives through the descriptors
+	 * and mappings */
+	shm_unlink(name);
+	close(fd);
+}
+#endif
+
 static int network_open(const struct iio_device *dev,
 		size_t samples_count, bool cyclic)
 {
@@ -606,9 +986,43 @@ static int network_open(const struct iio_device *dev,
 	}
 
 	ppdata->io_ctx.fd = ret;
+	network_set_socket_opts(&ppdata->io_ctx, &pdata->sock_opts);
 	ppdata->io_ctx.cancelled = false;
 	ppdata->io_ctx.cancellable = false;
 	ppdata->io_ctx.timeout_ms = DEFAULT_TIMEOUT_MS;
+	memset(&ppdata->io_ctx.link, 0, sizeof(ppdata->io_ctx.link));
+	ppdata->io_ctx.dev = dev;
+
+#ifndef WITH_NETWORK_GET_BUFFER
+	/* The zero-copy path speaks the text protocol on the socket */
+	iiod_client_enable_binary(pdata->iiod_client, &ppdata->io_ctx);
+#endif
+
+#ifdef WITH_NETWORK_UDP
+	if (pdata->sock_opts.udp && !iio_device_is_tx(dev))
+		network_setup_udp(pdata, &ppdata->io_ctx);
+#endif
+
+#ifdef WITH_NETWORK_SHM
+	if (pdata->sock_opts.shm && !iio_device_is_tx(dev))
+		network_setup_shm(pdata, &ppdata->io_ctx,
+				samples_count * iio_device_get_sample_size(dev));
+#endif
+
+#ifndef WITH_NETWORK_GET_BUFFER
+	if (pdata->sock_opts.compress && !iio_device_is_tx(dev)) {
+		uint32_t mode = IIOD_FRAME_PACKED;
+
+		if (pdata->sock_opts.compress > 1)
+			mode |= IIOD_FRAME_DELTA;
+
+		/* Not fatal: the samples are then sent uncompressed */
+		ret = iiod_client_enable_compression(pdata->iiod_client,
+				&ppdata->io_ctx, mode);
+		if (ret < 0)
+			IIO_WARNING("Unable to compress the samples: %d\n", ret);
+	}
+#endif
 
 	ret = iiod_client_open_unlocked(pdata->iiod_client,
 			&ppdata->io_ctx, dev, samples_count, cyclic);
@@ -628,6 +1042,7 @@ static int network_open(const struct iio_device *dev,
 	ppdata->is_tx = iio_device_is_tx(dev);
 	ppdata->is_cyclic = cyclic;
 	ppdata->wait_for_err_code = false;
+	ppdata->nb_pending = 0;
 #ifdef WITH_NETWORK_GET_BUFFER
 	ppdata->mmap_len = samples_count * iio_device_get_sample_size(dev);
 #endif
@@ -637,6 +1052,12 @@ static int network_open(const struct iio_device *dev,
 	return 0;
 
 err_close_socket:
+#ifdef WITH_NETWORK_UDP
+	network_close_udp(&ppdata->io_ctx);
+#endif
+#ifdef WITH_NETWORK_SHM
+	network_close_shm(&ppdata->io_ctx);
+#endif
 	close(ppdata->io_ctx.fd);
 	ppdata->io_ctx.fd = -1;
 out_mutex_unlock:
@@ -657,7 +1078,10 @@ static int network_close(const struct iio_device *dev)
 					dev->ctx->pdata->iiod_client,
 					&pdata->io_ctx, dev);
 
-			write_command(&pdata->io_ctx, "\r\nEXIT\r\n");
+			/* With the binary protocol, closing the socket ends
+			 * the session */
+			if (!pdata->io_ctx.link.binary)
+				write_command(&pdata->io_ctx, "\r\nEXIT\r\n");
 		} else {
 			ret = 0;
 		}
@@ -667,6 +1091,13 @@ static int network_close(const struct iio_device *dev)
 		pdata->io_ctx.fd = -1;
 	}
 
+#ifdef WITH_NETWORK_UDP
+	network_close_udp(&pdata->io_ctx);
+#endif
+#ifdef WITH_NETWORK_SHM
+	network_close_shm(&pdata->io_ctx);
+#endif
+
 #ifdef WITH_NETWORK_GET_BUFFER
 	if (pdata->memfd >= 0)
 		close(pdata->memfd);
@@ -676,12 +1107,44 @@ static int network_close(const struct iio_device *dev)
 		munmap(pdata->mmap_addr, pdata->mmap_len);
 		pdata->mmap_addr = NULL;
 	}
+
+	if (pdata->pipefd[0] >= 0) {
+		close(pdata->pipefd[0]);
+		close(pdata->pipefd[1]);
+		pdata->pipefd[0] = -1;
+		pdata->pipefd[1] = -1;
+	}
 #endif
 
 	iio_mutex_unlock(pdata->lock);
 	return ret;
 }
 
+/* The session and its data planes are kept: iiod reprograms the device */
+static int network_reconfigure(const struct iio_device *dev,
+		size_t samples_count)
+{
+#ifdef WITH_NETWORK_GET_BUFFER
+	/* The mapping of the zero-copy path is sized when opening */
+	return -ENOSYS;
+#else
+	struct iio_device_pdata *pdata = dev->pdata;
+	int ret;
+
+	iio_mutex_lock(pdata->lock);
+	if (pdata->io_ctx.fd < 0 || pdata->io_ctx.cancelled)
+		ret = -EBADF;
+	else if (pdata->nb_pending)
+		ret = -EBUSY;
+	else
+		ret = iiod_client_reopen_unlocked(dev->ctx->pdata->iiod_client,
+				&pdata->io_ctx, dev, samples_count);
+	iio_mutex_unlock(pdata->lock);
+
+	return ret;
+#endif
+}
+
 static ssize_t network_read(const struct iio_device *dev, void *dst, size_t len,
 		uint32_t *mask, size_t words)
 {
@@ -710,7 +1173,117 @@ static ssize_t network_write(const struct iio_device *dev,
 	return ret;
 }
 
-#ifdef WITH_NETWORK_GET_BUFFER
+static int network_get_fd(const struct iio_device *dev)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+
+	if (pdata->io_ctx.fd < 0)
+		return -EBADF;
+	else
+		return pdata->io_ctx.fd;
+}
+
+/* The overflows reported are the blocks iiod dropped before it could send
+ * them, and over UDP, the datagrams lost in transit */
+static int network_get_xflow_count(const struct iio_device *dev,
+		uint64_t *count)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	int ret = 0;
+
+	iio_mutex_lock(pdata->lock);
+	if (pdata->io_ctx.fd < 0) {
+		ret = -EBADF;
+	} else if (!pdata->io_ctx.link.binary) {
+		ret = -ENOSYS;
+	} else {
+		*count = pdata->io_ctx.link.nb_dropped;
+#ifdef WITH_NETWORK_UDP
+		if (pdata->io_ctx.udp)
+			*count += pdata->io_ctx.udp->nb_lost;
+#endif
+	}
+	iio_mutex_unlock(pdata->lock);
+
+	return ret;
+}
+
+#ifndef WITH_NETWORK_GET_BUFFER
+
+/*
+ * Asynchronous transfers: the READBUF / WRITEBUF command is sent right away,
+ * and the answer is only read once the socket becomes readable, which the
+ * application can wait for by polling the descriptor returned by
+ * network_get_fd(). iiod processes the commands of a client in order, so
+ * several reads can be queued; writes are limited to one in flight, as iiod
+ * must acknowledge the command before the data follows.
+ */
+static int network_submit_buffer(const struct iio_device *dev,
+		void *addr, size_t len)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct iiod_client *client = dev->ctx->pdata->iiod_client;
+	int ret;
+
+	if (pdata->is_cyclic)
+		return -EPERM;
+
+	iio_mutex_lock(pdata->lock);
+
+	if (!pdata->is_tx) {
+		ret = iiod_client_submit_read_unlocked(client,
+				&pdata->io_ctx, dev, len);
+	} else if (pdata->nb_pending) {
+		ret = -EBUSY;
+	} else {
+		ret = iiod_client_submit_write_unlocked(client,
+				&pdata->io_ctx, dev, addr, len);
+		pdata->pending_tx_len = len;
+	}
+
+	if (!ret)
+		pdata->nb_pending++;
+
+	iio_mutex_unlock(pdata->lock);
+	return ret;
+}
+
+static ssize_t network_complete_buffer(const struct iio_device *dev,
+		void **addr_ptr, size_t len, uint32_t *mask, size_t words,
+		bool wait)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct iiod_client *client = dev->ctx->pdata->iiod_client;
+	ssize_t ret;
+
+	iio_mutex_lock(pdata->lock);
+
+	if (!pdata->nb_pending) {
+		ret = -ENOENT;
+		goto out_unlock;
+	}
+
+	if (!wait && !network_data_ready(&pdata->io_ctx)) {
+		ret = -EAGAIN;
+		goto out_unlock;
+	}
+
+	if (pdata->is_tx) {
+		ret = iiod_client_complete_write_unlocked(client,
+				&pdata->io_ctx, pdata->pending_tx_len);
+	} else {
+		ret = iiod_client_complete_read_unlocked(client,
+				&pdata->io_ctx, dev, *addr_ptr, len, mask, words);
+	}
+
+	pdata->nb_pending--;
+
+out_unlock:
+	iio_mutex_unlock(pdata->lock);
+	return ret;
+}
+
+#else /* WITH_NETWORK_GET_BUFFER */
 
 static ssize_t read_all(struct iio_network_io_context *io_ctx,
 		void *dst, size_t len)
@@ -787,7 +1360,9 @@ static ssize_t network_read_mask(struct iio_network_io_context *io_ctx,
 		}
 	}
 
-	if (read_len > 0) {
+	/* Only the mask is followed by a \n; iiod sends it along with the
+	 * first chunk of data */
+	if (read_len > 0 && mask) {
 		char c;
 		ssize_t nb = read_all(io_ctx, &c, 1);
 		if (nb > 0 && c != '\n')
@@ -843,23 +1418,61 @@ static ssize_t write_rwbuf_command(const struct iio_device *dev,
 	return write_command(&pdata->io_ctx, cmd);
 }
 
+/* Upper bound of the size of the splice pipe; this is the default maximum
+ * for unprivileged processes (/proc/sys/fs/pipe-max-size) */
+#define NETWORK_PIPE_SIZE (1024 * 1024)
+
+static int network_setup_pipe(struct iio_device_pdata *pdata)
+{
+	if (pdata->pipefd[0] >= 0)
+		return 0;
+
+	if (pipe2(pdata->pipefd, O_CLOEXEC) < 0)
+		return -errno;
+
+#ifdef F_SETPIPE_SZ
+	/* Move up to one buffer per splice call; the default pipe size
+	 * (64 KiB) is used if the limit of the system is lower */
+	if (pdata->mmap_len > PIPE_BUF)
+		fcntl(pdata->pipefd[1], F_SETPIPE_SZ,
+				(int) MIN(pdata->mmap_len, NETWORK_PIPE_SIZE));
+#endif
+
+	return 0;
+}
+
+static void network_close_pipe(struct iio_device_pdata *pdata)
+{
+	if (pdata->pipefd[0] >= 0) {
+		close(pdata->pipefd[0]);
+		close(pdata->pipefd[1]);
+	}
+
+	pdata->pipefd[0] = -1;
+	pdata->pipefd[1] = -1;
+}
+
 static ssize_t network_do_splice(struct iio_device_pdata *pdata, size_t len,
-		bool read)
+		loff_t offset, bool read)
 {
-	int pipefd[2];
 	int fd_in, fd_out;
+	loff_t *off_in, *off_out;
 	ssize_t ret, read_len = len, write_len = 0;
 
-	ret = (ssize_t) pipe2(pipefd, O_CLOEXEC);
+	ret = network_setup_pipe(pdata);
 	if (ret < 0)
-		return -errno;
+		return ret;
 
 	if (read) {
 	    fd_in = pdata->io_ctx.fd;
 	    fd_out = pdata->memfd;
+	    off_in = NULL;
+	    off_out = &offset;
 	} else {
 	    fd_in = pdata->memfd;
 	    fd_out = pdata->io_ctx.fd;
+	    off_in = &offset;
+	    off_out = NULL;
 	}
 
 	do {
@@ -874,8 +1487,8 @@ static ssize_t network_do_splice(struct iio_device_pdata *pdata, size_t len,
 			 * non-blocking mode, it should never return -EAGAIN.
 			 * TODO(pcercuei): Find why it locks...
 			 * */
-			ret = splice(fd_in, NULL, pipefd[1], NULL, read_len,
-					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			ret = splice(fd_in, off_in, pdata->pipefd[1], NULL,
+					read_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
 			if (!ret)
 				ret = -EIO;
 			if (ret < 0 && errno != EAGAIN) {
@@ -888,8 +1501,8 @@ static ssize_t network_do_splice(struct iio_device_pdata *pdata, size_t len,
 		}
 
 		if (write_len) {
-			ret = splice(pipefd[0], NULL, fd_out, NULL, write_len,
-					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			ret = splice(pdata->pipefd[0], NULL, fd_out, off_out,
+					write_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
 			if (!ret)
 				ret = -EIO;
 			if (ret < 0 && errno != EAGAIN) {
@@ -902,44 +1515,118 @@ static ssize_t network_do_splice(struct iio_device_pdata *pdata, size_t len,
 
 	} while (write_len || read_len);
 
+	IIO_TRACE3(splice, pdata->io_ctx.fd, len, len);
+	return len;
+
 err_close_pipe:
-	close(pipefd[0]);
-	close(pipefd[1]);
-	return ret < 0 ? ret : len;
+	/* Whatever is left in the pipe is garbage now */
+	network_close_pipe(pdata);
+	IIO_TRACE3(splice, pdata->io_ctx.fd, len, ret);
+	return ret;
 }
 
-static ssize_t network_get_buffer(const struct iio_device *dev,
-		void **addr_ptr, size_t bytes_used,
-		uint32_t *mask, size_t words)
+static int network_create_memfd(void)
 {
-	struct iio_device_pdata *pdata = dev->pdata;
-	ssize_t ret, read = 0;
-	int memfd;
+	int fd;
 
-	if (pdata->is_cyclic)
-		return -ENOSYS;
+#ifdef HAS_MEMFD_CREATE
+	fd = memfd_create("libiio", MFD_CLOEXEC);
+#else
+	/* O_TMPFILE -> Linux 3.11 */
+	fd = open(P_tmpdir, O_RDWR | O_TMPFILE | O_EXCL | O_CLOEXEC, S_IRWXU);
+#endif
+	return fd < 0 ? -errno : fd;
+}
 
-	/* We check early that the temporary file can be created, so that we can
-	 * return -ENOSYS in case it fails, which will indicate that the
-	 * high-speed interface is not available.
-	 *
-	 * O_TMPFILE -> Linux 3.11.
-	 * TODO: use memfd_create (Linux 3.17) */
-	memfd = open(P_tmpdir, O_RDWR | O_TMPFILE | O_EXCL | O_CLOEXEC, S_IRWXU);
+static int network_map_buffer(struct iio_device_pdata *pdata)
+{
+	void *addr;
+	int ret, memfd;
+
+	memfd = network_create_memfd();
 	if (memfd < 0)
-		return -ENOSYS;
+		return memfd;
+
+	if (ftruncate(memfd, pdata->mmap_len) < 0) {
+		ret = -errno;
+		IIO_ERROR("Unable to truncate temp file: %i\n", -ret);
+		goto err_close_memfd;
+	}
+
+	addr = mmap(NULL, pdata->mmap_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED, memfd, 0);
+	if (addr == MAP_FAILED) {
+		ret = -errno;
+		IIO_ERROR("Unable to mmap: %i\n", -ret);
+		goto err_close_memfd;
+	}
+
+#ifdef MADV_HUGEPAGE
+	/* The pages of the memfd are spliced to and from the socket, which
+	 * hugetlbfs does not support; ask for transparent huge pages instead,
+	 * which shmem provides when enabled in the system settings */
+	madvise(addr, pdata->mmap_len, MADV_HUGEPAGE);
+#endif
+
+	pdata->memfd = memfd;
+	pdata->mmap_addr = addr;
+	return 0;
+
+err_close_memfd:
+	close(memfd);
+	return ret;
+}
+
+static void network_unmap_buffer(struct iio_device_pdata *pdata)
+{
+	if (pdata->mmap_addr) {
+		munmap(pdata->mmap_addr, pdata->mmap_len);
+		pdata->mmap_addr = NULL;
+	}
+
+	if (pdata->memfd >= 0)
+		close(pdata->memfd);
+	pdata->memfd = -1;
+}
+
+/*
+ * The buffer is a memfd mapped in the address space of the application;
+ * the samples are spliced between the socket and the memfd through a pipe,
+ * so that they are never copied by the CPU.
+ *
+ * For RX the same memfd is refilled over and over. For TX, the pages just
+ * pushed may still be referenced by the socket until they are actually
+ * transmitted, so the application gets a new memfd to fill instead.
+ */
+static ssize_t network_get_buffer(const struct iio_device *dev,
+		void **addr_ptr, size_t bytes_used,
+		uint32_t *mask, size_t words)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	ssize_t ret, read = 0;
+	loff_t offset = 0;
+
+	/* We check early that a memfd can be created, so that we can return
+	 * -ENOSYS in case it fails, which will indicate that the high-speed
+	 * interface is not available. */
+	if (!addr_ptr) {
+		int memfd = network_create_memfd();
+
+		if (memfd < 0)
+			return -ENOSYS;
 
-	if (!addr_ptr || words != (dev->nb_channels + 31) / 32) {
 		close(memfd);
 		return -EINVAL;
 	}
 
-	if (pdata->mmap_addr)
-		munmap(pdata->mmap_addr, pdata->mmap_len);
+	if (words != (dev->nb_channels + 31) / 32)
+		return -EINVAL;
 
 	if (pdata->mmap_addr && pdata->is_tx) {
 		char buf[1024];
 
+		/* A cyclic buffer pushed again replaces the waveform, if
+		 * iiod can do it; it reports -EBUSY otherwise */
 		iio_snprintf(buf, sizeof(buf), "WRITEBUF %s %lu\r\n",
 				dev->id, (unsigned long) bytes_used);
 
@@ -947,26 +1634,35 @@ static ssize_t network_get_buffer(const struct iio_device *dev,
 
 		ret = write_rwbuf_command(dev, buf);
 		if (ret < 0)
-			goto err_close_memfd;
+			goto err_unlock;
 
-		ret = network_do_splice(pdata, bytes_used, false);
+		ret = network_do_splice(pdata, bytes_used, 0, false);
 		if (ret < 0)
-			goto err_close_memfd;
+			goto err_unlock;
+
+		/* There is no next push to report an error of a cyclic
+		 * buffer: wait for the error code right away */
+		if (pdata->is_cyclic) {
+			ret = read_error_code(&pdata->io_ctx);
+			if (ret < 0)
+				goto err_unlock;
+
+			iio_mutex_unlock(pdata->lock);
+
+			*addr_ptr = pdata->mmap_addr;
+			return (ssize_t) bytes_used;
+		}
 
 		pdata->wait_for_err_code = true;
 		iio_mutex_unlock(pdata->lock);
-	}
-
-	if (pdata->memfd >= 0)
-		close(pdata->memfd);
 
-	pdata->memfd = memfd;
+		network_unmap_buffer(pdata);
+	}
 
-	ret = (ssize_t) ftruncate(pdata->memfd, pdata->mmap_len);
-	if (ret < 0) {
-		ret = -errno;
-		IIO_ERROR("Unable to truncate temp file: %zi\n", -ret);
-		return ret;
+	if (!pdata->mmap_addr) {
+		ret = network_map_buffer(pdata);
+		if (ret < 0)
+			return ret;
 	}
 
 	if (!pdata->is_tx) {
@@ -990,10 +1686,11 @@ static ssize_t network_get_buffer(const struct iio_device *dev,
 
 			mask = NULL; /* We read the mask only once */
 
-			ret = network_do_splice(pdata, ret, true);
+			ret = network_do_splice(pdata, ret, offset, true);
 			if (ret < 0)
 				goto err_unlock;
 
+			offset += ret;
 			read += ret;
 			len -= ret;
 		} while (len);
@@ -1001,20 +1698,9 @@ static ssize_t network_get_buffer(const struct iio_device *dev,
 		iio_mutex_unlock(pdata->lock);
 	}
 
-	pdata->mmap_addr = mmap(NULL, pdata->mmap_len,
-			PROT_READ | PROT_WRITE, MAP_SHARED, pdata->memfd, 0);
-	if (pdata->mmap_addr == MAP_FAILED) {
-		pdata->mmap_addr = NULL;
-		ret = -errno;
-		IIO_ERROR("Unable to mmap: %zi\n", -ret);
-		return ret;
-	}
-
 	*addr_ptr = pdata->mmap_addr;
 	return read ? read : (ssize_t) bytes_used;
 
-err_close_memfd:
-	close(memfd);
 err_unlock:
 	iio_mutex_unlock(pdata->lock);
 	return ret;
@@ -1057,6 +1743,124 @@ static ssize_t network_write_chn_attr(const struct iio_channel *chn,
 			&pdata->io_ctx, chn->dev, chn, attr, src, len, false);
 }
 
+static int network_set_attr_cache(const struct iio_context *ctx,
+		const char *attr, int ttl_ms)
+{
+	return iiod_client_set_attr_cache(ctx->pdata->iiod_client, attr, ttl_ms);
+}
+
+static void network_invalidate_attr_cache(const struct iio_context *ctx)
+{
+	iiod_client_invalidate_attr_cache(ctx->pdata->iiod_client);
+}
+
+static int network_get_attr_cache_stats(const struct iio_context *ctx,
+		struct iio_attr_cache_stats *stats)
+{
+	iiod_client_get_attr_cache_stats(ctx->pdata->iiod_client, stats);
+	return 0;
+}
+
+static int network_read_attrs(const struct iio_context *ctx,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs)
+{
+	struct iio_context_pdata *pdata = ctx->pdata;
+
+	return iiod_client_read_attrs(pdata->iiod_client,
+			&pdata->io_ctx, reqs, nb_reqs);
+}
+
+static int network_write_attrs(const struct iio_context *ctx,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs)
+{
+	struct iio_context_pdata *pdata = ctx->pdata;
+
+	return iiod_client_write_attrs(pdata->iiod_client,
+			&pdata->io_ctx, reqs, nb_reqs);
+}
+
+static int network_read_regs(const struct iio_device *dev,
+		const uint32_t *addrs, uint32_t *values, unsigned int nb)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_read_regs(pdata->iiod_client, &pdata->io_ctx,
+			dev, addrs, values, nb);
+}
+
+static int network_write_regs(const struct iio_device *dev,
+		const uint32_t *addrs, const uint32_t *values, unsigned int nb)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_write_regs(pdata->iiod_client, &pdata->io_ctx,
+			dev, addrs, values, nb);
+}
+
+/* Each stream of events has a connection of its own, as the READEVT command
+ * blocks until an event is reported */
+struct iio_event_stream_pdata {
+	struct iio_network_io_context io_ctx;
+};
+
+static int network_open_events(struct iio_event_stream *stream)
+{
+	struct iio_context_pdata *pdata = stream->dev->ctx->pdata;
+	struct iio_event_stream_pdata *ppdata;
+	int ret;
+
+	ppdata = zalloc(sizeof(*ppdata));
+	if (!ppdata)
+		return -ENOMEM;
+
+	ret = create_socket(pdata->addrinfo, DEFAULT_TIMEOUT_MS);
+	if (ret < 0)
+		goto err_free_pdata;
+
+	ppdata->io_ctx.fd = ret;
+	ppdata->io_ctx.timeout_ms = DEFAULT_TIMEOUT_MS;
+	network_set_socket_opts(&ppdata->io_ctx, &pdata->sock_opts);
+
+	ret = iiod_client_open_events_unlocked(pdata->iiod_client,
+			&ppdata->io_ctx, stream->dev);
+	if (ret < 0)
+		goto err_close_socket;
+
+	/* The server times out first, see calculate_remote_timeout() */
+	set_socket_timeout(ppdata->io_ctx.fd, pdata->io_ctx.timeout_ms);
+	ppdata->io_ctx.timeout_ms = pdata->io_ctx.timeout_ms;
+
+	stream->pdata = ppdata;
+	return 0;
+
+err_close_socket:
+	close(ppdata->io_ctx.fd);
+err_free_pdata:
+	free(ppdata);
+	return ret;
+}
+
+static ssize_t network_read_events(struct iio_event_stream *stream,
+		struct iio_event *events, size_t nb)
+{
+	struct iio_context_pdata *pdata = stream->dev->ctx->pdata;
+
+	return iiod_client_read_events_unlocked(pdata->iiod_client,
+			&stream->pdata->io_ctx, events, nb);
+}
+
+static void network_close_events(struct iio_event_stream *stream)
+{
+	struct iio_context_pdata *pdata = stream->dev->ctx->pdata;
+	struct iio_event_stream_pdata *ppdata = stream->pdata;
+
+	iiod_client_close_events_unlocked(pdata->iiod_client, &ppdata->io_ctx);
+	write_command(&ppdata->io_ctx, "\r\nEXIT\r\n");
+
+	close(ppdata->io_ctx.fd);
+	free(ppdata);
+}
+
 static int network_get_trigger(const struct iio_device *dev,
 		const struct iio_device **trigger)
 {
@@ -1075,15 +1879,16 @@ static int network_set_trigger(const struct iio_device *dev,
 			&pdata->io_ctx, dev, trigger);
 }
 
+static bool network_pool_put(struct iio_context_pdata *pdata);
+
 static void network_shutdown(struct iio_context *ctx)
 {
 	struct iio_context_pdata *pdata = ctx->pdata;
 	unsigned int i;
 
-	iio_mutex_lock(pdata->lock);
-	write_command(&pdata->io_ctx, "\r\nEXIT\r\n");
-	close(pdata->io_ctx.fd);
-	iio_mutex_unlock(pdata->lock);
+	/* The models of the pool have no connection */
+	if (!pdata)
+		return;
 
 	for (i = 0; i < ctx->nb_devices; i++) {
 		struct iio_device *dev = ctx->devices[i];
@@ -1096,6 +1901,15 @@ static void network_shutdown(struct iio_context *ctx)
 		}
 	}
 
+	if (pdata->pool && network_pool_put(pdata))
+		return;
+
+	iio_mutex_lock(pdata->lock);
+	if (!pdata->io_ctx.link.binary)
+		write_command(&pdata->io_ctx, "\r\nEXIT\r\n");
+	close(pdata->io_ctx.fd);
+	iio_mutex_unlock(pdata->lock);
+
 	iiod_client_destroy(pdata->iiod_client);
 	iio_mutex_destroy(pdata->lock);
 	freeaddrinfo(pdata->addrinfo);
@@ -1147,32 +1961,158 @@ static int network_set_kernel_buffers_count(const struct iio_device *dev,
 			 &pdata->io_ctx, dev, nb_blocks);
 }
 
-static struct iio_context * network_clone(const struct iio_context *ctx)
+static int network_set_cyclic_buffers_count(const struct iio_device *dev,
+		unsigned int nb_blocks)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_set_cyclic_buffers_count(pdata->iiod_client,
+			 &pdata->io_ctx, dev, nb_blocks);
+}
+
+static int network_set_decimation(const struct iio_device *dev,
+		unsigned int factor, bool average)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	int ret;
+
+	iio_mutex_lock(pdata->lock);
+
+	/* The command goes through the socket of the buffer, which must not
+	 * have responses to READBUF still in flight */
+	if (pdata->io_ctx.fd < 0)
+		ret = -EBADF;
+	else if (pdata->is_tx)
+		ret = -EINVAL;
+	else if (pdata->nb_pending)
+		ret = -EBUSY;
+	else
+		ret = iiod_client_set_decimation(dev->ctx->pdata->iiod_client,
+				&pdata->io_ctx, dev, factor, average);
+
+	iio_mutex_unlock(pdata->lock);
+	return ret;
+}
+
+static struct iio_context_pdata * network_connect(struct addrinfo *res,
+		const struct network_socket_opts *opts);
+static void network_disconnect(struct iio_context_pdata *pdata);
+static int network_init_devices(struct iio_context *ctx);
+
+/* Connects again to the address of a context, without resolving its name */
+static struct iio_context_pdata * network_reconnect(
+		const struct iio_context *ctx,
+		const struct network_socket_opts *opts)
 {
 	const char *addr = iio_context_get_attr_value(ctx, "ip,ip-addr");
+	struct iio_context_pdata *pdata;
+	struct addrinfo hints, *res;
+	int ret;
+
+	if (!addr) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	ret = getaddrinfo(addr, IIOD_PORT_STR, &hints, &res);
+	if (ret) {
+		IIO_ERROR("Unable to find host: %s\n", gai_strerror(ret));
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pdata = network_connect(res, opts);
+	if (!pdata)
+		freeaddrinfo(res);
+
+	return pdata;
+}
+
+/* Creates a context sharing the description of another one, over the
+ * connection of pdata; on failure, the connection is closed */
+static struct iio_context * network_create_from(const struct iio_context *ctx,
+		struct iio_context_pdata *pdata)
+{
+	struct iio_context *new_ctx;
+	int ret;
+
+	new_ctx = iio_context_clone_description(ctx, pdata);
+	if (!new_ctx) {
+		network_disconnect(pdata);
+		return NULL;
+	}
+
+	/* The connections taken from the pool are multiplexed already */
+	if (!iiod_client_enable_mux(pdata->iiod_client, &pdata->io_ctx))
+		IIO_DEBUG("Multiplexing the requests\n");
+
+	ret = network_init_devices(new_ctx);
+	if (ret < 0) {
+		iio_context_destroy(new_ctx);
+		errno = -ret;
+		return NULL;
+	}
+
+	iiod_client_set_timeout(pdata->iiod_client, &pdata->io_ctx,
+			calculate_remote_timeout(DEFAULT_TIMEOUT_MS));
+	return new_ctx;
+}
+
+/* The clone connects to the same server, but shares the description of the
+ * context instead of downloading the XML again */
+static struct iio_context * network_clone(const struct iio_context *ctx)
+{
+	struct iio_context_pdata *pdata;
+
+	pdata = network_reconnect(ctx, &ctx->pdata->sock_opts);
+	if (!pdata)
+		return NULL;
 
-	return iio_create_network_context(addr);
+	return network_create_from(ctx, pdata);
 }
 
 static const struct iio_backend_ops network_ops = {
 	.clone = network_clone,
 	.open = network_open,
 	.close = network_close,
+	.reconfigure = network_reconfigure,
 	.read = network_read,
 	.write = network_write,
+	.get_fd = network_get_fd,
+	.get_xflow_count = network_get_xflow_count,
 #ifdef WITH_NETWORK_GET_BUFFER
 	.get_buffer = network_get_buffer,
+#else
+	.submit_buffer = network_submit_buffer,
+	.complete_buffer = network_complete_buffer,
 #endif
 	.read_device_attr = network_read_dev_attr,
 	.write_device_attr = network_write_dev_attr,
 	.read_channel_attr = network_read_chn_attr,
 	.write_channel_attr = network_write_chn_attr,
+	.read_attrs = network_read_attrs,
+	.set_attr_cache = network_set_attr_cache,
+	.invalidate_attr_cache = network_invalidate_attr_cache,
+	.get_attr_cache_stats = network_get_attr_cache_stats,
+	.write_attrs = network_write_attrs,
+	.read_regs = network_read_regs,
+	.write_regs = network_write_regs,
+	.open_events = network_open_events,
+	.read_events = network_read_events,
+	.close_events = network_close_events,
 	.get_trigger = network_get_trigger,
 	.set_trigger = network_set_trigger,
 	.shutdown = network_shutdown,
 	.get_version = network_get_version,
 	.set_timeout = network_set_timeout,
 	.set_kernel_buffers_count = network_set_kernel_buffers_count,
+	.set_cyclic_buffers_count = network_set_cyclic_buffers_count,
+	.set_decimation = network_set_decimation,
 
 	.cancel = network_cancel,
 };
@@ -1193,110 +2133,636 @@ static ssize_t network_read_data(struct iio_context_pdata *pdata,
 	return network_recv(io_ctx, dst, len, 0);
 }
 
-static ssize_t network_read_line(struct iio_context_pdata *pdata,
-		void *io_data, char *dst, size_t len)
+static struct iiod_client_link * network_get_link(
+		struct iio_context_pdata *pdata, void *io_data)
 {
-	bool found = false;
-	size_t i;
-#ifdef __linux__
 	struct iio_network_io_context *io_ctx = io_data;
-	ssize_t ret;
-	size_t bytes_read = 0;
-
-	do {
-		size_t to_trunc;
-
-		ret = network_recv(io_ctx, dst, len, MSG_PEEK);
-		if (ret < 0)
-			return ret;
 
-		/* Lookup for the trailing \n */
-		for (i = 0; i < (size_t) ret && dst[i] != '\n'; i++);
-		found = i < (size_t) ret;
-
-		len -= ret;
-		dst += ret;
+	return &io_ctx->link;
+}
 
-		if (found)
-			to_trunc = i + 1;
-		else
-			to_trunc = (size_t) ret;
+static int network_wait_data(struct iio_context_pdata *pdata, void *io_data)
+{
+	return network_wait_io(io_data);
+}
 
-		/* Advance the read offset to the byte following the \n if
-		 * found, or after the last character read otherwise */
-		if (pdata->msg_trunc_supported)
-			ret = network_recv(io_ctx, NULL, to_trunc, MSG_TRUNC);
-		else
-			ret = network_recv(io_ctx, dst - ret, to_trunc, 0);
-		if (ret < 0) {
-			IIO_ERROR("NETWORK RECV: %zu\n", ret);
-			return ret;
-		}
+#ifdef WITH_NETWORK_UDP
+/* Copies the datagram held in udp->buf into the chunk. Returns 1 if it was
+ * a new datagram of the chunk, 0 if it was dropped, or -EAGAIN if it belongs
+ * to a later chunk, in which case it is kept for that chunk. */
+static int network_udp_place(struct network_udp *udp, char *dst, size_t len,
+		uint32_t first_seq, uint32_t nb, size_t size)
+{
+	const struct iiod_udp_header *hdr = (const void *) udp->buf;
+	size_t offset, payload;
+	uint32_t idx;
 
-		bytes_read += to_trunc;
-	} while (!found && len);
+	if (size < sizeof(*hdr))
+		return 0;
 
-	if (!found) {
-		IIO_ERROR("EIO: %zu\n", ret);
-		return -EIO;
-	} else
-		return bytes_read;
-#else
-	for (i = 0; i < len - 1; i++) {
-		ssize_t ret = network_read_data(pdata, io_data, dst + i, 1);
+	idx = iio_be32toh(hdr->seq) - first_seq;
 
-		if (ret < 0)
-			return ret;
+	/* Late datagram of a previous chunk */
+	if ((int32_t) idx < 0)
+		return 0;
 
-		if (dst[i] != '\n')
-			found = true;
-		else if (found)
-			break;
+	if (idx >= nb) {
+		udp->stash_len = size;
+		return -EAGAIN;
 	}
 
-	if (!found || i == len - 1)
-		return -EIO;
+	offset = (size_t) idx * IIOD_UDP_PAYLOAD;
+	payload = len - offset > IIOD_UDP_PAYLOAD ?
+		IIOD_UDP_PAYLOAD : len - offset;
 
-	return (ssize_t) i + 1;
-#endif
-}
+	if (iio_be32toh(hdr->len) != len ||
+			size - sizeof(*hdr) != payload ||
+			(udp->seen[idx / 32] & BIT(idx % 32)))
+		return 0;
 
-static const struct iiod_client_ops network_iiod_client_ops = {
-	.write = network_write_data,
-	.read = network_read_data,
-	.read_line = network_read_line,
-};
+	memcpy(dst + offset, udp->buf + sizeof(*hdr), payload);
+	udp->seen[idx / 32] |= BIT(idx % 32);
+	return 1;
+}
 
-#ifdef __linux__
-/*
- * As of build 16299, Windows Subsystem for Linux presents a Linux API but
- * without support for MSG_TRUNC. Since WSL allows running native Linux
- * applications this is not something that can be detected at compile time. If
- * we want to support WSL we have to have a runtime workaround.
- */
-static bool msg_trunc_supported(struct iio_network_io_context *io_ctx)
+/* Returns 1 when a datagram can be read, 0 on timeout */
+static int network_udp_wait(struct iio_network_io_context *io_ctx,
+		int timeout_ms)
 {
+	struct pollfd pfd[2];
 	int ret;
 
-	ret = network_recv(io_ctx, NULL, 0, MSG_TRUNC | MSG_DONTWAIT);
+	memset(pfd, 0, sizeof(pfd));
 
-	return ret != -EFAULT && ret != -EINVAL;
-}
-#else
-static bool msg_trunc_supported(struct iio_network_io_context *io_ctx)
-{
-	return false;
+	pfd[0].fd = io_ctx->udp->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = io_ctx->cancel_fd[0];
+	pfd[1].events = POLLIN;
+
+	do {
+		ret = poll(pfd, io_ctx->cancellable ? 2 : 1, timeout_ms);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1)
+		return -errno;
+	if (pfd[1].revents & POLLIN)
+		return -EBADF;
+
+	return !!ret;
+}
+
+static ssize_t network_read_datagrams(struct iio_context_pdata *pdata,
+		void *io_data, char *dst, size_t len, uint32_t first_seq,
+		uint32_t nb)
+{
+	struct iio_network_io_context *io_ctx = io_data;
+	struct network_udp *udp = io_ctx->udp;
+	size_t nb_words = (nb + 31) / 32;
+	uint32_t idx, received = 0;
+	uint64_t deadline;
+	int ret = 0;
+
+	if (!udp || (uint64_t) nb * IIOD_UDP_PAYLOAD < len ||
+			(uint64_t) nb * IIOD_UDP_PAYLOAD >= len + IIOD_UDP_PAYLOAD)
+		return -EIO;
+
+	if (nb_words > udp->nb_words) {
+		uint32_t *seen = realloc(udp->seen, nb_words * sizeof(*seen));
+		if (!seen)
+			return -ENOMEM;
+
+		udp->seen = seen;
+		udp->nb_words = nb_words;
+	}
+
+	memset(udp->seen, 0, nb_words * sizeof(*udp->seen));
+
+	if (udp->stash_len) {
+		size_t size = udp->stash_len;
+
+		udp->stash_len = 0;
+		ret = network_udp_place(udp, dst, len, first_seq, nb, size);
+		if (ret > 0)
+			received++;
+	}
+
+	/* The datagrams were sent before the response; only wait for the
+	 * stragglers for a bounded amount of time */
+	deadline = iio_get_monotonic_ns() + udp->wait_ms * 1000000ull;
+
+	while (ret >= 0 && received < nb) {
+		ssize_t size = recv(udp->fd, udp->buf, sizeof(udp->buf),
+				MSG_DONTWAIT);
+
+		if (size < 0) {
+			uint64_t now;
+
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -errno;
+
+			now = iio_get_monotonic_ns();
+			if (now >= deadline)
+				break;
+
+			ret = network_udp_wait(io_ctx,
+					(int) ((deadline - now + 999999) / 1000000));
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				break;
+			continue;
+		}
+
+		ret = network_udp_place(udp, dst, len, first_seq, nb,
+				(size_t) size);
+		if (ret > 0)
+			received++;
+	}
+
+	if (received == nb)
+		return (ssize_t) len;
+
+	/* Zero the samples that were lost, so that stale data is not
+	 * mistaken for new data */
+	for (idx = 0; idx < nb; idx++) {
+		size_t offset = (size_t) idx * IIOD_UDP_PAYLOAD;
+
+		if (!(udp->seen[idx / 32] & BIT(idx % 32)))
+			memset(dst + offset, 0, len - offset > IIOD_UDP_PAYLOAD ?
+					IIOD_UDP_PAYLOAD : len - offset);
+	}
+
+	udp->nb_lost += nb - received;
+	IIO_DEBUG("Lost %u datagrams out of %u\n", nb - received, nb);
+
+	return (ssize_t) len;
+}
+#endif
+
+#ifdef WITH_NETWORK_SHM
+static ssize_t network_read_shm(struct iio_context_pdata *pdata,
+		void *io_data, char *dst, size_t len, uint32_t seq)
+{
+	struct iio_network_io_context *io_ctx = io_data;
+	struct iiod_shm_header *hdr = io_ctx->shm;
+	size_t offset;
+
+	if (!hdr || len > hdr->slot_size)
+		return -EIO;
+
+	offset = IIOD_SHM_DATA_OFFSET +
+		(size_t) (seq % hdr->nb_slots) * hdr->slot_size;
+
+	memcpy(dst, (char *) hdr + offset, len);
+
+	/* iiod may write the slot again */
+	__atomic_store_n(&hdr->released, seq + 1, __ATOMIC_RELEASE);
+
+	return (ssize_t) len;
 }
 #endif
 
+static const struct iiod_client_ops network_iiod_client_ops = {
+	.write = network_write_data,
+	.read = network_read_data,
+	.get_link = network_get_link,
+	.wait = network_wait_data,
+#ifdef WITH_NETWORK_UDP
+	.read_datagrams = network_read_datagrams,
+#endif
+#ifdef WITH_NETWORK_SHM
+	.read_shm = network_read_shm,
+#endif
+};
+
+/* Parses the comma-separated "option=value" list following the host name */
+static int network_parse_socket_opts(const char *str,
+		struct network_socket_opts *opts)
+{
+	while (*str) {
+		const char *end = strchr(str, ','), *eq;
+		char *ptr;
+		size_t len;
+		long val;
+
+		len = end ? (size_t) (end - str) : strlen(str);
+		eq = memchr(str, '=', len);
+		if (!eq)
+			return -EINVAL;
+
+		errno = 0;
+		val = strtol(eq + 1, &ptr, 0);
+		if (ptr != str + len || ptr == eq + 1 || errno == ERANGE ||
+				val < 0 || val > INT_MAX)
+			return -EINVAL;
+
+		len = (size_t) (eq - str);
+		if (len == sizeof("sndbuf") - 1 && !strncmp(str, "sndbuf", len))
+			opts->sndbuf = (int) val;
+		else if (len == sizeof("rcvbuf") - 1 &&
+				!strncmp(str, "rcvbuf", len))
+			opts->rcvbuf = (int) val;
+		else if (len == sizeof("busy_poll") - 1 &&
+				!strncmp(str, "busy_poll", len))
+			opts->busy_poll = (int) val;
+		else if (len == sizeof("nodelay") - 1 &&
+				!strncmp(str, "nodelay", len))
+			opts->nodelay = !!val;
+		else if (len == sizeof("udp") - 1 && !strncmp(str, "udp", len))
+			opts->udp = !!val;
+		else if (len == sizeof("udp_wait") - 1 &&
+				!strncmp(str, "udp_wait", len))
+			opts->udp_wait = (unsigned int) val;
+		else if (len == sizeof("compress") - 1 &&
+				!strncmp(str, "compress", len) && val <= 2)
+			opts->compress = (unsigned int) val;
+		else if (len == sizeof("pool") - 1 && !strncmp(str, "pool", len))
+			opts->pool = (unsigned int) val;
+		else if (len == sizeof("shm") - 1 && !strncmp(str, "shm", len))
+			opts->shm = (unsigned int) val;
+		else
+			return -EINVAL;
+
+		str = end ? end + 1 : ptr;
+	}
+
+	return 0;
+}
+
+static struct iio_context * network_do_create_context(const char *host,
+		const struct network_socket_opts *opts);
+
+/*
+ * Process-wide pool of the connections of the contexts created with the
+ * "pool" option, keyed by their URI. The first context created with a URI
+ * leaves a copy of its description, without connection, in the pool; the
+ * next ones share it, and take the connections the destroyed contexts left
+ * there, or connect again to the address already resolved.
+ */
+
+/* Idle connections kept per URI */
+#define NETWORK_POOL_MAX_IDLE 4
+
+struct network_pool_entry {
+	char *uri;
+	struct iio_context *model;
+
+	struct iio_context_pdata *idle[NETWORK_POOL_MAX_IDLE];
+	unsigned int nb_idle;
+
+	struct network_pool_entry *next;
+};
+
+/* Protected by the global mutex; the entries live until the process
+ * exits */
+static struct network_pool_entry *network_pool;
+
+static struct network_pool_entry * network_pool_find(const char *uri)
+{
+	struct network_pool_entry *entry;
+
+	for (entry = network_pool; entry; entry = entry->next)
+		if (!strcmp(entry->uri, uri))
+			break;
+
+	return entry;
+}
+
+/* Nothing must be received on an idle connection: if anything is, the
+ * server either closed it or is out of sync. The server must then still
+ * answer a request. */
+static bool network_pool_check(struct iio_context_pdata *pdata)
+{
+	struct iio_network_io_context *io_ctx = &pdata->io_ctx;
+	char c;
+	int ret;
+
+	if (io_ctx->link.in_left || io_ctx->link.rx_pos != io_ctx->link.rx_len)
+		return false;
+
+	ret = set_blocking_mode(io_ctx->fd, false);
+	if (ret < 0)
+		return false;
+
+	ret = (int) recv(io_ctx->fd, &c, 1, MSG_PEEK);
+	if (ret < 0 && network_should_retry(network_get_error()))
+		ret = 0;
+	else
+		ret = -EPIPE;
+
+	if (set_blocking_mode(io_ctx->fd, true) < 0 || ret < 0)
+		return false;
+
+	/* The previous context may have changed it */
+	if (set_socket_timeout(io_ctx->fd, DEFAULT_TIMEOUT_MS) < 0)
+		return false;
+
+	io_ctx->timeout_ms = DEFAULT_TIMEOUT_MS;
+
+	return !iiod_client_set_timeout(pdata->iiod_client, io_ctx,
+			calculate_remote_timeout(DEFAULT_TIMEOUT_MS));
+}
+
+/* Returns the connection of a destroyed context to its pool; returns false
+ * if the pool is full, and the connection must be closed */
+static bool network_pool_put(struct iio_context_pdata *pdata)
+{
+	struct network_pool_entry *entry = pdata->pool;
+	struct iio_mutex *lock = iio_mutex_get_global();
+	bool ret = false;
+
+	iio_mutex_lock(lock);
+
+	if (entry->nb_idle < NETWORK_POOL_MAX_IDLE) {
+		pdata->pool_expiry_ns = iio_get_monotonic_ns() +
+			(uint64_t) pdata->sock_opts.pool * 1000000000ull;
+		entry->idle[entry->nb_idle++] = pdata;
+		ret = true;
+	}
+
+	iio_mutex_unlock(lock);
+
+	return ret;
+}
+
+/* Takes the most recent idle connection not expired yet, and closes the
+ * expired ones */
+static struct iio_context_pdata *
+network_pool_get(struct network_pool_entry *entry)
+{
+	struct iio_context_pdata *pdata = NULL, *expired[NETWORK_POOL_MAX_IDLE];
+	uint64_t now = iio_get_monotonic_ns();
+	unsigned int i, nb_expired = 0;
+
+	for (i = 0; i < entry->nb_idle; i++) {
+		if (entry->idle[i]->pool_expiry_ns < now)
+			expired[nb_expired++] = entry->idle[i];
+		else
+			entry->idle[i - nb_expired] = entry->idle[i];
+	}
+
+	entry->nb_idle -= nb_expired;
+	if (entry->nb_idle)
+		pdata = entry->idle[--entry->nb_idle];
+
+	for (i = 0; i < nb_expired; i++)
+		network_disconnect(expired[i]);
+
+	return pdata;
+}
+
+static struct iio_context * network_pool_create_context(const char *uri,
+		const char *host, const struct network_socket_opts *opts)
+{
+	struct iio_mutex *lock = iio_mutex_get_global();
+	struct network_pool_entry *entry;
+	struct iio_context_pdata *pdata;
+	struct iio_context *ctx, *model;
+
+	iio_mutex_lock(lock);
+
+	entry = network_pool_find(uri);
+	if (!entry) {
+		iio_mutex_unlock(lock);
+		goto out_create_context;
+	}
+
+	/* The model is never freed once in the pool */
+	model = entry->model;
+
+	do {
+		pdata = network_pool_get(entry);
+		iio_mutex_unlock(lock);
+
+		if (!pdata || network_pool_check(pdata))
+			break;
+
+		IIO_DEBUG("Dropping stale connection from the pool\n");
+		network_disconnect(pdata);
+		iio_mutex_lock(lock);
+	} while (true);
+
+	if (!pdata) {
+		pdata = network_reconnect(model, opts);
+		if (!pdata)
+			return NULL;
+	}
+
+	ctx = network_create_from(model, pdata);
+	if (ctx)
+		pdata->pool = entry;
+
+	return ctx;
+
+out_create_context:
+	ctx = network_do_create_context(host, opts);
+	if (!ctx)
+		return NULL;
+
+	entry = zalloc(sizeof(*entry));
+	if (!entry)
+		return ctx;
+
+	entry->uri = iio_strdup(uri);
+	entry->model = iio_context_clone_description(ctx, NULL);
+	if (!entry->uri || !entry->model) {
+		if (entry->model)
+			iio_context_destroy(entry->model);
+		free(entry->uri);
+		free(entry);
+		return ctx;
+	}
+
+	iio_mutex_lock(lock);
+
+	/* Another thread may have filled the pool in the meantime */
+	if (!network_pool_find(uri)) {
+		entry->next = network_pool;
+		network_pool = entry;
+		ctx->pdata->pool = entry;
+		entry = NULL;
+	}
+
+	iio_mutex_unlock(lock);
+
+	if (entry) {
+		iio_context_destroy(entry->model);
+		free(entry->uri);
+		free(entry);
+	}
+
+	return ctx;
+}
+
 struct iio_context * network_create_context(const char *host)
 {
-	struct addrinfo hints, *res;
+	struct network_socket_opts opts = {
+		.nodelay = true,
+#ifdef WITH_NETWORK_UDP
+		.udp_wait = NETWORK_UDP_WAIT_MS,
+#endif
+	};
+	struct iio_context *ctx;
+	const char *sep;
+	char *name;
+	int ret;
+
+	sep = host ? strchr(host, ',') : NULL;
+	if (!sep)
+		return network_do_create_context(host, &opts);
+
+	ret = network_parse_socket_opts(sep + 1, &opts);
+	if (ret < 0) {
+		IIO_ERROR("Invalid socket options: %s\n", sep + 1);
+		errno = -ret;
+		return NULL;
+	}
+
+	name = iio_strdup(host);
+	if (!name) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	name[sep - host] = '\0';
+
+	if (opts.pool)
+		ctx = network_pool_create_context(host, name, &opts);
+	else
+		ctx = network_do_create_context(name, &opts);
+	free(name);
+	return ctx;
+}
+
+struct iio_context * network_create_shm_context(const char *opts)
+{
 	struct iio_context *ctx;
+	char *host;
+	size_t len;
+
+	len = sizeof("localhost,shm=1,") + strlen(opts);
+	host = malloc(len);
+	if (!host) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* The options given after "shm:" override the default */
+	iio_snprintf(host, len, "localhost,shm=1%s%s", opts[0] ? "," : "", opts);
+
+	ctx = network_create_context(host);
+	free(host);
+	return ctx;
+}
+
+/* Connects to the server, and creates the data of a context; on success,
+ * the addrinfo is owned by the returned pdata */
+static struct iio_context_pdata * network_connect(struct addrinfo *res,
+		const struct network_socket_opts *opts)
+{
 	struct iio_context_pdata *pdata;
-	size_t i, len, uri_len;
 	int fd, ret;
+
+	fd = create_socket(res, DEFAULT_TIMEOUT_MS);
+	if (fd < 0) {
+		ret = fd;
+		goto err_set_errno;
+	}
+
+	pdata = zalloc(sizeof(*pdata));
+	if (!pdata) {
+		ret = -ENOMEM;
+		goto err_close_socket;
+	}
+
+	pdata->io_ctx.fd = fd;
+	pdata->addrinfo = res;
+	pdata->io_ctx.timeout_ms = DEFAULT_TIMEOUT_MS;
+	pdata->sock_opts = *opts;
+	network_set_socket_opts(&pdata->io_ctx, opts);
+
+	pdata->lock = iio_mutex_create();
+	if (!pdata->lock) {
+		ret = -ENOMEM;
+		goto err_free_pdata;
+	}
+
+	pdata->iiod_client = iiod_client_new(pdata, pdata->lock,
+			&network_iiod_client_ops);
+	if (!pdata->iiod_client) {
+		ret = -errno;
+		goto err_destroy_mutex;
+	}
+
+	/* Older servers reject the command, and the session stays in text
+	 * mode */
+	if (!iiod_client_enable_binary(pdata->iiod_client, &pdata->io_ctx))
+		IIO_DEBUG("Using the binary protocol\n");
+
+	return pdata;
+
+err_destroy_mutex:
+	iio_mutex_destroy(pdata->lock);
+err_free_pdata:
+	free(pdata);
+err_close_socket:
+	close(fd);
+err_set_errno:
+	errno = -ret;
+	return NULL;
+}
+
+/* Undoes network_connect(), before the pdata is attached to a context */
+static void network_disconnect(struct iio_context_pdata *pdata)
+{
+	int err = errno;
+
+	iiod_client_destroy(pdata->iiod_client);
+	iio_mutex_destroy(pdata->lock);
+	close(pdata->io_ctx.fd);
+	freeaddrinfo(pdata->addrinfo);
+	free(pdata);
+	errno = err;
+}
+
+static int network_init_devices(struct iio_context *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nb_devices; i++) {
+		struct iio_device *dev = ctx->devices[i];
+
+		dev->pdata = zalloc(sizeof(*dev->pdata));
+		if (!dev->pdata)
+			return -ENOMEM;
+
+		dev->pdata->io_ctx.fd = -1;
+		dev->pdata->io_ctx.timeout_ms = DEFAULT_TIMEOUT_MS;
+#ifdef WITH_NETWORK_GET_BUFFER
+		dev->pdata->memfd = -1;
+		dev->pdata->pipefd[0] = -1;
+		dev->pdata->pipefd[1] = -1;
+#endif
+
+		dev->pdata->lock = iio_mutex_create();
+		if (!dev->pdata->lock)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static struct iio_context * network_do_create_context(const char *host,
+		const struct network_socket_opts *opts)
+{
+	struct addrinfo hints, *res;
+	struct iio_context *ctx;
+	struct iio_context_pdata *pdata;
+	size_t len, uri_len;
 	char *description, *uri;
+	int ret;
 #ifdef _WIN32
 	WSADATA wsaData;
 
@@ -1349,44 +2815,24 @@ struct iio_context * network_create_context(const char *host)
 		return NULL;
 	}
 
-	fd = create_socket(res, DEFAULT_TIMEOUT_MS);
-	if (fd < 0) {
-		errno = -fd;
-		goto err_free_addrinfo;
-	}
-
-	pdata = zalloc(sizeof(*pdata));
+	pdata = network_connect(res, opts);
 	if (!pdata) {
-		errno = ENOMEM;
-		goto err_close_socket;
-	}
-
-	pdata->io_ctx.fd = fd;
-	pdata->addrinfo = res;
-	pdata->io_ctx.timeout_ms = DEFAULT_TIMEOUT_MS;
-
-	pdata->lock = iio_mutex_create();
-	if (!pdata->lock) {
-		errno = ENOMEM;
-		goto err_free_pdata;
+		freeaddrinfo(res);
+		return NULL;
 	}
 
-	pdata->iiod_client = iiod_client_new(pdata, pdata->lock,
-			&network_iiod_client_ops);
-
-	pdata->msg_trunc_supported = msg_trunc_supported(&pdata->io_ctx);
-	if (pdata->msg_trunc_supported)
-		IIO_DEBUG("MSG_TRUNC is supported\n");
-	else
-		IIO_DEBUG("MSG_TRUNC is NOT supported\n");
-
-	if (!pdata->iiod_client)
-		goto err_destroy_mutex;
-
 	IIO_DEBUG("Creating context...\n");
 	ctx = iiod_client_create_context(pdata->iiod_client, &pdata->io_ctx);
-	if (!ctx)
-		goto err_destroy_iiod_client;
+	if (!ctx) {
+		network_disconnect(pdata);
+		return NULL;
+	}
+
+	/* With the binary protocol, the requests of concurrent threads are
+	 * multiplexed over the context socket, and the responses routed to
+	 * them by tag */
+	if (!iiod_client_enable_mux(pdata->iiod_client, &pdata->io_ctx))
+		IIO_DEBUG("Multiplexing the requests\n");
 
 	/* Override the name and low-level functions of the XML context
 	 * with those corresponding to the network context */
@@ -1462,46 +2908,31 @@ struct iio_context * network_create_context(const char *host)
 	if (ret < 0)
 		goto err_free_description;
 
-	for (i = 0; i < ctx->nb_devices; i++) {
-		struct iio_device *dev = ctx->devices[i];
-
-		dev->pdata = zalloc(sizeof(*dev->pdata));
-		if (!dev->pdata) {
-			ret = -ENOMEM;
-			goto err_free_description;
-		}
-
-		dev->pdata->io_ctx.fd = -1;
-		dev->pdata->io_ctx.timeout_ms = DEFAULT_TIMEOUT_MS;
-#ifdef WITH_NETWORK_GET_BUFFER
-		dev->pdata->memfd = -1;
-#endif
-
-		dev->pdata->lock = iio_mutex_create();
-		if (!dev->pdata->lock) {
-			ret = -ENOMEM;
-			goto err_free_description;
-		}
-	}
+	ret = network_init_devices(ctx);
+	if (ret < 0)
+		goto err_free_description;
 
 	if (ctx->description) {
-		size_t desc_len = strlen(description);
-		size_t new_size = desc_len + strlen(ctx->description) + 2;
-		char *ptr, *new_description = realloc(description, new_size);
+		size_t new_size = strlen(description) +
+			strlen(ctx->description) + 2;
+		char *new_description = iio_arena_alloc(ctx->arena, new_size);
 		if (!new_description) {
 			ret = -ENOMEM;
 			goto err_free_description;
 		}
 
-		ptr = strrchr(new_description, '\0');
-		iio_snprintf(ptr, new_size - desc_len, " %s", ctx->description);
-		free(ctx->description);
-
+		iio_snprintf(new_description, new_size, "%s %s",
+				description, ctx->description);
 		ctx->description = new_description;
 	} else {
-		ctx->description = description;
+		ctx->description = iio_arena_strdup(ctx->arena, description);
+		if (!ctx->description) {
+			ret = -ENOMEM;
+			goto err_free_description;
+		}
 	}
 
+	free(description);
 	free(uri);
 	iiod_client_set_timeout(pdata->iiod_client, &pdata->io_ctx,
 			calculate_remote_timeout(DEFAULT_TIMEOUT_MS));
@@ -1515,16 +2946,4 @@ err_network_shutdown:
 	iio_context_destroy(ctx);
 	errno = -ret;
 	return NULL;
-
-err_destroy_iiod_client:
-	iiod_client_destroy(pdata->iiod_client);
-err_destroy_mutex:
-	iio_mutex_destroy(pdata->lock);
-err_free_pdata:
-	free(pdata);
-err_close_socket:
-	close(fd);
-err_free_addrinfo:
-	freeaddrinfo(res);
-	return NULL;
 }
@@ -23,6 +23,7 @@
 #include "iio-config.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/types.h>
@@ -55,6 +56,7 @@
 #include <avahi-common/address.h>
 #include <avahi-common/error.h>
 #include <avahi-common/simple-watch.h>
+#include <avahi-common/thread-watch.h>
 #include <avahi-common/malloc.h>
 #include <avahi-client/client.h>
 #include <avahi-client/lookup.h>
@@ -115,6 +117,11 @@ void remove_dup_discovery_data(struct dns_sd_discovery_data **ddata);
 /* port knocks  */
 void port_knock_discovery_data(struct dns_sd_discovery_data **ddata);
 
+/* Connects to the IIOD server, and fills the URI and description of the
+ * context it provides */
+int dnssd_fill_context_info(struct iio_context_info *info,
+		char *hostname, char *addr_str, int port);
+
 #endif /* HAVE_DNS_SD */
 
 /* Used everywhere */
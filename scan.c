@@ -15,13 +15,24 @@
  * Lesser General Public License for more details.
  */
 
+#include "debug.h"
 #include "iio-config.h"
+#include "iio-lock.h"
 #include "iio-private.h"
 
 #include <errno.h>
 #include <stdbool.h>
 #include <string.h>
 
+/* The backends are scanned concurrently; their results are listed in this
+ * order */
+enum iio_scan_backend {
+	SCAN_LOCAL,
+	SCAN_USB,
+	SCAN_DNSSD,
+	NB_SCAN_BACKENDS,
+};
+
 struct iio_scan_context {
 #ifdef WITH_USB_BACKEND
 	struct iio_scan_backend_context *usb_ctx;
@@ -30,6 +41,36 @@ struct iio_scan_context {
 	struct iio_scan_backend_context *dnssd_ctx;
 #endif
 	bool scan_local;
+
+	/* Time given to the scans, or 0 to wait for all of them */
+	unsigned int timeout_ms;
+
+	/* Also held by the scans still running after a timeout, which use
+	 * the contexts of the backends */
+	struct iio_mutex *lock;
+	unsigned int refcount;
+};
+
+/* State of one call to iio_scan_context_get_info_list(), shared with the
+ * threads scanning the backends, which may outlive it */
+struct iio_scan_run {
+	struct iio_scan_context *ctx;
+	struct iio_mutex *lock;
+	struct iio_cond *cond;
+	unsigned int refcount, nb_pending;
+
+	/* Set once the results were collected; those of the scans ending
+	 * later are discarded */
+	bool closed;
+	int err;
+
+	struct iio_scan_result results[NB_SCAN_BACKENDS];
+};
+
+struct iio_scan_job {
+	struct iio_scan_run *run;
+	enum iio_scan_backend backend;
+	uint64_t deadline;
 };
 
 const char * iio_context_info_get_description(
@@ -44,43 +85,255 @@ const char * iio_context_info_get_uri(
 	return info->uri;
 }
 
-ssize_t iio_scan_context_get_info_list(struct iio_scan_context *ctx,
-		struct iio_context_info ***info)
+static void iio_scan_context_unref(struct iio_scan_context *ctx)
 {
-	struct iio_scan_result scan_result = { 0, NULL };
+	unsigned int refcount;
 
-#ifdef WITH_LOCAL_BACKEND
-	if (ctx->scan_local) {
-		int ret = local_context_scan(&scan_result);
-		if (ret < 0) {
-			if (scan_result.info)
-				iio_context_info_list_free(scan_result.info);
-			return ret;
-		}
-	}
+	iio_mutex_lock(ctx->lock);
+	refcount = --ctx->refcount;
+	iio_mutex_unlock(ctx->lock);
+
+	if (refcount)
+		return;
+
+#ifdef WITH_USB_BACKEND
+	if (ctx->usb_ctx)
+		usb_context_scan_free(ctx->usb_ctx);
 #endif
+#ifdef HAVE_DNS_SD
+	if (ctx->dnssd_ctx)
+		dnssd_context_scan_free(ctx->dnssd_ctx);
+#endif
+	iio_mutex_destroy(ctx->lock);
+	free(ctx);
+}
+
+static struct iio_scan_run * iio_scan_run_new(struct iio_scan_context *ctx)
+{
+	struct iio_scan_run *run = zalloc(sizeof(*run));
 
+	if (!run)
+		return NULL;
+
+	run->lock = iio_mutex_create();
+	if (!run->lock)
+		goto err_free_run;
+
+	run->cond = iio_cond_create();
+	if (!run->cond)
+		goto err_destroy_lock;
+
+	iio_mutex_lock(ctx->lock);
+	ctx->refcount++;
+	iio_mutex_unlock(ctx->lock);
+
+	run->ctx = ctx;
+	run->refcount = 1;
+	return run;
+
+err_destroy_lock:
+	iio_mutex_destroy(run->lock);
+err_free_run:
+	free(run);
+	return NULL;
+}
+
+static void iio_scan_run_unref(struct iio_scan_run *run)
+{
+	unsigned int i, refcount;
+
+	iio_mutex_lock(run->lock);
+	refcount = --run->refcount;
+	iio_mutex_unlock(run->lock);
+
+	if (refcount)
+		return;
+
+	for (i = 0; i < NB_SCAN_BACKENDS; i++)
+		iio_context_info_list_free(run->results[i].info);
+
+	iio_scan_context_unref(run->ctx);
+	iio_cond_destroy(run->cond);
+	iio_mutex_destroy(run->lock);
+	free(run);
+}
+
+static int iio_scan_backend(struct iio_scan_context *ctx,
+		enum iio_scan_backend backend,
+		struct iio_scan_result *scan_result, uint64_t deadline)
+{
+	switch (backend) {
+#ifdef WITH_LOCAL_BACKEND
+	case SCAN_LOCAL:
+		return local_context_scan(scan_result);
+#endif
 #ifdef WITH_USB_BACKEND
-	if (ctx->usb_ctx) {
-		int ret = usb_context_scan(ctx->usb_ctx, &scan_result);
+	case SCAN_USB:
+		return usb_context_scan(ctx->usb_ctx, scan_result);
+#endif
+#ifdef HAVE_DNS_SD
+	case SCAN_DNSSD:
+		return dnssd_context_scan(ctx->dnssd_ctx, scan_result, deadline);
+#endif
+	default:
+		return 0;
+	}
+}
+
+static int iio_scan_job_run(void *d)
+{
+	struct iio_scan_job *job = d;
+	struct iio_scan_run *run = job->run;
+	struct iio_scan_result scan_result = { 0, NULL };
+	int ret;
+
+	ret = iio_scan_backend(run->ctx, job->backend,
+			&scan_result, job->deadline);
+
+	iio_mutex_lock(run->lock);
+	if (!run->closed) {
 		if (ret < 0) {
-			if (scan_result.info)
-				iio_context_info_list_free(scan_result.info);
-			return ret;
+			if (!run->err)
+				run->err = ret;
+		} else {
+			run->results[job->backend] = scan_result;
+			scan_result.info = NULL;
 		}
 	}
-#endif
 
+	run->nb_pending--;
+	iio_cond_broadcast(run->cond);
+	iio_mutex_unlock(run->lock);
+
+	iio_context_info_list_free(scan_result.info);
+	iio_scan_run_unref(run);
+	free(job);
+	return ret;
+}
+
+static int iio_scan_run_start(struct iio_scan_run *run,
+		enum iio_scan_backend backend, uint64_t deadline)
+{
+	struct iio_scan_job *job = malloc(sizeof(*job));
+	struct iio_thrd *thrd;
+
+	if (!job)
+		return -ENOMEM;
+
+	job->run = run;
+	job->backend = backend;
+	job->deadline = deadline;
+
+	iio_mutex_lock(run->lock);
+	run->refcount++;
+	run->nb_pending++;
+	iio_mutex_unlock(run->lock);
+
+	thrd = iio_thrd_create(iio_scan_job_run, job, "iio_scan");
+	if (thrd)
+		iio_thrd_detach(thrd);
+	else /* Without support for threads, the backend is scanned now */
+		iio_scan_job_run(job);
+
+	return 0;
+}
+
+/* Appends the results of the backends, in their order, to scan_result */
+static int iio_scan_run_collect(struct iio_scan_run *run,
+		struct iio_scan_result *scan_result)
+{
+	struct iio_context_info **info;
+	size_t i, size = 0;
+
+	for (i = 0; i < NB_SCAN_BACKENDS; i++)
+		size += run->results[i].size;
+
+	info = zalloc((size + 1) * sizeof(*info));
+	if (!info)
+		return -ENOMEM;
+
+	scan_result->info = info;
+	scan_result->size = size;
+
+	for (i = 0; i < NB_SCAN_BACKENDS; i++) {
+		struct iio_scan_result *result = &run->results[i];
+
+		if (!result->info)
+			continue;
+
+		memcpy(info, result->info, /* Flawfinder: ignore */
+				result->size * sizeof(*info));
+		info += result->size;
+
+		free(result->info);
+		result->info = NULL;
+		result->size = 0;
+	}
+
+	return 0;
+}
+
+ssize_t iio_scan_context_get_info_list(struct iio_scan_context *ctx,
+		struct iio_context_info ***info)
+{
+	struct iio_scan_result scan_result = { 0, NULL };
+	struct iio_scan_run *run;
+	uint64_t deadline = 0, now;
+	int ret = 0;
+
+	run = iio_scan_run_new(ctx);
+	if (!run)
+		return -ENOMEM;
+
+	if (ctx->timeout_ms)
+		deadline = iio_get_monotonic_ns() +
+			(uint64_t) ctx->timeout_ms * 1000000ull;
+
+#ifdef WITH_LOCAL_BACKEND
+	if (ctx->scan_local)
+		ret = iio_scan_run_start(run, SCAN_LOCAL, deadline);
+#endif
+#ifdef WITH_USB_BACKEND
+	if (!ret && ctx->usb_ctx)
+		ret = iio_scan_run_start(run, SCAN_USB, deadline);
+#endif
 #ifdef HAVE_DNS_SD
-	if (ctx->dnssd_ctx) {
-		int ret = dnssd_context_scan(ctx->dnssd_ctx, &scan_result);
-		if (ret < 0) {
-			if (scan_result.info)
-				iio_context_info_list_free(scan_result.info);
-			return ret;
+	if (!ret && ctx->dnssd_ctx)
+		ret = iio_scan_run_start(run, SCAN_DNSSD, deadline);
+#endif
+
+	iio_mutex_lock(run->lock);
+
+	/* Past the deadline, the results of the scans done are returned */
+	while (!ret && run->nb_pending) {
+		if (!deadline) {
+			iio_cond_wait(run->cond, run->lock);
+			continue;
 		}
+
+		now = iio_get_monotonic_ns();
+		if (now >= deadline)
+			break;
+
+		iio_cond_wait_timeout(run->cond, run->lock,
+				(unsigned int) ((deadline - now + 999999) / 1000000));
 	}
-#endif
+
+	if (run->nb_pending)
+		IIO_DEBUG("Scan timed out, %u backend(s) still scanning\n",
+				run->nb_pending);
+
+	run->closed = true;
+	if (!ret)
+		ret = run->err;
+	if (!ret)
+		ret = iio_scan_run_collect(run, &scan_result);
+
+	iio_mutex_unlock(run->lock);
+	iio_scan_run_unref(run);
+
+	if (ret < 0)
+		return ret;
 
 	*info = scan_result.info;
 
@@ -153,6 +406,15 @@ struct iio_scan_context * iio_create_scan_context(
 		return NULL;
 	}
 
+	ctx->lock = iio_mutex_create();
+	if (!ctx->lock) {
+		free(ctx);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ctx->refcount = 1;
+
 	if (!backend || strstr(backend, "local"))
 		ctx->scan_local = true;
 
@@ -170,15 +432,14 @@ struct iio_scan_context * iio_create_scan_context(
 
 void iio_scan_context_destroy(struct iio_scan_context *ctx)
 {
-#ifdef WITH_USB_BACKEND
-	if (ctx->usb_ctx)
-		usb_context_scan_free(ctx->usb_ctx);
-#endif
-#ifdef HAVE_DNS_SD
-	if (ctx->dnssd_ctx)
-		dnssd_context_scan_free(ctx->dnssd_ctx);
-#endif
-	free(ctx);
+	/* The backends are freed once the scans still running are over */
+	iio_scan_context_unref(ctx);
+}
+
+void iio_scan_context_set_timeout(struct iio_scan_context *ctx,
+		unsigned int timeout_ms)
+{
+	ctx->timeout_ms = timeout_ms;
 }
 
 struct iio_scan_block {
@@ -231,3 +492,331 @@ void iio_scan_block_destroy(struct iio_scan_block *blk)
 	iio_scan_context_destroy(blk->ctx);
 	free(blk);
 }
+
+/* Interval between the scans of the backends not notifying the changes */
+#define SCAN_MONITOR_POLL_MS 2000
+
+struct iio_scan_monitor_entry {
+	const void *owner;
+	struct iio_context_info info;
+
+	/* A watch may report the same context several times, e.g. when it
+	 * is reachable from several network interfaces */
+	unsigned int count;
+	bool seen;
+
+	struct iio_scan_monitor_entry *next;
+};
+
+struct iio_scan_monitor {
+	void (*cb)(const struct iio_context_info *info,
+			enum iio_scan_event event, void *d);
+	void *d;
+
+	/* Protects the entries, and serializes the callbacks */
+	struct iio_mutex *lock;
+	struct iio_scan_monitor_entry *entries;
+
+#ifdef WITH_USB_BACKEND
+	struct iio_scan_backend_watch *usb_watch;
+#endif
+#ifdef HAVE_DNS_SD
+	struct iio_scan_backend_watch *dnssd_watch;
+#endif
+
+	/* Scans the other backends periodically, until stopped */
+	struct iio_scan_context *poll_ctx;
+	struct iio_thrd *poll_thrd;
+	struct iio_cond *poll_cond;
+	bool stop;
+};
+
+static struct iio_scan_monitor_entry * iio_scan_monitor_find(
+		struct iio_scan_monitor *mon, const void *owner,
+		const char *uri)
+{
+	struct iio_scan_monitor_entry *entry;
+
+	for (entry = mon->entries; entry; entry = entry->next)
+		if (entry->owner == owner && !strcmp(entry->info.uri, uri))
+			return entry;
+
+	return NULL;
+}
+
+static void iio_scan_monitor_free_entry(struct iio_scan_monitor_entry *entry)
+{
+	free(entry->info.description);
+	free(entry->info.uri);
+	free(entry);
+}
+
+static int iio_scan_monitor_add_unlocked(struct iio_scan_monitor *mon,
+		const void *owner, const char *uri, const char *description)
+{
+	struct iio_scan_monitor_entry *entry;
+
+	entry = iio_scan_monitor_find(mon, owner, uri);
+	if (entry) {
+		entry->count++;
+		entry->seen = true;
+		return 0;
+	}
+
+	entry = zalloc(sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	entry->info.uri = iio_strdup(uri);
+	entry->info.description = iio_strdup(description);
+	if (!entry->info.uri || !entry->info.description) {
+		iio_scan_monitor_free_entry(entry);
+		return -ENOMEM;
+	}
+
+	entry->owner = owner;
+	entry->count = 1;
+	entry->seen = true;
+	entry->next = mon->entries;
+	mon->entries = entry;
+
+	mon->cb(&entry->info, IIO_SCAN_CONTEXT_ADDED, mon->d);
+	return 0;
+}
+
+static void iio_scan_monitor_remove_entry(struct iio_scan_monitor *mon,
+		struct iio_scan_monitor_entry *entry)
+{
+	struct iio_scan_monitor_entry **it;
+
+	for (it = &mon->entries; *it != entry; it = &(*it)->next);
+	*it = entry->next;
+
+	mon->cb(&entry->info, IIO_SCAN_CONTEXT_REMOVED, mon->d);
+	iio_scan_monitor_free_entry(entry);
+}
+
+int iio_scan_monitor_add(struct iio_scan_monitor *mon, const void *owner,
+		const char *uri, const char *description)
+{
+	int ret;
+
+	iio_mutex_lock(mon->lock);
+	ret = iio_scan_monitor_add_unlocked(mon, owner, uri, description);
+	iio_mutex_unlock(mon->lock);
+
+	return ret;
+}
+
+void iio_scan_monitor_remove(struct iio_scan_monitor *mon, const void *owner,
+		const char *uri)
+{
+	struct iio_scan_monitor_entry *entry;
+
+	iio_mutex_lock(mon->lock);
+
+	entry = iio_scan_monitor_find(mon, owner, uri);
+	if (entry && !--entry->count)
+		iio_scan_monitor_remove_entry(mon, entry);
+
+	iio_mutex_unlock(mon->lock);
+}
+
+/* Reports the differences between the results of a scan, and the contexts
+ * found by the previous one */
+static void iio_scan_monitor_sync(struct iio_scan_monitor *mon,
+		struct iio_context_info **info, size_t nb)
+{
+	struct iio_scan_monitor_entry *entry, *next;
+	size_t i;
+
+	iio_mutex_lock(mon->lock);
+
+	for (entry = mon->entries; entry; entry = entry->next)
+		if (entry->owner == mon->poll_ctx)
+			entry->seen = false;
+
+	for (i = 0; i < nb; i++) {
+		entry = iio_scan_monitor_find(mon, mon->poll_ctx, info[i]->uri);
+		if (entry)
+			entry->seen = true;
+		else if (iio_scan_monitor_add_unlocked(mon, mon->poll_ctx,
+					info[i]->uri, info[i]->description))
+			IIO_ERROR("Unable to add context %s\n",
+					info[i]->uri);
+	}
+
+	for (entry = mon->entries; entry; entry = next) {
+		next = entry->next;
+
+		if (entry->owner == mon->poll_ctx && !entry->seen)
+			iio_scan_monitor_remove_entry(mon, entry);
+	}
+
+	iio_mutex_unlock(mon->lock);
+}
+
+static int iio_scan_monitor_poll(void *d)
+{
+	struct iio_scan_monitor *mon = d;
+	struct iio_context_info **info;
+	ssize_t ret;
+
+	iio_mutex_lock(mon->lock);
+
+	while (!mon->stop) {
+		iio_mutex_unlock(mon->lock);
+
+		ret = iio_scan_context_get_info_list(mon->poll_ctx, &info);
+		if (ret < 0) {
+			IIO_DEBUG("Scan failed: %zd\n", ret);
+		} else {
+			iio_scan_monitor_sync(mon, info, (size_t) ret);
+			iio_context_info_list_free(info);
+		}
+
+		iio_mutex_lock(mon->lock);
+
+		if (!mon->stop)
+			iio_cond_wait_timeout(mon->poll_cond, mon->lock,
+					SCAN_MONITOR_POLL_MS);
+	}
+
+	iio_mutex_unlock(mon->lock);
+	return 0;
+}
+
+static void iio_scan_monitor_stop(struct iio_scan_monitor *mon)
+{
+	if (mon->poll_thrd) {
+		iio_mutex_lock(mon->lock);
+		mon->stop = true;
+		iio_cond_broadcast(mon->poll_cond);
+		iio_mutex_unlock(mon->lock);
+
+		iio_thrd_join_and_destroy(mon->poll_thrd);
+		mon->poll_thrd = NULL;
+	}
+
+#ifdef WITH_USB_BACKEND
+	if (mon->usb_watch)
+		usb_context_watch_stop(mon->usb_watch);
+	mon->usb_watch = NULL;
+#endif
+#ifdef HAVE_DNS_SD
+	if (mon->dnssd_watch)
+		dnssd_context_watch_stop(mon->dnssd_watch);
+	mon->dnssd_watch = NULL;
+#endif
+}
+
+struct iio_scan_monitor * iio_create_scan_monitor(
+		const char *backend, unsigned int flags,
+		void (*cb)(const struct iio_context_info *info,
+			enum iio_scan_event event, void *d),
+		void *d)
+{
+	struct iio_scan_monitor *mon;
+	char poll_backends[sizeof("local:usb:ip:")] = "";
+	int ret = -ENOMEM;
+
+	/* "flags" must be zero for now */
+	if (flags != 0 || !cb) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	mon = zalloc(sizeof(*mon));
+	if (!mon) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	mon->cb = cb;
+	mon->d = d;
+
+	mon->lock = iio_mutex_create();
+	if (!mon->lock)
+		goto err_free_mon;
+
+	mon->poll_cond = iio_cond_create();
+	if (!mon->poll_cond)
+		goto err_destroy_lock;
+
+	if (!backend || strstr(backend, "local"))
+		iio_strlcpy(poll_backends, "local:", sizeof(poll_backends));
+
+#ifdef WITH_USB_BACKEND
+	if (!backend || strstr(backend, "usb")) {
+		mon->usb_watch = usb_context_watch_start(mon);
+		if (!mon->usb_watch) {
+			IIO_DEBUG("Scanning the USB devices periodically\n");
+			strcat(poll_backends, "usb:"); /* Flawfinder: ignore */
+		}
+	}
+#endif
+#ifdef HAVE_DNS_SD
+	if (!backend || strstr(backend, "ip")) {
+		mon->dnssd_watch = dnssd_context_watch_start(mon);
+		if (!mon->dnssd_watch) {
+			IIO_DEBUG("Scanning the network periodically\n");
+			strcat(poll_backends, "ip:"); /* Flawfinder: ignore */
+		}
+	}
+#endif
+
+	if (poll_backends[0]) {
+		mon->poll_ctx = iio_create_scan_context(poll_backends, 0);
+		if (!mon->poll_ctx) {
+			ret = -errno;
+			goto err_stop_monitor;
+		}
+
+		mon->poll_thrd = iio_thrd_create(iio_scan_monitor_poll,
+				mon, "iio_scan_monitor");
+		if (!mon->poll_thrd) {
+			ret = -errno;
+			goto err_destroy_poll_ctx;
+		}
+	}
+
+	return mon;
+
+err_destroy_poll_ctx:
+	iio_scan_context_destroy(mon->poll_ctx);
+err_stop_monitor:
+	iio_scan_monitor_stop(mon);
+	iio_cond_destroy(mon->poll_cond);
+err_destroy_lock:
+	iio_mutex_destroy(mon->lock);
+err_free_mon:
+	while (mon->entries) {
+		struct iio_scan_monitor_entry *entry = mon->entries;
+
+		mon->entries = entry->next;
+		iio_scan_monitor_free_entry(entry);
+	}
+	free(mon);
+	errno = -ret;
+	return NULL;
+}
+
+void iio_scan_monitor_destroy(struct iio_scan_monitor *mon)
+{
+	struct iio_scan_monitor_entry *entry;
+
+	iio_scan_monitor_stop(mon);
+
+	if (mon->poll_ctx)
+		iio_scan_context_destroy(mon->poll_ctx);
+
+	while (mon->entries) {
+		entry = mon->entries;
+		mon->entries = entry->next;
+		iio_scan_monitor_free_entry(entry);
+	}
+
+	iio_cond_destroy(mon->poll_cond);
+	iio_mutex_destroy(mon->lock);
+	free(mon);
+}
@@ -16,6 +16,7 @@
  *
  * */
 
+#include "arena.h"
 #include "debug.h"
 #include "iio-private.h"
 #include "iio-lock.h"
@@ -34,6 +35,7 @@ struct iio_context_pdata {
 	struct sp_port *port;
 	struct iio_mutex *lock;
 	struct iiod_client *iiod_client;
+	struct iiod_client_link link;
 
 	unsigned int timeout_ms;
 };
@@ -157,6 +159,22 @@ out_unlock:
 	return ret;
 }
 
+static int serial_reconfigure(const struct iio_device *dev,
+		size_t samples_count)
+{
+	const struct iio_context *ctx = iio_device_get_context(dev);
+	struct iio_context_pdata *ctx_pdata = ctx->pdata;
+	struct iio_device_pdata *pdata = dev->pdata;
+	int ret = -EBADF;
+
+	iio_mutex_lock(ctx_pdata->lock);
+	if (pdata->opened)
+		ret = iiod_client_reopen_unlocked(ctx_pdata->iiod_client, NULL,
+				dev, samples_count);
+	iio_mutex_unlock(ctx_pdata->lock);
+	return ret;
+}
+
 static ssize_t serial_read(const struct iio_device *dev, void *dst, size_t len,
 		uint32_t *mask, size_t words)
 {
@@ -228,6 +246,60 @@ static ssize_t serial_write_chn_attr(const struct iio_channel *chn,
 			dev, chn, attr, src, len, false);
 }
 
+static int serial_set_attr_cache(const struct iio_context *ctx,
+		const char *attr, int ttl_ms)
+{
+	return iiod_client_set_attr_cache(ctx->pdata->iiod_client, attr, ttl_ms);
+}
+
+static void serial_invalidate_attr_cache(const struct iio_context *ctx)
+{
+	iiod_client_invalidate_attr_cache(ctx->pdata->iiod_client);
+}
+
+static int serial_get_attr_cache_stats(const struct iio_context *ctx,
+		struct iio_attr_cache_stats *stats)
+{
+	iiod_client_get_attr_cache_stats(ctx->pdata->iiod_client, stats);
+	return 0;
+}
+
+static int serial_read_attrs(const struct iio_context *ctx,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs)
+{
+	struct iio_context_pdata *pdata = ctx->pdata;
+
+	return iiod_client_read_attrs(pdata->iiod_client, NULL,
+			reqs, nb_reqs);
+}
+
+static int serial_write_attrs(const struct iio_context *ctx,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs)
+{
+	struct iio_context_pdata *pdata = ctx->pdata;
+
+	return iiod_client_write_attrs(pdata->iiod_client, NULL,
+			reqs, nb_reqs);
+}
+
+static int serial_read_regs(const struct iio_device *dev,
+		const uint32_t *addrs, uint32_t *values, unsigned int nb)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_read_regs(pdata->iiod_client, NULL,
+			dev, addrs, values, nb);
+}
+
+static int serial_write_regs(const struct iio_device *dev,
+		const uint32_t *addrs, const uint32_t *values, unsigned int nb)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_write_regs(pdata->iiod_client, NULL,
+			dev, addrs, values, nb);
+}
+
 static int serial_set_kernel_buffers_count(const struct iio_device *dev,
 		unsigned int nb_blocks)
 {
@@ -244,51 +316,32 @@ static ssize_t serial_write_data(struct iio_context_pdata *pdata,
 	ssize_t ret = (ssize_t) libserialport_to_errno(sp_blocking_write(
 				pdata->port, data, len, pdata->timeout_ms));
 
-	IIO_DEBUG("Write returned %li: %s\n", (long) ret, data);
+	IIO_DEBUG("Write returned %li: %.*s\n", (long) ret, (int) len, data);
 	return ret;
 }
 
+/* Returns as soon as some data was received, with all the data available;
+ * the iiod_client reads the responses through the receive buffer of the
+ * link, so that the lines are not read one byte at a time */
 static ssize_t serial_read_data(struct iio_context_pdata *pdata,
 		void *io_data, char *buf, size_t len)
 {
 	ssize_t ret = (ssize_t) libserialport_to_errno(sp_blocking_read_next(
 				pdata->port, buf, len, pdata->timeout_ms));
 
-	IIO_DEBUG("Read returned %li: %.*s\n", (long) ret, (int) ret, buf);
+	if (ret == 0)
+		return -ETIMEDOUT;
+
+	if (ret > 0)
+		IIO_DEBUG("Read returned %li: %.*s\n",
+				(long) ret, (int) ret, buf);
 	return ret;
 }
 
-static ssize_t serial_read_line(struct iio_context_pdata *pdata,
-		void *io_data, char *buf, size_t len)
+static struct iiod_client_link * serial_get_link(
+		struct iio_context_pdata *pdata, void *io_data)
 {
-	size_t i;
-	bool found = false;
-	int ret;
-
-	IIO_DEBUG("Readline size 0x%lx\n", (unsigned long) len);
-
-	for (i = 0; i < len - 1; i++) {
-		ret = libserialport_to_errno(sp_blocking_read_next(
-					pdata->port, &buf[i], 1,
-					pdata->timeout_ms));
-		if (ret < 0) {
-			IIO_ERROR("sp_blocking_read_next returned %i\n", ret);
-			return (ssize_t) ret;
-		}
-
-		IIO_DEBUG("Character: %c\n", buf[i]);
-
-		if (buf[i] != '\n')
-			found = true;
-		else if (found)
-			break;
-	}
-
-	/* No \n found? Just garbage data */
-	if (!found || i == len - 1)
-		return -EIO;
-
-	return (ssize_t) i + 1;
+	return &pdata->link;
 }
 
 static void serial_shutdown(struct iio_context *ctx)
@@ -321,12 +374,20 @@ static const struct iio_backend_ops serial_ops = {
 	.get_version = serial_get_version,
 	.open = serial_open,
 	.close = serial_close,
+	.reconfigure = serial_reconfigure,
 	.read = serial_read,
 	.write = serial_write,
 	.read_device_attr = serial_read_dev_attr,
 	.write_device_attr = serial_write_dev_attr,
 	.read_channel_attr = serial_read_chn_attr,
 	.write_channel_attr = serial_write_chn_attr,
+	.read_attrs = serial_read_attrs,
+	.set_attr_cache = serial_set_attr_cache,
+	.invalidate_attr_cache = serial_invalidate_attr_cache,
+	.get_attr_cache_stats = serial_get_attr_cache_stats,
+	.write_attrs = serial_write_attrs,
+	.read_regs = serial_read_regs,
+	.write_regs = serial_write_regs,
 	.set_kernel_buffers_count = serial_set_kernel_buffers_count,
 	.shutdown = serial_shutdown,
 	.set_timeout = serial_set_timeout,
@@ -335,7 +396,7 @@ static const struct iio_backend_ops serial_ops = {
 static const struct iiod_client_ops serial_iiod_client_ops = {
 	.write = serial_write_data,
 	.read = serial_read_data,
-	.read_line = serial_read_line,
+	.get_link = serial_get_link,
 };
 
 static int apply_settings(struct sp_port *port, unsigned int baud_rate,
@@ -436,6 +497,16 @@ static struct iio_context * serial_create_context(const char *port_name,
 	if (!pdata->iiod_client)
 		goto err_destroy_mutex;
 
+	/* Older firmwares reject the commands, and the session stays in text
+	 * mode; with the binary protocol, the frames carry a CRC so that
+	 * corrupted responses are detected */
+	if (!iiod_client_enable_binary(pdata->iiod_client, NULL)) {
+		IIO_DEBUG("Using the binary protocol\n");
+
+		if (!iiod_client_enable_crc(pdata->iiod_client, NULL))
+			IIO_DEBUG("Using CRC-protected frames\n");
+	}
+
 	ctx = iiod_client_create_context(pdata->iiod_client, NULL);
 	if (!ctx)
 		goto err_destroy_iiod_client;
@@ -443,7 +514,13 @@ static struct iio_context * serial_create_context(const char *port_name,
 	ctx->name = "serial";
 	ctx->ops = &serial_ops;
 	ctx->pdata = pdata;
-	ctx->description = description;
+
+	ctx->description = iio_arena_strdup(ctx->arena, description);
+	free(description);
+	if (!ctx->description) {
+		ret = -ENOMEM;
+		goto err_context_destroy;
+	}
 
 	for (i = 0; i < iio_context_get_devices_count(ctx); i++) {
 		struct iio_device *dev = iio_context_get_device(ctx, i);
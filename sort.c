@@ -16,7 +16,12 @@
  *
  * */
 
+#include "arena.h"
 #include "iio-private.h"
+#include "sort.h"
+
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* These are a few functions to do sorting via qsort for various
@@ -91,3 +96,91 @@ int iio_buffer_attr_compare(const void *p1, const void *p2)
 	return strcmp(tmp1, tmp2);
 }
 
+
+/* The entries of an index are sorted by group and key, and then by position,
+ * so that the first entry matching a key is the first element matching it
+ * in the table, like a linear search would return */
+static int iio_index_compare(const void *p1, const void *p2)
+{
+	const struct iio_index_entry *e1 = p1, *e2 = p2;
+	int ret;
+
+	if (e1->group != e2->group)
+		return e1->group < e2->group ? -1 : 1;
+
+	ret = strcmp(e1->key, e2->key);
+	if (ret)
+		return ret;
+
+	return e1->pos < e2->pos ? -1 : e1->pos > e2->pos;
+}
+
+int iio_index_init(struct iio_index *idx, struct iio_arena *arena,
+		unsigned int max)
+{
+	idx->nb = 0;
+	idx->entries = NULL;
+
+	if (!max)
+		return 0;
+
+	idx->entries = iio_arena_alloc(arena, max * sizeof(*idx->entries));
+	if (!idx->entries)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void iio_index_add(struct iio_index *idx, const char *key,
+		unsigned int group, unsigned int pos)
+{
+	struct iio_index_entry *entry;
+
+	if (!key)
+		return;
+
+	entry = &idx->entries[idx->nb++];
+	entry->key = key;
+	entry->group = group;
+	entry->pos = pos;
+}
+
+void iio_index_sort(struct iio_index *idx)
+{
+	if (idx->nb > 1)
+		qsort(idx->entries, idx->nb, sizeof(*idx->entries),
+				iio_index_compare);
+}
+
+int iio_index_find(const struct iio_index *idx,
+		unsigned int group, const char *key)
+{
+	const struct iio_index_entry *entry;
+	unsigned int low = 0, high = idx->nb, mid;
+	int ret;
+
+	/* Lowest entry not lower than the key */
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		entry = &idx->entries[mid];
+
+		if (entry->group != group)
+			ret = entry->group < group ? -1 : 1;
+		else
+			ret = strcmp(entry->key, key);
+
+		if (ret < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == idx->nb)
+		return -1;
+
+	entry = &idx->entries[low];
+	if (entry->group != group || strcmp(entry->key, key))
+		return -1;
+
+	return (int) entry->pos;
+}
@@ -25,4 +25,18 @@ int iio_device_compare(const void *p1, const void *p2);
 int iio_device_attr_compare(const void *p1, const void *p2);
 int iio_buffer_attr_compare(const void *p1, const void *p2);
 
+struct iio_arena;
+struct iio_index;
+
+/* The index is filled with up to max entries with iio_index_add(), then
+ * sorted. Lookups return the lowest position whose key matches, or -1.
+ * The entries are allocated from the arena of the context. */
+int iio_index_init(struct iio_index *idx, struct iio_arena *arena,
+		unsigned int max);
+void iio_index_add(struct iio_index *idx, const char *key,
+		unsigned int group, unsigned int pos);
+void iio_index_sort(struct iio_index *idx);
+int iio_index_find(const struct iio_index *idx,
+		unsigned int group, const char *key);
+
 #endif /* __IIO_QSORT_H__ */
@@ -0,0 +1,198 @@
+/*
+ * libiio - Library for interfacing industrial I/O (IIO) devices
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include "iio-lock.h"
+#include "iio-private.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The statistics of all the devices of a context are stored in one array,
+ * allocated the first time they are enabled and kept until the context is
+ * destroyed. Each operation is recorded under the lock of the context: the
+ * operations timed take from microseconds to milliseconds, next to which an
+ * uncontended lock is negligible.
+ */
+
+static const char * const iio_stats_op_names[] = {
+	[IIO_STATS_REFILL] = "refill",
+	[IIO_STATS_PUSH] = "push",
+	[IIO_STATS_GET_BUFFER] = "get_buffer",
+	[IIO_STATS_ATTR_READ] = "attr_read",
+	[IIO_STATS_ATTR_WRITE] = "attr_write",
+	[IIO_STATS_WAIT] = "wait",
+	[IIO_STATS_ENQUEUE] = "enqueue",
+	[IIO_STATS_DEQUEUE] = "dequeue",
+	[IIO_STATS_RECV] = "recv",
+	[IIO_STATS_SEND] = "send",
+};
+
+const char * iio_stats_op_get_name(enum iio_stats_op op)
+{
+	if ((unsigned int) op >= ARRAY_SIZE(iio_stats_op_names))
+		return NULL;
+
+	return iio_stats_op_names[op];
+}
+
+int iio_context_enable_stats(struct iio_context *ctx, bool enable)
+{
+	struct iio_stats *stats;
+	unsigned int i;
+
+	if (ctx->stats || !enable) {
+		ctx->stats_enabled = enable && ctx->stats;
+		return 0;
+	}
+
+	ctx->stats_lock = iio_mutex_create();
+	if (!ctx->stats_lock)
+		return -ENOMEM;
+
+	/* At least one device, so that the context has an array */
+	stats = calloc((size_t) (ctx->nb_devices + 1) * IIO_STATS_NB_OPS,
+			sizeof(*stats));
+	if (!stats) {
+		iio_mutex_destroy(ctx->stats_lock);
+		ctx->stats_lock = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < ctx->nb_devices; i++)
+		ctx->devices[i]->stats = &stats[i * IIO_STATS_NB_OPS];
+
+	ctx->stats = stats;
+	ctx->stats_enabled = true;
+	return 0;
+}
+
+void iio_context_reset_stats(struct iio_context *ctx)
+{
+	if (!ctx->stats)
+		return;
+
+	iio_mutex_lock(ctx->stats_lock);
+	memset(ctx->stats, 0, (size_t) ctx->nb_devices * IIO_STATS_NB_OPS *
+			sizeof(*ctx->stats));
+	iio_mutex_unlock(ctx->stats_lock);
+}
+
+void iio_stats_free(struct iio_context *ctx)
+{
+	if (ctx->stats) {
+		iio_mutex_destroy(ctx->stats_lock);
+		free(ctx->stats);
+	}
+}
+
+uint64_t iio_stats_start(const struct iio_device *dev)
+{
+	if (!dev->ctx->stats_enabled || !dev->stats)
+		return 0;
+
+	return iio_get_monotonic_ns();
+}
+
+void iio_stats_end(const struct iio_device *dev, enum iio_stats_op op,
+		uint64_t start, ssize_t ret)
+{
+	uint64_t us, ns, now;
+	struct iio_stats *stats;
+	unsigned int bucket;
+
+	if (!start)
+		return;
+
+	now = iio_get_monotonic_ns();
+	ns = now > start ? now - start : 0;
+
+	for (bucket = 0, us = ns / 2000; us && bucket < IIO_STATS_NB_BUCKETS - 1;
+			us >>= 1)
+		bucket++;
+
+	stats = &dev->stats[op];
+
+	iio_mutex_lock(dev->ctx->stats_lock);
+
+	stats->count++;
+	if (ret < 0)
+		stats->errors++;
+	else
+		stats->bytes += (uint64_t) ret;
+
+	stats->total_ns += ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+
+	stats->histogram[bucket]++;
+
+	iio_mutex_unlock(dev->ctx->stats_lock);
+}
+
+static void iio_stats_add(struct iio_stats *dst, const struct iio_stats *src)
+{
+	unsigned int i;
+
+	dst->count += src->count;
+	dst->errors += src->errors;
+	dst->bytes += src->bytes;
+	dst->total_ns += src->total_ns;
+	if (src->max_ns > dst->max_ns)
+		dst->max_ns = src->max_ns;
+
+	for (i = 0; i < IIO_STATS_NB_BUCKETS; i++)
+		dst->histogram[i] += src->histogram[i];
+}
+
+int iio_device_get_stats(const struct iio_device *dev,
+		enum iio_stats_op op, struct iio_stats *stats)
+{
+	if ((unsigned int) op >= IIO_STATS_NB_OPS)
+		return -EINVAL;
+
+	if (!dev->stats)
+		return -ENODATA;
+
+	iio_mutex_lock(dev->ctx->stats_lock);
+	*stats = dev->stats[op];
+	iio_mutex_unlock(dev->ctx->stats_lock);
+
+	return 0;
+}
+
+int iio_context_get_stats(const struct iio_context *ctx,
+		enum iio_stats_op op, struct iio_stats *stats)
+{
+	unsigned int i;
+
+	if ((unsigned int) op >= IIO_STATS_NB_OPS)
+		return -EINVAL;
+
+	if (!ctx->stats)
+		return -ENODATA;
+
+	memset(stats, 0, sizeof(*stats));
+
+	iio_mutex_lock(ctx->stats_lock);
+	for (i = 0; i < ctx->nb_devices; i++)
+		iio_stats_add(stats, &ctx->devices[i]->stats[op]);
+	iio_mutex_unlock(ctx->stats_lock);
+
+	return 0;
+}
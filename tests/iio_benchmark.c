@@ -0,0 +1,727 @@
+/*
+ * iio_benchmark - Part of libIIO utilities
+ *
+ * Copyright (C) 2020 Analog Devices, Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ * */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <iio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "iio_common.h"
+
+#define MY_NAME "iio_benchmark"
+
+#ifdef _MSC_BUILD
+#define iio_snprintf sprintf_s
+#else
+#define iio_snprintf snprintf
+#endif
+
+#define MAX_LIST_ITEMS 16
+
+/*
+ * Every result is printed on its own line as a JSON object, so that the
+ * output of two releases can be compared by a script. The fields common to
+ * all the results are "bench" (the name of the benchmark) and the
+ * distribution of the measured times: "min_ns", "median_ns", "p99_ns",
+ * "max_ns" and "mean_ns".
+ */
+
+enum benchmark {
+	BENCH_CONVERT,
+	BENCH_REFILL,
+	BENCH_ATTR,
+	BENCH_CONTEXT,
+	BENCH_NB,
+};
+
+static const char * const benchmark_names[] = {
+	"convert", "refill", "attr", "context",
+};
+
+/* Formats of the synthetic channels used by the conversion benchmark */
+static const char * const convert_formats[] = {
+	"le:s8/8>>0",
+	"le:s12/16>>4",
+	"be:s16/16>>0",
+	"le:u24/32>>8",
+	"be:s32/32>>0",
+	"le:s64/64>>0",
+};
+
+#define NB_CONVERT_FORMATS \
+	(sizeof(convert_formats) / sizeof(convert_formats[0]))
+
+static const struct option options[] = {
+	{"device", required_argument, 0, 'd'},
+	{"buffer-size", required_argument, 0, 'b'},
+	{"kernel-buffers", required_argument, 0, 'k'},
+	{"iterations", required_argument, 0, 'i'},
+	{"samples", required_argument, 0, 's'},
+	{0, 0, 0, 0},
+};
+
+static const char *options_descriptions[] = {
+	"[-d <device>] [-b <sizes>] [-k <counts>] [-i <iterations>] "
+		"[-s <samples>] [convert|refill|attr|context ...]",
+	"Device used by the refill and attr benchmarks."
+		"\n\t\t\tDefault is the first device with scan elements.",
+	"Comma-separated list of buffer sizes, in samples."
+		"\n\t\t\tDefault is 256,4096,65536.",
+	"Comma-separated list of kernel buffers counts."
+		"\n\t\t\tDefault is 4.",
+	"Number of iterations of each measurement. Default is 100.",
+	"Number of samples converted per iteration by the convert"
+		"\n\t\t\tbenchmark. Default is 65536.",
+};
+
+static uint64_t get_time_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+
+	return (uint64_t) ((double) count.QuadPart * 1e9 /
+			(double) freq.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t v1 = *(const uint64_t *) a, v2 = *(const uint64_t *) b;
+
+	return (v1 > v2) - (v1 < v2);
+}
+
+/* Sorts the times, and prints their distribution and the closing brace of
+ * the JSON object of the result */
+static void print_distribution(uint64_t *times, unsigned int nb)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	qsort(times, nb, sizeof(*times), compare_u64);
+
+	for (i = 0; i < nb; i++)
+		sum += times[i];
+
+	printf("\"iterations\": %u, \"min_ns\": %" PRIu64
+			", \"median_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+			", \"max_ns\": %" PRIu64 ", \"mean_ns\": %" PRIu64 "}\n",
+			nb, times[0], times[nb / 2], times[nb * 99 / 100],
+			times[nb - 1], sum / nb);
+	fflush(stdout);
+}
+
+static double per_second(uint64_t count, uint64_t ns)
+{
+	return ns ? (double) count * 1e9 / (double) ns : 0.0;
+}
+
+static void print_error(const char *bench, const char *what, int err)
+{
+	char buf[256];
+
+	iio_strerror(err, buf, sizeof(buf));
+	fprintf(stderr, "%s: %s: %s\n", bench, what, buf);
+}
+
+static unsigned int parse_list(const char *name, const char *arg,
+		unsigned int *values, uint64_t min, uint64_t max)
+{
+	char *str = cmn_strndup(arg, NAME_MAX), *ptr, *next;
+	unsigned int nb = 0;
+
+	if (!str) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (ptr = str; ptr && nb < MAX_LIST_ITEMS; ptr = next) {
+		next = strchr(ptr, ',');
+		if (next)
+			*next++ = '\0';
+
+		values[nb++] = (unsigned int) sanitize_clamp(name, ptr, min, max);
+	}
+
+	free(str);
+	return nb;
+}
+
+/* Fills the synthetic samples with a pattern the conversions cannot
+ * short-circuit */
+static void fill_pattern(uint8_t *buf, size_t len)
+{
+	uint32_t seed = 0x12345678;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t) (seed >> 16);
+	}
+}
+
+static struct iio_context * create_convert_context(void)
+{
+	char xml[4096];
+	size_t len;
+	unsigned int i;
+
+	len = iio_snprintf(xml, sizeof(xml), "<?xml version=\"1.0\" "
+			"encoding=\"utf-8\"?><!DOCTYPE context ["
+			"<!ELEMENT context (device)*>"
+			"<!ELEMENT device (channel)*>"
+			"<!ELEMENT channel (scan-element?)>"
+			"<!ELEMENT scan-element EMPTY>"
+			"<!ATTLIST context name CDATA #REQUIRED>"
+			"<!ATTLIST device id CDATA #REQUIRED name CDATA #IMPLIED>"
+			"<!ATTLIST channel id CDATA #REQUIRED "
+				"type (input|output) #REQUIRED>"
+			"<!ATTLIST scan-element index CDATA #REQUIRED "
+				"format CDATA #REQUIRED>"
+			"]><context name=\"xml\">"
+			"<device id=\"iio:device0\" name=\"benchmark\">");
+
+	for (i = 0; i < NB_CONVERT_FORMATS; i++) {
+		len += iio_snprintf(xml + len, sizeof(xml) - len,
+				"<channel id=\"voltage%u\" type=\"input\">"
+				"<scan-element index=\"%u\" format=\"%s\" />"
+				"</channel>", i, i, convert_formats[i]);
+	}
+
+	len += iio_snprintf(xml + len, sizeof(xml) - len,
+			"</device></context>");
+
+	return iio_create_xml_context_mem(xml, len);
+}
+
+static int bench_convert(unsigned int iterations, unsigned int nb_samples)
+{
+	struct iio_context *ctx;
+	struct iio_device *dev;
+	const struct iio_channel *chn;
+	size_t sizes[NB_CONVERT_FORMATS], offsets[NB_CONVERT_FORMATS];
+	size_t frame_size = 0, max_size = 1;
+	uint8_t *src, *dst, *frames;
+	uint64_t *times, start;
+	unsigned int i, j, k;
+	int ret = 0;
+
+	ctx = create_convert_context();
+	if (!ctx) {
+		print_error("convert", "Unable to create the synthetic context",
+				errno);
+		return -errno;
+	}
+
+	dev = iio_context_get_device(ctx, 0);
+
+	/* Layout of the interleaved frames, aligned like the kernel does */
+	for (i = 0; i < NB_CONVERT_FORMATS; i++) {
+		chn = iio_device_get_channel(dev, i);
+		sizes[i] = iio_channel_get_data_format(chn)->length / 8;
+
+		frame_size = (frame_size + sizes[i] - 1) / sizes[i] * sizes[i];
+		offsets[i] = frame_size;
+		frame_size += sizes[i];
+
+		if (sizes[i] > max_size)
+			max_size = sizes[i];
+	}
+
+	frame_size = (frame_size + max_size - 1) / max_size * max_size;
+
+	src = xmalloc((size_t) nb_samples * max_size, MY_NAME);
+	dst = xmalloc((size_t) nb_samples * max_size, MY_NAME);
+	frames = xmalloc((size_t) nb_samples * frame_size, MY_NAME);
+	times = xmalloc(iterations * sizeof(*times), MY_NAME);
+
+	fill_pattern(src, (size_t) nb_samples * max_size);
+	fill_pattern(frames, (size_t) nb_samples * frame_size);
+
+	for (i = 0; i < NB_CONVERT_FORMATS; i++) {
+		chn = iio_device_get_channel(dev, i);
+
+		/* One sample at a time */
+		for (j = 0; j < iterations; j++) {
+			start = get_time_ns();
+
+			for (k = 0; k < nb_samples; k++)
+				iio_channel_convert(chn, dst + k * sizes[i],
+						src + k * sizes[i]);
+
+			times[j] = get_time_ns() - start;
+		}
+
+		printf("{\"bench\": \"convert\", \"mode\": \"single\", "
+				"\"format\": \"%s\", \"samples\": %u, ",
+				convert_formats[i], nb_samples);
+		print_distribution(times, iterations);
+
+		/* Contiguous runs of samples */
+		for (j = 0; j < iterations; j++) {
+			start = get_time_ns();
+			iio_channel_convert_n(chn, dst, src, sizes[i],
+					nb_samples);
+			times[j] = get_time_ns() - start;
+		}
+
+		printf("{\"bench\": \"convert\", \"mode\": \"run\", "
+				"\"format\": \"%s\", \"samples\": %u, ",
+				convert_formats[i], nb_samples);
+		print_distribution(times, iterations);
+
+		for (j = 0; j < iterations; j++) {
+			start = get_time_ns();
+			iio_channel_convert_inverse_n(chn, dst, src, sizes[i],
+					nb_samples);
+			times[j] = get_time_ns() - start;
+		}
+
+		printf("{\"bench\": \"convert\", \"mode\": \"inverse\", "
+				"\"format\": \"%s\", \"samples\": %u, ",
+				convert_formats[i], nb_samples);
+		print_distribution(times, iterations);
+	}
+
+	/* Demultiplexing of interleaved frames holding all the formats, as
+	 * iio_buffer_deinterleave() does it */
+	for (j = 0; j < iterations; j++) {
+		start = get_time_ns();
+
+		for (i = 0; i < NB_CONVERT_FORMATS; i++) {
+			chn = iio_device_get_channel(dev, i);
+			iio_channel_convert_n(chn, dst, frames + offsets[i],
+					frame_size, nb_samples);
+		}
+
+		times[j] = get_time_ns() - start;
+	}
+
+	printf("{\"bench\": \"convert\", \"mode\": \"demux\", "
+			"\"channels\": %u, \"frame_size\": %zu, "
+			"\"samples\": %u, ", (unsigned int) NB_CONVERT_FORMATS,
+			frame_size, nb_samples);
+	print_distribution(times, iterations);
+
+	free(times);
+	free(frames);
+	free(dst);
+	free(src);
+	iio_context_destroy(ctx);
+	return ret;
+}
+
+static struct iio_device * find_buffer_device(struct iio_context *ctx,
+		const char *name)
+{
+	unsigned int i, j;
+
+	if (name)
+		return iio_context_find_device(ctx, name);
+
+	for (i = 0; i < iio_context_get_devices_count(ctx); i++) {
+		struct iio_device *dev = iio_context_get_device(ctx, i);
+
+		for (j = 0; j < iio_device_get_channels_count(dev); j++) {
+			if (iio_channel_is_scan_element(
+					iio_device_get_channel(dev, j)))
+				return dev;
+		}
+	}
+
+	return NULL;
+}
+
+/* Enables all the scan elements of the device, inputs if there is any,
+ * outputs otherwise. Returns true if the device is an output device. */
+static bool enable_scan_elements(struct iio_device *dev)
+{
+	unsigned int i, nb = iio_device_get_channels_count(dev);
+	bool output = true;
+
+	for (i = 0; i < nb; i++) {
+		struct iio_channel *chn = iio_device_get_channel(dev, i);
+
+		if (iio_channel_is_scan_element(chn) &&
+				!iio_channel_is_output(chn))
+			output = false;
+	}
+
+	for (i = 0; i < nb; i++) {
+		struct iio_channel *chn = iio_device_get_channel(dev, i);
+
+		if (iio_channel_is_scan_element(chn) &&
+				iio_channel_is_output(chn) == output)
+			iio_channel_enable(chn);
+	}
+
+	return output;
+}
+
+static int bench_buffer(struct iio_device *dev, bool output,
+		unsigned int buffer_size, unsigned int kernel_buffers,
+		unsigned int iterations)
+{
+	const char *bench = output ? "push" : "refill";
+	struct iio_buffer *buf;
+	uint64_t *times, start, total = 0, bytes = 0;
+	unsigned int i;
+	ssize_t ret;
+	int err;
+
+	err = iio_device_set_kernel_buffers_count(dev, kernel_buffers);
+	if (err < 0 && err != -ENOSYS) {
+		print_error(bench, "Unable to set the kernel buffers count", -err);
+		return err;
+	}
+
+	buf = iio_device_create_buffer(dev, buffer_size, false);
+	if (!buf) {
+		err = -errno;
+		print_error(bench, "Unable to create buffer", errno);
+		return err;
+	}
+
+	times = xmalloc(iterations * sizeof(*times), MY_NAME);
+
+	/* The first transfer also starts the stream; don't measure it */
+	ret = output ? iio_buffer_push(buf) : iio_buffer_refill(buf);
+
+	for (i = 0; ret >= 0 && i < iterations; i++) {
+		start = get_time_ns();
+		ret = output ? iio_buffer_push(buf) : iio_buffer_refill(buf);
+		times[i] = get_time_ns() - start;
+
+		total += times[i];
+		bytes += ret;
+	}
+
+	if (ret < 0) {
+		print_error(bench, output ? "Unable to push buffer" :
+				"Unable to refill buffer", (int) -ret);
+		err = (int) ret;
+	} else {
+		printf("{\"bench\": \"%s\", \"device\": \"%s\", "
+				"\"buffer_size\": %u, \"kernel_buffers\": %u, "
+				"\"bytes_per_s\": %.0f, ", bench,
+				iio_device_get_id(dev), buffer_size,
+				kernel_buffers, per_second(bytes, total));
+		print_distribution(times, iterations);
+		err = 0;
+	}
+
+	free(times);
+	iio_buffer_destroy(buf);
+	return err;
+}
+
+static int bench_refill(struct iio_context *ctx, const char *name,
+		const unsigned int *sizes, unsigned int nb_sizes,
+		const unsigned int *counts, unsigned int nb_counts,
+		unsigned int iterations)
+{
+	struct iio_device *dev = find_buffer_device(ctx, name);
+	unsigned int i, j;
+	bool output;
+	int ret = 0;
+
+	if (!dev) {
+		print_error("refill", "No device to stream from", ENODEV);
+		return -ENODEV;
+	}
+
+	output = enable_scan_elements(dev);
+
+	for (i = 0; i < nb_counts; i++) {
+		for (j = 0; j < nb_sizes; j++) {
+			int err = bench_buffer(dev, output, sizes[j],
+					counts[i], iterations);
+			if (err < 0)
+				ret = err;
+		}
+	}
+
+	return ret;
+}
+
+static int bench_attr_one(const struct iio_device *dev,
+		const struct iio_channel *chn, const char *attr,
+		unsigned int iterations)
+{
+	uint64_t *times, start, total = 0;
+	char buf[BUF_SIZE];
+	unsigned int i;
+	ssize_t ret = 0;
+
+	times = xmalloc(iterations * sizeof(*times), MY_NAME);
+
+	for (i = 0; i < iterations; i++) {
+		start = get_time_ns();
+		if (chn)
+			ret = iio_channel_attr_read(chn, attr, buf, sizeof(buf));
+		else
+			ret = iio_device_attr_read(dev, attr, buf, sizeof(buf));
+		times[i] = get_time_ns() - start;
+
+		if (ret < 0)
+			break;
+
+		total += times[i];
+	}
+
+	if (ret < 0) {
+		print_error("attr", "Unable to read attribute", (int) -ret);
+	} else {
+		printf("{\"bench\": \"attr\", \"device\": \"%s\", "
+				"\"channel\": \"%s\", \"attr\": \"%s\", "
+				"\"ops_per_s\": %.0f, ", iio_device_get_id(dev),
+				chn ? iio_channel_get_id(chn) : "", attr,
+				per_second(iterations, total));
+		print_distribution(times, iterations);
+	}
+
+	free(times);
+	return ret < 0 ? (int) ret : 0;
+}
+
+/* Reads the first attribute of the device and of its first channel that has
+ * attributes; the first attribute is the one a client would read first, and
+ * reading it twice does not change the state of the hardware */
+static int bench_attr(struct iio_context *ctx, const char *name,
+		unsigned int iterations)
+{
+	struct iio_device *dev;
+	unsigned int i;
+	int ret = -ENOENT;
+
+	if (name)
+		dev = iio_context_find_device(ctx, name);
+	else
+		dev = iio_context_get_device(ctx, 0);
+	if (!dev) {
+		print_error("attr", "No device to read from", ENODEV);
+		return -ENODEV;
+	}
+
+	if (iio_device_get_attrs_count(dev)) {
+		ret = bench_attr_one(dev, NULL, iio_device_get_attr(dev, 0),
+				iterations);
+	}
+
+	for (i = 0; i < iio_device_get_channels_count(dev); i++) {
+		struct iio_channel *chn = iio_device_get_channel(dev, i);
+		int err;
+
+		if (!iio_channel_get_attrs_count(chn))
+			continue;
+
+		err = bench_attr_one(dev, chn, iio_channel_get_attr(chn, 0),
+				iterations);
+		if (ret == -ENOENT || err < 0)
+			ret = err;
+		break;
+	}
+
+	if (ret == -ENOENT)
+		print_error("attr", "No attribute to read", ENOENT);
+
+	return ret;
+}
+
+static int bench_context(struct iio_context *ctx, unsigned int iterations)
+{
+	const char *uri = iio_context_get_attr_value(ctx, "uri");
+	uint64_t *times, start;
+	unsigned int i;
+	int ret = 0;
+
+	if (!uri) {
+		print_error("context", "No URI to create the context from",
+				ENOENT);
+		return -ENOENT;
+	}
+
+	times = xmalloc(iterations * sizeof(*times), MY_NAME);
+
+	for (i = 0; i < iterations; i++) {
+		struct iio_context *new_ctx;
+
+		start = get_time_ns();
+		new_ctx = iio_create_context_from_uri(uri);
+		times[i] = get_time_ns() - start;
+
+		if (!new_ctx) {
+			ret = -errno;
+			print_error("context", "Unable to create context",
+					errno);
+			break;
+		}
+
+		iio_context_destroy(new_ctx);
+	}
+
+	if (!ret) {
+		printf("{\"bench\": \"context\", \"uri\": \"%s\", ", uri);
+		print_distribution(times, iterations);
+	}
+
+	free(times);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	char **argw;
+	struct iio_context *ctx;
+	struct option *opts;
+	unsigned int sizes[MAX_LIST_ITEMS] = { 256, 4096, 65536 };
+	unsigned int counts[MAX_LIST_ITEMS] = { 4 };
+	unsigned int nb_sizes = 3, nb_counts = 1;
+	unsigned int iterations = 100, nb_samples = 65536;
+	unsigned int major, minor, i, j;
+	bool run[BENCH_NB] = { false };
+	bool run_all = true;
+	const char *device = NULL;
+	char git_tag[8];
+	int c, ret = EXIT_SUCCESS;
+
+	argw = dup_argv(MY_NAME, argc, argv);
+
+	ctx = handle_common_opts(MY_NAME, argc, argw, "d:b:k:i:s:",
+			options, options_descriptions);
+	opts = add_common_options(options);
+	if (!opts) {
+		fprintf(stderr, "Failed to add common options\n");
+		return EXIT_FAILURE;
+	}
+	while ((c = getopt_long(argc, argw, "+" COMMON_OPTIONS "d:b:k:i:s:", /* Flawfinder: ignore */
+			opts, NULL)) != -1) {
+		switch (c) {
+		/* All these are handled in the common */
+		case 'h':
+		case 'n':
+		case 'x':
+		case 'u':
+		case 'T':
+			break;
+		case 'S':
+		case 'a':
+			if (!optarg && argc > optind && argv[optind] != NULL
+					&& argv[optind][0] != '-')
+				optind++;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'b':
+			nb_sizes = parse_list("buffer size", optarg, sizes,
+					1, UINT32_MAX);
+			break;
+		case 'k':
+			nb_counts = parse_list("kernel buffers count", optarg,
+					counts, 1, UINT32_MAX);
+			break;
+		case 'i':
+			iterations = (unsigned int) sanitize_clamp("iterations",
+					optarg, 1, UINT32_MAX);
+			break;
+		case 's':
+			nb_samples = (unsigned int) sanitize_clamp("samples",
+					optarg, 1, UINT32_MAX);
+			break;
+		case '?':
+			printf("Unknown argument '%c'\n", c);
+			return EXIT_FAILURE;
+		}
+	}
+	free(opts);
+
+	for (i = optind; i < (unsigned int) argc; i++) {
+		for (j = 0; j < BENCH_NB; j++) {
+			if (!strcmp(argw[i], benchmark_names[j]))
+				break;
+		}
+
+		if (j == BENCH_NB) {
+			fprintf(stderr, "Unknown benchmark '%s'\n", argw[i]);
+			usage(MY_NAME, options, options_descriptions);
+		}
+
+		run[j] = true;
+		run_all = false;
+	}
+
+	iio_library_get_version(&major, &minor, git_tag);
+	printf("{\"bench\": \"info\", \"version\": \"%u.%u\", "
+			"\"git_tag\": \"%s\", \"context\": \"%s\"}\n",
+			major, minor, git_tag,
+			ctx ? iio_context_get_name(ctx) : "");
+
+	if ((run_all || run[BENCH_CONVERT]) &&
+			bench_convert(iterations, nb_samples) < 0)
+		ret = EXIT_FAILURE;
+
+	/* The other benchmarks run against the context */
+	if (!ctx) {
+		if (!run_all && (run[BENCH_REFILL] || run[BENCH_ATTR] ||
+				run[BENCH_CONTEXT]))
+			ret = EXIT_FAILURE;
+		goto out_free_argw;
+	}
+
+	if ((run_all || run[BENCH_CONTEXT]) &&
+			bench_context(ctx, iterations) < 0)
+		ret = EXIT_FAILURE;
+
+	if ((run_all || run[BENCH_ATTR]) &&
+			bench_attr(ctx, device, iterations) < 0)
+		ret = EXIT_FAILURE;
+
+	if ((run_all || run[BENCH_REFILL]) &&
+			bench_refill(ctx, device, sizes, nb_sizes, counts,
+				nb_counts, iterations) < 0)
+		ret = EXIT_FAILURE;
+
+	iio_context_destroy(ctx);
+out_free_argw:
+	free_argw(argc, argw);
+	return ret;
+}
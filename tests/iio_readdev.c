@@ -19,6 +19,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  * */
 
+#if defined(__linux__) && !NO_THREADS
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define WITH_RECORD 1
+#endif
+
 #include <errno.h>
 #include <getopt.h>
 #include <iio.h>
@@ -27,6 +34,14 @@
 #include <string.h>
 #include <errno.h>
 
+#ifdef WITH_RECORD
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
 #include "iio_common.h"
 
 #define MY_NAME "iio_readdev"
@@ -34,21 +49,34 @@
 #define SAMPLES_PER_READ 256
 #define DEFAULT_FREQ_HZ  100
 
+#define DEFAULT_WRITERS  2
+#define MAX_WRITERS      16
+
 static const struct option options[] = {
 	  {"trigger", required_argument, 0, 't'},
 	  {"buffer-size", required_argument, 0, 'b'},
 	  {"samples", required_argument, 0, 's' },
 	  {"auto", no_argument, 0, 'a'},
+	  {"output", required_argument, 0, 'o'},
+	  {"rotate", required_argument, 0, 'r'},
+	  {"writers", required_argument, 0, 'w'},
 	  {0, 0, 0, 0},
 };
 
 static const char *options_descriptions[] = {
 	"[-t <trigger>] [-b <buffer-size>]"
-		"[-s <samples>] <iio_device> [<channel> ...]",
+		"[-s <samples>] [-o <prefix> [-r <MiB>] [-w <writers>]]"
+		" <iio_device> [<channel> ...]",
 	"Use the specified trigger.",
 	"Size of the capture buffer. Default is 256.",
 	"Number of samples to capture, 0 = infinite. Default is 0.",
 	"Scan for available contexts and if only one is available use it.",
+	"Record the blocks to the files <prefix>-NNNN.bin."
+		"\n\t\t\tThey are described by <prefix>.hdr and indexed"
+		"\n\t\t\tin <prefix>.idx",
+	"Maximum size of the files in MiB when recording."
+		"\n\t\t\t0 = single file. Default is 0.",
+	"Number of threads writing the files when recording. Default is 2.",
 };
 
 static struct iio_context *ctx;
@@ -172,6 +200,501 @@ static void setup_sig_handler(void)
 
 #endif
 
+#ifdef WITH_RECORD
+
+/*
+ * Recording mode: the blocks are copied into large chunks aligned for
+ * O_DIRECT, which a pool of threads writes to the files while the buffer is
+ * refilled. Copying costs much less than waiting for the disk. The offset
+ * of each chunk in its file is set when the chunk is taken, so the writers
+ * work in parallel with pwrite(). A new file is only started between two
+ * blocks, so that each file holds whole blocks and can be mapped alone.
+ */
+#define RECORD_CHUNK_SIZE (4 * 1024 * 1024)
+#define RECORD_ALIGN      4096
+
+struct record_file {
+	int fd;
+	bool direct;
+
+	/* The chunks not written yet, plus one while it is the current file */
+	unsigned int refs;
+
+	/* Length of the samples, set once the file is complete */
+	off_t size;
+};
+
+struct record_chunk {
+	char *data;
+	size_t len;
+	off_t offset;
+	struct record_file *file;
+};
+
+struct recorder {
+	const char *prefix;
+	off_t max_file_size;
+
+	pthread_t writers[MAX_WRITERS];
+	unsigned int nb_writers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	struct record_chunk *chunks;
+	unsigned int nb_chunks;
+
+	/* Chunks not in use (stack), and filled chunks waiting for a writer
+	 * (ring) */
+	unsigned int *free_list, nb_free;
+	unsigned int *queue, queue_head, nb_queued;
+
+	bool stop;
+	int err;
+
+	/* Only used by the main thread */
+	struct record_chunk *cur;
+	struct record_file *file;
+	off_t file_len;
+	unsigned int nb_files;
+	bool direct, header_done;
+	FILE *index;
+	uint64_t nb_bytes, nb_stalls;
+};
+
+/* Must be called with the lock held */
+static void record_file_put(struct recorder *rec, struct record_file *file)
+{
+	if (--file->refs)
+		return;
+
+	/* The last chunk of the file was padded for O_DIRECT */
+	if (file->direct && ftruncate(file->fd, file->size) < 0 && !rec->err)
+		rec->err = -errno;
+	if (close(file->fd) < 0 && !rec->err)
+		rec->err = -errno;
+	free(file);
+}
+
+static void * record_writer_thd(void *d)
+{
+	struct recorder *rec = d;
+	struct record_chunk *chunk;
+	size_t len, done;
+	ssize_t ret;
+	int err;
+
+	pthread_mutex_lock(&rec->lock);
+
+	while (true) {
+		while (!rec->nb_queued && !rec->stop)
+			pthread_cond_wait(&rec->cond, &rec->lock);
+		if (!rec->nb_queued)
+			break;
+
+		chunk = &rec->chunks[rec->queue[rec->queue_head]];
+		rec->queue_head = (rec->queue_head + 1) % rec->nb_chunks;
+		rec->nb_queued--;
+		pthread_mutex_unlock(&rec->lock);
+
+		len = chunk->len;
+		if (chunk->file->direct)
+			len = (len + RECORD_ALIGN - 1) & ~(size_t) (RECORD_ALIGN - 1);
+
+		for (err = 0, done = 0; done < len; done += (size_t) ret) {
+			ret = pwrite(chunk->file->fd, chunk->data + done,
+					len - done, chunk->offset + (off_t) done);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			if (ret <= 0) {
+				err = ret < 0 ? -errno : -EIO;
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&rec->lock);
+		if (err && !rec->err)
+			rec->err = err;
+		record_file_put(rec, chunk->file);
+		rec->free_list[rec->nb_free++] =
+			(unsigned int) (chunk - rec->chunks);
+		pthread_cond_broadcast(&rec->cond);
+	}
+
+	pthread_mutex_unlock(&rec->lock);
+	return NULL;
+}
+
+static int record_open_file(struct recorder *rec)
+{
+	int fd = -1, flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	struct record_file *file;
+	char name[1024];
+
+	snprintf(name, sizeof(name), "%s-%04u.bin", rec->prefix, rec->nb_files);
+
+	if (rec->direct) {
+		fd = open(name, flags | O_DIRECT, 0644);
+
+		/* Not all the file systems support O_DIRECT (e.g. tmpfs) */
+		if (fd < 0 && errno == EINVAL) {
+			fprintf(stderr, "O_DIRECT not supported, "
+					"using buffered writes\n");
+			rec->direct = false;
+		}
+	}
+	if (!rec->direct)
+		fd = open(name, flags, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to create %s: %s\n",
+				name, strerror(errno));
+		return -errno;
+	}
+
+	file = calloc(1, sizeof(*file));
+	if (!file) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	file->fd = fd;
+	file->direct = rec->direct;
+	file->refs = 1;
+	rec->file = file;
+	rec->file_len = 0;
+	rec->nb_files++;
+	return 0;
+}
+
+static void record_close_file(struct recorder *rec)
+{
+	if (!rec->file)
+		return;
+
+	pthread_mutex_lock(&rec->lock);
+	rec->file->size = rec->file_len;
+	record_file_put(rec, rec->file);
+	pthread_mutex_unlock(&rec->lock);
+	rec->file = NULL;
+}
+
+static int record_get_chunk(struct recorder *rec)
+{
+	struct record_chunk *chunk;
+	int ret;
+
+	if (!rec->file) {
+		ret = record_open_file(rec);
+		if (ret < 0)
+			return ret;
+	}
+
+	pthread_mutex_lock(&rec->lock);
+
+	/* The disk does not keep up: the next refill is delayed */
+	if (!rec->nb_free && !rec->err)
+		rec->nb_stalls++;
+	while (!rec->nb_free && !rec->err)
+		pthread_cond_wait(&rec->cond, &rec->lock);
+
+	ret = rec->err;
+	if (!ret) {
+		chunk = &rec->chunks[rec->free_list[--rec->nb_free]];
+		chunk->file = rec->file;
+		chunk->offset = rec->file_len;
+		chunk->len = 0;
+		rec->file->refs++;
+		rec->cur = chunk;
+	}
+
+	pthread_mutex_unlock(&rec->lock);
+	return ret;
+}
+
+static void record_queue_chunk(struct recorder *rec)
+{
+	struct record_chunk *chunk = rec->cur;
+	size_t pad = (RECORD_ALIGN - chunk->len % RECORD_ALIGN) % RECORD_ALIGN;
+
+	if (chunk->file->direct && pad)
+		memset(chunk->data + chunk->len, 0, pad);
+
+	pthread_mutex_lock(&rec->lock);
+	rec->queue[(rec->queue_head + rec->nb_queued) % rec->nb_chunks] =
+		(unsigned int) (chunk - rec->chunks);
+	rec->nb_queued++;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+
+	rec->cur = NULL;
+}
+
+/* Describes the layout of the samples, so that the files can be mapped and
+ * decoded later on */
+static int record_write_header(struct recorder *rec, struct iio_buffer *buf)
+{
+	const struct iio_device *dev = iio_buffer_get_device(buf);
+	unsigned int i, nb_channels = iio_device_get_channels_count(dev);
+	const char *name = iio_device_get_name(dev);
+	long long rate = 0;
+	char path[1024];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s.hdr", rec->prefix);
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Unable to create %s: %s\n",
+				path, strerror(errno));
+		return -errno;
+	}
+
+	if (iio_device_attr_read_longlong(dev, "sampling_frequency", &rate)) {
+		for (i = 0; i < nb_channels; i++) {
+			struct iio_channel *ch = iio_device_get_channel(dev, i);
+
+			if (iio_channel_is_enabled(ch) &&
+					!iio_channel_attr_read_longlong(ch,
+						"sampling_frequency", &rate))
+				break;
+		}
+	}
+
+	fprintf(f, "# " MY_NAME " capture\n");
+	fprintf(f, "device = %s\n", iio_device_get_id(dev));
+	if (name)
+		fprintf(f, "name = %s\n", name);
+	fprintf(f, "sample_size = %ld\n", (long) iio_buffer_step(buf));
+	fprintf(f, "sample_rate = %lld\n", rate);
+	fprintf(f, "files = %s-NNNN.bin\n", rec->prefix);
+	fprintf(f, "index = %s.idx\n", rec->prefix);
+
+	/* One line per channel: ID, offset in the sample, and format */
+	for (i = 0; i < nb_channels; i++) {
+		struct iio_channel *ch = iio_device_get_channel(dev, i);
+		const struct iio_data_format *format;
+		char sign, repeat[12] = "";
+
+		if (!iio_channel_is_enabled(ch))
+			continue;
+
+		format = iio_channel_get_data_format(ch);
+		sign = format->is_signed ? 's' : 'u';
+		if (format->is_fully_defined)
+			sign += 'A' - 'a';
+		if (format->repeat > 1)
+			snprintf(repeat, sizeof(repeat), "X%u", format->repeat);
+
+		fprintf(f, "channel = %s %ld %ce:%c%u/%u%s>>%u\n",
+				iio_channel_get_id(ch),
+				(long) ((intptr_t) iio_buffer_first(buf, ch) -
+					(intptr_t) iio_buffer_start(buf)),
+				format->is_be ? 'b' : 'l', sign, format->bits,
+				format->length, repeat, format->shift);
+	}
+
+	if (fclose(f))
+		return -errno;
+
+	rec->header_done = true;
+	return 0;
+}
+
+static int record_block(struct recorder *rec, struct iio_buffer *buf,
+		size_t len)
+{
+	const char *src = iio_buffer_start(buf);
+	struct iio_block_info info;
+	size_t nb;
+	int ret;
+
+	if (!len)
+		return 0;
+
+	if (!rec->header_done) {
+		ret = record_write_header(rec, buf);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (iio_buffer_get_block_info(buf, &info))
+		memset(&info, 0, sizeof(info));
+
+	/* Start a new file rather than splitting the block */
+	if (rec->max_file_size && rec->file && rec->file_len &&
+			rec->file_len + (off_t) len > rec->max_file_size) {
+		if (rec->cur)
+			record_queue_chunk(rec);
+		record_close_file(rec);
+	}
+
+	if (!rec->cur) {
+		ret = record_get_chunk(rec);
+		if (ret < 0)
+			return ret;
+	}
+
+	fprintf(rec->index, "%" PRIu64 " %" PRIu64 " %u %lld %lu\n",
+			info.sequence, info.timestamp, rec->nb_files - 1,
+			(long long) rec->file_len, (unsigned long) len);
+
+	while (len) {
+		if (!rec->cur) {
+			ret = record_get_chunk(rec);
+			if (ret < 0)
+				return ret;
+		}
+
+		nb = RECORD_CHUNK_SIZE - rec->cur->len;
+		if (nb > len)
+			nb = len;
+
+		memcpy(rec->cur->data + rec->cur->len, src, nb);
+		rec->cur->len += nb;
+		rec->file_len += (off_t) nb;
+		rec->nb_bytes += nb;
+		src += nb;
+		len -= nb;
+
+		if (rec->cur->len == RECORD_CHUNK_SIZE)
+			record_queue_chunk(rec);
+	}
+
+	return 0;
+}
+
+static void record_free(struct recorder *rec)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&rec->lock);
+	rec->stop = true;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+
+	for (i = 0; i < rec->nb_writers; i++)
+		pthread_join(rec->writers[i], NULL);
+
+	if (rec->index)
+		fclose(rec->index);
+
+	for (i = 0; i < rec->nb_chunks; i++)
+		free(rec->chunks[i].data);
+
+	pthread_cond_destroy(&rec->cond);
+	pthread_mutex_destroy(&rec->lock);
+	free(rec->queue);
+	free(rec->free_list);
+	free(rec->chunks);
+	free(rec);
+}
+
+static struct recorder * record_new(const char *prefix,
+		unsigned int max_mib, unsigned int nb_writers)
+{
+	struct recorder *rec;
+	char path[1024];
+	unsigned int i;
+	void *data;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return NULL;
+
+	rec->prefix = prefix;
+	rec->max_file_size = (off_t) max_mib << 20;
+	rec->direct = true;
+
+	pthread_mutex_init(&rec->lock, NULL);
+	pthread_cond_init(&rec->cond, NULL);
+
+	/* Double buffering: each writer can write one chunk while the next
+	 * one is ready, and one more is being filled */
+	rec->nb_chunks = 2 * nb_writers + 1;
+	rec->chunks = calloc(rec->nb_chunks, sizeof(*rec->chunks));
+	rec->free_list = calloc(rec->nb_chunks, sizeof(*rec->free_list));
+	rec->queue = calloc(rec->nb_chunks, sizeof(*rec->queue));
+	if (!rec->chunks || !rec->free_list || !rec->queue)
+		goto err_free;
+
+	for (i = 0; i < rec->nb_chunks; i++) {
+		if (posix_memalign(&data, RECORD_ALIGN, RECORD_CHUNK_SIZE))
+			goto err_free;
+
+		rec->chunks[i].data = data;
+		rec->free_list[rec->nb_free++] = i;
+	}
+
+	snprintf(path, sizeof(path), "%s.idx", prefix);
+	rec->index = fopen(path, "w");
+	if (!rec->index) {
+		fprintf(stderr, "Unable to create %s: %s\n",
+				path, strerror(errno));
+		goto err_free;
+	}
+
+	fprintf(rec->index, "# sequence timestamp_ns file offset bytes\n");
+
+	for (i = 0; i < nb_writers; i++) {
+		if (pthread_create(&rec->writers[i], NULL,
+					record_writer_thd, rec))
+			goto err_free;
+		rec->nb_writers++;
+	}
+
+	return rec;
+
+err_free:
+	record_free(rec);
+	return NULL;
+}
+
+/* Writes what is left and waits for the writers */
+static int record_finish(struct recorder *rec)
+{
+	char path[1024];
+	FILE *f;
+	int ret;
+
+	if (rec->cur)
+		record_queue_chunk(rec);
+	record_close_file(rec);
+
+	pthread_mutex_lock(&rec->lock);
+	rec->stop = true;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+
+	while (rec->nb_writers)
+		pthread_join(rec->writers[--rec->nb_writers], NULL);
+
+	ret = rec->err;
+	if (fclose(rec->index) && !ret)
+		ret = -errno;
+	rec->index = NULL;
+
+	if (rec->header_done) {
+		snprintf(path, sizeof(path), "%s.hdr", rec->prefix);
+		f = fopen(path, "a");
+		if (f) {
+			fprintf(f, "bytes = %" PRIu64 "\n", rec->nb_bytes);
+			fprintf(f, "nb_files = %u\n", rec->nb_files);
+			fprintf(f, "stalls = %" PRIu64 "\n", rec->nb_stalls);
+			fclose(f);
+		}
+	}
+
+	if (rec->nb_stalls)
+		fprintf(stderr, "The disk did not keep up %" PRIu64 " times\n",
+				rec->nb_stalls);
+
+	record_free(rec);
+	return ret;
+}
+
+#endif /* WITH_RECORD */
+
 static ssize_t print_sample(const struct iio_channel *chn,
 		void *buf, size_t len, void *d)
 {
@@ -186,13 +709,18 @@ static ssize_t print_sample(const struct iio_channel *chn,
 	return (ssize_t) len;
 }
 
-#define MY_OPTS "t:b:s:T:"
+#define MY_OPTS "t:b:s:T:o:r:w:"
 int main(int argc, char **argv)
 {
 	char **argw;
 	unsigned int i, nb_channels;
 	unsigned int nb_active_channels = 0;
 	unsigned int buffer_size = SAMPLES_PER_READ;
+	const char *record_prefix = NULL;
+	unsigned int record_mib = 0, nb_writers = DEFAULT_WRITERS;
+#ifdef WITH_RECORD
+	struct recorder *rec = NULL;
+#endif
 	int c;
 	struct iio_device *dev;
 	ssize_t sample_size;
@@ -245,6 +773,27 @@ int main(int argc, char **argv)
 			}
 			num_samples = sanitize_clamp("number of samples", optarg, 0, SIZE_MAX);
 			break;
+		case 'o':
+			if (!optarg) {
+				fprintf(stderr, "Output requires an argument\n");
+				return EXIT_FAILURE;
+			}
+			record_prefix = optarg;
+			break;
+		case 'r':
+			if (!optarg) {
+				fprintf(stderr, "File size requires an argument\n");
+				return EXIT_FAILURE;
+			}
+			record_mib = sanitize_clamp("file size", optarg, 0, 1024 * 1024);
+			break;
+		case 'w':
+			if (!optarg) {
+				fprintf(stderr, "Number of writers requires an argument\n");
+				return EXIT_FAILURE;
+			}
+			nb_writers = sanitize_clamp("number of writers", optarg, 1, MAX_WRITERS);
+			break;
 		case '?':
 			printf("Unknown argument '%c'\n", c);
 			return EXIT_FAILURE;
@@ -261,6 +810,16 @@ int main(int argc, char **argv)
 	if (!ctx)
 		return EXIT_FAILURE;
 
+#ifndef WITH_RECORD
+	(void) record_mib;
+	(void) nb_writers;
+	if (record_prefix) {
+		fprintf(stderr, "Recording is not supported on this platform\n");
+		iio_context_destroy(ctx);
+		return EXIT_FAILURE;
+	}
+#endif
+
 	setup_sig_handler();
 
 	dev = iio_context_find_device(ctx, argw[optind]);
@@ -365,6 +924,18 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+#ifdef WITH_RECORD
+	if (record_prefix) {
+		rec = record_new(record_prefix, record_mib, nb_writers);
+		if (!rec) {
+			fprintf(stderr, "Unable to start the recording\n");
+			iio_buffer_destroy(buffer);
+			iio_context_destroy(ctx);
+			return EXIT_FAILURE;
+		}
+	}
+#endif
+
 #ifdef _WIN32
 	/*
 	 * Deactivate the translation for the stdout. Otherwise, bytes that have
@@ -384,6 +955,35 @@ int main(int argc, char **argv)
 			break;
 		}
 
+#ifdef WITH_RECORD
+		/* The blocks are recorded as they are, with all the channels
+		 * described by the header */
+		if (rec) {
+			size_t step = (size_t) iio_buffer_step(buffer);
+			size_t len = (intptr_t) iio_buffer_end(buffer)
+				- (intptr_t) iio_buffer_start(buffer);
+
+			if (num_samples && len > num_samples * step)
+				len = num_samples * step;
+
+			ret = record_block(rec, buffer, len);
+			if (ret < 0) {
+				char buf[256];
+				iio_strerror(-(int)ret, buf, sizeof(buf));
+				fprintf(stderr, "Unable to record: %s\n", buf);
+				exit_code = EXIT_FAILURE;
+				break;
+			}
+
+			if (num_samples) {
+				num_samples -= len / step;
+				if (!num_samples)
+					quit_all(EXIT_SUCCESS);
+			}
+			continue;
+		}
+#endif
+
 		/* If there are only the samples we requested, we don't need to
 		 * demux */
 		if (iio_buffer_step(buffer) == sample_size) {
@@ -420,6 +1020,17 @@ int main(int argc, char **argv)
 	}
 
 err_destroy_buffer:
+#ifdef WITH_RECORD
+	if (rec) {
+		ret = record_finish(rec);
+		if (ret < 0) {
+			char buf[256];
+			iio_strerror(-(int)ret, buf, sizeof(buf));
+			fprintf(stderr, "Unable to write the files: %s\n", buf);
+			exit_code = EXIT_FAILURE;
+		}
+	}
+#endif
 	iio_buffer_destroy(buffer);
 	iio_context_destroy(ctx);
 	free_argw(argc, argw);
@@ -20,6 +20,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  * */
 
+#if defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define WITH_PLAYBACK 1
+#endif
+
 #include <errno.h>
 #include <getopt.h>
 #include <iio.h>
@@ -36,6 +43,15 @@
 #include <unistd.h>
 #endif
 
+#ifdef WITH_PLAYBACK
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
 #include "iio_common.h"
 
 #define MY_NAME "iio_writedev"
@@ -43,24 +59,36 @@
 #define SAMPLES_PER_READ 256
 #define DEFAULT_FREQ_HZ  100
 
+#define MAX_RATE         1000000000
+
 static const struct option options[] = {
 	  {"trigger", required_argument, 0, 't'},
 	  {"buffer-size", required_argument, 0, 'b'},
 	  {"samples", required_argument, 0, 's' },
 	  {"auto", no_argument, 0, 'a'},
 	  {"cyclic", no_argument, 0, 'c'},
+	  {"file", required_argument, 0, 'f'},
+	  {"loop", no_argument, 0, 'l'},
+	  {"rate", required_argument, 0, 'r'},
 	  {0, 0, 0, 0},
 };
 
 static const char *options_descriptions[] = {
 	"[-t <trigger>] "
 		"[-b <buffer-size>] [-s <samples>] "
+		"[-f <file> [-l] [-r <rate>]] "
 		"<iio_device> [<channel> ...]",
 	"Use the specified trigger.",
 	"Size of the transmit buffer. Default is 256.",
 	"Number of samples to write, 0 = infinite. Default is 0.",
 	"Scan for available contexts and if only one is available use it.",
 	"Use cyclic buffer mode.",
+	"Play the samples of the file instead of the standard input."
+		"\n\t\t\tWith -c, the buffer size defaults to the size"
+		"\n\t\t\tof the file",
+	"Play the file again from its start once its end is reached.",
+	"Pace the playback to the given number of samples per second."
+		"\n\t\t\t0 = as fast as the device takes them. Default is 0.",
 };
 
 static struct iio_context *ctx;
@@ -196,7 +224,169 @@ static ssize_t read_sample(const struct iio_channel *chn,
 	return (ssize_t) nb;
 }
 
-#define MY_OPTS "t:b:s:T:ac"
+#ifdef WITH_PLAYBACK
+
+/* Samples of the file played with -f, mapped in memory. Blocks are copied
+ * from the mapping straight into the buffer, which is then pushed. */
+struct playback {
+	const char *data;
+	size_t len, pos;
+	bool loop;
+
+	/* Samples per second, or 0; time at which the first block was pushed,
+	 * and number of samples pushed since */
+	unsigned long rate;
+	struct timespec start;
+	unsigned long long played;
+};
+
+static int playback_open(struct playback *pb, const char *path,
+		size_t sample_size)
+{
+	struct stat st;
+	void *data;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+		goto err_close;
+	}
+
+	/* Trailing bytes of an incomplete sample are not played */
+	pb->len = (size_t) st.st_size - (size_t) st.st_size % sample_size;
+	if (!pb->len) {
+		ret = -EINVAL;
+		goto err_close;
+	}
+
+	data = mmap(NULL, pb->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		ret = -errno;
+		goto err_close;
+	}
+
+	/* Have the kernel read ahead of the playback */
+	madvise(data, pb->len, MADV_SEQUENTIAL);
+
+	close(fd);
+	pb->data = data;
+	pb->pos = 0;
+	pb->played = 0;
+	return 0;
+
+err_close:
+	close(fd);
+	return ret;
+}
+
+static void playback_close(struct playback *pb)
+{
+	munmap((void *) pb->data, pb->len);
+}
+
+/* Copies up to len bytes of the file into dst, and returns the number of
+ * bytes copied; fewer once the end of the file is reached, unless looping */
+static size_t playback_fill(struct playback *pb, void *dst, size_t len)
+{
+	size_t copied = 0;
+
+	while (copied < len) {
+		size_t nb = pb->len - pb->pos;
+
+		if (!nb) {
+			if (!pb->loop)
+				break;
+			pb->pos = 0;
+			nb = pb->len;
+		}
+
+		if (nb > len - copied)
+			nb = len - copied;
+
+		memcpy((char *) dst + copied, pb->data + pb->pos, nb);
+		pb->pos += nb;
+		copied += nb;
+	}
+
+	return copied;
+}
+
+/* Waits until the samples pushed so far are due at the requested rate */
+static void playback_pace(struct playback *pb)
+{
+	struct timespec deadline = pb->start;
+	unsigned long long nsec;
+
+	if (!pb->rate)
+		return;
+
+	if (!pb->played) {
+		clock_gettime(CLOCK_MONOTONIC, &pb->start);
+		return;
+	}
+
+	deadline.tv_sec += (time_t) (pb->played / pb->rate);
+	nsec = (unsigned long long) deadline.tv_nsec +
+		(pb->played % pb->rate) * 1000000000ull / pb->rate;
+	deadline.tv_sec += (time_t) (nsec / 1000000000ull);
+	deadline.tv_nsec = (long) (nsec % 1000000000ull);
+
+	while (app_running && clock_nanosleep(CLOCK_MONOTONIC,
+				TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+static void playback_run(struct playback *pb, size_t sample_size,
+		bool cyclic)
+{
+	void *start = iio_buffer_start(buffer);
+	size_t len = (intptr_t) iio_buffer_end(buffer) - (intptr_t) start;
+	ssize_t ret;
+
+	while (app_running) {
+		size_t nb, max = len;
+
+		if (num_samples && max > num_samples * sample_size)
+			max = num_samples * sample_size;
+
+		nb = playback_fill(pb, start, max) / sample_size;
+		if (!nb)
+			break;
+
+		playback_pace(pb);
+
+		ret = iio_buffer_push_partial(buffer, nb);
+		if (ret < 0) {
+			if (app_running) {
+				char buf[256];
+				iio_strerror(-(int)ret, buf, sizeof(buf));
+				fprintf(stderr, "Unable to push buffer: %s\n", buf);
+			}
+			break;
+		}
+
+		/* The hardware repeats the waveform by itself */
+		if (cyclic) {
+			while (app_running)
+				sleep(1);
+			break;
+		}
+
+		pb->played += nb;
+		if (num_samples) {
+			num_samples -= nb;
+			if (!num_samples)
+				break;
+		}
+	}
+}
+
+#endif /* WITH_PLAYBACK */
+
+#define MY_OPTS "t:b:s:T:acf:lr:"
 
 int main(int argc, char **argv)
 {
@@ -207,7 +397,13 @@ int main(int argc, char **argv)
 	int c;
 	struct iio_device *dev;
 	ssize_t sample_size;
-	bool cyclic_buffer = false;
+	bool cyclic_buffer = false, buffer_size_set = false;
+	const char *file_name = NULL;
+	bool loop = false;
+	unsigned long rate = 0;
+#ifdef WITH_PLAYBACK
+	struct playback pb;
+#endif
 	ssize_t ret;
 	struct option *opts;
 
@@ -248,6 +444,7 @@ int main(int argc, char **argv)
 				return EXIT_FAILURE;
 			}
 			buffer_size = sanitize_clamp("buffer size", optarg, 64, 4 * 1024 * 1024);
+			buffer_size_set = true;
 			break;
 		case 's':
 			if (!optarg) {
@@ -259,6 +456,23 @@ int main(int argc, char **argv)
 		case 'c':
 			cyclic_buffer = true;
 			break;
+		case 'f':
+			if (!optarg) {
+				fprintf(stderr, "File requires argument\n");
+				return EXIT_FAILURE;
+			}
+			file_name = optarg;
+			break;
+		case 'l':
+			loop = true;
+			break;
+		case 'r':
+			if (!optarg) {
+				fprintf(stderr, "Rate requires argument\n");
+				return EXIT_FAILURE;
+			}
+			rate = sanitize_clamp("rate", optarg, 0, MAX_RATE);
+			break;
 		case '?':
 			printf("Unknown argument '%c'\n", c);
 			return EXIT_FAILURE;
@@ -275,6 +489,17 @@ int main(int argc, char **argv)
 	if (!ctx)
 		return EXIT_FAILURE;
 
+#ifndef WITH_PLAYBACK
+	(void) buffer_size_set;
+	(void) loop;
+	(void) rate;
+	if (file_name) {
+		fprintf(stderr, "File playback is not supported on this platform\n");
+		iio_context_destroy(ctx);
+		return EXIT_FAILURE;
+	}
+#endif
+
 	setup_sig_handler();
 
 	dev = iio_context_find_device(ctx, argw[optind]);
@@ -370,15 +595,66 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+#ifdef WITH_PLAYBACK
+	if (file_name) {
+		ret = playback_open(&pb, file_name, sample_size);
+		if (ret < 0) {
+			char buf[256];
+			iio_strerror(-(int)ret, buf, sizeof(buf));
+			fprintf(stderr, "Unable to map %s: %s\n", file_name, buf);
+			iio_context_destroy(ctx);
+			return EXIT_FAILURE;
+		}
+
+		pb.loop = loop;
+		pb.rate = rate;
+
+		/* In cyclic mode, the whole file is the waveform */
+		if (cyclic_buffer) {
+			size_t nb = pb.len / sample_size;
+
+			if (num_samples && nb > num_samples)
+				nb = num_samples;
+
+			if (!buffer_size_set && nb <= UINT_MAX)
+				buffer_size = (unsigned int) nb;
+			else if (nb > buffer_size)
+				fprintf(stderr, "Only the first %u samples of the "
+						"file are played\n", buffer_size);
+		}
+	}
+#endif
+
 	buffer = iio_device_create_buffer(dev, buffer_size, cyclic_buffer);
 	if (!buffer) {
 		char buf[256];
 		iio_strerror(errno, buf, sizeof(buf));
 		fprintf(stderr, "Unable to allocate buffer: %s\n", buf);
+#ifdef WITH_PLAYBACK
+		if (file_name)
+			playback_close(&pb);
+#endif
 		iio_context_destroy(ctx);
 		return EXIT_FAILURE;
 	}
 
+#ifdef WITH_PLAYBACK
+	if (file_name) {
+		/* The file holds the samples as laid out in the buffer */
+		if (iio_buffer_step(buffer) != sample_size) {
+			fprintf(stderr, "The buffer contains samples of channels "
+					"that were not enabled; unable to play "
+					"the file\n");
+			exit_code = EXIT_FAILURE;
+		} else {
+			playback_run(&pb, (size_t) sample_size, cyclic_buffer);
+		}
+
+		playback_close(&pb);
+		goto err_destroy_buffer;
+	}
+#endif
+
 #ifdef _WIN32
 	_setmode(_fileno( stdin ), _O_BINARY);
 #endif
@@ -18,14 +18,23 @@
 
 #include "iio-lock.h"
 #include "iio-private.h"
+#include "iio-trace.h"
 #include "iiod-client.h"
 
 #include <ctype.h>
 #include <errno.h>
 #include <libusb.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/usbdevice_fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
 #ifdef ERROR
 #undef ERROR
 #endif
@@ -39,17 +48,77 @@
 
 #define IIO_INTERFACE_NAME	"IIO"
 
+/* Largest URB submitted, see usb_sync_transfer() */
+#define USB_MAX_TRANSFER_SIZE	(1024 * 1024)
+
+/* Largest URB submitted when the host controller supports scatter-gather;
+ * usbfs then only needs to stay within its memory limit, which is 16 MiB
+ * for all the URBs in flight by default */
+#define USB_SG_MAX_TRANSFER_SIZE	(8 * 1024 * 1024)
+
+/* Default size of the transfers of the streaming mode */
+#define USB_STREAM_TRANSFER_SIZE	(256 * 1024)
+
+/* Upper limit of the number of transfers kept in flight per endpoint */
+#define USB_STREAM_MAX_TRANSFERS	64
+
+/* Upper limit of the number of endpoint couples a device's samples are
+ * striped over, as supported by iiod */
+#define USB_MAX_STRIPES	8
+
+/* libusb_dev_mem_alloc() appeared in libusb 1.0.21 */
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+#define HAS_LIBUSB_DEV_MEM 1
+#endif
+
+/* The hotplug notifications appeared in libusb 1.0.16 */
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+#define HAS_LIBUSB_HOTPLUG 1
+#endif
+
+/* Time the thread of a watch waits for events before checking if stopped */
+#define USB_WATCH_POLL_MS	200
+
+struct iio_usb_opts {
+	unsigned int nb_transfers;
+	size_t transfer_size;
+	unsigned int nb_stripes;
+};
+
+/* One transfer of the streaming mode, reused from one call to the next */
+struct iio_usb_transfer {
+	struct libusb_transfer *transfer;
+	struct iio_context_pdata *pdata;
+
+	/* Set by the completion callback, under the stream lock */
+	bool done;
+
+	/* Submitted and not completed yet, under the lock of the I/O context */
+	bool busy;
+};
+
 struct iio_usb_ep_couple {
 	unsigned char addr_in, addr_out;
 	uint16_t pipe_id;
 	bool in_use;
 
+	/* Size of the URBs of usb_sync_transfer(), lowered when usbfs is
+	 * unable to allocate them */
+	size_t max_transfer_size;
+
 	struct iio_mutex *lock;
+
+	/* Transfers of the streaming mode, or NULL if it is disabled */
+	struct iio_usb_transfer *xfers;
 };
 
 struct iio_usb_io_context {
 	struct iio_usb_ep_couple *ep;
 
+	/* Number of consecutive endpoint couples used, starting at ep; the
+	 * samples read are striped over them by iiod */
+	unsigned int nb_stripes;
+
 	struct iio_mutex *lock;
 	bool cancelled;
 	struct libusb_transfer *transfer;
@@ -68,12 +137,35 @@ struct iio_context_pdata {
 	/* Lock for endpoint reservation */
 	struct iio_mutex *ep_lock;
 
+	/* The context, whose "usb,max_transfer_size" attribute is updated
+	 * under attr_lock when the URBs are made smaller */
+	struct iio_context *ctx;
+	struct iio_mutex *attr_lock;
+
 	struct iio_usb_ep_couple *io_endpoints;
 	uint16_t nb_ep_couples;
 
 	unsigned int timeout_ms;
 
+	/* Size of the URBs of usb_sync_transfer(): the initial one, then the
+	 * smallest one the endpoints were lowered to */
+	size_t max_transfer_size;
+
 	struct iio_usb_io_context io_ctx;
+
+	/* Streaming mode: number of transfers kept in flight per endpoint
+	 * (1 if disabled) and size of each. Their completion is handled by
+	 * the events thread, which signals stream_cond. */
+	unsigned int nb_transfers;
+	size_t transfer_size;
+
+	/* Number of endpoint couples each device stripes its samples over */
+	unsigned int nb_stripes;
+
+	struct iio_thrd *events_thrd;
+	struct iio_mutex *stream_lock;
+	struct iio_cond *stream_cond;
+	bool stop_events;
 };
 
 struct iio_device_pdata {
@@ -81,6 +173,24 @@ struct iio_device_pdata {
 
 	bool opened;
 	struct iio_usb_io_context io_ctx;
+
+	/* Requests sent by usb_submit_buffer() not answered yet */
+	unsigned int nb_pending;
+	size_t pending_tx_len;
+	void *pending_tx_addr;
+
+	/* Zero-copy mode: blocks of dma_len bytes allocated by usbfs, and
+	 * index of the block handed out by usb_get_buffer() (or -1) */
+	struct iio_usb_dma_block *dma_blocks;
+	unsigned int nb_dma_blocks;
+	size_t dma_len;
+	int last_block;
+};
+
+/* Busy while it is owned by the application or being transferred */
+struct iio_usb_dma_block {
+	unsigned char *addr;
+	bool busy;
 };
 
 static const unsigned int libusb_to_errno_codes[] = {
@@ -221,41 +331,147 @@ static int usb_close_pipe(struct iio_context_pdata *pdata, uint16_t pipe_id)
 	return 0;
 }
 
-static int usb_reserve_ep_unlocked(const struct iio_device *dev)
+/* Reserves nb consecutive endpoint couples, or returns false */
+static bool usb_reserve_eps(const struct iio_device *dev, unsigned int nb)
 {
 	struct iio_context_pdata *pdata = dev->ctx->pdata;
-	unsigned int i;
+	unsigned int i, j;
 
-	for (i = 0; i < pdata->nb_ep_couples; i++) {
+	for (i = 0; i + nb <= pdata->nb_ep_couples; i++) {
 		struct iio_usb_ep_couple *ep = &pdata->io_endpoints[i];
 
-		if (!ep->in_use) {
-			ep->in_use = true;
+		for (j = 0; j < nb && !ep[j].in_use; j++);
+		if (j < nb)
+			continue;
 
-			dev->pdata->io_ctx.ep = ep;
-			dev->pdata->lock = ep->lock;
-			return 0;
-		}
+		for (j = 0; j < nb; j++)
+			ep[j].in_use = true;
+
+		dev->pdata->io_ctx.ep = ep;
+		dev->pdata->io_ctx.nb_stripes = nb;
+		dev->pdata->lock = ep->lock;
+		return true;
 	}
 
-	return -EBUSY;
+	return false;
+}
+
+static int usb_reserve_ep_unlocked(const struct iio_device *dev)
+{
+	unsigned int nb = dev->ctx->pdata->nb_stripes;
+
+	/* Without enough endpoint couples left, the device does not stripe
+	 * its samples */
+	if (nb > 1 && usb_reserve_eps(dev, nb))
+		return 0;
+
+	return usb_reserve_eps(dev, 1) ? 0 : -EBUSY;
+}
+
+/* Frees the endpoint couples reserved, past the first keep ones */
+static void usb_free_eps(const struct iio_device *dev, unsigned int keep)
+{
+	struct iio_usb_io_context *io_ctx = &dev->pdata->io_ctx;
+	unsigned int i;
+
+	for (i = keep; i < io_ctx->nb_stripes; i++)
+		io_ctx->ep[i].in_use = false;
+
+	io_ctx->nb_stripes = keep;
 }
 
 static void usb_free_ep_unlocked(const struct iio_device *dev)
 {
-	struct iio_context_pdata *pdata = dev->ctx->pdata;
+	usb_free_eps(dev, 0);
+}
+
+#ifdef HAS_LIBUSB_DEV_MEM
+/*
+ * The memory of the blocks is allocated by usbfs and mapped in the address
+ * space of the application; the kernel recognizes it when a transfer is
+ * submitted, and uses it as the transfer buffer instead of copying the data
+ * to or from a buffer of its own. It is only supported by Linux: elsewhere,
+ * libusb_dev_mem_alloc() always fails and the blocks are never used.
+ *
+ * The two functions below must be called with the device's lock held.
+ */
+static int usb_dma_get_block(const struct iio_device *dev)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct iio_usb_dma_block *blocks;
+	unsigned char *addr;
 	unsigned int i;
 
-	for (i = 0; i < pdata->nb_ep_couples; i++) {
-		struct iio_usb_ep_couple *ep = &pdata->io_endpoints[i];
+	for (i = 0; i < pdata->nb_dma_blocks; i++) {
+		if (!pdata->dma_blocks[i].busy) {
+			pdata->dma_blocks[i].busy = true;
+			return (int) i;
+		}
+	}
+
+	blocks = realloc(pdata->dma_blocks,
+			(i + 1) * sizeof(*pdata->dma_blocks));
+	if (!blocks)
+		return -ENOMEM;
+
+	pdata->dma_blocks = blocks;
+
+	addr = libusb_dev_mem_alloc(dev->ctx->pdata->hdl, pdata->dma_len);
+	if (!addr)
+		return -ENOMEM;
+
+	blocks[i].addr = addr;
+	blocks[i].busy = true;
+	pdata->nb_dma_blocks++;
+
+	return (int) i;
+}
+
+static void usb_dma_put_block(const struct iio_device *dev, void *addr)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	unsigned int i;
+
+	for (i = 0; i < pdata->nb_dma_blocks; i++) {
+		if (pdata->dma_blocks[i].addr == addr) {
+			pdata->dma_blocks[i].busy = false;
 
-		if (ep->lock == dev->pdata->lock) {
-			ep->in_use = false;
+			if (pdata->last_block == (int) i)
+				pdata->last_block = -1;
 			return;
 		}
 	}
 }
 
+static void usb_dma_free_blocks(const struct iio_device *dev)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	unsigned int i;
+
+	for (i = 0; i < pdata->nb_dma_blocks; i++)
+		libusb_dev_mem_free(dev->ctx->pdata->hdl,
+				pdata->dma_blocks[i].addr, pdata->dma_len);
+
+	free(pdata->dma_blocks);
+	pdata->dma_blocks = NULL;
+	pdata->nb_dma_blocks = 0;
+	pdata->last_block = -1;
+}
+#else
+static int usb_dma_get_block(const struct iio_device *dev)
+{
+	return -ENOSYS;
+}
+
+static void usb_dma_put_block(const struct iio_device *dev, void *addr)
+{
+}
+
+static void usb_dma_free_blocks(const struct iio_device *dev)
+{
+}
+#endif /* HAS_LIBUSB_DEV_MEM */
+
 static int usb_open(const struct iio_device *dev,
 		size_t samples_count, bool cyclic)
 {
@@ -297,7 +513,23 @@ static int usb_open(const struct iio_device *dev,
 				&pdata->io_ctx, remote_timeout);
 	}
 
+	if (!ret && pdata->io_ctx.nb_stripes > 1) {
+		int err = iiod_client_set_stripes(ctx_pdata->iiod_client,
+				&pdata->io_ctx, pdata->io_ctx.nb_stripes,
+				ctx_pdata->transfer_size);
+
+		/* Older versions of iiod read on one pipe only */
+		if (err) {
+			IIO_DEBUG("Unable to stripe the samples: %i\n", err);
+			usb_free_eps(dev, 1);
+		}
+	}
+
 	pdata->opened = !ret;
+	pdata->nb_pending = 0;
+
+	pdata->dma_len = samples_count * iio_device_get_sample_size(dev);
+	pdata->last_block = -1;
 
 	iio_mutex_unlock(pdata->lock);
 
@@ -322,10 +554,18 @@ static int usb_close(const struct iio_device *dev)
 		goto out_unlock;
 
 	iio_mutex_lock(pdata->lock);
-	ret = iiod_client_close_unlocked(ctx_pdata->iiod_client, &pdata->io_ctx,
-			dev);
+
+	/* With requests still pending, the answer to CLOSE would be lost in
+	 * their replies; closing the pipe is enough for iiod to clean up. */
+	if (pdata->nb_pending)
+		ret = 0;
+	else
+		ret = iiod_client_close_unlocked(ctx_pdata->iiod_client,
+				&pdata->io_ctx, dev);
 	pdata->opened = false;
 
+	usb_dma_free_blocks(dev);
+
 	iio_mutex_unlock(pdata->lock);
 
 	usb_close_pipe(ctx_pdata, pdata->io_ctx.ep->pipe_id);
@@ -365,6 +605,203 @@ static ssize_t usb_write(const struct iio_device *dev,
 	return ret;
 }
 
+/*
+ * Asynchronous transfers reuse the iiod protocol of usb_read() and
+ * usb_write(), split at the point where the reply is awaited. libusb does
+ * not provide a descriptor that could signal the reply, so completing a
+ * request always waits for it (within the configured timeout), whatever
+ * the value of the "wait" parameter.
+ */
+static int usb_submit_buffer(const struct iio_device *dev,
+		void *addr, size_t len)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct iiod_client *client = dev->ctx->pdata->iiod_client;
+	int ret;
+
+	iio_mutex_lock(pdata->lock);
+
+	if (!iio_device_is_tx(dev)) {
+		/* The block of the buffer will be refilled by whichever
+		 * request completes first */
+		if (pdata->nb_dma_blocks)
+			usb_dma_put_block(dev, addr);
+
+		ret = iiod_client_submit_read_unlocked(client,
+				&pdata->io_ctx, dev, len);
+	} else if (pdata->nb_pending) {
+		ret = -EBUSY;
+	} else {
+		ret = iiod_client_submit_write_unlocked(client,
+				&pdata->io_ctx, dev, addr, len);
+		pdata->pending_tx_len = len;
+		pdata->pending_tx_addr = addr;
+	}
+
+	if (!ret)
+		pdata->nb_pending++;
+
+	iio_mutex_unlock(pdata->lock);
+	return ret;
+}
+
+/* Completion of the requests of the zero-copy mode: the buffer gets a new
+ * block, filled with the samples read, or to fill with the next samples to
+ * write. Called with the device's lock held. */
+static ssize_t usb_complete_dma_block(const struct iio_device *dev,
+		void **addr_ptr, uint32_t *mask, size_t words)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct iiod_client *client = dev->ctx->pdata->iiod_client;
+	ssize_t ret;
+	int idx;
+
+	if (iio_device_is_tx(dev) && pdata->nb_pending) {
+		ret = iiod_client_complete_write_unlocked(client,
+				&pdata->io_ctx, pdata->pending_tx_len);
+		pdata->nb_pending--;
+
+		/* The block was sent along with the request */
+		*addr_ptr = pdata->pending_tx_addr;
+		return ret;
+	}
+
+	/* Output buffers only need a block to fill */
+	if (!iio_device_is_tx(dev) && !pdata->nb_pending)
+		return -ENOENT;
+
+	idx = usb_dma_get_block(dev);
+	if (idx < 0)
+		return (ssize_t) idx;
+
+	if (iio_device_is_tx(dev)) {
+		*addr_ptr = pdata->dma_blocks[idx].addr;
+		return (ssize_t) pdata->dma_len;
+	}
+
+	ret = iiod_client_complete_read_unlocked(client, &pdata->io_ctx, dev,
+			pdata->dma_blocks[idx].addr, pdata->dma_len,
+			mask, words);
+	pdata->nb_pending--;
+
+	if (ret < 0)
+		pdata->dma_blocks[idx].busy = false;
+	else
+		*addr_ptr = pdata->dma_blocks[idx].addr;
+	return ret;
+}
+
+static ssize_t usb_complete_buffer(const struct iio_device *dev,
+		void **addr_ptr, size_t len, uint32_t *mask, size_t words,
+		bool wait)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct iiod_client *client = dev->ctx->pdata->iiod_client;
+	ssize_t ret;
+
+	iio_mutex_lock(pdata->lock);
+
+	if (pdata->nb_dma_blocks) {
+		ret = usb_complete_dma_block(dev, addr_ptr, mask, words);
+	} else if (!pdata->nb_pending) {
+		ret = -ENOENT;
+	} else {
+		if (iio_device_is_tx(dev))
+			ret = iiod_client_complete_write_unlocked(client,
+					&pdata->io_ctx, pdata->pending_tx_len);
+		else
+			ret = iiod_client_complete_read_unlocked(client,
+					&pdata->io_ctx, dev, *addr_ptr,
+					len, mask, words);
+		pdata->nb_pending--;
+	}
+
+	iio_mutex_unlock(pdata->lock);
+	return ret;
+}
+
+/*
+ * Zero-copy mode. The blocks handed to the application are allocated by
+ * usbfs (see usb_dma_get_block()), and the samples are transferred right
+ * from and to them. As the transfers are done by the time the functions
+ * return, a block just pushed can be handed back to be filled again.
+ */
+static ssize_t usb_get_buffer(const struct iio_device *dev,
+		void **addr_ptr, size_t bytes_used,
+		uint32_t *mask, size_t words)
+{
+	struct iio_device_pdata *pdata = dev->pdata;
+	struct iiod_client *client = dev->ctx->pdata->iiod_client;
+	unsigned char *addr;
+	size_t done;
+	ssize_t ret;
+	int idx;
+
+	if (!pdata->opened)
+		return -EBADF;
+
+	/* Check early that usbfs can provide the memory, so that we can
+	 * return -ENOSYS in case it fails, which will indicate that the
+	 * high-speed interface is not available. */
+	if (!addr_ptr) {
+		iio_mutex_lock(pdata->lock);
+		if (!pdata->nb_dma_blocks) {
+			idx = usb_dma_get_block(dev);
+			if (idx >= 0)
+				pdata->dma_blocks[idx].busy = false;
+		}
+		ret = pdata->nb_dma_blocks ? -EINVAL : -ENOSYS;
+		iio_mutex_unlock(pdata->lock);
+		return ret;
+	}
+
+	if (bytes_used > pdata->dma_len)
+		return -EFBIG;
+
+	iio_mutex_lock(pdata->lock);
+
+	if (iio_device_is_tx(dev) && pdata->last_block >= 0) {
+		/* A cyclic buffer pushed again replaces the waveform, if
+		 * iiod can do it; it reports -EBUSY otherwise */
+		addr = pdata->dma_blocks[pdata->last_block].addr;
+
+		for (done = 0; done < bytes_used; done += (size_t) ret) {
+			ret = iiod_client_write_unlocked(client,
+					&pdata->io_ctx, dev,
+					addr + done, bytes_used - done);
+			if (ret < 0)
+				goto out_unlock;
+		}
+	}
+
+	if (pdata->last_block < 0) {
+		idx = usb_dma_get_block(dev);
+		if (idx < 0) {
+			ret = (ssize_t) idx;
+			goto out_unlock;
+		}
+
+		pdata->last_block = idx;
+	}
+
+	addr = pdata->dma_blocks[pdata->last_block].addr;
+
+	if (!iio_device_is_tx(dev)) {
+		ret = iiod_client_read_unlocked(client, &pdata->io_ctx, dev,
+				addr, pdata->dma_len, mask, words);
+		if (ret < 0)
+			goto out_unlock;
+	} else {
+		ret = (ssize_t) bytes_used;
+	}
+
+	*addr_ptr = addr;
+
+out_unlock:
+	iio_mutex_unlock(pdata->lock);
+	return ret;
+}
+
 static ssize_t usb_read_dev_attr(const struct iio_device *dev,
 		const char *attr, char *dst, size_t len, enum iio_attr_type type)
 {
@@ -405,6 +842,60 @@ static ssize_t usb_write_chn_attr(const struct iio_channel *chn,
 			src, len, false);
 }
 
+static int usb_set_attr_cache(const struct iio_context *ctx,
+		const char *attr, int ttl_ms)
+{
+	return iiod_client_set_attr_cache(ctx->pdata->iiod_client, attr, ttl_ms);
+}
+
+static void usb_invalidate_attr_cache(const struct iio_context *ctx)
+{
+	iiod_client_invalidate_attr_cache(ctx->pdata->iiod_client);
+}
+
+static int usb_get_attr_cache_stats(const struct iio_context *ctx,
+		struct iio_attr_cache_stats *stats)
+{
+	iiod_client_get_attr_cache_stats(ctx->pdata->iiod_client, stats);
+	return 0;
+}
+
+static int usb_read_attrs(const struct iio_context *ctx,
+		struct iio_attr_read_req *reqs, unsigned int nb_reqs)
+{
+	struct iio_context_pdata *pdata = ctx->pdata;
+
+	return iiod_client_read_attrs(pdata->iiod_client,
+			&pdata->io_ctx, reqs, nb_reqs);
+}
+
+static int usb_write_attrs(const struct iio_context *ctx,
+		struct iio_attr_write_req *reqs, unsigned int nb_reqs)
+{
+	struct iio_context_pdata *pdata = ctx->pdata;
+
+	return iiod_client_write_attrs(pdata->iiod_client,
+			&pdata->io_ctx, reqs, nb_reqs);
+}
+
+static int usb_read_regs(const struct iio_device *dev,
+		const uint32_t *addrs, uint32_t *values, unsigned int nb)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_read_regs(pdata->iiod_client, &pdata->io_ctx,
+			dev, addrs, values, nb);
+}
+
+static int usb_write_regs(const struct iio_device *dev,
+		const uint32_t *addrs, const uint32_t *values, unsigned int nb)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_write_regs(pdata->iiod_client, &pdata->io_ctx,
+			dev, addrs, values, nb);
+}
+
 static int usb_set_kernel_buffers_count(const struct iio_device *dev,
 		unsigned int nb_blocks)
 {
@@ -414,6 +905,15 @@ static int usb_set_kernel_buffers_count(const struct iio_device *dev,
 			&pdata->io_ctx, dev, nb_blocks);
 }
 
+static int usb_set_cyclic_buffers_count(const struct iio_device *dev,
+		unsigned int nb_blocks)
+{
+	struct iio_context_pdata *pdata = dev->ctx->pdata;
+
+	return iiod_client_set_cyclic_buffers_count(pdata->iiod_client,
+			&pdata->io_ctx, dev, nb_blocks);
+}
+
 static int usb_set_timeout(struct iio_context *ctx, unsigned int timeout)
 {
 	struct iio_context_pdata *pdata = ctx->pdata;
@@ -447,6 +947,8 @@ static int usb_set_trigger(const struct iio_device *dev,
 }
 
 
+static void usb_stream_exit(struct iio_context_pdata *pdata);
+
 static void usb_shutdown(struct iio_context *ctx)
 {
 	unsigned int i;
@@ -456,8 +958,11 @@ static void usb_shutdown(struct iio_context *ctx)
 	for (i = 0; i < ctx->nb_devices; i++)
 		usb_close(ctx->devices[i]);
 
+	usb_stream_exit(ctx->pdata);
+
 	iio_mutex_destroy(ctx->pdata->lock);
 	iio_mutex_destroy(ctx->pdata->ep_lock);
+	iio_mutex_destroy(ctx->pdata->attr_lock);
 
 	for (i = 0; i < ctx->pdata->nb_ep_couples; i++)
 		if (ctx->pdata->io_endpoints[i].lock)
@@ -545,9 +1050,21 @@ static void usb_cancel(const struct iio_device *dev)
 {
 	struct iio_device_pdata *ppdata = dev->pdata;
 
+	struct iio_usb_ep_couple *ep = ppdata->io_ctx.ep;
+	unsigned int i, j;
+
 	iio_mutex_lock(ppdata->io_ctx.lock);
 	if (ppdata->io_ctx.transfer && !ppdata->io_ctx.cancelled)
 		libusb_cancel_transfer(ppdata->io_ctx.transfer);
+
+	if (ep && ep->xfers && !ppdata->io_ctx.cancelled) {
+		for (j = 0; j < ppdata->io_ctx.nb_stripes; j++)
+			for (i = 0; i < dev->ctx->pdata->nb_transfers; i++)
+				if (ep[j].xfers[i].busy)
+					libusb_cancel_transfer(
+						ep[j].xfers[i].transfer);
+	}
+
 	ppdata->io_ctx.cancelled = true;
 	iio_mutex_unlock(ppdata->io_ctx.lock);
 }
@@ -558,25 +1075,87 @@ static const struct iio_backend_ops usb_ops = {
 	.close = usb_close,
 	.read = usb_read,
 	.write = usb_write,
+	.submit_buffer = usb_submit_buffer,
+	.complete_buffer = usb_complete_buffer,
+	.get_buffer = usb_get_buffer,
 	.read_device_attr = usb_read_dev_attr,
 	.read_channel_attr = usb_read_chn_attr,
 	.write_device_attr = usb_write_dev_attr,
 	.write_channel_attr = usb_write_chn_attr,
+	.read_attrs = usb_read_attrs,
+	.set_attr_cache = usb_set_attr_cache,
+	.invalidate_attr_cache = usb_invalidate_attr_cache,
+	.get_attr_cache_stats = usb_get_attr_cache_stats,
+	.write_attrs = usb_write_attrs,
+	.read_regs = usb_read_regs,
+	.write_regs = usb_write_regs,
 	.get_trigger = usb_get_trigger,
 	.set_trigger = usb_set_trigger,
 	.set_kernel_buffers_count = usb_set_kernel_buffers_count,
+	.set_cyclic_buffers_count = usb_set_cyclic_buffers_count,
 	.set_timeout = usb_set_timeout,
 	.shutdown = usb_shutdown,
 
 	.cancel = usb_cancel,
 };
 
+static int usb_transfer_status_to_errno(enum libusb_transfer_status status)
+{
+	switch (status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		return 0;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		return -ETIMEDOUT;
+	case LIBUSB_TRANSFER_STALL:
+		return -EPIPE;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		return -ENODEV;
+	case LIBUSB_TRANSFER_CANCELLED:
+		return -EBADF;
+	default:
+		return -EIO;
+	}
+}
+
+static int usb_submit_transfer(struct libusb_transfer *transfer)
+{
+	IIO_TRACE2(usb_transfer_submit, transfer->endpoint, transfer->length);
+	return libusb_submit_transfer(transfer);
+}
+
 static void LIBUSB_CALL sync_transfer_cb(struct libusb_transfer *transfer)
 {
 	int *completed = transfer->user_data;
+
+	IIO_TRACE3(usb_transfer_complete, transfer->endpoint,
+			transfer->status, transfer->actual_length);
 	*completed = 1;
 }
 
+/* Lowers the size of the URBs of an endpoint, and the one reported by the
+ * "usb,max_transfer_size" attribute of the context */
+static void usb_lower_max_transfer_size(struct iio_context_pdata *pdata,
+		struct iio_usb_ep_couple *ep, size_t len)
+{
+	char buf[32];
+
+	ep->max_transfer_size = len;
+	IIO_DEBUG("Lowering the size of the URBs to %zu bytes\n", len);
+
+	iio_mutex_lock(pdata->attr_lock);
+	if (len < pdata->max_transfer_size) {
+		pdata->max_transfer_size = len;
+
+		/* Before the context is created, the attribute is added
+		 * with the value lowered */
+		iio_snprintf(buf, sizeof(buf), "%zu", len);
+		if (pdata->ctx && iio_context_add_attr(pdata->ctx,
+					"usb,max_transfer_size", buf) < 0)
+			IIO_WARNING("Unable to update usb,max_transfer_size\n");
+	}
+	iio_mutex_unlock(pdata->attr_lock);
+}
+
 static int usb_sync_transfer(struct iio_context_pdata *pdata,
 	struct iio_usb_io_context *io_ctx, unsigned int ep_type,
 	char *data, size_t len, int *transferred)
@@ -586,100 +1165,440 @@ static int usb_sync_transfer(struct iio_context_pdata *pdata,
 	int completed = 0;
 	int ret;
 
-	/*
-	 * If the size of the data to transfer is too big, the
-	 * IOCTL_USBFS_SUBMITURB ioctl (called by libusb) might fail with
-	 * errno set to ENOMEM, as the kernel might use contiguous allocation
-	 * for the URB if the driver doesn't support scatter-gather.
-	 * To prevent that, we support URBs of 1 MiB maximum. The iiod-client
-	 * code will handle this properly and ask for a new transfer.
-	 */
-	if (len > 1 * 1024 * 1024)
-		len = 1 * 1024 * 1024;
+	/*
+	 * If the size of the data to transfer is too big, the
+	 * IOCTL_USBFS_SUBMITURB ioctl (called by libusb) might fail with
+	 * errno set to ENOMEM, as the kernel might use contiguous allocation
+	 * for the URB if the driver doesn't support scatter-gather.
+	 * To prevent that, we support URBs of 1 MiB maximum, or more when
+	 * the host controller supports scatter-gather (see
+	 * usb_probe_max_transfer_size()). The iiod-client code will handle
+	 * this properly and ask for a new transfer.
+	 */
+	if (len > io_ctx->ep->max_transfer_size)
+		len = io_ctx->ep->max_transfer_size;
+
+	if (ep_type == LIBUSB_ENDPOINT_IN)
+		ep = io_ctx->ep->addr_in;
+	else
+		ep = io_ctx->ep->addr_out;
+
+	/*
+	 * For cancellation support the check whether the buffer has already been
+	 * cancelled and the allocation as well as the assignment of the new
+	 * transfer needs to happen in one atomic step. Otherwise it is possible
+	 * that the cancellation is missed and transfer is not aborted.
+	 */
+	iio_mutex_lock(io_ctx->lock);
+	if (io_ctx->cancelled) {
+		ret = -EBADF;
+		goto unlock;
+	}
+
+	transfer = libusb_alloc_transfer(0);
+	if (!transfer) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	transfer->user_data = &completed;
+
+	libusb_fill_bulk_transfer(transfer, pdata->hdl, ep,
+			(unsigned char *) data, (int) len, sync_transfer_cb,
+			&completed, pdata->timeout_ms);
+	transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+
+	ret = usb_submit_transfer(transfer);
+
+	/* Even with scatter-gather, usbfs may run out of memory for the
+	 * larger URBs: use smaller ones from now on */
+	while (ret == LIBUSB_ERROR_NO_MEM && len > USB_MAX_TRANSFER_SIZE) {
+		len /= 2;
+		usb_lower_max_transfer_size(pdata, io_ctx->ep, len);
+
+		transfer->length = (int) len;
+		ret = usb_submit_transfer(transfer);
+	}
+
+	if (ret) {
+		ret = -(int) libusb_to_errno(ret);
+		libusb_free_transfer(transfer);
+		goto unlock;
+	}
+
+	io_ctx->transfer = transfer;
+unlock:
+	iio_mutex_unlock(io_ctx->lock);
+	if (ret)
+		return ret;
+
+	while (!completed) {
+		ret = libusb_handle_events_completed(pdata->ctx, &completed);
+		if (ret < 0) {
+			if (ret == LIBUSB_ERROR_INTERRUPTED)
+				continue;
+			libusb_cancel_transfer(transfer);
+			continue;
+		}
+	}
+
+	ret = usb_transfer_status_to_errno(transfer->status);
+	if (!ret)
+		*transferred = transfer->actual_length;
+
+	/* Same as above. This needs to be atomic in regards to usb_cancel(). */
+	iio_mutex_lock(io_ctx->lock);
+	io_ctx->transfer = NULL;
+	iio_mutex_unlock(io_ctx->lock);
+
+	libusb_free_transfer(transfer);
+
+	return ret;
+}
+
+static void LIBUSB_CALL stream_transfer_cb(struct libusb_transfer *transfer)
+{
+	struct iio_usb_transfer *xfer = transfer->user_data;
+	struct iio_context_pdata *pdata = xfer->pdata;
+
+	IIO_TRACE3(usb_transfer_complete, transfer->endpoint,
+			transfer->status, transfer->actual_length);
+
+	iio_mutex_lock(pdata->stream_lock);
+	xfer->done = true;
+	iio_cond_broadcast(pdata->stream_cond);
+	iio_mutex_unlock(pdata->stream_lock);
+}
+
+/*
+ * Streaming mode: the data is split into transfers of transfer_size bytes,
+ * up to nb_transfers of them being in flight at any time, so that the bus
+ * is never idle waiting for the next URB to be submitted. The transfers
+ * complete in the order they were submitted; when an input transfer
+ * completes short, the data of the following ones is moved right after it.
+ * Returns the number of bytes transferred, which may be less than len.
+ */
+static ssize_t usb_stream_transfer(struct iio_context_pdata *pdata,
+		struct iio_usb_io_context *io_ctx, unsigned int ep_type,
+		char *data, size_t len)
+{
+	struct iio_usb_transfer *xfers = io_ctx->ep->xfers, *xfer;
+	unsigned int head = 0, tail = 0, nb = pdata->nb_transfers;
+	size_t submitted = 0, done = 0;
+	bool aborted = false;
+	unsigned char ep;
+	int ret = 0, err;
+
+	if (ep_type == LIBUSB_ENDPOINT_IN)
+		ep = io_ctx->ep->addr_in;
+	else
+		ep = io_ctx->ep->addr_out;
+
+	while (true) {
+		/* Keep the queue full */
+		while (!ret && head - tail < nb && submitted < len) {
+			size_t size = len - submitted;
+
+			if (size > pdata->transfer_size)
+				size = pdata->transfer_size;
+
+			xfer = &xfers[head % nb];
+			xfer->done = false;
+
+			libusb_fill_bulk_transfer(xfer->transfer, pdata->hdl,
+					ep, (unsigned char *) data + submitted,
+					(int) size, stream_transfer_cb,
+					xfer, pdata->timeout_ms);
+
+			/* Atomic in regards to usb_cancel() */
+			iio_mutex_lock(io_ctx->lock);
+			if (io_ctx->cancelled) {
+				ret = -EBADF;
+			} else {
+				ret = usb_submit_transfer(xfer->transfer);
+				if (ret)
+					ret = -(int) libusb_to_errno(ret);
+				else
+					xfer->busy = true;
+			}
+			iio_mutex_unlock(io_ctx->lock);
+
+			if (!ret) {
+				submitted += size;
+				head++;
+			}
+		}
+
+		if (head == tail)
+			break;
+
+		if (ret && !aborted) {
+			unsigned int i;
+
+			/* Abort the transfers still in flight */
+			iio_mutex_lock(io_ctx->lock);
+			for (i = tail; i != head; i++)
+				libusb_cancel_transfer(xfers[i % nb].transfer);
+			iio_mutex_unlock(io_ctx->lock);
+			aborted = true;
+		}
+
+		/* Wait for the oldest transfer */
+		xfer = &xfers[tail++ % nb];
+
+		iio_mutex_lock(pdata->stream_lock);
+		while (!xfer->done)
+			iio_cond_wait(pdata->stream_cond, pdata->stream_lock);
+		iio_mutex_unlock(pdata->stream_lock);
+
+		iio_mutex_lock(io_ctx->lock);
+		xfer->busy = false;
+		iio_mutex_unlock(io_ctx->lock);
+
+		err = usb_transfer_status_to_errno(xfer->transfer->status);
+		if (err && !ret)
+			ret = err;
+
+		if (!ret && xfer->transfer->actual_length) {
+			size_t actual = (size_t) xfer->transfer->actual_length;
+
+			if ((char *) xfer->transfer->buffer != data + done)
+				memmove(data + done, xfer->transfer->buffer,
+						actual);
+			done += actual;
+		}
+	}
+
+	if (ret)
+		return ret;
+
+	return (ssize_t) done;
+}
+
+/*
+ * Striped read: iiod sends the samples in chunks of transfer_size bytes, to
+ * each of the endpoint couples of the device in turn, starting with the
+ * first one. Each chunk is read with a transfer of its own, right at its
+ * place in the data, while the transfers of all the endpoints are in flight
+ * at the same time. Returns len, as a short chunk means that the data was
+ * not striped the way it was expected.
+ */
+static ssize_t usb_stripe_transfer(struct iio_context_pdata *pdata,
+		struct iio_usb_io_context *io_ctx, char *data, size_t len)
+{
+	unsigned int head[USB_MAX_STRIPES] = { 0 }, tail[USB_MAX_STRIPES] = { 0 };
+	size_t next[USB_MAX_STRIPES];
+	unsigned int i, nb = io_ctx->nb_stripes, nbt = pdata->nb_transfers;
+	size_t chunk = pdata->transfer_size;
+	size_t nb_chunks = (len + chunk - 1) / chunk, done = 0;
+	struct iio_usb_transfer *xfer;
+	bool aborted = false;
+	int ret = 0, err;
+
+	/* Index of the next chunk to read on each endpoint */
+	for (i = 0; i < nb; i++)
+		next[i] = i;
+
+	while (true) {
+		unsigned int in_flight = 0;
+
+		/* Keep the queues of all the endpoints full */
+		for (i = 0; i < nb; i++) {
+			struct iio_usb_ep_couple *ep = &io_ctx->ep[i];
+
+			while (!ret && head[i] - tail[i] < nbt &&
+					next[i] < nb_chunks) {
+				size_t offset = next[i] * chunk;
+				size_t size = len - offset;
+
+				if (size > chunk)
+					size = chunk;
+
+				xfer = &ep->xfers[head[i] % nbt];
+				xfer->done = false;
+
+				libusb_fill_bulk_transfer(xfer->transfer,
+						pdata->hdl, ep->addr_in,
+						(unsigned char *) data + offset,
+						(int) size, stream_transfer_cb,
+						xfer, pdata->timeout_ms);
+
+				/* Atomic in regards to usb_cancel() */
+				iio_mutex_lock(io_ctx->lock);
+				if (io_ctx->cancelled) {
+					ret = -EBADF;
+				} else {
+					ret = usb_submit_transfer(
+							xfer->transfer);
+					if (ret)
+						ret = -(int) libusb_to_errno(ret);
+					else
+						xfer->busy = true;
+				}
+				iio_mutex_unlock(io_ctx->lock);
+
+				if (!ret) {
+					head[i]++;
+					next[i] += nb;
+				}
+			}
+
+			in_flight += head[i] - tail[i];
+		}
+
+		if (!in_flight)
+			break;
+
+		if (ret && !aborted) {
+			unsigned int j;
+
+			/* Abort the transfers still in flight */
+			iio_mutex_lock(io_ctx->lock);
+			for (i = 0; i < nb; i++)
+				for (j = tail[i]; j != head[i]; j++)
+					libusb_cancel_transfer(io_ctx->ep[i]
+						.xfers[j % nbt].transfer);
+			iio_mutex_unlock(io_ctx->lock);
+			aborted = true;
+		}
+
+		/* Wait for the chunks in order; once aborted, for whichever
+		 * transfer is still in flight */
+		if (!ret) {
+			i = (unsigned int) (done % nb);
+		} else {
+			for (i = 0; head[i] == tail[i]; i++);
+		}
+
+		xfer = &io_ctx->ep[i].xfers[tail[i]++ % nbt];
+
+		iio_mutex_lock(pdata->stream_lock);
+		while (!xfer->done)
+			iio_cond_wait(pdata->stream_cond, pdata->stream_lock);
+		iio_mutex_unlock(pdata->stream_lock);
+
+		iio_mutex_lock(io_ctx->lock);
+		xfer->busy = false;
+		iio_mutex_unlock(io_ctx->lock);
+
+		err = usb_transfer_status_to_errno(xfer->transfer->status);
+		if (!err && xfer->transfer->actual_length !=
+				xfer->transfer->length)
+			err = -EIO;
+		if (err && !ret)
+			ret = err;
+		if (!ret)
+			done++;
+	}
+
+	if (ret)
+		return ret;
+
+	return (ssize_t) len;
+}
+
+static int usb_events_thd(void *d)
+{
+	struct iio_context_pdata *pdata = d;
+	bool stop;
+
+	do {
+		struct timeval tv = { .tv_sec = 0, .tv_usec = 100000, };
+
+		libusb_handle_events_timeout_completed(pdata->ctx, &tv, NULL);
+
+		iio_mutex_lock(pdata->stream_lock);
+		stop = pdata->stop_events;
+		iio_mutex_unlock(pdata->stream_lock);
+	} while (!stop);
+
+	return 0;
+}
+
+static void usb_stream_exit(struct iio_context_pdata *pdata)
+{
+	unsigned int i, j;
+
+	if (pdata->events_thrd) {
+		iio_mutex_lock(pdata->stream_lock);
+		pdata->stop_events = true;
+		iio_mutex_unlock(pdata->stream_lock);
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+		libusb_interrupt_event_handler(pdata->ctx);
+#endif
+		iio_thrd_join_and_destroy(pdata->events_thrd);
+		pdata->events_thrd = NULL;
+	}
+
+	for (i = 0; i < pdata->nb_ep_couples; i++) {
+		struct iio_usb_ep_couple *ep = &pdata->io_endpoints[i];
+
+		if (!ep->xfers)
+			continue;
+
+		for (j = 0; j < pdata->nb_transfers; j++)
+			if (ep->xfers[j].transfer)
+				libusb_free_transfer(ep->xfers[j].transfer);
 
-	if (ep_type == LIBUSB_ENDPOINT_IN)
-		ep = io_ctx->ep->addr_in;
-	else
-		ep = io_ctx->ep->addr_out;
+		free(ep->xfers);
+		ep->xfers = NULL;
+	}
 
-	/*
-	 * For cancellation support the check whether the buffer has already been
-	 * cancelled and the allocation as well as the assignment of the new
-	 * transfer needs to happen in one atomic step. Otherwise it is possible
-	 * that the cancellation is missed and transfer is not aborted.
-	 */
-	iio_mutex_lock(io_ctx->lock);
-	if (io_ctx->cancelled) {
-		ret = -EBADF;
-		goto unlock;
+	if (pdata->stream_cond) {
+		iio_cond_destroy(pdata->stream_cond);
+		pdata->stream_cond = NULL;
 	}
 
-	transfer = libusb_alloc_transfer(0);
-	if (!transfer) {
-		ret = -ENOMEM;
-		goto unlock;
+	if (pdata->stream_lock) {
+		iio_mutex_destroy(pdata->stream_lock);
+		pdata->stream_lock = NULL;
 	}
+}
 
-	transfer->user_data = &completed;
+static int usb_stream_init(struct iio_context_pdata *pdata)
+{
+	unsigned int i, j;
 
-	libusb_fill_bulk_transfer(transfer, pdata->hdl, ep,
-			(unsigned char *) data, (int) len, sync_transfer_cb,
-			&completed, pdata->timeout_ms);
-	transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+	pdata->stream_lock = iio_mutex_create();
+	if (!pdata->stream_lock)
+		return -ENOMEM;
 
-	ret = libusb_submit_transfer(transfer);
-	if (ret) {
-		ret = -(int) libusb_to_errno(ret);
-		libusb_free_transfer(transfer);
-		goto unlock;
-	}
+	pdata->stream_cond = iio_cond_create();
+	if (!pdata->stream_cond)
+		goto err_stream_exit;
 
-	io_ctx->transfer = transfer;
-unlock:
-	iio_mutex_unlock(io_ctx->lock);
-	if (ret)
-		return ret;
+	for (i = 0; i < pdata->nb_ep_couples; i++) {
+		struct iio_usb_ep_couple *ep = &pdata->io_endpoints[i];
 
-	while (!completed) {
-		ret = libusb_handle_events_completed(pdata->ctx, &completed);
-		if (ret < 0) {
-			if (ret == LIBUSB_ERROR_INTERRUPTED)
-				continue;
-			libusb_cancel_transfer(transfer);
-			continue;
+		ep->xfers = calloc(pdata->nb_transfers, sizeof(*ep->xfers));
+		if (!ep->xfers)
+			goto err_stream_exit;
+
+		for (j = 0; j < pdata->nb_transfers; j++) {
+			ep->xfers[j].pdata = pdata;
+			ep->xfers[j].transfer = libusb_alloc_transfer(0);
+			if (!ep->xfers[j].transfer)
+				goto err_stream_exit;
 		}
 	}
 
-	switch (transfer->status) {
-	case LIBUSB_TRANSFER_COMPLETED:
-		*transferred = transfer->actual_length;
-		ret = 0;
-		break;
-	case LIBUSB_TRANSFER_TIMED_OUT:
-		ret = -ETIMEDOUT;
-		break;
-	case LIBUSB_TRANSFER_STALL:
-		ret = -EPIPE;
-		break;
-	case LIBUSB_TRANSFER_NO_DEVICE:
-		ret = -ENODEV;
-		break;
-	case LIBUSB_TRANSFER_CANCELLED:
-		ret = -EBADF;
-		break;
-	default:
-		ret = -EIO;
-		break;
-	}
+	pdata->events_thrd = iio_thrd_create(usb_events_thd, pdata,
+			"usb_events_thd");
+	if (!pdata->events_thrd)
+		goto err_stream_exit;
 
-	/* Same as above. This needs to be atomic in regards to usb_cancel(). */
-	iio_mutex_lock(io_ctx->lock);
-	io_ctx->transfer = NULL;
-	iio_mutex_unlock(io_ctx->lock);
+	return 0;
 
-	libusb_free_transfer(transfer);
+err_stream_exit:
+	usb_stream_exit(pdata);
+	return -ENOMEM;
+}
 
-	return ret;
+static bool usb_use_stream(const struct iio_context_pdata *pdata,
+		const struct iio_usb_io_context *io_ctx, size_t len)
+{
+	return io_ctx->ep->xfers && len > pdata->transfer_size;
 }
 
 static ssize_t write_data_sync(struct iio_context_pdata *pdata,
@@ -687,6 +1606,10 @@ static ssize_t write_data_sync(struct iio_context_pdata *pdata,
 {
 	int transferred, ret;
 
+	if (usb_use_stream(pdata, ep, len))
+		return usb_stream_transfer(pdata, ep, LIBUSB_ENDPOINT_OUT,
+				(char *) data, len);
+
 	ret = usb_sync_transfer(pdata, ep, LIBUSB_ENDPOINT_OUT, (char *) data,
 			len, &transferred);
 	if (ret)
@@ -695,7 +1618,9 @@ static ssize_t write_data_sync(struct iio_context_pdata *pdata,
 		return (ssize_t) transferred;
 }
 
-static ssize_t read_data_sync(struct iio_context_pdata *pdata,
+/* The lines sent by iiod are each received in one transfer, so they are
+ * never read with the streaming mode */
+static ssize_t read_line_sync(struct iio_context_pdata *pdata,
 		void *ep, char *buf, size_t len)
 {
 	int transferred, ret;
@@ -708,10 +1633,44 @@ static ssize_t read_data_sync(struct iio_context_pdata *pdata,
 		return transferred;
 }
 
+static ssize_t read_data_sync(struct iio_context_pdata *pdata,
+		void *ep, char *buf, size_t len)
+{
+	if (usb_use_stream(pdata, ep, len))
+		return usb_stream_transfer(pdata, ep, LIBUSB_ENDPOINT_IN,
+				buf, len);
+
+	return read_line_sync(pdata, ep, buf, len);
+}
+
+static ssize_t read_samples_sync(struct iio_context_pdata *pdata,
+		void *ep, char *buf, size_t len)
+{
+	struct iio_usb_io_context *io_ctx = ep;
+	size_t done = 0;
+	ssize_t ret;
+
+	if (io_ctx->nb_stripes > 1)
+		return usb_stripe_transfer(pdata, io_ctx, buf, len);
+
+	while (done < len) {
+		ret = read_data_sync(pdata, ep, buf + done, len - done);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return -EIO;
+
+		done += (size_t) ret;
+	}
+
+	return (ssize_t) len;
+}
+
 static const struct iiod_client_ops usb_iiod_client_ops = {
 	.write = write_data_sync,
 	.read = read_data_sync,
-	.read_line = read_data_sync,
+	.read_line = read_line_sync,
+	.read_samples = read_samples_sync,
 };
 
 static int usb_verify_eps(const struct libusb_interface_descriptor *iface)
@@ -777,6 +1736,12 @@ static int usb_populate_context_attrs(struct iio_context *ctx,
 	if (ret < 0)
 		return ret;
 
+	iio_snprintf(buffer, sizeof(buffer), "%zu",
+			ctx->pdata->max_transfer_size);
+	ret = iio_context_add_attr(ctx, "usb,max_transfer_size", buffer);
+	if (ret < 0)
+		return ret;
+
 	iio_snprintf(buffer, sizeof(buffer), "%1hhx.%1hhx",
 			(unsigned char)((dev_desc.bcdUSB >> 8) & 0xf),
 			(unsigned char)((dev_desc.bcdUSB >> 4) & 0xf));
@@ -817,8 +1782,38 @@ static int usb_populate_context_attrs(struct iio_context *ctx,
 	return 0;
 }
 
-struct iio_context * usb_create_context(unsigned int bus,
-		uint16_t address, uint16_t intrfc)
+/*
+ * With scatter-gather, usbfs does not need the memory of an URB to be
+ * contiguous, so much larger URBs can be used. libusb does not report the
+ * capability, so it is read from usbfs directly.
+ */
+static size_t usb_probe_max_transfer_size(libusb_device *dev)
+{
+#if defined(__linux__) && defined(USBDEVFS_CAP_BULK_SCATTER_GATHER)
+	char path[sizeof("/dev/bus/usb/255/255")];
+	uint32_t caps;
+	int fd, ret;
+
+	iio_snprintf(path, sizeof(path), "/dev/bus/usb/%03u/%03u",
+			libusb_get_bus_number(dev),
+			libusb_get_device_address(dev));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return USB_MAX_TRANSFER_SIZE;
+
+	ret = ioctl(fd, USBDEVFS_GET_CAPABILITIES, &caps);
+	close(fd);
+
+	if (!ret && (caps & USBDEVFS_CAP_BULK_SCATTER_GATHER))
+		return USB_SG_MAX_TRANSFER_SIZE;
+#endif
+	return USB_MAX_TRANSFER_SIZE;
+}
+
+static struct iio_context * usb_do_create_context(unsigned int bus,
+		uint16_t address, uint16_t intrfc,
+		const struct iio_usb_opts *opts)
 {
 	libusb_context *usb_ctx;
 	libusb_device_handle *hdl = NULL;
@@ -853,12 +1848,19 @@ struct iio_context * usb_create_context(unsigned int bus,
 		goto err_destroy_mutex;
 	}
 
+	pdata->attr_lock = iio_mutex_create();
+	if (!pdata->attr_lock) {
+		IIO_ERROR("Unable to create mutex\n");
+		ret = -ENOMEM;
+		goto err_destroy_ep_mutex;
+	}
+
 	pdata->iiod_client = iiod_client_new(pdata, pdata->lock,
 			&usb_iiod_client_ops);
 	if (!pdata->iiod_client) {
 		IIO_ERROR("Unable to create IIOD client\n");
 		ret = -errno;
-		goto err_destroy_ep_mutex;
+		goto err_destroy_attr_mutex;
 	}
 
 	ret = libusb_init(&usb_ctx);
@@ -948,6 +1950,9 @@ struct iio_context * usb_create_context(unsigned int bus,
 
 	pdata->nb_ep_couples = iface->bNumEndpoints / 2;
 
+	pdata->max_transfer_size = usb_probe_max_transfer_size(usb_dev);
+	IIO_DEBUG("Using URBs of up to %zu bytes\n", pdata->max_transfer_size);
+
 	IIO_DEBUG("Found %hhu usable i/o endpoint couples\n", pdata->nb_ep_couples);
 
 	pdata->io_endpoints = calloc(pdata->nb_ep_couples,
@@ -964,6 +1969,7 @@ struct iio_context * usb_create_context(unsigned int bus,
 		ep->addr_in = iface->endpoint[i * 2 + 0].bEndpointAddress;
 		ep->addr_out = iface->endpoint[i * 2 + 1].bEndpointAddress;
 		ep->pipe_id = i;
+		ep->max_transfer_size = pdata->max_transfer_size;
 
 		IIO_DEBUG("Couple %i with endpoints 0x%x / 0x%x\n", i,
 				ep->addr_in, ep->addr_out);
@@ -980,14 +1986,31 @@ struct iio_context * usb_create_context(unsigned int bus,
 	pdata->hdl = hdl;
 	pdata->timeout_ms = DEFAULT_TIMEOUT_MS;
 	pdata->intrfc = intrfc;
+	pdata->nb_transfers = opts->nb_transfers;
+	pdata->transfer_size = opts->transfer_size;
+
+	pdata->nb_stripes = opts->nb_stripes;
+
+	/* Striping relies on the transfers of the streaming mode */
+	if (pdata->nb_transfers > 1 || pdata->nb_stripes > 1) {
+		ret = usb_stream_init(pdata);
+		if (ret) {
+			IIO_ERROR("Unable to initialize streaming mode\n");
+			goto err_free_endpoints;
+		}
+
+		IIO_DEBUG("Streaming with %u transfers of %zu bytes\n",
+				pdata->nb_transfers, pdata->transfer_size);
+	}
 
 	ret = usb_io_context_init(&pdata->io_ctx);
 	if (ret)
-		goto err_free_endpoints;
+		goto err_stream_exit;
 
 	/* We reserve the first I/O endpoint couple for global operations */
 	pdata->io_ctx.ep = &pdata->io_endpoints[0];
 	pdata->io_ctx.ep->in_use = true;
+	pdata->io_ctx.nb_stripes = 1;
 
 	ret = usb_reset_pipes(pdata);
 	if (ret) {
@@ -1014,6 +2037,7 @@ struct iio_context * usb_create_context(unsigned int bus,
 	ctx->name = "usb";
 	ctx->ops = &usb_ops;
 	ctx->pdata = pdata;
+	pdata->ctx = ctx;
 
 	for (i = 0; i < ctx->nb_devices; i++) {
 		struct iio_device *dev = ctx->devices[i];
@@ -1045,6 +2069,8 @@ err_reset_pipes:
 	usb_reset_pipes(pdata); /* Close everything */
 err_io_context_exit:
 	usb_io_context_exit(&pdata->io_ctx);
+err_stream_exit:
+	usb_stream_exit(pdata);
 err_free_endpoints:
 	for (i = 0; i < pdata->nb_ep_couples; i++)
 		if (pdata->io_endpoints[i].lock)
@@ -1059,6 +2085,8 @@ err_libusb_exit:
 	libusb_exit(usb_ctx);
 err_destroy_iiod_client:
 	iiod_client_destroy(pdata->iiod_client);
+err_destroy_attr_mutex:
+	iio_mutex_destroy(pdata->attr_lock);
 err_destroy_ep_mutex:
 	iio_mutex_destroy(pdata->ep_lock);
 err_destroy_mutex:
@@ -1070,11 +2098,71 @@ err_set_errno:
 	return NULL;
 }
 
+struct iio_context * usb_create_context(unsigned int bus,
+		uint16_t address, uint16_t intrfc)
+{
+	struct iio_usb_opts opts = {
+		.nb_transfers = 1,
+		.transfer_size = USB_STREAM_TRANSFER_SIZE,
+		.nb_stripes = 1,
+	};
+
+	return usb_do_create_context(bus, address, intrfc, &opts);
+}
+
+/* Parses the comma-separated "option=value" list following the address */
+static int usb_parse_opts(const char *str, struct iio_usb_opts *opts)
+{
+	while (*str) {
+		const char *end = strchr(str, ','), *eq;
+		char *ptr;
+		size_t len;
+		long val;
+
+		len = end ? (size_t) (end - str) : strlen(str);
+		eq = memchr(str, '=', len);
+		if (!eq)
+			return -EINVAL;
+
+		errno = 0;
+		val = strtol(eq + 1, &ptr, 0);
+		if (ptr != str + len || ptr == eq + 1 || errno == ERANGE ||
+				val < 0 || val > INT_MAX)
+			return -EINVAL;
+
+		len = (size_t) (eq - str);
+		if (len == sizeof("transfers") - 1 &&
+				!strncmp(str, "transfers", len) && val >= 1 &&
+				val <= USB_STREAM_MAX_TRANSFERS)
+			opts->nb_transfers = (unsigned int) val;
+		else if (len == sizeof("transfer_size") - 1 &&
+				!strncmp(str, "transfer_size", len) &&
+				val >= 1024 && val <= USB_MAX_TRANSFER_SIZE)
+			/* Multiple of the largest bulk packet size */
+			opts->transfer_size = (size_t) val & ~(size_t) 1023;
+		else if (len == sizeof("stripes") - 1 &&
+				!strncmp(str, "stripes", len) && val >= 1 &&
+				val <= USB_MAX_STRIPES)
+			opts->nb_stripes = (unsigned int) val;
+		else
+			return -EINVAL;
+
+		str = end ? end + 1 : ptr;
+	}
+
+	return 0;
+}
+
 struct iio_context * usb_create_context_from_uri(const char *uri)
 {
+	struct iio_usb_opts opts = {
+		.nb_transfers = 1,
+		.transfer_size = USB_STREAM_TRANSFER_SIZE,
+		.nb_stripes = 1,
+	};
 	long bus, address, intrfc;
-	char *end;
-	const char *ptr;
+	char *end, addr[sizeof("usb:127.255.255")];
+	const char *ptr, *sep;
 	/* keep MSVS happy by setting these to NULL */
 	struct iio_scan_context *scan_ctx = NULL;
 	struct iio_context_info **info = NULL;
@@ -1085,6 +2173,19 @@ struct iio_context * usb_create_context_from_uri(const char *uri)
 
 	ptr = (const char *) ((uintptr_t) uri + sizeof("usb:") - 1);
 
+	/* The address can be followed by options, e.g. "usb:3.32.5,transfers=8" */
+	sep = strchr(ptr, ',');
+	if (sep) {
+		size_t len = (size_t) (sep - ptr);
+
+		if (len >= sizeof(addr) || usb_parse_opts(sep + 1, &opts))
+			goto err_bad_uri;
+
+		memcpy(addr, ptr, len);
+		addr[len] = '\0';
+		ptr = addr;
+	}
+
 	/* if uri is just "usb:" that means search for the first one */
 	if (!*ptr) {
 		ssize_t ret;
@@ -1146,8 +2247,8 @@ struct iio_context * usb_create_context_from_uri(const char *uri)
 		iio_context_info_list_free(info);
 		iio_scan_context_destroy(scan_ctx);
 	}
-	return usb_create_context((unsigned int) bus,
-			(uint16_t) address, (uint16_t) intrfc);
+	return usb_do_create_context((unsigned int) bus,
+			(uint16_t) address, (uint16_t) intrfc, &opts);
 
 err_bad_uri:
 	if (scan) {
@@ -1295,3 +2396,265 @@ cleanup_free_device_list:
 	libusb_free_device_list(device_list, true);
 	return ret;
 }
+
+#ifdef HAS_LIBUSB_HOTPLUG
+/* A device which arrived or left, queued by the hotplug callback: libusb
+ * does not allow I/O from the callback itself */
+struct usb_watch_event {
+	libusb_device *dev;
+	bool arrived;
+	struct usb_watch_event *next;
+};
+
+/* A device reported to the monitor */
+struct usb_watch_device {
+	libusb_device *dev;
+	char *uri;
+	struct usb_watch_device *next;
+};
+
+struct iio_scan_backend_watch {
+	struct iio_scan_monitor *mon;
+	libusb_context *ctx;
+	libusb_hotplug_callback_handle handle;
+	struct iio_thrd *thrd;
+
+	struct iio_mutex *lock;
+	bool stop;
+
+	/* Both only used by the thread handling the events of libusb, or
+	 * before it starts */
+	struct usb_watch_event *events, **events_tail;
+	struct usb_watch_device *devices;
+};
+
+static int LIBUSB_CALL usb_watch_hotplug_cb(libusb_context *ctx,
+		libusb_device *dev, libusb_hotplug_event event, void *d)
+{
+	struct iio_scan_backend_watch *watch = d;
+	struct usb_watch_event *ev = malloc(sizeof(*ev));
+
+	if (!ev) {
+		IIO_ERROR("Unable to allocate memory\n");
+		return 0;
+	}
+
+	ev->dev = libusb_ref_device(dev);
+	ev->arrived = event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+	ev->next = NULL;
+
+	*watch->events_tail = ev;
+	watch->events_tail = &ev->next;
+	return 0;
+}
+
+static void usb_watch_add_device(struct iio_scan_backend_watch *watch,
+		libusb_device *dev)
+{
+	struct iio_context_info info = { NULL, NULL };
+	struct usb_watch_device *wdev;
+	struct libusb_device_handle *hdl;
+	unsigned int intrfc = 0;
+	int ret;
+
+	if (libusb_open(dev, &hdl))
+		return;
+
+	ret = iio_usb_match_device(dev, hdl, &intrfc);
+	if (!ret)
+		ret = usb_fill_context_info(&info, dev, hdl, intrfc);
+
+	libusb_close(hdl);
+
+	if (!ret)
+		ret = iio_scan_monitor_add(watch->mon, watch,
+				info.uri, info.description);
+	if (ret)
+		goto out_free_info;
+
+	wdev = malloc(sizeof(*wdev));
+	if (!wdev) {
+		iio_scan_monitor_remove(watch->mon, watch, info.uri);
+		goto out_free_info;
+	}
+
+	wdev->dev = libusb_ref_device(dev);
+	wdev->uri = info.uri;
+	wdev->next = watch->devices;
+	watch->devices = wdev;
+	info.uri = NULL;
+
+out_free_info:
+	free(info.description);
+	free(info.uri);
+}
+
+static void usb_watch_remove_device(struct iio_scan_backend_watch *watch,
+		libusb_device *dev)
+{
+	struct usb_watch_device **it, *wdev;
+
+	for (it = &watch->devices; *it; it = &(*it)->next) {
+		wdev = *it;
+		if (wdev->dev != dev)
+			continue;
+
+		*it = wdev->next;
+		iio_scan_monitor_remove(watch->mon, watch, wdev->uri);
+		libusb_unref_device(wdev->dev);
+		free(wdev->uri);
+		free(wdev);
+		break;
+	}
+}
+
+static void usb_watch_process_events(struct iio_scan_backend_watch *watch,
+		bool report)
+{
+	struct usb_watch_event *ev;
+
+	while (watch->events) {
+		ev = watch->events;
+		watch->events = ev->next;
+
+		if (!report)
+			;
+		else if (ev->arrived)
+			usb_watch_add_device(watch, ev->dev);
+		else
+			usb_watch_remove_device(watch, ev->dev);
+
+		libusb_unref_device(ev->dev);
+		free(ev);
+	}
+
+	watch->events_tail = &watch->events;
+}
+
+static int usb_watch_thd(void *d)
+{
+	struct iio_scan_backend_watch *watch = d;
+	struct timeval tv = {
+		.tv_sec = 0,
+		.tv_usec = USB_WATCH_POLL_MS * 1000,
+	};
+	bool stop;
+
+	do {
+		/* The devices already present were queued when the
+		 * callback was registered */
+		usb_watch_process_events(watch, true);
+
+		libusb_handle_events_timeout_completed(watch->ctx, &tv, NULL);
+
+		iio_mutex_lock(watch->lock);
+		stop = watch->stop;
+		iio_mutex_unlock(watch->lock);
+	} while (!stop);
+
+	return 0;
+}
+
+struct iio_scan_backend_watch * usb_context_watch_start(
+		struct iio_scan_monitor *mon)
+{
+	struct iio_scan_backend_watch *watch;
+	int ret;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	watch = zalloc(sizeof(*watch));
+	if (!watch) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	watch->mon = mon;
+	watch->events_tail = &watch->events;
+
+	watch->lock = iio_mutex_create();
+	if (!watch->lock) {
+		ret = -ENOMEM;
+		goto err_free_watch;
+	}
+
+	ret = libusb_init(&watch->ctx);
+	if (ret) {
+		ret = -(int) libusb_to_errno(ret);
+		goto err_destroy_lock;
+	}
+
+	ret = libusb_hotplug_register_callback(watch->ctx,
+			LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+			LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+			LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY,
+			LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+			usb_watch_hotplug_cb, watch, &watch->handle);
+	if (ret) {
+		ret = -(int) libusb_to_errno(ret);
+		goto err_libusb_exit;
+	}
+
+	watch->thrd = iio_thrd_create(usb_watch_thd, watch, "usb_watch");
+	if (!watch->thrd) {
+		ret = -errno;
+		goto err_deregister_callback;
+	}
+
+	return watch;
+
+err_deregister_callback:
+	libusb_hotplug_deregister_callback(watch->ctx, watch->handle);
+	usb_watch_process_events(watch, false);
+err_libusb_exit:
+	libusb_exit(watch->ctx);
+err_destroy_lock:
+	iio_mutex_destroy(watch->lock);
+err_free_watch:
+	free(watch);
+	errno = -ret;
+	return NULL;
+}
+
+void usb_context_watch_stop(struct iio_scan_backend_watch *watch)
+{
+	struct usb_watch_device *wdev;
+
+	iio_mutex_lock(watch->lock);
+	watch->stop = true;
+	iio_mutex_unlock(watch->lock);
+
+	/* Wakes up the thread handling the events */
+	libusb_hotplug_deregister_callback(watch->ctx, watch->handle);
+	iio_thrd_join_and_destroy(watch->thrd);
+
+	usb_watch_process_events(watch, false);
+
+	while (watch->devices) {
+		wdev = watch->devices;
+		watch->devices = wdev->next;
+
+		libusb_unref_device(wdev->dev);
+		free(wdev->uri);
+		free(wdev);
+	}
+
+	libusb_exit(watch->ctx);
+	iio_mutex_destroy(watch->lock);
+	free(watch);
+}
+#else
+struct iio_scan_backend_watch * usb_context_watch_start(
+		struct iio_scan_monitor *mon)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void usb_context_watch_stop(struct iio_scan_backend_watch *watch)
+{
+}
+#endif /* HAS_LIBUSB_HOTPLUG */
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #if defined(_WIN32) || \
 		(defined(__APPLE__) && defined(__MACH__)) || \
@@ -321,3 +322,22 @@ wrong_str:
 #endif
 	return NULL;
 }
+
+uint64_t iio_get_monotonic_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+
+	return (uint64_t) (count.QuadPart / freq.QuadPart) * 1000000000ull +
+		(uint64_t) (count.QuadPart % freq.QuadPart) * 1000000000ull /
+		(uint64_t) freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+#endif
+}
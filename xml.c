@@ -16,11 +16,13 @@
  *
  * */
 
+#include "arena.h"
 #include "debug.h"
 #include "iio-private.h"
 
 #include <errno.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 #include <string.h>
 
 /* 'input' must be in UTF-8 encoded, null terminated */
@@ -33,90 +35,97 @@ char * encode_xml_ndup(const char * input)
 	return out;
 }
 
-static int add_attr_to_channel(struct iio_channel *chn, xmlNode *n)
+/* The XML is parsed as a stream: the functions below are called on the
+ * start tag of each element, and read its attributes */
+static const char * next_attr(xmlTextReaderPtr reader, const char **content)
 {
-	xmlAttr *attr;
+	if (xmlTextReaderMoveToNextAttribute(reader) != 1)
+		return NULL;
+
+	*content = (const char *) xmlTextReaderConstValue(reader);
+	return (const char *) xmlTextReaderConstName(reader);
+}
+
+/* The strings and tables of the context are allocated from its arena, and
+ * are all released along with it on error */
+static int add_attr_to_channel(struct iio_channel *chn,
+		xmlTextReaderPtr reader)
+{
+	struct iio_arena *arena = chn->dev->ctx->arena;
+	const char *attr, *content;
 	char *name = NULL, *filename = NULL;
 	struct iio_channel_attr *attrs;
 
-	for (attr = n->properties; attr; attr = attr->next) {
-		if (!strcmp((char *) attr->name, "name")) {
-			name = iio_strdup((char *) attr->children->content);
-		} else if (!strcmp((char *) attr->name, "filename")) {
-			filename = iio_strdup((char *) attr->children->content);
+	while ((attr = next_attr(reader, &content))) {
+		if (!strcmp(attr, "name")) {
+			name = iio_arena_strdup(arena, content);
+		} else if (!strcmp(attr, "filename")) {
+			filename = iio_arena_strdup(arena, content);
 		} else {
 			IIO_WARNING("Unknown field \'%s\' in channel %s\n",
-					attr->name, chn->id);
+					attr, chn->id);
 		}
 	}
 
 	if (!name) {
 		IIO_ERROR("Incomplete attribute in channel %s\n", chn->id);
-		goto err_free;
+		return -1;
 	}
 
-	if (!filename) {
-		filename = iio_strdup(name);
-		if (!filename)
-			goto err_free;
-	}
+	if (!filename)
+		filename = name;
 
-	attrs = realloc(chn->attrs, (1 + chn->nb_attrs) *
+	attrs = iio_arena_grow_array(arena, chn->attrs, chn->nb_attrs,
 			sizeof(struct iio_channel_attr));
 	if (!attrs)
-		goto err_free;
+		return -1;
 
 	attrs[chn->nb_attrs].filename = filename;
 	attrs[chn->nb_attrs++].name = name;
 	chn->attrs = attrs;
 	return 0;
-
-err_free:
-	if (name)
-		free(name);
-	if (filename)
-		free(filename);
-	return -1;
 }
 
-static int add_attr_to_device(struct iio_device *dev, xmlNode *n, enum iio_attr_type type)
+static int add_attr_to_device(struct iio_device *dev,
+		xmlTextReaderPtr reader, enum iio_attr_type type)
 {
-	xmlAttr *attr;
+	struct iio_arena *arena = dev->ctx->arena;
+	const char *attr, *content;
 	char **attrs, *name = NULL;
 
-	for (attr = n->properties; attr; attr = attr->next) {
-		if (!strcmp((char *) attr->name, "name")) {
-			name = iio_strdup((char *) attr->children->content);
+	while ((attr = next_attr(reader, &content))) {
+		if (!strcmp(attr, "name")) {
+			name = iio_arena_strdup(arena, content);
 		} else {
 			IIO_WARNING("Unknown field \'%s\' in device %s\n",
-					attr->name, dev->id);
+					attr, dev->id);
 		}
 	}
 
 	if (!name) {
 		IIO_ERROR("Incomplete attribute in device %s\n", dev->id);
-		goto err_free;
+		return -1;
 	}
 
 	switch(type) {
 		case IIO_ATTR_TYPE_DEBUG:
-			attrs = realloc(dev->debug_attrs,
-					(1 + dev->nb_debug_attrs) * sizeof(char *));
+			attrs = iio_arena_grow_array(arena, dev->debug_attrs,
+					dev->nb_debug_attrs, sizeof(char *));
 			break;
 		case IIO_ATTR_TYPE_DEVICE:
-			attrs = realloc(dev->attrs,
-					(1 + dev->nb_attrs) * sizeof(char *));
+			attrs = iio_arena_grow_array(arena, dev->attrs,
+					dev->nb_attrs, sizeof(char *));
 			break;
 		case IIO_ATTR_TYPE_BUFFER:
-			attrs = realloc(dev->buffer_attrs,
-					(1 + dev->nb_buffer_attrs) * sizeof(char *));
+			attrs = iio_arena_grow_array(arena, dev->buffer_attrs,
+					dev->nb_buffer_attrs, sizeof(char *));
 			break;
 		default:
 			attrs = NULL;
 			break;
 	}
 	if (!attrs)
-		goto err_free;
+		return -1;
 
 	switch(type) {
 		case IIO_ATTR_TYPE_DEBUG:
@@ -134,20 +143,14 @@ static int add_attr_to_device(struct iio_device *dev, xmlNode *n, enum iio_attr_
 	}
 
 	return 0;
-
-err_free:
-	if (name)
-		free(name);
-	return -1;
 }
 
-static void setup_scan_element(struct iio_channel *chn, xmlNode *n)
+static void setup_scan_element(struct iio_channel *chn,
+		xmlTextReaderPtr reader)
 {
-	xmlAttr *attr;
+	const char *name, *content;
 
-	for (attr = n->properties; attr; attr = attr->next) {
-		const char *name = (const char *) attr->name,
-		      *content = (const char *) attr->children->content;
+	while ((name = next_attr(reader, &content))) {
 		if (!strcmp(name, "index")) {
 			char *end;
 			long long value;
@@ -208,10 +211,12 @@ static void setup_scan_element(struct iio_channel *chn, xmlNode *n)
 	}
 }
 
-static struct iio_channel * create_channel(struct iio_device *dev, xmlNode *n)
+static struct iio_channel * create_channel(struct iio_device *dev,
+		xmlTextReaderPtr reader)
 {
-	xmlAttr *attr;
-	struct iio_channel *chn = zalloc(sizeof(*chn));
+	struct iio_arena *arena = dev->ctx->arena;
+	const char *name, *content;
+	struct iio_channel *chn = iio_arena_alloc(arena, sizeof(*chn));
 	if (!chn)
 		return NULL;
 
@@ -220,13 +225,11 @@ static struct iio_channel * create_channel(struct iio_device *dev, xmlNode *n)
 	/* Set the default index value < 0 (== no index) */
 	chn->index = -ENOENT;
 
-	for (attr = n->properties; attr; attr = attr->next) {
-		const char *name = (const char *) attr->name,
-		      *content = (const char *) attr->children->content;
+	while ((name = next_attr(reader, &content))) {
 		if (!strcmp(name, "name")) {
-			chn->name = iio_strdup(content);
+			chn->name = iio_arena_strdup(arena, content);
 		} else if (!strcmp(name, "id")) {
-			chn->id = iio_strdup(content);
+			chn->id = iio_arena_strdup(arena, content);
 		} else if (!strcmp(name, "type")) {
 			if (!strcmp(content, "output"))
 				chn->is_output = true;
@@ -240,217 +243,269 @@ static struct iio_channel * create_channel(struct iio_device *dev, xmlNode *n)
 
 	if (!chn->id) {
 		IIO_ERROR("Incomplete <attribute>\n");
-		goto err_free_channel;
-	}
-
-	for (n = n->children; n; n = n->next) {
-		if (!strcmp((char *) n->name, "attribute")) {
-			if (add_attr_to_channel(chn, n) < 0)
-				goto err_free_channel;
-		} else if (!strcmp((char *) n->name, "scan-element")) {
-			chn->is_scan_element = true;
-			setup_scan_element(chn, n);
-		} else if (strcmp((char *) n->name, "text")) {
-			IIO_WARNING("Unknown children \'%s\' in <channel>\n",
-					n->name);
-			continue;
-		}
+		return NULL;
 	}
 
-	iio_channel_init_finalize(chn);
-
 	return chn;
-
-err_free_channel:
-	free_channel(chn);
-	return NULL;
 }
 
-static struct iio_device * create_device(struct iio_context *ctx, xmlNode *n)
+static struct iio_device * create_device(struct iio_context *ctx,
+		xmlTextReaderPtr reader)
 {
-	xmlAttr *attr;
-	struct iio_device *dev = zalloc(sizeof(*dev));
+	const char *name, *content;
+	struct iio_device *dev = iio_arena_alloc(ctx->arena, sizeof(*dev));
 	if (!dev)
 		return NULL;
 
 	dev->ctx = ctx;
 
-	for (attr = n->properties; attr; attr = attr->next) {
-		if (!strcmp((char *) attr->name, "name")) {
-			dev->name = iio_strdup(
-					(char *) attr->children->content);
-		} else if (!strcmp((char *) attr->name, "id")) {
-			dev->id = iio_strdup((char *) attr->children->content);
+	while ((name = next_attr(reader, &content))) {
+		if (!strcmp(name, "name")) {
+			dev->name = iio_arena_strdup(ctx->arena, content);
+		} else if (!strcmp(name, "id")) {
+			dev->id = iio_arena_strdup(ctx->arena, content);
 		} else {
 			IIO_WARNING("Unknown attribute \'%s\' in <device>\n",
-					attr->name);
+					name);
 		}
 	}
 
 	if (!dev->id) {
 		IIO_ERROR("Unable to read device ID\n");
-		goto err_free_device;
+		return NULL;
 	}
 
-	for (n = n->children; n; n = n->next) {
-		if (!strcmp((char *) n->name, "channel")) {
-			struct iio_channel **chns,
-					   *chn = create_channel(dev, n);
-			if (!chn) {
-				IIO_ERROR("Unable to create channel\n");
-				goto err_free_device;
-			}
+	return dev;
+}
 
-			chns = realloc(dev->channels, (1 + dev->nb_channels) *
-					sizeof(struct iio_channel *));
-			if (!chns) {
-				IIO_ERROR("Unable to allocate memory\n");
-				free(chn);
-				goto err_free_device;
-			}
+/* Called once all the children of the device were parsed */
+static int finalize_device(struct iio_device *dev)
+{
+	unsigned int i;
 
-			chns[dev->nb_channels++] = chn;
-			dev->channels = chns;
-		} else if (!strcmp((char *) n->name, "attribute")) {
-			if (add_attr_to_device(dev, n, IIO_ATTR_TYPE_DEVICE) < 0)
-				goto err_free_device;
-		} else if (!strcmp((char *) n->name, "debug-attribute")) {
-			if (add_attr_to_device(dev, n, IIO_ATTR_TYPE_DEBUG) < 0)
-				goto err_free_device;
-		} else if (!strcmp((char *) n->name, "buffer-attribute")) {
-			if (add_attr_to_device(dev, n, IIO_ATTR_TYPE_BUFFER) < 0)
-				goto err_free_device;
-		} else if (strcmp((char *) n->name, "text")) {
-			IIO_WARNING("Unknown children \'%s\' in <device>\n",
-					n->name);
-			continue;
-		}
-	}
+	for (i = 0; i < dev->nb_channels; i++)
+		iio_channel_init_finalize(dev->channels[i]);
 
 	dev->words = (dev->nb_channels + 31) / 32;
 	if (dev->words) {
-		dev->mask = calloc(dev->words, sizeof(*dev->mask));
-		if (!dev->mask) {
-			errno = ENOMEM;
-			goto err_free_device;
-		}
+		dev->mask = iio_arena_alloc(dev->ctx->arena,
+				dev->words * sizeof(*dev->mask));
+		if (!dev->mask)
+			return -ENOMEM;
 	}
 
-	return dev;
+	return 0;
+}
 
-err_free_device:
-	free_device(dev);
-	return NULL;
+static int add_channel(struct iio_device *dev, xmlTextReaderPtr reader)
+{
+	struct iio_channel **chns, *chn = create_channel(dev, reader);
+	if (!chn) {
+		IIO_ERROR("Unable to create channel\n");
+		return -EINVAL;
+	}
+
+	chns = iio_arena_grow_array(dev->ctx->arena, dev->channels,
+			dev->nb_channels, sizeof(struct iio_channel *));
+	if (!chns) {
+		IIO_ERROR("Unable to allocate memory\n");
+		return -ENOMEM;
+	}
+
+	chns[dev->nb_channels++] = chn;
+	dev->channels = chns;
+	return 0;
+}
+
+static int add_device(struct iio_context *ctx, xmlTextReaderPtr reader)
+{
+	struct iio_device **devs, *dev = create_device(ctx, reader);
+	if (!dev) {
+		IIO_ERROR("Unable to create device\n");
+		return -EINVAL;
+	}
+
+	devs = iio_arena_grow_array(ctx->arena, ctx->devices,
+			ctx->nb_devices, sizeof(struct iio_device *));
+	if (!devs) {
+		IIO_ERROR("Unable to allocate memory\n");
+		return -ENOMEM;
+	}
+
+	devs[ctx->nb_devices++] = dev;
+	ctx->devices = devs;
+	return 0;
 }
 
 static struct iio_context * xml_clone(const struct iio_context *ctx)
 {
-	return xml_create_context_mem(ctx->xml, strlen(ctx->xml));
+	return iio_context_clone_description(ctx, NULL);
 }
 
 static const struct iio_backend_ops xml_ops = {
 	.clone = xml_clone,
 };
 
-static int parse_context_attr(struct iio_context *ctx, xmlNode *n)
+static int parse_context_attr(struct iio_context *ctx,
+		xmlTextReaderPtr reader)
 {
-	xmlAttr *attr;
-	const char *name = NULL, *value = NULL;
-
-	for (attr = n->properties; attr; attr = attr->next) {
-		if (!strcmp((const char *) attr->name, "name")) {
-			name = (const char *) attr->children->content;
-		} else if (!strcmp((const char *) attr->name, "value")) {
-			value = (const char *) attr->children->content;
-		}
+	const char *attr, *content;
+	char *name = NULL, *value = NULL;
+
+	/* The strings of the reader only last until it moves to the next
+	 * attribute */
+	while ((attr = next_attr(reader, &content))) {
+		if (!strcmp(attr, "name") && !name)
+			name = iio_arena_strdup(ctx->arena, content);
+		else if (!strcmp(attr, "value") && !value)
+			value = iio_arena_strdup(ctx->arena, content);
 	}
 
 	if (!name || !value)
 		return -EINVAL;
-	else
-		return iio_context_add_attr(ctx, name, value);
+
+	return iio_context_add_attr(ctx, name, value);
+}
+
+/* Handles the start tag of an element of the given depth; the device and
+ * channel are the ones the element belongs to, if any */
+static int parse_element(struct iio_context *ctx, xmlTextReaderPtr reader,
+		int depth, struct iio_device *dev, struct iio_channel *chn)
+{
+	const char *name = (const char *) xmlTextReaderConstName(reader);
+
+	switch (depth) {
+	case 1:
+		if (!strcmp(name, "context-attribute"))
+			return parse_context_attr(ctx, reader);
+		if (!strcmp(name, "device"))
+			return add_device(ctx, reader);
+
+		IIO_WARNING("Unknown children \'%s\' in <context>\n", name);
+		return 0;
+	case 2:
+		if (!dev)
+			return 0;
+		if (!strcmp(name, "channel"))
+			return add_channel(dev, reader);
+		if (!strcmp(name, "attribute"))
+			return add_attr_to_device(dev, reader,
+					IIO_ATTR_TYPE_DEVICE) < 0 ? -EINVAL : 0;
+		if (!strcmp(name, "debug-attribute"))
+			return add_attr_to_device(dev, reader,
+					IIO_ATTR_TYPE_DEBUG) < 0 ? -EINVAL : 0;
+		if (!strcmp(name, "buffer-attribute"))
+			return add_attr_to_device(dev, reader,
+					IIO_ATTR_TYPE_BUFFER) < 0 ? -EINVAL : 0;
+
+		IIO_WARNING("Unknown children \'%s\' in <device>\n", name);
+		return 0;
+	case 3:
+		if (!chn)
+			return 0;
+		if (!strcmp(name, "attribute"))
+			return add_attr_to_channel(chn, reader) < 0 ? -EINVAL : 0;
+
+		if (!strcmp(name, "scan-element")) {
+			chn->is_scan_element = true;
+			setup_scan_element(chn, reader);
+		} else {
+			IIO_WARNING("Unknown children \'%s\' in <channel>\n",
+					name);
+		}
+		return 0;
+	default:
+		return 0;
+	}
 }
 
-static struct iio_context * iio_create_xml_context_helper(xmlDoc *doc)
+/* Builds the context as the XML is read, without the document tree */
+static struct iio_context * iio_create_xml_context_helper(
+		xmlTextReaderPtr reader)
 {
 	unsigned int i;
-	xmlNode *root, *n;
-	xmlAttr *attr;
-	int err = -ENOMEM;
+	const char *name, *content;
+	struct iio_device *dev = NULL;
+	struct iio_channel *chn = NULL;
+	int ret, depth, err = -ENOMEM;
 	struct iio_context *ctx = zalloc(sizeof(*ctx));
 	if (!ctx)
 		goto err_set_errno;
 
+	ctx->arena = iio_arena_new();
+	if (!ctx->arena)
+		goto err_free_ctx;
+
 	ctx->name = "xml";
 	ctx->ops = &xml_ops;
 
-	root = xmlDocGetRootElement(doc);
-	if (strcmp((char *) root->name, "context")) {
-		IIO_ERROR("Unrecognized XML file\n");
-		err = -EINVAL;
-		goto err_free_ctx;
-	}
+	err = -EINVAL;
 
-	for (attr = root->properties; attr; attr = attr->next) {
-		if (!strcmp((char *) attr->name, "description"))
-			ctx->description = iio_strdup(
-					(char *) attr->children->content);
-		else if (strcmp((char *) attr->name, "name"))
-			IIO_WARNING("Unknown parameter \'%s\' in <context>\n",
-					(char *) attr->children->content);
-	}
+	while ((ret = xmlTextReaderRead(reader)) == 1) {
+		if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+			continue;
+
+		depth = xmlTextReaderDepth(reader);
+		name = (const char *) xmlTextReaderConstName(reader);
 
-	for (n = root->children; n; n = n->next) {
-		struct iio_device **devs, *dev;
-
-		if (!strcmp((char *) n->name, "context-attribute")) {
-			err = parse_context_attr(ctx, n);
-			if (err)
-				goto err_free_devices;
-			else
-				continue;
-		} else if (strcmp((char *) n->name, "device")) {
-			if (strcmp((char *) n->name, "text"))
-				IIO_WARNING("Unknown children \'%s\' in "
-						"<context>\n", n->name);
+		if (!depth) {
+			if (strcmp(name, "context")) {
+				IIO_ERROR("Unrecognized XML file\n");
+				goto err_destroy_arena;
+			}
+
+			while ((name = next_attr(reader, &content))) {
+				if (!strcmp(name, "description")) {
+					ctx->description = iio_arena_strdup(
+							ctx->arena, content);
+				} else if (strcmp(name, "name")) {
+					IIO_WARNING("Unknown parameter \'%s\' "
+							"in <context>\n",
+							content);
+				}
+			}
 			continue;
 		}
 
-		dev = create_device(ctx, n);
-		if (!dev) {
-			IIO_ERROR("Unable to create device\n");
-			goto err_free_devices;
+		err = parse_element(ctx, reader, depth, dev, chn);
+		if (err)
+			goto err_destroy_arena;
+
+		/* Elements of the following depths belong to the device or
+		 * channel just created, if any */
+		if (depth == 1) {
+			dev = NULL;
+			if (!strcmp(name, "device"))
+				dev = ctx->devices[ctx->nb_devices - 1];
 		}
 
-		devs = realloc(ctx->devices, (1 + ctx->nb_devices) *
-				sizeof(struct iio_device *));
-		if (!devs) {
-			IIO_ERROR("Unable to allocate memory\n");
-			free(dev);
-			goto err_free_devices;
+		if (depth <= 2) {
+			chn = NULL;
+			if (depth == 2 && dev && !strcmp(name, "channel"))
+				chn = dev->channels[dev->nb_channels - 1];
 		}
+	}
 
-		devs[ctx->nb_devices++] = dev;
-		ctx->devices = devs;
+	if (ret < 0) {
+		IIO_ERROR("Unable to parse XML file\n");
+		err = -EINVAL;
+		goto err_destroy_arena;
+	}
+
+	for (i = 0; i < ctx->nb_devices; i++) {
+		err = finalize_device(ctx->devices[i]);
+		if (err)
+			goto err_destroy_arena;
 	}
 
 	err = iio_context_init(ctx);
 	if (err)
-		goto err_free_devices;
+		goto err_destroy_arena;
 
 	return ctx;
 
-err_free_devices:
-	for (i = 0; i < ctx->nb_devices; i++)
-		free_device(ctx->devices[i]);
-	if (ctx->nb_devices)
-		free(ctx->devices);
-	for (i = 0; i < ctx->nb_attrs; i++) {
-		free(ctx->attrs[i]);
-		free(ctx->values[i]);
-	}
-	free(ctx->attrs);
-	free(ctx->values);
+err_destroy_arena:
+	iio_arena_destroy(ctx->arena);
 err_free_ctx:
 	free(ctx);
 err_set_errno:
@@ -461,37 +516,38 @@ err_set_errno:
 struct iio_context * xml_create_context(const char *xml_file)
 {
 	struct iio_context *ctx;
-	xmlDoc *doc;
+	xmlTextReaderPtr reader;
 
 	LIBXML_TEST_VERSION;
 
-	doc = xmlReadFile(xml_file, NULL, XML_PARSE_DTDVALID);
-	if (!doc) {
+	reader = xmlReaderForFile(xml_file, NULL, XML_PARSE_DTDVALID);
+	if (!reader) {
 		IIO_ERROR("Unable to parse XML file\n");
 		errno = EINVAL;
 		return NULL;
 	}
 
-	ctx = iio_create_xml_context_helper(doc);
-	xmlFreeDoc(doc);
+	ctx = iio_create_xml_context_helper(reader);
+	xmlFreeTextReader(reader);
 	return ctx;
 }
 
 struct iio_context * xml_create_context_mem(const char *xml, size_t len)
 {
 	struct iio_context *ctx;
-	xmlDoc *doc;
+	xmlTextReaderPtr reader;
 
 	LIBXML_TEST_VERSION;
 
-	doc = xmlReadMemory(xml, (int) len, NULL, NULL, XML_PARSE_DTDVALID);
-	if (!doc) {
+	reader = xmlReaderForMemory(xml, (int) len, NULL, NULL,
+			XML_PARSE_DTDVALID);
+	if (!reader) {
 		IIO_ERROR("Unable to parse XML file\n");
 		errno = EINVAL;
 		return NULL;
 	}
 
-	ctx = iio_create_xml_context_helper(doc);
-	xmlFreeDoc(doc);
+	ctx = iio_create_xml_context_helper(reader);
+	xmlFreeTextReader(reader);
 	return ctx;
 }